@@ -41,6 +41,7 @@
 #include "config.h"
 #include <dirent.h>
 #include <dlfcn.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -52,7 +53,10 @@
 #include "psetting.h"
 #include "plinkman.h"
 
+#include "cpiface/cpiface.h"
+#include "filesel/mdb.h"
 #include "stuff/compat.h"
+#include "stuff/err.h"
 
 static int handlecounter;
 static struct dll_handle loadlist[MAXDLLLIST];
@@ -171,6 +175,7 @@ static int lnkAppend (char *file, void *handle, uint32_t size, const struct link
 	loadlist[i].info = info;
 	loadlist[i].handle = handle;
 	loadlist[i].refcount = 1;
+	loadlist[i].record = 0;
 	loadlist[i].size = size;
 
 	loadlist_n ++;
@@ -249,6 +254,863 @@ static int lnkDoLoad(const char *file)
 	return retval;
 }
 
+/* Plugin manifest, so that player plugins do not need to be loaded at startup.
+ *
+ * The first time a plugin in the autoload directory is seen, it is loaded as
+ * normal and everything its PluginInit() registers is recorded. A plugin that
+ * has no other hooks, and only registers file types, file extensions and mdb
+ * detectors is lazy: on the next start the recorded file types and extensions
+ * are registered on its behalf without loading it, and a stub takes the place
+ * of its detectors. It is loaded the first time one of its file types is
+ * played, or when a file being probed reaches that stub. Any change to a plugin file, ocp.ini or the OCP version makes the
+ * plugin (or the whole manifest) to be recorded again.
+ */
+
+#define LNK_MANIFEST_SIG "OCPLNK1"
+
+struct lnk_record_type
+{
+	struct moduletype modtype;
+	char *interface;
+	char **description; /* zero terminated, as fsTypeRegister() expects */
+	const struct cpifaceplayerstruct *cp; /* the real one, once a lazy plugin is loaded */
+};
+
+struct lnk_record
+{
+	char *file; /* name inside the directory */
+	uint64_t size;
+	int64_t mtime;
+	int lazy;
+	int seen;      /* the file is still present */
+	int recording; /* PluginInit() has not been recorded yet */
+	int foreign;   /* PluginInit() used something that can not be recorded */
+	int stubbed;   /* lazy, and registered by stubs this time */
+	int loaded;    /* lazy plugin has been loaded, -1 if that failed */
+	uint32_t sortindex;
+	struct linkinfostruct info; /* only the strings, ver and sortindex for a lazy plugin that is not loaded */
+	char *name;
+	char *desc;
+	char *playername;
+	struct lnk_record_type *types;
+	int types_n;
+	char **exts;
+	int exts_n;
+	int detectors;
+	struct mdbreadinforegstruct **readinfos; /* the real ones, once a lazy plugin is loaded */
+	int readinfos_n;
+	struct mdbreadinforegstruct detector; /* stub for the detectors, the real ones are linked in behind it when loaded */
+	struct cpifaceplayerstruct stub;
+};
+
+static struct lnk_record **lnkRecords;
+static int lnkRecords_n;
+static int lnkRecordsDirty;
+static char *lnkManifestDir; /* the autoload directory the manifest describes, 0 if disabled */
+static struct PluginInitAPI_t *lnkPluginInitAPI; /* valid from lnkPluginInitAll() to lnkPluginCloseAll() */
+static struct lnk_record *lnkRecording; /* PluginInit() in progress */
+static struct lnk_record *lnkLoading; /* lazy PluginInit() in progress */
+static const struct cpifaceplayerstruct *lnkLazyCurrent; /* the real player behind a stub currently playing */
+
+static void lnk_record_free (struct lnk_record *r)
+{
+	int i, j;
+
+	for (i=0; i < r->types_n; i++)
+	{
+		free (r->types[i].interface);
+		for (j=0; r->types[i].description[j]; j++)
+		{
+			free (r->types[i].description[j]);
+		}
+		free (r->types[i].description);
+	}
+	free (r->types);
+	for (i=0; i < r->exts_n; i++)
+	{
+		free (r->exts[i]);
+	}
+	free (r->exts);
+	free (r->readinfos);
+	free (r->file);
+	free (r->name);
+	free (r->desc);
+	free (r->playername);
+	free (r);
+}
+
+static struct lnk_record *lnk_record_new (const char *file)
+{
+	struct lnk_record **temp;
+	struct lnk_record *r;
+
+	if (!(temp = realloc (lnkRecords, sizeof (lnkRecords[0]) * (lnkRecords_n + 1))))
+	{
+		return 0;
+	}
+	lnkRecords = temp;
+	if (!(r = calloc (1, sizeof (*r))))
+	{
+		return 0;
+	}
+	if (!(r->file = strdup (file)))
+	{
+		free (r);
+		return 0;
+	}
+	lnkRecords[lnkRecords_n++] = r;
+	return r;
+}
+
+static void lnk_record_remove (struct lnk_record *r)
+{
+	int i;
+
+	for (i=0; i < lnkRecords_n; i++)
+	{
+		if (lnkRecords[i] == r)
+		{
+			memmove (lnkRecords + i, lnkRecords + i + 1, sizeof (lnkRecords[0]) * (lnkRecords_n - i - 1));
+			lnkRecords_n--;
+			break;
+		}
+	}
+	lnk_record_free (r);
+	lnkRecordsDirty = 1;
+}
+
+static int lnk_record_add_type (struct lnk_record *r, struct moduletype modtype, const char *interface)
+{
+	struct lnk_record_type *temp;
+
+	if (!(temp = realloc (r->types, sizeof (r->types[0]) * (r->types_n + 1))))
+	{
+		return -1;
+	}
+	r->types = temp;
+	memset (r->types + r->types_n, 0, sizeof (r->types[0]));
+	r->types[r->types_n].modtype = modtype;
+	r->types[r->types_n].interface = strdup (interface ? interface : "");
+	r->types[r->types_n].description = calloc (1, sizeof (char *));
+	if ((!r->types[r->types_n].interface) || (!r->types[r->types_n].description))
+	{
+		free (r->types[r->types_n].interface);
+		free (r->types[r->types_n].description);
+		return -1;
+	}
+	r->types_n++;
+	return 0;
+}
+
+static int lnk_record_add_line (struct lnk_record_type *t, const char *line)
+{
+	char **temp;
+	int n;
+
+	for (n=0; t->description[n]; n++)
+	{
+	}
+	if (!(temp = realloc (t->description, sizeof (t->description[0]) * (n + 2))))
+	{
+		return -1;
+	}
+	t->description = temp;
+	if (!(t->description[n] = strdup (line)))
+	{
+		return -1;
+	}
+	t->description[n + 1] = 0;
+	return 0;
+}
+
+static int lnk_record_add_ext (struct lnk_record *r, const char *ext)
+{
+	char **temp;
+
+	if (!(temp = realloc (r->exts, sizeof (r->exts[0]) * (r->exts_n + 1))))
+	{
+		return -1;
+	}
+	r->exts = temp;
+	if (!(r->exts[r->exts_n] = strdup (ext)))
+	{
+		return -1;
+	}
+	r->exts_n++;
+	return 0;
+}
+
+static int lnk_record_set_string (char **dst, const char *src)
+{
+	free (*dst);
+	*dst = strdup (src ? src : "");
+	return *dst ? 0 : -1;
+}
+
+static void lnk_record_set_info (struct lnk_record *r)
+{
+	memset (&r->info, 0, sizeof (r->info));
+	r->info.name = r->name;
+	r->info.desc = r->desc;
+	r->info.ver = DLLVERSION;
+	r->info.sortindex = r->sortindex;
+}
+
+static void lnk_set_record (int id, struct lnk_record *r)
+{
+	int i;
+
+	for (i=0; i < loadlist_n; i++)
+	{
+		if (loadlist[i].id == id)
+		{
+			loadlist[i].record = r;
+			return;
+		}
+	}
+}
+
+static int64_t lnk_config_mtime (void)
+{
+	struct stat st;
+	char *path;
+	int64_t retval = 0;
+
+	if (makepath_malloc (&path, 0, cfConfigDir, "ocp.ini", 0))
+	{
+		return 0;
+	}
+	if (!stat (path, &st))
+	{
+		retval = st.st_mtime;
+	}
+	free (path);
+	return retval;
+}
+
+static char *lnk_manifest_path (void)
+{
+	char *path;
+
+	if (makepath_malloc (&path, 0, cfConfigDir, "plugins.manifest", 0))
+	{
+		return 0;
+	}
+	return path;
+}
+
+/* reads the remainder of a line, without the newline */
+static const char *lnk_manifest_arg (char *line, const char *key)
+{
+	size_t len = strlen (key);
+
+	if (strncmp (line, key, len) || (line[len] != ' '))
+	{
+		return 0;
+	}
+	line[strcspn (line, "\r\n")] = 0;
+	return line + len + 1;
+}
+
+static void lnk_manifest_load (const char *dir)
+{
+	char line[1024];
+	const char *arg;
+	char *path;
+	FILE *f;
+	struct lnk_record *r = 0;
+	int ok = 0;
+
+	if (!(path = lnk_manifest_path ()))
+	{
+		return;
+	}
+	f = fopen (path, "r");
+	free (path);
+	if (!f)
+	{
+		return;
+	}
+
+	/* header, any mismatch means that all plugins are recorded again */
+	if ((!fgets (line, sizeof (line), f)) || strncmp (line, LNK_MANIFEST_SIG "\n", strlen (LNK_MANIFEST_SIG) + 1))
+	{
+		goto out;
+	}
+	if ((!fgets (line, sizeof (line), f)) || (!(arg = lnk_manifest_arg (line, "version"))) || (strtoul (arg, 0, 16) != DLLVERSION))
+	{
+		goto out;
+	}
+	if ((!fgets (line, sizeof (line), f)) || (!(arg = lnk_manifest_arg (line, "dir"))) || strcmp (arg, dir))
+	{
+		goto out;
+	}
+	if ((!fgets (line, sizeof (line), f)) || (!(arg = lnk_manifest_arg (line, "config"))) || (strtoll (arg, 0, 10) != lnk_config_mtime ()))
+	{
+		goto out;
+	}
+
+	while (fgets (line, sizeof (line), f))
+	{
+		if ((arg = lnk_manifest_arg (line, "plugin")))
+		{
+			uint64_t size;
+			int64_t mtime;
+			int lazy, n;
+
+			if ((sscanf (arg, "%"SCNu64" %"SCNd64" %d %n", &size, &mtime, &lazy, &n) != 3) || (!arg[n]))
+			{
+				goto out;
+			}
+			if (!(r = lnk_record_new (arg + n)))
+			{
+				goto out;
+			}
+			r->size = size;
+			r->mtime = mtime;
+			r->lazy = lazy;
+			lnk_record_set_string (&r->name, "");
+			lnk_record_set_string (&r->desc, "");
+		} else if (!r)
+		{
+			goto out;
+		} else if ((arg = lnk_manifest_arg (line, "sortindex")))
+		{
+			r->sortindex = strtoul (arg, 0, 10);
+		} else if ((arg = lnk_manifest_arg (line, "name")))
+		{
+			if (lnk_record_set_string (&r->name, arg)) goto out;
+		} else if ((arg = lnk_manifest_arg (line, "desc")))
+		{
+			if (lnk_record_set_string (&r->desc, arg)) goto out;
+		} else if ((arg = lnk_manifest_arg (line, "player")))
+		{
+			if (lnk_record_set_string (&r->playername, arg)) goto out;
+		} else if ((arg = lnk_manifest_arg (line, "ext")))
+		{
+			if (lnk_record_add_ext (r, arg)) goto out;
+		} else if ((arg = lnk_manifest_arg (line, "type")))
+		{
+			struct moduletype modtype;
+			int n;
+
+			if ((sscanf (arg, "%"SCNx32" %n", &modtype.integer.i, &n) != 1) || lnk_record_add_type (r, modtype, arg + n))
+			{
+				goto out;
+			}
+		} else if ((arg = lnk_manifest_arg (line, "line")))
+		{
+			if ((!r->types_n) || lnk_record_add_line (r->types + r->types_n - 1, arg)) goto out;
+		} else if ((arg = lnk_manifest_arg (line, "detectors")))
+		{
+			r->detectors = strtol (arg, 0, 10);
+		} else {
+			goto out;
+		}
+	}
+	ok = 1;
+out:
+	fclose (f);
+	if (!ok)
+	{
+		while (lnkRecords_n)
+		{
+			lnk_record_free (lnkRecords[--lnkRecords_n]);
+		}
+	}
+	for (ok=0; ok < lnkRecords_n; ok++)
+	{
+		lnk_record_set_info (lnkRecords[ok]);
+	}
+}
+
+static void lnk_manifest_store (void)
+{
+	char *path, *temppath;
+	FILE *f;
+	int i, j, k;
+
+	if (!(path = lnk_manifest_path ()))
+	{
+		return;
+	}
+	if (!(temppath = malloc (strlen (path) + 5)))
+	{
+		free (path);
+		return;
+	}
+	sprintf (temppath, "%s.new", path);
+	if (!(f = fopen (temppath, "w")))
+	{
+		free (temppath);
+		free (path);
+		return;
+	}
+
+	fprintf (f, LNK_MANIFEST_SIG "\n");
+	fprintf (f, "version %x\n", DLLVERSION);
+	fprintf (f, "dir %s\n", lnkManifestDir);
+	fprintf (f, "config %"PRId64"\n", lnk_config_mtime ());
+	for (i=0; i < lnkRecords_n; i++)
+	{
+		struct lnk_record *r = lnkRecords[i];
+
+		if (r->recording)
+		{ /* failed to load, try again next time */
+			continue;
+		}
+		fprintf (f, "plugin %"PRIu64" %"PRId64" %d %s\n", r->size, r->mtime, r->lazy, r->file);
+		fprintf (f, "sortindex %"PRIu32"\n", r->sortindex);
+		fprintf (f, "name %s\n", r->name ? r->name : "");
+		fprintf (f, "desc %s\n", r->desc ? r->desc : "");
+		if (r->playername)
+		{
+			fprintf (f, "player %s\n", r->playername);
+		}
+		for (j=0; j < r->exts_n; j++)
+		{
+			fprintf (f, "ext %s\n", r->exts[j]);
+		}
+		for (j=0; j < r->types_n; j++)
+		{
+			fprintf (f, "type %08"PRIx32" %s\n", r->types[j].modtype.integer.i, r->types[j].interface);
+			for (k=0; r->types[j].description[k]; k++)
+			{
+				fprintf (f, "line %s\n", r->types[j].description[k]);
+			}
+		}
+		fprintf (f, "detectors %d\n", r->detectors);
+	}
+
+	if (fclose (f) || rename (temppath, path))
+	{
+		unlink (temppath);
+	}
+	lnkRecordsDirty = 0;
+	free (temppath);
+	free (path);
+}
+
+/* The API given to PluginInit() of plugins that are loaded at startup, records what is registered */
+static void lnk_record_mdbRegisterReadInfo (struct mdbreadinforegstruct *r)
+{
+	lnkRecording->detectors++;
+	lnkPluginInitAPI->mdbRegisterReadInfo (r);
+}
+
+static void lnk_record_fsTypeRegister (struct moduletype modtype, const char **description, const char *interface, const struct cpifaceplayerstruct *cp)
+{
+	struct lnk_record *r = lnkRecording;
+
+	if (lnk_record_add_type (r, modtype, interface))
+	{
+		r->foreign = 1;
+	} else if (description)
+	{
+		int i;
+		for (i=0; description[i]; i++)
+		{
+			if (lnk_record_add_line (r->types + r->types_n - 1, description[i]))
+			{
+				r->foreign = 1;
+			}
+		}
+	}
+	if (cp && (!r->playername))
+	{
+		lnk_record_set_string (&r->playername, cp->playername);
+	} else if (cp && r->playername && strcmp (r->playername, cp->playername ? cp->playername : ""))
+	{ /* the stub can only give one name */
+		r->foreign = 1;
+	}
+	lnkPluginInitAPI->fsTypeRegister (modtype, description, interface, cp);
+}
+
+static void lnk_record_fsRegisterExt (const char *ext)
+{
+	if (lnk_record_add_ext (lnkRecording, ext))
+	{
+		lnkRecording->foreign = 1;
+	}
+	lnkPluginInitAPI->fsRegisterExt (ext);
+}
+
+static void lnk_record_filesystem_setup_register_file (struct ocpfile_t *file)
+{
+	lnkRecording->foreign = 1;
+	lnkPluginInitAPI->filesystem_setup_register_file (file);
+}
+
+static struct ocpfile_t *lnk_record_dev_file_create
+(
+	struct ocpdir_t *parent,
+	const char *devname,
+	const char *mdbtitle,
+	const char *mdbcomposer,
+	void *token,
+	int  (*Init)       (void **token, struct moduleinfostruct *info, struct ocpfilehandle_t *f, const struct DevInterfaceAPI_t *API),
+	void (*Run)        (void **token,                                                           const struct DevInterfaceAPI_t *API),
+	void (*Close)      (void **token,                                                           const struct DevInterfaceAPI_t *API),
+	void (*Destructor) (void  *token)
+)
+{
+	lnkRecording->foreign = 1;
+	return lnkPluginInitAPI->dev_file_create (parent, devname, mdbtitle, mdbcomposer, token, Init, Run, Close, Destructor);
+}
+
+static int lnk_record_plugininit (int i)
+{
+	struct PluginInitAPI_t API = *lnkPluginInitAPI;
+	const struct linkinfostruct *info = loadlist[i].info;
+	struct lnk_record *r = loadlist[i].record;
+	int retval;
+
+	API.mdbRegisterReadInfo = lnk_record_mdbRegisterReadInfo;
+	API.fsTypeRegister = lnk_record_fsTypeRegister;
+	API.fsRegisterExt = lnk_record_fsRegisterExt;
+	API.filesystem_setup_register_file = lnk_record_filesystem_setup_register_file;
+	API.dev_file_create = lnk_record_dev_file_create;
+
+	lnkRecording = r;
+	retval = info->PluginInit ? info->PluginInit (&API) : 0;
+	lnkRecording = 0;
+
+	r->recording = 0;
+	lnk_record_set_string (&r->name, info->name);
+	lnk_record_set_string (&r->desc, info->desc);
+	r->lazy = (!r->foreign) &&
+	          r->types_n &&
+	          (!info->PreInit) && (!info->Init) && (!info->LateInit) &&
+	          (!info->PreClose) && (!info->Close) && (!info->LateClose) &&
+	          (!dlsym (loadlist[i].handle, "dllinfo"));
+	r->sortindex = info->sortindex;
+	lnk_record_set_info (r);
+	lnkRecordsDirty = 1;
+
+	return retval;
+}
+
+/* The API given to PluginInit() of a lazy plugin when it is loaded. The file types and detectors are already registered by stubs, so only take a note of the real ones */
+static void lnk_lazy_mdbRegisterReadInfo (struct mdbreadinforegstruct *r)
+{
+	struct mdbreadinforegstruct **temp;
+
+	if (!(temp = realloc (lnkLoading->readinfos, sizeof (lnkLoading->readinfos[0]) * (lnkLoading->readinfos_n + 1))))
+	{
+		return;
+	}
+	lnkLoading->readinfos = temp;
+	lnkLoading->readinfos[lnkLoading->readinfos_n++] = r;
+}
+
+static void lnk_lazy_fsTypeRegister (struct moduletype modtype, const char **description, const char *interface, const struct cpifaceplayerstruct *cp)
+{
+	int i;
+
+	for (i=0; i < lnkLoading->types_n; i++)
+	{
+		if (lnkLoading->types[i].modtype.integer.i == modtype.integer.i)
+		{
+			lnkLoading->types[i].cp = cp;
+			return;
+		}
+	}
+	lnkPluginInitAPI->fsTypeRegister (modtype, description, interface, cp);
+}
+
+/* The real detectors are linked in behind the stub, in the order mdbRegisterReadInfo() would have put them. The medialib
+ * scanner threads can walk the list meanwhile, so the new entries are complete before they are linked in, and the stub
+ * is flagged MDB_READINFO_THREADSAFE last: a thread that sees the flag also sees the new link. Until then, the scanner
+ * stops at the stub and leaves the rest to the main thread */
+static void lnk_lazy_link (struct lnk_record *r)
+{
+	struct mdbreadinforegstruct *next = r->detector.next;
+	int i;
+
+	if (r->loaded > 0)
+	{
+		for (i=0; i < r->readinfos_n; i++)
+		{
+			r->readinfos[i]->next = next;
+			next = r->readinfos[i];
+		}
+		__atomic_store_n (&r->detector.next, next, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n (&r->detector.flags, MDB_READINFO_THREADSAFE, __ATOMIC_RELEASE);
+}
+
+/* dlopen() and PluginInit() must only happen on the main thread */
+static int lnk_lazy_load_plugin (struct lnk_record *r)
+{
+	struct PluginInitAPI_t API;
+	const struct linkinfostruct *info;
+	void *handle;
+	int i;
+
+	r->loaded = -1;
+
+	if (!lnkPluginInitAPI)
+	{
+		return -1;
+	}
+	for (i=0; i < loadlist_n; i++)
+	{
+		if (loadlist[i].record == r)
+		{
+			break;
+		}
+	}
+	if (i >= loadlist_n)
+	{
+		return -1;
+	}
+#ifdef LD_DEBUG
+	fprintf(stderr, "[lnk] Loading lazy plugin %s\n", loadlist[i].file);
+#endif
+	if (!(handle = dlopen (loadlist[i].file, RTLD_NOW|RTLD_GLOBAL)))
+	{
+		fprintf (stderr, "%s\n", dlerror());
+		return -1;
+	}
+	if ((!(info = (const struct linkinfostruct *)dlsym (handle, "dllextinfo"))) || (!info->PluginInit))
+	{
+		fprintf (stderr, "lnk_lazy_load(%s): dlsym(dllextinfo): %s\n", loadlist[i].file, dlerror());
+		dlclose (handle);
+		return -1;
+	}
+	loadlist[i].handle = handle;
+	loadlist[i].info = info;
+
+	API = *lnkPluginInitAPI;
+	API.mdbRegisterReadInfo = lnk_lazy_mdbRegisterReadInfo;
+	API.fsTypeRegister = lnk_lazy_fsTypeRegister;
+	lnkLoading = r;
+	if (info->PluginInit (&API) < 0)
+	{
+		lnkLoading = 0;
+		return -1;
+	}
+	lnkLoading = 0;
+	r->loaded = 1;
+	return 0;
+}
+
+static int lnk_lazy_load (struct lnk_record *r)
+{
+	int retval;
+
+	if (r->loaded)
+	{
+		return (r->loaded > 0) ? 0 : -1;
+	}
+	retval = lnk_lazy_load_plugin (r);
+	if (r->detectors)
+	{
+		lnk_lazy_link (r);
+	}
+	return retval;
+}
+
+static struct lnk_record *lnk_lazy_find (struct moduletype modtype, struct lnk_record_type **type)
+{
+	int i, j;
+
+	for (i=0; i < lnkRecords_n; i++)
+	{
+		if (!lnkRecords[i]->stubbed)
+		{
+			continue;
+		}
+		for (j=0; j < lnkRecords[i]->types_n; j++)
+		{
+			if (lnkRecords[i]->types[j].modtype.integer.i == modtype.integer.i)
+			{
+				*type = lnkRecords[i]->types + j;
+				return lnkRecords[i];
+			}
+		}
+	}
+	return 0;
+}
+
+static int lnk_lazy_OpenFile (struct cpifaceSessionAPI_t *cpifaceSession, struct moduleinfostruct *info, struct ocpfilehandle_t *f)
+{
+	struct lnk_record_type *type = 0;
+	struct lnk_record *r = lnk_lazy_find (info->modtype, &type);
+	int failed;
+
+	if (!r)
+	{
+		return errGen;
+	}
+	failed = lnk_lazy_load (r);
+	if (failed || (!type->cp) || (!type->cp->OpenFile))
+	{
+		return errGen;
+	}
+
+	lnkLazyCurrent = type->cp;
+	return type->cp->OpenFile (cpifaceSession, info, f);
+}
+
+static void lnk_lazy_CloseFile (struct cpifaceSessionAPI_t *cpifaceSession)
+{
+	if (lnkLazyCurrent)
+	{
+		lnkLazyCurrent->CloseFile (cpifaceSession);
+		lnkLazyCurrent = 0;
+	}
+}
+
+/* Stands in for the detectors of a lazy plugin, where the plugin would have registered them. The detectors look at the
+ * content of the file and not only at its name, so the first time a file gets this far, every lazy plugin that has
+ * detectors is loaded, as on a normal start. Their detectors are then linked in behind their stubs, and mdbReadInfo()
+ * runs them as it continues down the list */
+static int lnk_lazy_ReadInfo (struct moduleinfostruct *m, struct ocpfilehandle_t *f, const char *buf, size_t len, const struct mdbReadInfoAPI_t *API)
+{
+	int i;
+
+	for (i=0; i < loadlist_n; i++)
+	{
+		struct lnk_record *r = loadlist[i].record;
+		if (r && r->stubbed && r->detectors)
+		{
+			lnk_lazy_load (r);
+		}
+	}
+	return 0;
+}
+
+static void lnk_lazy_register (struct lnk_record *r)
+{
+	int i;
+
+	r->stubbed = 1;
+	r->stub.playername = r->playername ? r->playername : r->name;
+	r->stub.OpenFile = lnk_lazy_OpenFile;
+	r->stub.CloseFile = lnk_lazy_CloseFile;
+
+	for (i=0; i < r->exts_n; i++)
+	{
+		lnkPluginInitAPI->fsRegisterExt (r->exts[i]);
+	}
+	for (i=0; i < r->types_n; i++)
+	{
+		lnkPluginInitAPI->fsTypeRegister (r->types[i].modtype, (const char **)r->types[i].description, r->types[i].interface, &r->stub);
+	}
+	if (r->detectors)
+	{
+		r->detector.name = r->name;
+		r->detector.ReadInfo = lnk_lazy_ReadInfo;
+		r->detector.flags = 0;
+		lnkPluginInitAPI->mdbRegisterReadInfo (&r->detector);
+	}
+}
+
+/* The API given to PluginClose() of a lazy plugin, the stubs of the file types are unregistered instead of the real ones.
+ * The real detectors are in the list behind the stub of the detectors, and are unregistered as normal */
+static struct PluginCloseAPI_t *lnkPluginCloseAPI;
+
+static void lnk_lazy_fsTypeUnregister (struct moduletype modtype)
+{
+	int i;
+
+	for (i=0; i < lnkLoading->types_n; i++)
+	{
+		if (lnkLoading->types[i].modtype.integer.i == modtype.integer.i)
+		{
+			return;
+		}
+	}
+	lnkPluginCloseAPI->fsTypeUnregister (modtype);
+}
+
+static void lnk_lazy_close (int i, struct PluginCloseAPI_t *API)
+{
+	struct lnk_record *r = loadlist[i].record;
+	int j;
+
+	if (r->loaded > 0)
+	{
+		struct PluginCloseAPI_t LazyAPI = *API;
+
+		if (loadlist[i].info->PluginClose)
+		{
+			LazyAPI.fsTypeUnregister = lnk_lazy_fsTypeUnregister;
+			lnkPluginCloseAPI = API;
+			lnkLoading = r;
+			loadlist[i].info->PluginClose (&LazyAPI);
+			lnkLoading = 0;
+			lnkPluginCloseAPI = 0;
+		}
+	}
+	for (j=0; j < r->types_n; j++)
+	{
+		API->fsTypeUnregister (r->types[j].modtype);
+		r->types[j].cp = 0;
+	}
+	if (r->detectors)
+	{
+		API->mdbUnregisterReadInfo (&r->detector);
+	}
+	free (r->readinfos);
+	r->readinfos = 0;
+	r->readinfos_n = 0;
+}
+
+/* like _lnkDoLoad(), but lazy plugins from the manifest are only added to the list */
+static int lnk_link_recorded (char *path, const char *file)
+{
+	struct lnk_record *r = 0;
+	struct stat st;
+	int i, id;
+
+	for (i=0; i < lnkRecords_n; i++)
+	{
+		if (!strcmp (lnkRecords[i]->file, file))
+		{
+			r = lnkRecords[i];
+			break;
+		}
+	}
+	if (stat (path, &st))
+	{
+		return _lnkDoLoad (path);
+	}
+	if (r && ((r->size != (uint64_t)st.st_size) || (r->mtime != (int64_t)st.st_mtime)))
+	{
+		lnk_record_remove (r);
+		r = 0;
+	}
+	if (r && r->lazy)
+	{
+		r->seen = 1;
+		if ((id = lnkAppend (path, 0, st.st_size, &r->info)) >= 0)
+		{
+			lnk_set_record (id, r);
+		}
+		return id;
+	}
+
+	if ((id = _lnkDoLoad (path)) < 0)
+	{
+		return id;
+	}
+	if ((!r) && (r = lnk_record_new (file)))
+	{
+		r->size = st.st_size;
+		r->mtime = st.st_mtime;
+		r->recording = 1;
+		lnkRecordsDirty = 1;
+	}
+	if (r)
+	{
+		r->seen = 1;
+		lnk_set_record (id, r);
+	}
+	return id;
+}
+
 #ifdef HAVE_QSORT
 static int cmpstringp(const void *p1, const void *p2)
 {
@@ -289,6 +1151,7 @@ int lnkLinkDir(const char *dir)
 	char *filenames[1024];
 	char *buffer;
 	int files=0;
+	int manifest;
 	int n;
 	if (!(d=opendir(dir)))
 	{
@@ -318,10 +1181,16 @@ int lnkLinkDir(const char *dir)
 #else
 	bsort(filenames, files);
 #endif
+	if ((!lnkManifestDir) && cfGetProfileBool("general", "lazyplugins", 1, 1))
+	{
+		if ((lnkManifestDir = strdup (dir)))
+			lnk_manifest_load (dir);
+	}
+	manifest = lnkManifestDir && !strcmp (lnkManifestDir, dir);
 	for (n=0;n<files;n++)
 	{
 		makepath_malloc (&buffer, 0, dir, filenames[n], 0);
-		if (_lnkDoLoad(buffer)<0) // steals the string
+		if ((manifest ? lnk_link_recorded(buffer, filenames[n]) : _lnkDoLoad(buffer))<0) // steals the string
 		{
 			for (;n<files;n++)
 				free(filenames[n]);
@@ -329,6 +1198,12 @@ int lnkLinkDir(const char *dir)
 		}
 		free (filenames[n]);
 	}
+	if (manifest)
+	{
+		for (n=lnkRecords_n-1;n>=0;n--)
+			if (!lnkRecords[n]->seen)
+				lnk_record_remove (lnkRecords[n]);
+	}
 	return 0; /* all okey */
 }
 
@@ -361,12 +1236,18 @@ void lnkFree(const int id)
 		for (i=loadlist_n-1;i>=0;i--)
 		{
 #ifndef NO_DLCLOSE
-			if (loadlist[i].handle) /* this happens for static plugins */
+			if (loadlist[i].handle) /* this happens for static plugins, and lazy plugins that were never loaded */
 				dlclose(loadlist[i].handle);
 #endif
 			free (loadlist[i].file);
 		}
 		loadlist_n=0;
+		while (lnkRecords_n)
+			lnk_record_free (lnkRecords[--lnkRecords_n]);
+		free (lnkRecords);
+		lnkRecords=0;
+		free (lnkManifestDir);
+		lnkManifestDir=0;
 	} else {
 		for (i=loadlist_n-1;i>=0;i--)
 			if (loadlist[i].id==id)
@@ -484,10 +1365,25 @@ int lnkPluginInitAll (struct PluginInitAPI_t *API)
 {
 	int i;
 
+	lnkPluginInitAPI=API;
+
 	for (i=0;i<loadlist_n;i++)
-		if (loadlist[i].info->PluginInit)
+	{
+		struct lnk_record *r=loadlist[i].record;
+
+		if (r && r->lazy && !r->recording)
+			lnk_lazy_register(r);
+		else if (r && r->recording)
+		{
+			if (lnk_record_plugininit(i)<0)
+				return 1;
+		} else if (loadlist[i].info->PluginInit)
 			if (loadlist[i].info->PluginInit(API)<0)
 				return 1;
+	}
+
+	if (lnkRecordsDirty)
+		lnk_manifest_store();
 
 	return 0;
 }
@@ -497,8 +1393,12 @@ void lnkPluginCloseAll (struct PluginCloseAPI_t *API)
 	int i;
 
 	for (i=0;i<loadlist_n;i++)
-		if (loadlist[i].info->PluginClose)
+		if (loadlist[i].record && loadlist[i].record->stubbed)
+			lnk_lazy_close(i, API);
+		else if (loadlist[i].info->PluginClose)
 			loadlist[i].info->PluginClose(API);
+
+	lnkPluginInitAPI=0;
 }
 
 void lnkCloseAll (void)
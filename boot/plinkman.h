@@ -60,14 +60,16 @@ struct __attribute__ ((aligned (64))) linkinfostruct
 	void (*LateClose)(void); /* low priority Close */
 };
 
+struct lnk_record;
 struct dll_handle
 {
-	void *handle;
+	void *handle; /* 0 for static plugins, and lazy plugins that are not loaded yet */
 	char *file;
 	int id;
 	int refcount;
 	uint32_t size;
 	const struct linkinfostruct *info;
+	struct lnk_record *record; /* plugins in the autoload directory, see the manifest in plinkman.c */
 };
 extern int loadlist_n;
 
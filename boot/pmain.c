@@ -90,6 +90,10 @@ static int cmdhlp(void)
 		printf("     8            : play/sample/mix as 8bit\n");
 		printf("     m            : play/sample/mix mono\n");
 		printf("-p                : quit when playlist is empty\n");
+		printf("--render          : render the given files to .wav as fast as possible, without\n");
+		printf("                    any user interface (uses the disk writer)\n");
+		printf("-j{0..64}         : number of files to render in parallel with --render (0=one\n");
+		printf("                    per cpu core)\n");
 		printf("-d : force display driver\n");
 		printf("     curses       : ncurses driver\n");
 #ifdef HAVE_X11
@@ -106,6 +110,8 @@ static int cmdhlp(void)
 #endif
 		printf("\nExample : ocp -fl0,r1 -vf2 -spdevpdisk -sr48000 ftstar.xm\n");
 		printf("          (for nice HD rendering of modules)\n");
+		printf("          ocp --render -j0 -sr48000 *.xm\n");
+		printf("          (the same for many modules at once, using all cpu cores)\n");
 		return errHelpPrinted;
 	}
 	return errOk;
@@ -61,7 +61,9 @@
 #include "cpipic.h"
 #include "cpiptype.h"
 #include "dev/mcp.h"
+#include "dev/resample.h"
 #include "dev/ringbuffer.h"
+#include "dev/smpcache.h"
 #include "dev/player.h"
 #include "filesel/dirdb.h"
 #include "filesel/filesystem.h"
@@ -116,7 +118,9 @@ static struct mcpAPI_t mcpAPI =
 	mcpGetFreq6848,
 	mcpGetFreq8363,
 	mcpGetNote6848,
-	mcpGetNote8363
+	mcpGetNote8363,
+	mcpSampleCacheKey,
+	mcpSampleCacheSelect
 };
 
 static struct drawHelperAPI_t drawHelperAPI =
@@ -2139,8 +2143,10 @@ static void plmpClose (void)
 }
 
 static int plmpInited = 0;
+static int plmpHeadless = 0; /* --render */
 static int plmpLateInit(void)
 {
+	plmpHeadless=cfGetProfileBool("CommandLine--", "render", 0, 0);
 	plCompoMode=cfGetProfileBool2(cfScreenSec, "screen", "compomode", 0, 0);
 	strncpy(curmodehandle, cfGetProfileString2(cfScreenSec, "screen", "startupmode", "text"), 8);
 	curmodehandle[8]=0;
@@ -2221,6 +2227,7 @@ static int plmpOpenFile(struct moduleinfostruct *info, struct ocpfilehandle_t *f
 
 	cpifaceSessionAPI.Public.plrDevAPI = plrDevAPI;
 	cpifaceSessionAPI.Public.ringbufferAPI = &ringbufferAPI;
+	cpifaceSessionAPI.Public.resampleAPI = &resampleAPI;
 	cpifaceSessionAPI.Public.mcpAPI = &mcpAPI;
 	cpifaceSessionAPI.Public.mcpDevAPI = mcpDevAPI;
 	cpifaceSessionAPI.Public.drawHelperAPI = &drawHelperAPI;
@@ -2287,7 +2294,10 @@ static int plmpOpenFile(struct moduleinfostruct *info, struct ocpfilehandle_t *f
 		return 0;
 	}
 
-	pollInit (cpifaceIdle);
+	if (!plmpHeadless)
+	{
+		pollInit (cpifaceIdle);
+	}
 
 	for (mod=cpiDefModes; mod; mod=mod->nextdef)
 		cpiRegisterMode(mod);
@@ -2449,7 +2459,8 @@ void cpiForwardIProcessKey (struct cpifaceSessionAPI_t *cpifaceSession, uint16_t
 	}
 }
 
-static interfaceReturnEnum plmpDrawScreen(void)
+/* called with tmSetSecure() held, *wait is set if framelock() should be called afterwards */
+static interfaceReturnEnum plmpDrawScreenLocked(int *wait)
 {
 	struct cpimoderegstruct *mod;
 	static int plInKeyboardHelp = 0;
@@ -2463,6 +2474,8 @@ static interfaceReturnEnum plmpDrawScreen(void)
 		}
 	}
 
+	fsPrefetchIdle ();
+
 	for (mod=cpiModes; mod; mod=mod->next)
 	{
 		mod->Event (&cpifaceSessionAPI.Public, cpievKeepalive);
@@ -2479,7 +2492,7 @@ static interfaceReturnEnum plmpDrawScreen(void)
 		{
 			curmode->SetMode(); /* force complete redraw */
 		} else {
-			framelock();
+			*wait = 1;
 		}
 		return interfaceReturnContinue;
 	}
@@ -2637,22 +2650,94 @@ static interfaceReturnEnum plmpDrawScreen(void)
 
 superbreak:
 	curmode->Draw(&cpifaceSessionAPI.Public);
-	framelock();
+	*wait = 1;
 
 	cpifaceSessionAPI.Public.SelectedChannelChanged = 0;
 
 	return interfaceReturnContinue;
 }
 
+/* The audio render thread (if enabled) is only held off while the player state is read or changed. Showing the
+ * last frame, polling the keyboard and sleeping in framelock() does not touch the player.
+ */
+static interfaceReturnEnum plmpDrawScreen(void)
+{
+	interfaceReturnEnum retval;
+	int wait = 0;
+
+	Console.KeyboardHit();
+
+	tmSetSecure();
+	retval = plmpDrawScreenLocked (&wait);
+	tmReleaseSecure();
+
+	if (wait)
+	{
+		framelock();
+	}
+	return retval;
+}
+
+static int plmpRenderLimitReached;
+static void plmpRenderLimit (void *arg, int samples_ago)
+{
+	plmpRenderLimitReached = 1;
+}
+
+/* With --render there is no screen or keyboard, and the disk writer does not have to wait for anything. Service the
+ * player back to back instead of once per frame, so it runs as fast as the player and mixer can produce data.
+ */
+static interfaceReturnEnum plmpRenderHeadless(void)
+{
+	int maxlength = cfGetProfileInt("devpDisk", "maxlength", 600, 10); /* seconds, for modules that never end */
+
+	if (maxlength < 1)
+	{
+		maxlength = 1;
+	}
+	if (maxlength > 3600)
+	{
+		maxlength = 3600;
+	}
+	plmpRenderLimitReached = 0;
+	if (plrDevAPI)
+	{
+		plrDevAPI->OnBufferCallback (-maxlength * (int)plrDevAPI->GetRate(), plmpRenderLimit, 0);
+	}
+
+	while (cpifaceSessionAPI.Public.IsEnd && !plmpRenderLimitReached)
+	{
+		if (cpifaceSessionAPI.Public.IsEnd (&cpifaceSessionAPI.Public, 0))
+		{
+			break;
+		}
+	}
+	if (plmpRenderLimitReached)
+	{
+		fprintf(stderr, "[cpiface]: stopped after %d seconds, see [devpDisk] maxlength\n", maxlength);
+	}
+
+	return interfaceReturnNextAuto;
+}
+
 static interfaceReturnEnum plmpCallBack(void)
 {
 	interfaceReturnEnum stop;
 
+	if (plmpHeadless)
+	{
+		return plmpRenderHeadless();
+	}
+
+	tmSetSecure();
 	plmpOpenScreen();
+	tmReleaseSecure();
 	stop=interfaceReturnContinue;
 	while (!stop)
 		stop=plmpDrawScreen();
+	tmSetSecure();
 	plmpCloseScreen();
+	tmReleaseSecure();
 	return stop;
 }
 
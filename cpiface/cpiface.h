@@ -24,6 +24,7 @@ struct configAPI_t;
 struct dirdbAPI_t;
 #include "filesel/mdb.h" /* struct moduleinfostruct; */
 struct ocpfilehandle_t;
+struct resampleAPI_t;
 struct ringbufferAPI_t;
 struct plrDevAPI_t;
 struct mcpAPI_t;
@@ -224,6 +225,8 @@ struct mcpAPI_t
 	int (*GetFreq8363) (int note);
 	int (*GetNote6848) (int freq);
 	int (*GetNote8363) (int freq);
+	uint64_t (*SampleCacheKey) (struct ocpfilehandle_t *file, uint32_t modtype); /* 0 if the sample cache is disabled */
+	void (*SampleCacheSelect) (uint64_t key, int (*decode)(void *token), void *token); /* call right before mcpDevAPI->LoadSamples() */
 };
 
 struct drawHelperAPI_t
@@ -265,6 +268,7 @@ struct cpifaceSessionAPI_t
 	const struct plrDevAPI_t        *plrDevAPI;
 	const struct mcpDevAPI_t        *mcpDevAPI;
 	const struct ringbufferAPI_t    *ringbufferAPI;
+	const struct resampleAPI_t      *resampleAPI;
 	const struct mcpAPI_t           *mcpAPI;
 	const struct drawHelperAPI_t    *drawHelperAPI;
 	const struct configAPI_t        *configAPI;
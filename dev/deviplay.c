@@ -354,6 +354,10 @@ static int playdevinit(void)
 	defplaydev=0;
 
 	def=cfGetProfileString("commandline_s", "p", cfGetProfileString2(cfSoundSec, "sound", "defplayer", ""));
+	if (cfGetProfileBool("CommandLine--", "render", 0, 0))
+	{
+		def="devpDisk";
+	}
 
 	if (strlen(def))
 		plrSetDevice(def, 1);
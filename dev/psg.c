@@ -0,0 +1,830 @@
+/* OpenCP Module Player
+ * copyright (c) 2022 Stian Skjelstad <stian.skjelstad@gmail.com>
+ *
+ * Band-limited AY-3-8910/8912 and YM2149 emulation, rendered in blocks
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "psg.h"
+
+#define PSG_TAPS       16   /* length of a band-limited step, in output samples */
+#define PSG_PHASE_BITS 8    /* sub-sample resolution of a step */
+#define PSG_PHASES     (1 << PSG_PHASE_BITS)
+#define PSG_DELTA_BITS 14   /* each phase of the kernel adds up to 1 << PSG_DELTA_BITS */
+#define PSG_CUTOFF     0.45 /* relative to the output rate */
+#define PSG_BETA       6.0  /* Kaiser window shape */
+#define PSG_TAIL       (PSG_TAPS + 4) /* rounding a time up to the next tick can move it past PSG_MAXBLOCK if there are less ticks than samples */
+#define PSG_BUFLEN     (PSG_MAXBLOCK + PSG_TAIL)
+#define PSG_NEVER      0xffffffff
+#define PSG_EVENTS     256  /* noise and envelope changes that are worked out ahead of the channels */
+
+/* bitmasks for envelope */
+#define PSG_ENV_CONT   8
+#define PSG_ENV_ATTACK 4
+#define PSG_ENV_ALT    2
+#define PSG_ENV_HOLD   1
+
+/* AY output doesn't match the claimed levels; these levels are based
+ * on the measurements posted to comp.sys.sinclair in Dec 2001 by
+ * Matthew Westcott, scaled to 0..0xffff (from aylet).
+ */
+static const uint16_t psg_ay_levels[16] =
+{
+	0x0000, 0x0385, 0x053D, 0x0770,
+	0x0AD7, 0x0FD5, 0x15B0, 0x230C,
+	0x2B4C, 0x43C1, 0x5A4B, 0x732F,
+	0x9204, 0xAFF1, 0xD921, 0xFFFF
+};
+
+/* The 16 volume levels of ST-Sound at the odd steps, the envelope only steps in between */
+static const uint16_t psg_ym_levels[32] =
+{
+	   62,   124,   200,   322,   413,   530,   632,   754,
+	  935,  1160,  1340,  1548,  1891,  2310,  2697,  3150,
+	 3773,  4520,  5284,  6176,  7513,  9140, 10674, 12466,
+	15252, 18660, 22184, 26374, 33456, 42440, 52738, 65535
+};
+
+/* band-limited impulse for a step at sub-sample position p/PSG_PHASES, the output is made by integrating them */
+static int16_t psg_kernel[PSG_PHASES][PSG_TAPS];
+static int psg_kernel_ready;
+
+/* a change of the noise output or the envelope level, shared by the channels that listen to it */
+struct psg_event
+{
+	uint32_t tick;
+	int32_t  value;
+};
+
+struct psg_t
+{
+	int      flags;
+	int      outputs;
+	uint32_t clock;
+	uint32_t rate;
+	uint64_t factor;     /* output samples per tick, 32.32 fixed point. A tick is 8 clocks, the resolution of the tone counters */
+	uint64_t tickrate;   /* ticks per output sample, 32.32 fixed point, saves a division on every write */
+	uint64_t offset;     /* output sample of tick 0 of the current block, 32.32 fixed point */
+	uint32_t now;        /* tick, counted from the start of the current block */
+	int      bass_shift;
+
+	int32_t  levels[32]; /* envelope step or volume to output level */
+	int      envsteps;   /* steps per ramp, 16 or 32 */
+
+	uint8_t  regs[16];
+
+	uint32_t tone_period[3]; /* ticks between each toggle */
+	uint32_t tone_next[3];   /* tick of the next toggle, PSG_NEVER if the period is ultrasonic */
+	int      tone_bit[3];
+
+	uint32_t noise_period;   /* ticks between each step of the shift register */
+	uint32_t noise_next;
+	uint32_t rng;
+	int      noise_bit;
+
+	uint32_t env_period;     /* ticks per step */
+	uint32_t env_next;       /* PSG_NEVER when holding */
+	int      env_step;       /* position in the current ramp */
+	int      env_attack;     /* the current ramp goes up */
+	int      env_level;
+
+	uint32_t sid_period[3];  /* ticks between the volume rewrites of a timer, 16.16 fixed point, 0 when off */
+	uint32_t sid_next[3];    /* tick of the next rewrite */
+	uint32_t sid_frac[3];    /* and the fraction of a tick it is late, 0.16 fixed point */
+	int      sid_vol[3];
+	int      sid_high[3];    /* the volume is rewritten with sid_vol, else with 0 */
+
+	int32_t  dac[3];         /* negative when not in use */
+	int      tone_off[3];    /* the tone does not gate the channel, it is disabled in the mixer or the channel plays a DAC level */
+	int      noise_off[3];
+	int      env_user[3];    /* the channel follows the envelope */
+	int32_t  open_level[3];  /* what the channel outputs while it is not gated, from the volume register, the envelope or the DAC */
+	int32_t  level[4];       /* what each channel, and the external signal, outputs now */
+
+	struct psg_event noise_events[PSG_EVENTS]; /* where the noise output flips, ends with PSG_NEVER */
+	struct psg_event env_events[PSG_EVENTS];   /* the envelope steps, as output levels */
+
+	int32_t  integrator[4];
+	int32_t  buf[4][PSG_BUFLEN];
+};
+
+static double psg_bessel_i0 (double x)
+{
+	double sum = 1.0, term = 1.0;
+	int k;
+
+	for (k = 1; k < 32; k++)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < sum * 1e-12)
+		{
+			break;
+		}
+	}
+	return sum;
+}
+
+static void psg_kernel_init (void)
+{
+	int p, t;
+
+	if (psg_kernel_ready)
+	{
+		return;
+	}
+
+	for (p = 0; p < PSG_PHASES; p++)
+	{
+		double k[PSG_TAPS];
+		double sum = 0.0;
+		int total = 0;
+
+		for (t = 0; t < PSG_TAPS; t++)
+		{
+			double x = t - (PSG_TAPS / 2 - 1) - (double)p / PSG_PHASES; /* distance to the step, in samples */
+			double w = x / (PSG_TAPS / 2);
+			double s = (x == 0.0) ? 2.0 * PSG_CUTOFF : sin (2.0 * M_PI * PSG_CUTOFF * x) / (M_PI * x);
+
+			k[t] = (fabs (w) < 1.0) ? s * psg_bessel_i0 (PSG_BETA * sqrt (1.0 - w * w)) / psg_bessel_i0 (PSG_BETA) : 0.0;
+			sum += k[t];
+		}
+		for (t = 0; t < PSG_TAPS; t++)
+		{
+			psg_kernel[p][t] = lrint (k[t] / sum * (1 << PSG_DELTA_BITS));
+			total += psg_kernel[p][t];
+		}
+		/* the rounding error goes into the centre, so every step reaches exactly the new level */
+		psg_kernel[p][PSG_TAPS / 2 - 1 + (p >= PSG_PHASES / 2)] += (1 << PSG_DELTA_BITS) - total;
+	}
+	psg_kernel_ready = 1;
+}
+
+/* add a change of delta in output at the given tick */
+static inline void psg_delta (struct psg_t *self, int output, uint32_t tick, int32_t delta)
+{
+	uint64_t t = self->offset + tick * self->factor;
+	const int16_t *k = psg_kernel[(uint32_t)t >> (32 - PSG_PHASE_BITS)];
+	int32_t *b = self->buf[output] + (t >> 32);
+	int n;
+
+	if ((delta >= -32768) && (delta <= 32767))
+	{ /* 16 by 16 bit multiplies, the compiler can do several at once */
+		const int16_t d = delta;
+
+		for (n = 0; n < PSG_TAPS; n++)
+		{
+			b[n] += (int32_t)k[n] * d;
+		}
+	} else {
+		for (n = 0; n < PSG_TAPS; n++)
+		{
+			b[n] += k[n] * delta;
+		}
+	}
+}
+
+static inline int32_t psg_volume (const struct psg_t *self, int vol)
+{
+	return self->levels[(self->flags & PSG_FLAGS_YM) ? ((vol & 15) * 2 + 1) : (vol & 15)];
+}
+
+/* recalculate what the registers, the envelope, the timer and the DAC give channel c */
+static void psg_channel_setup (struct psg_t *self, int c)
+{
+	int mixer = self->regs[7];
+	int vol = self->sid_period[c] ? (self->sid_high[c] ? self->sid_vol[c] : 0) : self->regs[8 + c];
+
+	if (self->dac[c] >= 0)
+	{
+		self->tone_off[c] = 1;
+		self->noise_off[c] = 1;
+		self->env_user[c] = 0;
+		self->open_level[c] = self->dac[c];
+		return;
+	}
+
+	/* a channel with both tone and noise disabled just outputs the volume, used by sample players */
+	self->tone_off[c] = (mixer >> c) & 1;
+	self->noise_off[c] = (mixer >> (c + 3)) & 1;
+	self->env_user[c] = !!(vol & 0x10);
+	if (vol & 0x10)
+	{
+		self->open_level[c] = self->levels[self->env_level];
+	} else {
+		self->open_level[c] = psg_volume (self, vol);
+	}
+}
+
+static int32_t psg_channel_level (const struct psg_t *self, int c)
+{
+	return self->open_level[c] & -((self->tone_bit[c] | self->tone_off[c]) & (self->noise_bit | self->noise_off[c]) & 1);
+}
+
+/* refresh the channels in mask at the current time */
+static void psg_update (struct psg_t *self, int mask)
+{
+	int c;
+
+	for (c = 0; c < 3; c++)
+	{
+		int32_t level;
+
+		if (!(mask & (1 << c)))
+		{
+			continue;
+		}
+		level = psg_channel_level (self, c);
+		if (level != self->level[c])
+		{
+			psg_delta (self, (self->outputs > 1) ? c : 0, self->now, level - self->level[c]);
+			self->level[c] = level;
+		}
+	}
+}
+
+/* the envelope level changed, returns the channels that follow it */
+static int psg_env_setup (struct psg_t *self)
+{
+	int users = 0;
+	int c;
+
+	for (c = 0; c < 3; c++)
+	{
+		if (self->env_user[c])
+		{
+			self->open_level[c] = self->levels[self->env_level];
+			users |= 1 << c;
+		}
+	}
+	return users;
+}
+
+/* a period change keeps the position of the counter, like the real chip. If it is already past the new period, it fires on the next tick */
+static uint32_t psg_reperiod (const struct psg_t *self, uint32_t next, uint32_t oldperiod, uint32_t newperiod)
+{
+	uint32_t elapsed;
+
+	if (next == PSG_NEVER)
+	{
+		return self->now + newperiod;
+	}
+	elapsed = oldperiod - (next - self->now);
+	return self->now + ((newperiod > elapsed) ? (newperiod - elapsed) : 1);
+}
+
+static void psg_tone_period (struct psg_t *self, int c)
+{
+	uint32_t period = ((self->regs[c * 2 + 1] & 15) << 8) | self->regs[c * 2];
+
+	if (!period)
+	{
+		period = 1;
+	}
+	/* above the Nyquist frequency the output stage averages it away, and samples are played with such periods. Treat it as always high, like ST-Sound did */
+	if ((uint64_t)period * 8 * self->rate < self->clock)
+	{
+		self->tone_next[c] = PSG_NEVER;
+		self->tone_bit[c] = 1;
+	} else {
+		self->tone_next[c] = psg_reperiod (self, self->tone_next[c], self->tone_period[c], period);
+	}
+	self->tone_period[c] = period;
+}
+
+static void psg_noise_period (struct psg_t *self)
+{
+	uint32_t period = (self->regs[6] & 31) ? (self->regs[6] & 31) * 2 : 2;
+
+	self->noise_next = psg_reperiod (self, self->noise_next, self->noise_period, period);
+	self->noise_period = period;
+}
+
+static void psg_env_period (struct psg_t *self)
+{
+	uint32_t period = self->regs[11] | (self->regs[12] << 8);
+
+	if (!period)
+	{
+		period = 1;
+	}
+	if (!(self->flags & PSG_FLAGS_YM))
+	{ /* 16 steps take as long as the 32 steps of the YM2149 */
+		period *= 2;
+	}
+	if (self->env_next != PSG_NEVER)
+	{
+		self->env_next = psg_reperiod (self, self->env_next, self->env_period, period);
+	}
+	self->env_period = period;
+}
+
+static void psg_env_restart (struct psg_t *self)
+{
+	self->env_step = 0;
+	self->env_attack = !!(self->regs[13] & PSG_ENV_ATTACK);
+	self->env_level = self->env_attack ? 0 : (self->envsteps - 1);
+	self->env_next = self->now + self->env_period;
+}
+
+static void psg_env_step (struct psg_t *self)
+{
+	int shape = self->regs[13];
+
+	self->env_step++;
+	if (self->env_step >= self->envsteps)
+	{ /* end of a ramp */
+		if (!(shape & PSG_ENV_CONT))
+		{
+			self->env_level = 0;
+			self->env_next = PSG_NEVER;
+			return;
+		}
+		if (shape & PSG_ENV_HOLD)
+		{
+			self->env_level = (self->env_attack ^ !!(shape & PSG_ENV_ALT)) ? (self->envsteps - 1) : 0;
+			self->env_next = PSG_NEVER;
+			return;
+		}
+		if (shape & PSG_ENV_ALT)
+		{
+			self->env_attack = !self->env_attack;
+		}
+		self->env_step = 0;
+	}
+	self->env_level = self->env_attack ? self->env_step : (self->envsteps - 1 - self->env_step);
+	self->env_next += self->env_period;
+}
+
+/* step the shift register until tick end, and note where the output flips if a channel listens to it */
+static void psg_noise_run (struct psg_t *self, uint32_t end, int record)
+{
+	struct psg_event *e = self->noise_events;
+	uint32_t rng = self->rng;
+	int bit = self->noise_bit;
+
+	while (self->noise_next < end)
+	{
+		/* 17 bit shift register, the input is bit 0 xor bit 3 */
+		rng = (rng >> 1) | (((rng ^ (rng >> 3)) & 1) << 16);
+		if ((int)(rng & 1) != bit)
+		{
+			bit = rng & 1;
+			e->tick = self->noise_next;
+			e->value = bit;
+			e += record;
+		}
+		self->noise_next += self->noise_period;
+	}
+	e->tick = PSG_NEVER;
+	self->rng = rng;
+	self->noise_bit = bit;
+}
+
+/* step the envelope until tick end, and note the levels if a channel listens to it */
+static void psg_env_run (struct psg_t *self, uint32_t end, int record)
+{
+	struct psg_event *e = self->env_events;
+
+	while (self->env_next < end)
+	{
+		e->tick = self->env_next;
+		psg_env_step (self);
+		e->value = self->levels[self->env_level];
+		e += record;
+	}
+	e->tick = PSG_NEVER;
+}
+
+/* make the output of channel c until tick end. The noise and the envelope are already stepped, the changes they made are in the event lists */
+static void psg_channel_run (struct psg_t *self, int c, uint32_t end, int noise_bit)
+{
+	static const struct psg_event never = {PSG_NEVER, 0};
+	const int output = (self->outputs > 1) ? c : 0;
+	const uint32_t tone_period = self->tone_period[c];
+	const uint32_t sid_period = self->sid_period[c];
+	const int32_t sid_level[2] = {psg_volume (self, 0), psg_volume (self, self->sid_vol[c])};
+	const struct psg_event *noise = self->noise_off[c] ? &never : self->noise_events;
+	const struct psg_event *env = self->env_user[c] ? self->env_events : &never;
+	uint32_t tone_next = self->tone_off[c] ? PSG_NEVER : self->tone_next[c];
+	uint32_t sid_next = sid_period ? self->sid_next[c] : PSG_NEVER;
+	int tone_bit = self->tone_bit[c];
+	int tone_gate = tone_bit | self->tone_off[c];
+	int noise_gate = noise_bit | self->noise_off[c];
+	int32_t open = self->open_level[c];
+	int32_t level = self->level[c];
+
+	/* only the generators that gate this channel take part, the others stay at PSG_NEVER. This keeps the branches predictable */
+	while (1)
+	{
+		uint32_t next = tone_next;
+		int32_t l;
+
+		if (noise->tick < next) next = noise->tick;
+		if (env->tick < next) next = env->tick;
+		if (sid_next < next) next = sid_next;
+		if (next >= end)
+		{
+			break;
+		}
+
+		if (tone_next == next)
+		{
+			tone_bit ^= 1;
+			tone_gate = tone_bit;
+			tone_next += tone_period;
+		}
+		if (noise->tick == next)
+		{
+			noise_gate = noise->value;
+			noise++;
+		}
+		if (env->tick == next)
+		{
+			open = env->value;
+			env++;
+		}
+		if (sid_next == next)
+		{ /* the timer rewrites the volume */
+			uint32_t acc = self->sid_frac[c] + sid_period;
+
+			self->sid_high[c] ^= 1;
+			sid_next += acc >> 16;
+			self->sid_frac[c] = acc & 0xffff;
+			if (self->dac[c] < 0)
+			{
+				open = sid_level[self->sid_high[c]];
+			}
+		}
+
+		l = open & -(tone_gate & noise_gate & 1);
+		if (l != level)
+		{
+			psg_delta (self, output, next, l - level);
+			level = l;
+		}
+	}
+
+	if (self->tone_off[c])
+	{ /* the counter runs on while it is disabled in the mixer */
+		tone_next = self->tone_next[c];
+		while (tone_next < end)
+		{
+			tone_bit ^= 1;
+			tone_next += tone_period;
+		}
+	}
+	self->tone_next[c] = tone_next;
+	self->tone_bit[c] = tone_bit;
+	if (sid_period)
+	{
+		self->sid_next[c] = sid_next;
+	}
+	self->open_level[c] = open;
+	self->level[c] = level;
+}
+
+/* run the generators through all the changes that happen before tick until */
+static void psg_run (struct psg_t *self, uint32_t until)
+{
+	while (self->now < until)
+	{
+		const int noise_users = !(self->noise_off[0] & self->noise_off[1] & self->noise_off[2]);
+		const int env_users = self->env_user[0] | self->env_user[1] | self->env_user[2];
+		const int noise_bit = self->noise_bit;
+		uint32_t end = until;
+		int c;
+
+		/* the event lists limit how far the channels can be run at once */
+		if (noise_users && ((end - self->now) / (PSG_EVENTS - 1) >= self->noise_period))
+		{
+			end = self->now + (PSG_EVENTS - 1) * self->noise_period;
+		}
+		if (env_users && (self->env_next != PSG_NEVER) && ((end - self->now) / (PSG_EVENTS - 1) >= self->env_period))
+		{
+			end = self->now + (PSG_EVENTS - 1) * self->env_period;
+		}
+
+		psg_noise_run (self, end, noise_users);
+		psg_env_run (self, end, env_users);
+		for (c = 0; c < 3; c++)
+		{
+			psg_channel_run (self, c, end, noise_bit);
+		}
+		self->now = end;
+	}
+}
+
+/* the first tick at or after the given time */
+static uint32_t psg_tick (const struct psg_t *self, uint32_t time)
+{
+	uint64_t t;
+	uint32_t retval;
+
+	if (time >= ((uint32_t)PSG_MAXBLOCK << 16))
+	{
+		time = ((uint32_t)PSG_MAXBLOCK << 16) - 1;
+	}
+	t = (uint64_t)time << 16;
+	/* with 12 fractional bits of a sample the product fits 64 bits up to 2^38 ticks per sample */
+	retval = (t > self->offset) ? ((((t - self->offset) >> 20) * self->tickrate + ((uint64_t)1 << 44) - 1) >> 44) : 0;
+	return (retval > self->now) ? retval : self->now;
+}
+
+void __attribute__ ((visibility ("internal"))) psg_write (struct psg_t *self, uint32_t time, int reg, int val)
+{
+	if ((reg < 0) || (reg > 15))
+	{
+		return;
+	}
+
+	psg_run (self, psg_tick (self, time));
+
+	self->regs[reg] = val;
+	switch (reg)
+	{
+		case 0: case 1:
+		case 2: case 3:
+		case 4: case 5:
+			psg_tone_period (self, reg >> 1);
+			psg_update (self, 1 << (reg >> 1));
+			break;
+		case 6:
+			psg_noise_period (self);
+			break;
+		case 7:
+			psg_channel_setup (self, 0);
+			psg_channel_setup (self, 1);
+			psg_channel_setup (self, 2);
+			psg_update (self, 7);
+			break;
+		case 8: case 9: case 10:
+			psg_channel_setup (self, reg - 8);
+			psg_update (self, 1 << (reg - 8));
+			break;
+		case 11: case 12:
+			psg_env_period (self);
+			break;
+		case 13:
+			psg_env_restart (self);
+			psg_update (self, psg_env_setup (self));
+			break;
+	}
+}
+
+int __attribute__ ((visibility ("internal"))) psg_read (const struct psg_t *self, int reg)
+{
+	if ((reg < 0) || (reg > 15))
+	{
+		return -1;
+	}
+	return self->regs[reg];
+}
+
+void __attribute__ ((visibility ("internal"))) psg_dac (struct psg_t *self, uint32_t time, int chan, int level)
+{
+	if ((chan < 0) || (chan > 2))
+	{
+		return;
+	}
+	psg_run (self, psg_tick (self, time));
+	self->dac[chan] = level;
+	psg_channel_setup (self, chan);
+	psg_update (self, 1 << chan);
+}
+
+void __attribute__ ((visibility ("internal"))) psg_sid (struct psg_t *self, uint32_t time, int chan, uint32_t period, int vol)
+{
+	uint64_t ticks;
+
+	if ((chan < 0) || (chan > 2))
+	{
+		return;
+	}
+	psg_run (self, psg_tick (self, time));
+
+	/* 16.16 samples times 32.32 ticks per sample, at least one tick */
+	ticks = period ? (((uint64_t)period * self->tickrate) >> 32) : 0;
+	if (period && (ticks < 0x10000))
+	{
+		ticks = 0x10000;
+	} else if (ticks > 0xffffffff)
+	{
+		ticks = 0xffffffff;
+	}
+
+	if (!ticks)
+	{
+		self->sid_period[chan] = 0;
+	} else if (!self->sid_period[chan])
+	{ /* starts low */
+		self->sid_high[chan] = 0;
+		self->sid_next[chan] = self->now + (uint32_t)(ticks >> 16);
+		self->sid_frac[chan] = ticks & 0xffff;
+		self->sid_period[chan] = ticks;
+	} else if (ticks != self->sid_period[chan])
+	{ /* what is left until the next rewrite is scaled to the new period */
+		uint64_t left = ((uint64_t)(self->sid_next[chan] - self->now) << 16) + self->sid_frac[chan];
+
+		left = left * ticks / self->sid_period[chan];
+		if (left < 0x10000)
+		{
+			left = 0x10000;
+		}
+		self->sid_next[chan] = self->now + (uint32_t)(left >> 16);
+		self->sid_frac[chan] = left & 0xffff;
+		self->sid_period[chan] = ticks;
+	}
+	self->sid_vol[chan] = vol & 15;
+
+	psg_channel_setup (self, chan);
+	psg_update (self, 1 << chan);
+}
+
+void __attribute__ ((visibility ("internal"))) psg_external (struct psg_t *self, uint32_t time, int level)
+{
+	psg_run (self, psg_tick (self, time));
+	if (level != self->level[3])
+	{
+		psg_delta (self, (self->outputs > 1) ? 3 : 0, self->now, level - self->level[3]);
+		self->level[3] = level;
+	}
+}
+
+static void psg_render_chunk (struct psg_t *self, int16_t *dst, int stride, int samples)
+{
+	uint32_t end = (((uint64_t)samples << 32) - self->offset + self->factor - 1) / self->factor;
+	int bass_shift = self->bass_shift;
+	int o, c, i;
+
+	psg_run (self, end);
+
+	for (o = 0; o < self->outputs; o++)
+	{
+		int32_t *b = self->buf[o];
+		int32_t sum = self->integrator[o];
+
+		for (i = 0; i < samples; i++)
+		{
+			int32_t s;
+
+			sum += b[i];
+			s = sum >> PSG_DELTA_BITS;
+			sum -= sum >> bass_shift; /* high-pass, removes DC. Taken before the clipping, so the next sample does not wait for it */
+			if (s < -32768)
+			{
+				s = -32768;
+			} else if (s > 32767)
+			{
+				s = 32767;
+			}
+			dst[i * stride + o] = s;
+		}
+		self->integrator[o] = sum;
+
+		/* only the tail of the last steps reaches past the block */
+		memmove (b, b + samples, PSG_TAIL * sizeof (b[0]));
+		memset (b + PSG_TAIL, 0, samples * sizeof (b[0]));
+	}
+
+	/* the next block starts at tick 0 */
+	for (c = 0; c < 3; c++)
+	{
+		if (self->tone_next[c] != PSG_NEVER)
+		{
+			self->tone_next[c] -= end;
+		}
+	}
+	self->noise_next -= end;
+	if (self->env_next != PSG_NEVER)
+	{
+		self->env_next -= end;
+	}
+	for (c = 0; c < 3; c++)
+	{
+		if (self->sid_period[c])
+		{
+			self->sid_next[c] -= end;
+		}
+	}
+	self->now = 0;
+	self->offset = self->offset + end * self->factor - ((uint64_t)samples << 32);
+}
+
+void __attribute__ ((visibility ("internal"))) psg_render (struct psg_t *self, int16_t *dst, int stride, int samples)
+{
+	while (samples > 0)
+	{
+		int chunk = (samples > PSG_MAXBLOCK) ? PSG_MAXBLOCK : samples;
+
+		psg_render_chunk (self, dst, stride, chunk);
+		dst += chunk * stride;
+		samples -= chunk;
+	}
+}
+
+void __attribute__ ((visibility ("internal"))) psg_set_clock (struct psg_t *self, uint32_t clock)
+{
+	int c;
+
+	self->clock = clock;
+	self->factor = ((uint64_t)self->rate << 32) / (clock / 8);
+	self->tickrate = ((uint64_t)(clock / 8) << 32) / self->rate;
+	for (c = 0; c < 3; c++)
+	{
+		psg_tone_period (self, c);
+	}
+}
+
+void __attribute__ ((visibility ("internal"))) psg_reset (struct psg_t *self)
+{
+	int c;
+
+	memset (self->regs, 0, sizeof (self->regs));
+	for (c = 0; c < 3; c++)
+	{
+		self->tone_bit[c] = 0;
+		self->tone_period[c] = 1;
+		self->tone_next[c] = PSG_NEVER;
+		psg_tone_period (self, c);
+		self->dac[c] = -1;
+		self->sid_period[c] = 0;
+	}
+	self->rng = 1;
+	self->noise_bit = 1;
+	self->noise_next = PSG_NEVER;
+	psg_noise_period (self);
+	self->env_period = 1;
+	self->env_next = PSG_NEVER;
+	psg_env_period (self);
+	self->env_step = 0;
+	self->env_attack = 0;
+	self->env_level = 0;
+	for (c = 0; c < 3; c++)
+	{
+		psg_channel_setup (self, c);
+	}
+	psg_update (self, 7);
+}
+
+struct psg_t __attribute__ ((visibility ("internal"))) *psg_new (uint32_t clock, uint32_t rate, int flags, int amplitude)
+{
+	struct psg_t *self;
+	int i;
+
+	if ((clock < 8) || (!rate))
+	{
+		return 0;
+	}
+
+	self = calloc (1, sizeof (*self));
+	if (!self)
+	{
+		return 0;
+	}
+
+	psg_kernel_init ();
+
+	self->flags = flags;
+	self->outputs = (flags & PSG_FLAGS_SEPARATE) ? 4 : 1;
+	self->rate = rate;
+	self->envsteps = (flags & PSG_FLAGS_YM) ? 32 : 16;
+	for (i = 0; i < self->envsteps; i++)
+	{
+		uint32_t l = (flags & PSG_FLAGS_YM) ? psg_ym_levels[i] : psg_ay_levels[i];
+		self->levels[i] = (l * amplitude + 0x8000) / 0xffff;
+	}
+
+	/* cut-off at rate / (2 * PI * 2^bass_shift), about 15Hz */
+	for (self->bass_shift = 1; (self->bass_shift < PSG_DELTA_BITS) && ((rate >> self->bass_shift) > 94); self->bass_shift++)
+	{
+	}
+
+	psg_set_clock (self, clock);
+	psg_reset (self);
+
+	return self;
+}
+
+void __attribute__ ((visibility ("internal"))) psg_free (struct psg_t *self)
+{
+	free (self);
+}
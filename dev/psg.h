@@ -0,0 +1,69 @@
+#ifndef _PSG_H
+#define _PSG_H 1
+
+/* Band-limited emulation of the AY-3-8910/8912 and YM2149 programmable sound
+ * generators, shared by the AY and YM players. It is compiled into each of
+ * the plugins, not into the core.
+ *
+ * The tone, noise and envelope generators are not stepped per output sample.
+ * The time of every change of a channel output is computed from the periods,
+ * and inserted into a delta buffer as a band-limited step. A block is then
+ * made by integrating the buffer once, so the cost follows the number of
+ * level changes and not the output rate, and frequencies above the Nyquist
+ * frequency do not alias back into the audible range. The integration also
+ * removes DC with a high-pass at about 15Hz.
+ *
+ * The channels are run one at a time, each only through the generators that
+ * gate it, as the order of the changes is too random for branch prediction
+ * when all generators are merged. The noise and envelope changes are worked
+ * out first and shared by the channels that listen to them.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PSG_MAXBLOCK 8192 /* times given to psg_write() etc. must be below this */
+
+#define PSG_FLAGS_YM       1 /* YM2149: 32 step envelope and the YM volume curve, else AY-3-8912 with 16 steps */
+#define PSG_FLAGS_SEPARATE 2 /* render channel A, B, C and the external level as four outputs, else mix them into one */
+
+struct psg_t;
+
+/* clock:     the master clock of the chip, in Hz
+ * rate:      output rate, in Hz
+ * amplitude: the output of one channel at full volume, at most 10922 if the channels are mixed
+ */
+struct psg_t __attribute__ ((visibility ("internal"))) *psg_new (uint32_t clock, uint32_t rate, int flags, int amplitude);
+void __attribute__ ((visibility ("internal"))) psg_free (struct psg_t *self);
+
+/* all registers become zero, like after power on. The output ramps to the new level */
+void __attribute__ ((visibility ("internal"))) psg_reset (struct psg_t *self);
+
+/* only between blocks */
+void __attribute__ ((visibility ("internal"))) psg_set_clock (struct psg_t *self, uint32_t clock);
+
+/* time is in output samples from the start of the block being made, 16.16 fixed point. Times must not go backwards within a block */
+void __attribute__ ((visibility ("internal"))) psg_write (struct psg_t *self, uint32_t time, int reg, int val);
+int __attribute__ ((visibility ("internal"))) psg_read (const struct psg_t *self, int reg);
+
+/* level (0 to amplitude) replaces the generators of a channel, used for digi-drums. A negative level gives the channel back to the generators */
+void __attribute__ ((visibility ("internal"))) psg_dac (struct psg_t *self, uint32_t time, int chan, int level);
+
+/* a timer rewrites the volume register of chan with 0 and vol (0 to 15) in turn, every period output samples (16.16 fixed point), like the
+ * SID voices of the Atari ST. It starts with 0 at time. Called again while it runs, the phase is kept. A period of 0 stops it, and the
+ * volume register written last is used again
+ */
+void __attribute__ ((visibility ("internal"))) psg_sid (struct psg_t *self, uint32_t time, int chan, uint32_t period, int vol);
+
+/* an extra signal added to the output, like the ZX Spectrum beeper */
+void __attribute__ ((visibility ("internal"))) psg_external (struct psg_t *self, uint32_t time, int level);
+
+/* ends the block. Output n of sample i is stored at dst[i*stride+n]. Writes made for this block must have a time below samples */
+void __attribute__ ((visibility ("internal"))) psg_render (struct psg_t *self, int16_t *dst, int stride, int samples);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,375 @@
+/* OpenCP Module Player
+ * copyright (c) 2022 Stian Skjelstad <stian.skjelstad@gmail.com>
+ *
+ * unit-test of "psg.c", with aliasing and CPU measurements against a
+ * generator that steps per output sample
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "types.h"
+
+#include "psg.c"
+
+#define ANSI_COLOR_RED     "\x1b[31m"
+#define ANSI_COLOR_GREEN   "\x1b[32m"
+#define ANSI_COLOR_RESET   "\x1b[0m"
+
+#define RATE      44100
+#define AY_CLOCK  1773400
+#define AMPLITUDE 10000
+
+#define FFTLEN    16384
+
+static int16_t buf[RATE * 4];
+
+static int result (int failed)
+{
+	printf ("%s%s%s\n", failed ? ANSI_COLOR_RED : ANSI_COLOR_GREEN, failed ? "failed" : "ok", ANSI_COLOR_RESET);
+	return failed;
+}
+
+/* every shape, three ramps, compared with the table in the AY-3-8910 data sheet */
+static int test_envelope (void)
+{
+	static const char *shapes[16] =
+	{
+		"\\__", "\\__", "\\__", "\\__", "/__", "/__", "/__", "/__",
+		"\\\\\\", "\\__", "\\/\\", "\\^^", "///", "/^^", "/\\/", "/__"
+	};
+	int shape, failed = 0;
+	struct psg_t *p = psg_new (AY_CLOCK, RATE, 0, AMPLITUDE);
+
+	printf ("envelope shapes: ");
+	for (shape = 0; shape < 16; shape++)
+	{
+		int ramp;
+
+		psg_write (p, 0, 11, 1);
+		psg_write (p, 0, 13, shape);
+		for (ramp = 0; ramp < 3; ramp++)
+		{
+			int first = p->env_level, last = first, step;
+
+			for (step = 1; step < 16; step++)
+			{
+				psg_run (p, p->env_next + 1);
+				last = p->env_level;
+			}
+			psg_run (p, p->env_next + 1); /* first step of the next ramp */
+
+			switch (shapes[shape][ramp])
+			{
+				case '\\': failed |= (first != 15) || (last != 0); break;
+				case '/':  failed |= (first != 0) || (last != 15); break;
+				case '_':  failed |= (first != 0) || (last != 0); break;
+				case '^':  failed |= (first != 15) || (last != 15); break;
+			}
+		}
+		psg_render (p, buf, 1, 100);
+	}
+	psg_free (p);
+	return result (failed);
+}
+
+/* a channel with tone and noise disabled outputs the volume, which is a step the high-pass slowly takes back to zero. A band-limited step rings, and overshoots by about 9% */
+static int test_level (void)
+{
+	struct psg_t *p = psg_new (AY_CLOCK, RATE, PSG_FLAGS_SEPARATE, AMPLITUDE);
+	int i, max = 0, failed = 0;
+
+	printf ("volume step: ");
+	psg_write (p, 0, 7, 0x3f);
+	psg_write (p, 10 << 16, 9, 15);
+	psg_render (p, buf, 4, 1000);
+	for (i = 0; i < 1000; i++)
+	{
+		if (buf[i * 4 + 0] || buf[i * 4 + 2] || buf[i * 4 + 3])
+		{
+			failed = 1;
+		}
+		if ((i < 10 - PSG_TAPS / 2) && buf[i * 4 + 1])
+		{
+			failed = 1;
+		}
+		if (buf[i * 4 + 1] > max)
+		{
+			max = buf[i * 4 + 1];
+		}
+	}
+	if ((max < AMPLITUDE * 97 / 100) || (max > AMPLITUDE * 112 / 100) || (buf[999 * 4 + 1] >= max * 3 / 4))
+	{
+		failed = 1;
+	}
+	psg_free (p);
+	return result (failed);
+}
+
+/* zero crossings during one second */
+static int test_frequency (void)
+{
+	struct psg_t *p = psg_new (AY_CLOCK, RATE, 0, AMPLITUDE);
+	int i, crossings = 0, failed = 0;
+	double expect = AY_CLOCK / (16.0 * 300);
+
+	printf ("tone frequency: ");
+	psg_write (p, 0, 7, 0x3e);
+	psg_write (p, 0, 0, 300 & 0xff);
+	psg_write (p, 0, 1, 300 >> 8);
+	psg_write (p, 0, 8, 15);
+	psg_render (p, buf, 1, RATE * 2);
+	for (i = RATE + 1; i < RATE * 2; i++)
+	{
+		if ((buf[i - 1] < 0) && (buf[i] >= 0))
+		{
+			crossings++;
+		}
+	}
+	if (fabs (crossings - expect) > 2)
+	{
+		failed = 1;
+	}
+	psg_free (p);
+	return result (failed);
+}
+
+/* a 2000Hz timer makes a 1000Hz square wave from the volume, and keeps its phase when it is set again for every block */
+static int test_sid (void)
+{
+	struct psg_t *p = psg_new (AY_CLOCK, RATE, 0, AMPLITUDE);
+	int i, crossings = 0, failed = 0;
+
+	printf ("timer volume: ");
+	psg_write (p, 0, 7, 0x3f);
+	psg_write (p, 0, 8, 15);
+	for (i = 0; i < RATE * 2; i += 1000)
+	{
+		psg_sid (p, 0, 0, ((uint64_t)RATE << 16) / 2000, 15);
+		psg_render (p, buf + i, 1, (i + 1000 > RATE * 2) ? (RATE * 2 - i) : 1000);
+	}
+	for (i = RATE + 1; i < RATE * 2; i++)
+	{
+		if ((buf[i - 1] < 0) && (buf[i] >= 0))
+		{
+			crossings++;
+		}
+	}
+	if (abs (crossings - 1000) > 2)
+	{
+		failed = 1;
+	}
+	psg_free (p);
+	return result (failed);
+}
+
+/* the output may not depend on how it is split into blocks */
+static int test_blocks (void)
+{
+	struct psg_t *a = psg_new (AY_CLOCK, RATE, PSG_FLAGS_YM, AMPLITUDE);
+	struct psg_t *b = psg_new (AY_CLOCK, RATE, PSG_FLAGS_YM, AMPLITUDE);
+	static int16_t out[RATE];
+	int i, pos, failed = 0;
+
+	printf ("block sizes: ");
+	for (i = 0; i < 2; i++)
+	{
+		struct psg_t *p = i ? b : a;
+		psg_write (p, 0, 7, 0x30);
+		psg_write (p, 0, 0, 77);
+		psg_write (p, 0, 2, 201);
+		psg_write (p, 0, 4, 33);
+		psg_write (p, 0, 6, 7);
+		psg_write (p, 0, 8, 12);
+		psg_write (p, 0, 9, 16);
+		psg_write (p, 0, 10, 9);
+		psg_write (p, 0, 11, 40);
+		psg_write (p, 0, 13, 10);
+	}
+	psg_render (a, buf, 1, RATE);
+	for (pos = 0, i = 1; pos < RATE; pos += i, i = (i * 7 + 3) % 1500 + 1)
+	{
+		psg_render (b, out + pos, 1, (pos + i > RATE) ? (RATE - pos) : i);
+	}
+	if (memcmp (buf, out, sizeof (out)))
+	{
+		failed = 1;
+	}
+	psg_free (a);
+	psg_free (b);
+	return result (failed);
+}
+
+/* Reference: a square wave from a 32 bit phase counter, sampled once per output sample like the old emulators did */
+static void naive_tone (int16_t *dst, int samples, double freq)
+{
+	uint32_t pos = 0, step = freq * 4294967296.0 / RATE;
+	int i;
+
+	for (i = 0; i < samples; i++)
+	{
+		dst[i] = (pos & 0x80000000) ? (AMPLITUDE / 2) : (-AMPLITUDE / 2);
+		pos += step;
+	}
+}
+
+static void fft (double *re, double *im, int n)
+{
+	int i, j, len;
+
+	for (i = 1, j = 0; i < n; i++)
+	{
+		int bit = n >> 1;
+		for (; j & bit; bit >>= 1)
+		{
+			j ^= bit;
+		}
+		j ^= bit;
+		if (i < j)
+		{
+			double t;
+			t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+	for (len = 2; len <= n; len <<= 1)
+	{
+		for (i = 0; i < n; i += len)
+		{
+			for (j = 0; j < len / 2; j++)
+			{
+				double wr = cos (-2 * M_PI * j / len), wi = sin (-2 * M_PI * j / len);
+				double xr = re[i + j + len / 2] * wr - im[i + j + len / 2] * wi;
+				double xi = re[i + j + len / 2] * wi + im[i + j + len / 2] * wr;
+				re[i + j + len / 2] = re[i + j] - xr;
+				im[i + j + len / 2] = im[i + j] - xi;
+				re[i + j] += xr;
+				im[i + j] += xi;
+			}
+		}
+	}
+}
+
+/* Energy below 16kHz that is not a harmonic of freq, relative to the harmonics, in dB.
+ * Aliases that land above are hard to hear, and the band-limited steps roll off there. */
+static double aliasing (const int16_t *src, double freq)
+{
+	static double re[FFTLEN], im[FFTLEN];
+	double harmonics = 0.0, other = 0.0;
+	int i;
+
+	for (i = 0; i < FFTLEN; i++)
+	{ /* Blackman-Harris window, the side lobes are below -90dB */
+		double w = 0.35875 - 0.48829 * cos (2 * M_PI * i / FFTLEN) + 0.14128 * cos (4 * M_PI * i / FFTLEN) - 0.01168 * cos (6 * M_PI * i / FFTLEN);
+		re[i] = src[i] * w;
+		im[i] = 0.0;
+	}
+	fft (re, im, FFTLEN);
+
+	for (i = 1; i < FFTLEN * 16000 / RATE; i++)
+	{
+		double bin = (double)i * RATE / FFTLEN;
+		double h = bin / freq;
+		double e = re[i] * re[i] + im[i] * im[i];
+
+		/* odd harmonics, and the main lobe of the window around them */
+		if (((int)lrint (h) & 1) && (fabs (bin - lrint (h) * freq) < 5.0 * RATE / FFTLEN))
+		{
+			harmonics += e;
+		} else {
+			other += e;
+		}
+	}
+	return 10.0 * log10 (other / harmonics);
+}
+
+static int test_aliasing (void)
+{
+	static const int periods[] = {40, 15, 7};
+	int i, failed = 0;
+
+	for (i = 0; i < sizeof (periods) / sizeof (periods[0]); i++)
+	{
+		struct psg_t *p = psg_new (AY_CLOCK, RATE, 0, AMPLITUDE);
+		double freq = AY_CLOCK / (16.0 * periods[i]);
+		double naive, blep;
+
+		psg_write (p, 0, 7, 0x3e);
+		psg_write (p, 0, 0, periods[i]);
+		psg_write (p, 0, 8, 15);
+		psg_render (p, buf, 1, RATE + FFTLEN);
+		blep = aliasing (buf + RATE, freq);
+
+		naive_tone (buf, FFTLEN, freq);
+		naive = aliasing (buf, freq);
+
+		printf ("aliasing of %5.0fHz: %6.1fdB, sampled per output sample %6.1fdB: ", freq, blep, naive);
+		failed |= result ((blep > -50.0) || (blep > naive - 20.0));
+		psg_free (p);
+	}
+	return failed;
+}
+
+/* three tones, noise on one of them and the envelope on another, for 10 seconds */
+static void benchmark (void)
+{
+	struct psg_t *p = psg_new (AY_CLOCK, RATE, PSG_FLAGS_SEPARATE, AMPLITUDE);
+	struct timespec t1, t2;
+	double elapsed;
+	int i;
+
+	psg_write (p, 0, 7, 0x38 & ~0x08);
+	psg_write (p, 0, 0, 254);
+	psg_write (p, 0, 2, 170);
+	psg_write (p, 0, 4, 127);
+	psg_write (p, 0, 6, 12);
+	psg_write (p, 0, 8, 15);
+	psg_write (p, 0, 9, 16);
+	psg_write (p, 0, 10, 13);
+	psg_write (p, 0, 11, 64);
+	psg_write (p, 0, 13, 14);
+
+	clock_gettime (CLOCK_MONOTONIC, &t1);
+	for (i = 0; i < 500; i++)
+	{ /* one frame at 50Hz, with a register change */
+		psg_write (p, 0, 0, 200 + (i & 63));
+		psg_render (p, buf, 4, RATE / 50);
+	}
+	clock_gettime (CLOCK_MONOTONIC, &t2);
+	elapsed = (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1000000000.0;
+
+	printf ("benchmark: %6.2f ns per output sample, %5.2f%% of one CPU at %dHz\n", elapsed * 1000000000.0 / (500.0 * RATE / 50), elapsed * 100.0 / 10.0, RATE);
+	psg_free (p);
+}
+
+int main (int argc, char *argv[])
+{
+	int retval = 0;
+
+	retval |= test_envelope ();
+	retval |= test_level ();
+	retval |= test_frequency ();
+	retval |= test_sid ();
+	retval |= test_blocks ();
+	retval |= test_aliasing ();
+	benchmark ();
+
+	return retval;
+}
@@ -0,0 +1,393 @@
+/* OpenCP Module Player
+ * copyright (c) 2022 Stian Skjelstad <stian.skjelstad@gmail.com>
+ *
+ * Windowed-sinc polyphase resampler for 16bit stereo streams
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "resample.h"
+
+#if defined(__SSE__)
+# include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+# include <arm_neon.h>
+#endif
+
+#define RESAMPLE_HISTLEN 1024   /* input samples kept as float, per channel */
+#define RESAMPLE_CUTOFF  0.90   /* pass-band edge, relative to the lower of the two Nyquist frequencies */
+#define RESAMPLE_BETA    8.0    /* Kaiser window shape */
+#define RESAMPLE_BANKS   4      /* filter banks kept per resampler, so a speed slide that goes back and forth does not rebuild them */
+
+struct resample_bank_t
+{
+	uint32_t key;  /* resample_bankkey() of the rates it is made for, 0 if unused */
+	uint32_t used; /* bankclock at the last use, the least recently used bank is replaced */
+	/* the filter for sub-sample position p/RESAMPLE_PHASES is found at taps[p*RESAMPLE_TAPS]. One extra phase so we can interpolate between neighbours */
+	float taps[(RESAMPLE_PHASES + 1) * RESAMPLE_TAPS];
+};
+
+struct resample_t
+{
+	struct resample_bank_t banks[RESAMPLE_BANKS];
+	uint32_t bankclock;
+	const float *bank; /* taps of the bank in use */
+	uint32_t bankrate; /* rate bank was selected for */
+
+	uint32_t fpos; /* 16bit sub-sample position between histl[start] and histl[start+1], relative to the filter center */
+	int start;     /* first input sample under the filter */
+	int fill;      /* number of input samples in histl/histr */
+	float histl[RESAMPLE_HISTLEN];
+	float histr[RESAMPLE_HISTLEN];
+};
+
+static double resample_bessel_i0 (double x)
+{
+	double sum = 1.0, term = 1.0;
+	int k;
+
+	for (k = 1; k < 32; k++)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < sum * 1e-12)
+		{
+			break;
+		}
+	}
+	return sum;
+}
+
+/* The cut-off only depends on the rate when down-sampling, and a change of 1/256 in the rate moves it too little to
+ * matter. Rates that give the same key share a bank */
+static inline uint32_t resample_bankkey (uint32_t rate)
+{
+	if (rate <= 0x10000)
+	{
+		return 0x10000;
+	}
+	return (rate + 0x80) & ~0xff;
+}
+
+static void resample_makebank (float *bank, uint32_t key)
+{
+	double cutoff = RESAMPLE_CUTOFF;
+	double i0beta = resample_bessel_i0 (RESAMPLE_BETA);
+	int p, k;
+
+	if (key > 0x10000)
+	{ /* down-sampling, move the cut-off below the output Nyquist frequency */
+		cutoff = cutoff * 65536.0 / key;
+	}
+
+	for (p = 0; p <= RESAMPLE_PHASES; p++)
+	{
+		float *b = bank + p * RESAMPLE_TAPS;
+		double sum = 0.0;
+
+		for (k = 0; k < RESAMPLE_TAPS; k++)
+		{
+			double x = k - (RESAMPLE_TAPS / 2 - 1) - (double)p / RESAMPLE_PHASES;
+			double w = x / (RESAMPLE_TAPS / 2);
+			double s = (x == 0.0) ? cutoff : sin (M_PI * cutoff * x) / (M_PI * x);
+
+			if (w > 1.0 || w < -1.0)
+			{
+				s = 0.0;
+			} else {
+				s *= resample_bessel_i0 (RESAMPLE_BETA * sqrt (1.0 - w * w)) / i0beta;
+			}
+			b[k] = s;
+			sum += s;
+		}
+		/* unity gain at DC for every phase */
+		for (k = 0; k < RESAMPLE_TAPS; k++)
+		{
+			b[k] /= sum;
+		}
+	}
+}
+
+static void resample_selectbank (struct resample_t *self, uint32_t rate)
+{
+	uint32_t key = resample_bankkey (rate);
+	struct resample_bank_t *bank = 0;
+	int i;
+
+	for (i = 0; i < RESAMPLE_BANKS; i++)
+	{
+		if (self->banks[i].key == key)
+		{
+			bank = self->banks + i;
+			break;
+		}
+		if ((!bank) || (self->banks[i].used < bank->used))
+		{
+			bank = self->banks + i;
+		}
+	}
+	if (bank->key != key)
+	{
+		resample_makebank (bank->taps, key);
+		bank->key = key;
+	}
+	bank->used = ++self->bankclock;
+
+	self->bank = bank->taps;
+	self->bankrate = rate;
+}
+
+void resample_reset (struct resample_t *self)
+{
+	/* pre-load the part of the filter that is behind the center with silence, so the first output sample matches the first input sample */
+	self->fpos = 0;
+	self->start = 0;
+	self->fill = RESAMPLE_TAPS / 2 - 1;
+	memset (self->histl, 0, sizeof (self->histl[0]) * self->fill);
+	memset (self->histr, 0, sizeof (self->histr[0]) * self->fill);
+}
+
+static inline int16_t resample_fragment (const int16_t *src, int pos1, int length1, int pos2, int i, int channel)
+{
+	return (i < length1) ? src[((pos1 + i)<<1) + channel] : src[((pos2 + i - length1)<<1) + channel];
+}
+
+void resample_feed (struct resample_t *self, const int16_t *src, int pos1, int length1, int pos2, int length2)
+{
+	/* leave the history as resample_reset() does, but with the last input samples instead of silence */
+	const int keep = RESAMPLE_TAPS / 2 - 1;
+	const int total = length1 + length2;
+	float l[RESAMPLE_TAPS], r[RESAMPLE_TAPS];
+	int old = 0, i;
+
+	if (total < keep)
+	{ /* a short fragment, the oldest part of the history comes from what was there before */
+		int have = self->fill - self->start;
+
+		old = keep - total;
+		for (i = 0; i < old; i++)
+		{
+			int j = have - old + i;
+			l[i] = (j >= 0) ? self->histl[self->start + j] : 0.0f;
+			r[i] = (j >= 0) ? self->histr[self->start + j] : 0.0f;
+		}
+	}
+	for (i = old; i < keep; i++)
+	{
+		int j = total - keep + i;
+		l[i] = resample_fragment (src, pos1, length1, pos2, j, 0);
+		r[i] = resample_fragment (src, pos1, length1, pos2, j, 1);
+	}
+
+	memcpy (self->histl, l, sizeof (l[0]) * keep);
+	memcpy (self->histr, r, sizeof (r[0]) * keep);
+	self->fpos = 0;
+	self->start = 0;
+	self->fill = keep;
+}
+
+struct resample_t *resample_new (void)
+{
+	struct resample_t *self = calloc (sizeof (*self), 1);
+
+	if (!self)
+	{
+		return 0;
+	}
+	resample_reset (self);
+
+	return self;
+}
+
+void resample_free (struct resample_t *self)
+{
+	free (self);
+}
+
+static int resample_fetch (struct resample_t *self, const int16_t *src, int *pos1, int *length1, int *pos2, int *length2, int want)
+{
+	int got = 0;
+
+	while (want && *length1)
+	{
+		int n = (*length1 < want) ? *length1 : want;
+		const int16_t *s = src + (*pos1 << 1);
+		int i;
+
+		for (i = 0; i < n; i++)
+		{
+			self->histl[self->fill + i] = s[(i<<1) + 0];
+			self->histr[self->fill + i] = s[(i<<1) + 1];
+		}
+		self->fill += n;
+		got += n;
+		want -= n;
+
+		*pos1 += n;
+		if (!(*length1 -= n))
+		{
+			*pos1 = *pos2;
+			*length1 = *length2;
+			*pos2 = 0;
+			*length2 = 0;
+		}
+	}
+
+	return got;
+}
+
+static inline int16_t resample_clip (float v)
+{
+	if (v >= 32767.0f)
+	{
+		return 32767;
+	}
+	if (v <= -32768.0f)
+	{
+		return -32768;
+	}
+	return (int16_t)lrintf (v);
+}
+
+static inline void resample_one (const struct resample_t *self, int16_t *dst)
+{
+	const float *b0 = self->bank + (self->fpos >> 8) * RESAMPLE_TAPS;
+	const float *b1 = b0 + RESAMPLE_TAPS;
+	const float *hl = self->histl + self->start;
+	const float *hr = self->histr + self->start;
+	float l, r;
+#if defined(__SSE__)
+	__m128 f = _mm_set1_ps ((self->fpos & 0xff) * (1.0f / 256.0f));
+	__m128 accl = _mm_setzero_ps ();
+	__m128 accr = _mm_setzero_ps ();
+	int k;
+
+	for (k = 0; k < RESAMPLE_TAPS; k += 4)
+	{
+		__m128 c0 = _mm_loadu_ps (b0 + k);
+		__m128 c = _mm_add_ps (c0, _mm_mul_ps (f, _mm_sub_ps (_mm_loadu_ps (b1 + k), c0)));
+		accl = _mm_add_ps (accl, _mm_mul_ps (c, _mm_loadu_ps (hl + k)));
+		accr = _mm_add_ps (accr, _mm_mul_ps (c, _mm_loadu_ps (hr + k)));
+	}
+	accl = _mm_add_ps (accl, _mm_movehl_ps (accl, accl));
+	accr = _mm_add_ps (accr, _mm_movehl_ps (accr, accr));
+	accl = _mm_add_ss (accl, _mm_shuffle_ps (accl, accl, 1));
+	accr = _mm_add_ss (accr, _mm_shuffle_ps (accr, accr, 1));
+	l = _mm_cvtss_f32 (accl);
+	r = _mm_cvtss_f32 (accr);
+#elif defined(__ARM_NEON)
+	float32x4_t f = vdupq_n_f32 ((self->fpos & 0xff) * (1.0f / 256.0f));
+	float32x4_t accl = vdupq_n_f32 (0.0f);
+	float32x4_t accr = vdupq_n_f32 (0.0f);
+	float32x2_t suml, sumr;
+	int k;
+
+	for (k = 0; k < RESAMPLE_TAPS; k += 4)
+	{
+		float32x4_t c0 = vld1q_f32 (b0 + k);
+		float32x4_t c = vmlaq_f32 (c0, f, vsubq_f32 (vld1q_f32 (b1 + k), c0));
+		accl = vmlaq_f32 (accl, c, vld1q_f32 (hl + k));
+		accr = vmlaq_f32 (accr, c, vld1q_f32 (hr + k));
+	}
+	suml = vadd_f32 (vget_low_f32 (accl), vget_high_f32 (accl));
+	sumr = vadd_f32 (vget_low_f32 (accr), vget_high_f32 (accr));
+	l = vget_lane_f32 (vpadd_f32 (suml, suml), 0);
+	r = vget_lane_f32 (vpadd_f32 (sumr, sumr), 0);
+#else
+	float f = (self->fpos & 0xff) * (1.0f / 256.0f);
+	int k;
+
+	l = r = 0.0f;
+	for (k = 0; k < RESAMPLE_TAPS; k++)
+	{
+		float c = b0[k] + f * (b1[k] - b0[k]);
+		l += c * hl[k];
+		r += c * hr[k];
+	}
+#endif
+	dst[0] = resample_clip (l);
+	dst[1] = resample_clip (r);
+}
+
+int resample_stereo16 (struct resample_t *self, uint32_t rate, int16_t *dst, int dstlen, const int16_t *src, int pos1, int length1, int pos2, int length2, int *consumed)
+{
+	int produced = 0;
+
+	*consumed = 0;
+
+	if ((self->bankrate != rate) || (!self->bank))
+	{
+		resample_selectbank (self, rate);
+	}
+
+	while (produced < dstlen)
+	{
+		int64_t want;
+		int got;
+
+		/* move the history down to the start of the buffers. start can be ahead of fill if rate skipped past what we have fetched so far */
+		if (self->start >= self->fill)
+		{
+			self->start -= self->fill;
+			self->fill = 0;
+		} else if (self->start)
+		{
+			memmove (self->histl, self->histl + self->start, sizeof (self->histl[0]) * (self->fill - self->start));
+			memmove (self->histr, self->histr + self->start, sizeof (self->histr[0]) * (self->fill - self->start));
+			self->fill -= self->start;
+			self->start = 0;
+		}
+
+		/* only pull what the remaining output needs, so we do not run ahead of the ringbuffer callbacks */
+		want = RESAMPLE_TAPS + self->start - self->fill + (int64_t)((self->fpos + (uint64_t)(dstlen - produced - 1) * rate) >> 16);
+		if (want > RESAMPLE_HISTLEN - self->fill)
+		{
+			want = RESAMPLE_HISTLEN - self->fill;
+		}
+		got = (want > 0) ? resample_fetch (self, src, &pos1, &length1, &pos2, &length2, want) : 0;
+		*consumed += got;
+
+		while ((produced < dstlen) && ((self->fill - self->start) >= RESAMPLE_TAPS))
+		{
+			resample_one (self, dst + (produced << 1));
+			produced++;
+
+			self->fpos += rate;
+			self->start += self->fpos >> 16;
+			self->fpos &= 0xffff;
+		}
+
+		if (!got)
+		{
+			break; /* input ran dry */
+		}
+	}
+
+	return produced;
+}
+
+const struct resampleAPI_t resampleAPI =
+{
+	resample_new,
+	resample_free,
+	resample_reset,
+	resample_feed,
+	resample_stereo16
+};
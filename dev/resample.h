@@ -0,0 +1,45 @@
+#ifndef _RESAMPLE_H
+#define _RESAMPLE_H 1
+
+/* Windowed-sinc polyphase resampler for 16bit stereo streams, shared by the
+ * stream based playback plugins (ogg, flac, wav, mpeg). The input is read
+ * directly from the two fragments given by ringbuffer_get_tail_samples().
+ */
+
+#define RESAMPLE_TAPS   16  /* filter length in input samples, must be a multiple of 4 */
+#define RESAMPLE_PHASES 256 /* number of precomputed sub-sample positions */
+
+struct resample_t;
+
+struct resample_t *resample_new (void);
+void resample_free (struct resample_t *self);
+
+/* forget the history, call after seeking */
+void resample_reset (struct resample_t *self);
+
+/* the same fragments as resample_stereo16() takes, but played 1:1 by the caller without the resampler. Keeps the
+ * history up to date, so that a later switch to resampling (speed or pitch change) continues without a click */
+void resample_feed (struct resample_t *self, const int16_t *src, int pos1, int length1, int pos2, int length2);
+
+/* rate:    input samples per output sample, 16.16 fixed point (0x10000 == 1.0)
+ * dst:     stereo output buffer, room for dstlen samples
+ * src:     the ringbuffer data, stereo 16bit
+ * pos1, length1, pos2, length2: as returned by ringbuffer_get_tail_samples()
+ * consumed: returns how many input samples that can now be released with ringbuffer_tail_consume_samples()
+ *
+ * returns the number of output samples produced. Less than dstlen means that the input ran dry.
+ */
+int resample_stereo16 (struct resample_t *self, uint32_t rate, int16_t *dst, int dstlen, const int16_t *src, int pos1, int length1, int pos2, int length2, int *consumed);
+
+struct resampleAPI_t
+{
+	struct resample_t *(*resample_new) (void);
+	void (*resample_free) (struct resample_t *self);
+	void (*resample_reset) (struct resample_t *self);
+	void (*resample_feed) (struct resample_t *self, const int16_t *src, int pos1, int length1, int pos2, int length2);
+	int (*resample_stereo16) (struct resample_t *self, uint32_t rate, int16_t *dst, int dstlen, const int16_t *src, int pos1, int length1, int pos2, int length2, int *consumed);
+};
+
+extern const struct resampleAPI_t resampleAPI;
+
+#endif
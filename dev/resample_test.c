@@ -0,0 +1,275 @@
+/* OpenCP Module Player
+ * copyright (c) 2022 Stian Skjelstad <stian.skjelstad@gmail.com>
+ *
+ * unit-test of "resample.c"
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "types.h"
+#include "resample.h"
+
+#define SRCRATE 44100
+#define DSTRATE 48000
+#define SRCLEN  8192
+#define DSTLEN  8192
+
+char *OKSTR="\x1b[1m\x1b[32mok\x1b[0m\x1b[37m";
+char *FAILEDSTR="\x1b[1m\x1b[31mfailed\x1b[0m\x1b[37m";
+
+static int16_t src[SRCLEN*2];
+static int16_t dst1[DSTLEN*2];
+static int16_t dst2[DSTLEN*2];
+
+static uint32_t rate = (uint32_t)(65536.0 * SRCRATE / DSTRATE);
+
+/* 1kHz on the left channel and 10kHz on the right, compare against the ideal signal */
+static int test_sine (void)
+{
+	struct resample_t *r = resample_new ();
+	double errl = 0.0, errr = 0.0, sigl = 0.0, sigr = 0.0;
+	int consumed, produced, i;
+
+	for (i=0; i < SRCLEN; i++)
+	{
+		src[(i<<1)+0] = lrint (16384.0 * sin (2.0 * M_PI * 1000.0 * i / SRCRATE));
+		src[(i<<1)+1] = lrint (16384.0 * sin (2.0 * M_PI * 10000.0 * i / SRCRATE));
+	}
+
+	produced = resample_stereo16 (r, rate, dst1, DSTLEN, src, 0, SRCLEN, -1, 0, &consumed);
+
+	/* skip the filter warm-up at the start */
+	for (i=64; i < produced; i++)
+	{
+		double t = (double)i * rate / 65536.0;
+		double il = 16384.0 * sin (2.0 * M_PI * 1000.0 * t / SRCRATE);
+		double ir = 16384.0 * sin (2.0 * M_PI * 10000.0 * t / SRCRATE);
+		errl += (dst1[(i<<1)+0] - il) * (dst1[(i<<1)+0] - il);
+		errr += (dst1[(i<<1)+1] - ir) * (dst1[(i<<1)+1] - ir);
+		sigl += il * il;
+		sigr += ir * ir;
+	}
+	resample_free (r);
+
+	printf ("44100 => 48000, %d in, %d out: 1kHz SNR %.1f dB, 10kHz SNR %.1f dB: ", consumed, produced, 10.0 * log10 (sigl / errl), 10.0 * log10 (sigr / errr));
+	if ((10.0 * log10 (sigl / errl) < 60.0) || (10.0 * log10 (sigr / errr) < 40.0))
+	{
+		printf ("%s\n", FAILEDSTR);
+		return 1;
+	}
+	printf ("%s\n", OKSTR);
+	return 0;
+}
+
+/* feeding the stream in odd sized, wrapped fragments must give the same result as one large call */
+static int test_streaming (void)
+{
+	struct resample_t *r = resample_new ();
+	static int16_t ring[1000*2];
+	int srcpos = 0, dstpos = 0, i;
+	int ringtail = 0, ringfill = 0;
+
+	while (dstpos < 4096)
+	{
+		int pos1, length1, pos2, length2, consumed, produced, want;
+
+		/* top up the ring from the source */
+		while ((ringfill < 999) && (srcpos < SRCLEN))
+		{
+			int at = (ringtail + ringfill) % 1000;
+			ring[(at<<1)+0] = src[(srcpos<<1)+0];
+			ring[(at<<1)+1] = src[(srcpos<<1)+1];
+			ringfill++;
+			srcpos++;
+		}
+
+		pos1 = ringtail;
+		if (ringtail + ringfill <= 1000)
+		{
+			length1 = ringfill;
+			pos2 = -1;
+			length2 = 0;
+		} else {
+			length1 = 1000 - ringtail;
+			pos2 = 0;
+			length2 = ringfill - length1;
+		}
+
+		want = 1 + (dstpos % 313);
+		if (want > 4096 - dstpos)
+		{
+			want = 4096 - dstpos;
+		}
+		produced = resample_stereo16 (r, rate, dst2 + (dstpos<<1), want, ring, pos1, length1, pos2, length2, &consumed);
+		ringtail = (ringtail + consumed) % 1000;
+		ringfill -= consumed;
+		dstpos += produced;
+		if (!produced)
+		{
+			break;
+		}
+	}
+	resample_free (r);
+
+	printf ("streaming in fragments matches a single call: ");
+	for (i=0; i < (dstpos<<1); i++)
+	{
+		if (dst1[i] != dst2[i])
+		{
+			printf ("%s (sample %d differs, %d != %d)\n", FAILEDSTR, i>>1, dst1[i], dst2[i]);
+			return 1;
+		}
+	}
+	if (dstpos != 4096)
+	{
+		printf ("%s (stopped after %d samples)\n", FAILEDSTR, dstpos);
+		return 1;
+	}
+	printf ("%s\n", OKSTR);
+	return 0;
+}
+
+/* a stream that was played 1:1 with resample_feed() and then changes speed must continue from what was played, not from old history */
+static int test_feed (void)
+{
+	struct resample_t *r = resample_new ();
+	static int16_t dc[1000*2];
+	int consumed, produced, i, maxerr = 0;
+
+	produced = resample_stereo16 (r, rate, dst1, 1000, src, 0, SRCLEN, -1, 0, &consumed);
+	for (i=0; i < 1000; i++)
+	{
+		dc[(i<<1)+0] = 10000;
+		dc[(i<<1)+1] = -10000;
+	}
+	resample_feed (r, dc, 600, 400, 0, 300);
+	resample_feed (r, dc, 0, 3, -1, 0);
+	produced = resample_stereo16 (r, 0x10400, dst2, 500, dc, 0, 1000, -1, 0, &consumed);
+	for (i=0; i < produced; i++)
+	{
+		int el = abs (dst2[(i<<1)+0] - 10000);
+		int er = abs (dst2[(i<<1)+1] + 10000);
+		if (el > maxerr) maxerr = el;
+		if (er > maxerr) maxerr = er;
+	}
+	resample_free (r);
+
+	printf ("1:1 copy followed by resampling, largest step %d: ", maxerr);
+	if ((produced != 500) || (maxerr > 2))
+	{
+		printf ("%s\n", FAILEDSTR);
+		return 1;
+	}
+	printf ("%s\n", OKSTR);
+	return 0;
+}
+
+/* the down-sampling filter follows the rate, going back to a rate after visiting others must give the same output */
+static int test_banks (void)
+{
+	struct resample_t *r1 = resample_new ();
+	struct resample_t *r2 = resample_new ();
+	const uint32_t down = 0x18000;
+	int consumed, produced1, produced2, i;
+
+	produced1 = resample_stereo16 (r1, down, dst1, 1000, src, 0, SRCLEN, -1, 0, &consumed);
+	for (i=0; i < 6; i++)
+	{ /* more rates than there are banks kept */
+		resample_reset (r2);
+		resample_stereo16 (r2, down + (i + 1) * 0x2000, dst2, 1000, src, 0, SRCLEN, -1, 0, &consumed);
+	}
+	resample_reset (r2);
+	resample_stereo16 (r2, down, dst2, 1000, src, 0, SRCLEN, -1, 0, &consumed);
+	resample_reset (r2);
+	resample_stereo16 (r2, down + 0x2000, dst2, 1000, src, 0, SRCLEN, -1, 0, &consumed);
+	resample_reset (r2);
+	produced2 = resample_stereo16 (r2, down, dst2, 1000, src, 0, SRCLEN, -1, 0, &consumed);
+	resample_free (r1);
+	resample_free (r2);
+
+	printf ("down-sampling filter after changing the rate back and forth: ");
+	if ((produced1 != produced2) || memcmp (dst1, dst2, produced1 * 2 * sizeof (dst1[0])))
+	{
+		printf ("%s\n", FAILEDSTR);
+		return 1;
+	}
+	printf ("%s\n", OKSTR);
+	return 0;
+}
+
+static void bench (void)
+{
+	struct resample_t *r = resample_new ();
+	struct timespec t1, t2;
+	double elapsed;
+	long total = 0;
+	int i;
+
+	clock_gettime (CLOCK_MONOTONIC, &t1);
+	for (i=0; i < 500; i++)
+	{
+		int consumed;
+		resample_reset (r);
+		total += resample_stereo16 (r, rate, dst1, DSTLEN, src, 0, SRCLEN, -1, 0, &consumed);
+	}
+	clock_gettime (CLOCK_MONOTONIC, &t2);
+	elapsed = (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1000000000.0;
+	resample_free (r);
+
+	printf ("%.1f ns per stereo output sample, %.0fx realtime at %d Hz\n", elapsed * 1000000000.0 / total, total / elapsed / DSTRATE, DSTRATE);
+}
+
+/* a slow speed slide while down-sampling, the rate changes a little for every call */
+static void bench_slide (void)
+{
+	struct resample_t *r = resample_new ();
+	struct timespec t1, t2;
+	double elapsed;
+	long total = 0;
+	int i;
+
+	clock_gettime (CLOCK_MONOTONIC, &t1);
+	for (i=0; i < 2000; i++)
+	{
+		int consumed;
+		resample_reset (r);
+		total += resample_stereo16 (r, 0x18000 + (i & 255) * 0x10, dst1, 256, src, 0, SRCLEN, -1, 0, &consumed);
+	}
+	clock_gettime (CLOCK_MONOTONIC, &t2);
+	elapsed = (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1000000000.0;
+	resample_free (r);
+
+	printf ("speed slide: %.1f ns per stereo output sample\n", elapsed * 1000000000.0 / total);
+}
+
+int main(int argc, char *argv[])
+{
+	int retval = 0;
+
+	retval |= test_sine ();
+	retval |= test_streaming ();
+	retval |= test_feed ();
+	retval |= test_banks ();
+	bench ();
+	bench_slide ();
+
+	return retval;
+}
@@ -20,6 +20,8 @@
 
 #include "config.h"
 #include <assert.h>
+#include <stdatomic.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "ringbuffer.h"
@@ -53,8 +55,37 @@ struct ringbuffer_t
 	struct ringbuffer_callback_hook_t *processing_callbacks;
 	int processing_callbacks_size;
 	int processing_callbacks_fill;
+
+	/* RINGBUFFER_FLAGS_SPSC: head is only written by the producer and tail only by the consumer, each on its own cache-line */
+	char spsc_pad0[64];
+	atomic_int spsc_head;
+	char spsc_pad1[64 - sizeof (atomic_int)];
+	atomic_int spsc_tail;
+	char spsc_pad2[64 - sizeof (atomic_int)];
 };
 
+static inline int ringbuffer_spsc_read_available (struct ringbuffer_t *self, int *tail)
+{
+	int t = atomic_load_explicit (&self->spsc_tail, memory_order_acquire);
+	int h = atomic_load_explicit (&self->spsc_head, memory_order_acquire);
+	if (tail)
+	{
+		*tail = t;
+	}
+	return (self->buffersize + h - t) % self->buffersize;
+}
+
+static inline int ringbuffer_spsc_write_available (struct ringbuffer_t *self, int *head)
+{
+	int h = atomic_load_explicit (&self->spsc_head, memory_order_acquire);
+	int t = atomic_load_explicit (&self->spsc_tail, memory_order_acquire);
+	if (head)
+	{
+		*head = h;
+	}
+	return (self->buffersize + t - h - 1) % self->buffersize;
+}
+
 void ringbuffer_reset (struct ringbuffer_t *self)
 {
 	int i;
@@ -63,6 +94,9 @@ void ringbuffer_reset (struct ringbuffer_t *self)
 	self->processing = 0;
 	self->tail = 0;
 
+	atomic_store_explicit (&self->spsc_head, 0, memory_order_relaxed);
+	atomic_store_explicit (&self->spsc_tail, 0, memory_order_relaxed);
+
 	self->cache_write_available = self->buffersize - 1;
 	self->cache_read_available = 0;
 	self->cache_processing_available = 0;
@@ -88,6 +122,9 @@ static void ringbuffer_static_initialize (struct ringbuffer_t *self, int flags,
 	/* we can only have one bitdepth */
 	assert  ( ((!!(self->flags & RINGBUFFER_FLAGS_8BIT)) + (!!(self->flags & RINGBUFFER_FLAGS_16BIT)) + (!!(self->flags & RINGBUFFER_FLAGS_FLOAT))) == 1);
 
+	/* the processing cursor would need to be a third party */
+	assert (!((self->flags & RINGBUFFER_FLAGS_SPSC) && (self->flags & RINGBUFFER_FLAGS_PROCESS)));
+
 	if (self->flags & RINGBUFFER_FLAGS_STEREO)
 	{
 		self->cache_sample_shift++;
@@ -138,6 +175,14 @@ void ringbuffer_free(struct ringbuffer_t *self)
 
 void ringbuffer_tail_consume_samples(struct ringbuffer_t *self, int samples)
 {
+	if (self->flags & RINGBUFFER_FLAGS_SPSC)
+	{
+		int t;
+		assert (samples <= ringbuffer_spsc_read_available (self, &t));
+		atomic_store_explicit (&self->spsc_tail, (t + samples) % self->buffersize, memory_order_release);
+		return;
+	}
+
 	assert (samples <= self->cache_read_available);
 	self->tail = (self->tail + samples) % self->buffersize;
 
@@ -169,7 +214,8 @@ void ringbuffer_tail_consume_samples(struct ringbuffer_t *self, int samples)
 
 void ringbuffer_tail_set_samples(struct ringbuffer_t *self, int pos)
 {
-	int samples = (self->buffersize + pos - self->tail) % self->buffersize;
+	int tail = (self->flags & RINGBUFFER_FLAGS_SPSC) ? atomic_load_explicit (&self->spsc_tail, memory_order_relaxed) : self->tail;
+	int samples = (self->buffersize + pos - tail) % self->buffersize;
 
 	ringbuffer_tail_consume_samples (self, samples);
 }
@@ -217,6 +263,14 @@ void ringbuffer_processing_set_samples(struct ringbuffer_t *self, int pos)
 
 void ringbuffer_head_add_samples(struct ringbuffer_t *self, int samples)
 {
+	if (self->flags & RINGBUFFER_FLAGS_SPSC)
+	{
+		int h;
+		assert (samples <= ringbuffer_spsc_write_available (self, &h));
+		atomic_store_explicit (&self->spsc_head, (h + samples) % self->buffersize, memory_order_release);
+		return;
+	}
+
 	assert (samples <= self->cache_write_available);
 
 	self->head = (self->head + samples) % self->buffersize;
@@ -235,13 +289,18 @@ void ringbuffer_head_add_samples(struct ringbuffer_t *self, int samples)
 
 void ringbuffer_head_set_samples(struct ringbuffer_t *self, int pos)
 {
-	int samples = (self->buffersize + pos - self->head) % self->buffersize;
+	int head = (self->flags & RINGBUFFER_FLAGS_SPSC) ? atomic_load_explicit (&self->spsc_head, memory_order_relaxed) : self->head;
+	int samples = (self->buffersize + pos - head) % self->buffersize;
 
 	ringbuffer_head_add_samples (self, samples);
 }
 
 int ringbuffer_get_tail_available_samples (struct ringbuffer_t *self)
 {
+	if (self->flags & RINGBUFFER_FLAGS_SPSC)
+	{
+		return ringbuffer_spsc_read_available (self, 0);
+	}
 	return self->cache_read_available;
 }
 
@@ -252,24 +311,38 @@ int ringbuffer_get_processing_available_samples (struct ringbuffer_t *self)
 
 int ringbuffer_get_head_available_samples (struct ringbuffer_t *self)
 {
+	if (self->flags & RINGBUFFER_FLAGS_SPSC)
+	{
+		return ringbuffer_spsc_write_available (self, 0);
+	}
 	return self->cache_write_available;
 }
 
 void ringbuffer_get_tail_samples (struct ringbuffer_t *self, int *pos1, int *length1, int *pos2, int *length2)
 {
-	if (!self->cache_read_available)
+	int tail, available;
+
+	if (self->flags & RINGBUFFER_FLAGS_SPSC)
+	{
+		available = ringbuffer_spsc_read_available (self, &tail);
+	} else {
+		tail = self->tail;
+		available = self->cache_read_available;
+	}
+
+	if (!available)
 	{
 		goto clear1;
 	}
 
-	*pos1 = self->tail;
-	if ((self->tail + self->cache_read_available) <= self->buffersize)
+	*pos1 = tail;
+	if ((tail + available) <= self->buffersize)
 	{
-		*length1 = self->cache_read_available;
+		*length1 = available;
 		goto clear2;
 	}
 
-	*length1 = self->buffersize - self->tail;
+	*length1 = self->buffersize - tail;
 
 	if (pos2)
 	{
@@ -277,7 +350,7 @@ void ringbuffer_get_tail_samples (struct ringbuffer_t *self, int *pos1, int *len
 	}
 	if (length2)
 	{
-		*length2 = self->cache_read_available - *length1;
+		*length2 = available - *length1;
 	}
 
 	return;
@@ -341,8 +414,15 @@ clear2:
 
 void ringbuffer_get_tailandprocessing_samples (struct ringbuffer_t *self, int *pos1, int *length1, int *pos2, int *length2)
 {
-	int temp = self->cache_read_available + self->cache_processing_available;
+	int temp;
+
+	if (self->flags & RINGBUFFER_FLAGS_SPSC)
+	{
+		fprintf (stderr, "ringbuffer_get_tailandprocessing_samples() called for a buffer that has RINGBUFFER_FLAGS_SPSC\n");
+		goto clear1;
+	}
 	assert (self->flags & RINGBUFFER_FLAGS_PROCESS);
+	temp = self->cache_read_available + self->cache_processing_available;
 
 	if (!temp)
 	{
@@ -385,19 +465,29 @@ clear2:
 
 void ringbuffer_get_head_samples (struct ringbuffer_t *self, int *pos1, int *length1, int *pos2, int *length2)
 {
-	if (!self->cache_write_available)
+	int head, available;
+
+	if (self->flags & RINGBUFFER_FLAGS_SPSC)
+	{
+		available = ringbuffer_spsc_write_available (self, &head);
+	} else {
+		head = self->head;
+		available = self->cache_write_available;
+	}
+
+	if (!available)
 	{
 		goto clear1;
 	}
 
-	*pos1 = self->head;
-	if ((self->head + self->cache_write_available) <= self->buffersize)
+	*pos1 = head;
+	if ((head + available) <= self->buffersize)
 	{
-		*length1 = self->cache_write_available;
+		*length1 = available;
 		goto clear2;
 	}
 
-	*length1 = self->buffersize - self->head;
+	*length1 = self->buffersize - head;
 
 	if (pos2)
 	{
@@ -405,7 +495,7 @@ void ringbuffer_get_head_samples (struct ringbuffer_t *self, int *pos1, int *len
 	}
 	if (length2)
 	{
-		*length2 = self->cache_write_available - *length1;
+		*length2 = available - *length1;
 	}
 
 	return;
@@ -527,6 +617,13 @@ int ringbuffer_get_head_available_bytes (struct ringbuffer_t *self)
 void ringbuffer_add_tail_callback_samples (struct ringbuffer_t *self, int samples, void (*callback)(void *arg, int samples_ago), const void *arg)
 {
 	int insertat, i;
+
+	if (self->flags & RINGBUFFER_FLAGS_SPSC)
+	{
+		fprintf (stderr, "ringbuffer_add_tail_callback_samples() called for a buffer that has RINGBUFFER_FLAGS_SPSC\n");
+		return;
+	}
+
 /*	if (samples < 0)
 	{
 		samples = 0;
@@ -561,6 +658,11 @@ void ringbuffer_add_processing_callback_samples (struct ringbuffer_t *self, int
 {
 	int insertat, i;
 
+	if (self->flags & RINGBUFFER_FLAGS_SPSC)
+	{
+		fprintf (stderr, "ringbuffer_add_processing_callback_samples() called for a buffer that has RINGBUFFER_FLAGS_SPSC\n");
+		return;
+	}
 	if (!(self->flags & RINGBUFFER_FLAGS_PROCESS))
 	{
 		fprintf (stderr, "ringbuffer_add_processing_callback_samples() called for a buffer that does not have RINGBUFFER_FLAGS_PROCESS\n");
@@ -14,6 +14,8 @@
 
 #define RINGBUFFER_FLAGS_PROCESS 128 /* if present, processing and cache_process will be maintained */
 
+#define RINGBUFFER_FLAGS_SPSC 256 /* head may be moved by one thread while tail is moved by another. Can not be combined with RINGBUFFER_FLAGS_PROCESS or callbacks. reset and free still requires both threads to be idle */
+
 struct ringbuffer_t;
 
 /* causes all callbacks to be called */
@@ -0,0 +1,156 @@
+/* OpenCP Module Player
+ * copyright (c) 2022 Stian Skjelstad <stian.skjelstad@gmail.com>
+ *
+ * stress-test of RINGBUFFER_FLAGS_SPSC in "ringbuffer.c". A producer and a
+ * consumer thread pass a running counter through the buffer, and the
+ * consumer verifies that every sample arrives once and in order.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "types.h"
+#include "ringbuffer.h"
+
+#define TEST_BUFFERSIZE 1021 /* not a power of two on purpose, to exercise the wrap-around */
+#define TEST_SAMPLES    (32*1024*1024)
+
+static struct ringbuffer_t *rb;
+static uint32_t buffer[TEST_BUFFERSIZE]; /* stereo 16bit == 4 bytes per sample */
+static int errors;
+
+static void *producer (void *arg)
+{
+	uint32_t counter = 0;
+
+	while (counter < TEST_SAMPLES)
+	{
+		int pos1, length1, pos2, length2, i;
+		int want;
+
+		ringbuffer_get_head_samples (rb, &pos1, &length1, &pos2, &length2);
+		if (!length1)
+		{
+			sched_yield ();
+			continue;
+		}
+		/* vary the chunk sizes, so the two threads do not fall into lock-step */
+		want = (counter % 97) + 1;
+		if (want > TEST_SAMPLES - counter)
+		{
+			want = TEST_SAMPLES - counter;
+		}
+		if (length1 > want)
+		{
+			length1 = want;
+			length2 = 0;
+		} else if ((length1 + length2) > want)
+		{
+			length2 = want - length1;
+		}
+		for (i=0; i < length1; i++)
+		{
+			buffer[pos1 + i] = counter++;
+		}
+		for (i=0; i < length2; i++)
+		{
+			buffer[pos2 + i] = counter++;
+		}
+		ringbuffer_head_add_samples (rb, length1 + length2);
+	}
+	return 0;
+}
+
+static void *consumer (void *arg)
+{
+	uint32_t expect = 0;
+
+	while (expect < TEST_SAMPLES)
+	{
+		int pos1, length1, pos2, length2, i;
+
+		ringbuffer_get_tail_samples (rb, &pos1, &length1, &pos2, &length2);
+		if (!length1)
+		{
+			sched_yield ();
+			continue;
+		}
+		for (i=0; i < length1; i++)
+		{
+			if (buffer[pos1 + i] != expect++)
+			{
+				errors++;
+			}
+		}
+		for (i=0; i < length2; i++)
+		{
+			if (buffer[pos2 + i] != expect++)
+			{
+				errors++;
+			}
+		}
+		ringbuffer_tail_consume_samples (rb, length1 + length2);
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t p, c;
+	struct timespec t1, t2;
+	double elapsed;
+
+	rb = ringbuffer_new_samples (RINGBUFFER_FLAGS_STEREO | RINGBUFFER_FLAGS_16BIT | RINGBUFFER_FLAGS_SIGNED | RINGBUFFER_FLAGS_SPSC, TEST_BUFFERSIZE);
+
+	clock_gettime (CLOCK_MONOTONIC, &t1);
+	if (pthread_create (&c, 0, consumer, 0) ||
+	    pthread_create (&p, 0, producer, 0))
+	{
+		fprintf (stderr, "pthread_create() failed\n");
+		return 1;
+	}
+	pthread_join (p, 0);
+	pthread_join (c, 0);
+	clock_gettime (CLOCK_MONOTONIC, &t2);
+	elapsed = (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1000000000.0;
+
+	printf ("SPSC ringbuffer: %d samples in %.3f s, %.1f Msamples/s, %.1f MB/s\n", TEST_SAMPLES, elapsed, TEST_SAMPLES / elapsed / 1000000.0, TEST_SAMPLES * 4.0 / elapsed / (1024.0 * 1024.0));
+
+	if (ringbuffer_get_tail_available_samples (rb) != 0)
+	{
+		printf ("buffer not empty after test\n");
+		errors++;
+	}
+	if (ringbuffer_get_head_available_samples (rb) != TEST_BUFFERSIZE - 1)
+	{
+		printf ("buffer write space %d, expected %d\n", ringbuffer_get_head_available_samples (rb), TEST_BUFFERSIZE - 1);
+		errors++;
+	}
+
+	ringbuffer_free (rb);
+
+	if (errors)
+	{
+		printf ("\x1b[1m\x1b[31m%d samples out of order\x1b[0m\x1b[37m\n", errors);
+		return 1;
+	}
+	printf ("\x1b[1m\x1b[32mok\x1b[0m\x1b[37m\n");
+	return 0;
+}
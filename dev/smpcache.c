@@ -0,0 +1,527 @@
+/* OpenCP Module Player
+ * copyright (c) 2022 Stian Skjelstad <stian.skjelstad@gmail.com>
+ *
+ * On-disk cache of mixer ready sample banks
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <utime.h>
+#include "types.h"
+#include "boot/psetting.h"
+#include "filesel/filesystem.h"
+#include "mcp.h"
+#include "smpcache.h"
+
+/*
+ file format, all numbers are in native byte order (the byteorder field
+ rejects files from other architectures):
+
+  header:
+   8 bytes "OCPSMPC" + format version
+   4 bytes byteorder, 0x01020304
+   4 bytes number of samples
+   8 bytes key
+   4 bytes opt
+   4 bytes mem
+
+  per sample:
+   4 bytes type, length, samprate, loopstart, loopend, sloopstart, sloopend and a reserved field
+   8 bytes offset of the sample data, aligned to SMPCACHE_ALIGN
+   8 bytes size of the sample data
+*/
+
+#define SMPCACHE_MAGIC "OCPSMPC\x01"
+#define SMPCACHE_BYTEORDER 0x01020304
+#define SMPCACHE_ALIGN 4096
+#define SMPCACHE_SAMPEND 8 /* must match SAMPEND in smpman.c */
+
+struct smpcache_header_t
+{
+	char     magic[8];
+	uint32_t byteorder;
+	uint32_t n;
+	uint64_t key;
+	uint32_t opt;
+	uint32_t mem;
+};
+
+struct smpcache_entry_t
+{
+	uint32_t type;
+	uint32_t length;
+	uint32_t samprate;
+	uint32_t loopstart;
+	uint32_t loopend;
+	uint32_t sloopstart;
+	uint32_t sloopend;
+	uint32_t reserved;
+	uint64_t offset;
+	uint64_t size;
+};
+
+static int       smpcache_enabled = -1; /* -1 = configuration not read yet */
+static char     *smpcache_dir;          /* with trailing slash */
+static uint64_t  smpcache_limit;        /* in bytes */
+
+static uint64_t  smpcache_key;
+static int     (*smpcache_decode)(void *token);
+static void     *smpcache_token;
+
+static void smpcache_config (void)
+{
+	if (smpcache_enabled >= 0)
+	{
+		return;
+	}
+	smpcache_enabled = cfGetProfileBool2 (cfSoundSec, "sound", "samplecache", 1, 1);
+	smpcache_limit = (uint64_t)cfGetProfileInt2 (cfSoundSec, "sound", "samplecachesize", 256, 10) << 20;
+	if (!smpcache_enabled)
+	{
+		return;
+	}
+	smpcache_dir = malloc (strlen (cfConfigDir) + 12 + 1);
+	if (!smpcache_dir)
+	{
+		smpcache_enabled = 0;
+		return;
+	}
+	sprintf (smpcache_dir, "%ssamplecache/", cfConfigDir);
+}
+
+/* The buffers left behind by mcpReduceSamples(), see repairsmp() and samptofloat() in smpman.c */
+static uint64_t smpcache_datasize (uint32_t type, uint32_t length)
+{
+	int sizefac = ((type & mcpSampFloat) ? 2 : ((type & mcpSamp16Bit) ? 1 : 0)) + ((type & mcpSampStereo) ? 1 : 0);
+
+	return ((uint64_t)length + SMPCACHE_SAMPEND) << sizefac;
+}
+
+static char *smpcache_path (uint64_t key, long mem, int opt)
+{
+	char *path = malloc (strlen (smpcache_dir) + 16 + 1 + 8 + 1 + 16 + 4 + 1);
+
+	if (path)
+	{
+		sprintf (path, "%s%016" PRIx64 "-%08x-%lx.smp", smpcache_dir, key, (unsigned int)opt, (unsigned long)mem);
+	}
+	return path;
+}
+
+uint64_t mcpSampleCacheKey (struct ocpfilehandle_t *file, uint32_t modtype)
+{
+	uint64_t hash = UINT64_C(0xcbf29ce484222325); /* FNV-1a */
+	uint64_t filesize, pos, done = 0;
+	uint8_t *buffer;
+	int i;
+
+	smpcache_config ();
+	if ((!smpcache_enabled) || (!file))
+	{
+		return 0;
+	}
+	filesize = file->filesize (file);
+	if ((filesize == FILESIZE_STREAM) || (filesize == FILESIZE_ERROR))
+	{
+		return 0;
+	}
+	if (!(buffer = malloc (65536)))
+	{
+		return 0;
+	}
+
+	pos = file->getpos (file);
+	file->seek_set (file, 0);
+	while (1)
+	{
+		int res = file->read (file, buffer, 65536);
+		if (res <= 0)
+		{
+			break;
+		}
+		for (i=0; i < res; i++)
+		{
+			hash = (hash ^ buffer[i]) * UINT64_C(0x100000001b3);
+		}
+		done += res;
+	}
+	file->seek_set (file, pos);
+	free (buffer);
+
+	if (done != filesize)
+	{
+		return 0;
+	}
+	for (i=0; i < 8; i++)
+	{
+		hash = (hash ^ ((filesize >> (i * 8)) & 0xff)) * UINT64_C(0x100000001b3);
+	}
+	for (i=0; i < 4; i++)
+	{
+		hash = (hash ^ ((modtype >> (i * 8)) & 0xff)) * UINT64_C(0x100000001b3);
+	}
+	return hash ? hash : 1;
+}
+
+void mcpSampleCacheSelect (uint64_t key, int (*decode)(void *token), void *token)
+{
+	smpcache_key = key;
+	smpcache_decode = decode;
+	smpcache_token = token;
+}
+
+int mcpSampleCacheDecode (void)
+{
+	int (*decode)(void *token) = smpcache_decode;
+
+	smpcache_decode = 0;
+	return decode ? decode (smpcache_token) : 0;
+}
+
+static int smpcache_read_all (int fd, void *dst, uint64_t size, uint64_t offset)
+{
+	while (size)
+	{
+		ssize_t res = pread (fd, dst, (size > 0x40000000) ? 0x40000000 : size, offset);
+		if (res < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return -1;
+		}
+		if (!res)
+		{
+			return -1;
+		}
+		dst = (uint8_t *)dst + res;
+		size -= res;
+		offset += res;
+	}
+	return 0;
+}
+
+static int smpcache_write_all (int fd, const void *src, uint64_t size, uint64_t offset)
+{
+	while (size)
+	{
+		ssize_t res = pwrite (fd, src, (size > 0x40000000) ? 0x40000000 : size, offset);
+		if (res < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return -1;
+		}
+		src = (const uint8_t *)src + res;
+		size -= res;
+		offset += res;
+	}
+	return 0;
+}
+
+int mcpSampleCacheLoad (struct sampleinfo *si, int n, long mem, int opt)
+{
+	struct smpcache_header_t header;
+	struct smpcache_entry_t *entries = 0;
+	void **ptrs = 0;
+	struct stat st;
+	char *path;
+	int fd, i, hit = 0;
+
+	if ((!smpcache_key) || (!smpcache_enabled) || (n < 0))
+	{
+		return 0;
+	}
+	if (!(path = smpcache_path (smpcache_key, mem, opt)))
+	{
+		return 0;
+	}
+	if ((fd = open (path, O_RDONLY)) < 0)
+	{
+		free (path);
+		return 0;
+	}
+	if (fstat (fd, &st) ||
+	    smpcache_read_all (fd, &header, sizeof (header), 0) ||
+	    memcmp (header.magic, SMPCACHE_MAGIC, 8) ||
+	    (header.byteorder != SMPCACHE_BYTEORDER) ||
+	    (header.n != (uint32_t)n) ||
+	    (header.key != smpcache_key) ||
+	    (header.opt != (uint32_t)opt) ||
+	    (header.mem != (uint32_t)mem))
+	{
+		goto out;
+	}
+
+	entries = malloc (sizeof (entries[0]) * (n + 1));
+	ptrs = calloc (sizeof (ptrs[0]), n + 1);
+	if ((!entries) || (!ptrs) ||
+	    smpcache_read_all (fd, entries, sizeof (entries[0]) * n, sizeof (header)))
+	{
+		goto out;
+	}
+
+	for (i=0; i < n; i++)
+	{
+		struct smpcache_entry_t *e = entries + i;
+
+		if ((!e->length) ||
+		    ((e->type & mcpSampLoop) && ((e->loopend > e->length) || (e->loopstart >= e->loopend))) ||
+		    ((e->type & mcpSampSLoop) && ((e->sloopend > e->length) || (e->sloopstart >= e->sloopend))) ||
+		    (e->size != smpcache_datasize (e->type, e->length)) ||
+		    (e->offset & (SMPCACHE_ALIGN - 1)) ||
+		    (e->offset + e->size > (uint64_t)st.st_size))
+		{
+			goto out;
+		}
+		if ((!(ptrs[i] = malloc (e->size))) ||
+		    smpcache_read_all (fd, ptrs[i], e->size, e->offset))
+		{
+			goto out;
+		}
+	}
+
+	/* the loaders free() the sample buffers, so they are read into the heap instead of mapped */
+	for (i=0; i < n; i++)
+	{
+		free (si[i].ptr);
+		si[i].ptr        = ptrs[i];
+		si[i].type       = entries[i].type;
+		si[i].length     = entries[i].length;
+		si[i].samprate   = entries[i].samprate;
+		si[i].loopstart  = entries[i].loopstart;
+		si[i].loopend    = entries[i].loopend;
+		si[i].sloopstart = entries[i].sloopstart;
+		si[i].sloopend   = entries[i].sloopend;
+		ptrs[i] = 0;
+	}
+	hit = 1;
+	utime (path, 0); /* least recently used entries are pruned first */
+
+out:
+	if (ptrs)
+	{
+		for (i=0; i < n; i++)
+		{
+			free (ptrs[i]);
+		}
+		free (ptrs);
+	}
+	free (entries);
+	close (fd);
+	free (path);
+	return hit;
+}
+
+struct smpcache_file_t
+{
+	char *name;
+	time_t mtime;
+	uint64_t size;
+};
+
+static int smpcache_file_cmp (const void *a, const void *b)
+{
+	const struct smpcache_file_t *x = a;
+	const struct smpcache_file_t *y = b;
+
+	return (x->mtime < y->mtime) ? -1 : (x->mtime > y->mtime) ? 1 : 0;
+}
+
+/* Remove the least recently used entries until the cache fits in smpcache_limit */
+static void smpcache_prune (void)
+{
+	struct smpcache_file_t *files = 0;
+	int fill = 0, size = 0, i;
+	uint64_t total = 0;
+	struct dirent *de;
+	DIR *d;
+
+	if (!(d = opendir (smpcache_dir)))
+	{
+		return;
+	}
+	while ((de = readdir (d)))
+	{
+		size_t len = strlen (de->d_name);
+		struct stat st;
+		char *path;
+
+		if ((len < 4) || strcmp (de->d_name + len - 4, ".smp"))
+		{
+			continue;
+		}
+		if (!(path = malloc (strlen (smpcache_dir) + len + 1)))
+		{
+			break;
+		}
+		sprintf (path, "%s%s", smpcache_dir, de->d_name);
+		if (stat (path, &st) || !S_ISREG (st.st_mode))
+		{
+			free (path);
+			continue;
+		}
+		if (fill == size)
+		{
+			struct smpcache_file_t *temp = realloc (files, sizeof (files[0]) * (size + 64));
+			if (!temp)
+			{
+				free (path);
+				break;
+			}
+			files = temp;
+			size += 64;
+		}
+		files[fill].name = path;
+		files[fill].mtime = st.st_mtime;
+		files[fill].size = st.st_size;
+		total += st.st_size;
+		fill++;
+	}
+	closedir (d);
+
+	if (total > smpcache_limit)
+	{
+		qsort (files, fill, sizeof (files[0]), smpcache_file_cmp);
+		for (i=0; (i < fill) && (total > smpcache_limit); i++)
+		{
+			if (!unlink (files[i].name))
+			{
+				total -= files[i].size;
+			}
+		}
+	}
+
+	for (i=0; i < fill; i++)
+	{
+		free (files[i].name);
+	}
+	free (files);
+}
+
+void mcpSampleCacheStore (const struct sampleinfo *si, int n, long mem, int opt)
+{
+	struct smpcache_header_t header;
+	struct smpcache_entry_t *entries;
+	uint64_t offset;
+	char *path, *temppath;
+	int fd, i, failed = 0;
+
+	if ((!smpcache_key) || (!smpcache_enabled) || (n < 0))
+	{
+		return;
+	}
+
+	if (!(entries = calloc (sizeof (entries[0]), n + 1)))
+	{
+		return;
+	}
+	offset = (sizeof (header) + sizeof (entries[0]) * n + SMPCACHE_ALIGN - 1) & ~(uint64_t)(SMPCACHE_ALIGN - 1);
+	for (i=0; i < n; i++)
+	{
+		entries[i].type       = si[i].type;
+		entries[i].length     = si[i].length;
+		entries[i].samprate   = si[i].samprate;
+		entries[i].loopstart  = si[i].loopstart;
+		entries[i].loopend    = si[i].loopend;
+		entries[i].sloopstart = si[i].sloopstart;
+		entries[i].sloopend   = si[i].sloopend;
+		entries[i].offset     = offset;
+		entries[i].size       = smpcache_datasize (si[i].type, si[i].length);
+		offset = (offset + entries[i].size + SMPCACHE_ALIGN - 1) & ~(uint64_t)(SMPCACHE_ALIGN - 1);
+		if ((!si[i].ptr) || (!si[i].length))
+		{
+			free (entries);
+			return;
+		}
+	}
+	if (offset > smpcache_limit)
+	{ /* would push everything else out */
+		free (entries);
+		return;
+	}
+
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, SMPCACHE_MAGIC, 8);
+	header.byteorder = SMPCACHE_BYTEORDER;
+	header.n = n;
+	header.key = smpcache_key;
+	header.opt = opt;
+	header.mem = mem;
+
+	path = smpcache_path (smpcache_key, mem, opt);
+	temppath = path ? malloc (strlen (path) + 16) : 0;
+	if (!temppath)
+	{
+		free (path);
+		free (entries);
+		return;
+	}
+	sprintf (temppath, "%s.%d", path, (int)getpid ());
+
+	if (mkdir (smpcache_dir, S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH) && (errno != EEXIST))
+	{
+		fprintf (stderr, "[smpcache] mkdir(%s): %s\n", smpcache_dir, strerror (errno));
+		goto out;
+	}
+	if ((fd = open (temppath, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH)) < 0)
+	{
+		fprintf (stderr, "[smpcache] open(%s): %s\n", temppath, strerror (errno));
+		goto out;
+	}
+	if (smpcache_write_all (fd, &header, sizeof (header), 0) ||
+	    smpcache_write_all (fd, entries, sizeof (entries[0]) * n, sizeof (header)))
+	{
+		failed = 1;
+	}
+	for (i=0; (i < n) && (!failed); i++)
+	{
+		if (smpcache_write_all (fd, si[i].ptr, entries[i].size, entries[i].offset))
+		{
+			failed = 1;
+		}
+	}
+	if ((!failed) && ftruncate (fd, offset))
+	{
+		failed = 1;
+	}
+	close (fd);
+	if (failed || rename (temppath, path))
+	{
+		fprintf (stderr, "[smpcache] failed to store %s\n", path);
+		unlink (temppath);
+		goto out;
+	}
+
+	smpcache_prune ();
+
+out:
+	free (temppath);
+	free (path);
+	free (entries);
+}
@@ -0,0 +1,31 @@
+#ifndef _DEV_SMPCACHE_H
+#define _DEV_SMPCACHE_H 1
+
+/* On-disk cache of the sample banks mcpReduceSamples() leaves behind, so
+ * reopening a module does not need to decompress and convert all the
+ * samples again.
+ *
+ * Entries are keyed by a hash of the module file, the reduce options and the
+ * memory limit (which together select the mixer format), and are stored in
+ * cfConfigDir/samplecache/. Each sample block starts at a page aligned offset.
+ */
+
+struct ocpfilehandle_t;
+struct sampleinfo;
+
+/* Hash of the file content, filesize and modtype. Returns 0 if the cache is
+ * disabled or the file can not be hashed. The file position is preserved */
+uint64_t mcpSampleCacheKey (struct ocpfilehandle_t *file, uint32_t modtype);
+
+/* Selects the cache entry the next mcpReduceSamples() should use. If decode
+ * is given, the sample data is not loaded yet, and decode (returning non-zero
+ * on error) is called on a cache miss before the samples are converted.
+ * A key of 0 just runs decode. The selection is cleared by mcpReduceSamples() */
+void mcpSampleCacheSelect (uint64_t key, int (*decode)(void *token), void *token);
+
+/* used by mcpReduceSamples() */
+int mcpSampleCacheLoad (struct sampleinfo *si, int n, long mem, int opt); /* returns 1 on hit. On miss si is untouched */
+int mcpSampleCacheDecode (void); /* returns non-zero on error */
+void mcpSampleCacheStore (const struct sampleinfo *si, int n, long mem, int opt);
+
+#endif
@@ -0,0 +1,347 @@
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+
+#include "smpcache.c"
+
+#define ANSI_COLOR_RED     "\x1b[31m"
+#define ANSI_COLOR_GREEN   "\x1b[32m"
+#define ANSI_COLOR_RESET   "\x1b[0m"
+
+struct configAPI_t configAPI;
+
+static char tempdir[] = "/tmp/smpcache_test.XXXXXX";
+
+/* just enough of a file handle for mcpSampleCacheKey() */
+struct memfile_t
+{
+	struct ocpfilehandle_t head;
+	const uint8_t *data;
+	uint64_t size;
+	uint64_t pos;
+};
+
+static int memfile_seek_set (struct ocpfilehandle_t *_self, int64_t pos)
+{
+	struct memfile_t *self = (struct memfile_t *)_self;
+	if ((pos < 0) || (pos > self->size))
+	{
+		return -1;
+	}
+	self->pos = pos;
+	return 0;
+}
+
+static uint64_t memfile_getpos (struct ocpfilehandle_t *_self)
+{
+	return ((struct memfile_t *)_self)->pos;
+}
+
+static int memfile_read (struct ocpfilehandle_t *_self, void *dst, int len)
+{
+	struct memfile_t *self = (struct memfile_t *)_self;
+	if (len > self->size - self->pos)
+	{
+		len = self->size - self->pos;
+	}
+	memcpy (dst, self->data + self->pos, len);
+	self->pos += len;
+	return len;
+}
+
+static uint64_t memfile_filesize (struct ocpfilehandle_t *_self)
+{
+	return ((struct memfile_t *)_self)->size;
+}
+
+static void memfile_init (struct memfile_t *self, const uint8_t *data, uint64_t size)
+{
+	memset (self, 0, sizeof (*self));
+	self->head.seek_set = memfile_seek_set;
+	self->head.getpos = memfile_getpos;
+	self->head.read = memfile_read;
+	self->head.filesize = memfile_filesize;
+	self->data = data;
+	self->size = size;
+}
+
+static int test_key (void)
+{
+	static uint8_t data[200000];
+	struct memfile_t a, b;
+	uint64_t k1, k2, k3;
+	int i, failed = 0;
+
+	printf ("content hash: ");
+	for (i=0; i < sizeof (data); i++)
+	{
+		data[i] = i * 7 + (i >> 8);
+	}
+	memfile_init (&a, data, sizeof (data));
+	memfile_init (&b, data, sizeof (data) - 1);
+	a.pos = 1234;
+
+	k1 = mcpSampleCacheKey (&a.head, 1);
+	k2 = mcpSampleCacheKey (&a.head, 2);
+	k3 = mcpSampleCacheKey (&b.head, 1);
+	if ((!k1) || (k1 == k2) || (k1 == k3) || (a.pos != 1234))
+	{
+		failed = 1;
+	}
+	if (mcpSampleCacheKey (&a.head, 1) != k1)
+	{
+		failed = 1;
+	}
+	data[100000] ^= 1;
+	if (mcpSampleCacheKey (&a.head, 1) == k1)
+	{
+		failed = 1;
+	}
+
+	printf ("%s%s%s\n", failed ? ANSI_COLOR_RED : ANSI_COLOR_GREEN, failed ? "failed" : "ok", ANSI_COLOR_RESET);
+	return failed;
+}
+
+#define SAMPLES 3
+
+static void make_samples (struct sampleinfo *si, int seed)
+{
+	int i, j;
+
+	memset (si, 0, sizeof (si[0]) * SAMPLES);
+	si[0].type = 0;
+	si[0].length = 1000;
+	si[1].type = mcpSamp16Bit | mcpSampStereo | mcpSampLoop;
+	si[1].length = 5000;
+	si[1].loopstart = 100;
+	si[1].loopend = 4000;
+	si[2].type = mcpSampFloat | mcpSampBiDi | mcpSampLoop;
+	si[2].length = 3;
+	si[2].loopstart = 0;
+	si[2].loopend = 3;
+	for (i=0; i < SAMPLES; i++)
+	{
+		uint64_t size = smpcache_datasize (si[i].type, si[i].length);
+		si[i].samprate = 8363 + i;
+		si[i].ptr = malloc (size);
+		for (j=0; j < size; j++)
+		{
+			((uint8_t *)si[i].ptr)[j] = j * (i + 1) + seed;
+		}
+	}
+}
+
+static void free_samples (struct sampleinfo *si)
+{
+	int i;
+	for (i=0; i < SAMPLES; i++)
+	{
+		free (si[i].ptr);
+	}
+}
+
+static int compare_samples (const struct sampleinfo *a, const struct sampleinfo *b)
+{
+	int i;
+	for (i=0; i < SAMPLES; i++)
+	{
+		if ((a[i].type != b[i].type) ||
+		    (a[i].length != b[i].length) ||
+		    (a[i].samprate != b[i].samprate) ||
+		    (a[i].loopstart != b[i].loopstart) ||
+		    (a[i].loopend != b[i].loopend) ||
+		    (a[i].sloopstart != b[i].sloopstart) ||
+		    (a[i].sloopend != b[i].sloopend) ||
+		    memcmp (a[i].ptr, b[i].ptr, smpcache_datasize (a[i].type, a[i].length)))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int decode_calls;
+static int decode (void *token)
+{
+	decode_calls++;
+	return token ? -1 : 0;
+}
+
+static int test_roundtrip (void)
+{
+	struct sampleinfo orig[SAMPLES], loaded[SAMPLES];
+	char *path;
+	int failed = 0;
+
+	printf ("store and load: ");
+	make_samples (orig, 1);
+
+	mcpSampleCacheSelect (0x1234, decode, 0);
+	mcpSampleCacheStore (orig, SAMPLES, 0x40000000, mcpRedToMono);
+
+	/* loaded into buffers the loader has already filled in */
+	make_samples (loaded, 2);
+	if ((!mcpSampleCacheLoad (loaded, SAMPLES, 0x40000000, mcpRedToMono)) || compare_samples (orig, loaded))
+	{
+		failed = 1;
+	}
+	free_samples (loaded);
+
+	/* samples not loaded yet */
+	memset (loaded, 0, sizeof (loaded));
+	if ((!mcpSampleCacheLoad (loaded, SAMPLES, 0x40000000, mcpRedToMono)) || compare_samples (orig, loaded))
+	{
+		failed = 1;
+	}
+	free_samples (loaded);
+
+	/* other mixer, other memory limit, other number of samples, other file */
+	memset (loaded, 0, sizeof (loaded));
+	if (mcpSampleCacheLoad (loaded, SAMPLES, 0x40000000, mcpRedToMono | mcpRedToFloat) ||
+	    mcpSampleCacheLoad (loaded, SAMPLES, 0x100000, mcpRedToMono) ||
+	    mcpSampleCacheLoad (loaded, SAMPLES - 1, 0x40000000, mcpRedToMono))
+	{
+		failed = 1;
+	}
+	mcpSampleCacheSelect (0x1235, 0, 0);
+	if (mcpSampleCacheLoad (loaded, SAMPLES, 0x40000000, mcpRedToMono))
+	{
+		failed = 1;
+	}
+
+	/* truncated file */
+	mcpSampleCacheSelect (0x1234, 0, 0);
+	path = smpcache_path (0x1234, 0x40000000, mcpRedToMono);
+	if (truncate (path, 8192 + 100) || mcpSampleCacheLoad (loaded, SAMPLES, 0x40000000, mcpRedToMono))
+	{
+		failed = 1;
+	}
+	unlink (path);
+	free (path);
+
+	if (loaded[0].ptr || loaded[1].ptr || loaded[2].ptr)
+	{ /* misses must leave the samples alone */
+		failed = 1;
+	}
+	free_samples (orig);
+
+	printf ("%s%s%s\n", failed ? ANSI_COLOR_RED : ANSI_COLOR_GREEN, failed ? "failed" : "ok", ANSI_COLOR_RESET);
+	return failed;
+}
+
+static int test_decode (void)
+{
+	int failed = 0;
+
+	printf ("deferred decode: ");
+	decode_calls = 0;
+	mcpSampleCacheSelect (0, decode, 0);
+	if (mcpSampleCacheDecode () || mcpSampleCacheDecode () || (decode_calls != 1))
+	{
+		failed = 1;
+	}
+	mcpSampleCacheSelect (0, decode, (void *)1);
+	if ((!mcpSampleCacheDecode ()) || (decode_calls != 2))
+	{
+		failed = 1;
+	}
+	mcpSampleCacheSelect (0, 0, 0);
+	if (mcpSampleCacheDecode ())
+	{
+		failed = 1;
+	}
+
+	printf ("%s%s%s\n", failed ? ANSI_COLOR_RED : ANSI_COLOR_GREEN, failed ? "failed" : "ok", ANSI_COLOR_RESET);
+	return failed;
+}
+
+static int test_prune (void)
+{
+	struct sampleinfo si[SAMPLES];
+	struct utimbuf old = {1000000000, 1000000000};
+	char *path1, *path2, *path3;
+	struct stat st;
+	int failed = 0;
+
+	printf ("prune least recently used: ");
+	make_samples (si, 3);
+	path1 = smpcache_path (1, 0x40000000, 0);
+	path2 = smpcache_path (2, 0x40000000, 0);
+	path3 = smpcache_path (3, 0x40000000, 0);
+
+	/* each entry is 8 pages, room for two */
+	smpcache_limit = 16 * SMPCACHE_ALIGN;
+	mcpSampleCacheSelect (1, 0, 0);
+	mcpSampleCacheStore (si, SAMPLES, 0x40000000, 0);
+	mcpSampleCacheSelect (2, 0, 0);
+	mcpSampleCacheStore (si, SAMPLES, 0x40000000, 0);
+	utime (path1, &old);
+	utime (path2, &old);
+
+	/* a hit makes 1 the most recently used */
+	mcpSampleCacheSelect (1, 0, 0);
+	free_samples (si);
+	memset (si, 0, sizeof (si));
+	if (!mcpSampleCacheLoad (si, SAMPLES, 0x40000000, 0))
+	{
+		failed = 1;
+	}
+
+	mcpSampleCacheSelect (3, 0, 0);
+	mcpSampleCacheStore (si, SAMPLES, 0x40000000, 0);
+	if (stat (path1, &st) || (!stat (path2, &st)) || stat (path3, &st))
+	{
+		failed = 1;
+	}
+
+	/* too big to ever fit */
+	smpcache_limit = 4 * SMPCACHE_ALIGN;
+	unlink (path1);
+	unlink (path3);
+	mcpSampleCacheSelect (1, 0, 0);
+	mcpSampleCacheStore (si, SAMPLES, 0x40000000, 0);
+	if (!stat (path1, &st))
+	{
+		failed = 1;
+	}
+	smpcache_limit = 256 << 20;
+
+	unlink (path1);
+	unlink (path2);
+	unlink (path3);
+	free (path1);
+	free (path2);
+	free (path3);
+	free_samples (si);
+
+	printf ("%s%s%s\n", failed ? ANSI_COLOR_RED : ANSI_COLOR_GREEN, failed ? "failed" : "ok", ANSI_COLOR_RESET);
+	return failed;
+}
+
+int main (int argc, char *argv[])
+{
+	int retval = 0;
+
+	if (!mkdtemp (tempdir))
+	{
+		perror ("mkdtemp()");
+		return 1;
+	}
+	smpcache_enabled = 1;
+	smpcache_limit = 256 << 20;
+	smpcache_dir = malloc (strlen (tempdir) + 1 + 12 + 1);
+	sprintf (smpcache_dir, "%s/samplecache/", tempdir);
+
+	retval |= test_key ();
+	retval |= test_roundtrip ();
+	retval |= test_decode ();
+	retval |= test_prune ();
+
+	rmdir (smpcache_dir);
+	rmdir (tempdir);
+	free (smpcache_dir);
+
+	return retval;
+}
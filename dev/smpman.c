@@ -38,6 +38,7 @@
 #include <stdio.h>
 #include "types.h"
 #include "mcp.h"
+#include "smpcache.h"
 
 #define SAMPEND 8
 
@@ -782,7 +783,7 @@ static int convertsample(struct sampleinfo *s)
 	return 1;
 }
 
-int mcpReduceSamples(struct sampleinfo *si, int n, long mem, int opt)
+static int reducesamples(struct sampleinfo *si, int n, long mem, int opt)
 {
 	struct sampleinfo *samples=si;
 	int32_t memmax=mem;
@@ -912,3 +913,20 @@ int mcpReduceSamples(struct sampleinfo *si, int n, long mem, int opt)
 
 	return 1;
 }
+
+int mcpReduceSamples(struct sampleinfo *si, int n, long mem, int opt)
+{
+	int retval=0;
+
+	if (mcpSampleCacheLoad(si, n, mem, opt))
+		retval=1;
+	else if (!mcpSampleCacheDecode())
+	{
+		retval=reducesamples(si, n, mem, opt);
+		if (retval)
+			mcpSampleCacheStore(si, n, mem, opt);
+	}
+	mcpSampleCacheSelect(0, 0, 0);
+
+	return retval;
+}
@@ -66,6 +66,7 @@ static uint32_t devpDiskRate;
 static unsigned char stereo;
 static unsigned char bit16;
 static unsigned char writeerr;
+static unsigned char headless; /* --render, nobody looks at the visuals */
 
 static void devpDiskConsume(int flush)
 {
@@ -130,7 +131,7 @@ static unsigned int devpDiskIdle(void)
 		return 0;
 	}
 
-	devpDiskConsume (0);
+	devpDiskConsume (headless);
 
 	if (devpDiskCachePos > (devpDiskCachelen/2))
 	{
@@ -208,6 +209,7 @@ static int devpDiskPlay (uint32_t *rate, enum plrRequestFormat *format, struct o
 
 	stereo = !cfGetProfileBool("commandline_s", "m", !cfGetProfileBool("devpDisk", "stereo", 1, 1), 1);
 	bit16 =  !cfGetProfileBool("commandline_s", "8", !cfGetProfileBool("devpDisk", "16bit", 1, 1), 1);
+	headless = cfGetProfileBool("CommandLine--", "render", 0, 0);
 
 	if (*rate == 0)
 	{
@@ -261,6 +263,10 @@ static int devpDiskPlay (uint32_t *rate, enum plrRequestFormat *format, struct o
 	writeerr=0;
 
 	devpDiskCachelen = 12*devpDiskRate; /* 3 seconds */
+	if (headless)
+	{ /* devpDiskIdle() can consume an entire ringbuffer at once */
+		devpDiskCachelen += buflength << 2;
+	}
 	devpDiskCachePos=0;
 	devpDiskCache=calloc(devpDiskCachelen, 1);
 	if (!devpDiskCache)
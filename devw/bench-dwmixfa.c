@@ -0,0 +1,164 @@
+/* OpenCP Module Player
+ * copyright (c) 2022 Stian Skjelstad <stian.skjelstad@gmail.com>
+ *
+ * Benchmark for "dwmixfa.c", mixes MIXF_MAXCHAN voices spread over a
+ * large sample set, so the numbers include the cache behaviour of the
+ * voice state and the mix buffer.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.h"
+#include "types.h"
+#include <stdio.h>
+#include "dwmixfa.h"
+#include "dev/mcp.h"
+#include <stdlib.h>
+#include <strings.h>
+#include <time.h>
+
+#define BENCH_SAMPLELEN 65536
+#define BENCH_RATE      96000
+#define BENCH_SECONDS   2
+
+static float *samples[MIXF_MAXCHAN];
+
+static void calcinterpoltab(void)
+{
+	int i;
+	for (i=0; i<256; i++)
+	{
+		float x1=i/256.0;
+		float x2=x1*x1;
+		float x3=x1*x1*x1;
+		dwmixfa_state.ct0[i]=-0.5*x3+x2-0.5*x1;
+		dwmixfa_state.ct1[i]=1.5*x3-2.5*x2+1;
+		dwmixfa_state.ct2[i]=-1.5*x3+2*x2+0.5*x1;
+		dwmixfa_state.ct3[i]=0.5*x3-0.5*x2;
+	};
+}
+
+static void setup_voices(int nvoices, int flags)
+{
+	int i;
+
+	srand(1);
+	for (i=0; i<nvoices; i++)
+	{
+		dwmixfa_state.voice[i].voiceflags = MIXF_PLAYING | MIXF_LOOPED | flags;
+		dwmixfa_state.voice[i].freqw = (i % 3 == 2) ? 1 : 0;
+		dwmixfa_state.voice[i].freqf = (uint32_t)(rand() & 0xffff) << 16;
+		dwmixfa_state.voice[i].smpposw = samples[i];
+		dwmixfa_state.voice[i].smpposf = 0;
+		dwmixfa_state.voice[i].looplen = BENCH_SAMPLELEN / 2;
+		dwmixfa_state.voice[i].loopend = samples[i] + BENCH_SAMPLELEN;
+		dwmixfa_state.voice[i].volleft = 0.001f;
+		dwmixfa_state.voice[i].volright = 0.001f;
+		dwmixfa_state.voice[i].rampleft = 0.0f;
+		dwmixfa_state.voice[i].rampright = 0.0f;
+		dwmixfa_state.voicecold[i].fl1 = 0;
+		dwmixfa_state.voicecold[i].fb1 = 0;
+		dwmixfa_state.voicecold[i].ffreq = (flags & MIXF_FILTER) ? 0.5f : 1.0f;
+		dwmixfa_state.voicecold[i].freso = (flags & MIXF_FILTER) ? 0.3f : 0.0f;
+	}
+	dwmixfa_state.nvoices = nvoices;
+}
+
+static void run(int nvoices, int flags, const char *name)
+{
+	static int16_t output[MIXF_MIXBUFLEN * 2];
+	struct timespec t1, t2;
+	double elapsed;
+	int iterations = BENCH_RATE * BENCH_SECONDS / MIXF_MIXBUFLEN;
+	int i;
+
+	setup_voices (nvoices, flags);
+	dwmixfa_state.outbuf = output;
+	dwmixfa_state.nsamples = MIXF_MIXBUFLEN;
+
+	clock_gettime (CLOCK_MONOTONIC, &t1);
+	for (i=0; i < iterations; i++)
+	{
+		mixer();
+	}
+	clock_gettime (CLOCK_MONOTONIC, &t2);
+	elapsed = (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1000000000.0;
+
+	printf ("%3d voices %-13s: %7.1f ns/frame, %6.1fx realtime at %d Hz\n", nvoices, name, elapsed * 1000000000.0 / ((double)iterations * MIXF_MIXBUFLEN), (double)BENCH_SECONDS / elapsed, BENCH_RATE);
+}
+
+int main(int argc, char *argv[])
+{
+	static const int voices[3] = {32, 128, MIXF_MAXCHAN};
+	int i, j;
+
+	for (i=0; i<MIXF_MAXCHAN; i++)
+	{
+		if (!(samples[i] = malloc (sizeof (float) * (BENCH_SAMPLELEN + 8))))
+		{
+			return 1;
+		}
+		for (j=0; j < BENCH_SAMPLELEN + 8; j++)
+		{
+			samples[i][j] = (float)(rand() % 65536 - 32768);
+		}
+	}
+
+	if (!(dwmixfa_state.tempbuf = malloc (sizeof (float) * (MIXF_MIXBUFLEN<<1))))
+	{
+		return 1;
+	}
+	dwmixfa_state.samprate = BENCH_RATE;
+	calcinterpoltab();
+	prepare_mixer();
+
+	if (argc > 1)
+	{
+		int kernel;
+		for (kernel = MIXF_KERNEL_C; kernel <= MIXF_KERNEL_NEON; kernel++)
+		{
+			if (!strcasecmp (argv[1], mixer_kernel_name (kernel)))
+			{
+				break;
+			}
+		}
+		if (!mixer_select_kernel (kernel))
+		{
+			fprintf (stderr, "Usage: %s [C|SSE2|AVX2|NEON [threads]]   (kernel must be supported by this CPU)\n", argv[0]);
+			return 1;
+		}
+		printf ("kernel: %s\n", mixer_kernel_name (kernel));
+	}
+	if (argc > 2)
+	{
+		printf ("threads: %d\n", mixer_start_threads (atoi (argv[2])));
+	}
+	for (i=0; i<3; i++)
+	{
+		run (voices[i], 0,                                 "none");
+		run (voices[i], MIXF_INTERPOLATE,                  "linear");
+		run (voices[i], MIXF_INTERPOLATEQ,                 "cubic");
+		run (voices[i], MIXF_INTERPOLATEQ | MIXF_FILTER,   "cubic+filter");
+	}
+
+	mixer_stop_threads ();
+	for (i=0; i<MIXF_MAXCHAN; i++)
+	{
+		free (samples[i]);
+	}
+	free (dwmixfa_state.tempbuf);
+
+	return 0;
+}
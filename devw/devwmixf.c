@@ -84,6 +84,7 @@ static int volramp;
 static int declick;
 
 static int channelnum;
+static int mixthreads;
 static uint32_t IdleCache; /* To prevent devpDisk lockup */
 
 struct channel
@@ -180,17 +181,17 @@ static void calcstep(struct channel *c)
 {
 	int n=c->handle;
 	uint32_t rstep;
-	if (!(dwmixfa_state.voiceflags[n]&MIXF_PLAYING))
+	if (!(dwmixfa_state.voice[n].voiceflags&MIXF_PLAYING))
 		return;
 	if (!c->orgdiv)
 		return;
 
 	rstep=imuldiv(imuldiv(c->orgfrq, c->orgrate, c->orgdiv)<<8, relpitch, dwmixfa_state.samprate);
-	dwmixfa_state.freqw[n]=rstep>>16;
-	dwmixfa_state.freqf[n]=rstep<<16;
+	dwmixfa_state.voice[n].freqw=rstep>>16;
+	dwmixfa_state.voice[n].freqf=rstep<<16;
 
-	dwmixfa_state.voiceflags[n]&=~(MIXF_INTERPOLATE|MIXF_INTERPOLATEQ);
-	dwmixfa_state.voiceflags[n]|=interpolation?((interpolation>1)?MIXF_INTERPOLATEQ:MIXF_INTERPOLATE):0;
+	dwmixfa_state.voice[n].voiceflags&=~(MIXF_INTERPOLATE|MIXF_INTERPOLATEQ);
+	dwmixfa_state.voice[n].voiceflags|=interpolation?((interpolation>1)?MIXF_INTERPOLATEQ:MIXF_INTERPOLATE):0;
 }
 
 static void calcsteps(void)
@@ -215,7 +216,7 @@ static void transformvol(struct channel *ch)
 	if (volopt^ch->volopt)
 		ch->vol[1]=-ch->vol[1];
 
-	if (dwmixfa_state.voiceflags[n]&MIXF_MUTE)
+	if (dwmixfa_state.voice[n].voiceflags&MIXF_MUTE)
 	{
 		ch->dstvols[0]=ch->dstvols[1]=0;
 	} else {
@@ -265,19 +266,19 @@ static void calcvols(void)
 static void stopchan(struct channel *c)
 {
 	int n=c->handle;
-	if (!(dwmixfa_state.voiceflags[n]&MIXF_PLAYING))
+	if (!(dwmixfa_state.voice[n].voiceflags&MIXF_PLAYING))
 		return;
 
 	/* cool end-of-sample-declicking */
-	if (!(dwmixfa_state.voiceflags[n] & MIXF_QUIET))
+	if (!(dwmixfa_state.voice[n].voiceflags & MIXF_QUIET))
 	{
-		int offs = ( dwmixfa_state.voiceflags[n] & MIXF_INTERPOLATEQ ) ? 1 : 0;
-		float ff2 = dwmixfa_state.ffreq[n] * dwmixfa_state.ffreq[n];
-		dwmixfa_state.fadeleft += ff2*dwmixfa_state.volleft[n] * dwmixfa_state.smpposw[n][offs];
-		dwmixfa_state.faderight += ff2*dwmixfa_state.volright[n] * dwmixfa_state.smpposw[n][offs];
+		int offs = ( dwmixfa_state.voice[n].voiceflags & MIXF_INTERPOLATEQ ) ? 1 : 0;
+		float ff2 = dwmixfa_state.voicecold[n].ffreq * dwmixfa_state.voicecold[n].ffreq;
+		dwmixfa_state.fadeleft += ff2*dwmixfa_state.voice[n].volleft * dwmixfa_state.voice[n].smpposw[offs];
+		dwmixfa_state.faderight += ff2*dwmixfa_state.voice[n].volright * dwmixfa_state.voice[n].smpposw[offs];
 	}
 
-	dwmixfa_state.voiceflags[n]&=~MIXF_PLAYING;
+	dwmixfa_state.voice[n].voiceflags&=~MIXF_PLAYING;
 }
 
 
@@ -300,10 +301,10 @@ static void setlbuf(struct channel *c)
 	if (c->sbpos)
 		rstlbuf(c);
 
-	if (dwmixfa_state.voiceflags[n]&MIXF_LOOPED)
+	if (dwmixfa_state.voice[n].voiceflags&MIXF_LOOPED)
 	{
-		float *dst=dwmixfa_state.loopend[n];
-		float *src=dst-dwmixfa_state.looplen[n];
+		float *dst=dwmixfa_state.voice[n].loopend;
+		float *src=dst-dwmixfa_state.voice[n].looplen;
 		int i;
 		for (i=0; i<8; i++)
 		{
@@ -356,33 +357,33 @@ static void devwMixFIdle (struct cpifaceSessionAPI_t *cpifaceSession)
 			}
 
 			/* set-up mixing core variables */
-			for (i=0; i<channelnum; i++) if (dwmixfa_state.voiceflags[i]&MIXF_PLAYING)
+			for (i=0; i<channelnum; i++) if (dwmixfa_state.voice[i].voiceflags&MIXF_PLAYING)
 			{
 				struct channel *ch=&channels[i];
 
-				dwmixfa_state.volleft[i]=frchk(dwmixfa_state.volleft[i]);
-				dwmixfa_state.volright[i]=frchk(dwmixfa_state.volright[i]);
+				dwmixfa_state.voice[i].volleft=frchk(dwmixfa_state.voice[i].volleft);
+				dwmixfa_state.voice[i].volright=frchk(dwmixfa_state.voice[i].volright);
 
-				if (!dwmixfa_state.volleft[i] && !dwmixfa_state.volright[i] && !dwmixfa_state.rampleft[i] && !dwmixfa_state.rampright[i])
-					dwmixfa_state.voiceflags[i]|=MIXF_QUIET;
+				if (!dwmixfa_state.voice[i].volleft && !dwmixfa_state.voice[i].volright && !dwmixfa_state.voice[i].rampleft && !dwmixfa_state.voice[i].rampright)
+					dwmixfa_state.voice[i].voiceflags|=MIXF_QUIET;
 				else
-					dwmixfa_state.voiceflags[i]&=~MIXF_QUIET;
+					dwmixfa_state.voice[i].voiceflags&=~MIXF_QUIET;
 
 
-				if (dwmixfa_state.ffreq[i]!=1 || dwmixfa_state.freso[i]!=0)
-					dwmixfa_state.voiceflags[i]|=MIXF_FILTER;
+				if (dwmixfa_state.voicecold[i].ffreq!=1 || dwmixfa_state.voicecold[i].freso!=0)
+					dwmixfa_state.voice[i].voiceflags|=MIXF_FILTER;
 				else
-					dwmixfa_state.voiceflags[i]&=~MIXF_FILTER;
+					dwmixfa_state.voice[i].voiceflags&=~MIXF_FILTER;
 
 				/* declick start of sample */
 				if (ch->newsamp)
 				{
-					if (!(dwmixfa_state.voiceflags[i] & MIXF_QUIET))
+					if (!(dwmixfa_state.voice[i].voiceflags & MIXF_QUIET))
 					{
-						int offs = ( dwmixfa_state.voiceflags[i] & MIXF_INTERPOLATEQ ) ? 1 : 0;
-						float ff2 = dwmixfa_state.ffreq[i] * dwmixfa_state.ffreq[i];
-						dwmixfa_state.fadeleft -= ff2 * dwmixfa_state.volleft[i] * dwmixfa_state.smpposw[i][offs];
-						dwmixfa_state.faderight -= ff2 * dwmixfa_state.volright[i] * dwmixfa_state.smpposw[i][offs];
+						int offs = ( dwmixfa_state.voice[i].voiceflags & MIXF_INTERPOLATEQ ) ? 1 : 0;
+						float ff2 = dwmixfa_state.voicecold[i].ffreq * dwmixfa_state.voicecold[i].ffreq;
+						dwmixfa_state.fadeleft -= ff2 * dwmixfa_state.voice[i].volleft * dwmixfa_state.voice[i].smpposw[offs];
+						dwmixfa_state.faderight -= ff2 * dwmixfa_state.voice[i].volright * dwmixfa_state.voice[i].smpposw[offs];
 					}
 					ch->newsamp=0;
 				}
@@ -427,26 +428,26 @@ static void devwMixFIdle (struct cpifaceSessionAPI_t *cpifaceSession)
 				invt2g=256.0/tickwidth;
 
 				/* set up volume ramping */
-				for (i=0; i<channelnum; i++) if (dwmixfa_state.voiceflags[i]&MIXF_PLAYING)
+				for (i=0; i<channelnum; i++) if (dwmixfa_state.voice[i].voiceflags&MIXF_PLAYING)
 				{
 					struct channel *ch=&channels[i];
 					if (ch->dontramp)
 					{
-						dwmixfa_state.volleft[i]=frchk(ch->dstvols[0]);
-						dwmixfa_state.volright[i]=frchk(ch->dstvols[1]);
-						dwmixfa_state.rampleft[i]=dwmixfa_state.rampright[i]=0;
+						dwmixfa_state.voice[i].volleft=frchk(ch->dstvols[0]);
+						dwmixfa_state.voice[i].volright=frchk(ch->dstvols[1]);
+						dwmixfa_state.voice[i].rampleft=dwmixfa_state.voice[i].rampright=0;
 						if (volramp)
 							ch->dontramp=0;
 					} else {
-						dwmixfa_state.rampleft[i]=frchk(invt2g*(ch->dstvols[0]-dwmixfa_state.volleft[i]));
-						if (dwmixfa_state.rampleft[i]==0)
-							dwmixfa_state.volleft[i]=ch->dstvols[0];
-						dwmixfa_state.rampright[i]=frchk(invt2g*(ch->dstvols[1]-dwmixfa_state.volright[i]));
-						if (dwmixfa_state.rampright[i]==0)
-							dwmixfa_state.volright[i]=ch->dstvols[1];
+						dwmixfa_state.voice[i].rampleft=frchk(invt2g*(ch->dstvols[0]-dwmixfa_state.voice[i].volleft));
+						if (dwmixfa_state.voice[i].rampleft==0)
+							dwmixfa_state.voice[i].volleft=ch->dstvols[0];
+						dwmixfa_state.voice[i].rampright=frchk(invt2g*(ch->dstvols[1]-dwmixfa_state.voice[i].volright));
+						if (dwmixfa_state.voice[i].rampright==0)
+							dwmixfa_state.voice[i].volright=ch->dstvols[1];
 					}
 					/* filter resonance */
-					dwmixfa_state.freso[i]=pow(ch->orgfrez,dwmixfa_state.ffreq[i]);
+					dwmixfa_state.voicecold[i].freso=pow(ch->orgfrez,dwmixfa_state.voicecold[i].ffreq);
 				}
 			}
 
@@ -483,10 +484,10 @@ static void devwMixFSET(int ch, int opt, int val)
 				int reswasmute;
 				rstlbuf(chn);
 				stopchan(chn);
-				reswasmute=dwmixfa_state.voiceflags[ch]&MIXF_MUTE;
+				reswasmute=dwmixfa_state.voice[ch].voiceflags&MIXF_MUTE;
 				memset(chn, 0, sizeof(struct channel));
 				chn->handle=ch;
-				dwmixfa_state.voiceflags[ch]=reswasmute;
+				dwmixfa_state.voice[ch].voiceflags=reswasmute;
 			}
 			break;
 
@@ -510,36 +511,36 @@ static void devwMixFSET(int ch, int opt, int val)
 				chn->dontramp=1;
 				chn->newsamp=1;
 
-				dwmixfa_state.voiceflags[ch]&=~(MIXF_PLAYING|MIXF_LOOPED);
+				dwmixfa_state.voice[ch].voiceflags&=~(MIXF_PLAYING|MIXF_LOOPED);
 
-				dwmixfa_state.freqw[ch]=0;
-				dwmixfa_state.freqf[ch]=0;
-				dwmixfa_state.fl1[ch]=0;
-				dwmixfa_state.fb1[ch]=0;
-				dwmixfa_state.ffreq[ch]=1;
-				dwmixfa_state.freso[ch]=0;
-				dwmixfa_state.smpposf[ch]=0;
-				dwmixfa_state.smpposw[ch]=(float *)chn->samp;
+				dwmixfa_state.voice[ch].freqw=0;
+				dwmixfa_state.voice[ch].freqf=0;
+				dwmixfa_state.voicecold[ch].fl1=0;
+				dwmixfa_state.voicecold[ch].fb1=0;
+				dwmixfa_state.voicecold[ch].ffreq=1;
+				dwmixfa_state.voicecold[ch].freso=0;
+				dwmixfa_state.voice[ch].smpposf=0;
+				dwmixfa_state.voice[ch].smpposw=(float *)chn->samp;
 
 				if (chn->samptype&mcpSampSLoop)
 				{
-					dwmixfa_state.voiceflags[ch]|=MIXF_LOOPED;
+					dwmixfa_state.voice[ch].voiceflags|=MIXF_LOOPED;
 					chn->loopstart=chn->orgsloopstart;
 					chn->loopend=chn->orgsloopend;
 				} else if (chn->samptype&mcpSampLoop)
 				{
-					dwmixfa_state.voiceflags[ch]|=MIXF_LOOPED;
+					dwmixfa_state.voice[ch].voiceflags|=MIXF_LOOPED;
 					chn->loopstart=chn->orgloopstart;
 					chn->loopend=chn->orgloopend;
 				}
 
-				if (dwmixfa_state.voiceflags[ch]&MIXF_LOOPED)
+				if (dwmixfa_state.voice[ch].voiceflags&MIXF_LOOPED)
 				{
-					dwmixfa_state.looplen[ch]=chn->loopend-chn->loopstart;
-					dwmixfa_state.loopend[ch]=(float *)chn->samp+chn->loopend;
+					dwmixfa_state.voice[ch].looplen=chn->loopend-chn->loopstart;
+					dwmixfa_state.voice[ch].loopend=(float *)chn->samp+chn->loopend;
 				} else {
-					dwmixfa_state.looplen[ch]=chn->length;
-					dwmixfa_state.loopend[ch]=(float *)chn->samp+chn->length-1;
+					dwmixfa_state.voice[ch].looplen=chn->length;
+					dwmixfa_state.voice[ch].loopend=(float *)chn->samp+chn->length-1;
 				}
 				setlbuf(chn);
 			}
@@ -548,17 +549,17 @@ static void devwMixFSET(int ch, int opt, int val)
 			if (!val)
 				stopchan(chn);
 			else {
-				if (dwmixfa_state.smpposw[ch] >= (float *)(chn->samp)+chn->length)
+				if (dwmixfa_state.voice[ch].smpposw >= (float *)(chn->samp)+chn->length)
 					break;
-				dwmixfa_state.voiceflags[ch]|=MIXF_PLAYING;
+				dwmixfa_state.voice[ch].voiceflags|=MIXF_PLAYING;
 				calcstep(chn);
 			}
 			break;
 		case mcpCMute:
 			if (val)
-				dwmixfa_state.voiceflags[ch]|=MIXF_MUTE;
+				dwmixfa_state.voice[ch].voiceflags|=MIXF_MUTE;
 			else
-				dwmixfa_state.voiceflags[ch]&=~MIXF_MUTE;
+				dwmixfa_state.voice[ch].voiceflags&=~MIXF_MUTE;
 			calcvol(chn);
 			break;
 		case mcpCVolume:
@@ -577,7 +578,7 @@ static void devwMixFSET(int ch, int opt, int val)
 			break;
 		case mcpCLoop:
 			rstlbuf(chn);
-			dwmixfa_state.voiceflags[ch]&=~MIXF_LOOPED;
+			dwmixfa_state.voice[ch].voiceflags&=~MIXF_LOOPED;
 
 			if ((val==1)&&!(chn->samptype&mcpSampSLoop))
 				val=2;
@@ -586,24 +587,24 @@ static void devwMixFSET(int ch, int opt, int val)
 
 			if (val==1)
 			{
-				dwmixfa_state.voiceflags[ch]|=MIXF_LOOPED;
+				dwmixfa_state.voice[ch].voiceflags|=MIXF_LOOPED;
 				chn->loopstart=chn->orgsloopstart;
 				chn->loopend=chn->orgsloopend;
 			}
 			if (val==2)
 			{
-				dwmixfa_state.voiceflags[ch]|=MIXF_LOOPED;
+				dwmixfa_state.voice[ch].voiceflags|=MIXF_LOOPED;
 				chn->loopstart=chn->orgloopstart;
 				chn->loopend=chn->orgloopend;
 			}
 
-			if (dwmixfa_state.voiceflags[ch]&MIXF_LOOPED)
+			if (dwmixfa_state.voice[ch].voiceflags&MIXF_LOOPED)
 			{
-				dwmixfa_state.looplen[ch]=chn->loopend-chn->loopstart;
-				dwmixfa_state.loopend[ch]=(float *)chn->samp+chn->loopend;
+				dwmixfa_state.voice[ch].looplen=chn->loopend-chn->loopstart;
+				dwmixfa_state.voice[ch].loopend=(float *)chn->samp+chn->loopend;
 			} else {
-				dwmixfa_state.looplen[ch]=chn->length;
-				dwmixfa_state.loopend[ch]=(float *)chn->samp+chn->length-1;
+				dwmixfa_state.voice[ch].looplen=chn->length;
+				dwmixfa_state.voice[ch].loopend=(float *)chn->samp+chn->length-1;
 			}
 			setlbuf(chn);
 
@@ -611,16 +612,16 @@ static void devwMixFSET(int ch, int opt, int val)
 		case mcpCPosition:
 			{
 				int poswasplaying;
-				poswasplaying=dwmixfa_state.voiceflags[ch]&MIXF_PLAYING;
+				poswasplaying=dwmixfa_state.voice[ch].voiceflags&MIXF_PLAYING;
 				stopchan(chn);
 				chn->newsamp=1;
 				if (val<0)
 					val=0;
 				if ((unsigned)val>=chn->length)
 					val=chn->length-1;
-				dwmixfa_state.smpposw[ch]=(float *)(chn->samp)+val;
-				dwmixfa_state.smpposf[ch]=0;
-				dwmixfa_state.voiceflags[ch]|=poswasplaying;
+				dwmixfa_state.voice[ch].smpposw=(float *)(chn->samp)+val;
+				dwmixfa_state.voice[ch].smpposf=0;
+				dwmixfa_state.voice[ch].voiceflags|=poswasplaying;
 			}
 			break;
 		case mcpCPitch:
@@ -648,22 +649,22 @@ static void devwMixFSET(int ch, int opt, int val)
 			 */
 			if (!(val&128))
 			{
-				dwmixfa_state.ffreq[ch]=1;
-				dwmixfa_state.freso[ch]=0;
+				dwmixfa_state.voicecold[ch].ffreq=1;
+				dwmixfa_state.voicecold[ch].freso=0;
 				break;
 			}
-			dwmixfa_state.ffreq[ch]=33075.0*pow(2,(val-255)/24.0)/dwmixfa_state.samprate;
-			if (dwmixfa_state.ffreq[ch]<0)
-				dwmixfa_state.ffreq[ch]=0;
-			if (dwmixfa_state.ffreq[ch]>1)
-				dwmixfa_state.ffreq[ch]=1;
+			dwmixfa_state.voicecold[ch].ffreq=33075.0*pow(2,(val-255)/24.0)/dwmixfa_state.samprate;
+			if (dwmixfa_state.voicecold[ch].ffreq<0)
+				dwmixfa_state.voicecold[ch].ffreq=0;
+			if (dwmixfa_state.voicecold[ch].ffreq>1)
+				dwmixfa_state.voicecold[ch].ffreq=1;
 			break;
 		case mcpCFilterRez:
 			chn->orgfrez=val/300.0;
 			if (chn->orgfrez>1)
 				chn->orgfrez=1;
-			if (chn->orgfrez==0 && dwmixfa_state.ffreq[ch]==0)
-				dwmixfa_state.ffreq[ch]=1;
+			if (chn->orgfrez==0 && dwmixfa_state.voicecold[ch].ffreq==0)
+				dwmixfa_state.voicecold[ch].ffreq=1;
 			break;
 		case mcpGSpeed:
 			orgspeed=val;
@@ -730,9 +731,9 @@ static int devwMixFGET(int ch, int opt)
 	switch (opt)
 	{
 		case mcpCStatus:
-			return !!(dwmixfa_state.voiceflags[ch]&MIXF_PLAYING);
+			return !!(dwmixfa_state.voice[ch].voiceflags&MIXF_PLAYING);
 		case mcpCMute:
-			return !!(dwmixfa_state.voiceflags[ch]&MIXF_MUTE);
+			return !!(dwmixfa_state.voice[ch].voiceflags&MIXF_MUTE);
 		case mcpGTimer:
 			return imuldiv(playsamps - IdleCache, 65536, dwmixfa_state.samprate);
 		case mcpGCmdTimer:
@@ -761,19 +762,19 @@ static void GetMixChannel(unsigned int ch, struct mixchannel *chn, uint32_t rate
 	chn->length=c->length;
 	chn->loopstart=c->loopstart;
 	chn->loopend=c->loopend;
-	chn->fpos=dwmixfa_state.smpposf[ch]>>16;
-	chn->pos=dwmixfa_state.smpposw[ch]-(float*)c->samp;
+	chn->fpos=dwmixfa_state.voice[ch].smpposf>>16;
+	chn->pos=dwmixfa_state.voice[ch].smpposw-(float*)c->samp;
 	chn->vol.volfs[0]=fabs(c->vol[0]);
 	chn->vol.volfs[1]=fabs(c->vol[1]);
-	chn->step=imuldiv((dwmixfa_state.freqw[ch]<<16)|(dwmixfa_state.freqf[ch]>>16), dwmixfa_state.samprate, (signed)rate);
+	chn->step=imuldiv((dwmixfa_state.voice[ch].freqw<<16)|(dwmixfa_state.voice[ch].freqf>>16), dwmixfa_state.samprate, (signed)rate);
 	chn->status=MIX_PLAYFLOAT;
-	if (dwmixfa_state.voiceflags[ch]&MIXF_MUTE)
+	if (dwmixfa_state.voice[ch].voiceflags&MIXF_MUTE)
 		chn->status|=MIX_MUTE;
-	if (dwmixfa_state.voiceflags[ch]&MIXF_LOOPED)
+	if (dwmixfa_state.voice[ch].voiceflags&MIXF_LOOPED)
 		chn->status|=MIX_LOOPED;
-	if (dwmixfa_state.voiceflags[ch]&MIXF_PLAYING)
+	if (dwmixfa_state.voice[ch].voiceflags&MIXF_PLAYING)
 		chn->status|=MIX_PLAYING;
-	if (dwmixfa_state.voiceflags[ch]&MIXF_INTERPOLATE)
+	if (dwmixfa_state.voice[ch].voiceflags&MIXF_INTERPOLATE)
 		chn->status|=MIX_INTERPOLATE;
 }
 
@@ -853,7 +854,7 @@ static int devwMixFOpenPlayer(int chan, void (*proc)(struct cpifaceSessionAPI_t
 	for (i=0; i<chan; i++)
 	{
 		channels[i].handle=i;
-		dwmixfa_state.voiceflags[i]=0;
+		dwmixfa_state.voice[i].voiceflags=0;
 	}
 
 	dopause=0;
@@ -866,6 +867,7 @@ static int devwMixFOpenPlayer(int chan, void (*proc)(struct cpifaceSessionAPI_t
 
 	dwmixfa_state.nvoices=channelnum;
 	prepare_mixer();
+	mixer_start_threads(mixthreads);
 
 	calcspeed();
 	tickwidth=newtickwidth;
@@ -895,6 +897,8 @@ static void devwMixFClosePlayer()
 
 	plrDevAPI->Stop();
 
+	mixer_stop_threads();
+
 	channelnum=0;
 
 	mixClose();
@@ -995,8 +999,10 @@ static void mixfInit(const char *sec)
 	char regname[50];
 	const char *regs;
 
+	mixthreads=cfGetProfileInt(sec, "threads", 1, 10);
+
 	fprintf(stderr, "[devwmixf] INIT, ");
-	fprintf(stderr, "using dwmixfa.c C version\n");
+	fprintf(stderr, "using dwmixfa.c C version, %d mixing thread(s)\n", mixthreads);
 
 	dwmixfa_state.postprocs=0;
 	regs=cfGetProfileString(sec, "postprocs", "");
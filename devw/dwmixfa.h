@@ -1,4 +1,5 @@
 #define MIXF_MIXBUFLEN 4096
+#define MIXF_TILELEN 256 /* mixer() renders all voices into one tile of this many samples before moving on to the next, keeping the tile in L1 */
 #define MIXF_MAXCHAN 255
 
 //#define MIXF_PLAYSTEREO 0     Floating point mixer doesn't support stereo samples, only mono to stereo output
@@ -17,12 +18,50 @@
 #define MIXF_VOLRAMP  256
 #define MIXF_DECLICK  512
 
+#define MIXF_KERNEL_AUTO -1
+#define MIXF_KERNEL_C     0
+#define MIXF_KERNEL_SSE2  1
+#define MIXF_KERNEL_AVX2  2
+#define MIXF_KERNEL_NEON  3
+
 extern void mixer (void);
 extern void prepare_mixer (void);
 extern void getchanvol (int n, int len);
+extern int mixer_select_kernel (int kernel); /* returns 0 if the kernel is not available on this host/CPU */
+extern const char *mixer_kernel_name (int kernel);
+extern int mixer_start_threads (int threads); /* threads=0 uses one thread per CPU core. Returns the number of threads in use, 1 means mixing is done on the caller thread only */
+extern void mixer_stop_threads (void);
+
+#define MIXF_MAXTHREADS 32
 
 #define MAXVOICES MIXF_MAXCHAN
 
+/* Everything the inner mixing loop touches for a voice, packed together so one
+ * voice only costs a single cache-line fetch when the mixer switches voice. */
+typedef struct
+{
+	float    *smpposw;    /* sample position (whole part (pointer!)) */
+	uint32_t  smpposf;    /* sample position (fractional part) */
+	uint32_t  voiceflags; /* voice status flags */
+	uint32_t  freqw;      /* frequency (whole part) */
+	uint32_t  freqf;      /* frequency (fractional part) */
+	float    *loopend;    /* pointer to loop end */
+	uint32_t  looplen;    /* loop length in samples */
+	float     volleft;    /* float: left volume (1.0=normal) */
+	float     volright;   /* float: right volume (1.0=normal) */
+	float     rampleft;   /* float: left volramp (dvol/sample) */
+	float     rampright;  /* float: right volramp (dvol/sample) */
+} dwmixfa_voice_t;
+
+/* Data that is only needed when a voice has the filter enabled */
+typedef struct
+{
+	float     ffreq;      /* filter frequency (0<=x<=1) */
+	float     freso;      /* filter resonance (0<=x<1) */
+	float     fl1;        /* filter lp buffer */
+	float     fb1;        /* filter bp buffer */
+} dwmixfa_voicecold_t;
+
 typedef struct
 {
 	float    *tempbuf;         /* ptr to 32 bit temp-buffer */
@@ -30,30 +69,11 @@ typedef struct
 	uint32_t  nsamples;        /* # of samples to generate */
 	uint32_t  nvoices;         /* # of voices */
 
-	uint32_t  freqw[MIXF_MAXCHAN]; /* frequency (whole part) */
-	uint32_t  freqf[MIXF_MAXCHAN]; /* frequency (fractional part) */
-
-	float    *smpposw[MIXF_MAXCHAN]; /* sample position (whole part (pointer!)) */
-	uint32_t  smpposf[MIXF_MAXCHAN]; /* sample position (fractional part) */
-
-	float    *loopend[MIXF_MAXCHAN]; /* pointer to loop end */
-	uint32_t  looplen[MIXF_MAXCHAN]; /* loop length in samples */
-
-	float   volleft[MIXF_MAXCHAN];   /* float: left volume (1.0=normal) */
-	float   volright[MIXF_MAXCHAN];  /* float: right volume (1.0=normal) */
-	float   rampleft[MIXF_MAXCHAN];  /* float: left volramp (dvol/sample) */
-	float   rampright[MIXF_MAXCHAN]; /* float: right volramp (dvol/sample) */
-
-	uint32_t voiceflags[MIXF_MAXCHAN]; /* voice status flags */
-
-	float   ffreq[MIXF_MAXCHAN]; /* filter frequency (0<=x<=1) */
-	float   freso[MIXF_MAXCHAN]; /* filter resonance (0<=x<1) */
+	dwmixfa_voice_t     voice[MIXF_MAXCHAN];
+	dwmixfa_voicecold_t voicecold[MIXF_MAXCHAN];
 
 	float   fadeleft,faderight; /* temp holding register - TODO, check if they should be local for channel */
 
-	float   fl1[MIXF_MAXCHAN]; /* filter lp buffer */
-	float   fb1[MIXF_MAXCHAN]; /* filter bp buffer */
-
 	float   voll, volr; /* output volume */
 
 	float   ct0[256]; /* interpolation tab for s[-1] */
@@ -66,16 +86,23 @@ typedef struct
 	struct mixfpostprocregstruct *postprocs; /* TODO */
 
 	/* private to mixer, used be dwmixfa_8087.c */
-	float volrl; /* volume current left */
-	float volrr; /* volume current right */
 	uint16_t clipval;    /* used in clippers in order to transfer into register */
-	uint32_t mixlooplen; /* lenght of loop in samples*/
-	uint32_t looptype;  /* local version of voiceflags[N] */
 	float magic1;  /* internal dumping variable for filters */
+} dwmixfa_state_t;
+
+extern dwmixfa_state_t dwmixfa_state;
+
+/* private to mixer, the registers used while mixing one voice. Each mixing thread has its own copy */
+typedef struct
+{
+	float voll, volr;    /* volume current */
+	float volrl, volrr;  /* volume ramp */
+	uint32_t mixlen;     /* # of samples in the tile currently being mixed */
+	uint32_t mixlooplen; /* lenght of loop in samples*/
+	uint32_t looptype;   /* local version of voiceflags[N] */
+	float holdsample;    /* last sample of a voice that stopped during the tile */
 	float ffrq;
 	float frez;
 	float __fl1;
 	float __fb1;
-} dwmixfa_state_t;
-
-extern dwmixfa_state_t dwmixfa_state;
+} dwmixfa_regs_t;
@@ -20,6 +20,12 @@
 
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #define MAXVOICES MIXF_MAXCHAN
 
@@ -90,7 +96,9 @@ static const clippercall clippers[1] = {clip_16s};
 #endif
 
 
-typedef void(*mixercall)(float *destptr, float **sample_pos, uint32_t *sample_pos_fract, uint32_t sample_pitch, uint32_t sample_pitch_fract, float *loopend);
+typedef void(*mixercall)(dwmixfa_regs_t *r, float *destptr, float **sample_pos, uint32_t *sample_pos_fract, uint32_t sample_pitch, uint32_t sample_pitch_fract, float *loopend);
+
+static const mixercall *mixers = 0; /* selected by mixer_select_kernel() */
 
 void
 prepare_mixer (void)
@@ -99,11 +107,12 @@ prepare_mixer (void)
 
 	state.fadeleft  = 0.0;
 	state.faderight = 0.0;
-	state.volrl = 0.0;
-	state.volrr = 0.0;
 
 	for (i = 0; i < MAXVOICES; i++)
-		state.volleft[i] = dwmixfa_state.volright[i] = 0.0;
+		state.voice[i].volleft = state.voice[i].volright = 0.0;
+
+	if (!mixers)
+		mixer_select_kernel (MIXF_KERNEL_AUTO);
 }
 
 static inline
@@ -122,27 +131,29 @@ void clearbufs(float *samples, int count)
 
 
 static void
-mix_0(float *destptr,
+mix_0(dwmixfa_regs_t *r, float *destptr,
       float **sample_pos, uint32_t *sample_pos_fract,
       uint32_t sample_pitch, uint32_t sample_pitch_fract,
       float *loopend)
 {
 	int i;
 
-	for (i = 0; i < state.nsamples; i++)
+	r->holdsample = 0.0;
+
+	for (i = 0; i < r->mixlen; i++)
 	{
 		*sample_pos_fract += sample_pitch_fract;
 		*sample_pos += sample_pitch + (*sample_pos_fract >> 16);
 		*sample_pos_fract &= 0xffff;
 		while (*sample_pos >= loopend)
 		{
-			if (!(state.looptype & MIXF_LOOPED))
+			if (!(r->looptype & MIXF_LOOPED))
 			{
-				state.looptype &= ~MIXF_PLAYING;
+				r->looptype &= ~MIXF_PLAYING;
 				goto out;
 			}
-			assert(state.mixlooplen > 0);
-			*sample_pos -= state.mixlooplen;
+			assert(r->mixlooplen > 0);
+			*sample_pos -= r->mixlooplen;
 		}
 	}
 out:
@@ -150,17 +161,17 @@ out:
 }
 
 static inline float
-filter_none(float sample)
+filter_none(dwmixfa_regs_t *r, float sample)
 {
 	return sample;
 }
 
 static inline float
-filter_mixf(float sample)
+filter_mixf(dwmixfa_regs_t *r, float sample)
 {
-	state.__fb1  =  state.__fb1  *  state.frez  +  state.ffrq  *  (  sample  -  state.__fl1  );
+	r->__fb1  =  r->__fb1  *  r->frez  +  r->ffrq  *  (  sample  -  r->__fl1  );
 
-	return state.__fl1  +=  state.__fb1;
+	return r->__fl1  +=  r->__fb1;
 }
 
 static inline float
@@ -189,7 +200,7 @@ interp_cub(float* samples, uint_fast16_t sample_pos_fract)
 
 #define MIX_TEMPLATE(NAME, STEREO, INTERP, FILTER)                      \
 static void                                                             \
-mix##NAME(float *destptr,                                               \
+mix##NAME(dwmixfa_regs_t *r, float *destptr,                            \
        float **sample_pos, uint32_t *sample_pos_fract,                  \
        uint32_t sample_pitch, uint32_t sample_pitch_fract,              \
        float *loopend)                                                  \
@@ -197,14 +208,14 @@ mix##NAME(float *destptr,                                               \
     int i = 0;                                                          \
     float sample;                                                       \
                                                                         \
-    for (i = 0; i < state.nsamples; i++)                                \
+    for (i = 0; i < r->mixlen; i++)                                     \
       {                                                                 \
-        sample = filter_##FILTER(interp_##INTERP(*sample_pos, *sample_pos_fract)); \
-        *destptr++ += state.voll * sample;                              \
-        state.voll += state.volrl;                                      \
+        sample = filter_##FILTER(r, interp_##INTERP(*sample_pos, *sample_pos_fract)); \
+        *destptr++ += r->voll * sample;                                 \
+        r->voll += r->volrl;                                            \
         if (STEREO) {                                                   \
-            *destptr++ += state.volr * sample;                          \
-            state.volr += state.volrr;                                  \
+            *destptr++ += r->volr * sample;                             \
+            r->volr += r->volrr;                                        \
         }                                                               \
                                                                         \
         *sample_pos_fract += sample_pitch_fract;                        \
@@ -213,32 +224,31 @@ mix##NAME(float *destptr,                                               \
                                                                         \
         while (*sample_pos >= loopend)                                  \
           {                                                             \
-            if (!(state.looptype & MIXF_LOOPED)) {                      \
-                state.looptype &= ~MIXF_PLAYING;                        \
+            if (!(r->looptype & MIXF_LOOPED)) {                         \
+                r->looptype &= ~MIXF_PLAYING;                           \
                 goto fade;                                              \
             }                                                           \
-            assert(state.mixlooplen > 0);                               \
-            *sample_pos -= state.mixlooplen;                            \
+            assert(r->mixlooplen > 0);                                  \
+            *sample_pos -= r->mixlooplen;                               \
           }                                                             \
       }                                                                 \
     return;                                                             \
                                                                         \
 fade:                                                                   \
-                                                                        \
-    for (; i < state.nsamples; i++)                                     \
+    /* frame i is already mixed. Older versions started at i again,     \
+     * which mixed one frame past the end of the buffer and ramped the  \
+     * volume one step too far, so the output differs slightly */       \
+    for (i++; i < r->mixlen; i++)                                       \
       {                                                                 \
-        *destptr++ += state.voll * sample;                              \
-        state.voll += state.volrl;                                      \
+        *destptr++ += r->voll * sample;                                 \
+        r->voll += r->volrl;                                            \
         if (STEREO) {                                                   \
-            *destptr++ += state.volr * sample;                          \
-            state.volr += state.volrr;                                  \
+            *destptr++ += r->volr * sample;                             \
+            r->volr += r->volrr;                                        \
         }                                                               \
     }                                                                   \
                                                                         \
-    state.fadeleft += state.voll * sample;                              \
-    if (STEREO) {                                                       \
-        state.faderight += state.volr * sample;                         \
-    }                                                                   \
+    r->holdsample = sample;                                             \
 }
 
 MIX_TEMPLATE(s_n, 1, none, none)
@@ -266,7 +276,7 @@ static const mixercall mixers[16] = {
 
 #else
 
-static const mixercall mixers[8] = {
+static const mixercall mixers_c[8] = {
 	mixs_n,   mixs_i,
 	mixs_i2,  mix_0,
 	mixs_nf,  mixs_if,
@@ -275,10 +285,327 @@ static const mixercall mixers[8] = {
 
 #endif
 
+#include "dwmixfa_simd.c"
+
+/* MIXF_KERNEL_AUTO picks a kernel per interpolation mode, from what bench-dwmixfa and test-dwmixfa measure on x86-64:
+ * SSE2 is the fastest without and with linear interpolation (the AVX2 gather instruction costs more than the four scalar
+ * loads it replaces), and none of the vector kernels beat the C mixer at cubic interpolation, which needs to gather its
+ * coefficients from the tables as well */
+static mixercall mixers_auto[8];
+
+static void
+mixer_select_auto (const mixercall *vector)
+{
+	memcpy (mixers_auto, mixers_c, sizeof (mixers_auto));
+	if (vector)
+	{
+		mixers_auto[0] = vector[0]; /* no interpolation */
+		mixers_auto[1] = vector[1]; /* linear interpolation */
+	}
+	mixers = mixers_auto;
+}
+
+int
+mixer_select_kernel (int kernel)
+{
+	switch (kernel)
+	{
+		case MIXF_KERNEL_C:
+			mixers = mixers_c;
+			return 1;
+#ifdef MIXF_HAVE_SSE2
+		case MIXF_KERNEL_SSE2:
+			__builtin_cpu_init ();
+			if (!__builtin_cpu_supports ("sse2"))
+				return 0;
+			mixers = mixers_sse2;
+			return 1;
+#endif
+#ifdef MIXF_HAVE_AVX2
+		case MIXF_KERNEL_AVX2:
+			__builtin_cpu_init ();
+			if (!__builtin_cpu_supports ("avx2"))
+				return 0;
+			mixers = mixers_avx2;
+			return 1;
+#endif
+#ifdef MIXF_HAVE_NEON
+		case MIXF_KERNEL_NEON:
+			mixers = mixers_neon;
+			return 1;
+#endif
+		case MIXF_KERNEL_AUTO:
+			if (mixer_select_kernel (MIXF_KERNEL_SSE2) ||
+			    mixer_select_kernel (MIXF_KERNEL_NEON))
+			{
+				mixer_select_auto (mixers);
+			} else {
+				mixer_select_auto (0);
+			}
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+const char *
+mixer_kernel_name (int kernel)
+{
+	switch (kernel)
+	{
+		case MIXF_KERNEL_C:    return "C";
+		case MIXF_KERNEL_SSE2: return "SSE2";
+		case MIXF_KERNEL_AVX2: return "AVX2";
+		case MIXF_KERNEL_NEON: return "NEON";
+		default:               return "auto";
+	}
+}
+
+/* A voice that stopped in an earlier tile keeps its last sample (with volume ramp) until the end of the buffer */
+static void
+mixhold(dwmixfa_regs_t *r, float *destptr, float sample)
+{
+	int i;
+
+	for (i = 0; i < r->mixlen; i++)
+	{
+		*destptr++ += r->voll * sample;
+		r->voll += r->volrl;
+		*destptr++ += r->volr * sample;
+		r->volr += r->volrr;
+	}
+}
+
+/* voices that are playing at the start of the current buffer */
+static uint8_t active[MIXF_MAXCHAN];
+static float holdsample[MIXF_MAXCHAN];
+static int nactive;
+
+/* Adds mixlen samples of voice active[n] into destptr */
+static void
+mixvoice(dwmixfa_regs_t *r, float *destptr, int n)
+{
+	dwmixfa_voice_t *v = &state.voice[active[n]];
+	mixercall mixer;
+
+	r->voll = v->volleft;
+	r->volr = v->volright;
+	r->volrl = v->rampleft;
+	r->volrr = v->rampright;
+
+	if (!(v->voiceflags & MIXF_PLAYING))
+	{
+		mixhold(r, destptr, holdsample[n]);
+		v->volleft = r->voll;
+		v->volright = r->volr;
+		return;
+	}
+
+	r->looptype = v->voiceflags;
+	r->mixlooplen = v->looplen;
+	if (v->voiceflags & MIXF_FILTER)
+	{
+		dwmixfa_voicecold_t *c = &state.voicecold[active[n]];
+		r->ffrq = c->ffreq;
+		r->frez = c->freso;
+		r->__fl1 = c->fl1;
+		r->__fb1 = c->fb1;
+	}
+
+/*
+	assert((v->freqf & 0xffff) == 0);
+	assert((v->smpposf & 0xffff) == 0);
+*/
+	mixer = mixers[v->voiceflags & 0x7];
+	v->smpposf >>= 16;
+	mixer(r, destptr,
+	      &v->smpposw, &v->smpposf,
+	      v->freqw, v->freqf >> 16,
+	      v->loopend);
+	v->smpposf <<= 16;
+
+	v->voiceflags = r->looptype;
+	v->volleft = r->voll;
+	v->volright = r->volr;
+	if (v->voiceflags & MIXF_FILTER)
+	{
+		dwmixfa_voicecold_t *c = &state.voicecold[active[n]];
+		c->fl1 = r->__fl1;
+		c->fb1 = r->__fb1;
+	}
+	if (!(v->voiceflags & MIXF_PLAYING))
+		holdsample[n] = r->holdsample;
+}
+
+/* Worker pool. For every tile, the voices are handed out through a lock-free
+ * counter, and each voice is rendered into its own slot of voicebuf. After a
+ * barrier, the slots are added into tempbuf in the same voice order as the
+ * single-threaded mixer uses (split by sample range across the threads), so
+ * the output is identical no matter how many threads are in use.
+ */
+static struct
+{
+	int nthreads; /* including the thread calling mixer() */
+	pthread_t threads[MIXF_MAXTHREADS];
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	unsigned int generation; /* increased for every buffer handed to the workers */
+	int quit;
+
+	float *voicebuf; /* MIXF_MAXCHAN slots of MIXF_TILELEN stereo samples */
+	atomic_int next[MIXF_MIXBUFLEN / MIXF_TILELEN]; /* per tile: next voice to claim */
+	atomic_int arrived;
+	atomic_int sense;
+	int mainsense; /* barrier sense of the thread calling mixer() */
+} pool;
+
+static void
+pool_barrier(int *sense)
+{
+	*sense = !*sense;
+	if (atomic_fetch_add (&pool.arrived, 1) == (pool.nthreads - 1))
+	{
+		atomic_store (&pool.arrived, 0);
+		atomic_store (&pool.sense, *sense);
+	} else {
+		while (atomic_load (&pool.sense) != *sense)
+			sched_yield();
+	}
+}
+
+/* Executed by all the threads in parallel, for one buffer */
+static void
+mixer_parallel(int thread, int *sense)
+{
+	dwmixfa_regs_t r;
+	uint32_t pos;
+	int tile;
+
+	for (pos = 0, tile = 0; pos < state.nsamples; pos += MIXF_TILELEN, tile++)
+	{
+		float *destptr = state.tempbuf + 2 /* stereo */ * pos;
+		uint32_t start, stop, j;
+		int n;
+
+		r.mixlen = state.nsamples - pos;
+		if (r.mixlen > MIXF_TILELEN)
+			r.mixlen = MIXF_TILELEN;
+
+		if (!thread)
+			clearbufs(destptr, r.mixlen);
+
+		while ((n = atomic_fetch_add (&pool.next[tile], 1)) < nactive)
+		{
+			float *voicebuf = pool.voicebuf + n * 2 * MIXF_TILELEN;
+			memset (voicebuf, 0, sizeof (float) * 2 * r.mixlen);
+			mixvoice (&r, voicebuf, n);
+		}
+
+		pool_barrier (sense);
+
+		start = 2 * r.mixlen * thread / pool.nthreads;
+		stop = 2 * r.mixlen * (thread + 1) / pool.nthreads;
+		for (n = 0; n < nactive; n++)
+		{
+			float *voicebuf = pool.voicebuf + n * 2 * MIXF_TILELEN;
+			for (j = start; j < stop; j++)
+				destptr[j] += voicebuf[j];
+		}
+
+		pool_barrier (sense);
+	}
+}
+
+static void *
+mixer_thread(void *arg)
+{
+	int thread = (int)(intptr_t)arg;
+	unsigned int generation = 0;
+	int sense = 0;
+
+	while (1)
+	{
+		pthread_mutex_lock (&pool.mutex);
+		while ((pool.generation == generation) && !pool.quit)
+			pthread_cond_wait (&pool.cond, &pool.mutex);
+		generation = pool.generation;
+		if (pool.quit)
+		{
+			pthread_mutex_unlock (&pool.mutex);
+			return 0;
+		}
+		pthread_mutex_unlock (&pool.mutex);
+
+		mixer_parallel (thread, &sense);
+	}
+}
+
+int
+mixer_start_threads (int threads)
+{
+	int i;
+
+	mixer_stop_threads ();
+
+	if (threads <= 0)
+	{
+		long cores = sysconf (_SC_NPROCESSORS_ONLN);
+		threads = (cores > 0) ? cores : 1;
+	}
+	if (threads > MIXF_MAXTHREADS)
+		threads = MIXF_MAXTHREADS;
+	if (threads == 1)
+		return 1;
+
+	if (!(pool.voicebuf = malloc (sizeof (float) * 2 * MIXF_TILELEN * MIXF_MAXCHAN)))
+		return 1;
+
+	pthread_mutex_init (&pool.mutex, NULL);
+	pthread_cond_init (&pool.cond, NULL);
+	pool.generation = 0;
+	pool.quit = 0;
+	atomic_store (&pool.arrived, 0);
+	atomic_store (&pool.sense, 0);
+	pool.mainsense = 0;
+
+	for (i = 1; i < threads; i++)
+	{
+		if (pthread_create (&pool.threads[i], NULL, mixer_thread, (void *)(intptr_t)i))
+			break;
+	}
+	pool.nthreads = i;
+	if (pool.nthreads == 1)
+		mixer_stop_threads ();
+	return i;
+}
+
+void
+mixer_stop_threads (void)
+{
+	int i;
+
+	if (pool.nthreads <= 1)
+		return;
+
+	pthread_mutex_lock (&pool.mutex);
+	pool.quit = 1;
+	pthread_cond_broadcast (&pool.cond);
+	pthread_mutex_unlock (&pool.mutex);
+	for (i = 1; i < pool.nthreads; i++)
+		pthread_join (pool.threads[i], NULL);
+
+	pthread_cond_destroy (&pool.cond);
+	pthread_mutex_destroy (&pool.mutex);
+	free (pool.voicebuf);
+	pool.voicebuf = 0;
+	pool.nthreads = 0;
+}
+
 void
 mixer (void)
 {
-	int voice;
+	uint32_t pos;
+	int voice, n;
 	struct mixfpostprocregstruct *pp;
 
 	if (fabsf(state.fadeleft) < minampl)
@@ -290,45 +617,51 @@ mixer (void)
 	if (state.nsamples == 0)
 		return;
 
-	clearbufs(state.tempbuf, state.nsamples);
-
+	nactive = 0;
 	for (voice = state.nvoices - 1; voice >= 0; voice--)
 	{
-		mixercall mixer;
+		if (state.voice[voice].voiceflags & MIXF_PLAYING)
+			active[nactive++] = voice;
+	}
 
-		if (!(state.voiceflags[voice] & MIXF_PLAYING))
-			continue;
+	if ((pool.nthreads > 1) && (nactive > 1))
+	{
+		for (n = 0; n < (MIXF_MIXBUFLEN / MIXF_TILELEN); n++)
+			atomic_store (&pool.next[n], 0);
+
+		pthread_mutex_lock (&pool.mutex);
+		pool.generation++;
+		pthread_cond_broadcast (&pool.cond);
+		pthread_mutex_unlock (&pool.mutex);
+
+		mixer_parallel (0, &pool.mainsense);
+	} else {
+		/* Render all the voices into one tile of tempbuf at the time, so the tile stays in L1 while the voices are added into it */
+		for (pos = 0; pos < state.nsamples; pos += MIXF_TILELEN)
+		{
+			float *destptr = state.tempbuf + 2 /* stereo */ * pos;
+			dwmixfa_regs_t r;
 
-		state.looptype = state.voiceflags[voice];
-		state.voll = state.volleft[voice];
-		state.volr = state.volright[voice];
-		state.volrl = state.rampleft[voice];
-		state.volrr = state.rampright[voice];
+			r.mixlen = state.nsamples - pos;
+			if (r.mixlen > MIXF_TILELEN)
+				r.mixlen = MIXF_TILELEN;
 
-		state.ffrq = state.ffreq[voice];
-		state.frez = state.freso[voice];
-		state.__fl1 = state.fl1[voice];
-		state.__fb1 = state.fb1[voice];
+			clearbufs(destptr, r.mixlen);
 
-		state.mixlooplen = state.looplen[voice];
+			for (n = 0; n < nactive; n++)
+				mixvoice(&r, destptr, n);
+		}
+	}
 
-/*
-		assert((state.freqf[voice] & 0xffff) == 0);
-		assert((state.smpposf[voice] & 0xffff) == 0);
-*/
-		mixer = mixers[state.voiceflags[voice] & 0x7];
-		state.smpposf[voice] >>= 16;
-		mixer(state.tempbuf,
-		      &state.smpposw[voice], &state.smpposf[voice],
-		      state.freqw[voice], state.freqf[voice] >> 16,
-		      state.loopend[voice]);
-		state.smpposf[voice] <<= 16;
-
-		state.voiceflags[voice] = state.looptype;
-		state.volleft[voice] = state.voll;
-		state.volright[voice] = state.volr;
-		state.fl1[voice] = state.__fl1;
-		state.fb1[voice] = state.__fb1;
+	/* voices that stopped during this buffer continue into the declick fade-out */
+	for (n = 0; n < nactive; n++)
+	{
+		dwmixfa_voice_t *v = &state.voice[active[n]];
+		if (!(v->voiceflags & MIXF_PLAYING))
+		{
+			state.fadeleft += v->volleft * holdsample[n];
+			state.faderight += v->volright * holdsample[n];
+		}
 	}
 
 	for (pp = state.postprocs; pp; pp = pp->next)
@@ -411,29 +744,30 @@ static void clip_8u(float *input, void *output, uint_fast32_t count)
 void
 getchanvol(int n, int len)
 {
-	float *sample_pos = state.smpposw[n];
-	int sample_pos_fract = state.smpposf[n] >> 16;
+	dwmixfa_voice_t *v = &state.voice[n];
+	float *sample_pos = v->smpposw;
+	int sample_pos_fract = v->smpposf >> 16;
 	float sum = 0.0;
 	int i;
 
-	if (state.voiceflags[n] & MIXF_PLAYING)
+	if (v->voiceflags & MIXF_PLAYING)
 	{
 		for (i = 0; i < state.nsamples; i++)
 		{
 			sum += fabsf(*sample_pos);
 
-			sample_pos_fract += state.freqf[n] >> 16;
-			sample_pos += state.freqw[n] + (sample_pos_fract >> 16);
+			sample_pos_fract += v->freqf >> 16;
+			sample_pos += v->freqw + (sample_pos_fract >> 16);
 			sample_pos_fract &= 0xffff;
-			while (sample_pos >= state.loopend[n])
+			while (sample_pos >= v->loopend)
 			{
-				if (!(state.voiceflags[n] & MIXF_LOOPED))
+				if (!(v->voiceflags & MIXF_LOOPED))
 				{
-					state.voiceflags[n] &= ~MIXF_PLAYING;
+					v->voiceflags &= ~MIXF_PLAYING;
 					goto out;
 				}
-				assert(state.looplen[n] > 0);
-				sample_pos -= state.looplen[n];
+				assert(v->looplen > 0);
+				sample_pos -= v->looplen;
 			}
 		}
 	}
@@ -441,6 +775,6 @@ getchanvol(int n, int len)
 out:
 
 	sum /= state.nsamples;
-	state.voll = sum * state.volleft[n];
-	state.volr = sum * state.volright[n];
+	state.voll = sum * v->volleft;
+	state.volr = sum * v->volright;
 }
@@ -0,0 +1,374 @@
+/* OpenCP Module Player
+ * copyright (c) 2022 Stian Skjelstad <stian.skjelstad@gmail.com>
+ *
+ * SSE2/AVX2/NEON versions of the unfiltered FPU mixer routines. Included
+ * from dwmixfa_c.c, and selected at runtime by mixer_select_kernel()
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* The vector kernels render 4 (SSE2/NEON) or 8 (AVX2) output frames per
+ * step. A step is only taken if the sample position after the last frame
+ * is still before loopend, so no looping can happen inside a step. All
+ * other frames (loop wrap, end of sample, tail of the buffer) are rendered
+ * by the same code as the scalar mixer in dwmixfa_c.c.
+ *
+ * The resonance filter is a recursive IIR filter, and it can not be
+ * spread over several output frames, so filtered voices always use the
+ * scalar routines.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define MIXF_HAVE_SSE2 1
+# define MIXF_HAVE_AVX2 1
+# include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+# define MIXF_HAVE_NEON 1
+# include <arm_neon.h>
+#endif
+
+/* Calculate the sample offsets (relative to sample_pos) of the next n output frames.
+ * Returns the 16.16 offset after the last frame, or zero if that offset would hit loopend */
+static inline uint64_t
+simd_block_positions (const float *sample_pos, uint32_t sample_pos_fract,
+                      uint32_t sample_pitch, uint32_t sample_pitch_fract,
+                      const float *loopend, int n, int32_t *idx, int32_t *fract)
+{
+	uint64_t step = ((uint64_t)sample_pitch << 16) | sample_pitch_fract;
+	uint64_t acc = sample_pos_fract;
+	int k;
+
+	if ((uint64_t)(loopend - sample_pos) <= ((acc + step * n) >> 16))
+	{
+		return 0;
+	}
+
+	for (k = 0; k < n; k++)
+	{
+		idx[k] = acc >> 16;
+		fract[k] = acc & 0xffff;
+		acc += step;
+	}
+	return acc;
+}
+
+/* Volume of the next n output frames. The ramp is accumulated exactly like the scalar mixer does it, so rounding matches */
+static inline void
+simd_block_volumes (float *vol, float ramp, int n, float *lanes)
+{
+	int k;
+
+	for (k = 0; k < n; k++)
+	{
+		lanes[k] = *vol;
+		*vol += ramp;
+	}
+}
+
+/* One frame of the scalar mixer, identical to the body of MIX_TEMPLATE. Jumps to fade if the sample ends */
+#define SIMD_SCALAR_STEP(INTERP)                                        \
+        sample = interp_##INTERP(*sample_pos, *sample_pos_fract);       \
+        *destptr++ += r->voll * sample;                                 \
+        r->voll += r->volrl;                                            \
+        *destptr++ += r->volr * sample;                                 \
+        r->volr += r->volrr;                                            \
+                                                                        \
+        *sample_pos_fract += sample_pitch_fract;                        \
+        *sample_pos += sample_pitch + (*sample_pos_fract >> 16);        \
+        *sample_pos_fract &= 0xffff;                                    \
+                                                                        \
+        while (*sample_pos >= loopend)                                  \
+          {                                                             \
+            if (!(r->looptype & MIXF_LOOPED)) {                         \
+                r->looptype &= ~MIXF_PLAYING;                           \
+                goto fade;                                              \
+            }                                                           \
+            assert(r->mixlooplen > 0);                                  \
+            *sample_pos -= r->mixlooplen;                               \
+          }
+
+#define SIMD_FADE                                                       \
+fade:                                                                   \
+    /* frame i is already mixed, see MIX_TEMPLATE in dwmixfa_c.c */     \
+    for (i++; i < r->mixlen; i++)                                       \
+      {                                                                 \
+        *destptr++ += r->voll * sample;                                 \
+        r->voll += r->volrl;                                            \
+        *destptr++ += r->volr * sample;                                 \
+        r->volr += r->volrr;                                            \
+      }                                                                 \
+                                                                        \
+    r->holdsample = sample;
+
+#ifdef MIXF_HAVE_SSE2
+
+__attribute__((target("sse2"))) static inline __m128
+sse2_interp_none (const float *s, const int32_t *idx, const int32_t *fract)
+{
+	return _mm_set_ps (s[idx[3]], s[idx[2]], s[idx[1]], s[idx[0]]);
+}
+
+__attribute__((target("sse2"))) static inline __m128
+sse2_interp_lin (const float *s, const int32_t *idx, const int32_t *fract)
+{
+	__m128 s0 = _mm_set_ps (s[idx[3]],   s[idx[2]],   s[idx[1]],   s[idx[0]]);
+	__m128 s1 = _mm_set_ps (s[idx[3]+1], s[idx[2]+1], s[idx[1]+1], s[idx[0]+1]);
+	__m128 t  = _mm_mul_ps (_mm_cvtepi32_ps (_mm_loadu_si128 ((const __m128i *)fract)), _mm_set1_ps (1.0f / 65536.0f));
+	return _mm_add_ps (s0, _mm_mul_ps (t, _mm_sub_ps (s1, s0)));
+}
+
+__attribute__((target("sse2"))) static inline __m128
+sse2_interp_cub (const float *s, const int32_t *idx, const int32_t *fract)
+{
+	int t0 = fract[0] >> 8, t1 = fract[1] >> 8, t2 = fract[2] >> 8, t3 = fract[3] >> 8;
+	const float *s0 = s + idx[0], *s1 = s + idx[1], *s2 = s + idx[2], *s3 = s + idx[3];
+	__m128 r;
+	r =                _mm_mul_ps (_mm_set_ps (s3[0], s2[0], s1[0], s0[0]), _mm_set_ps (state.ct0[t3], state.ct0[t2], state.ct0[t1], state.ct0[t0]));
+	r = _mm_add_ps (r, _mm_mul_ps (_mm_set_ps (s3[1], s2[1], s1[1], s0[1]), _mm_set_ps (state.ct1[t3], state.ct1[t2], state.ct1[t1], state.ct1[t0])));
+	r = _mm_add_ps (r, _mm_mul_ps (_mm_set_ps (s3[2], s2[2], s1[2], s0[2]), _mm_set_ps (state.ct2[t3], state.ct2[t2], state.ct2[t1], state.ct2[t0])));
+	r = _mm_add_ps (r, _mm_mul_ps (_mm_set_ps (s3[3], s2[3], s1[3], s0[3]), _mm_set_ps (state.ct3[t3], state.ct3[t2], state.ct3[t1], state.ct3[t0])));
+	return r;
+}
+
+#define MIX_TEMPLATE_SSE2(NAME, INTERP)                                 \
+__attribute__((target("sse2"))) static void                             \
+mix##NAME##_sse2(dwmixfa_regs_t *r, float *destptr,                     \
+       float **sample_pos, uint32_t *sample_pos_fract,                  \
+       uint32_t sample_pitch, uint32_t sample_pitch_fract,              \
+       float *loopend)                                                  \
+{                                                                       \
+    int i = 0;                                                          \
+    float sample = 0.0f;                                                \
+    int32_t idx[4], fract[4];                                           \
+    float vl[4], vr[4];                                                 \
+                                                                        \
+    while (i < r->mixlen)                                               \
+      {                                                                 \
+        uint64_t next;                                                  \
+        if ((i + 4 <= r->mixlen) &&                                     \
+            (next = simd_block_positions (*sample_pos, *sample_pos_fract, sample_pitch, sample_pitch_fract, loopend, 4, idx, fract))) \
+          {                                                             \
+            __m128 s = sse2_interp_##INTERP (*sample_pos, idx, fract);  \
+            __m128 outl, outr;                                          \
+            simd_block_volumes (&r->voll, r->volrl, 4, vl);             \
+            simd_block_volumes (&r->volr, r->volrr, 4, vr);             \
+            outl = _mm_mul_ps (s, _mm_loadu_ps (vl));                   \
+            outr = _mm_mul_ps (s, _mm_loadu_ps (vr));                   \
+            _mm_storeu_ps (destptr,     _mm_add_ps (_mm_loadu_ps (destptr),     _mm_unpacklo_ps (outl, outr))); \
+            _mm_storeu_ps (destptr + 4, _mm_add_ps (_mm_loadu_ps (destptr + 4), _mm_unpackhi_ps (outl, outr))); \
+            destptr += 8;                                               \
+            sample = _mm_cvtss_f32 (_mm_shuffle_ps (s, s, 0xff));       \
+            *sample_pos += next >> 16;                                  \
+            *sample_pos_fract = next & 0xffff;                          \
+            i += 4;                                                     \
+            continue;                                                   \
+          }                                                             \
+        SIMD_SCALAR_STEP(INTERP)                                        \
+        i++;                                                            \
+      }                                                                 \
+    return;                                                             \
+                                                                        \
+    SIMD_FADE                                                           \
+}
+
+MIX_TEMPLATE_SSE2(s_n, none)
+MIX_TEMPLATE_SSE2(s_i, lin)
+MIX_TEMPLATE_SSE2(s_i2, cub)
+
+static const mixercall mixers_sse2[8] = {
+	mixs_n_sse2,  mixs_i_sse2,
+	mixs_i2_sse2, mix_0,
+	mixs_nf,      mixs_if,
+	mixs_i2f,     mix_0
+};
+
+#endif
+
+#ifdef MIXF_HAVE_AVX2
+
+__attribute__((target("avx2"))) static inline __m256
+avx2_interp_none (const float *s, __m256i idx, __m256i fract)
+{
+	return _mm256_i32gather_ps (s, idx, 4);
+}
+
+__attribute__((target("avx2"))) static inline __m256
+avx2_interp_lin (const float *s, __m256i idx, __m256i fract)
+{
+	__m256 s0 = _mm256_i32gather_ps (s,     idx, 4);
+	__m256 s1 = _mm256_i32gather_ps (s + 1, idx, 4);
+	__m256 t  = _mm256_mul_ps (_mm256_cvtepi32_ps (fract), _mm256_set1_ps (1.0f / 65536.0f));
+	return _mm256_add_ps (s0, _mm256_mul_ps (t, _mm256_sub_ps (s1, s0)));
+}
+
+__attribute__((target("avx2"))) static inline __m256
+avx2_interp_cub (const float *s, __m256i idx, __m256i fract)
+{
+	__m256i t = _mm256_srli_epi32 (fract, 8);
+	__m256 r;
+	r =                   _mm256_mul_ps (_mm256_i32gather_ps (s,     idx, 4), _mm256_i32gather_ps (state.ct0, t, 4));
+	r = _mm256_add_ps (r, _mm256_mul_ps (_mm256_i32gather_ps (s + 1, idx, 4), _mm256_i32gather_ps (state.ct1, t, 4)));
+	r = _mm256_add_ps (r, _mm256_mul_ps (_mm256_i32gather_ps (s + 2, idx, 4), _mm256_i32gather_ps (state.ct2, t, 4)));
+	r = _mm256_add_ps (r, _mm256_mul_ps (_mm256_i32gather_ps (s + 3, idx, 4), _mm256_i32gather_ps (state.ct3, t, 4)));
+	return r;
+}
+
+#define MIX_TEMPLATE_AVX2(NAME, INTERP)                                 \
+__attribute__((target("avx2"))) static void                             \
+mix##NAME##_avx2(dwmixfa_regs_t *r, float *destptr,                     \
+       float **sample_pos, uint32_t *sample_pos_fract,                  \
+       uint32_t sample_pitch, uint32_t sample_pitch_fract,              \
+       float *loopend)                                                  \
+{                                                                       \
+    int i = 0;                                                          \
+    float sample = 0.0f;                                                \
+    int32_t idx[8], fract[8];                                           \
+    float vl[8], vr[8];                                                 \
+                                                                        \
+    while (i < r->mixlen)                                               \
+      {                                                                 \
+        uint64_t next;                                                  \
+        if ((i + 8 <= r->mixlen) &&                                     \
+            (next = simd_block_positions (*sample_pos, *sample_pos_fract, sample_pitch, sample_pitch_fract, loopend, 8, idx, fract))) \
+          {                                                             \
+            __m256 s = avx2_interp_##INTERP (*sample_pos, _mm256_loadu_si256 ((const __m256i *)idx), _mm256_loadu_si256 ((const __m256i *)fract)); \
+            __m256 outl, outr, lo, hi;                                  \
+            simd_block_volumes (&r->voll, r->volrl, 8, vl);             \
+            simd_block_volumes (&r->volr, r->volrr, 8, vr);             \
+            outl = _mm256_mul_ps (s, _mm256_loadu_ps (vl));             \
+            outr = _mm256_mul_ps (s, _mm256_loadu_ps (vr));             \
+            lo = _mm256_unpacklo_ps (outl, outr); /* frames 0,1 | 4,5 */ \
+            hi = _mm256_unpackhi_ps (outl, outr); /* frames 2,3 | 6,7 */ \
+            _mm256_storeu_ps (destptr,     _mm256_add_ps (_mm256_loadu_ps (destptr),     _mm256_permute2f128_ps (lo, hi, 0x20))); \
+            _mm256_storeu_ps (destptr + 8, _mm256_add_ps (_mm256_loadu_ps (destptr + 8), _mm256_permute2f128_ps (lo, hi, 0x31))); \
+            destptr += 16;                                              \
+            sample = _mm_cvtss_f32 (_mm_shuffle_ps (_mm256_extractf128_ps (s, 1), _mm256_extractf128_ps (s, 1), 0xff)); \
+            *sample_pos += next >> 16;                                  \
+            *sample_pos_fract = next & 0xffff;                          \
+            i += 8;                                                     \
+            continue;                                                   \
+          }                                                             \
+        SIMD_SCALAR_STEP(INTERP)                                        \
+        i++;                                                            \
+      }                                                                 \
+    return;                                                             \
+                                                                        \
+    SIMD_FADE                                                           \
+}
+
+MIX_TEMPLATE_AVX2(s_n, none)
+MIX_TEMPLATE_AVX2(s_i, lin)
+MIX_TEMPLATE_AVX2(s_i2, cub)
+
+static const mixercall mixers_avx2[8] = {
+	mixs_n_avx2,  mixs_i_avx2,
+	mixs_i2_avx2, mix_0,
+	mixs_nf,      mixs_if,
+	mixs_i2f,     mix_0
+};
+
+#endif
+
+#ifdef MIXF_HAVE_NEON
+
+static inline float32x4_t
+neon_interp_none (const float *s, const int32_t *idx, const int32_t *fract)
+{
+	float v[4] = {s[idx[0]], s[idx[1]], s[idx[2]], s[idx[3]]};
+	return vld1q_f32 (v);
+}
+
+static inline float32x4_t
+neon_interp_lin (const float *s, const int32_t *idx, const int32_t *fract)
+{
+	float v0[4] = {s[idx[0]],   s[idx[1]],   s[idx[2]],   s[idx[3]]};
+	float v1[4] = {s[idx[0]+1], s[idx[1]+1], s[idx[2]+1], s[idx[3]+1]};
+	float32x4_t s0 = vld1q_f32 (v0);
+	float32x4_t t = vmulq_n_f32 (vcvtq_f32_s32 (vld1q_s32 (fract)), 1.0f / 65536.0f);
+	return vmlaq_f32 (s0, t, vsubq_f32 (vld1q_f32 (v1), s0));
+}
+
+static inline float32x4_t
+neon_interp_cub (const float *s, const int32_t *idx, const int32_t *fract)
+{
+	int t0 = fract[0] >> 8, t1 = fract[1] >> 8, t2 = fract[2] >> 8, t3 = fract[3] >> 8;
+	const float *s0 = s + idx[0], *s1 = s + idx[1], *s2 = s + idx[2], *s3 = s + idx[3];
+	float a[4][4] = {{s0[0], s1[0], s2[0], s3[0]}, {s0[1], s1[1], s2[1], s3[1]}, {s0[2], s1[2], s2[2], s3[2]}, {s0[3], s1[3], s2[3], s3[3]}};
+	float c[4][4] = {{state.ct0[t0], state.ct0[t1], state.ct0[t2], state.ct0[t3]},
+	                 {state.ct1[t0], state.ct1[t1], state.ct1[t2], state.ct1[t3]},
+	                 {state.ct2[t0], state.ct2[t1], state.ct2[t2], state.ct2[t3]},
+	                 {state.ct3[t0], state.ct3[t1], state.ct3[t2], state.ct3[t3]}};
+	float32x4_t r;
+	r =            vmulq_f32 (vld1q_f32 (a[0]), vld1q_f32 (c[0]));
+	r = vmlaq_f32 (r,         vld1q_f32 (a[1]), vld1q_f32 (c[1]));
+	r = vmlaq_f32 (r,         vld1q_f32 (a[2]), vld1q_f32 (c[2]));
+	r = vmlaq_f32 (r,         vld1q_f32 (a[3]), vld1q_f32 (c[3]));
+	return r;
+}
+
+#define MIX_TEMPLATE_NEON(NAME, INTERP)                                 \
+static void                                                             \
+mix##NAME##_neon(dwmixfa_regs_t *r, float *destptr,                     \
+       float **sample_pos, uint32_t *sample_pos_fract,                  \
+       uint32_t sample_pitch, uint32_t sample_pitch_fract,              \
+       float *loopend)                                                  \
+{                                                                       \
+    int i = 0;                                                          \
+    float sample = 0.0f;                                                \
+    int32_t idx[4], fract[4];                                           \
+    float vl[4], vr[4];                                                 \
+                                                                        \
+    while (i < r->mixlen)                                               \
+      {                                                                 \
+        uint64_t next;                                                  \
+        if ((i + 4 <= r->mixlen) &&                                     \
+            (next = simd_block_positions (*sample_pos, *sample_pos_fract, sample_pitch, sample_pitch_fract, loopend, 4, idx, fract))) \
+          {                                                             \
+            float32x4_t s = neon_interp_##INTERP (*sample_pos, idx, fract); \
+            float32x4x2_t z;                                            \
+            simd_block_volumes (&r->voll, r->volrl, 4, vl);             \
+            simd_block_volumes (&r->volr, r->volrr, 4, vr);             \
+            z = vzipq_f32 (vmulq_f32 (s, vld1q_f32 (vl)), vmulq_f32 (s, vld1q_f32 (vr))); \
+            vst1q_f32 (destptr,     vaddq_f32 (vld1q_f32 (destptr),     z.val[0])); \
+            vst1q_f32 (destptr + 4, vaddq_f32 (vld1q_f32 (destptr + 4), z.val[1])); \
+            destptr += 8;                                               \
+            sample = vgetq_lane_f32 (s, 3);                             \
+            *sample_pos += next >> 16;                                  \
+            *sample_pos_fract = next & 0xffff;                          \
+            i += 4;                                                     \
+            continue;                                                   \
+          }                                                             \
+        SIMD_SCALAR_STEP(INTERP)                                        \
+        i++;                                                            \
+      }                                                                 \
+    return;                                                             \
+                                                                        \
+    SIMD_FADE                                                           \
+}
+
+MIX_TEMPLATE_NEON(s_n, none)
+MIX_TEMPLATE_NEON(s_i, lin)
+MIX_TEMPLATE_NEON(s_i2, cub)
+
+static const mixercall mixers_neon[8] = {
+	mixs_n_neon,  mixs_i_neon,
+	mixs_i2_neon, mix_0,
+	mixs_nf,      mixs_if,
+	mixs_i2f,     mix_0
+};
+
+#endif
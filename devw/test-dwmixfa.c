@@ -23,8 +23,10 @@
 #include <stdio.h>
 #include "dwmixfa.h"
 #include "dev/mcp.h"
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 
 static int channelnum;
 
@@ -76,7 +78,7 @@ static void OpenPlayer(int chan)
 
 	for (i=0; i<chan; i++)
 	{
-		dwmixfa_state.voiceflags[i]=0;
+		dwmixfa_state.voice[i].voiceflags=0;
 	}
 
 	dwmixfa_state.samprate=/*plrRate*/44100;
@@ -129,8 +131,180 @@ static void ClosePlayer()
 	  free(dwmixfa_state.tempbuf);
 }
 
+#define KERNEL_VOICES 64
+#define KERNEL_SAMPLELEN 4096
+static float kernel_samples[KERNEL_VOICES][KERNEL_SAMPLELEN + 8];
+
+static void kernel_setup_samples(void)
+{
+	int i, j;
+
+	srand(1);
+	for (i=0; i<KERNEL_VOICES; i++)
+	{
+		for (j=0; j<KERNEL_SAMPLELEN + 8; j++)
+		{
+			kernel_samples[i][j] = (float)(rand() % 65536 - 32768);
+		}
+	}
+}
+
+static void kernel_setup_voices(int flags)
+{
+	int i;
+
+	srand(2);
+	for (i=0; i<KERNEL_VOICES; i++)
+	{
+		dwmixfa_state.voice[i].voiceflags = MIXF_PLAYING | flags | ((i & 3) ? MIXF_LOOPED : 0); /* every 4th voice ends and fades out */
+		dwmixfa_state.voice[i].freqw = i / 16;
+		dwmixfa_state.voice[i].freqf = (uint32_t)(rand() & 0xffff) << 16;
+		dwmixfa_state.voice[i].smpposw = kernel_samples[i] + (rand() % 1024);
+		dwmixfa_state.voice[i].smpposf = (uint32_t)(rand() & 0xffff) << 16;
+		dwmixfa_state.voice[i].looplen = KERNEL_SAMPLELEN - 1024 - i * 8;
+		dwmixfa_state.voice[i].loopend = kernel_samples[i] + KERNEL_SAMPLELEN - i * 8;
+		dwmixfa_state.voice[i].volleft = 0.005f * (i + 1);
+		dwmixfa_state.voice[i].volright = 0.3f - 0.004f * i;
+		dwmixfa_state.voice[i].rampleft = (i & 1) ? 0.0f : 0.00001f;
+		dwmixfa_state.voice[i].rampright = (i & 1) ? -0.00001f : 0.0f;
+		dwmixfa_state.voicecold[i].fl1 = 0;
+		dwmixfa_state.voicecold[i].fb1 = 0;
+		dwmixfa_state.voicecold[i].ffreq = (flags & MIXF_FILTER) ? 0.7f : 1.0f;
+		dwmixfa_state.voicecold[i].freso = (flags & MIXF_FILTER) ? 0.2f : 0.0f;
+	}
+	dwmixfa_state.nvoices = KERNEL_VOICES;
+	dwmixfa_state.fadeleft = 0.0f;
+	dwmixfa_state.faderight = 0.0f;
+}
+
+/* mixes one buffer with the given kernel, and leaves the result in dwmixfa_state.tempbuf */
+static void kernel_run(int kernel, int flags, int nsamples, int16_t *output)
+{
+	mixer_select_kernel (kernel);
+	kernel_setup_voices (flags);
+	dwmixfa_state.outbuf = output;
+	dwmixfa_state.nsamples = nsamples;
+	mixer();
+}
+
+static int test_kernels(void)
+{
+	static const int flags[3] = {0, MIXF_INTERPOLATE, MIXF_INTERPOLATEQ};
+	static const char *flagnames[3] = {"none", "linear", "cubic"};
+	static const int kernels[3] = {MIXF_KERNEL_SSE2, MIXF_KERNEL_AVX2, MIXF_KERNEL_NEON};
+	static int16_t output[MIXF_MIXBUFLEN * 2];
+	float *reference;
+	int retval = 0;
+	int k, f;
+
+	reference = malloc (sizeof (float) * (MIXF_MIXBUFLEN<<1));
+	if (!reference)
+	{
+		exit(1);
+	}
+	kernel_setup_samples ();
+
+	for (k=0; k < 3; k++)
+	{
+		if (!mixer_select_kernel (kernels[k]))
+		{
+			fprintf (stderr, "kernel %-4s: not available on this host\n", mixer_kernel_name (kernels[k]));
+			continue;
+		}
+		for (f=0; f < 3; f++)
+		{
+			float maxdiff = 0.0f;
+			float *refpos[KERNEL_VOICES];
+			uint32_t reffract[KERNEL_VOICES];
+			int i, posok = 1;
+
+			kernel_run (MIXF_KERNEL_C, flags[f], 1000, output);
+			memcpy (reference, dwmixfa_state.tempbuf, sizeof (float) * 2 * 1000);
+			for (i=0; i < KERNEL_VOICES; i++)
+			{
+				refpos[i] = dwmixfa_state.voice[i].smpposw;
+				reffract[i] = dwmixfa_state.voice[i].smpposf;
+			}
+
+			kernel_run (kernels[k], flags[f], 1000, output);
+			for (i=0; i < 2 * 1000; i++)
+			{
+				float diff = fabsf (reference[i] - dwmixfa_state.tempbuf[i]);
+				if (diff > maxdiff)
+				{
+					maxdiff = diff;
+				}
+			}
+			for (i=0; i < KERNEL_VOICES; i++)
+			{
+				if ((refpos[i] != dwmixfa_state.voice[i].smpposw) || (reffract[i] != dwmixfa_state.voice[i].smpposf))
+				{
+					posok = 0;
+				}
+			}
+			/* linear interpolation is done in single precision (the C version promotes to double), so allow tiny differences */
+			fprintf (stderr, "kernel %-4s %-6s: max difference %f, sample positions %s\n", mixer_kernel_name (kernels[k]), flagnames[f], maxdiff, posok ? "ok" : "MISMATCH");
+			if ((maxdiff > 0.05f) || (!posok))
+			{
+				retval = 1;
+			}
+		}
+	}
+
+	/* throughput benchmark */
+	for (k=-1; k < 3; k++)
+	{
+		int kernel = (k < 0) ? MIXF_KERNEL_C : kernels[k];
+		if (!mixer_select_kernel (kernel))
+		{
+			continue;
+		}
+		for (f=0; f < 3; f++)
+		{
+			struct timespec t1, t2;
+			double elapsed;
+			int iter;
+
+			clock_gettime (CLOCK_MONOTONIC, &t1);
+			for (iter=0; iter < 50; iter++)
+			{
+				kernel_run (kernel, flags[f], MIXF_MIXBUFLEN, output);
+			}
+			clock_gettime (CLOCK_MONOTONIC, &t2);
+			elapsed = (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1000000000.0;
+			fprintf (stderr, "benchmark %-4s %-6s: %8.2f Mvoice-samples/s\n", mixer_kernel_name (kernel), flagnames[f], 50.0 * MIXF_MIXBUFLEN * KERNEL_VOICES / elapsed / 1000000.0);
+		}
+	}
+
+	/* threaded mixing must give exactly the same output as single-threaded mixing */
+	for (f=0; f < 3; f++)
+	{
+		static int16_t output2[MIXF_MIXBUFLEN * 2];
+		int threads;
+
+		mixer_select_kernel (MIXF_KERNEL_AUTO);
+		mixer_stop_threads ();
+		kernel_run (MIXF_KERNEL_AUTO, flags[f] | MIXF_FILTER, MIXF_MIXBUFLEN, output);
+		threads = mixer_start_threads (4);
+		kernel_run (MIXF_KERNEL_AUTO, flags[f] | MIXF_FILTER, MIXF_MIXBUFLEN, output2);
+		mixer_stop_threads ();
+
+		fprintf (stderr, "threads %d %-6s: %s\n", threads, flagnames[f], memcmp (output, output2, sizeof (output)) ? "MISMATCH" : "identical");
+		if (memcmp (output, output2, sizeof (output)))
+		{
+			retval = 1;
+		}
+	}
+
+	free (reference);
+	mixer_select_kernel (MIXF_KERNEL_AUTO);
+
+	return retval;
+}
+
 int main(int argc, char *argv[])
 {
+	int retval;
 	float sample_1[] = {12345.0f, 23451.1234f, 30000.543f, 32767.0f, 1023.09f, -5435.05f, -32768.0f, -16000.02f}; /* normalized around 32767 and -32768 */
 	int16_t output[2048];
 /* INIT START */
@@ -167,27 +341,27 @@ int main(int argc, char *argv[])
 	dwmixfa_state.outbuf=output+2;
 	dwmixfa_state.nsamples=308;//508;
 
-	dwmixfa_state.voiceflags[0] = MIXF_PLAYING|MIXF_LOOPED; /* this is so broken! */
+	dwmixfa_state.voice[0].voiceflags = MIXF_PLAYING|MIXF_LOOPED; /* this is so broken! */
 
-	dwmixfa_state.freqf[0]=0x3a987654; /* pitch */
-	dwmixfa_state.freqw[0]=0x00000000; /* pitch */
+	dwmixfa_state.voice[0].freqf=0x3a987654; /* pitch */
+	dwmixfa_state.voice[0].freqw=0x00000000; /* pitch */
 
-	dwmixfa_state.fl1[0]=0; /* reset filter */
-	dwmixfa_state.fb1[0]=0; /* reset feilter */
+	dwmixfa_state.voicecold[0].fl1=0; /* reset filter */
+	dwmixfa_state.voicecold[0].fb1=0; /* reset feilter */
 
-	dwmixfa_state.ffreq[0] = 1;      /* filter frequency (0<=x<=1) TODO, needs testing / study */
-	dwmixfa_state.freso[0] = 0;      /* filter resonance (0<=x<1)  TODO, needs testing / study*/
+	dwmixfa_state.voicecold[0].ffreq = 1;      /* filter frequency (0<=x<=1) TODO, needs testing / study */
+	dwmixfa_state.voicecold[0].freso = 0;      /* filter resonance (0<=x<1)  TODO, needs testing / study*/
 
-	dwmixfa_state.smpposf[0]=0;
-	dwmixfa_state.smpposw[0]=sample_1;
+	dwmixfa_state.voice[0].smpposf=0;
+	dwmixfa_state.voice[0].smpposw=sample_1;
 
-	dwmixfa_state.looplen[0]=4;
-	dwmixfa_state.loopend[0]=&sample_1[7];
+	dwmixfa_state.voice[0].looplen=4;
+	dwmixfa_state.voice[0].loopend=&sample_1[7];
 
-	dwmixfa_state.volleft[0]=0.125f;
-	dwmixfa_state.volright[0]=0.125f;
-	dwmixfa_state.rampleft[0]=0.0f;
-	dwmixfa_state.rampright[0]=0.0f;
+	dwmixfa_state.voice[0].volleft=0.125f;
+	dwmixfa_state.voice[0].volright=0.125f;
+	dwmixfa_state.voice[0].rampleft=0.0f;
+	dwmixfa_state.voice[0].rampright=0.0f;
 
 	dwmixfa_state.fadeleft=0.5f;
 	dwmixfa_state.faderight=-0.5f;
@@ -202,9 +376,11 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "\n");
 	}
 
-	fprintf(stderr, "smppos: %u.%u\n", (unsigned int)(dwmixfa_state.smpposw[0]-sample_1), dwmixfa_state.smpposf[0]);
+	fprintf(stderr, "smppos: %u.%u\n", (unsigned int)(dwmixfa_state.voice[0].smpposw-sample_1), dwmixfa_state.voice[0].smpposf);
+
+	retval = test_kernels();
 
 	ClosePlayer();
 
-	return 0;
+	return retval;
 }
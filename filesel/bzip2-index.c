@@ -0,0 +1,331 @@
+/* OpenCP Module Player
+ * copyright (c) 2022 Stian Skjelstad <stian.skjelstad@gmail.com>
+ *
+ * Block index for bzip2 streams, and decoding of single blocks, based on
+ * the same idea as seek-bzip2 and pbzip2.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <bzlib.h>
+#include "types.h"
+#include "bzip2-index.h"
+
+/*
+ serialized format, all numbers are little endian:
+
+  4 bytes number of points
+
+ per point:
+  8 bytes out
+  8 bytes inbit
+*/
+
+void bzip2_index_free (struct bzip2_index_t *self)
+{
+	free (self->points);
+	self->points = 0;
+	self->fill = 0;
+	self->size = 0;
+	self->dirty = 0;
+}
+
+void bzip2_index_add (struct bzip2_index_t *self, uint64_t inbit, uint64_t out)
+{
+	if (self->fill && (inbit <= self->points[self->fill - 1].inbit))
+	{
+		return;
+	}
+
+	if (self->fill == self->size)
+	{
+		struct bzip2_index_point_t *temp = realloc (self->points, sizeof (self->points[0]) * (self->size + 64));
+		if (!temp)
+		{
+			return;
+		}
+		self->points = temp;
+		self->size += 64;
+	}
+	self->points[self->fill].out = out;
+	self->points[self->fill].inbit = inbit;
+	self->fill++;
+	self->dirty = 1;
+}
+
+const struct bzip2_index_point_t *bzip2_index_lookup (const struct bzip2_index_t *self, uint64_t pos)
+{
+	int lo = 0, hi = self->fill;
+
+	/* binary search for the last point with out <= pos */
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (self->points[mid].out <= pos)
+		{
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo ? (self->points + lo - 1) : 0;
+}
+
+static void put32 (unsigned char *dst, uint32_t src)
+{
+	dst[0] = src;
+	dst[1] = src >> 8;
+	dst[2] = src >> 16;
+	dst[3] = src >> 24;
+}
+
+static void put64 (unsigned char *dst, uint64_t src)
+{
+	put32 (dst, src);
+	put32 (dst + 4, src >> 32);
+}
+
+static uint32_t get32 (const unsigned char *src)
+{
+	return ((uint32_t)src[3] << 24) | ((uint32_t)src[2] << 16) | ((uint32_t)src[1] << 8) | src[0];
+}
+
+static uint64_t get64 (const unsigned char *src)
+{
+	return ((uint64_t)get32 (src + 4) << 32) | get32 (src);
+}
+
+unsigned char *bzip2_index_serialize (const struct bzip2_index_t *self, size_t *datasize)
+{
+	unsigned char *retval;
+	int i;
+
+	*datasize = 4 + self->fill * 16;
+	retval = malloc (*datasize);
+	if (!retval)
+	{
+		return 0;
+	}
+
+	put32 (retval, self->fill);
+	for (i=0; i < self->fill; i++)
+	{
+		put64 (retval + 4 + i * 16 + 0, self->points[i].out);
+		put64 (retval + 4 + i * 16 + 8, self->points[i].inbit);
+	}
+	return retval;
+}
+
+int bzip2_index_deserialize (struct bzip2_index_t *self, const unsigned char *data, size_t datasize)
+{
+	uint32_t count, i;
+
+	bzip2_index_free (self);
+
+	if (datasize < 4)
+	{
+		return -1;
+	}
+	count = get32 (data);
+	if ((datasize - 4) / 16 != count)
+	{
+		return -1;
+	}
+	if (!count)
+	{
+		return 0;
+	}
+
+	self->points = malloc (sizeof (self->points[0]) * count);
+	if (!self->points)
+	{
+		return -1;
+	}
+	self->size = count;
+
+	for (i=0; i < count; i++)
+	{
+		self->points[i].out   = get64 (data + 4 + i * 16 + 0);
+		self->points[i].inbit = get64 (data + 4 + i * 16 + 8);
+		if (i && ((self->points[i].out < self->points[i-1].out) || (self->points[i].inbit <= self->points[i-1].inbit)))
+		{
+			bzip2_index_free (self);
+			return -1;
+		}
+	}
+	self->fill = count;
+	return 0;
+}
+
+int64_t bzip2_block_scan (const uint8_t *src, size_t len, uint64_t bit, int *eos)
+{
+	uint64_t reg = 0;
+	size_t p;
+
+	/* feed one byte at the time, and test the 8 possible bit alignments of a magic that ends in this byte */
+	for (p = bit >> 3; p < len; p++)
+	{
+		int s;
+
+		reg = (reg << 8) | src[p];
+		for (s = 7; s >= 0; s--)
+		{
+			uint64_t candidate = (reg >> s) & 0xffffffffffffULL;
+			int64_t start;
+
+			if ((candidate != BZIP2_BLOCK_MAGIC) && (candidate != BZIP2_EOS_MAGIC))
+			{
+				continue;
+			}
+			start = (int64_t)p * 8 + 8 - s - 48;
+			if (start < (int64_t)bit)
+			{
+				continue;
+			}
+			*eos = (candidate == BZIP2_EOS_MAGIC);
+			return start;
+		}
+	}
+	return -1;
+}
+
+static uint64_t get_bits (const uint8_t *src, uint64_t bit, int count)
+{
+	uint64_t retval = 0;
+
+	while (count--)
+	{
+		retval = (retval << 1) | ((src[bit >> 3] >> (7 - (bit & 7))) & 1);
+		bit++;
+	}
+	return retval;
+}
+
+static void put_bits (uint8_t *dst, uint64_t bit, uint64_t value, int count)
+{
+	while (count--)
+	{
+		if ((value >> count) & 1)
+		{
+			dst[bit >> 3] |= 0x80 >> (bit & 7);
+		}
+		bit++;
+	}
+}
+
+int bzip2_block_decode (const uint8_t *src, size_t len, uint64_t start, uint64_t end, int level, uint8_t **dst, size_t *dstlen)
+{
+	uint64_t bits = end - start;
+	uint64_t bytes = (bits + 7) >> 3;
+	size_t streamlen = 4 + ((bits + 80 + 7) >> 3);
+	uint8_t *stream;
+	const uint8_t *in;
+	int shift = start & 7;
+	uint64_t i;
+	bz_stream strm;
+	size_t outsize;
+	int ret;
+
+	*dst = 0;
+	*dstlen = 0;
+
+	if ((end <= start + 80) || (end > (uint64_t)len * 8) || (level < 1) || (level > 9))
+	{
+		return -1;
+	}
+
+	stream = calloc (streamlen, 1);
+	if (!stream)
+	{
+		return -1;
+	}
+
+	/* A new stream header, the block itself shifted into byte alignment, and an end-of-stream marker. The combined CRC of a single block stream is the CRC of that block */
+	stream[0] = 'B';
+	stream[1] = 'Z';
+	stream[2] = 'h';
+	stream[3] = '0' + level;
+	in = src + (start >> 3);
+	for (i = 0; i < bytes; i++)
+	{
+		uint8_t next = ((start >> 3) + i + 1 < len) ? in[i + 1] : 0;
+		stream[4 + i] = shift ? ((in[i] << shift) | (next >> (8 - shift))) : in[i];
+	}
+	if (bits & 7)
+	{
+		stream[4 + bytes - 1] &= 0xff << (8 - (bits & 7));
+	}
+	put_bits (stream, 32 + bits, BZIP2_EOS_MAGIC, 48);
+	put_bits (stream, 32 + bits + 48, get_bits (src, start + 48, 32), 32);
+
+	memset (&strm, 0, sizeof (strm));
+	if (BZ2_bzDecompressInit (&strm, 0 /* no verbosity */, 0 /* do not use the small decompression routine */) != BZ_OK)
+	{
+		free (stream);
+		return -1;
+	}
+	outsize = level * 100000;
+	*dst = malloc (outsize);
+	if (!*dst)
+	{
+		BZ2_bzDecompressEnd (&strm);
+		free (stream);
+		return -1;
+	}
+	strm.next_in = (char *)stream;
+	strm.avail_in = streamlen;
+	strm.next_out = (char *)*dst;
+	strm.avail_out = outsize;
+
+	while (1)
+	{
+		ret = BZ2_bzDecompress (&strm);
+		if (ret == BZ_STREAM_END)
+		{
+			break;
+		}
+		if ((ret != BZ_OK) || strm.avail_out)
+		{ /* broken data, or the block was cut short, since the output buffer was not filled */
+			goto error;
+		}
+		{ /* the first run-length pass can make a block larger than the block size */
+			uint8_t *temp = realloc (*dst, outsize * 2);
+			if (!temp)
+			{
+				goto error;
+			}
+			*dst = temp;
+			strm.next_out = (char *)*dst + outsize;
+			strm.avail_out = outsize;
+			outsize *= 2;
+		}
+	}
+
+	*dstlen = outsize - strm.avail_out;
+	BZ2_bzDecompressEnd (&strm);
+	free (stream);
+	return 0;
+
+error:
+	BZ2_bzDecompressEnd (&strm);
+	free (stream);
+	free (*dst);
+	*dst = 0;
+	return -1;
+}
@@ -0,0 +1,50 @@
+#ifndef _BZIP2_INDEX_H
+#define _BZIP2_INDEX_H 1
+
+/* Random access into bzip2 streams, and decoding of single blocks.
+ *
+ * A bzip2 stream is a sequence of independent blocks of up to 900KB of
+ * output. Each block starts with a 48 bit magic that is not byte aligned,
+ * so blocks are found by scanning the compressed data bit by bit. A block
+ * is decoded on its own by wrapping it into a stream of its own, which
+ * means several blocks can be decoded at the same time, and a seek only has
+ * to decode the block it lands in.
+ */
+
+#define BZIP2_BLOCK_MAGIC 0x314159265359ULL
+#define BZIP2_EOS_MAGIC   0x177245385090ULL
+
+struct bzip2_index_point_t
+{
+	uint64_t out;   /* uncompressed offset */
+	uint64_t inbit; /* compressed offset of the block magic, in bits */
+};
+
+struct bzip2_index_t
+{
+	struct bzip2_index_point_t *points;
+	int                         fill;
+	int                         size;
+	int                         dirty; /* points were added since load, and should be stored */
+};
+
+void bzip2_index_free (struct bzip2_index_t *self); /* frees the content, not self */
+
+/* Blocks are only appended, a block at or before the last point is ignored */
+void bzip2_index_add (struct bzip2_index_t *self, uint64_t inbit, uint64_t out);
+
+/* Returns the last block starting at or before pos, or NULL */
+const struct bzip2_index_point_t *bzip2_index_lookup (const struct bzip2_index_t *self, uint64_t pos);
+
+/* Serialized form, for storing in adbMeta */
+unsigned char *bzip2_index_serialize (const struct bzip2_index_t *self, size_t *datasize);
+int bzip2_index_deserialize (struct bzip2_index_t *self, const unsigned char *data, size_t datasize);
+
+/* Returns the bit offset of the first block or end-of-stream magic starting at or after bit that fits inside the len bytes of src, or -1. *eos is set if it is the end-of-stream magic */
+int64_t bzip2_block_scan (const uint8_t *src, size_t len, uint64_t bit, int *eos);
+
+/* Decodes the block starting at bit start of src, ending at bit end (where the next magic starts). level is the digit from the stream header.
+ * Returns non-zero on error, else *dst must be freed by the caller. Can be called from any thread */
+int bzip2_block_decode (const uint8_t *src, size_t len, uint64_t start, uint64_t end, int level, uint8_t **dst, size_t *dstlen);
+
+#endif
@@ -20,6 +20,7 @@
 
 #include "config.h"
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -332,6 +333,145 @@ int __attribute__ ((visibility ("internal")))
 	return 1;
 }
 
+/* Sector cache, shared by all the datasources of a disc.
+ *
+ * Sectors are read CDFS_CACHE_SECTORS at the time, so sequential access
+ * (audio tracks, files) only costs one seek and read per block, and the
+ * sectors around a directory or descriptor are usually already there when
+ * the parser asks for them. The least recently used block is replaced.
+ */
+struct cdfs_sectorcache_block_t
+{
+	int       datasource; /* index into disc->datasources_data */
+	uint32_t  stride;     /* bytes per sector, as stored in the datasource */
+	uint32_t  first;      /* first sector, relative to the datasource */
+	uint32_t  count;      /* sectors loaded, 0 = unused */
+	uint32_t  lastuse;
+	uint32_t  size;       /* allocated size of data */
+	uint8_t  *data;
+};
+
+struct cdfs_sectorcache_t
+{
+	pthread_mutex_t                 mutex; /* audio tracks are read from the player while the UI can browse the disc */
+	uint32_t                        tick;
+	struct cdfs_sectorcache_block_t blocks[CDFS_CACHE_BLOCKS];
+};
+
+static void cdfs_sectorcache_free (struct cdfs_disc_t *disc)
+{
+	int i;
+
+	if (!disc->sectorcache)
+	{
+		return;
+	}
+	for (i=0; i < CDFS_CACHE_BLOCKS; i++)
+	{
+		free (disc->sectorcache->blocks[i].data);
+	}
+	pthread_mutex_destroy (&disc->sectorcache->mutex);
+	free (disc->sectorcache);
+	disc->sectorcache = 0;
+}
+
+/* Reads length bytes, starting skip bytes into sector relsector of datasource i. Each sector is stored as stride bytes */
+static int cdfs_datasource_read (struct cdfs_disc_t *disc, int i, uint32_t relsector, uint32_t stride, uint32_t skip, uint8_t *dst, uint32_t length)
+{
+	struct cdfs_datasource_t *ds = disc->datasources_data + i;
+	struct cdfs_sectorcache_t *c;
+	struct cdfs_sectorcache_block_t *b = 0;
+	uint32_t first = relsector - (relsector % CDFS_CACHE_SECTORS);
+	int j;
+
+	if (!disc->sectorcache)
+	{ /* cdfs_disc_new() failed to allocate the cache */
+		if (ds->fh->seek_set (ds->fh, ds->offset + (uint64_t)relsector * stride + skip) < 0)
+		{
+			debug_printf ("seek((%"PRIu32")*%"PRIu32" + %"PRIu32", SEEK_SET) failed\n", relsector, stride, skip);
+			return -1;
+		}
+		if (ds->fh->read (ds->fh, dst, length) != length)
+		{
+			debug_printf ("read(buffer, %"PRIu32") failed\n", length);
+			return -1;
+		}
+		return 0;
+	}
+	c = disc->sectorcache;
+
+	pthread_mutex_lock (&c->mutex);
+	c->tick++;
+
+	for (j=0; j < CDFS_CACHE_BLOCKS; j++)
+	{
+		if ((c->blocks[j].count) &&
+		    (c->blocks[j].datasource == i) &&
+		    (c->blocks[j].stride == stride) &&
+		    (c->blocks[j].first == first) &&
+		    (c->blocks[j].first + c->blocks[j].count > relsector))
+		{
+			b = c->blocks + j;
+			break;
+		}
+	}
+
+	if (!b)
+	{
+		uint32_t count = ds->sectorcount - first;
+		int got;
+
+		b = c->blocks; /* unused blocks have lastuse 0, and are picked first */
+		for (j=1; j < CDFS_CACHE_BLOCKS; j++)
+		{
+			if (c->blocks[j].lastuse < b->lastuse)
+			{
+				b = c->blocks + j;
+			}
+		}
+
+		if (count > CDFS_CACHE_SECTORS)
+		{
+			count = CDFS_CACHE_SECTORS;
+		}
+		b->count = 0;
+		if (b->size < count * stride)
+		{
+			uint8_t *temp = realloc (b->data, CDFS_CACHE_SECTORS * stride);
+			if (!temp)
+			{
+				pthread_mutex_unlock (&c->mutex);
+				return -1;
+			}
+			b->data = temp;
+			b->size = CDFS_CACHE_SECTORS * stride;
+		}
+		if (ds->fh->seek_set (ds->fh, ds->offset + (uint64_t)first * stride) < 0)
+		{
+			debug_printf ("seek((%"PRIu32")*%"PRIu32", SEEK_SET) failed\n", first, stride);
+			pthread_mutex_unlock (&c->mutex);
+			return -1;
+		}
+		got = ds->fh->read (ds->fh, b->data, count * stride);
+		b->datasource = i;
+		b->stride = stride;
+		b->first = first;
+		b->count = got / stride; /* a short read only happens at EOF, keep the complete sectors */
+		if (b->first + b->count <= relsector)
+		{
+			debug_printf ("read(buffer, %"PRIu32") failed\n", count * stride);
+			pthread_mutex_unlock (&c->mutex);
+			return -1;
+		}
+	}
+
+	b->lastuse = c->tick;
+	memcpy (dst, b->data + (relsector - first) * stride + skip, length);
+
+	pthread_mutex_unlock (&c->mutex);
+	return 0;
+}
+
 int __attribute__ ((visibility ("internal"))) cdfs_fetch_absolute_sector_2048 (struct cdfs_disc_t *disc, uint32_t sector, uint8_t *buffer) /* 2048 byte modes */
 {
 	int i;
@@ -372,15 +512,8 @@ int __attribute__ ((visibility ("internal"))) cdfs_fetch_absolute_sector_2048 (s
 				case FORMAT_MODE1_RAW___NONE:
 				case FORMAT_MODE2_RAW___NONE:
 				case FORMAT_XA_MODE2_RAW:
-					if (disc->datasources_data[i].fh->seek_set (disc->datasources_data[i].fh, disc->datasources_data[i].offset + ((uint64_t)relsector)*(SECTORSIZE_XA2 + subchannel)) < 0)
-					{
-						debug_printf ("seek((%"PRId32")*(SECTORSIZE_XA2+%d), SEEK_SET) failed\n", relsector, subchannel);
-						return -1;
-					}
-
-					if (disc->datasources_data[i].fh->read(disc->datasources_data[i].fh, xbuffer, 16) != 16)
+					if (cdfs_datasource_read (disc, i, relsector, SECTORSIZE_XA2 + subchannel, 0, xbuffer, 16))
 					{
-						debug_printf ("read(xbuffer, 16) failed\n");
 						return -1;
 					}
 					if (memcmp (xbuffer, "\x00\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\x00", 12))
@@ -395,27 +528,12 @@ int __attribute__ ((visibility ("internal"))) cdfs_fetch_absolute_sector_2048 (s
 							debug_printf ("Sector %"PRId32" is CLEAR\n", sector);
 							return -1;
 						case 0x01: /* MODE 1: DATA */
-							if (disc->datasources_data[i].fh->read(disc->datasources_data[i].fh, buffer, SECTORSIZE) != SECTORSIZE)
-							{
-								debug_printf ("read(buffer, SECTORSIZE) failed\n");
-								return -1;
-							}
-							return 0;
+							return cdfs_datasource_read (disc, i, relsector, SECTORSIZE_XA2 + subchannel, 16, buffer, SECTORSIZE);
 						case 0xe2: /* Seems to be second to last sector on CD-R, mode-2 */
 						case 0x02: /* MODE 2 */
 							/* assuming XA-FORM-1, that is the only mode2 that can provide 2048 bytes of data */
 #warning ignoring sub-header in FORMAT_XA_MODE2_RAW for now..
-							if (disc->datasources_data[i].fh->read(disc->datasources_data[i].fh, xbuffer, 8) != 8)
-							{
-								debug_printf ("read(xbuffer_subheader, 8) failed\n");
-								return -1;
-							}
-							if (disc->datasources_data[i].fh->read(disc->datasources_data[i].fh, buffer, SECTORSIZE) != SECTORSIZE)
-							{
-								debug_printf ("read(buffer, SECTORSIZE) failed\n");
-								return -1;
-							}
-							return 0;
+							return cdfs_datasource_read (disc, i, relsector, SECTORSIZE_XA2 + subchannel, 16 + 8, buffer, SECTORSIZE);
 						default:
 							debug_printf ("Sector %"PRId32" is of unknown type (0x%02x)\n", sector, xbuffer[15]);
 							return -1;
@@ -427,29 +545,8 @@ int __attribute__ ((visibility ("internal"))) cdfs_fetch_absolute_sector_2048 (s
 					subchannel = 96;
 					/* fall-through */
 				case FORMAT_XA_MODE2_FORM_MIX___NONE: /* not tested */
-					if (disc->datasources_data[i].fh->seek_set(disc->datasources_data[i].fh, disc->datasources_data[i].offset + ((uint64_t)relsector)*(2324 + 8 + subchannel)) < 0)
-					{
-						debug_printf ("seek((%"PRId32")*(2324 + 8 + %d)), SEEK_SET) failed\n", relsector, subchannel);
-						return -1;
-					}
-
-					if (disc->datasources_data[i].fh->read(disc->datasources_data[i].fh, xbuffer, 8) != 8)
-					{
-						debug_printf ("read(xbuffer, 8) failed\n");
-						return -1;
-					}
 #warning ignoring sub-header in FORMAT_XA_MODE2_FORM_MIX for now..
-					if (disc->datasources_data[i].fh->read(disc->datasources_data[i].fh, xbuffer, 8) != 8)
-					{
-						debug_printf ("read(xbuffer_subheader, 8) failed\n");
-						return -1;
-					}
-					if (disc->datasources_data[i].fh->read(disc->datasources_data[i].fh, buffer, SECTORSIZE) != SECTORSIZE)
-					{
-						debug_printf ("read(buffer, SECTORSIZE) failed\n");
-						return -1;
-					}
-					return 0;
+					return cdfs_datasource_read (disc, i, relsector, 2324 + 8 + subchannel, 8 + 8, buffer, SECTORSIZE);
 
 				case FORMAT_MODE1___RAW_RW:
 				case FORMAT_MODE1___RW:
@@ -462,35 +559,14 @@ int __attribute__ ((visibility ("internal"))) cdfs_fetch_absolute_sector_2048 (s
 				case FORMAT_MODE1___NONE:
 				case FORMAT_XA_MODE2_FORM1___NONE:
 				case FORMAT_MODE_1__XA_MODE2_FORM1___NONE:
-					if (disc->datasources_data[i].fh->seek_set(disc->datasources_data[i].fh, disc->datasources_data[i].offset + ((uint64_t)relsector)*(SECTORSIZE + subchannel)) < 0)
-					{
-						debug_printf ("seek((%"PRId32")*(SECTORSIZE + %d)), SEEK_SET) failed\n", relsector, subchannel);
-						return -1;
-					}
-					if (disc->datasources_data[i].fh->read(disc->datasources_data[i].fh, buffer, SECTORSIZE) != SECTORSIZE)
-					{
-						debug_printf ("read(buffer, SECTORSIZE) failed\n");
-						return -1;
-					}
-					return 0;
+					return cdfs_datasource_read (disc, i, relsector, SECTORSIZE + subchannel, 0, buffer, SECTORSIZE);
 
 				case FORMAT_XA1_MODE2_FORM1___RW:
 				case FORMAT_XA1_MODE2_FORM1___RW_RAW:
 					subchannel = 96;
 					/* fall-through */
 				case FORMAT_XA1_MODE2_FORM1___NONE:
-
-					if (disc->datasources_data[i].fh->seek_set(disc->datasources_data[i].fh, disc->datasources_data[i].offset + ((uint64_t)relsector)*(SECTORSIZE + 8 + subchannel) + 8) < 0)
-					{
-						debug_printf ("seek((%"PRId32")*(SECTORSIZE + 8 + %d) + 8), SEEK_SET) failed\n", relsector, subchannel);
-						return -1;
-					}
-					if (disc->datasources_data[i].fh->read(disc->datasources_data[i].fh, buffer, SECTORSIZE) != SECTORSIZE)
-					{
-						debug_printf ("read(buffer, SECTORSIZE) failed\n");
-						return -1;
-					}
-					return 0;
+					return cdfs_datasource_read (disc, i, relsector, SECTORSIZE + 8 + subchannel, 8, buffer, SECTORSIZE);
 
 				case FORMAT_MODE2___NONE:
 				case FORMAT_MODE2___RAW_RW:
@@ -539,18 +615,7 @@ int __attribute__ ((visibility ("internal"))) cdfs_fetch_absolute_sector_2352 (s
 					subchannel = 96;
 					/* fall-through */
 				case FORMAT_AUDIO_SWAP___NONE: /* we do not swap endian on 2048 byte fetches */
-					if (disc->datasources_data[i].fh->seek_set (disc->datasources_data[i].fh, disc->datasources_data[i].offset + ((uint64_t)relsector)*(SECTORSIZE_XA2 + subchannel)) < 0)
-					{
-						debug_printf ("seek((%"PRId32")*(SECTORSIZE_XA2+%d), SEEK_SET) failed\n", relsector, subchannel);
-						return -1;
-					}
-
-					if (disc->datasources_data[i].fh->read(disc->datasources_data[i].fh, buffer, SECTORSIZE_XA2) != SECTORSIZE_XA2)
-					{
-						debug_printf ("read(buffer, SECTORSIZE) failed\n");
-						return -1;
-					}
-					return 0;
+					return cdfs_datasource_read (disc, i, relsector, SECTORSIZE_XA2 + subchannel, 0, buffer, SECTORSIZE_XA2);
 
 				case FORMAT_AUDIO___RAW_RW: /* we do not swap endian on 2048 byte fetches */
 				case FORMAT_AUDIO___RW: /* we do not swap endian on 2048 byte fetches */
@@ -569,15 +634,8 @@ int __attribute__ ((visibility ("internal"))) cdfs_fetch_absolute_sector_2352 (s
 				case FORMAT_MODE1_RAW___NONE:
 				case FORMAT_MODE2_RAW___NONE:
 				case FORMAT_XA_MODE2_RAW:
-					if (disc->datasources_data[i].fh->seek_set (disc->datasources_data[i].fh, disc->datasources_data[i].offset + ((uint64_t)relsector)*(SECTORSIZE_XA2 + subchannel)) < 0)
+					if (cdfs_datasource_read (disc, i, relsector, SECTORSIZE_XA2 + subchannel, 0, buffer, SECTORSIZE_XA2))
 					{
-						debug_printf ("seek((%"PRId32")*(SECTORSIZE_XA2+%d), SEEK_SET) failed\n", relsector, subchannel);
-						return -1;
-					}
-
-					if (disc->datasources_data[i].fh->read(disc->datasources_data[i].fh, buffer, SECTORSIZE_XA2) != SECTORSIZE_XA2)
-					{
-						debug_printf ("read(buffer, SECTORSIZE) failed\n");
 						return -1;
 					}
 
@@ -747,6 +805,12 @@ struct cdfs_disc_t __attribute__ ((visibility ("internal"))) *cdfs_disc_new (str
 		return 0;
 	}
 
+	disc->sectorcache = calloc (sizeof (*disc->sectorcache), 1);
+	if (disc->sectorcache)
+	{
+		pthread_mutex_init (&disc->sectorcache->mutex, NULL);
+	}
+
 	disc->dir_size = 16;
 	disc->dirs = malloc (disc->dir_size * sizeof (disc->dirs[0]));
 
@@ -853,6 +917,8 @@ static void cdfs_disc_free (struct cdfs_disc_t *disc)
 	}
 	free (disc->datasources_data);
 
+	cdfs_sectorcache_free (disc);
+
 	for (i=0; i < 100; i++)
 	{
 		free (disc->tracks_data[i].title);
@@ -216,6 +216,11 @@ struct cdfs_instance_file_t
 };
 
 struct musicbrainz_database_h;
+#define CDFS_CACHE_SECTORS 32 /* sectors read in one go */
+#define CDFS_CACHE_BLOCKS  32 /* blocks of CDFS_CACHE_SECTORS kept per disc */
+
+struct cdfs_sectorcache_t;
+
 struct cdfs_disc_t
 {
 	struct cdfs_disc_instance_t       *next; // TODO
@@ -249,6 +254,8 @@ struct cdfs_disc_t
 
 	/* One UDF session can in theory cross sessions on disc */
 	struct UDF_Session       *udf_session;
+
+	struct cdfs_sectorcache_t *sectorcache; /* allocated by cdfs_disc_new(), NULL if that failed and reads go straight to the datasources */
 };
 
 void cdfs_disc_datasource_append (struct cdfs_disc_t     *disc,
@@ -2,7 +2,9 @@
 
 //#define DIRDB_DEBUG 1
 
+#include <time.h>
 #include "dirdb.c"
+#include "textindex.c"
 #include "../stuff/compat.c"
 
 #define ANSI_COLOR_RED     "\x1b[31m"
@@ -13,7 +15,7 @@
 #define ANSI_COLOR_CYAN    "\x1b[36m"
 #define ANSI_COLOR_RESET   "\x1b[0m"
 
-int (*_measurestr_utf8)(const char *src, int srclen) = 0;
+struct console_t Console;
 uint32_t utf8_decode (const char *_src, size_t srclen, int *inc)
 {
 	*inc=1;
@@ -22,20 +24,19 @@ uint32_t utf8_decode (const char *_src, size_t srclen, int *inc)
 
 static void clear_dirdb()
 {
-	int i;
-	for (i=0; i < dirdbNum; i++)
-	{
-		free(dirdbData[i].name);
-	}
+	dirdbNameFreeAll ();
 	free (dirdbData);
 	dirdbData=0;
 	dirdbNum=0;
 	dirdbDirty=0;
+	free (dirdbHashData);
+	dirdbHashData=0;
+	dirdbHashSize=0;
 	dirdbRootChild = DIRDB_NOPARENT;
 	dirdbFreeChild = DIRDB_NOPARENT;
 }
 
-char *cfConfigDir = "/foo/home/ocp/.ocp/";
+struct configAPI_t configAPI = {.ConfigDir = "/foo/home/ocp/.ocp/"};
 uint8_t mdbCleanSlate = 0;
 
 static int dirdb_basic_test1(void)
@@ -1071,6 +1072,201 @@ static int dirdb_basic_test8(void)
 	return retval;
 }
 
+#define BENCH_DIRS  16
+#define BENCH_FILES 8192
+static int dirdb_bench_test9(void)
+{
+	int retval = 0;
+	uint32_t root, dirs[BENCH_DIRS];
+	static uint32_t files[BENCH_DIRS][BENCH_FILES];
+	struct timespec t1, t2, t3;
+	char name[64];
+	int i, j, e;
+
+	fprintf (stderr, ANSI_COLOR_CYAN "Large tree, %d directories with %d files each\n" ANSI_COLOR_RESET, BENCH_DIRS, BENCH_FILES);
+
+	root = dirdbResolvePathAndRef ("file:/tmp/bench", dirdb_use_dir);
+	for (i=0; i < BENCH_DIRS; i++)
+	{
+		snprintf (name, sizeof (name), "dir%d", i);
+		dirs[i] = dirdbFindAndRef (root, name, dirdb_use_dir);
+	}
+
+	clock_gettime (CLOCK_MONOTONIC, &t1);
+	for (i=0; i < BENCH_DIRS; i++)
+	{
+		for (j=0; j < BENCH_FILES; j++)
+		{
+			snprintf (name, sizeof (name), "module %05d.mod", j);
+			files[i][j] = dirdbFindAndRef (dirs[i], name, dirdb_use_file);
+		}
+	}
+	clock_gettime (CLOCK_MONOTONIC, &t2);
+
+	/* every name is now found, and ends up at the same node */
+	e = 0;
+	for (i=0; i < BENCH_DIRS; i++)
+	{
+		for (j=0; j < BENCH_FILES; j++)
+		{
+			snprintf (name, sizeof (name), "module %05d.mod", j);
+			if (dirdbFindAndRef (dirs[i], name, dirdb_use_file) != files[i][j])
+			{
+				e++;
+			}
+			dirdbUnref (files[i][j], dirdb_use_file);
+		}
+	}
+	clock_gettime (CLOCK_MONOTONIC, &t3);
+
+	fprintf (stderr, "insert: %.1f ns per node, lookup: %.1f ns per node\n",
+		((t2.tv_sec - t1.tv_sec) * 1000000000.0 + (t2.tv_nsec - t1.tv_nsec)) / (BENCH_DIRS * BENCH_FILES),
+		((t3.tv_sec - t2.tv_sec) * 1000000000.0 + (t3.tv_nsec - t2.tv_nsec)) / (BENCH_DIRS * BENCH_FILES));
+	fprintf (stderr, "lookups resolve to the inserted nodes: %s\n" ANSI_COLOR_RESET, e ? ANSI_COLOR_RED "Failed" : ANSI_COLOR_GREEN "OK");
+	retval |= !!e;
+
+	/* release in a different order than they were created */
+	for (j=0; j < BENCH_FILES; j++)
+	{
+		for (i=0; i < BENCH_DIRS; i++)
+		{
+			dirdbUnref (files[i][(j * 7919) % BENCH_FILES], dirdb_use_file);
+		}
+	}
+	for (i=0; i < BENCH_DIRS; i++)
+	{
+		dirdbUnref (dirs[i], dirdb_use_dir);
+	}
+	dirdbUnref (root, dirdb_use_dir);
+
+	e = 0;
+	for (i=0; i < dirdbNum; i++)
+	{
+		if (dirdbData[i].name)
+		{
+			e++;
+		}
+	}
+	for (i=0; i < dirdbNameChunksCount; i++)
+	{
+		if (dirdbNameChunks[i] && dirdbNameChunks[i]->live)
+		{
+			e++;
+		}
+	}
+	fprintf (stderr, "all nodes and names released: %s\n" ANSI_COLOR_RESET, e ? ANSI_COLOR_RED "Failed" : ANSI_COLOR_GREEN "OK");
+	retval |= !!e;
+
+	clear_dirdb();
+
+	return retval;
+}
+
+static int dirdb_basic_test10_expect (const char *query, const uint32_t *mdb_refs, uint32_t mdb_count, int expected_retval, const uint32_t *expected, uint32_t expected_count)
+{
+	uint32_t *nodes = 0, count = 0;
+	uint32_t sorted[8];
+	int r, i;
+
+	/* the result is sorted on node */
+	memcpy (sorted, expected, expected_count * sizeof (uint32_t));
+	qsort (sorted, expected_count, sizeof (uint32_t), dirdbSearchCmp);
+
+	fprintf (stderr, "dirdbSearchMdb(\"%s\", %d mdb_refs) => ", query, (int)mdb_count);
+	r = dirdbSearchMdb (query, mdb_refs, mdb_count, &nodes, &count);
+	if (r != expected_retval)
+	{
+		fprintf (stderr, ANSI_COLOR_RED "retval %d != %d\n" ANSI_COLOR_RESET, r, expected_retval);
+		free (nodes);
+		return 1;
+	}
+	if ((!r) && ((count != expected_count) || (count && memcmp (nodes, sorted, count * sizeof (uint32_t)))))
+	{
+		fprintf (stderr, ANSI_COLOR_RED "%d nodes:", (int)count);
+		for (i=0; i < count; i++)
+		{
+			fprintf (stderr, " %"PRIu32, nodes[i]);
+		}
+		fprintf (stderr, ", expected %d\n" ANSI_COLOR_RESET, (int)expected_count);
+		free (nodes);
+		return 1;
+	}
+	fprintf (stderr, ANSI_COLOR_GREEN "OK\n" ANSI_COLOR_RESET);
+	free (nodes);
+	return 0;
+}
+
+static int dirdb_basic_test10(void)
+{
+	int retval = 0;
+	uint32_t dir = dirdbResolvePathAndRef ("file:/tmp/mods", dirdb_use_filehandle);
+	uint32_t sub = dirdbResolvePathAndRef ("file:/tmp/mods/debris", dirdb_use_filehandle);
+	uint32_t file1 = dirdbResolvePathAndRef ("file:/tmp/mods/Space Debris.mod", dirdb_use_filehandle);
+	uint32_t file2 = dirdbResolvePathAndRef ("file:/tmp/mods/other.xm", dirdb_use_filehandle);
+	uint32_t file3 = dirdbResolvePathAndRef ("file:/tmp/mods/debris/debris.it", dirdb_use_filehandle);
+	uint32_t file4;
+	uint32_t expected[3];
+	uint32_t mdb_refs[1];
+
+	fprintf (stderr, ANSI_COLOR_CYAN "Testing dirdbSearchMdb()\n" ANSI_COLOR_RESET);
+
+	dirdbTagSetParent (dir);
+	dirdbMakeMdbRef (file1, 1);
+	dirdbMakeMdbRef (file2, 2);
+	dirdbMakeMdbRef (file3, 3);
+	dirdbTagRemoveUntaggedAndSubmit ();
+
+	/* only nodes with a mdb_ref match on their name, so the directory named debris does not */
+	expected[0] = file1; expected[1] = file3;
+	retval |= dirdb_basic_test10_expect ("debris", 0, 0, 0, expected, 2);
+	retval |= dirdb_basic_test10_expect ("SPACE deb", 0, 0, 0, expected, 1);
+	retval |= dirdb_basic_test10_expect ("nomatch", 0, 0, 0, expected, 0);
+	retval |= dirdb_basic_test10_expect ("de", 0, 0, -1, expected, 0);
+
+	/* nodes that use the given mdb_refs are included, without duplicates */
+	mdb_refs[0] = 2;
+	expected[0] = file2;
+	retval |= dirdb_basic_test10_expect ("nomatch", mdb_refs, 1, 0, expected, 1);
+	mdb_refs[0] = 1;
+	expected[0] = file1; expected[1] = file3;
+	retval |= dirdb_basic_test10_expect ("debris", mdb_refs, 1, 0, expected, 2);
+
+	/* a node that gets a mdb_ref after the first search */
+	file4 = dirdbResolvePathAndRef ("file:/tmp/mods/debris/debris2.s3m", dirdb_use_filehandle);
+	dirdbTagSetParent (dir);
+	dirdbMakeMdbRef (file1, 1);
+	dirdbMakeMdbRef (file2, 2);
+	dirdbMakeMdbRef (file3, 3);
+	dirdbMakeMdbRef (file4, 4);
+	dirdbTagRemoveUntaggedAndSubmit ();
+	expected[0] = file1; expected[1] = file3; expected[2] = file4;
+	retval |= dirdb_basic_test10_expect ("debris", 0, 0, 0, expected, 3);
+
+	/* and one that loses it */
+	dirdbTagSetParent (dir);
+	dirdbMakeMdbRef (file3, 3);
+	dirdbMakeMdbRef (file4, 4);
+	dirdbTagRemoveUntaggedAndSubmit ();
+	expected[0] = file3; expected[1] = file4;
+	retval |= dirdb_basic_test10_expect ("debris", 0, 0, 0, expected, 2);
+	mdb_refs[0] = 1;
+	retval |= dirdb_basic_test10_expect ("debris", mdb_refs, 1, 0, expected, 2);
+
+	dirdbUnref (dir, dirdb_use_filehandle);
+	dirdbUnref (sub, dirdb_use_filehandle);
+	dirdbUnref (file1, dirdb_use_filehandle);
+	dirdbUnref (file2, dirdb_use_filehandle);
+	dirdbUnref (file3, dirdb_use_filehandle);
+	dirdbUnref (file4, dirdb_use_filehandle);
+
+	dirdbSearchFree ();
+	clear_dirdb();
+
+	fprintf (stderr, "\n");
+
+	return retval;
+}
+
 int main(int argc, char *argv[])
 {
 	int retval = 0;
@@ -1091,5 +1287,9 @@ int main(int argc, char *argv[])
 
 	retval |= dirdb_basic_test7(); /* dirdbTagSetParent(), dirdbMakeMdbRef(), dirdbTagRemoveUntaggedAndSubmit(), dirdbGetMdb() */
 
+	retval |= dirdb_bench_test9(); /* dirdbFindAndRef() + dirdbUnref() on a large tree */
+
+	retval |= dirdb_basic_test10(); /* dirdbSearchMdb() */
+
 	return retval;
 }
@@ -24,6 +24,7 @@
 #include "config.h"
 #include <assert.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,6 +35,7 @@
 #include "boot/console.h"
 #include "dirdb.h"
 #include "mdb.h"
+#include "textindex.h"
 #include "boot/psetting.h"
 #include "stuff/compat.h"
 #include "stuff/poutput.h"
@@ -44,10 +46,15 @@ struct dirdbEntry
 	uint32_t parent;
 
 	uint32_t next;
+	uint32_t prev; /* previous sibling, so a node can be unlinked without scanning all its siblings */
 	uint32_t child;
 
+	uint32_t hashnext; /* next node in the same dirdbHashData bucket */
+	uint32_t namehash; /* dirdbNameHash (parent, name) */
+
 	uint32_t mdb_ref;
-	char *name; /* we pollute malloc a lot with this */
+	char *name; /* stored in dirdbNameChunks[namechunk] */
+	uint32_t namechunk;
 	int refcount;
 #ifdef DIRDB_DEBUG
 	int refcount_children;
@@ -74,11 +81,240 @@ const char dirdbsigv2[60] = "Cubic Player Directory Data Base\x1B\x00\x00\x00\x0
 
 static struct dirdbEntry *dirdbData=0;
 static uint32_t dirdbNum=0;
+/* the medialib scanner threads look up names while the main thread adds nodes, so guard the realloc() of dirdbData */
+static pthread_mutex_t dirdbDataMutex = PTHREAD_MUTEX_INITIALIZER;
 static int dirdbDirty=0;
 
 static uint32_t dirdbRootChild = DIRDB_NOPARENT;
 static uint32_t dirdbFreeChild = DIRDB_NOPARENT;
 
+/* All nodes are hashed on parent + name, so finding a child does not need to scan all the siblings */
+static uint32_t *dirdbHashData = 0; /* first node in each bucket */
+static uint32_t dirdbHashSize = 0;  /* power of two, and kept >= dirdbNum */
+
+/* Names are packed into large chunks instead of one malloc() each. A chunk is released when the last name in it is gone */
+#define DIRDB_NAMECHUNK_SIZE 65536
+struct dirdbNameChunk
+{
+	uint32_t live; /* number of names still in use */
+	uint32_t fill;
+	uint32_t size;
+	char data[];
+};
+static struct dirdbNameChunk **dirdbNameChunks = 0; /* unused slots are NULL */
+static uint32_t dirdbNameChunksCount = 0;
+static uint32_t dirdbNameChunkCurrent = 0; /* only valid if dirdbNameChunksCount != 0 */
+
+/* Used by dirdbSearchMdb(). Both are built by the first search, and cover the nodes that have a mdb_ref */
+static struct textindex_t dirdbTextIndex; /* trigrams of the names */
+static int dirdbTextIndexReady;
+struct dirdbMdbPair
+{
+	uint32_t mdb_ref;
+	uint32_t node;
+};
+static struct dirdbMdbPair *dirdbMdbPairs = 0; /* sorted on mdb_ref, invalidated when a mdb_ref changes */
+static uint32_t dirdbMdbPairsCount = 0;
+static int dirdbMdbPairsReady;
+
+static uint32_t dirdbNameHash (uint32_t parent, const char *name)
+{ /* FNV-1a */
+	uint32_t h = 2166136261u;
+	int i;
+
+	for (; *name; name++)
+	{
+		h = (h ^ (uint8_t)*name) * 16777619u;
+	}
+	for (i=0; i < 4; i++)
+	{
+		h = (h ^ (uint8_t)(parent >> (i * 8))) * 16777619u;
+	}
+	return h;
+}
+
+/* gives room for len characters + zero-termination in dirdbData[node].name */
+static int dirdbNameAlloc (uint32_t node, size_t len)
+{
+	struct dirdbNameChunk *chunk = dirdbNameChunksCount ? dirdbNameChunks[dirdbNameChunkCurrent] : 0;
+	uint32_t i;
+
+	if ((!chunk) || ((chunk->size - chunk->fill) < (len + 1)))
+	{
+		size_t size = (len + 1) > DIRDB_NAMECHUNK_SIZE ? (len + 1) : DIRDB_NAMECHUNK_SIZE;
+		struct dirdbNameChunk *newchunk = malloc (sizeof (*newchunk) + size);
+
+		if (!newchunk)
+		{
+			return -1;
+		}
+		newchunk->live = 0;
+		newchunk->fill = 0;
+		newchunk->size = size;
+
+		for (i=0; i < dirdbNameChunksCount; i++)
+		{
+			if (!dirdbNameChunks[i])
+			{
+				break;
+			}
+		}
+		if (i == dirdbNameChunksCount)
+		{
+			struct dirdbNameChunk **temp = realloc (dirdbNameChunks, (dirdbNameChunksCount + 16) * sizeof (dirdbNameChunks[0]));
+			if (!temp)
+			{
+				free (newchunk);
+				return -1;
+			}
+			dirdbNameChunks = temp;
+			memset (dirdbNameChunks + dirdbNameChunksCount, 0, 16 * sizeof (dirdbNameChunks[0]));
+			dirdbNameChunksCount += 16;
+		}
+		dirdbNameChunks[i] = newchunk;
+
+		/* the previous chunk was kept alive only because it was the current one */
+		if (chunk && (!chunk->live))
+		{
+			free (chunk);
+			dirdbNameChunks[dirdbNameChunkCurrent] = 0;
+		}
+		dirdbNameChunkCurrent = i;
+		chunk = newchunk;
+	}
+
+	dirdbData[node].name = chunk->data + chunk->fill;
+	dirdbData[node].namechunk = dirdbNameChunkCurrent;
+	chunk->fill += len + 1;
+	chunk->live++;
+
+	return 0;
+}
+
+static void dirdbNameFree (uint32_t node)
+{
+	struct dirdbNameChunk *chunk = dirdbNameChunks[dirdbData[node].namechunk];
+
+	dirdbData[node].name = 0;
+
+	if (--chunk->live)
+	{
+		return;
+	}
+	if (dirdbData[node].namechunk == dirdbNameChunkCurrent)
+	{
+		chunk->fill = 0;
+	} else {
+		free (chunk);
+		dirdbNameChunks[dirdbData[node].namechunk] = 0;
+	}
+}
+
+static void dirdbNameFreeAll (void)
+{
+	uint32_t i;
+
+	for (i=0; i < dirdbNameChunksCount; i++)
+	{
+		free (dirdbNameChunks[i]);
+	}
+	free (dirdbNameChunks);
+	dirdbNameChunks = 0;
+	dirdbNameChunksCount = 0;
+	dirdbNameChunkCurrent = 0;
+}
+
+static void dirdbHashInsert (uint32_t node)
+{
+	uint32_t *bucket = dirdbHashData + (dirdbData[node].namehash & (dirdbHashSize - 1));
+
+	dirdbData[node].hashnext = *bucket;
+	*bucket = node;
+}
+
+static void dirdbHashRemove (uint32_t node)
+{
+	uint32_t *iter = dirdbHashData + (dirdbData[node].namehash & (dirdbHashSize - 1));
+
+	while (*iter != node)
+	{
+		assert ((*iter) != DIRDB_NOPARENT);
+		iter = &dirdbData[*iter].hashnext;
+	}
+	*iter = dirdbData[node].hashnext;
+	dirdbData[node].hashnext = DIRDB_NOPARENT;
+}
+
+/* make sure dirdbHashSize >= dirdbNum, all nodes in use are rehashed if the table grows */
+static int dirdbHashResize (void)
+{
+	uint32_t size = dirdbHashSize ? dirdbHashSize : 64;
+	uint32_t *temp;
+	uint32_t i;
+
+	while (size < dirdbNum)
+	{
+		size <<= 1;
+	}
+	if (size == dirdbHashSize)
+	{
+		return 0;
+	}
+	temp = malloc (size * sizeof (dirdbHashData[0]));
+	if (!temp)
+	{
+		return -1;
+	}
+	free (dirdbHashData);
+	dirdbHashData = temp;
+	dirdbHashSize = size;
+	for (i=0; i < size; i++)
+	{
+		dirdbHashData[i] = DIRDB_NOPARENT;
+	}
+	for (i=0; i < dirdbNum; i++)
+	{
+		if (dirdbData[i].name)
+		{
+			dirdbHashInsert (i);
+		}
+	}
+	return 0;
+}
+
+/* insert as the first child of parent */
+static void dirdbLinkSibling (uint32_t node)
+{
+	uint32_t *head = (dirdbData[node].parent == DIRDB_NOPARENT) ? &dirdbRootChild : &dirdbData[dirdbData[node].parent].child;
+
+	dirdbData[node].prev = DIRDB_NOPARENT;
+	dirdbData[node].next = *head;
+	if (*head != DIRDB_NOPARENT)
+	{
+		dirdbData[*head].prev = node;
+	}
+	*head = node;
+}
+
+static void dirdbUnlinkSibling (uint32_t node)
+{
+	if (dirdbData[node].prev != DIRDB_NOPARENT)
+	{
+		dirdbData[dirdbData[node].prev].next = dirdbData[node].next;
+	} else if (dirdbData[node].parent == DIRDB_NOPARENT)
+	{
+		dirdbRootChild = dirdbData[node].next;
+	} else {
+		dirdbData[dirdbData[node].parent].child = dirdbData[node].next;
+	}
+	if (dirdbData[node].next != DIRDB_NOPARENT)
+	{
+		dirdbData[dirdbData[node].next].prev = dirdbData[node].prev;
+	}
+	dirdbData[node].prev = DIRDB_NOPARENT;
+	dirdbData[node].next = DIRDB_NOPARENT;
+}
+
 #ifdef DIRDB_DEBUG
 static void dumpdb_parent(uint32_t firstchild, int ident)
 {
@@ -240,12 +476,11 @@ int dirdbInit(void)
 					goto endoffile;
 			}
 
-			dirdbData[i].name=malloc(len+1);
-			if (!dirdbData[i].name)
+			if (dirdbNameAlloc (i, len))
 				goto outofmemory;
 			if (read(f, dirdbData[i].name, len)!=len)
 			{
-				free(dirdbData[i].name);
+				dirdbNameFree (i);
 				goto endoffile;
 			}
 			dirdbData[i].name[len]=0; /* terminate the string */
@@ -272,8 +507,7 @@ int dirdbInit(void)
 			{
 				fprintf(stderr, "Invalid parent in a node .. (out of range)\n");
 				dirdbData[i].parent = DIRDB_NOPARENT;
-				free (dirdbData[i].name);
-				dirdbData[i].name = 0;
+				dirdbNameFree (i);
 			} else if (!dirdbData[dirdbData[i].parent].name)
 			{
 				fprintf(stderr, "Invalid parent in a node .. (not in use)\n");
@@ -287,6 +521,12 @@ int dirdbInit(void)
 		}
 		dirdbData[i].child = DIRDB_NOPARENT;
 		dirdbData[i].next = DIRDB_NOPARENT;
+		dirdbData[i].prev = DIRDB_NOPARENT;
+		dirdbData[i].hashnext = DIRDB_NOPARENT;
+		if (dirdbData[i].name)
+		{
+			dirdbData[i].namehash = dirdbNameHash (dirdbData[i].parent, dirdbData[i].name);
+		}
 	}
 
 	for (i=0; i<dirdbNum; i++)
@@ -296,18 +536,17 @@ int dirdbInit(void)
 			dirdbData[i].next = dirdbFreeChild;
 			dirdbFreeChild = i;
 		} else {
-			uint32_t *parent;
-			if (dirdbData[i].parent == DIRDB_NOPARENT)
-			{
-				parent = &dirdbRootChild;
-			} else {
-				parent = &dirdbData[dirdbData[i].parent].child;
-			}
-			dirdbData[i].next = *parent;
-			*parent = i;
+			dirdbLinkSibling (i);
 		}
 	}
 
+	if (dirdbHashResize ())
+	{
+		fprintf(stderr, "out of memory\n");
+		retval=0;
+		goto unload;
+	}
+
 	fprintf(stderr, "Done\n");
 	return 1;
 endoffile:
@@ -320,39 +559,69 @@ outofmemory:
 	close(f);
 	retval=0;
 unload:
+	dirdbRootChild = DIRDB_NOPARENT;
+	dirdbFreeChild = DIRDB_NOPARENT;
 	for (i=0; i<dirdbNum; i++)
 	{
-		if (dirdbData[i].name)
-		{
-			free(dirdbData[i].name);
-			dirdbData[i].name=0;
-		}
+		dirdbData[i].name=0;
 		dirdbData[i].parent = DIRDB_NOPARENT;
+		dirdbData[i].child = DIRDB_NOPARENT;
+		dirdbData[i].prev = DIRDB_NOPARENT;
 		dirdbData[i].next = dirdbFreeChild;
 		dirdbFreeChild = i;
 	}
+	dirdbNameFreeAll ();
+	free (dirdbHashData);
+	dirdbHashData = 0;
+	dirdbHashSize = 0;
 	return retval;
 }
 
+static void dirdbSearchFree (void)
+{
+	textindex_free (&dirdbTextIndex);
+	dirdbTextIndexReady = 0;
+	free (dirdbMdbPairs);
+	dirdbMdbPairs = 0;
+	dirdbMdbPairsCount = 0;
+	dirdbMdbPairsReady = 0;
+}
+
+/* keeps dirdbTextIndex in sync when a node gets or loses its mdb_ref */
+static void dirdbTextIndexUpdate (uint32_t node, int add)
+{
+	dirdbMdbPairsReady = 0;
+	if (!dirdbTextIndexReady)
+	{
+		return;
+	}
+	if (textindex_update (&dirdbTextIndex, node, add ? 0 : dirdbData[node].name, add ? dirdbData[node].name : 0))
+	{ /* out of memory, rebuild on the next search */
+		textindex_free (&dirdbTextIndex);
+		dirdbTextIndexReady = 0;
+	}
+}
+
 void dirdbClose(void)
 {
-	uint32_t i;
+	dirdbSearchFree ();
 	if (!dirdbNum)
 		return;
-	for (i=0; i<dirdbNum; i++)
-	{
-		free(dirdbData[i].name);
-	}
+	dirdbNameFreeAll ();
 	free(dirdbData);
 	dirdbData = 0;
 	dirdbNum = 0;
+	free(dirdbHashData);
+	dirdbHashData = 0;
+	dirdbHashSize = 0;
 	dirdbRootChild = DIRDB_NOPARENT;
 	dirdbFreeChild = DIRDB_NOPARENT;
 }
 
 uint32_t dirdbFindAndRef(uint32_t parent, char const *name, enum dirdb_use use)
 {
-	uint32_t i, *prev;
+	uint32_t i, hash;
+	size_t len;
 	struct dirdbEntry *new;
 
 #ifdef DIRDB_DEBUG
@@ -364,7 +633,8 @@ uint32_t dirdbFindAndRef(uint32_t parent, char const *name, enum dirdb_use use)
 		fprintf (stderr, "dirdbFindAndRef: name is NULL\n");
 		return DIRDB_NOPARENT;
 	}
-	if (strlen(name) > UINT16_MAX)
+	len = strlen(name);
+	if (len > UINT16_MAX)
 	{
 		fprintf (stderr, "dirdbFindAndRef: strlen(name) > UINT16_MAX, can not store this in DB\n");
 		return DIRDB_NOPARENT;
@@ -398,11 +668,11 @@ uint32_t dirdbFindAndRef(uint32_t parent, char const *name, enum dirdb_use use)
 		return DIRDB_NOPARENT;
 	}
 
-	for (i = (parent != DIRDB_NOPARENT) ? dirdbData[parent].child : dirdbRootChild; i != DIRDB_NOPARENT; i = dirdbData[i].next)
+	hash = dirdbNameHash (parent, name);
+	for (i = dirdbHashSize ? dirdbHashData[hash & (dirdbHashSize - 1)] : DIRDB_NOPARENT; i != DIRDB_NOPARENT; i = dirdbData[i].hashnext)
 	{
 		assert (dirdbData[i].name);
-		assert (dirdbData[i].parent == parent);
-		if (!strcmp(name, dirdbData[i].name))
+		if ((dirdbData[i].namehash == hash) && (dirdbData[i].parent == parent) && !strcmp(name, dirdbData[i].name))
 		{
 			/*fprintf(stderr, " ++ %s (%d p=%d)\n", dirdbData[i].name, i, dirdbData[i].parent);*/
 			dirdbData[i].refcount++;
@@ -426,17 +696,26 @@ uint32_t dirdbFindAndRef(uint32_t parent, char const *name, enum dirdb_use use)
 	if (dirdbFreeChild == DIRDB_NOPARENT)
 	{
 		uint32_t j;
+		uint32_t grow = dirdbNum ? dirdbNum : 64; /* double the size each time, so large trees do not realloc() for every 64 nodes */
 
-		new=realloc(dirdbData, (dirdbNum+64)*sizeof(struct dirdbEntry));
+		if (grow > (DIRDB_NOPARENT - 1 - dirdbNum))
+		{
+			fprintf(stderr, "dirdbFindAndRef: database is full\n");
+			return DIRDB_NOPARENT;
+		}
+		pthread_mutex_lock (&dirdbDataMutex);
+		new=realloc(dirdbData, (dirdbNum+grow)*sizeof(struct dirdbEntry));
 		if (!new)
 		{
+			pthread_mutex_unlock (&dirdbDataMutex);
 			fprintf(stderr, "dirdbFindAndRef: realloc() failed, out of memory\n");
 			return DIRDB_NOPARENT;
 		}
 		dirdbData=new;
-		memset(dirdbData+dirdbNum, 0, 64*sizeof(struct dirdbEntry));
+		memset(dirdbData+dirdbNum, 0, grow*sizeof(struct dirdbEntry));
 		i=dirdbNum;
-		dirdbNum+=64;
+		dirdbNum+=grow;
+		pthread_mutex_unlock (&dirdbDataMutex);
 
 		for (j=i;j<dirdbNum;j++)
 		{
@@ -444,34 +723,36 @@ uint32_t dirdbFindAndRef(uint32_t parent, char const *name, enum dirdb_use use)
 			dirdbData[j].newmdb_ref = DIRDB_NO_MDBREF;
 			dirdbData[j].parent = DIRDB_NOPARENT;
 			dirdbData[j].next = dirdbFreeChild;
+			dirdbData[j].prev = DIRDB_NOPARENT;
 			dirdbData[j].child = DIRDB_NOPARENT;
+			dirdbData[j].hashnext = DIRDB_NOPARENT;
 			dirdbFreeChild = j;
 		}
-	}
 
-	if (parent == DIRDB_NOPARENT)
-	{
-		prev = &dirdbRootChild;
-	} else {
-		prev = &dirdbData[parent].child;
+		if (dirdbHashResize ())
+		{
+			fprintf(stderr, "dirdbFindAndRef: dirdbHashResize() failed, out of memory\n");
+			return DIRDB_NOPARENT;
+		}
 	}
 
 	dirdbDirty=1;
 
 	/* grab a free entry */
 	i = dirdbFreeChild;
-	dirdbData[i].name=strdup(name);
-	if (!dirdbData[i].name)
+	if (dirdbNameAlloc (i, len))
 	{
-		fprintf (stderr, "dirdbFindAndRef: strdup() failed\n");
+		fprintf (stderr, "dirdbFindAndRef: dirdbNameAlloc() failed\n");
 		return DIRDB_NOPARENT;
 	}
+	memcpy (dirdbData[i].name, name, len + 1);
 	dirdbFreeChild = dirdbData[i].next;
 
 	/* and insert it as the parent first child */
-	dirdbData[i].next = *prev; /* take the previous value */
-	*prev = i; /* before we replace it */
 	dirdbData[i].parent=parent;
+	dirdbLinkSibling (i);
+	dirdbData[i].namehash = hash;
+	dirdbHashInsert (i);
 	dirdbData[i].refcount++;
 #ifdef DIRDB_DEBUG
 	switch (use)
@@ -951,7 +1232,7 @@ char *dirdbDiffPath(uint32_t base, uint32_t node, const int flags)
 
 void dirdbUnref(uint32_t node, enum dirdb_use use)
 {
-	uint32_t parent, *prev;
+	uint32_t parent;
 #ifdef DIRDB_DEBUG
 	fprintf(stderr, "dirdbUnref(0x%08x)\n", node);
 #endif
@@ -1021,27 +1302,14 @@ void dirdbUnref(uint32_t node, enum dirdb_use use)
 	dirdbDirty=1;
 	assert (dirdbData[node].child == DIRDB_NOPARENT);
 	parent = dirdbData[node].parent;
+	dirdbHashRemove (node);
+	dirdbUnlinkSibling (node);
 	dirdbData[node].parent=DIRDB_NOPARENT;
-	free(dirdbData[node].name);
-	dirdbData[node].name=0;
+	dirdbNameFree (node);
 
 	dirdbData[node].mdb_ref=DIRDB_NO_MDBREF; /* this should not be needed */
 	dirdbData[node].newmdb_ref=DIRDB_NO_MDBREF; /* this should not be needed */
 
-	if (parent == DIRDB_NOPARENT)
-	{
-		prev = &dirdbRootChild;
-	} else {
-		prev = &dirdbData[parent].child;
-	}
-
-	while (*prev != node)
-	{
-		assert ((*prev) != DIRDB_NOPARENT);
-		prev = &dirdbData[*prev].next;
-	}
-
-	*prev = dirdbData[node].next;
 	dirdbData[node].next = dirdbFreeChild;
 	dirdbFreeChild = node;
 
@@ -1058,17 +1326,21 @@ void dirdbUnref(uint32_t node, enum dirdb_use use)
 void dirdbGetName_internalstr(uint32_t node, const char **name)
 {
 	*name = 0;
+	pthread_mutex_lock (&dirdbDataMutex); /* the name itself is stored in a chunk that does not move */
 	if (node>=dirdbNum)
 	{
+		pthread_mutex_unlock (&dirdbDataMutex);
 		fprintf(stderr, "dirdbGetName_internalstr: invalid node #1\n");
 		return;
 	}
 	if (!dirdbData[node].name)
 	{
+		pthread_mutex_unlock (&dirdbDataMutex);
 		fprintf(stderr, "dirdbGetName_internalstr: invalid node #2\n");
 		return;
 	}
 	*name = dirdbData[node].name;
+	pthread_mutex_unlock (&dirdbDataMutex);
 }
 
 extern void dirdbGetName_malloc(uint32_t node, char **name)
@@ -1378,6 +1650,7 @@ static void _dirdbTagRemoveUntaggedAndSubmit(uint32_t node)
 			{
 				dirdbData[i].mdb_ref = dirdbData[i].newmdb_ref;
 				dirdbData[i].newmdb_ref = DIRDB_NO_MDBREF;
+				dirdbTextIndexUpdate (i, 1);
 				/* no need to unref/ref, since we are
 				 * balanced. Since somebody can have
 				 * named a file, the same name
@@ -1386,12 +1659,14 @@ static void _dirdbTagRemoveUntaggedAndSubmit(uint32_t node)
 				 */
 			} else if (dirdbData[i].newmdb_ref == DIRDB_NO_MDBREF)
 			{
+				dirdbTextIndexUpdate (i, 0);
 				dirdbData[i].mdb_ref = DIRDB_NO_MDBREF;
 				dirdbUnref (i, dirdb_use_mdb_medialib);
 				/* same as above regarding renaming */
 			} else {
 				dirdbData[i].mdb_ref = dirdbData[i].newmdb_ref;
 				dirdbData[i].newmdb_ref = DIRDB_NO_MDBREF;
+				dirdbMdbPairsReady = 0;
 				dirdbUnref(i, dirdb_use_mdb_medialib);
 			}
 		}
@@ -1478,6 +1753,178 @@ int dirdbGetMdb(uint32_t *dirdbnode, uint32_t *mdb_ref, int *first)
 	return -1;
 }
 
+static int dirdbSearchCmp (const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static int dirdbMdbPairCmp (const void *a, const void *b)
+{
+	const struct dirdbMdbPair *x = a;
+	const struct dirdbMdbPair *y = b;
+	if (x->mdb_ref != y->mdb_ref)
+	{
+		return (x->mdb_ref > y->mdb_ref) - (x->mdb_ref < y->mdb_ref);
+	}
+	return (x->node > y->node) - (x->node < y->node);
+}
+
+static int dirdbSearchPrepare (void)
+{
+	uint32_t i;
+
+	if (!dirdbTextIndexReady)
+	{
+		for (i=0; i < dirdbNum; i++)
+		{
+			if (dirdbData[i].name && (dirdbData[i].mdb_ref != DIRDB_NO_MDBREF))
+			{
+				if (textindex_update (&dirdbTextIndex, i, 0, dirdbData[i].name))
+				{
+					textindex_free (&dirdbTextIndex);
+					return -1;
+				}
+			}
+		}
+		dirdbTextIndexReady = 1;
+	}
+
+	if (!dirdbMdbPairsReady)
+	{
+		free (dirdbMdbPairs);
+		dirdbMdbPairsCount = 0;
+		dirdbMdbPairs = malloc ((dirdbNum ? dirdbNum : 1) * sizeof (dirdbMdbPairs[0]));
+		if (!dirdbMdbPairs)
+		{
+			return -1;
+		}
+		for (i=0; i < dirdbNum; i++)
+		{
+			if (dirdbData[i].name && (dirdbData[i].mdb_ref != DIRDB_NO_MDBREF))
+			{
+				dirdbMdbPairs[dirdbMdbPairsCount].mdb_ref = dirdbData[i].mdb_ref;
+				dirdbMdbPairs[dirdbMdbPairsCount].node = i;
+				dirdbMdbPairsCount++;
+			}
+		}
+		qsort (dirdbMdbPairs, dirdbMdbPairsCount, sizeof (dirdbMdbPairs[0]), dirdbMdbPairCmp);
+		dirdbMdbPairsReady = 1;
+	}
+
+	return 0;
+}
+
+/* Unit test available */
+int dirdbSearchMdb (const char *query, const uint32_t *mdb_refs, uint32_t mdb_count, uint32_t **nodes, uint32_t *count)
+{
+	uint32_t *candidates = 0, candidatescount = 0;
+	uint32_t i, fill = 0, size;
+	char *upper;
+
+	*nodes = 0;
+	*count = 0;
+
+	if (dirdbSearchPrepare ())
+	{
+		return -1;
+	}
+
+	upper = strdup (query);
+	if (!upper)
+	{
+		return -1;
+	}
+	strupr (upper);
+	if (textindex_query (&dirdbTextIndex, upper, &candidates, &candidatescount))
+	{
+		free (upper);
+		return -1;
+	}
+
+	/* worst case, all name candidates plus all nodes that use the given mdb_refs */
+	size = candidatescount;
+	for (i=0; i < mdb_count; i++)
+	{
+		struct dirdbMdbPair key = {mdb_refs[i], 0};
+		struct dirdbMdbPair *iter = bsearch (&key, dirdbMdbPairs, dirdbMdbPairsCount, sizeof (dirdbMdbPairs[0]), dirdbSearchCmp);
+		if (!iter)
+		{
+			continue;
+		}
+		while ((iter > dirdbMdbPairs) && (iter[-1].mdb_ref == mdb_refs[i]))
+		{
+			iter--;
+		}
+		for (; (iter < (dirdbMdbPairs + dirdbMdbPairsCount)) && (iter->mdb_ref == mdb_refs[i]); iter++)
+		{
+			size++;
+		}
+	}
+	*nodes = malloc ((size ? size : 1) * sizeof (uint32_t));
+	if (!*nodes)
+	{
+		free (candidates);
+		free (upper);
+		return -1;
+	}
+
+	/* the index gives the names that contain all the trigrams, verify that they contain the entire string */
+	for (i=0; i < candidatescount; i++)
+	{
+		uint32_t node = candidates[i];
+		char *name;
+
+		if ((node >= dirdbNum) || (!dirdbData[node].name) || (dirdbData[node].mdb_ref == DIRDB_NO_MDBREF))
+		{
+			continue;
+		}
+		name = strdup (dirdbData[node].name);
+		if (!name)
+		{
+			continue;
+		}
+		if (strstr (strupr (name), upper))
+		{
+			(*nodes)[fill++] = node;
+		}
+		free (name);
+	}
+	free (candidates);
+	free (upper);
+
+	for (i=0; i < mdb_count; i++)
+	{
+		struct dirdbMdbPair key = {mdb_refs[i], 0};
+		struct dirdbMdbPair *iter = bsearch (&key, dirdbMdbPairs, dirdbMdbPairsCount, sizeof (dirdbMdbPairs[0]), dirdbSearchCmp);
+		if (!iter)
+		{
+			continue;
+		}
+		while ((iter > dirdbMdbPairs) && (iter[-1].mdb_ref == mdb_refs[i]))
+		{
+			iter--;
+		}
+		for (; (iter < (dirdbMdbPairs + dirdbMdbPairsCount)) && (iter->mdb_ref == mdb_refs[i]); iter++)
+		{
+			(*nodes)[fill++] = iter->node;
+		}
+	}
+
+	/* sorted and unique */
+	qsort (*nodes, fill, sizeof (uint32_t), dirdbSearchCmp);
+	for (i=0, size=0; i < fill; i++)
+	{
+		if ((!size) || ((*nodes)[size - 1] != (*nodes)[i]))
+		{
+			(*nodes)[size++] = (*nodes)[i];
+		}
+	}
+	*count = size;
+	return 0;
+}
+
 static size_t strlen_width (const char *source)
 {
 	return measurestr_utf8 (source, strlen (source));
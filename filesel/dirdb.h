@@ -89,6 +89,11 @@ extern void dirdbTagRemoveUntaggedAndSubmit(void);
 /* iterate the internal database of all known songs - medialib: */
 extern int dirdbGetMdb(uint32_t *dirdbnode, uint32_t *mdbnode, int *first);
 
+/* nodes in the medialib where the name contains query (ignoring case), or where the mdb_ref is one of mdb_refs. *nodes
+ * is sorted and must be free()ed. Returns non-zero if query is too short to be searched for using the index.
+ */
+extern int dirdbSearchMdb(const char *query, const uint32_t *mdb_refs, uint32_t mdb_count, uint32_t **nodes, uint32_t *count);
+
 void utf8_XdotY_name (const int X, const int Y, char *shortname, const char *source);
 
 struct dirdbAPI_t
@@ -3,7 +3,13 @@
 #define INPUTBUFFERSIZE 128
 #define OUTPUTBUFFERSIZE 64
 
+#include <stddef.h>
+#include <stdint.h>
+int64_t bzip2_test_block_scan (const uint8_t *src, size_t len, uint64_t bit, int *eos);
+#define bzip2_block_scan bzip2_test_block_scan
 #include "filesystem-bzip2.c"
+#undef bzip2_block_scan
+#include "bzip2-index.c"
 #include "filesystem-dir-mem.h"
 #include "filesystem-file-mem.h"
 #include <unistd.h>
@@ -16,6 +22,22 @@
 #define ANSI_COLOR_CYAN    "\x1b[36m"
 #define ANSI_COLOR_RESET   "\x1b[0m"
 
+/* the next bzip2_test_false_magics magics found are reported halfway to where they really are, as if the magic appeared by chance inside the block */
+static int bzip2_test_false_magics;
+static int bzip2_test_false_eos;
+
+int64_t bzip2_test_block_scan (const uint8_t *src, size_t len, uint64_t bit, int *eos)
+{
+	int64_t next = bzip2_block_scan (src, len, bit, eos);
+	if ((next >= 0) && bzip2_test_false_magics && ((uint64_t)next > bit + 96))
+	{
+		bzip2_test_false_magics--;
+		*eos = bzip2_test_false_eos;
+		return bit + (next - bit) / 2;
+	}
+	return next;
+}
+
 void preemptive_framelock (void)
 {
 }
@@ -43,6 +65,10 @@ void dirdbGetName_internalstr (uint32_t ref, const char **retval)
 	if (ref == 9) *retval = "test5.txt.bz2.bz2";
 	if (ref == 10) *retval = "test5.txt.bz2";
 	if (ref == 11) *retval = "test5.txt";
+	if (ref == 12) *retval = "test6.txt.bz2";
+	if (ref == 13) *retval = "test6.txt";
+	if (ref == 14) *retval = "test7.txt.bz2";
+	if (ref == 15) *retval = "test7.txt";
 
 }
 
@@ -418,6 +444,200 @@ int bzip2_test5 (void)
 	return retval;
 }
 
+int bzip2_test6 (void)
+{
+	const unsigned int srcsize = 450000; /* five blocks with -1 */
+	char *orig = malloc (srcsize);
+	char *dsrc = malloc (srcsize + 4096);
+	unsigned int dsrcsize = srcsize + 4096;
+	char *dst = malloc (srcsize);
+	const uint32_t seeks[] = {0, 399999, 100000, 99999, 250000, 449990, 1234};
+	int retval = 0;
+	struct ocpdir_t *test_dir;
+	struct ocpfile_t *osrc;
+	struct ocpdir_t *oddst;
+	struct ocpfile_t *odst;
+	struct ocpfilehandle_t *hdst;
+	struct bzip2_ocpfile_t *owner;
+	uint32_t seed = 1;
+	unsigned int i;
+
+	printf ("Testing multiple blocks, decoded in parallel:  ");
+	bzip2_threads_count = 4; /* also when the test machine has fewer cores */
+
+	for (i=0; i < srcsize; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		orig[i] = "abcdefgh \n"[(seed >> 16) % 10];
+	}
+	if (BZ2_bzBuffToBuffCompress (dsrc, &dsrcsize, orig, srcsize, 1, 0, 0) != BZ_OK)
+	{
+		printf (ANSI_COLOR_RED " BZ2_bzBuffToBuffCompress() failed" ANSI_COLOR_RESET "\n");
+		free (orig);
+		free (dsrc);
+		free (dst);
+		return 1;
+	}
+
+	test_dir = ocpdir_mem_getdir_t(ocpdir_mem_alloc (0, "test:"));
+	osrc = mem_file_open (test_dir, /* dirdb_ref */ 12, dsrc, dsrcsize);
+	test_dir->unref (test_dir); test_dir = 0;
+
+	oddst = bzip2_check_steal (osrc, 13);
+	odst = oddst->readdir_file(oddst, 13);
+	owner = (struct bzip2_ocpfile_t *)odst;
+	hdst = odst->open (odst);
+	oddst->unref (oddst); oddst = 0;
+	osrc->unref (osrc); osrc = 0;
+
+	/* linear read, in odd sized pieces */
+	for (i=0; i < srcsize; )
+	{
+		int l = hdst->read (hdst, dst + i, 33333);
+		if (l <= 0)
+		{
+			break;
+		}
+		i += l;
+	}
+	if ((i != srcsize) || memcmp (dst, orig, srcsize))
+	{
+		printf ("r");
+		retval |= 1;
+	}
+	if (hdst->read (hdst, dst, 1) != 0)
+	{
+		printf ("e");
+		retval |= 2;
+	}
+	if ((owner->index.fill != 5) || owner->filesize_pending || (owner->uncompressed_filesize != srcsize))
+	{
+		printf ("i");
+		retval |= 4;
+	}
+
+	/* random access, using the block index */
+	for (i=0; i < sizeof (seeks) / sizeof (seeks[0]); i++)
+	{
+		if (hdst->seek_set (hdst, seeks[i]) ||
+		    (hdst->read (hdst, dst, 10) != 10) ||
+		    memcmp (dst, orig + seeks[i], 10))
+		{
+			printf ("s");
+			retval |= 8;
+		}
+	}
+	hdst->unref (hdst); hdst = 0;
+
+	/* the size, without reading the data */
+	owner->filesize_pending = 1;
+	if (odst->filesize (odst) != srcsize)
+	{
+		printf ("f");
+		retval |= 16;
+	}
+	odst->unref (odst); odst = 0;
+
+	if (retval)
+	{
+		printf (ANSI_COLOR_RED " Failed" ANSI_COLOR_RESET "\n");
+	} else {
+		printf (ANSI_COLOR_GREEN " OK" ANSI_COLOR_RESET "\n");
+	}
+
+	free (orig);
+	free (dst);
+
+	return retval;
+}
+
+int bzip2_test7 (void)
+{
+	const unsigned int srcsize = 450000; /* five blocks with -1 */
+	char *orig = malloc (srcsize);
+	char *dsrc = malloc (srcsize + 4096);
+	unsigned int dsrcsize = srcsize + 4096;
+	char *dst = malloc (srcsize);
+	int retval = 0;
+	uint32_t seed = 1;
+	unsigned int i;
+	int j;
+
+	printf ("Testing a magic appearing by chance at the end of a batch:  ");
+	bzip2_threads_count = 1; /* every block ends a batch */
+
+	for (i=0; i < srcsize; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		orig[i] = "abcdefgh \n"[(seed >> 16) % 10];
+	}
+	if (BZ2_bzBuffToBuffCompress (dsrc, &dsrcsize, orig, srcsize, 1, 0, 0) != BZ_OK)
+	{
+		printf (ANSI_COLOR_RED " BZ2_bzBuffToBuffCompress() failed" ANSI_COLOR_RESET "\n");
+		free (orig);
+		free (dsrc);
+		free (dst);
+		return 1;
+	}
+
+	for (j=0; j < 2; j++)
+	{ /* a false block magic, and a false end-of-stream magic */
+		struct ocpdir_t *test_dir;
+		struct ocpfile_t *osrc;
+		struct ocpdir_t *oddst;
+		struct ocpfile_t *odst;
+		struct ocpfilehandle_t *hdst;
+		char *copy = malloc (dsrcsize);
+
+		memcpy (copy, dsrc, dsrcsize);
+		test_dir = ocpdir_mem_getdir_t(ocpdir_mem_alloc (0, "test:"));
+		osrc = mem_file_open (test_dir, /* dirdb_ref */ 14, copy, dsrcsize);
+		test_dir->unref (test_dir); test_dir = 0;
+
+		oddst = bzip2_check_steal (osrc, 15);
+		odst = oddst->readdir_file(oddst, 15);
+		hdst = odst->open (odst);
+		oddst->unref (oddst); oddst = 0;
+		osrc->unref (osrc); osrc = 0;
+
+		bzip2_test_false_magics = 1;
+		bzip2_test_false_eos = j;
+		for (i=0; i < srcsize; )
+		{
+			int l = hdst->read (hdst, dst + i, 33333);
+			if (l <= 0)
+			{
+				break;
+			}
+			i += l;
+		}
+		if (bzip2_test_false_magics || (i != srcsize) || memcmp (dst, orig, srcsize))
+		{
+			printf ("%c", j ? 'E' : 'M');
+			retval |= 1 << j;
+		} else {
+			printf ("%d", j + 1);
+		}
+		bzip2_test_false_magics = 0;
+
+		hdst->unref (hdst); hdst = 0;
+		odst->unref (odst); odst = 0;
+	}
+
+	if (retval)
+	{
+		printf (ANSI_COLOR_RED " Failed" ANSI_COLOR_RESET "\n");
+	} else {
+		printf (ANSI_COLOR_GREEN " OK" ANSI_COLOR_RESET "\n");
+	}
+
+	free (orig);
+	free (dsrc);
+	free (dst);
+
+	return retval;
+}
+
 int main(int argc, char *argv[])
 {
 	int retval = 0;
@@ -426,6 +646,8 @@ int main(int argc, char *argv[])
 	retval |= bzip2_test1 ();
 	retval |= bzip2_test3 ();
 	retval |= bzip2_test5 ();
+	retval |= bzip2_test6 ();
+	retval |= bzip2_test7 ();
 	printf ("\n");
 
 	return retval;
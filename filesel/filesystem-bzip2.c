@@ -23,8 +23,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <bzlib.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "types.h"
 #include "adbmeta.h"
+#include "bzip2-index.h"
 #include "dirdb.h"
 #include "filesystem.h"
 #include "filesystem-bzip2.h"
@@ -34,8 +37,8 @@
 # define INPUTBUFFERSIZE  65536
 #endif
 
-#ifndef OUTPUTBUFFERSIZE
-# define OUTPUTBUFFERSIZE 65536
+#ifndef BZIP2_MAX_THREADS
+# define BZIP2_MAX_THREADS 8 /* blocks decoded at the same time */
 #endif
 
 #if defined(BZIP2_DEBUG) || defined(BZIP2_VERBOSE)
@@ -54,26 +57,43 @@ static int do_bzip2_debug_print=1;
 #define VERBOSE_PRINT(...) {}
 #endif
 
+struct bzip2_block_t
+{
+	uint64_t  inbit;  /* compressed offset of the block magic, in bits */
+	uint64_t  endbit; /* compressed offset of the next magic, in bits */
+	uint64_t  out;
+	uint8_t  *data;
+	size_t    datalen;
+
+	/* used while decoding */
+	const uint8_t *src;
+	size_t         srclen;
+	uint64_t       srcbit; /* compressed offset of src[0], in bits */
+	int            level;
+	int            result;
+};
+
 struct bzip2_ocpfilehandle_t
 {
 	struct ocpfilehandle_t head;
 
 	struct ocpfilehandle_t *compressedfilehandle;
 
-	bz_stream strm;
-	int eofhit;
-	uint8_t inputbuffer[INPUTBUFFERSIZE];
-	uint8_t outputbuffer[OUTPUTBUFFERSIZE];
+	int      level; /* from the stream header, 0 if not read yet */
+	uint64_t nextbit; /* the next block to decode */
+	uint64_t nextout;
+	int      eofhit;
+
+	struct bzip2_block_t blocks[BZIP2_MAX_THREADS]; /* the last decoded batch, covering blocks[0].out up to nextout */
+	int                  blocks_fill;
 
-	uint8_t *outputbuffer_pos;
-	int      outputbuffer_fill;
+	uint8_t *inputbuffer;
+	size_t   inputbuffer_size;
 
 	struct bzip2_ocpfile_t *owner;
 
-	uint64_t realpos;
 	uint64_t pos;
 
-	int need_deinit;
 	int error;
 };
 
@@ -84,6 +104,9 @@ struct bzip2_ocpfile_t /* head->parent always point to a bzip2_ocpdir_t */
 
 	int                   filesize_pending;
 	uint64_t uncompressed_filesize;
+
+	int                   index_loaded;
+	struct bzip2_index_t  index; /* start of the blocks, shared by all handles */
 };
 
 struct bzip2_ocpdir_t
@@ -92,48 +115,316 @@ struct bzip2_ocpdir_t
 	struct bzip2_ocpfile_t child;
 };
 
-static int bzip2_ocpfilehandle_compressInit (struct bzip2_ocpfilehandle_t *s)
+static int bzip2_threads_count; /* 0 until the first use */
+
+static int bzip2_threads (void)
+{
+	if (!bzip2_threads_count)
+	{
+		long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+		bzip2_threads_count = (cpus > 0) ? cpus : 1;
+		if (bzip2_threads_count > BZIP2_MAX_THREADS)
+		{
+			bzip2_threads_count = BZIP2_MAX_THREADS;
+		}
+	}
+	return bzip2_threads_count;
+}
+
+static void bzip2_ocpfile_index_load (struct bzip2_ocpfile_t *s)
 {
-	int retval;
+	unsigned char *metadata = 0;
+	size_t metadatasize = 0;
+	const char *filename = 0;
+
+	if (s->index_loaded)
+	{
+		return;
+	}
+	s->index_loaded = 1;
 
-	if (s->need_deinit)
+	if (s->index.fill)
 	{
-		BZ2_bzDecompressEnd (&s->strm);
-		s->need_deinit = 0;
+		return;
 	}
 
-	s->error = 0;
-	s->realpos = 0;
+	dirdbGetName_internalstr (s->compressedfile->dirdb_ref, &filename);
+	if (!adbMetaGet (filename, s->compressedfile->filesize (s->compressedfile), "BZIP2IDX", &metadata, &metadatasize))
+	{
+		if (bzip2_index_deserialize (&s->index, metadata, metadatasize))
+		{
+			DEBUG_PRINT ("[BZIP2 index_load] invalid BZIP2IDX for %s\n", filename);
+		}
+		free (metadata);
+		metadata = 0;
+	}
+}
 
-	s->outputbuffer_pos = 0;
-	s->outputbuffer_fill = 0;
+static void bzip2_ocpfile_index_store (struct bzip2_ocpfile_t *s)
+{
+	unsigned char *metadata;
+	size_t metadatasize = 0;
+	const char *filename = 0;
 
-	s->eofhit = 0;
+	if ((!s->index.dirty) || (!s->index.fill))
+	{
+		return;
+	}
+	s->index.dirty = 0;
 
-	if (s->compressedfilehandle->seek_set (s->compressedfilehandle, 0) < 0)
+	metadata = bzip2_index_serialize (&s->index, &metadatasize);
+	if (!metadata)
 	{
-		s->error = 1;
-		return -1;
+		return;
+	}
+	dirdbGetName_internalstr (s->compressedfile->dirdb_ref, &filename);
+	DEBUG_PRINT ("[BZIP2 index_store] adbMetaAdd(%s, BZIP2IDX, %d points, %lu bytes)\n", filename, s->index.fill, (unsigned long)metadatasize);
+	adbMetaAdd (filename, s->compressedfile->filesize (s->compressedfile), "BZIP2IDX", metadata, metadatasize);
+	free (metadata);
+}
+
+/* the end of the stream was reached, so the size is known */
+static void bzip2_ocpfile_filesize_found (struct bzip2_ocpfile_t *s, uint64_t filesize)
+{
+	uint8_t buffer[8];
+	const char *filename = 0;
+	uint64_t compressedfile_size;
+
+	bzip2_ocpfile_index_store (s);
+
+	if ((!s->filesize_pending) && (s->uncompressed_filesize == filesize))
+	{
+		return;
+	}
+
+	s->filesize_pending = 0;
+	s->uncompressed_filesize = filesize;
+
+	buffer[7] = filesize >> 56;
+	buffer[6] = filesize >> 48;
+	buffer[5] = filesize >> 40;
+	buffer[4] = filesize >> 32;
+	buffer[3] = filesize >> 24;
+	buffer[2] = filesize >> 16;
+	buffer[1] = filesize >> 8;
+	buffer[0] = filesize;
+
+	dirdbGetName_internalstr (s->compressedfile->dirdb_ref, &filename);
+	compressedfile_size = s->compressedfile->filesize (s->compressedfile);
+
+	DEBUG_PRINT ("[BZIP2 filesize_found] adbMetaAdd(%s, %"PRIu64", BZIP2, [%02x %02x %02x %02x %02x %02x %02x %02x] => %"PRIu64")\n", filename, compressedfile_size, buffer[0], buffer[1], buffer[2], buffer[3], buffer[4], buffer[5], buffer[6], buffer[7], filesize);
+	adbMetaAdd (filename, compressedfile_size, "BZIP2", buffer, 8);
+}
+
+static void bzip2_ocpfilehandle_blocks_free (struct bzip2_ocpfilehandle_t *s)
+{
+	int i;
+
+	for (i=0; i < s->blocks_fill; i++)
+	{
+		free (s->blocks[i].data);
+		s->blocks[i].data = 0;
+	}
+	s->blocks_fill = 0;
+}
+
+static void *bzip2_block_thread (void *_block)
+{
+	struct bzip2_block_t *block = _block;
+
+	block->result = bzip2_block_decode (block->src, block->srclen, block->inbit - block->srcbit, block->endbit - block->srcbit, block->level, &block->data, &block->datalen);
+
+	return 0;
+}
+
+/* make sure that inputbuffer holds at least need bytes from the compressed file, starting at byte base. Returns the number of bytes available */
+static size_t bzip2_ocpfilehandle_fill_input (struct bzip2_ocpfilehandle_t *s, uint64_t base, size_t have, size_t need)
+{
+	while (have < need)
+	{
+		int retval;
+
+		if (have + INPUTBUFFERSIZE > s->inputbuffer_size)
+		{
+			size_t size = s->inputbuffer_size ? s->inputbuffer_size * 2 : INPUTBUFFERSIZE * 16;
+			uint8_t *temp;
+			while (size < have + INPUTBUFFERSIZE)
+			{
+				size *= 2;
+			}
+			temp = realloc (s->inputbuffer, size);
+			if (!temp)
+			{
+				break;
+			}
+			s->inputbuffer = temp;
+			s->inputbuffer_size = size;
+		}
+		if ((!have) && (s->compressedfilehandle->seek_set (s->compressedfilehandle, base) < 0))
+		{
+			break;
+		}
+		retval = s->compressedfilehandle->read (s->compressedfilehandle, s->inputbuffer + have, INPUTBUFFERSIZE);
+		if (retval <= 0)
+		{
+			break;
+		}
+		have += retval;
+	}
+	return have;
+}
+
+/* Finds the next magic starting at or after bit scanfrom of inputbuffer, reading more of the compressed file as needed. Returns its bit offset in inputbuffer, or -1 if the stream is truncated */
+static int64_t bzip2_ocpfilehandle_scan (struct bzip2_ocpfilehandle_t *s, uint64_t base, size_t *have, uint64_t scanfrom, int *eos)
+{
+	while (1)
+	{
+		int64_t next = bzip2_block_scan (s->inputbuffer, *have, scanfrom, eos);
+		size_t newhave;
+
+		if (next >= 0)
+		{
+			return next;
+		}
+		if (*have * 8 > scanfrom + 47)
+		{ /* a magic starting before this would have fitted inside the data already scanned */
+			scanfrom = *have * 8 - 47;
+		}
+		newhave = bzip2_ocpfilehandle_fill_input (s, base, *have, *have + INPUTBUFFERSIZE);
+		if (newhave == *have)
+		{
+			return -1;
+		}
+		*have = newhave;
 	}
+}
 
-	memset (&s->strm, 0, sizeof (s->strm));
+/* Decodes the next batch of blocks, starting at nextbit, one block per thread */
+static int bzip2_ocpfilehandle_decode_batch (struct bzip2_ocpfilehandle_t *s)
+{
+	pthread_t threads[BZIP2_MAX_THREADS];
+	int       threaded[BZIP2_MAX_THREADS];
+	uint64_t  base; /* byte offset of inputbuffer in the compressed file */
+	size_t    have = 0;
+	int64_t   next;
+	int       eos = 0;
+	int       count = bzip2_threads ();
+	int       n = 0;
+	int       i;
+
+	bzip2_ocpfilehandle_blocks_free (s);
+
+	if (!s->level)
+	{
+		have = bzip2_ocpfilehandle_fill_input (s, 0, 0, 4);
+		if ((have < 4) || memcmp (s->inputbuffer, "BZh", 3) || (s->inputbuffer[3] < '1') || (s->inputbuffer[3] > '9'))
+		{
+			return -1;
+		}
+		s->level = s->inputbuffer[3] - '0';
+		have = 0;
+	}
+	if (!s->nextbit)
+	{ /* the first block follows the stream header */
+		s->nextbit = 32;
+		s->nextout = 0;
+	}
 
-	s->strm.next_in = (char *)s->inputbuffer;
-	retval = s->compressedfilehandle->read (s->compressedfilehandle, s->inputbuffer, INPUTBUFFERSIZE);
-	if (retval <= 0)
+	base = s->nextbit >> 3;
+	have = bzip2_ocpfilehandle_fill_input (s, base, have, 7);
+	if (have < 7)
 	{
-		s->error = 1;
 		return -1;
 	}
-	s->strm.avail_in = retval;
+	{
+		int magic_eos;
+		if (bzip2_block_scan (s->inputbuffer, 7, s->nextbit & 7, &magic_eos) != (s->nextbit & 7))
+		{
+			return -1;
+		}
+		if (magic_eos)
+		{ /* empty stream, or the end was reached by the last batch */
+			s->eofhit = 1;
+			bzip2_ocpfile_filesize_found (s->owner, s->nextout);
+			return 0;
+		}
+	}
 
-	if (BZ2_bzDecompressInit (&s->strm, 0 /* no verbosity */, 0 /* do not use the small decompression routine */) != BZ_OK)
+	/* find where the blocks end */
+	next = s->nextbit & 7;
+	while ((n < count) && (!eos))
+	{
+		next = bzip2_ocpfilehandle_scan (s, base, &have, next + 48, &eos);
+		if (next < 0)
+		{ /* truncated stream, decode the blocks found so far */
+			break;
+		}
+		s->blocks[n].inbit = (n ? s->blocks[n-1].endbit : s->nextbit);
+		s->blocks[n].endbit = base * 8 + next;
+		n++;
+	}
+	if (!n)
 	{
-		s->error = 1;
 		return -1;
 	}
 
-	s->need_deinit = 1;
+	for (i=0; i < n; i++)
+	{
+		s->blocks[i].src = s->inputbuffer;
+		s->blocks[i].srclen = have;
+		s->blocks[i].srcbit = base * 8;
+		s->blocks[i].level = s->level;
+		s->blocks[i].data = 0;
+		s->blocks[i].datalen = 0;
+		threaded[i] = i && !pthread_create (&threads[i], 0, bzip2_block_thread, &s->blocks[i]);
+	}
+	bzip2_block_thread (&s->blocks[0]);
+	for (i=1; i < n; i++)
+	{
+		if (threaded[i])
+		{
+			pthread_join (threads[i], 0);
+		} else {
+			bzip2_block_thread (&s->blocks[i]);
+		}
+	}
+	s->blocks_fill = n;
+
+	/* reassemble in order */
+	for (i=0; i < s->blocks_fill; i++)
+	{
+		while (s->blocks[i].result && (i + 1 < s->blocks_fill))
+		{ /* the magic can appear by chance inside a block, retry with the next block included */
+			free (s->blocks[i + 1].data);
+			s->blocks[i].endbit = s->blocks[i + 1].endbit;
+			memmove (s->blocks + i + 1, s->blocks + i + 2, sizeof (s->blocks[0]) * (s->blocks_fill - i - 2));
+			s->blocks_fill--;
+			bzip2_block_thread (&s->blocks[i]);
+		}
+		while (s->blocks[i].result && ((next = bzip2_ocpfilehandle_scan (s, base, &have, s->blocks[i].endbit - base * 8 + 48, &eos)) >= 0))
+		{ /* the same for the last block of the batch, the magic that ended it (even an end-of-stream one) can be a chance match, so look further */
+			s->blocks[i].endbit = base * 8 + next;
+			s->blocks[i].src = s->inputbuffer; /* fill_input() might have moved it */
+			s->blocks[i].srclen = have;
+			bzip2_block_thread (&s->blocks[i]);
+		}
+		if (s->blocks[i].result)
+		{
+			s->blocks_fill = i;
+			bzip2_ocpfilehandle_blocks_free (s);
+			return -1;
+		}
+		s->blocks[i].out = s->nextout;
+		bzip2_index_add (&s->owner->index, s->blocks[i].inbit, s->blocks[i].out);
+		s->nextout += s->blocks[i].datalen;
+		s->nextbit = s->blocks[i].endbit;
+	}
+
+	if (eos)
+	{
+		s->eofhit = 1;
+		bzip2_ocpfile_filesize_found (s->owner, s->nextout);
+	}
 
 	return 0;
 }
@@ -155,14 +446,16 @@ static void bzip2_ocpfilehandle_unref (struct ocpfilehandle_t *_s)
 		return;
 	}
 
-	if (s->need_deinit)
-	{
-		BZ2_bzDecompressEnd (&s->strm);
-		s->need_deinit = 0;
-	}
+	bzip2_ocpfilehandle_blocks_free (s);
+	free (s->inputbuffer);
 
 	dirdbUnref (s->head.dirdb_ref, dirdb_use_filehandle);
 
+	if (s->owner)
+	{ /* readers rarely decode past the last byte, so the end is not always seen. Points are valid even if they do not cover the whole stream */
+		bzip2_ocpfile_index_store (s->owner);
+	}
+
 	if (s->compressedfilehandle)
 	{
 		s->compressedfilehandle->unref (s->compressedfilehandle);
@@ -294,190 +587,63 @@ static int bzip2_ocpfilehandle_read (struct ocpfilehandle_t *_s, void *dst, int
 {
 	struct bzip2_ocpfilehandle_t *s = (struct bzip2_ocpfilehandle_t *)_s;
 	int retval = 0;
-	int recall = 0;
 
-	/* do we need to reverse? */
-	if ((s->pos < s->realpos) || (!s->need_deinit))
-	{
-		if (bzip2_ocpfilehandle_compressInit (s))
-		{
-			s->error = 1;
-			return -1;
-		}
-	}
+	bzip2_ocpfile_index_load (s->owner);
 
-	/* we need for fast-forward */
-	while (s->pos > s->realpos)
+	while (len)
 	{
-		uint64_t targetskip = s->pos - s->realpos;
-		int ret, inputsize;
+		uint64_t first = s->blocks_fill ? s->blocks[0].out : s->nextout;
+		const struct bzip2_index_point_t *point;
 
-		if (s->outputbuffer_fill)
-		{
-			int skip = s->outputbuffer_fill;
-			if (targetskip < (uint64_t)skip)
-			{
-				skip = targetskip;
-			}
-			s->outputbuffer_fill -= skip;
-			s->outputbuffer_pos += skip;
-			s->realpos += skip;
-			continue;
-		}
-		if (s->eofhit)
+		if ((s->pos >= first) && (s->pos < s->nextout))
 		{
-			s->error = 1;
-			return -1;
-		}
+			int i = s->blocks_fill - 1;
+			uint64_t copy;
 
-		if (!s->strm.avail_in)
-		{
-			s->strm.next_in = (char *)s->inputbuffer;
-			s->strm.avail_in = s->compressedfilehandle->read (s->compressedfilehandle, s->inputbuffer, INPUTBUFFERSIZE);
-			if (s->compressedfilehandle->error (s->compressedfilehandle))
+			while (s->blocks[i].out > s->pos)
 			{
-				s->error = 1;
-				return -1;
+				i--;
 			}
-		}
-
-		s->strm.next_out = (char *)s->outputbuffer;
-		s->strm.avail_out = OUTPUTBUFFERSIZE;
-		s->outputbuffer_pos = s->outputbuffer;
-
-		inputsize = s->strm.avail_in;
-		ret = BZ2_bzDecompress (&s->strm);
-
-		switch (ret)
-		{
-			default:
-			case BZ_PARAM_ERROR:
-			case BZ_DATA_ERROR:
-			case BZ_DATA_ERROR_MAGIC:
-			case BZ_MEM_ERROR:
-				/* should not happen */
-				s->error = 1;
-				return -1;
-			case BZ_STREAM_END:
-				s->eofhit = 1;
-			case BZ_OK:
-				break;
-		}
-		s->outputbuffer_fill = OUTPUTBUFFERSIZE - s->strm.avail_out;
-		if ((s->outputbuffer_fill == 0) && ((ret == BZ_STREAM_END) || (inputsize == 0)))
-		{
-			/* should not happen when we are fast-forwarding... */
-			s->error = 1;
-			return -1;
-		}
-
-		if (!recall) /* yield ? */
-		{
-			preemptive_framelock();
-			recall = 20;
-		}
-		recall--;
-	}
-
-	while (len)
-	{
-		int ret, inputsize;
-
-		if (s->outputbuffer_fill)
-		{
-			int copy = len;
-			if (copy > s->outputbuffer_fill)
+			copy = s->blocks[i].out + s->blocks[i].datalen - s->pos;
+			if (copy > (uint64_t)len)
 			{
-				copy = s->outputbuffer_fill;
+				copy = len;
 			}
-			memcpy (dst, s->outputbuffer_pos, copy);
-			s->outputbuffer_pos += copy;
-			s->outputbuffer_fill -= copy;
+			memcpy (dst, s->blocks[i].data + (s->pos - s->blocks[i].out), copy);
 			retval += copy;
 			len -= copy;
 			dst += copy;
 			s->pos += copy;
-			s->realpos += copy;
 			continue;
 		}
 
-		if (s->eofhit)
-		{
-			break;
-		}
-
-		if (!s->strm.avail_in)
-		{
-			s->strm.next_in = (char *)s->inputbuffer;
-			s->strm.avail_in = s->compressedfilehandle->read (s->compressedfilehandle, s->inputbuffer, INPUTBUFFERSIZE);
-			if (s->compressedfilehandle->error (s->compressedfilehandle))
+		point = bzip2_index_lookup (&s->owner->index, s->pos);
+		if (s->pos < first)
+		{ /* we need to reverse, to the closest known block */
+			bzip2_ocpfilehandle_blocks_free (s);
+			s->nextbit = point ? point->inbit : 0;
+			s->nextout = point ? point->out : 0;
+			s->eofhit = 0;
+		} else {
+			if (s->eofhit)
 			{
-				s->error = 1;
-				return -1;
+				break;
+			}
+			if (point && (point->out > s->nextout))
+			{ /* skip the blocks we already know the size of */
+				bzip2_ocpfilehandle_blocks_free (s);
+				s->nextbit = point->inbit;
+				s->nextout = point->out;
 			}
 		}
 
-		s->strm.next_out = (char *)s->outputbuffer;
-		s->strm.avail_out = OUTPUTBUFFERSIZE;
-		s->outputbuffer_pos = s->outputbuffer;
-
-		inputsize = s->strm.avail_in;
-		ret = BZ2_bzDecompress (&s->strm);
-
-		switch (ret)
+		if (bzip2_ocpfilehandle_decode_batch (s))
 		{
-			default:
-			case BZ_PARAM_ERROR:
-			case BZ_DATA_ERROR:
-			case BZ_DATA_ERROR_MAGIC:
-			case BZ_MEM_ERROR:
-				/* should not happen */
-				s->error = 1;
-				return -1;
-			case BZ_STREAM_END:
-				s->eofhit = 1;
-			case BZ_OK:
-				break;
+			s->error = 1;
+			return -1;
 		}
-		s->outputbuffer_fill = OUTPUTBUFFERSIZE - s->strm.avail_out;
-#if 0
-		if (ret == BZ_STREAM_END)
-#else
-		if ((s->outputbuffer_fill == 0) && ((ret == BZ_STREAM_END) || (inputsize == 0)))
-#endif
-		{
-			uint64_t filesize = s->realpos + s->outputbuffer_fill;
-
-			if ((s->owner->filesize_pending) || (s->owner->uncompressed_filesize != filesize))
-			{
-				uint8_t buffer[8];
-				const char *filename = 0;
-				uint64_t compressedfile_size = s->compressedfilehandle->filesize (s->compressedfilehandle);
-
-
-				s->owner->filesize_pending = 0;
-				s->owner->uncompressed_filesize = filesize;
-
-				buffer[7] = filesize >> 56;
-				buffer[6] = filesize >> 48;
-				buffer[5] = filesize >> 40;
-				buffer[4] = filesize >> 32;
-				buffer[3] = filesize >> 24;
-				buffer[2] = filesize >> 16;
-				buffer[1] = filesize >> 8;
-				buffer[0] = filesize;
-
-				dirdbGetName_internalstr (s->compressedfilehandle->dirdb_ref, &filename);
-
-				DEBUG_PRINT ("[BZIP2 filehandle_read EOF] adbMetaAdd(%s, %"PRId64", BZIP2, [%02x %02x %02x %02x %02x %02x %02x %02x] (%"PRIu64" + %d => %"PRIu64")\n", filename, compressedfile_size, buffer[0], buffer[1], buffer[2], buffer[3], buffer[4], buffer[5], buffer[6], buffer[7], s->realpos, s->outputbuffer_fill, filesize);
-				adbMetaAdd (filename, compressedfile_size, "BZIP2", buffer, 8);
-			}
 
-			if (!s->outputbuffer_fill)
-			{
-				return retval;
-			}
-		}
+		preemptive_framelock();
 	}
 
 	return retval;
@@ -560,14 +726,8 @@ static int bzip2_ocpfile_filesize_ready (struct ocpfile_t *_s)
 static uint64_t bzip2_ocpfile_filesize (struct ocpfile_t *_s)
 {
 	struct bzip2_ocpfile_t *s = (struct bzip2_ocpfile_t *)_s;
-	struct ocpfilehandle_t *h = 0;
+	struct bzip2_ocpfilehandle_t *h = 0;
 	uint64_t compressedfile_size = 0;
-	bz_stream strm = {0};
-	uint8_t *inputbuffer;
-	uint8_t *outputbuffer;
-	uint64_t filesize = 0;
-	uint8_t buffer[8];
-	int ret; // for zlib
 	const char *filename = 0;
 
 	if (!s->filesize_pending)
@@ -614,117 +774,29 @@ static uint64_t bzip2_ocpfile_filesize (struct ocpfile_t *_s)
 		}
 	}
 
-/* Second, we decompress the wole thing... */
-	h = s->compressedfile->open (s->compressedfile);
+/* Second, we decode the whole thing, continuing from the last known block */
+	h = (struct bzip2_ocpfilehandle_t *)bzip2_ocpfile_open (&s->head);
 	if (!h)
 	{
 		return FILESIZE_ERROR;
 	}
 
-	inputbuffer = malloc (INPUTBUFFERSIZE);
-	if (!inputbuffer)
-	{
-		h->unref (h);
-		h = 0;
-		return FILESIZE_ERROR;
-	}
-	outputbuffer = malloc (OUTPUTBUFFERSIZE);
-	if (!outputbuffer)
-	{
-		h->unref (h);
-		h = 0;
-		free (inputbuffer);
-		return FILESIZE_ERROR;
-	}
-
-	strm.next_in = (char *)inputbuffer;
-	strm.avail_in = h->read (h, inputbuffer, INPUTBUFFERSIZE);
-
-	if (BZ2_bzDecompressInit (&strm, 0 /* no verbosity */, 0 /* do not use the small decompression routine */) != BZ_OK)
+	bzip2_ocpfile_index_load (s);
+	if (s->index.fill)
 	{
-		free (outputbuffer);
-		h->unref (h);
-		h = 0;
-		return FILESIZE_ERROR;
+		h->nextbit = s->index.points[s->index.fill - 1].inbit;
+		h->nextout = s->index.points[s->index.fill - 1].out;
 	}
 
-	do
+	while (!h->eofhit)
 	{
-		if (!strm.avail_in) // this is false for the first iteration
-		{
-			strm.next_in = (char *)inputbuffer;
-			strm.avail_in = h->read (h, inputbuffer, INPUTBUFFERSIZE);
-			if (h->error (h))
-			{
-				BZ2_bzDecompressEnd (&strm);
-				free (inputbuffer);
-				free (outputbuffer);
-				h->unref (h);
-				h = 0;
-				return FILESIZE_ERROR;
-			}
-		}
-		if (strm.avail_in == 0) // EOF hit, without file-error
+		if (bzip2_ocpfilehandle_decode_batch (h))
 		{
-			break;
+			h->head.unref (&h->head);
+			return FILESIZE_ERROR;
 		}
-
-		do
-		{
-			strm.next_out = (char *)outputbuffer;
-			strm.avail_out = OUTPUTBUFFERSIZE;
-
-			ret = BZ2_bzDecompress (&strm);
-
-			switch (ret)
-			{
-				default:
-				case BZ_PARAM_ERROR:
-				case BZ_DATA_ERROR:
-				case BZ_DATA_ERROR_MAGIC:
-				case BZ_MEM_ERROR:
-				/* should not happen */
-					BZ2_bzDecompressEnd (&strm);
-					free (inputbuffer);
-					free (outputbuffer);
-					h->unref (h);
-					h = 0;
-					return FILESIZE_ERROR;
-				case BZ_STREAM_END:
-				case BZ_OK:
-					break;
-			}
-			filesize += OUTPUTBUFFERSIZE - strm.avail_out;
-		 } while ((strm.avail_in != 0) && (ret != BZ_STREAM_END));
-	} while (ret != BZ_STREAM_END);
-
-	BZ2_bzDecompressEnd (&strm);
-	free (inputbuffer);
-	free (outputbuffer);
-	h->unref (h);
-	h = 0;
-
-	s->filesize_pending = 0;
-	s->uncompressed_filesize = filesize;
-
-	buffer[7] = filesize >> 56;
-	buffer[6] = filesize >> 48;
-	buffer[5] = filesize >> 40;
-	buffer[4] = filesize >> 32;
-	buffer[3] = filesize >> 24;
-	buffer[2] = filesize >> 16;
-	buffer[1] = filesize >> 8;
-	buffer[0] = filesize;
-
-	if (!filename)
-	{
-		dirdbGetName_internalstr (s->compressedfile->dirdb_ref, &filename);
 	}
-
-	compressedfile_size = s->compressedfile->filesize (s->compressedfile);
-
-	DEBUG_PRINT ("[BZIP2 file_filesize] adbMetaAdd(%s, %"PRIu64", BZIP2, [%02x %02x %02x %02x %02x %02x %02x %02x]\n", filename, compressedfile_size, buffer[0], buffer[1], buffer[2], buffer[3], buffer[4], buffer[5], buffer[6], buffer[7]);
-	adbMetaAdd (filename, compressedfile_size, "BZIP2", buffer, 8);
+	h->head.unref (&h->head);
 
 	return s->uncompressed_filesize;
 }
@@ -752,6 +824,8 @@ static void bzip2_dir_unref (struct ocpdir_t *self)
 		s->child.compressedfile = 0;
 	}
 
+	bzip2_index_free (&s->child.index);
+
 	s->head.parent->unref (s->head.parent);
 	s->head.parent = 0;
 
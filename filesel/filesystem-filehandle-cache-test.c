@@ -1,6 +1,7 @@
 int do_debug_print = 0;
 
 #define CACHE_LINE_SIZE 3
+#define CACHE_BLOCK_SIZE 4
 
 struct cache_ocpfilehandle_t;
 static void dump_self (struct cache_ocpfilehandle_t *self);
@@ -109,6 +110,10 @@ const char *ocpfile_t_fill_default_filename_override (struct ocpfile_t *file)
 
 int ocpfilehandle_t_fill_default_ioctl (struct ocpfilehandle_t *s, const char *cmd, void *ptr)
 {
+	if (!strcmp (cmd, "test"))
+	{
+		return 0;
+	}
 	return -1;
 }
 
@@ -256,6 +261,8 @@ int main (int argc, char *argv[])
 	struct ocpfile_t *f;
 	struct ocpfilehandle_t *fh;
 	struct ocpdir_t *test_dir;
+	int prefailed = 0;
+	int sharedfailed = 0;
 
 	do_debug_print = 0;
 
@@ -468,7 +475,125 @@ int main (int argc, char *argv[])
 	f->unref (f);
 	fh->unref (fh);
 
+	/* the whole file in the head buffer, as the playlist prefetch does. Reads past EOF must be cut short */
+	mem = malloc (src_len);
+	memcpy (mem, src_data, src_len);
+	f = mem_file_open (test_dir, 0, mem, src_len);
+	mem = malloc (src_len);
+	memcpy (mem, src_data, src_len);
+	{
+		struct ocpfilehandle_t *c1 = cache_filehandle_open_pre (f, mem, src_len, 0, 0);
+		int readres;
+
+		memset (dst_data, '.', sizeof (dst_data));
+		readres = c1->read (c1, dst_data, 100);
+		if ((readres != src_len) || memcmp (dst_data, src_data, src_len) || (dst_data[src_len] != '.'))
+		{
+			fprintf (stderr, " pre-read past EOF failed");
+			prefailed = 1;
+		}
+		c1->seek_set (c1, 20);
+		memset (dst_data, '.', sizeof (dst_data));
+		readres = c1->read (c1, dst_data, 10);
+		if ((readres != 6) || memcmp (dst_data, src_data + 20, 6) || (dst_data[6] != '.'))
+		{
+			fprintf (stderr, " pre-read across EOF failed");
+			prefailed = 1;
+		}
+		fprintf (stderr, "%s\n", prefailed ? "" : ".");
+		c1->unref (c1);
+	}
+	f->unref (f);
+
+	/* two handles of the same file share the blocks, sequential reads get read-ahead */
+	mem = malloc (src_len);
+	memcpy (mem, src_data, src_len);
+	f = mem_file_open (test_dir, 1, mem, src_len);
+	{
+		struct ocpfilehandle_t *c1, *c2;
+		struct IOCTL_CacheStats stats1, stats2;
+		uint64_t readahead;
+		int i;
+
+		fh = f->open (f);
+		c1 = cache_filehandle_open (fh);
+		fh->unref (fh);
+		fh = f->open (f);
+		c2 = cache_filehandle_open (fh);
+		fh->unref (fh);
+
+		memset (dst_data, '.', sizeof (dst_data));
+		for (i=0; i < src_len; i+=2)
+		{
+			c1->read (c1, dst_data + i, 2);
+		}
+		if (memcmp (dst_data, src_data, src_len) || c1->ioctl (c1, IOCTL_CACHE_STATS, &stats1) || (stats1.misses != 7))
+		{
+			fprintf (stderr, " first handle did not fill the shared cache");
+			sharedfailed = 1;
+		}
+		memset (dst_data, '.', sizeof (dst_data));
+		if ((c2->read (c2, dst_data, src_len) != src_len) || memcmp (dst_data, src_data, src_len) ||
+		    c2->ioctl (c2, IOCTL_CACHE_STATS, &stats2) || stats2.misses || (!stats2.hits))
+		{
+			fprintf (stderr, " second handle did not use the shared cache");
+			sharedfailed = 1;
+		}
+		c1->unref (c1);
+		c2->unref (c2);
+		f->unref (f);
+
+		mem = malloc (src_len);
+		memcpy (mem, src_data, src_len);
+		f = mem_file_open (test_dir, 2, mem, src_len);
+		fh = f->open (f);
+		c1 = cache_filehandle_open (fh);
+		fh->unref (fh);
+
+		c1->read (c1, dst_data, 12);
+		c1->ioctl (c1, IOCTL_CACHE_STATS, &stats1);
+		readahead = stats1.readahead;
+		for (i=0; i < 10; i++)
+		{
+			cache_filehandle_idle ();
+		}
+		memset (dst_data, '.', sizeof (dst_data));
+		c1->read (c1, dst_data + 12, 4);
+		c1->ioctl (c1, IOCTL_CACHE_STATS, &stats2);
+		if ((stats2.readahead <= readahead) || (stats2.misses != stats1.misses) || memcmp (dst_data + 12, src_data + 12, 4))
+		{
+			fprintf (stderr, " sequential read was not read ahead");
+			sharedfailed = 1;
+		}
+
+		cache_filehandle_setlimit (2 * CACHE_BLOCK_SIZE);
+		c1->ioctl (c1, IOCTL_CACHE_STATS, &stats1);
+		if (stats1.blocks > 2)
+		{
+			fprintf (stderr, " cache limit not enforced");
+			sharedfailed = 1;
+		}
+		cache_filehandle_setlimit (16 << 20);
+		c1->unref (c1);
+		f->unref (f);
+
+		cache_filehandle_flush ();
+		mem = malloc (src_len);
+		memcpy (mem, src_data, src_len);
+		f = mem_file_open (test_dir, 3, mem, src_len);
+		c1 = cache_filehandle_open_pre (f, 0, 0, 0, 0);
+		if ((c1->ioctl (c1, IOCTL_CACHE_STATS, &stats1)) || stats1.blocks || (c1->ioctl (c1, "unknown", 0) != -1) || c1->ioctl (c1, "test", 0))
+		{
+			fprintf (stderr, " ioctl");
+			sharedfailed = 1;
+		}
+		c1->unref (c1);
+		f->unref (f);
+
+		fprintf (stderr, "%s\n", sharedfailed ? "" : ".");
+	}
+
 	test_dir->unref (test_dir); test_dir = 0;
 
-	return 0;
+	return prefailed || sharedfailed;
 }
@@ -19,12 +19,14 @@
  */
 
 #include "config.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
 #include "types.h"
+#include "dirdb.h"
 #include "filesystem.h"
 #include "filesystem-filehandle-cache.h"
 
@@ -34,6 +36,13 @@
 
 #define CACHE_LINES 4
 
+#ifndef CACHE_BLOCK_SIZE
+# define CACHE_BLOCK_SIZE 65536 /* granularity of the shared cache */
+#endif
+
+#define CACHE_HASH_SIZE 1024
+#define CACHE_READAHEAD_MAX 16 /* blocks */
+
 #ifdef FILEHANDLE_CACHE_DEBUG
 #define DEBUG_PRINT(...) do { if (do_debug_print) { fprintf(stderr, __VA_ARGS__); } } while (0)
 #define DUMP_SELF(S) do { if (do_debug_print) { dump_self(s); } } while (0)
@@ -69,8 +78,56 @@ struct cache_ocpfilehandle_t
    2 = tail
    3 = post-tail, when trying read past the current known EOF
  */
+
+	struct cache_file_t *file; /* shared blocks, NULL if this handle does not use the shared cache */
+	uint64_t last_block;
+	int sequential;            /* number of blocks in a row that was accessed in order */
+	uint64_t ahead_next;       /* blocks that cache_filehandle_idle() should read in advance */
+	uint64_t ahead_end;
+	int ahead_queued;
+	struct cache_ocpfilehandle_t *ahead_queue_next;
+	uint64_t hits;
+	uint64_t misses;
+};
+
+/* The shared cache sits below the cache lines of each handle, and is used for
+ * all I/O towards the parent. Blocks are keyed by the dirdb_ref of the file,
+ * so all handles of the same file share them, and they are kept after the
+ * handles are closed until they are the least recently used and the cache is
+ * full.
+ */
+struct cache_file_t
+{
+	uint32_t dirdb_ref;
+	uint64_t filesize; /* 0 if not known yet */
+	int handles;
+	int blocks;
+	struct cache_file_t *next;
+};
+
+struct cache_block_t
+{
+	struct cache_file_t *file;
+	uint64_t index;
+	int fill;
+	struct cache_block_t *hash_next;
+	struct cache_block_t *lru_prev; /* towards the least recently used */
+	struct cache_block_t *lru_next; /* towards the most recently used */
+	char data[CACHE_BLOCK_SIZE];
 };
 
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct cache_file_t *cache_files;
+static struct cache_block_t *cache_hash[CACHE_HASH_SIZE];
+static struct cache_block_t *cache_lru_head; /* least recently used */
+static struct cache_block_t *cache_lru_tail; /* most recently used */
+static uint64_t cache_blocks;
+static uint64_t cache_limit = (16 << 20) / CACHE_BLOCK_SIZE;
+static uint64_t cache_hits;
+static uint64_t cache_misses;
+static uint64_t cache_readahead;
+static struct cache_ocpfilehandle_t *cache_ahead_queue; /* handles that has read-ahead pending */
+
 static void cache_filehandle_ref (struct ocpfilehandle_t *_s);
 
 static void cache_filehandle_unref (struct ocpfilehandle_t *_s);
@@ -95,6 +152,178 @@ static int cache_filehandle_filesize_ready (struct ocpfilehandle_t *);
 
 static int cache_filehandle_ioctl (struct ocpfilehandle_t *, const char *cmd, void *ptr);
 
+static inline unsigned int cache_hash_index (const struct cache_file_t *file, uint64_t index)
+{
+	return (((uintptr_t)file >> 4) ^ (index * 2654435761u)) % CACHE_HASH_SIZE;
+}
+
+/* cache_mutex must be held */
+static struct cache_block_t *cache_block_find (const struct cache_file_t *file, uint64_t index, int touch)
+{
+	struct cache_block_t *b;
+
+	for (b = cache_hash[cache_hash_index (file, index)]; b; b = b->hash_next)
+	{
+		if ((b->file == file) && (b->index == index))
+		{
+			break;
+		}
+	}
+	if (b && touch && (b != cache_lru_tail))
+	{ /* move to the most recently used end */
+		if (b->lru_prev)
+		{
+			b->lru_prev->lru_next = b->lru_next;
+		} else {
+			cache_lru_head = b->lru_next;
+		}
+		b->lru_next->lru_prev = b->lru_prev;
+		b->lru_prev = cache_lru_tail;
+		b->lru_next = 0;
+		cache_lru_tail->lru_next = b;
+		cache_lru_tail = b;
+	}
+	return b;
+}
+
+/* cache_mutex must be held */
+static void cache_block_remove (struct cache_block_t *b)
+{
+	struct cache_block_t **prev;
+
+	for (prev = &cache_hash[cache_hash_index (b->file, b->index)]; *prev != b; prev = &(*prev)->hash_next)
+	{
+	}
+	*prev = b->hash_next;
+
+	if (b->lru_prev)
+	{
+		b->lru_prev->lru_next = b->lru_next;
+	} else {
+		cache_lru_head = b->lru_next;
+	}
+	if (b->lru_next)
+	{
+		b->lru_next->lru_prev = b->lru_prev;
+	} else {
+		cache_lru_tail = b->lru_prev;
+	}
+
+	b->file->blocks--;
+	cache_blocks--;
+	free (b);
+}
+
+/* cache_mutex must be held */
+static void cache_block_evict (uint64_t limit)
+{
+	while (cache_blocks > limit)
+	{
+		cache_block_remove (cache_lru_head);
+	}
+}
+
+/* cache_mutex must be held */
+static void cache_block_insert (struct cache_block_t *b)
+{
+	unsigned int h = cache_hash_index (b->file, b->index);
+
+	b->hash_next = cache_hash[h];
+	cache_hash[h] = b;
+
+	b->lru_prev = cache_lru_tail;
+	b->lru_next = 0;
+	if (cache_lru_tail)
+	{
+		cache_lru_tail->lru_next = b;
+	} else {
+		cache_lru_head = b;
+	}
+	cache_lru_tail = b;
+
+	b->file->blocks++;
+	cache_blocks++;
+
+	cache_block_evict (cache_limit);
+}
+
+/* cache_mutex must be held. Files without handles or blocks are released here and not on eviction, so that dirdbUnref() is only called by the thread that opens the handles */
+static void cache_files_release (void)
+{
+	struct cache_file_t **prev = &cache_files;
+
+	while (*prev)
+	{
+		struct cache_file_t *f = *prev;
+		if (f->handles || f->blocks)
+		{
+			prev = &f->next;
+			continue;
+		}
+		*prev = f->next;
+		dirdbUnref (f->dirdb_ref, dirdb_use_filehandle);
+		free (f);
+	}
+}
+
+static struct cache_file_t *cache_file_get (uint32_t dirdb_ref, uint64_t filesize)
+{
+	struct cache_file_t *f;
+
+	if (dirdb_ref == DIRDB_NOPARENT)
+	{
+		return 0;
+	}
+
+	pthread_mutex_lock (&cache_mutex);
+	cache_files_release ();
+	if (!cache_limit)
+	{
+		pthread_mutex_unlock (&cache_mutex);
+		return 0;
+	}
+	for (f = cache_files; f; f = f->next)
+	{
+		if (f->dirdb_ref == dirdb_ref)
+		{
+			break;
+		}
+	}
+	if (f && filesize && f->filesize && (f->filesize != filesize))
+	{ /* the file has changed since the blocks were cached */
+		struct cache_block_t *b = cache_lru_head;
+		while (b)
+		{
+			struct cache_block_t *next = b->lru_next;
+			if (b->file == f)
+			{
+				cache_block_remove (b);
+			}
+			b = next;
+		}
+	}
+	if (!f)
+	{
+		f = calloc (1, sizeof (*f));
+		if (!f)
+		{
+			pthread_mutex_unlock (&cache_mutex);
+			return 0;
+		}
+		f->dirdb_ref = dirdbRef (dirdb_ref, dirdb_use_filehandle);
+		f->next = cache_files;
+		cache_files = f;
+	}
+	if (filesize)
+	{
+		f->filesize = filesize;
+	}
+	f->handles++;
+	pthread_mutex_unlock (&cache_mutex);
+
+	return f;
+}
+
 struct ocpfilehandle_t *cache_filehandle_open_pre (struct ocpfile_t *owner, char *headptr, uint32_t headlen, char *tailptr, uint32_t taillen)
 {
 	struct cache_ocpfilehandle_t *retval = calloc (1, sizeof (*retval));
@@ -169,6 +398,9 @@ struct ocpfilehandle_t *cache_filehandle_open (struct ocpfilehandle_t *parent)
 		retval->filesize = 0;//UINT64_C(0xffffffffffffffff);
 	}
 
+	retval->file = cache_file_get (parent->dirdb_ref, retval->filesize_pending ? 0 : retval->filesize);
+	retval->last_block = UINT64_C(0xffffffffffffffff);
+
 	retval->head.origin->ref (retval->head.origin);
 
 	retval->head.refcount = 1;
@@ -200,6 +432,22 @@ static void cache_filehandle_unref (struct ocpfilehandle_t *_s)
 		s->cache_line[i].data = 0;
 	}
 
+	if (s->file)
+	{
+		pthread_mutex_lock (&cache_mutex);
+		if (s->ahead_queued)
+		{
+			struct cache_ocpfilehandle_t **prev;
+			for (prev = &cache_ahead_queue; *prev != s; prev = &(*prev)->ahead_queue_next)
+			{
+			}
+			*prev = s->ahead_queue_next;
+		}
+		s->file->handles--;
+		s->file = 0;
+		pthread_mutex_unlock (&cache_mutex);
+	}
+
 	if (s->owner)
 	{
 		s->owner->unref (s->owner);
@@ -517,7 +765,7 @@ static void cache_steal_buffers (struct cache_ocpfilehandle_t *s)
 	}
 }
 
-static int cache_filehandle_seek_and_read (struct cache_ocpfilehandle_t *s, uint64_t pos, void *dst, int len)
+static int cache_filehandle_parent_read (struct cache_ocpfilehandle_t *s, uint64_t pos, void *dst, int len)
 {
 	int readresult;
 
@@ -550,7 +798,7 @@ static int cache_filehandle_seek_and_read (struct cache_ocpfilehandle_t *s, uint
 	}
 #else
 	{
-		uint64_t temp2 = s->pos + readresult;
+		uint64_t temp2 = pos + readresult;
 		if (temp2 > s->filesize)
 		{ /* should never happen if s->filesize_pending, but does not hurt performing this task */
 			s->filesize = temp2;
@@ -570,6 +818,199 @@ static int cache_filehandle_seek_and_read (struct cache_ocpfilehandle_t *s, uint
 	return readresult;
 }
 
+/* Reads block index from the parent and adds it to the shared cache. If dst is given, the data at pos is copied out of it.
+ * Returns the number of bytes copied, or -1 on error */
+static int cache_block_load (struct cache_ocpfilehandle_t *s, uint64_t index, uint64_t pos, void *dst, int len)
+{
+	struct cache_block_t *b, *o;
+	uint64_t offset = index * CACHE_BLOCK_SIZE;
+	int want = CACHE_BLOCK_SIZE;
+	int readresult;
+	int copy = 0;
+
+	if (!s->filesize_pending)
+	{
+		if (offset >= s->filesize)
+		{
+			return 0;
+		}
+		if ((s->filesize - offset) < want)
+		{
+			want = s->filesize - offset;
+		}
+	}
+
+	b = malloc (sizeof (*b));
+	if (!b)
+	{
+		s->error = 1;
+		return -1;
+	}
+	readresult = cache_filehandle_parent_read (s, offset, b->data, want);
+	if ((readresult != want) && s->error)
+	{
+		free (b);
+		return -1;
+	}
+	if (!readresult)
+	{
+		free (b);
+		return 0;
+	}
+	b->file = s->file;
+	b->index = index;
+	b->fill = readresult;
+
+	pthread_mutex_lock (&cache_mutex);
+	o = cache_block_find (s->file, index, 1);
+	if (o)
+	{ /* another handle was faster */
+		free (b);
+		b = o;
+	} else {
+		cache_block_insert (b);
+	}
+	if (dst)
+	{
+		copy = b->fill - (pos - offset);
+		if (copy > len)
+		{
+			copy = len;
+		}
+		if (copy > 0)
+		{
+			memcpy (dst, b->data + (pos - offset), copy);
+		} else {
+			copy = 0;
+		}
+		s->misses++;
+		cache_misses++;
+	} else if (!o)
+	{
+		cache_readahead++;
+	}
+	pthread_mutex_unlock (&cache_mutex);
+
+	return copy;
+}
+
+/* Detects sequential access, and widens the read-ahead window for each block read in order */
+static void cache_filehandle_sequential (struct cache_ocpfilehandle_t *s, uint64_t index)
+{
+	uint64_t end;
+	uint64_t window;
+
+	if (index == s->last_block)
+	{
+		return;
+	}
+	if (index == (s->last_block + 1))
+	{
+		if (s->sequential < CACHE_READAHEAD_MAX)
+		{
+			s->sequential++;
+		}
+	} else {
+		s->sequential = 0;
+		s->ahead_next = s->ahead_end = 0;
+	}
+	s->last_block = index;
+
+	if (s->sequential < 2)
+	{
+		return;
+	}
+
+	pthread_mutex_lock (&cache_mutex);
+	window = s->sequential;
+	if (window > (cache_limit / 4))
+	{ /* never let read-ahead push out the data being read */
+		window = cache_limit / 4;
+	}
+	end = index + 1 + window;
+	if (!s->filesize_pending)
+	{
+		uint64_t blocks = (s->filesize + CACHE_BLOCK_SIZE - 1) / CACHE_BLOCK_SIZE;
+		if (end > blocks)
+		{
+			end = blocks;
+		}
+	}
+	if (s->ahead_next <= index)
+	{
+		s->ahead_next = index + 1;
+	}
+	if (end > s->ahead_end)
+	{
+		s->ahead_end = end;
+	}
+	if ((s->ahead_next < s->ahead_end) && (!s->ahead_queued))
+	{
+		s->ahead_queue_next = cache_ahead_queue;
+		cache_ahead_queue = s;
+		s->ahead_queued = 1;
+	}
+	pthread_mutex_unlock (&cache_mutex);
+}
+
+static int cache_filehandle_seek_and_read (struct cache_ocpfilehandle_t *s, uint64_t pos, void *dst, int len)
+{
+	int retval = 0;
+
+	if (!s->file)
+	{
+		return cache_filehandle_parent_read (s, pos, dst, len);
+	}
+
+	while (len)
+	{
+		uint64_t index = pos / CACHE_BLOCK_SIZE;
+		struct cache_block_t *b;
+		int copy = 0;
+
+		cache_filehandle_sequential (s, index);
+
+		pthread_mutex_lock (&cache_mutex);
+		b = cache_block_find (s->file, index, 1);
+		if (b)
+		{
+			copy = b->fill - (pos - index * CACHE_BLOCK_SIZE);
+			if (copy > len)
+			{
+				copy = len;
+			}
+			if (copy > 0)
+			{
+				memcpy (dst, b->data + (pos - index * CACHE_BLOCK_SIZE), copy);
+			} else {
+				copy = 0;
+			}
+			s->hits++;
+			cache_hits++;
+		}
+		pthread_mutex_unlock (&cache_mutex);
+
+		if (!b)
+		{
+			copy = cache_block_load (s, index, pos, dst, len);
+			if (copy < 0)
+			{
+				break;
+			}
+		}
+		if (!copy)
+		{ /* EOF */
+			break;
+		}
+		retval += copy;
+		pos += copy;
+		dst = (char *)dst + copy;
+		len -= copy;
+	}
+
+	return retval;
+}
+
 static int cache_filehandle_read (struct ocpfilehandle_t *_s, void *dst, int len)
 {
 	struct cache_ocpfilehandle_t *s = (struct cache_ocpfilehandle_t *)_s;
@@ -597,7 +1038,7 @@ static int cache_filehandle_read (struct ocpfilehandle_t *_s, void *dst, int len
 	{
 		if ((s->pos + len) > s->filesize)
 		{
-			len = s->filesize - len;
+			len = s->filesize - s->pos;
 		}
 	}
 
@@ -1018,6 +1459,35 @@ static int cache_filehandle_ioctl (struct ocpfilehandle_t *_s, const char *cmd,
 {
 	struct cache_ocpfilehandle_t *s = (struct cache_ocpfilehandle_t *)_s;
 
+	if (!strcmp (cmd, IOCTL_CACHE_STATS))
+	{
+		struct IOCTL_CacheStats *stats = ptr;
+
+		pthread_mutex_lock (&cache_mutex);
+		stats->hits         = s->hits;
+		stats->misses       = s->misses;
+		stats->total_hits   = cache_hits;
+		stats->total_misses = cache_misses;
+		stats->readahead    = cache_readahead;
+		stats->blocks       = cache_blocks;
+		stats->limit        = cache_limit;
+		stats->blocksize    = CACHE_BLOCK_SIZE;
+		pthread_mutex_unlock (&cache_mutex);
+
+		return 0;
+	}
+
+	/* a handle from cache_filehandle_open_pre() can have all the data already, but ioctls like the TOC of an audio CD
+	 * still need the real file */
+	if (!s->parent)
+	{
+		s->parent = s->owner->open (s->owner);
+		if (!s->parent)
+		{
+			return -1;
+		}
+	}
+
 	return s->parent->ioctl (s->parent, cmd, ptr);
 }
 
@@ -1034,3 +1504,51 @@ static int cache_filehandle_filesize_ready (struct ocpfilehandle_t *_s)
 
 	return !s->filesize_pending;
 }
+
+void cache_filehandle_idle (void)
+{
+	struct cache_ocpfilehandle_t *s;
+	uint64_t index;
+	int have;
+
+	pthread_mutex_lock (&cache_mutex);
+	cache_files_release ();
+	while ((s = cache_ahead_queue))
+	{
+		if ((s->ahead_next < s->ahead_end) && (!s->error))
+		{
+			break;
+		}
+		cache_ahead_queue = s->ahead_queue_next;
+		s->ahead_queued = 0;
+	}
+	if (!s)
+	{
+		pthread_mutex_unlock (&cache_mutex);
+		return;
+	}
+	index = s->ahead_next++;
+	have = !!cache_block_find (s->file, index, 0);
+	pthread_mutex_unlock (&cache_mutex);
+
+	if (!have)
+	{
+		cache_block_load (s, index, 0, 0, 0);
+	}
+}
+
+void cache_filehandle_setlimit (uint64_t bytes)
+{
+	pthread_mutex_lock (&cache_mutex);
+	cache_limit = bytes / CACHE_BLOCK_SIZE;
+	cache_block_evict (cache_limit);
+	pthread_mutex_unlock (&cache_mutex);
+}
+
+void cache_filehandle_flush (void)
+{
+	pthread_mutex_lock (&cache_mutex);
+	cache_block_evict (0);
+	cache_files_release ();
+	pthread_mutex_unlock (&cache_mutex);
+}
@@ -1,6 +1,8 @@
 #ifndef _FILESEL_FILESYSTEM_FILEHANDLE_CACHE_H
 #define _FILESEL_FILESYSTEM_FILEHANDLE_CACHE_H 1
 
+#define IOCTL_CACHE_STATS "CacheStats"
+
 struct ocpdir_t;
 struct ocpfile_t;
 struct ocpfilehandle_t;
@@ -13,4 +15,26 @@ struct ocpfilehandle_t *cache_filehandle_open_pre (struct ocpfile_t *owner, char
 /* for general cached version, we go directly for an open handle */
 struct ocpfilehandle_t *cache_filehandle_open (struct ocpfilehandle_t *parent);
 
+/* Handles from cache_filehandle_open() read their parent through a shared block cache, so all handles of the same file
+ * share the data. The cache is thread-safe, but each handle should only be used by one thread at the time, like any other
+ * ocpfilehandle_t. */
+struct IOCTL_CacheStats
+{
+	uint64_t hits;         /* blocks this handle found in the shared cache */
+	uint64_t misses;       /* blocks this handle had to read from the parent */
+	uint64_t total_hits;   /* all handles */
+	uint64_t total_misses;
+	uint64_t readahead;    /* blocks read in advance by cache_filehandle_idle() */
+	uint64_t blocks;       /* blocks currently in the cache */
+	uint64_t limit;        /* max blocks */
+	uint32_t blocksize;
+};
+
+/* Reads one block ahead for a handle that is being read sequentially. Call this from the thread that uses the handles, when it is idle */
+void cache_filehandle_idle (void);
+
+void cache_filehandle_setlimit (uint64_t bytes); /* 0 disables the shared cache for new handles */
+
+void cache_filehandle_flush (void); /* drops all the cached blocks */
+
 #endif
@@ -2,8 +2,10 @@
 
 #define INPUTBUFFERSIZE 128
 #define OUTPUTBUFFERSIZE 64
+#define ZLIB_INDEX_SPAN 4096
 
 #include "filesystem-gzip.c"
+#include "zlib-index.c"
 #include "filesystem-dir-mem.h"
 #include "filesystem-file-mem.h"
 
@@ -42,6 +44,8 @@ void dirdbGetName_internalstr (uint32_t ref, const char **retval)
 	if (ref == 9) *retval = "test5.txt.gz.gz";
 	if (ref == 10) *retval = "test5.txt.gz";
 	if (ref == 11) *retval = "test5.txt";
+	if (ref == 12) *retval = "test6.txt.gz";
+	if (ref == 13) *retval = "test6.txt";
 
 }
 
@@ -94,13 +98,31 @@ void register_dirdecompressor (const struct ocpdirdecompressor_t *ofd)
 {
 }
 
+/* only GZIPIDX is remembered, so test6 can verify that the index survives */
+static unsigned char *adbMeta_gzipidx;
+static size_t         adbMeta_gzipidx_size;
+
 int adbMetaAdd (const char *filename, const size_t filesize, const char *SIG, const unsigned char  *data, const size_t  datasize)
 {
+	if (!strcmp (SIG, "GZIPIDX"))
+	{
+		free (adbMeta_gzipidx);
+		adbMeta_gzipidx = malloc (datasize);
+		memcpy (adbMeta_gzipidx, data, datasize);
+		adbMeta_gzipidx_size = datasize;
+	}
 	return 0;
 }
 
 int adbMetaGet (const char *filename, const size_t filesize, const char *SIG,       unsigned char **data,       size_t *datasize)
 {
+	if ((!strcmp (SIG, "GZIPIDX")) && adbMeta_gzipidx)
+	{
+		*data = malloc (adbMeta_gzipidx_size);
+		memcpy (*data, adbMeta_gzipidx, adbMeta_gzipidx_size);
+		*datasize = adbMeta_gzipidx_size;
+		return 0;
+	}
 	return -1;
 }
 
@@ -484,6 +506,142 @@ int gzip_test5 (void)
 	return retval;
 }
 
+#define TEST6_SIZE (256*1024)
+
+static struct ocpfilehandle_t *gzip_test6_open (uint8_t *src, size_t srclen)
+{
+	struct ocpdir_t *test_dir;
+	struct ocpfile_t *osrc;
+	struct ocpdir_t *oddst;
+	struct ocpfile_t *odst;
+	struct ocpfilehandle_t *hdst;
+	char *dsrc = malloc (srclen);
+
+	memcpy (dsrc, src, srclen);
+	test_dir = ocpdir_mem_getdir_t(ocpdir_mem_alloc (0, "test:"));
+	osrc = mem_file_open (test_dir, 12, dsrc, srclen);
+	test_dir->unref (test_dir); test_dir = 0;
+
+	oddst = gzip_check_steal (osrc, 13);
+	odst = oddst->readdir_file(oddst, 13);
+	hdst = odst->open (odst);
+	oddst->unref (oddst); oddst = 0;
+	odst->unref (odst); odst = 0;
+	osrc->unref (osrc); osrc = 0;
+
+	return hdst;
+}
+
+static int gzip_test6_seeks (struct ocpfilehandle_t *h, const uint8_t *verify)
+{
+	const uint32_t offsets[] = {TEST6_SIZE - 100, 5, 200000, 100000, 150000, 12345, TEST6_SIZE - 4096};
+	uint8_t dst[1000];
+	int retval = 0;
+	int i;
+
+	for (i=0; i < sizeof (offsets) / sizeof (offsets[0]); i++)
+	{
+		int len = (offsets[i] + sizeof (dst) > TEST6_SIZE) ? (TEST6_SIZE - offsets[i]) : sizeof (dst);
+
+		if (h->seek_set (h, offsets[i]))
+		{
+			printf ("s");
+			retval |= 1;
+		} else if (h->read (h, dst, len) != len)
+		{
+			printf ("r");
+			retval |= 2;
+		} else if (memcmp (dst, verify + offsets[i], len))
+		{
+			printf ("d");
+			retval |= 4;
+		} else {
+			printf (".");
+		}
+	}
+	return retval;
+}
+
+int gzip_test6 (void)
+{
+	uint8_t *verify = malloc (TEST6_SIZE);
+	uint8_t *src = malloc (TEST6_SIZE);
+	uint8_t *dst = malloc (TEST6_SIZE);
+	struct ocpfilehandle_t *h;
+	z_stream strm;
+	size_t srclen;
+	uint32_t seed = 1;
+	int retval = 0;
+	int i;
+
+	printf ("Testing seek access points, and that they are stored and reloaded via adbMeta:  ");
+
+	/* semi-compressible data, so we get plenty of deflate blocks */
+	for (i=0; i < TEST6_SIZE; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		verify[i] = 'a' + ((seed >> 16) % 16);
+	}
+
+	memset (&strm, 0, sizeof (strm));
+	deflateInit2 (&strm, 6, Z_DEFLATED, 16 + MAX_WBITS, 1, Z_DEFAULT_STRATEGY); /* memLevel 1 gives small deflate blocks */
+	strm.next_in = verify;
+	strm.avail_in = TEST6_SIZE;
+	strm.next_out = src;
+	strm.avail_out = TEST6_SIZE;
+	deflate (&strm, Z_FINISH);
+	srclen = TEST6_SIZE - strm.avail_out;
+	deflateEnd (&strm);
+
+	/* first pass, decode everything linearly and check that access points were made */
+	h = gzip_test6_open (src, srclen);
+	if (h->read (h, dst, TEST6_SIZE) != TEST6_SIZE)
+	{
+		printf ("R");
+		retval |= 8;
+	} else if (memcmp (dst, verify, TEST6_SIZE))
+	{
+		printf ("D");
+		retval |= 16;
+	}
+	if (((struct gzip_ocpfilehandle_t *)h)->owner->index.fill < 8)
+	{
+		printf ("i");
+		retval |= 32;
+	}
+	retval |= gzip_test6_seeks (h, verify);
+	h->unref (h); h = 0;
+	if (!adbMeta_gzipidx)
+	{
+		printf ("m");
+		retval |= 64;
+	}
+
+	/* second instance, must pick up the index from adbMeta instead of building it */
+	h = gzip_test6_open (src, srclen);
+	retval |= gzip_test6_seeks (h, verify);
+	if (((struct gzip_ocpfilehandle_t *)h)->owner->index.dirty || (((struct gzip_ocpfilehandle_t *)h)->owner->index.fill < 8))
+	{
+		printf ("I");
+		retval |= 128;
+	}
+	h->unref (h); h = 0;
+
+	if (retval)
+	{
+		printf (ANSI_COLOR_RED " Failed" ANSI_COLOR_RESET "\n");
+	} else {
+		printf (ANSI_COLOR_GREEN " OK" ANSI_COLOR_RESET "\n");
+	}
+
+	free (verify);
+	free (src);
+	free (dst);
+	free (adbMeta_gzipidx);
+	adbMeta_gzipidx = 0;
+
+	return retval;
+}
 
 int main(int argc, char *argv[])
 {
@@ -495,6 +653,7 @@ int main(int argc, char *argv[])
 	retval |= gzip_test3 ();
 	retval |= gzip_test4 ();
 	retval |= gzip_test5 ();
+	retval |= gzip_test6 ();
 	printf ("\n");
 
 	return retval;
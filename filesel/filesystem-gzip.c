@@ -29,6 +29,7 @@
 #include "filesystem.h"
 #include "filesystem-gzip.h"
 #include "stuff/framelock.h"
+#include "zlib-index.h"
 
 #ifndef INPUTBUFFERSIZE
 # define INPUTBUFFERSIZE  65536
@@ -75,6 +76,9 @@ struct gzip_ocpfilehandle_t
 	uint64_t realpos;
 	uint64_t pos;
 
+	uint64_t in_base;  /* compressed and uncompressed offset where strm was last (re)started, total_in/total_out are relative to these */
+	uint64_t out_base;
+
 	int need_deinit;
 	int error;
 };
@@ -86,6 +90,9 @@ struct gzip_ocpfile_t
 
 	int                   filesize_pending;
 	uint64_t uncompressed_filesize;
+
+	int                   index_loaded;
+	struct zlib_index_t   index; /* seek access points, shared by all handles */
 };
 
 struct gzip_ocpdir_t
@@ -106,6 +113,8 @@ static int gzip_ocpfilehandle_inflateInit (struct gzip_ocpfilehandle_t *s)
 
 	s->error = 0;
 	s->realpos = 0;
+	s->in_base = 0;
+	s->out_base = 0;
 
 	s->outputbuffer_pos = 0;
 	s->outputbuffer_fill = 0;
@@ -140,6 +149,117 @@ static int gzip_ocpfilehandle_inflateInit (struct gzip_ocpfilehandle_t *s)
 	return 0;
 }
 
+static void gzip_ocpfile_index_load (struct gzip_ocpfile_t *s)
+{
+	unsigned char *metadata = 0;
+	size_t metadatasize = 0;
+	const char *filename = 0;
+
+	if (s->index_loaded)
+	{
+		return;
+	}
+	s->index_loaded = 1;
+
+	if (s->index.fill)
+	{ /* already built by gzip_ocpfile_filesize() */
+		return;
+	}
+
+	dirdbGetName_internalstr (s->compressedfile->dirdb_ref, &filename);
+	if (!adbMetaGet (filename, s->compressedfile->filesize (s->compressedfile), "GZIPIDX", &metadata, &metadatasize))
+	{
+		if (zlib_index_deserialize (&s->index, metadata, metadatasize))
+		{
+			DEBUG_PRINT ("[GZIP index_load] invalid GZIPIDX for %s\n", filename);
+		}
+		free (metadata);
+		metadata = 0;
+	}
+}
+
+static void gzip_ocpfile_index_store (struct gzip_ocpfile_t *s)
+{
+	unsigned char *metadata;
+	size_t metadatasize = 0;
+	const char *filename = 0;
+
+	if ((!s->index.dirty) || (!s->index.fill))
+	{
+		return;
+	}
+	s->index.dirty = 0;
+
+	metadata = zlib_index_serialize (&s->index, &metadatasize);
+	if (!metadata)
+	{
+		return;
+	}
+	dirdbGetName_internalstr (s->compressedfile->dirdb_ref, &filename);
+	DEBUG_PRINT ("[GZIP index_store] adbMetaAdd(%s, GZIPIDX, %d points, %lu bytes)\n", filename, s->index.fill, (unsigned long)metadatasize);
+	adbMetaAdd (filename, s->compressedfile->filesize (s->compressedfile), "GZIPIDX", metadata, metadatasize);
+	free (metadata);
+}
+
+/* restart decoding at the given access point, using raw inflate since we are past the gzip header */
+static int gzip_ocpfilehandle_inflateResume (struct gzip_ocpfilehandle_t *s, const struct zlib_index_point_t *point)
+{
+	uint8_t prime = 0;
+	int retval;
+
+	if (!s->need_deinit)
+	{
+		memset (&s->strm, 0, sizeof (s->strm));
+		if (inflateInit2(&s->strm, -MAX_WBITS) != Z_OK)
+		{
+			s->error = 1;
+			return -1;
+		}
+		s->need_deinit = 1;
+	}
+
+	s->error = 0;
+	s->realpos = point->out;
+	s->in_base = point->in;
+	s->out_base = point->out;
+
+	s->outputbuffer_pos = 0;
+	s->outputbuffer_fill = 0;
+
+	s->eofhit = 0;
+
+	if (s->compressedfilehandle->seek_set (s->compressedfilehandle, point->in - (point->bits ? 1 : 0)) < 0)
+	{
+		s->error = 1;
+		return -1;
+	}
+	if (point->bits)
+	{
+		if (s->compressedfilehandle->read (s->compressedfilehandle, &prime, 1) != 1)
+		{
+			s->error = 1;
+			return -1;
+		}
+	}
+
+	if (zlib_index_resume (&s->strm, point, prime))
+	{
+		s->error = 1;
+		return -1;
+	}
+
+	s->strm.next_in = s->inputbuffer;
+	retval = s->compressedfilehandle->read (s->compressedfilehandle, s->inputbuffer, INPUTBUFFERSIZE);
+	if (retval <= 0)
+	{
+		s->error = 1;
+		return -1;
+	}
+	s->strm.avail_in = retval;
+
+	return 0;
+}
+
 static void gzip_ocpfilehandle_ref (struct ocpfilehandle_t *_s)
 {
 	struct gzip_ocpfilehandle_t *s = (struct gzip_ocpfilehandle_t *)_s;
@@ -163,6 +283,11 @@ static void gzip_ocpfilehandle_unref (struct ocpfilehandle_t *_s)
 		s->need_deinit = 0;
 	}
 
+	if (s->owner)
+	{ /* readers rarely decode past the last byte, so EOF is not always seen. Points are valid even if they do not cover the whole stream */
+		gzip_ocpfile_index_store (s->owner);
+	}
+
 	dirdbUnref (s->head.dirdb_ref, dirdb_use_filehandle);
 
 	if (s->compressedfilehandle)
@@ -298,13 +423,28 @@ static int gzip_ocpfilehandle_read (struct ocpfilehandle_t *_s, void *dst, int l
 	int retval = 0;
 	int recall = 0;
 
-	/* do we need to reverse? */
-	if ((s->pos < s->realpos) || (!s->need_deinit))
+	/* do we need to reverse, or is the target far enough ahead that an access point can spare us decoding everything in between? */
+	if ((s->pos < s->realpos) || (!s->need_deinit) || (s->pos >= s->realpos + ZLIB_INDEX_SPAN))
 	{
-		if (gzip_ocpfilehandle_inflateInit (s))
+		const struct zlib_index_point_t *point;
+
+		gzip_ocpfile_index_load (s->owner);
+		point = zlib_index_lookup (&s->owner->index, s->pos);
+
+		if (point && ((s->pos < s->realpos) || (!s->need_deinit) || (point->out > s->realpos)))
 		{
-			s->error = 1;
-			return -1;
+			if (gzip_ocpfilehandle_inflateResume (s, point))
+			{
+				s->error = 1;
+				return -1;
+			}
+		} else if ((s->pos < s->realpos) || (!s->need_deinit))
+		{
+			if (gzip_ocpfilehandle_inflateInit (s))
+			{
+				s->error = 1;
+				return -1;
+			}
 		}
 	}
 
@@ -348,7 +488,8 @@ static int gzip_ocpfilehandle_read (struct ocpfilehandle_t *_s, void *dst, int l
 		s->outputbuffer_pos = s->outputbuffer;
 
 		inputsize = s->strm.avail_in;
-		ret = inflate (&s->strm, Z_NO_FLUSH);
+		ret = inflate (&s->strm, Z_BLOCK);
+		zlib_index_update (&s->owner->index, &s->strm, s->in_base + s->strm.total_in, s->out_base + s->strm.total_out);
 
 		switch (ret)
 		{
@@ -361,6 +502,7 @@ static int gzip_ocpfilehandle_read (struct ocpfilehandle_t *_s, void *dst, int l
 				return -1;
 			case Z_STREAM_END:
 				s->eofhit = 1;
+				gzip_ocpfile_index_store (s->owner);
 			case Z_OK:
 				break;
 		}
@@ -423,7 +565,8 @@ static int gzip_ocpfilehandle_read (struct ocpfilehandle_t *_s, void *dst, int l
 		s->outputbuffer_pos = s->outputbuffer;
 
 		inputsize = s->strm.avail_in;
-		ret = inflate (&s->strm, Z_NO_FLUSH);
+		ret = inflate (&s->strm, Z_BLOCK);
+		zlib_index_update (&s->owner->index, &s->strm, s->in_base + s->strm.total_in, s->out_base + s->strm.total_out);
 
 		switch (ret)
 		{
@@ -436,6 +579,7 @@ static int gzip_ocpfilehandle_read (struct ocpfilehandle_t *_s, void *dst, int l
 				return -1;
 			case Z_STREAM_END:
 				s->eofhit = 1;
+				gzip_ocpfile_index_store (s->owner);
 			case Z_OK:
 				break;
 		}
@@ -732,7 +876,8 @@ UseZlib:
 			strm.next_out = outputbuffer;
 			strm.avail_out = OUTPUTBUFFERSIZE;
 
-			ret = inflate (&strm, Z_NO_FLUSH);
+			ret = inflate (&strm, Z_BLOCK);
+			zlib_index_update (&s->index, &strm, strm.total_in, strm.total_out);
 
 			switch (ret)
 			{
@@ -760,6 +905,8 @@ UseZlib:
 	h->unref (h);
 	h = 0;
 
+	gzip_ocpfile_index_store (s);
+
 	s->filesize_pending = 0;
 	s->uncompressed_filesize = filesize;
 
@@ -802,6 +949,8 @@ static void gzip_dir_unref (struct ocpdir_t *self)
 		return;
 	}
 
+	zlib_index_free (&s->child.index);
+
 	if (s->child.compressedfile)
 	{
 		s->child.compressedfile->unref (s->child.compressedfile);
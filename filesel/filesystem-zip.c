@@ -56,6 +56,7 @@ static int do_zip_debug_print=1;
 
 #define MAX_SIZE_OF_CENTRAL_DIRECTORY (16*1024*1024)
 #define MAX_NUMBER_OF_DISKS 1000
+#define ZIP_PARSE_BATCH 256 /* entries added per readdir_iterate() call while the directory is still being parsed */
 
 struct zip_instance_t;
 
@@ -66,7 +67,9 @@ struct zip_instance_dir_t
 	uint32_t                     dir_parent; /* used for making blob */
 	uint32_t                     dir_next;
 	uint32_t                     dir_child;
+	uint32_t                     dir_child_last;
 	uint32_t                     file_child;
+	uint32_t                     file_child_last;
 
 	char                        *orig_full_dirpath; /* if encoding deviates from UTF-8 */
 	int                          orig_FlaggedUTF8;
@@ -85,11 +88,14 @@ struct zip_instance_file_t
 	uint64_t                     compressed_fileoffset_startdisk; /* points to the PK header!! */
 	uint32_t                     compressed_startdisk;
 
-	char                        *orig_full_filepath; /* if encoding deviates from UTF-8, this can be used to recode on the fly too */
+	char                        *orig_full_filepath; /* if encoding deviates from UTF-8, this can be used to recode on the fly too. Points into owner->names */
 	int                          orig_FlaggedUTF8;
 
 	uint32_t                     LocalHeaderSize;
 
+	int                          inflate_index_loaded;
+	struct zlib_index_t          inflate_index; /* seek access points for deflated files, shared by all handles */
+
 /* Not needed - above points to the PK header which contains this information when needed
 	uint16_t                     method;
 	uint16_t                     flags;
@@ -131,10 +137,24 @@ struct zip_instance_t
 	struct zip_instance_dir_t    dir0;
 	int                          dir_fill;
 	int                          dir_size;
-	struct zip_instance_file_t  *files; /* realloc doesn't break on this, since we do a complete scan before we make the nodes public */
+	struct zip_instance_file_t  *files; /* allocated for all the entries before the first one is added, since they are made public while the directory is still being parsed */
         int                          file_fill;
 	int                          file_size;
 
+	uint32_t                    *dir_hash; /* dirs indexed by orig_full_dirpath, UINT32_MAX for unused slots */
+	uint32_t                     dir_hash_size;
+
+	char                        *names; /* all the orig_full_filepath strings */
+	uint32_t                     names_fill;
+
+	/* entries not added yet, either the raw central directory or the adbMeta blob (then pending == names) */
+	uint8_t                     *pending;
+	uint64_t                     pending_pos;
+	uint64_t                     pending_len;
+	uint32_t                     pending_left;
+	int                          pending_blob;
+	int                          pending_failed;
+
 	struct ocpfile_t            *archive_file;
 	struct ocpfilehandle_t      *archive_filehandle;
 
@@ -209,12 +229,52 @@ static uint32_t zip_instance_add (struct zip_instance_t *self,
                                   const uint32_t         DiskNumber,
                                   const uint64_t         OffsetLocalHeader);
 
+/* counts the entries in the blob, so the files can be allocated up front */
+static uint32_t zip_instance_count_blob (uint8_t *blob, size_t blobsize)
+{
+	uint32_t count = 0;
+
+	while (blobsize >= 31)
+	{
+		uint8_t *eos = memchr (blob + 29, 0, blobsize - 29);
+		if (!eos)
+		{
+			break;
+		}
+		count++;
+		eos++;
+		blobsize -= eos - blob;
+		blob = eos;
+	}
+	return count;
+}
+
+static int zip_instance_reserve_files (struct zip_instance_t *self, uint32_t count)
+{
+	struct zip_instance_file_t *files;
+
+	if (count <= self->file_size)
+	{
+		return 0;
+	}
+	files = realloc (self->files, count * sizeof (self->files[0]));
+	if (!files)
+	{
+		return -1;
+	}
+	self->files = files;
+	self->file_size = count;
+	return 0;
+}
+
+/* parses the header of the blob and queues the entries for zip_instance_parse(). The filenames are used in place, so this takes ownership of the blob */
 static void zip_instance_decode_blob (struct zip_instance_t *self, uint8_t *blob, size_t blobsize)
 {
 	uint8_t *eos;
 
 	if (blobsize < 4)
 	{
+		free (blob);
 		return;
 	}
 	self->Total_number_of_disks =
@@ -222,78 +282,32 @@ static void zip_instance_decode_blob (struct zip_instance_t *self, uint8_t *blob
 		              ((uint64_t)(blob[ 2]) << 16) |
 		              ((uint64_t)(blob[ 1]) << 8) |
 		              ((uint64_t)(blob[ 0]));
-	blob += 4;
-	blobsize -= 4;
 
-	eos = memchr (blob, 0, blobsize);
+	eos = memchr (blob + 4, 0, blobsize - 4);
 	if (!eos)
 	{
+		free (blob);
 		return;
 	}
-	if (eos != blob)
+	if (eos != (blob + 4))
 	{
-		self->charset_override = strdup ((char *)blob);
+		self->charset_override = strdup ((char *)blob + 4);
 	} else {
 		self->charset_override = NULL;
 	}
-
 	eos++;
-	blobsize -= eos - blob;
-	blob = eos;
-
-	zip_translate_prepare (self);
 
-	while (blobsize >= 31)
+	self->pending_left = zip_instance_count_blob (eos, blobsize - (eos - blob));
+	if (zip_instance_reserve_files (self, self->pending_left))
 	{
-		uint64_t uncompressed_filesize =
-		              ((uint64_t)(blob[ 7]) << 56) |
-		              ((uint64_t)(blob[ 6]) << 48) |
-		              ((uint64_t)(blob[ 5]) << 40) |
-		              ((uint64_t)(blob[ 4]) << 32) |
-		              ((uint64_t)(blob[ 3]) << 24) |
-		              ((uint64_t)(blob[ 2]) << 16) |
-		              ((uint64_t)(blob[ 1]) <<  8) |
-		              ((uint64_t)(blob[ 0])      );
-		uint64_t compressed_filesize =
-		              ((uint64_t)(blob[15]) << 56) |
-		              ((uint64_t)(blob[14]) << 48) |
-		              ((uint64_t)(blob[13]) << 40) |
-		              ((uint64_t)(blob[12]) << 32) |
-		              ((uint64_t)(blob[11]) << 24) |
-		              ((uint64_t)(blob[10]) << 16) |
-		              ((uint64_t)(blob[ 9]) <<  8) |
-		              ((uint64_t)(blob[ 8])      );
-		uint64_t compressed_fileoffset_startdisk =
-		              ((uint64_t)(blob[23]) << 56) |
-		              ((uint64_t)(blob[22]) << 48) |
-		              ((uint64_t)(blob[21]) << 40) |
-		              ((uint64_t)(blob[20]) << 32) |
-		              ((uint64_t)(blob[19]) << 24) |
-		              ((uint64_t)(blob[18]) << 16) |
-		              ((uint64_t)(blob[17]) <<  8) |
-		              ((uint64_t)(blob[16])      );
-		uint64_t compressed_startdisk =
-		              ((uint64_t)(blob[27]) << 24) |
-		              ((uint64_t)(blob[26]) << 16) |
-		              ((uint64_t)(blob[25]) <<  8) |
-		              ((uint64_t)(blob[24])      );
-		int orig_FlaggedUTF8 =    blob[28] & 1;
-
-		blob += 29;
-		blobsize -= 29;
-		eos = memchr (blob, 0, blobsize);
-		if (!eos)
-		{
-			break;
-		}
-
-		zip_instance_add (self, (char *)blob, orig_FlaggedUTF8, compressed_filesize, uncompressed_filesize, compressed_startdisk, compressed_fileoffset_startdisk);
-
-		eos++;
-		blobsize -= eos - blob;
-		blob = eos;
+		free (blob);
+		return;
 	}
-	zip_translate_complete (self);
+	self->names = (char *)blob;
+	self->pending = blob;
+	self->pending_pos = eos - blob;
+	self->pending_len = blobsize;
+	self->pending_blob = 1;
 }
 
 static void zip_instance_encode_blob (struct zip_instance_t *self, uint8_t **blob, size_t *blobfill)
@@ -533,13 +547,86 @@ static void zip_io_unref (struct zip_instance_t *self)
 	self->Number_of_this_disk = UINT32_MAX;
 }
 
+static uint32_t zip_dir_hash_name (const char *path)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*path)
+	{
+		hash = (hash ^ (uint8_t)*(path++)) * 16777619u;
+	}
+	return hash;
+}
+
+static void zip_dir_hash_put (struct zip_instance_t *self, uint32_t dir)
+{
+	uint32_t i = zip_dir_hash_name (self->dirs[dir]->orig_full_dirpath) & (self->dir_hash_size - 1);
+
+	while (self->dir_hash[i] != UINT32_MAX)
+	{
+		i = (i + 1) & (self->dir_hash_size - 1);
+	}
+	self->dir_hash[i] = dir;
+}
+
+static void zip_dir_hash_add (struct zip_instance_t *self, uint32_t dir)
+{
+	if (((dir + 1) * 2) > self->dir_hash_size)
+	{
+		uint32_t size = self->dir_hash_size ? self->dir_hash_size * 2 : 256;
+		uint32_t i;
+
+		free (self->dir_hash);
+		self->dir_hash = malloc (size * sizeof (self->dir_hash[0]));
+		if (!self->dir_hash)
+		{ /* zip_dir_hash_find() falls back to a linear search */
+			self->dir_hash_size = 0;
+			return;
+		}
+		memset (self->dir_hash, 0xff, size * sizeof (self->dir_hash[0]));
+		self->dir_hash_size = size;
+		for (i = 1; i < dir; i++)
+		{
+			zip_dir_hash_put (self, i);
+		}
+	}
+	zip_dir_hash_put (self, dir);
+}
+
+/* returns 0 (the root) if path is not known yet */
+static uint32_t zip_dir_hash_find (struct zip_instance_t *self, const char *path)
+{
+	uint32_t i;
+
+	if (!self->dir_hash)
+	{
+		for (i = 1; i < self->dir_fill; i++)
+		{
+			if (!strcmp (self->dirs[i]->orig_full_dirpath, path))
+			{
+				return i;
+			}
+		}
+		return 0;
+	}
+
+	for (i = zip_dir_hash_name (path) & (self->dir_hash_size - 1); self->dir_hash[i] != UINT32_MAX; i = (i + 1) & (self->dir_hash_size - 1))
+	{
+		if (!strcmp (self->dirs[self->dir_hash[i]]->orig_full_dirpath, path))
+		{
+			return self->dir_hash[i];
+		}
+	}
+	return 0;
+}
+
 static uint32_t zip_instance_add_create_dir (struct zip_instance_t *self,
                                              const uint32_t         dir_parent,
                                              char                  *Dirpath,
                                              char                  *Dirname,
                                              int                    Filename_FlaggedUTF8)
 {
-	uint32_t *prev, iter;
+	uint32_t iter;
 	uint32_t dirdb_ref;
 	DEBUG_PRINT ("[ZIP] create_dir: %s %d\n", Filename, Filename_FlaggedUTF8);
 
@@ -597,20 +684,26 @@ static uint32_t zip_instance_add_create_dir (struct zip_instance_t *self,
 	self->dirs[self->dir_fill]->dir_parent = dir_parent;
 	self->dirs[self->dir_fill]->dir_next = UINT32_MAX;
 	self->dirs[self->dir_fill]->dir_child = UINT32_MAX;
+	self->dirs[self->dir_fill]->dir_child_last = UINT32_MAX;
 	self->dirs[self->dir_fill]->file_child = UINT32_MAX;
+	self->dirs[self->dir_fill]->file_child_last = UINT32_MAX;
 	self->dirs[self->dir_fill]->orig_full_dirpath = strdup (Dirpath);
 	self->dirs[self->dir_fill]->orig_FlaggedUTF8 = Filename_FlaggedUTF8;
 
-	prev = &self->dirs[dir_parent]->dir_child;
-	for (iter = *prev; iter != UINT32_MAX; iter = self->dirs[iter]->dir_next)
+	iter = self->dir_fill;
+	if (self->dirs[dir_parent]->dir_child_last == UINT32_MAX)
 	{
-		prev = &self->dirs[iter]->dir_next;
-	};
-	*prev = self->dir_fill;
+		self->dirs[dir_parent]->dir_child = iter;
+	} else {
+		self->dirs[self->dirs[dir_parent]->dir_child_last]->dir_next = iter;
+	}
+	self->dirs[dir_parent]->dir_child_last = iter;
 
 	self->dir_fill++;
 
-	return *prev;
+	zip_dir_hash_add (self, iter);
+
+	return iter;
 }
 
 static uint32_t zip_instance_add_file (struct zip_instance_t *self,
@@ -623,23 +716,14 @@ static uint32_t zip_instance_add_file (struct zip_instance_t *self,
                                        const uint32_t         DiskNumber,
                                        const uint64_t         OffsetLocalHeader)
 {
-	uint32_t *prev, iter;
+	uint32_t iter;
 	uint32_t dirdb_ref;
 
 	DEBUG_PRINT ("[ZIP] add_file: %s %s %d\n", Filepath, Filename, Filename_FlaggedUTF8);
 
 	if (self->file_fill == self->file_size)
-	{
-		int size = self->file_size + 64;
-		struct zip_instance_file_t *files = realloc (self->files, size * sizeof (self->files[0]));
-
-		if (!files)
-		{
-			return UINT32_MAX;
-		}
-
-		self->files = files;
-		self->file_size = size;
+	{ /* more entries than the directory announced. Files are public already, so the array can not move */
+		return UINT32_MAX;
 	}
 
 	if (!Filename_FlaggedUTF8)
@@ -670,23 +754,27 @@ static uint32_t zip_instance_add_file (struct zip_instance_t *self,
 	self->files[self->file_fill].head.refcount   = 0;
 	self->files[self->file_fill].dir_parent = dir_parent;
 	self->files[self->file_fill].file_next  = UINT32_MAX;
-	self->files[self->file_fill].orig_full_filepath = strdup (Filepath);
+	self->files[self->file_fill].orig_full_filepath = Filepath;
 	self->files[self->file_fill].orig_FlaggedUTF8 = Filename_FlaggedUTF8;
 	self->files[self->file_fill].uncompressed_filesize           = UncompressedSize;
 	self->files[self->file_fill].compressed_filesize             = CompressedSize;
 	self->files[self->file_fill].compressed_fileoffset_startdisk = OffsetLocalHeader;
 	self->files[self->file_fill].compressed_startdisk            = DiskNumber;
+	self->files[self->file_fill].inflate_index_loaded            = 0;
+	memset (&self->files[self->file_fill].inflate_index, 0, sizeof (self->files[self->file_fill].inflate_index));
 
-	prev = &self->dirs[dir_parent]->file_child;
-	for (iter = *prev; iter != UINT32_MAX; iter = self->files[iter].file_next)
+	iter = self->file_fill;
+	if (self->dirs[dir_parent]->file_child_last == UINT32_MAX)
 	{
-		prev = &self->files[iter].file_next;
-	};
-	*prev = self->file_fill;
+		self->dirs[dir_parent]->file_child = iter;
+	} else {
+		self->files[self->dirs[dir_parent]->file_child_last].file_next = iter;
+	}
+	self->dirs[dir_parent]->file_child_last = iter;
 
 	self->file_fill++;
 
-	return *prev;
+	return iter;
 }
 
 static uint32_t zip_instance_add (struct zip_instance_t *self,
@@ -716,23 +804,17 @@ again:
 		slash = strchr (ptr, '/');
 		if (slash)
 		{
-			uint32_t dirdb_ref = UINT32_MAX;
-
 			*slash = 0;
 			if (strcmp (ptr, ".") && strcmp (ptr, "..") && strlen (ptr)) /* we ignore these entries */
 			{
 				/* check if we already have this node */
-				for (search = 1; search < self->dir_fill; search++)
+				search = zip_dir_hash_find (self, Filepath);
+				if (search)
 				{
-					if (!strcmp (self->dirs[search]->orig_full_dirpath, Filepath))
-					{
-						iter = search;
-						*slash = '/';
-						ptr = slash + 1;
-						iter = search;
-						dirdbUnref (dirdb_ref, dirdb_use_dir);
-						goto again; /* we need a break + continue; */
-					}
+					*slash = '/';
+					ptr = slash + 1;
+					iter = search;
+					goto again; /* we need a break + continue; */
 				}
 
 				/* no hit, create one */
@@ -756,34 +838,136 @@ again:
 	}
 }
 
-static int zip_parse_central_directory (struct zip_instance_t *self, uint8_t *searchptr, uint64_t searchlen, uint32_t Total_number_of_entries_in_the_central_directory)
+/* all entries are added, cache them in adbMeta if they came from the central directory */
+static void zip_instance_parse_complete (struct zip_instance_t *self)
 {
-	uint32_t filecounter;
+	if (!self->pending_blob)
+	{
+		free (self->pending);
+	}
+	self->pending = 0;
+	self->pending_left = 0;
+	self->ready = 1;
 
-        for (filecounter = 0; filecounter < Total_number_of_entries_in_the_central_directory; filecounter++)
-        {
-		uint64_t  CompressedSize;
-		uint64_t  UncompressedSize;
-		uint32_t  DiskNumber;
-		uint64_t  OffsetLocalHeader;
-		uint32_t  CRC;
-		char     *Filename = 0;
-		int       Filename_FlaggedUTF8;
+	if (self->pending_failed)
+	{
+		return;
+	}
 
-                int r = central_directory_header (searchptr, searchlen, &CompressedSize, &UncompressedSize, &DiskNumber, &OffsetLocalHeader, &CRC, &Filename, &Filename_FlaggedUTF8);
-                if (r != -1)
-                {
-			DEBUG_PRINT ("[ZIP] just got a central directory header %"PRId32" of %"PRId32" %s\n", filecounter + 1, Total_number_of_entries_in_the_central_directory, Filename);
-			zip_instance_add (self, Filename, Filename_FlaggedUTF8, CompressedSize, UncompressedSize, DiskNumber, OffsetLocalHeader);
-			free (Filename);
-                        searchptr += r;
-                        searchlen -= r;
-                } else {
-			DEBUG_PRINT ("[ZIP] just FAILED a central directory header %"PRId32" of %"PRId32"\n", filecounter + 1, Total_number_of_entries_in_the_central_directory);
+	/* disable charset API if all entries as UTF-8 */
+	{
+		int i;
+		int nonUTF8 = 0;
+
+		for (i=1; i < self->dir_fill; i++)
+		{
+			if (!self->dirs[i]->orig_FlaggedUTF8)
+			{
+				nonUTF8 = 1;
+				break;
+			}
+		}
+		if (!nonUTF8)
+		{
+			for (i=0; i < self->file_fill; i++)
+			{
+				if (!self->files[i].orig_FlaggedUTF8)
+				{
+					nonUTF8 = 1;
+					break;
+				}
+			}
+		}
+		if (!nonUTF8)
+		{ /* disable the charset API, since we have no non-UTF8 entries */
+			self->dirs[0]->head.charset_override_API = 0;
+		}
+	}
+
+	if (!self->pending_blob)
+	{
+		uint8_t *metadata = 0;
+		size_t metadatasize = 0;
+		const char *filename = 0;
+
+		zip_instance_encode_blob (self, &metadata, &metadatasize);
+		dirdbGetName_internalstr (self->archive_file->dirdb_ref, &filename);
+		adbMetaAdd (filename, self->archive_file->filesize (self->archive_file), "ZIP", metadata, metadatasize);
+		free (metadata);
+	}
+}
+
+/* Adds up to count entries from the central directory or the adbMeta blob. Returns non-zero if there are more entries left */
+static int zip_instance_parse (struct zip_instance_t *self, uint32_t count)
+{
+	if (!self->pending)
+	{
+		return 0;
+	}
+
+	zip_translate_prepare (self);
+	for (; count && self->pending_left; count--, self->pending_left--)
+	{
+		uint8_t *src = self->pending + self->pending_pos;
+		uint64_t srclen = self->pending_len - self->pending_pos;
+
+		if (self->pending_blob)
+		{
+			uint8_t *eos;
+
+			if ((srclen < 31) || (!(eos = memchr (src + 29, 0, srclen - 29))))
+			{
+				self->pending_failed = 1;
+				break;
+			}
+			zip_instance_add (self,
+				(char *)src + 29,
+				src[28] & 1, /* orig_FlaggedUTF8 */
+				((uint64_t)(src[15]) << 56) | ((uint64_t)(src[14]) << 48) | ((uint64_t)(src[13]) << 40) | ((uint64_t)(src[12]) << 32) |
+				((uint64_t)(src[11]) << 24) | ((uint64_t)(src[10]) << 16) | ((uint64_t)(src[ 9]) <<  8) | ((uint64_t)(src[ 8])      ), /* compressed_filesize */
+				((uint64_t)(src[ 7]) << 56) | ((uint64_t)(src[ 6]) << 48) | ((uint64_t)(src[ 5]) << 40) | ((uint64_t)(src[ 4]) << 32) |
+				((uint64_t)(src[ 3]) << 24) | ((uint64_t)(src[ 2]) << 16) | ((uint64_t)(src[ 1]) <<  8) | ((uint64_t)(src[ 0])      ), /* uncompressed_filesize */
+				((uint32_t)(src[27]) << 24) | ((uint32_t)(src[26]) << 16) | ((uint32_t)(src[25]) <<  8) | ((uint32_t)(src[24])      ), /* compressed_startdisk */
+				((uint64_t)(src[23]) << 56) | ((uint64_t)(src[22]) << 48) | ((uint64_t)(src[21]) << 40) | ((uint64_t)(src[20]) << 32) |
+				((uint64_t)(src[19]) << 24) | ((uint64_t)(src[18]) << 16) | ((uint64_t)(src[17]) <<  8) | ((uint64_t)(src[16])      )  /* compressed_fileoffset_startdisk */);
+			self->pending_pos += eos + 1 - src;
+		} else {
+			uint64_t  CompressedSize;
+			uint64_t  UncompressedSize;
+			uint32_t  DiskNumber;
+			uint64_t  OffsetLocalHeader;
+			uint32_t  CRC;
+			char     *Filename = 0;
+			int       Filename_FlaggedUTF8;
+			int       r, l;
+
+			r = central_directory_header (src, srclen, &CompressedSize, &UncompressedSize, &DiskNumber, &OffsetLocalHeader, &CRC, &Filename, &Filename_FlaggedUTF8);
+			if (r == -1)
+			{
+				DEBUG_PRINT ("[ZIP] just FAILED a central directory header, %"PRIu32" entries left\n", self->pending_left);
+				free (Filename);
+				self->pending_failed = 1;
+				break;
+			}
+			DEBUG_PRINT ("[ZIP] just got a central directory header, %"PRIu32" entries left %s\n", self->pending_left, Filename);
+
+			/* the record is always larger than the filename, so names can never overflow */
+			l = strlen (Filename) + 1;
+			memcpy (self->names + self->names_fill, Filename, l);
 			free (Filename);
-                        return -1;
-                }
-        }
+
+			zip_instance_add (self, self->names + self->names_fill, Filename_FlaggedUTF8, CompressedSize, UncompressedSize, DiskNumber, OffsetLocalHeader);
+			self->names_fill += l;
+			self->pending_pos += r;
+		}
+	}
+	zip_translate_complete (self);
+
+	if (self->pending_left && !self->pending_failed)
+	{
+		return 1;
+	}
+	zip_instance_parse_complete (self);
 	return 0;
 }
 
@@ -952,11 +1136,16 @@ static int zip_scan (struct zip_instance_t *self)
 start_central_directory_record:
 
 	free (buffer); buffer = 0;
-	if (Size_of_the_central_directory > MAX_SIZE_OF_CENTRAL_DIRECTORY)
+	if ((Size_of_the_central_directory > MAX_SIZE_OF_CENTRAL_DIRECTORY) ||
+	    (Total_number_of_entries_in_the_central_directory > (Size_of_the_central_directory / 46))) /* each entry is at least 46 bytes */
 	{
 		goto abort;
 	}
 	buffer = malloc (Size_of_the_central_directory);
+	if (!buffer)
+	{
+		goto abort;
+	}
 
 	if (zip_ensure_disk (self, Number_of_the_disk_with_the_start_of_the_end_of_central_directory) ||
 	    self->archive_filehandle->seek_set (self->archive_filehandle, Offset_of_start_of_central_directory_with_respect_to_the_starting_disk_number))
@@ -980,54 +1169,19 @@ start_central_directory_record:
 		}
 	}
 
-	if (zip_parse_central_directory (self, buffer, Size_of_the_central_directory, Total_number_of_entries_in_the_central_directory))
+	/* the entries are added by zip_instance_parse() when they are needed */
+	self->names = malloc (Size_of_the_central_directory + 1);
+	if ((!self->names) || zip_instance_reserve_files (self, Total_number_of_entries_in_the_central_directory))
 	{
 		goto abort;
 	}
+	self->pending = buffer;
+	self->pending_pos = 0;
+	self->pending_len = Size_of_the_central_directory;
+	self->pending_left = Total_number_of_entries_in_the_central_directory;
+	self->pending_blob = 0;
 
-	free (buffer);
 	zip_io_unref (self);
-
-	/* disable charset API if all entries as UTF-8 */
-	{
-		int i;
-		int nonUTF8 = 0;
-
-		for (i=1; i < self->dir_fill; i++)
-		{
-			if (!self->dirs[i]->orig_FlaggedUTF8)
-			{
-				nonUTF8 = 1;
-				break;
-			}
-		}
-		if (!nonUTF8)
-		{
-			for (i=0; i < self->file_fill; i++)
-			{
-				if (!self->files[i].orig_FlaggedUTF8)
-				{
-					nonUTF8 = 1;
-					break;
-				}
-			}
-		}
-		if (!nonUTF8)
-		{ /* disable the charset API, since we have no non-UTF8 entries */
-			self->dirs[0]->head.charset_override_API = 0;
-		}
-	}
-
-	{
-		uint8_t *metadata = 0;
-		size_t metadatasize = 0;
-		const char *filename = 0;
-
-		zip_instance_encode_blob (self, &metadata, &metadatasize);
-		dirdbGetName_internalstr (self->archive_file->dirdb_ref, &filename);
-		adbMetaAdd (filename, self->archive_file->filesize (self->archive_file), "ZIP", metadata, metadatasize);
-		free (metadata);
-	}
 	return 0;
 abort:
 	free (buffer);
@@ -1092,7 +1246,9 @@ static struct ocpdir_t *zip_check (const struct ocpdirdecompressor_t *self, stru
 	iter->dirs[0]->dir_parent = UINT32_MAX;
 	iter->dirs[0]->dir_next = UINT32_MAX;
 	iter->dirs[0]->dir_child = UINT32_MAX;
+	iter->dirs[0]->dir_child_last = UINT32_MAX;
 	iter->dirs[0]->file_child = UINT32_MAX;
+	iter->dirs[0]->file_child_last = UINT32_MAX;
 	iter->dirs[0]->orig_full_dirpath = 0;
 	iter->dir_fill = 1;
 
@@ -1113,51 +1269,19 @@ static struct ocpdir_t *zip_check (const struct ocpdirdecompressor_t *self, stru
 		dirdbGetName_internalstr (iter->archive_file->dirdb_ref, &filename);
 		if (!adbMetaGet (filename, iter->archive_file->filesize (iter->archive_file), "ZIP", &metadata, &metadatasize))
 		{
-			int i;
-			int nonUTF8 = 0;
-
 			DEBUG_PRINT ("[ZIP] We found adbmeta cache\n");
 			zip_instance_decode_blob (iter, metadata, metadatasize);
-
-			for (i=1; i < iter->dir_fill; i++)
-			{
-				if (!iter->dirs[i]->orig_FlaggedUTF8)
-				{
-					nonUTF8 = 1;
-					break;
-				}
-			}
-			if (!nonUTF8)
-			{
-				for (i=0; i < iter->file_fill; i++)
-				{
-					if (!iter->files[i].orig_FlaggedUTF8)
-					{
-						nonUTF8 = 1;
-						break;
-					}
-				}
-			}
-			if (!nonUTF8)
-			{ /* disable the charset API, since we have no non-UTF8 entries */
-				iter->dirs[0]->head.charset_override_API = 0;
-			}
-
-			free (metadata);
-			iter->ready = 1;
 		}
 	}
 
-	if (!iter->ready)
+	if (!iter->pending)
 	{
 #ifdef ZIP_DEBUG
 		dirdbGetFullname_malloc (file->dirdb_ref, &fullpath, 0);
 		DEBUG_PRINT ("[ZIP %s] file is not ready, SCAN IT!\n", fullpath);
 		free (fullpath);
 #endif
-		zip_translate_prepare (iter);
 		zip_scan (iter);
-		zip_translate_complete (iter);
 	}
 
 	DEBUG_PRINT ("[ZIP] finished creating the datastructures, refcount the ROOT entry\n");
@@ -1201,11 +1325,17 @@ static void zip_instance_unref (struct zip_instance_t *self)
 	for (counter = 0; counter < self->file_fill; counter++)
 	{
 		dirdbUnref (self->files[counter].head.dirdb_ref, dirdb_use_file);
-		free (self->files[counter].orig_full_filepath);
+		zlib_index_free (&self->files[counter].inflate_index);
 	}
 
 	free (self->dirs);
 	free (self->files);
+	free (self->dir_hash);
+	if (!self->pending_blob)
+	{
+		free (self->pending);
+	}
+	free (self->names);
 
 	if (self->archive_file)
 	{
@@ -1288,8 +1418,9 @@ struct zip_instance_ocpdirhandle_t
 	/* fast-mode */
 	uint32_t flatdir;
 
-	uint32_t nextdir;
-	uint32_t nextfile;
+	uint32_t nextfile; /* fast-mode */
+	uint32_t lastdir;  /* entries are appended while the directory is parsed, so remember the last one given */
+	uint32_t lastfile;
 };
 
 static ocpdirhandle_pt zip_dir_readdir_start (struct ocpdir_t *_self, void(*callback_file)(void *token, struct ocpfile_t *),
@@ -1306,8 +1437,9 @@ static ocpdirhandle_pt zip_dir_readdir_start (struct ocpdir_t *_self, void(*call
 	retval->callback_dir = callback_dir;
 	retval->token = token;
 
-	retval->nextfile = self->file_child;
-	retval->nextdir = self->dir_child;
+	retval->nextfile = 0;
+	retval->lastdir = UINT32_MAX;
+	retval->lastfile = UINT32_MAX;
 	retval->flatdir = 0;
 	DEBUG_PRINT ("\n");
 
@@ -1328,7 +1460,8 @@ static ocpdirhandle_pt zip_dir_readflatdir_start (struct ocpdir_t *_self, void(*
 	retval->token = token;
 
 	retval->nextfile = 0;
-	retval->nextdir = UINT32_MAX;
+	retval->lastdir = UINT32_MAX;
+	retval->lastfile = UINT32_MAX;
 	retval->flatdir = 1;
 	DEBUG_PRINT ("\n");
 
@@ -1351,30 +1484,40 @@ static void zip_dir_readdir_cancel (ocpdirhandle_pt _self)
 static int zip_dir_readdir_iterate (ocpdirhandle_pt _self)
 {
 	struct zip_instance_ocpdirhandle_t *self = (struct zip_instance_ocpdirhandle_t *)_self;
+	struct zip_instance_t *owner = self->dir->owner;
+	uint32_t next;
 
 	if (self->flatdir)
 	{
-		if (self->nextfile >= self->dir->owner->file_fill)
+		if (self->nextfile < owner->file_fill)
 		{
-			return 0;
+			self->callback_file (self->token, &owner->files[self->nextfile++].head);
+			return 1;
+		}
+	} else {
+		next = (self->lastdir == UINT32_MAX) ? self->dir->dir_child : owner->dirs[self->lastdir]->dir_next;
+		if (next != UINT32_MAX)
+		{
+			self->callback_dir (self->token, &owner->dirs[next]->head);
+			self->lastdir = next;
+			return 1;
+		}
+		next = (self->lastfile == UINT32_MAX) ? self->dir->file_child : owner->files[self->lastfile].file_next;
+		if (next != UINT32_MAX)
+		{
+			self->callback_file (self->token, &owner->files[next].head);
+			self->lastfile = next;
+			return 1;
 		}
-		self->callback_file (self->token, &self->dir->owner->files[self->nextfile++].head);
-		return 1;
 	}
 
-	if (self->nextdir != UINT32_MAX)
-	{
-		self->callback_dir (self->token, &self->dir->owner->dirs[self->nextdir]->head);
-		self->nextdir = self->dir->owner->dirs[self->nextdir]->dir_next;
-		return 1;
-	}
-	if (self->nextfile != UINT32_MAX)
+	/* everything known so far has been given, add more entries if the directory is not fully parsed yet */
+	if (!owner->pending)
 	{
-		self->callback_file (self->token, &self->dir->owner->files[self->nextfile].head);
-		self->nextfile = self->dir->owner->files[self->nextfile].file_next;
-		return 1;
+		return 0;
 	}
-	return 0;
+	zip_instance_parse (owner, ZIP_PARSE_BATCH);
+	return 1;
 }
 
 static struct ocpdir_t *zip_dir_readdir_dir (struct ocpdir_t *_self, uint32_t dirdb_ref)
@@ -1382,6 +1525,7 @@ static struct ocpdir_t *zip_dir_readdir_dir (struct ocpdir_t *_self, uint32_t di
 	struct zip_instance_dir_t *dir = (struct zip_instance_dir_t *)_self;
 	struct zip_instance_t *self = dir->owner;
 	int i;
+	zip_instance_parse (self, UINT32_MAX);
 	for (i = 0; i < self->dir_fill; i++)
 	{
 		if (self->dirs[i]->head.dirdb_ref == dirdb_ref)
@@ -1398,6 +1542,7 @@ static struct ocpfile_t *zip_dir_readdir_file (struct ocpdir_t *_self, uint32_t
 	struct zip_instance_dir_t *dir = (struct zip_instance_dir_t *)_self;
 	struct zip_instance_t *self = dir->owner;
 	int i;
+	zip_instance_parse (self, UINT32_MAX);
 	for (i = 0; i < self->file_fill; i++)
 	{
 		if (self->files[i].head.dirdb_ref == dirdb_ref)
@@ -1794,6 +1939,124 @@ static int zip_filehandle_read_explode (struct ocpfilehandle_t *_self, void *dst
 	return retval;
 }
 
+/* position the input at the given offset into the compressed data, which might span several disks */
+static int zip_filehandle_seek_compressed (struct zip_instance_filehandle_t *self, uint64_t offset)
+{
+	self->CurrentDisk = self->file->compressed_startdisk;
+	self->CurrentDiskOffset = self->file->compressed_fileoffset_startdisk + self->file->LocalHeaderSize + offset;
+	self->in_buffer_diskpos = 0;
+	self->in_buffer_fill = 0;
+	self->in_buffer_readnext = self->in_buffer;
+
+	while (1)
+	{
+		uint64_t disksize;
+
+		if (zip_ensure_disk (self->owner, self->CurrentDisk) < 0)
+		{
+			return -1;
+		}
+		disksize = self->owner->archive_filehandle->filesize (self->owner->archive_filehandle);
+		if ((disksize == FILESIZE_STREAM) || (disksize == FILESIZE_ERROR))
+		{
+			return -1;
+		}
+		if (self->CurrentDiskOffset < disksize)
+		{
+			return 0;
+		}
+		self->CurrentDiskOffset -= disksize;
+		self->CurrentDisk++;
+	}
+}
+
+static void zip_file_inflate_index_sig (struct zip_instance_file_t *self, char sig[32])
+{
+	snprintf (sig, 32, "ZIPIDX%"PRIx32":%"PRIx64, self->compressed_startdisk, self->compressed_fileoffset_startdisk);
+}
+
+static void zip_file_inflate_index_load (struct zip_instance_file_t *self)
+{
+	unsigned char *metadata = 0;
+	size_t metadatasize = 0;
+	const char *filename = 0;
+	char sig[32];
+
+	if (self->inflate_index_loaded)
+	{
+		return;
+	}
+	self->inflate_index_loaded = 1;
+
+	if (self->inflate_index.fill)
+	{
+		return;
+	}
+
+	zip_file_inflate_index_sig (self, sig);
+	dirdbGetName_internalstr (self->owner->archive_file->dirdb_ref, &filename);
+	if (!adbMetaGet (filename, self->owner->archive_file->filesize (self->owner->archive_file), sig, &metadata, &metadatasize))
+	{
+		zlib_index_deserialize (&self->inflate_index, metadata, metadatasize);
+		free (metadata);
+		metadata = 0;
+	}
+}
+
+static void zip_file_inflate_index_store (struct zip_instance_file_t *self)
+{
+	unsigned char *metadata;
+	size_t metadatasize = 0;
+	const char *filename = 0;
+	char sig[32];
+
+	if ((!self->inflate_index.dirty) || (!self->inflate_index.fill))
+	{
+		return;
+	}
+	self->inflate_index.dirty = 0;
+
+	metadata = zlib_index_serialize (&self->inflate_index, &metadatasize);
+	if (!metadata)
+	{
+		return;
+	}
+	zip_file_inflate_index_sig (self, sig);
+	dirdbGetName_internalstr (self->owner->archive_file->dirdb_ref, &filename);
+	adbMetaAdd (filename, self->owner->archive_file->filesize (self->owner->archive_file), sig, metadata, metadatasize);
+	free (metadata);
+}
+
+/* restart decoding at the access point, instead of at the start of the file */
+static int zip_filehandle_inflate_resume (struct zip_instance_filehandle_t *self, const struct zlib_index_point_t *point)
+{
+	uint8_t prime = 0;
+
+	DEBUG_PRINT ("[ZIP] zip_filehandle_read_inflate resume at access point out=%"PRIu64" in=%"PRIu64"\n", point->out, point->in);
+
+	if (zip_filehandle_seek_compressed (self, point->in - (point->bits ? 1 : 0)))
+	{
+		return -1;
+	}
+	if (point->bits)
+	{
+		if (zip_filehandle_read_fill_inputbuffer (self) || (!self->in_buffer_fill))
+		{
+			return -1;
+		}
+		prime = *self->in_buffer_readnext;
+		self->in_buffer_readnext++;
+		self->in_buffer_fill--;
+	}
+	if (zip_inflate_resume (self->inflate_io, point, prime))
+	{
+		return -1;
+	}
+	self->curpos = point->out;
+
+	return 0;
+}
+
 static int zip_filehandle_read_inflate (struct ocpfilehandle_t *_self, void *dst, int len)
 {
 	struct zip_instance_filehandle_t *self = (struct zip_instance_filehandle_t *)_self;
@@ -1818,23 +2081,38 @@ static int zip_filehandle_read_inflate (struct ocpfilehandle_t *_self, void *dst
 		return 0;
 	}
 
-	if (self->filepos < self->curpos)
-	{ /* we need to reverse-seek */
-		/* reset back to start */
-		DEBUG_PRINT ("[ZIP] zip_filehandle_read_inflate reset, so we can reverse)\n");
+	if ((self->filepos < self->curpos) || (self->filepos >= self->curpos + ZLIB_INDEX_SPAN))
+	{ /* we need to reverse-seek, or we are skipping far enough ahead that an access point might help */
+		const struct zlib_index_point_t *point;
 
-		self->curpos = 0;
-		self->CurrentDisk = self->file->compressed_startdisk;
-		self->CurrentDiskOffset = self->file->compressed_fileoffset_startdisk + self->file->LocalHeaderSize;
-		zip_inflate_done (self->inflate_io);
-		if (zip_inflate_init (self->inflate_io))
+		zip_file_inflate_index_load (self->file);
+		point = zlib_index_lookup (&self->file->inflate_index, self->filepos);
+
+		if (point && ((self->filepos < self->curpos) || (point->out > self->curpos)))
 		{
-			self->error = 1;
-			return -1;
+			if (zip_filehandle_inflate_resume (self, point))
+			{
+				self->error = 1;
+				return -1;
+			}
+		} else if (self->filepos < self->curpos)
+		{
+			/* reset back to start */
+			DEBUG_PRINT ("[ZIP] zip_filehandle_read_inflate reset, so we can reverse)\n");
+
+			self->curpos = 0;
+			self->CurrentDisk = self->file->compressed_startdisk;
+			self->CurrentDiskOffset = self->file->compressed_fileoffset_startdisk + self->file->LocalHeaderSize;
+			zip_inflate_done (self->inflate_io);
+			if (zip_inflate_init (self->inflate_io))
+			{
+				self->error = 1;
+				return -1;
+			}
+			self->in_buffer_diskpos = 0;
+			self->in_buffer_fill = 0;
+			self->in_buffer_readnext = self->in_buffer;
 		}
-		self->in_buffer_diskpos = 0;
-		self->in_buffer_fill = 0;
-		self->in_buffer_readnext = self->in_buffer;
 	}
 
 	while (len)
@@ -1886,6 +2164,10 @@ static int zip_filehandle_read_inflate (struct ocpfilehandle_t *_self, void *dst
 			return -1;
 		} else if (res > 0)
 		{
+			if (self->inflate_io->eof_hit)
+			{
+				zip_file_inflate_index_store (self->file);
+			}
 			continue;
 		}
 
@@ -1907,6 +2189,10 @@ static int zip_filehandle_read_inflate (struct ocpfilehandle_t *_self, void *dst
 			self->error = 1;
 			return -1;
 		}
+		if (self->inflate_io->eof_hit)
+		{
+			zip_file_inflate_index_store (self->file);
+		}
 	}
 
 	return retval;
@@ -2113,6 +2399,10 @@ static struct ocpfilehandle_t *zip_file_open (struct ocpfile_t *_self)
 				free (retval);
 				return 0;
 			}
+			if (CompressionMethod == 8) /* deflate64 uses a 64KB window, not covered by the index */
+			{
+				retval->inflate_io->index = &self->inflate_index;
+			}
 			break;
 
 		case 12: /* bzip2 */
@@ -2211,6 +2501,11 @@ static void zip_filehandle_unref (struct ocpfilehandle_t *_self)
 	{
 		dirdbUnref (self->head.dirdb_ref, dirdb_use_filehandle);
 
+		if (self->inflate_io)
+		{ /* readers rarely decode past the last byte, so EOF is not always seen */
+			zip_file_inflate_index_store (self->file);
+		}
+
 		zip_io_unref (self->owner);
 		zip_instance_unref (self->owner);
 
@@ -2472,6 +2767,8 @@ static void zip_set_byuser_string (struct ocpdir_t *_self, const char *byuser)
 		return;
 	}
 
+	zip_instance_parse (self->owner, UINT32_MAX);
+
 	free (self->owner->charset_override);
 	if (byuser)
 	{
@@ -2537,6 +2834,8 @@ static char **zip_get_test_strings(struct ocpdir_t *__self)
 	char **retval;
 
 	int count = 0, i;
+
+	zip_instance_parse (self, UINT32_MAX);
 	for (i=1; i < self->dir_fill; i++)
 	{
 		count += !self->dirs[i]->orig_FlaggedUTF8;
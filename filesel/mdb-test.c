@@ -24,12 +24,16 @@
 #ifdef flock
 # undef flock
 #endif
+#ifdef fstat
+# undef fstat
+#endif
 #define read mdb_test_read
 #define write mdb_test_write
 #define open mdb_test_open
 #define close mdb_test_close
 #define lseek mdb_test_lseek
 #define flock mdb_test_flock
+#define fstat mdb_test_fstat
 
 static ssize_t mdb_test_read (int fd, void *buf, size_t size);
 static ssize_t mdb_test_write (int fd, void *buf, size_t size);
@@ -37,12 +41,23 @@ static int mdb_test_open(const char *pathname, int flags, ...);
 static off_t mdb_test_lseek (int fd, off_t offset, int whence);
 static int mdb_test_close (int fd);
 static int mdb_test_flock (int fd, int operation);
+static int mdb_test_fstat (int fd, struct stat *st);
 
 #include "mdb.c"
+#include "textindex.c"
 #include "../stuff/compat.c"
 
 int fsWriteModInfo = 1;
-char *cfConfigDir = "/foo/home/ocp/.ocp/";
+struct configAPI_t configAPI = {.ConfigDir = "/foo/home/ocp/.ocp/"};
+const struct dirdbAPI_t dirdbAPI;
+
+void cp437_f_to_utf8_z (const char *src, size_t srclen, char *dst, size_t dstlen)
+{
+}
+
+void latin1_f_to_utf8_z (const char *src, size_t srclen, char *dst, size_t dstlen)
+{
+}
 
 static ssize_t (*mdb_test_read_hook) (int fd, void *buf, size_t size) = 0;
 static ssize_t (*mdb_test_write_hook) (int fd, void *buf, size_t size) = 0;
@@ -50,6 +65,7 @@ static int (*mdb_test_open_hook) (const char *pathname, int flags, mode_t mode)
 static off_t (*mdb_test_lseek_hook) (int fd, off_t offset, int whence) = 0;
 static int (*mdb_test_close_hook) (int fd) = 0;
 static int (*mdb_test_flock_hook) (int fd, int operation) = 0;
+static int (*mdb_test_fstat_hook) (int fd, struct stat *st) = 0;
 
 #define ANSI_COLOR_RED     "\x1b[31m"
 #define ANSI_COLOR_GREEN   "\x1b[32m"
@@ -112,6 +128,14 @@ static int mdb_test_flock (int fd, int operation)
 	_exit(1);
 }
 
+static int mdb_test_fstat (int fd, struct stat *st)
+{
+	if (mdb_test_fstat_hook) return mdb_test_fstat_hook (fd, st);
+	/* the virtual files can not be mapped, this makes mdb.c fall back to read() and an in-memory index */
+	errno = ENOSYS;
+	return -1;
+}
+
 void dirdbGetName_internalstr(uint32_t ref, const char **name)
 {
 	switch (ref)
@@ -190,9 +214,7 @@ void mdb_basic_mdbNew_prepare (void)
 	mdbDirtyMapSize = 64;
 	mdbDirtyMap = calloc (1, mdbDirtyMapSize / 8);
 
-	mdbSearchIndexData = 0;
-	mdbSearchIndexCount = 0;
-	mdbSearchIndexSize = 0;
+	mdbIndexRelease ();
 }
 
 void mdb_basic_mdbNew_finalize (void)
@@ -348,9 +370,7 @@ void mdb_heap1_mdbNew_prepare (int test, int freeN)
 	mdbDirtyMapSize = (test == 1) ? 256 : 24;
 	mdbDirtyMap = calloc (1, mdbDirtyMapSize / 8);
 
-	mdbSearchIndexData = 0;
-	mdbSearchIndexCount = 0;
-	mdbSearchIndexSize = 0;
+	mdbIndexRelease ();
 }
 
 void mdb_heap1_mdbNew_finalize (void)
@@ -442,9 +462,7 @@ void mdb_basic_mdbFree_prepare (void)
 	mdbDirtyMapSize = 64;
 	mdbDirtyMap = calloc (1, mdbDirtyMapSize / 8);
 
-	mdbSearchIndexData = 0;
-	mdbSearchIndexCount = 0;
-	mdbSearchIndexSize = 0;
+	mdbIndexRelease ();
 }
 
 void mdb_basic_mdbFree_finalize (void)
@@ -536,16 +554,14 @@ void mdb_basic_mdbGetModuleReference_prepare (void)
 	mdbDirtyMapSize = 256;
 	mdbDirtyMap = calloc (1, mdbDirtyMapSize / 8);
 
-	mdbSearchIndexData = 0;
-	mdbSearchIndexCount = 0;
-	mdbSearchIndexSize = 0;
+	mdbIndexRelease ();
 }
 
 void mdb_basic_mdbGetModuleReference_finalize (void)
 {
 	free (mdbData);
 	free (mdbDirtyMap);
-	free (mdbSearchIndexData);
+	mdbIndexRelease ();
 }
 
 int mdb_basic_mdbGetModuleReference (void)
@@ -555,7 +571,7 @@ int mdb_basic_mdbGetModuleReference (void)
 	uint32_t r;
 	int i, j;
 
-	fprintf (stderr, ANSI_COLOR_CYAN "MDB mdbGetModuleReference (hash, mdbSearchIndex, deduplication)\n" ANSI_COLOR_RESET);
+	fprintf (stderr, ANSI_COLOR_CYAN "MDB mdbGetModuleReference (hash, index, deduplication)\n" ANSI_COLOR_RESET);
 
 	mdb_basic_mdbGetModuleReference_prepare();
 
@@ -590,36 +606,18 @@ int mdb_basic_mdbGetModuleReference (void)
 	retval |= r;
 	fprintf (stderr, " => %d duplicates - %s\n" ANSI_COLOR_RESET, r, r ? ANSI_COLOR_RED "Failed" : ANSI_COLOR_GREEN "OK");
 
+	fprintf (stderr, "mdbIndexCount: %"PRIu32" %s\n" ANSI_COLOR_RESET, mdbIndexCount, (mdbIndexCount == 10) ? ANSI_COLOR_GREEN "OK" : ANSI_COLOR_RED "Failed");
+	retval |= (mdbIndexCount != 10);
+
 	r = 0;
-	fprintf (stderr, "mdbSearchIndexData is in incrementing order:\n");
-	for (i = 0; i < mdbSearchIndexCount; i++)
-	{
-		fprintf (stderr, "  %8" PRIu64 " 0x%02x%02x%02x%02x%02x%02x%02x\n",
-			mdbData[mdbSearchIndexData[i]].mie.general.size,
-			mdbData[mdbSearchIndexData[i]].mie.general.filename_hash[0],
-			mdbData[mdbSearchIndexData[i]].mie.general.filename_hash[1],
-			mdbData[mdbSearchIndexData[i]].mie.general.filename_hash[2],
-			mdbData[mdbSearchIndexData[i]].mie.general.filename_hash[3],
-			mdbData[mdbSearchIndexData[i]].mie.general.filename_hash[4],
-			mdbData[mdbSearchIndexData[i]].mie.general.filename_hash[5],
-			mdbData[mdbSearchIndexData[i]].mie.general.filename_hash[6]);
-		if (i)
-		{
-			if (mdbData[mdbSearchIndexData[i-1]].mie.general.size > mdbData[mdbSearchIndexData[i]].mie.general.size)
-			{
-				r++;
-			} else if (mdbData[mdbSearchIndexData[i-1]].mie.general.size == mdbData[mdbSearchIndexData[i]].mie.general.size)
-			{
-				int temp = memcmp (mdbData[mdbSearchIndexData[i-1]].mie.general.filename_hash, mdbData[mdbSearchIndexData[i]].mie.general.filename_hash, 7);
-				if (temp >= 0)
-				{
-					r++;
-				}
-			 }
-		}
-	}
+	fprintf (stderr, "Index lookups are stable:");
+	r += (mdbGetModuleReference ("A very long filename - even longer.mp3", 511423) != ref[1]);
+	r += (mdbGetModuleReference ("11111112222222.mod", 4444555) != ref[2]);
+	r += (mdbGetModuleReference ("22222221111111.mod", 4444555) != ref[3]);
+	r += (mdbGetModuleReference ("open cubic player.s3m", 128000) != ref[9]);
+	r += (mdbGetModuleReference ("open cubic player.s3m", 128001) == ref[9]);
 	retval |= r;
-	fprintf (stderr, "  ... %s\n" ANSI_COLOR_RESET, r ? ANSI_COLOR_RED "Failed" : ANSI_COLOR_GREEN "OK");
+	fprintf (stderr, " %s\n" ANSI_COLOR_RESET, r ? ANSI_COLOR_RED "Failed" : ANSI_COLOR_GREEN "OK");
 
 	mdb_basic_mdbGetModuleReference_finalize ();
 
@@ -657,9 +655,7 @@ void mdb_basic_mdbWriteString_prepare (void)
 	mdbDirtyMapSize = 256;
 	mdbDirtyMap = calloc (1, mdbDirtyMapSize / 8);
 
-	mdbSearchIndexData = 0;
-	mdbSearchIndexCount = 0;
-	mdbSearchIndexSize = 0;
+	mdbIndexRelease ();
 }
 
 void mdb_basic_mdbWriteString_finalize (void)
@@ -874,9 +870,7 @@ void mdb_basic_mdbGetString_prepare (void)
 	mdbData = calloc (64, mdbDataSize);
 	mdbDataNextFree = 1;
 
-	mdbSearchIndexData = 0;
-	mdbSearchIndexCount = 0;
-	mdbSearchIndexSize = 0;
+	mdbIndexRelease ();
 }
 
 void mdb_basic_mdbGetString_finalize (void)
@@ -992,16 +986,14 @@ void mdb_basic_mdbWriteModuleInfo_mdbGetModuleInfo_prepare (void)
 	mdbDirtyMapSize = 64;
 	mdbDirtyMap = calloc (1, mdbDirtyMapSize / 8);
 
-	mdbSearchIndexData = 0;
-	mdbSearchIndexCount = 0;
-	mdbSearchIndexSize = 0;
+	mdbIndexRelease ();
 }
 
 void mdb_basic_mdbWriteModuleInfo_mdbGetModuleInfo_finalize (void)
 {
 	free (mdbData);
 	free (mdbDirtyMap);
-	free (mdbSearchIndexData);
+	mdbIndexRelease ();
 }
 
 int mdb_basic_mdbWriteModuleInfo_mdbGetModuleInfo (void)
@@ -1178,6 +1170,95 @@ int mdb_basic_mdbWriteModuleInfo_mdbGetModuleInfo (void)
 	return retval;
 }
 
+static int mdb_basic_mdbSearchText_expect (const char *query, int expected_retval, uint32_t expected_count, uint32_t expected_first)
+{
+	uint32_t *refs = 0, count = 0;
+	int e = 0, r;
+
+	fprintf (stderr, "mdbSearchText(\"%s\"):", query);
+	r = mdbSearchText (query, &refs, &count);
+	if (!!r != !!expected_retval)
+	{
+		fprintf (stderr, ANSI_COLOR_RED " [returned %d]", r);
+		e++;
+	} else if (!r)
+	{
+		if (count != expected_count)
+		{
+			fprintf (stderr, ANSI_COLOR_RED " [%"PRIu32" hits, expected %"PRIu32"]", count, expected_count);
+			e++;
+		} else if (count && (refs[0] != expected_first))
+		{
+			fprintf (stderr, ANSI_COLOR_RED " [first hit is %"PRIu32", expected %"PRIu32"]", refs[0], expected_first);
+			e++;
+		}
+	}
+	free (refs);
+	fprintf (stderr, "%s\n" ANSI_COLOR_RESET, e ? "" : ANSI_COLOR_GREEN " OK");
+	return e;
+}
+
+int mdb_basic_mdbSearchText (void)
+{
+	int retval = 0;
+	uint32_t r1, r2, r3;
+	struct moduleinfostruct m;
+
+	fprintf (stderr, ANSI_COLOR_CYAN "MDB mdbSearchText\n" ANSI_COLOR_RESET);
+
+	mdb_basic_mdbWriteModuleInfo_mdbGetModuleInfo_prepare();
+	mdbFd = -1;
+
+	r1 = mdbGetModuleReference ("first.xm", 1000);
+	r2 = mdbGetModuleReference ("second.s3m", 2000);
+	r3 = mdbGetModuleReference ("third.mod", 3000);
+
+	bzero (&m, sizeof (m));
+	mdbGetModuleInfo (&m, r1);
+	snprintf (m.title, sizeof (m.title), "%s", "Space Debris");
+	snprintf (m.composer, sizeof (m.composer), "%s", "Captain");
+	mdbWriteModuleInfo (r1, &m);
+
+	bzero (&m, sizeof (m));
+	mdbGetModuleInfo (&m, r2);
+	snprintf (m.title, sizeof (m.title), "%s", "Second Reality");
+	snprintf (m.comment, sizeof (m.comment), "%s", "Future Crew, Assembly 93");
+	mdbWriteModuleInfo (r2, &m);
+
+	bzero (&m, sizeof (m));
+	mdbGetModuleInfo (&m, r3);
+	snprintf (m.title, sizeof (m.title), "%s", "Debris of Space");
+	snprintf (m.album, sizeof (m.album), "%s", "Reality check");
+	mdbWriteModuleInfo (r3, &m);
+
+	/* the first search builds the index */
+	retval |= mdb_basic_mdbSearchText_expect ("space debris", 0, 1, r1);
+	retval |= mdb_basic_mdbSearchText_expect ("REALITY", 0, 2, r2);
+	retval |= mdb_basic_mdbSearchText_expect ("debris", 0, 2, r1);
+	retval |= mdb_basic_mdbSearchText_expect ("ture cr", 0, 1, r2);
+	retval |= mdb_basic_mdbSearchText_expect ("nomatch", 0, 0, 0);
+	retval |= mdb_basic_mdbSearchText_expect ("Captain\nSpace", 0, 0, 0); /* fields are not joined */
+	retval |= mdb_basic_mdbSearchText_expect ("de", 1, 0, 0);
+
+	/* changes after that are applied to the index directly */
+	bzero (&m, sizeof (m));
+	mdbGetModuleInfo (&m, r1);
+	bzero (m.title, sizeof (m.title));
+	snprintf (m.title, sizeof (m.title), "%s", "Stardust Memories");
+	mdbWriteModuleInfo (r1, &m);
+
+	retval |= mdb_basic_mdbSearchText_expect ("space debris", 0, 0, 0);
+	retval |= mdb_basic_mdbSearchText_expect ("stardust", 0, 1, r1);
+	retval |= mdb_basic_mdbSearchText_expect ("debris", 0, 1, r3);
+
+	textindex_free (&mdbTextIndex);
+	mdbTextIndexReady = 0;
+	mdbTextIndexStale = 0;
+	mdb_basic_mdbWriteModuleInfo_mdbGetModuleInfo_finalize ();
+
+	return retval;
+}
+
 #ifdef WORDS_BIGENDIAN
 #define BIGlittle_1or1(BIG,little) BIG
 #define BIGlittle_2(MSB,LSB) MSB,LSB
@@ -1257,6 +1338,12 @@ int mdb_basic_mdbInit_open (const char *pathname, int flags, mode_t mode)
 {
 	/* TODO, verify flags and mode.. */
 
+	if ((strlen (pathname) < 12) || strcmp (pathname + strlen (pathname) - 12, "CPMODNFO.DAT"))
+	{ /* CPMODNFO.IDX */
+		errno = ENOENT;
+		return -1;
+	}
+
 	mdb_basic_mdbInit_src_isopen++;
 
 	return 3;
@@ -1334,9 +1421,7 @@ void mdb_basic_mdbInit_prepare (void)
 	mdbDirtyMapSize = 0;
 	mdbDirtyMap = 0;
 
-	mdbSearchIndexData = 0;
-	mdbSearchIndexCount = 0;
-	mdbSearchIndexSize = 0;
+	mdbIndexRelease ();
 
 	mdb_basic_mdbInit_src_pos = 0;
 	mdb_basic_mdbInit_src_isopen = 0;
@@ -1352,7 +1437,7 @@ void mdb_basic_mdbInit_finalize (void)
 {
 	free (mdbData);
 	free (mdbDirtyMap);
-	free (mdbSearchIndexData);
+	mdbIndexRelease ();
 
 	mdb_test_read_hook = 0;
 	mdb_test_open_hook = 0;
@@ -1360,10 +1445,18 @@ void mdb_basic_mdbInit_finalize (void)
 	mdb_test_close_hook = 0;
 }
 
+static int mdb_basic_mdbInit_cmp (const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
 int mdb_basic_mdbInit (void)
 {
 	int retval = 0;
 	struct moduleinfostruct m;
+	uint32_t i;
 	int e;
 
 	fprintf (stderr, ANSI_COLOR_CYAN "MDB mdbInit\n" ANSI_COLOR_RESET);
@@ -1401,21 +1494,32 @@ int mdb_basic_mdbInit (void)
 		fprintf (stderr, ANSI_COLOR_GREEN "OK\n" ANSI_COLOR_RESET);
 	}
 
-	fprintf (stderr, "mdbSearchIndex: ");
-	if (mdbSearchIndexCount != 4)
+	fprintf (stderr, "mdbIndex: ");
+	if (mdbIndexCount != 4)
 	{
-		fprintf (stderr, ANSI_COLOR_RED "mdbSearchIndexCount => %d >= 4\n" ANSI_COLOR_RESET, (int)mdbSearchIndexCount);
-		retval |= 1;
-	} else if ((mdbSearchIndexData[0] != 22) || (mdbSearchIndexData[1] != 15) || (mdbSearchIndexData[2] != 8) || (mdbSearchIndexData[3] != 1))
-	{
-		fprintf (stderr, ANSI_COLOR_RED "mdbSearchIndexData[] => 22, 15, 8, 1 != %d %d %d %d\n" ANSI_COLOR_RESET,
-			(int)mdbSearchIndexData[0],
-			(int)mdbSearchIndexData[1],
-			(int)mdbSearchIndexData[2],
-			(int)mdbSearchIndexData[3]);
+		fprintf (stderr, ANSI_COLOR_RED "mdbIndexCount => %d != 4\n" ANSI_COLOR_RESET, (int)mdbIndexCount);
 		retval |= 1;
 	} else {
-		fprintf (stderr, ANSI_COLOR_GREEN "OK\n" ANSI_COLOR_RESET);
+		uint32_t found[4] = {0, 0, 0, 0};
+		for (i = 0, e = 0; i < mdbIndexBuckets; i++)
+		{
+			if (mdbIndexData[i].ref && (e < 4))
+			{
+				found[e++] = mdbIndexData[i].ref;
+			}
+		}
+		qsort (found, 4, sizeof (found[0]), mdb_basic_mdbInit_cmp);
+		if ((found[0] != 1) || (found[1] != 8) || (found[2] != 15) || (found[3] != 22))
+		{
+			fprintf (stderr, ANSI_COLOR_RED "mdbIndexData[] => 1, 8, 15, 22 != %d %d %d %d\n" ANSI_COLOR_RESET,
+				(int)found[0],
+				(int)found[1],
+				(int)found[2],
+				(int)found[3]);
+			retval |= 1;
+		} else {
+			fprintf (stderr, ANSI_COLOR_GREEN "OK\n" ANSI_COLOR_RESET);
+		}
 	}
 
 	fprintf (stderr, "mdbInfoIsAvailable(1): %s\n" ANSI_COLOR_RESET, mdbInfoIsAvailable (0x00000001) ? ANSI_COLOR_GREEN "OK" : ANSI_COLOR_RED "Failed");
@@ -1523,6 +1627,12 @@ int mdb_basic_mdbUpdate_open (const char *pathname, int flags, mode_t mode)
 {
 	/* TODO, verify flags and mode.. */
 
+	if ((strlen (pathname) < 12) || strcmp (pathname + strlen (pathname) - 12, "CPMODNFO.DAT"))
+	{ /* CPMODNFO.IDX */
+		errno = ENOENT;
+		return -1;
+	}
+
 	mdb_basic_mdbUpdate_isopen++;
 
 	return 3;
@@ -1600,9 +1710,7 @@ void mdb_basic_mdbUpdate_prepare (void)
 	mdbDirtyMapSize = 0;
 	mdbDirtyMap = 0;
 
-	mdbSearchIndexData = 0;
-	mdbSearchIndexCount = 0;
-	mdbSearchIndexSize = 0;
+	mdbIndexRelease ();
 
 	memcpy (mdb_basic_mdbUpdate_data, mdb_basic_mdbInit_src, sizeof (mdb_basic_mdbInit_src));
 	mdb_basic_mdbUpdate_size = sizeof (mdb_basic_mdbInit_src);
@@ -1623,7 +1731,7 @@ void mdb_basic_mdbUpdate_finalize (void)
 {
 	free (mdbData);
 	free (mdbDirtyMap);
-	free (mdbSearchIndexData);
+	mdbIndexRelease ();
 
 	mdb_test_read_hook = 0;
 	mdb_test_write_hook = 0;
@@ -1730,6 +1838,224 @@ int mdb_basic_mdbUpdate (void)
 	return retval;
 }
 
+/* the last test runs against real files, so the hooks pass everything through */
+#undef read
+#undef write
+#undef open
+#undef close
+#undef lseek
+#undef flock
+#undef fstat
+int fstat (int fd, struct stat *st); /* the prototype in <sys/stat.h> was renamed to mdb_test_fstat */
+
+static ssize_t mdb_real_read (int fd, void *buf, size_t size) { return read (fd, buf, size); }
+static ssize_t mdb_real_write (int fd, void *buf, size_t size) { return write (fd, buf, size); }
+static int mdb_real_open (const char *pathname, int flags, mode_t mode) { return open (pathname, flags, mode); }
+static off_t mdb_real_lseek (int fd, off_t offset, int whence) { return lseek (fd, offset, whence); }
+static int mdb_real_close (int fd) { return close (fd); }
+static int mdb_real_flock (int fd, int operation) { return flock (fd, operation); }
+static int mdb_real_fstat (int fd, struct stat *st) { return fstat (fd, st); }
+
+#define MDB_INDEXFILE_COUNT 5000
+
+int mdb_basic_mdbIndexFile (void)
+{
+	int retval = 0;
+	char dir[] = "/tmp/mdb-test-XXXXXX";
+	char path[64];
+	char file[64];
+	static uint32_t ref[MDB_INDEXFILE_COUNT];
+	uint32_t size;
+	char name[32];
+	int e, i;
+
+	fprintf (stderr, ANSI_COLOR_CYAN "MDB CPMODNFO.IDX (mmap, persistent hash index)\n" ANSI_COLOR_RESET);
+
+	if (!mkdtemp (dir))
+	{
+		fprintf (stderr, ANSI_COLOR_RED "mkdtemp() failed: %s\n" ANSI_COLOR_RESET, strerror (errno));
+		return 1;
+	}
+	snprintf (path, sizeof (path), "%s/", dir);
+	configAPI.ConfigDir = path;
+
+	mdb_test_read_hook = mdb_real_read;
+	mdb_test_write_hook = mdb_real_write;
+	mdb_test_open_hook = mdb_real_open;
+	mdb_test_lseek_hook = mdb_real_lseek;
+	mdb_test_close_hook = mdb_real_close;
+	mdb_test_flock_hook = mdb_real_flock;
+	mdb_test_fstat_hook = mdb_real_fstat;
+
+	mdbInit ();
+	for (i = 0; i < MDB_INDEXFILE_COUNT; i++)
+	{
+		snprintf (name, sizeof (name), "file%d.mod", i);
+		ref[i] = mdbGetModuleReference (name, i * 3);
+	}
+	size = mdbDataSize;
+	fprintf (stderr, "%d new references, %"PRIu32" buckets: %s\n" ANSI_COLOR_RESET, MDB_INDEXFILE_COUNT, mdbIndexBuckets, (mdbIndexCount == MDB_INDEXFILE_COUNT) ? ANSI_COLOR_GREEN "OK" : ANSI_COLOR_RED "Failed");
+	retval |= (mdbIndexCount != MDB_INDEXFILE_COUNT);
+	mdbClose ();
+
+	fprintf (stderr, "Reopen uses the mapped database and stored index:");
+	mdbInit ();
+	e = 0;
+	if (!mdbRawData)                           { fprintf (stderr, ANSI_COLOR_RED " [CPMODNFO.DAT not mapped]"); e++; }
+	if (!mdbIndexRawData)                      { fprintf (stderr, ANSI_COLOR_RED " [CPMODNFO.IDX not loaded]"); e++; }
+	if (mdbIndexCount != MDB_INDEXFILE_COUNT)  { fprintf (stderr, ANSI_COLOR_RED " [mdbIndexCount %"PRIu32"]", mdbIndexCount); e++; }
+	for (i = 0; i < MDB_INDEXFILE_COUNT; i++)
+	{
+		snprintf (name, sizeof (name), "file%d.mod", i);
+		if (mdbGetModuleReference (name, i * 3) != ref[i])
+		{
+			fprintf (stderr, ANSI_COLOR_RED " [%s resolved to a different reference]", name);
+			e++;
+			break;
+		}
+	}
+	if (mdbDataSize != size)                   { fprintf (stderr, ANSI_COLOR_RED " [database grew]"); e++; }
+	fprintf (stderr, "%s\n" ANSI_COLOR_RESET, e ? "" : ANSI_COLOR_GREEN " OK");
+	retval |= e;
+	mdbClose ();
+
+	fprintf (stderr, "Stale index is rebuilt:");
+	snprintf (file, sizeof (file), "%s/CPMODNFO.IDX", dir);
+	truncate (file, 16);
+	mdbInit ();
+	e = 0;
+	if (mdbIndexCount != MDB_INDEXFILE_COUNT)  { fprintf (stderr, ANSI_COLOR_RED " [mdbIndexCount %"PRIu32"]", mdbIndexCount); e++; }
+	for (i = 0; i < MDB_INDEXFILE_COUNT; i++)
+	{
+		snprintf (name, sizeof (name), "file%d.mod", i);
+		if (mdbGetModuleReference (name, i * 3) != ref[i])
+		{
+			fprintf (stderr, ANSI_COLOR_RED " [%s resolved to a different reference]", name);
+			e++;
+			break;
+		}
+	}
+	fprintf (stderr, "%s\n" ANSI_COLOR_RESET, e ? "" : ANSI_COLOR_GREEN " OK");
+	retval |= e;
+	mdbClose ();
+
+	fprintf (stderr, "Rebuilt index is stored without any record changing:");
+	mdbInit ();
+	e = 0;
+	if (!mdbIndexRawData)                      { fprintf (stderr, ANSI_COLOR_RED " [CPMODNFO.IDX not loaded]"); e++; }
+	if (mdbIndexCount != MDB_INDEXFILE_COUNT)  { fprintf (stderr, ANSI_COLOR_RED " [mdbIndexCount %"PRIu32"]", mdbIndexCount); e++; }
+	fprintf (stderr, "%s\n" ANSI_COLOR_RESET, e ? "" : ANSI_COLOR_GREEN " OK");
+	retval |= e;
+	mdbClose ();
+
+	snprintf (file, sizeof (file), "%s/CPMODNFO.IDX", dir);
+	unlink (file);
+	snprintf (file, sizeof (file), "%s/CPMODNFO.DAT", dir);
+	unlink (file);
+	rmdir (dir);
+
+	mdb_test_read_hook = 0;
+	mdb_test_write_hook = 0;
+	mdb_test_open_hook = 0;
+	mdb_test_lseek_hook = 0;
+	mdb_test_close_hook = 0;
+	mdb_test_flock_hook = 0;
+	mdb_test_fstat_hook = 0;
+
+	return retval;
+}
+
+int mdb_basic_mdbTextIndexFile (void)
+{
+	int retval = 0;
+	char dir[] = "/tmp/mdb-test-XXXXXX";
+	char path[64];
+	char file[64];
+	struct moduleinfostruct m;
+	uint32_t ref, *refs, count;
+	int e;
+
+	fprintf (stderr, ANSI_COLOR_CYAN "MDB CPMODNFO.TXI (persistent text index)\n" ANSI_COLOR_RESET);
+
+	if (!mkdtemp (dir))
+	{
+		fprintf (stderr, ANSI_COLOR_RED "mkdtemp() failed: %s\n" ANSI_COLOR_RESET, strerror (errno));
+		return 1;
+	}
+	snprintf (path, sizeof (path), "%s/", dir);
+	configAPI.ConfigDir = path;
+
+	mdb_test_read_hook = mdb_real_read;
+	mdb_test_write_hook = mdb_real_write;
+	mdb_test_open_hook = mdb_real_open;
+	mdb_test_lseek_hook = mdb_real_lseek;
+	mdb_test_close_hook = mdb_real_close;
+	mdb_test_flock_hook = mdb_real_flock;
+	mdb_test_fstat_hook = mdb_real_fstat;
+
+	mdbInit ();
+	ref = mdbGetModuleReference ("debris.mod", 1234);
+	bzero (&m, sizeof (m));
+	mdbGetModuleInfo (&m, ref);
+	snprintf (m.title, sizeof (m.title), "%s", "Space Debris");
+	mdbWriteModuleInfo (ref, &m);
+	retval |= mdb_basic_mdbSearchText_expect ("debris", 0, 1, ref);
+	mdbClose ();
+
+	fprintf (stderr, "A change before the first search updates the stored index:");
+	mdbInit ();
+	bzero (&m, sizeof (m));
+	mdbGetModuleInfo (&m, ref);
+	bzero (m.title, sizeof (m.title));
+	snprintf (m.title, sizeof (m.title), "%s", "Stardust Memories");
+	mdbWriteModuleInfo (ref, &m);
+	e = 0;
+	if (!mdbTextIndexReady)                     { fprintf (stderr, ANSI_COLOR_RED " [CPMODNFO.TXI not loaded]"); e++; }
+	if (mdbTextIndexStale)                      { fprintf (stderr, ANSI_COLOR_RED " [index marked stale]"); e++; }
+	fprintf (stderr, "%s\n" ANSI_COLOR_RESET, e ? "" : ANSI_COLOR_GREEN " OK");
+	retval |= e;
+	mdbClose ();
+
+	fprintf (stderr, "Reopen uses the stored index:");
+	mdbInit ();
+	e = 0;
+	if (mdbTextIndexLoad ())                    { fprintf (stderr, ANSI_COLOR_RED " [CPMODNFO.TXI not loaded]"); e++; }
+	mdbTextIndexReady = 1;
+	if (mdbSearchText ("stardust", &refs, &count)) { fprintf (stderr, ANSI_COLOR_RED " [search failed]"); e++; }
+	else
+	{
+		if ((count != 1) || (refs[0] != ref)) { fprintf (stderr, ANSI_COLOR_RED " [new title not found]"); e++; }
+		free (refs);
+	}
+	if (mdbSearchText ("debris", &refs, &count)) { fprintf (stderr, ANSI_COLOR_RED " [search failed]"); e++; }
+	else
+	{
+		if (count)                          { fprintf (stderr, ANSI_COLOR_RED " [old title found]"); e++; }
+		free (refs);
+	}
+	fprintf (stderr, "%s\n" ANSI_COLOR_RESET, e ? "" : ANSI_COLOR_GREEN " OK");
+	retval |= e;
+	mdbClose ();
+
+	snprintf (file, sizeof (file), "%s/CPMODNFO.TXI", dir);
+	unlink (file);
+	snprintf (file, sizeof (file), "%s/CPMODNFO.IDX", dir);
+	unlink (file);
+	snprintf (file, sizeof (file), "%s/CPMODNFO.DAT", dir);
+	unlink (file);
+	rmdir (dir);
+
+	mdb_test_read_hook = 0;
+	mdb_test_write_hook = 0;
+	mdb_test_open_hook = 0;
+	mdb_test_lseek_hook = 0;
+	mdb_test_close_hook = 0;
+	mdb_test_flock_hook = 0;
+	mdb_test_fstat_hook = 0;
+
+	return retval;
+}
+
 int main (int argc, char *argv[])
 {
 	int retval = 0;
@@ -1754,9 +2080,15 @@ int main (int argc, char *argv[])
 
 	retval |= mdb_basic_mdbWriteModuleInfo_mdbGetModuleInfo ();
 
+	retval |= mdb_basic_mdbSearchText ();
+
 	retval |= mdb_basic_mdbInit();
 
 	retval |= mdb_basic_mdbUpdate();
 
+	retval |= mdb_basic_mdbIndexFile();
+
+	retval |= mdb_basic_mdbTextIndexFile();
+
 	return retval;
 }
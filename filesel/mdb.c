@@ -27,10 +27,12 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -41,6 +43,7 @@
 #include "filesystem.h"
 #include "mdb.h"
 #include "pfilesel.h"
+#include "textindex.h"
 #include "stuff/cp437.h"
 #include "stuff/compat.h"
 #include "stuff/imsrtns.h"
@@ -99,12 +102,45 @@ const char mdbsigv2[60] = "Cubic Player Module Information Data Base II\x1B\x00\
 #else
 const char mdbsigv2[60] = "Cubic Player Module Information Data Base II\x1B\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x01";
 #endif
-/* future mmap
-static void  *mdbRawData;
-static size_t mdbRawMapSize;
-*/
+
+/* CPMODNFO.IDX, open-addressing hash index of all the file records in CPMODNFO.DAT, keyed on filename_hash + size */
+struct __attribute__((packed)) mdbindexheader
+{
+	char sig[32];
+	uint32_t buckets;   /* power of two */
+	uint32_t count;     /* number of used buckets */
+	uint32_t nextfree;  /* mdbDataNextFree, so we do not need to scan for it */
+	uint32_t entries;   /* these three must match CPMODNFO.DAT, else the index is stale and is rebuilt */
+	uint64_t datsize;
+	int64_t  datmtime;
+};
+#ifdef WORDS_BIGENDIAN
+static const char mdbindexsig[32] = "Cubic Player MDB Hash Index\x1B\x00\x00\x00\x00";
+#else
+static const char mdbindexsig[32] = "Cubic Player MDB Hash Index\x1B\x00\x00\x00\x01";
+#endif
+
+struct mdbindexbucket
+{
+	uint32_t ref; /* 0 = unused, since record 0 is the header */
+	uint32_t key; /* mdbKeyHash() of the record, so probing and growing do not need to touch mdbData */
+};
+
+#define MDB_INDEX_MIN_BUCKETS 4096
+#define MDB_INDEX_PAGE        4096 /* granularity of mdbIndexDirtyMap, in bytes */
+
+/* mdbData is mapped copy-on-write from CPMODNFO.DAT inside a larger reserved address range, so records can be appended
+ * without moving it, and only the pages we actually touch are ever read from disk. Dirty records are still written back
+ * using mdbDirtyMap. If the reservation runs out, or mmap() is not available, mdbData lives on the heap instead.
+ */
+#define MDB_RESERVE ((sizeof (void *) >= 8) ? ((size_t)1024*1024*1024) : ((size_t)32*1024*1024))
+
+static void  *mdbRawData;      /* NULL if mdbData is on the heap */
+static size_t mdbRawMapSize;   /* size of the reserved range */
+static size_t mdbRawMapUsed;   /* part of the reserved range that is accessible */
 
 static int mdbFd = -1;
+static int mdbIndexFd = -1;
 
 static struct modinfoentry *mdbData;
 static uint32_t             mdbDataSize;
@@ -116,9 +152,34 @@ static unsigned int         mdbDirtyMapSize;  /* should be >= mdbDataSize */
 
        uint8_t              mdbCleanSlate; /* media-db needs to know that we used to be previous version database before we hashed filenames */
 
-static uint32_t            *mdbSearchIndexData;  /* lookup sorted index */
-static uint32_t             mdbSearchIndexCount; /* Number of entries in sorted index */
-static uint32_t             mdbSearchIndexSize;  /* Allocated size in sorted index */
+static struct mdbindexbucket *mdbIndexData;
+static uint32_t               mdbIndexBuckets;   /* power of two */
+static uint32_t               mdbIndexCount;     /* number of used buckets */
+static void                  *mdbIndexRawData;   /* NULL if mdbIndexData is on the heap */
+static size_t                 mdbIndexRawSize;
+static uint8_t               *mdbIndexDirtyMap;  /* one byte per MDB_INDEX_PAGE of mdbIndexData */
+static uint8_t                mdbIndexRewrite;   /* the index file layout changed, write everything */
+
+/* CPMODNFO.TXI, trigram index of the text fields in CPMODNFO.DAT used by mdbSearchText(). It is loaded by the first
+ * search or the first mdbWriteModuleInfo(), kept up to date after that, and stored again by mdbClose(). Only a search
+ * rebuilds it if it is missing or stale.
+ */
+struct __attribute__((packed)) mdbtextheader
+{
+	char sig[32];
+	uint32_t entries;   /* these three must match CPMODNFO.DAT, else the index is stale and is rebuilt */
+	uint64_t datsize;
+	int64_t  datmtime;
+	uint64_t length;    /* of the textindex_serialize() data that follows */
+};
+static const char mdbtextsig[32] = "Cubic Player MDB Text Index\x1B\x00\x00\x00\x01";
+
+#define MDB_TEXT_LEN (MDB_TITLE_LEN + MDB_COMPOSER_LEN + MDB_ARTIST_LEN + MDB_COMMENT_LEN + MDB_TITLE_LEN + 5)
+
+static struct textindex_t     mdbTextIndex;
+static uint8_t                mdbTextIndexReady; /* mdbTextIndex is loaded, and follows all changes */
+static uint8_t                mdbTextIndexStale; /* records were changed while mdbTextIndex was not loaded, so CPMODNFO.TXI can not be trusted even if the stamp matches */
+static struct mdbtextheader   mdbTextStamp;      /* CPMODNFO.DAT as mdbInit() found it, CPMODNFO.TXI must match this and not the file as written since */
 
 int mdbGetModuleType (uint32_t mdb_ref, struct moduletype *dst)
 {
@@ -178,21 +239,37 @@ void mdbUnregisterReadInfo (struct mdbreadinforegstruct *r)
 	DEBUG_PRINT ("mdbUnregisterReadInfo(%s) # WARNING, unable to find entry\n", r->name);
 }
 
+/* mdbReadInfoThreadSafe() can run from several medialib scanner threads at once, and the cp437 converter shares one iconv handle */
+static pthread_mutex_t mdbReadInfoCP437Mutex = PTHREAD_MUTEX_INITIALIZER;
+static void mdbReadInfo_cp437_f_to_utf8_z (const char *src, size_t srclen, char *dst, size_t dstlen)
+{
+	pthread_mutex_lock (&mdbReadInfoCP437Mutex);
+	cp437_f_to_utf8_z (src, srclen, dst, dstlen);
+	pthread_mutex_unlock (&mdbReadInfoCP437Mutex);
+}
+
 /* detect file infomation using 'plugins' */
 static const struct mdbReadInfoAPI_t mdbReadInfoAPI =
 {
-	cp437_f_to_utf8_z,
+	mdbReadInfo_cp437_f_to_utf8_z,
 	latin1_f_to_utf8_z,
 	&dirdbAPI
 };
-int mdbReadInfo (struct moduleinfostruct *m, struct ocpfilehandle_t *f)
+
+/* runs the detectors in list order starting at rinfos. If threadsafe is set, it stops before the first detector that is not
+ * flagged MDB_READINFO_THREADSAFE and stores it in *resume, so the caller can continue later on the main thread */
+static int mdbReadInfoFrom (struct moduleinfostruct *m, struct ocpfilehandle_t *f, const struct mdbreadinforegstruct *rinfos, int threadsafe, const struct mdbreadinforegstruct **resume)
 {
 	char mdbScanBuf[1084];
-	struct mdbreadinforegstruct *rinfos;
 	int maxl;
 
 	DEBUG_PRINT ("mdbReadInfo(f=%p)\n", f);
 
+	if (resume)
+	{
+		*resume = 0;
+	}
+
 	if (f->seek_set (f, 0) < 0)
 	{
 		return 1;
@@ -206,15 +283,135 @@ int mdbReadInfo (struct moduleinfostruct *m, struct ocpfilehandle_t *f)
 		DEBUG_PRINT ("   mdbReadInfo(%s %p %d)\n", path, mdbScanBuf, maxl);
 	}
 
-	/* slow version that also allows more I/O */
-	for (rinfos=mdbReadInfos; rinfos; rinfos=rinfos->next)
+	/* slow version that also allows more I/O. flags and next can be changed by the main thread while the scanner
+	 * threads walk the list, when a lazy plugin links in its detectors (see plinkman.c) */
+	for (; rinfos; rinfos=__atomic_load_n (&rinfos->next, __ATOMIC_ACQUIRE))
+	{
+		if (threadsafe && !(__atomic_load_n (&rinfos->flags, __ATOMIC_ACQUIRE) & MDB_READINFO_THREADSAFE))
+		{
+			*resume = rinfos;
+			return 0;
+		}
 		if (rinfos->ReadInfo)
 			if (rinfos->ReadInfo(m, f, mdbScanBuf, maxl, &mdbReadInfoAPI))
 				return 1;
+	}
 
 	return m->modtype.integer.i != 0;
 }
 
+int mdbReadInfo (struct moduleinfostruct *m, struct ocpfilehandle_t *f)
+{
+	return mdbReadInfoFrom (m, f, mdbReadInfos, 0, 0);
+}
+
+int mdbReadInfoThreadSafe (struct moduleinfostruct *m, struct ocpfilehandle_t *f, const struct mdbreadinforegstruct **resume)
+{
+	return mdbReadInfoFrom (m, f, mdbReadInfos, 1, resume);
+}
+
+int mdbReadInfoResume (struct moduleinfostruct *m, struct ocpfilehandle_t *f, const struct mdbreadinforegstruct *resume)
+{
+	return mdbReadInfoFrom (m, f, resume, 0, 0);
+}
+
+static size_t mdbPageRound (size_t size)
+{
+	size_t ps = sysconf (_SC_PAGE_SIZE);
+	return (size + ps - 1) / ps * ps;
+}
+
+/* map count records of CPMODNFO.DAT, returns non-zero if mmap() is not available and the caller should read() the file instead */
+static int mdbDataMap (uint32_t count)
+{
+	size_t filemap = mdbPageRound ((size_t)count * sizeof (mdbData[0]));
+	void *base;
+
+	if (filemap >= MDB_RESERVE)
+	{
+		return -1;
+	}
+
+	/* reserve address space without backing, then put the file at the start of it */
+	base = mmap (0, MDB_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (base == MAP_FAILED)
+	{
+		return -1;
+	}
+	if (mmap (base, filemap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, mdbFd, 0) == MAP_FAILED)
+	{
+		munmap (base, MDB_RESERVE);
+		return -1;
+	}
+
+	mdbRawData = base;
+	mdbRawMapSize = MDB_RESERVE;
+	mdbRawMapUsed = filemap;
+	mdbData = (struct modinfoentry *)base;
+
+	return 0;
+}
+
+static void mdbDataRelease (void)
+{
+	if (mdbRawData)
+	{
+		munmap (mdbRawData, mdbRawMapSize);
+		mdbRawData = 0;
+		mdbRawMapSize = 0;
+		mdbRawMapUsed = 0;
+	} else {
+		free (mdbData);
+	}
+	mdbData = 0;
+}
+
+/* make room for N records in mdbData, it might move */
+static int mdbDataResize (uint32_t N)
+{
+	size_t need = (size_t)N * sizeof (mdbData[0]);
+	void *t;
+
+	if (mdbRawData)
+	{
+		if (mdbPageRound (need) <= mdbRawMapSize)
+		{
+			size_t newused = mdbPageRound (need);
+			if (newused > mdbRawMapUsed)
+			{ /* make more of the reservation accessible, as anonymous memory past the end of the file */
+				if (mmap ((uint8_t *)mdbRawData + mdbRawMapUsed, newused - mdbRawMapUsed, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | MAP_FIXED, -1, 0) == MAP_FAILED)
+				{
+					return -1;
+				}
+				mdbRawMapUsed = newused;
+			}
+			return 0;
+		}
+
+		/* outgrew the reservation, move everything to the heap */
+		t = malloc (need);
+		if (!t)
+		{
+			return -1;
+		}
+		memcpy (t, mdbData, (size_t)mdbDataSize * sizeof (mdbData[0]));
+		munmap (mdbRawData, mdbRawMapSize);
+		mdbRawData = 0;
+		mdbRawMapSize = 0;
+		mdbRawMapUsed = 0;
+		mdbData = (struct modinfoentry *)t;
+		return 0;
+	}
+
+	t = realloc (mdbData, need);
+	if (!t)
+	{
+		return -1;
+	}
+	mdbData = (struct modinfoentry *)t;
+	return 0;
+}
+
 /* Unit test available */
 static uint32_t mdbNew (int size)
 {
@@ -262,13 +459,11 @@ static uint32_t mdbNew (int size)
 		}
 
 		/* grow mdbData, in GROW chunks */
-		t=realloc(mdbData, N * sizeof(mdbData[0]));
-		if (!t)
+		if (mdbDataResize (N))
 		{
-			DEBUG_PRINT ("mdbNew() realloc(mdbData) failed\n");
+			DEBUG_PRINT ("mdbNew() mdbDataResize() failed\n");
 			return UINT32_MAX;
 		}
-		mdbData=(struct modinfoentry *)t;
 		bzero(mdbData + mdbDataSize, (N - mdbDataSize) * sizeof(mdbData[0]));
 		mdbDataSize = N;
 		for (j=i; j<mdbDataSize; j++) /* all appended entries are dirty */
@@ -387,6 +582,48 @@ b:
 	return 0;
 }
 
+/* the fields mdbSearchText() looks at, separated by newlines so no trigram spans two of them */
+static void mdbTextIndexFormat (char *dst, const struct moduleinfostruct *m)
+{
+	snprintf (dst, MDB_TEXT_LEN, "%s\n%s\n%s\n%s\n%s", m->title, m->composer, m->artist, m->album, m->comment);
+}
+
+static int mdbTextIndexLoad (void)
+{
+	struct mdbtextheader header;
+	unsigned char *data;
+	char *path;
+	int fd, retval = -1;
+
+	if ((mdbFd < 0) || (!mdbTextStamp.entries))
+	{
+		return -1;
+	}
+	makepath_malloc (&path, 0, cfConfigDir, "CPMODNFO.TXI", 0);
+	fd = open (path, O_RDONLY);
+	free (path);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	if ((read (fd, &header, sizeof (header)) == sizeof (header)) &&
+	    (!memcmp (header.sig, mdbtextsig, sizeof (mdbtextsig))) &&
+	    (header.entries == mdbTextStamp.entries) &&
+	    (header.datsize == mdbTextStamp.datsize) &&
+	    (header.datmtime == mdbTextStamp.datmtime) &&
+	    (header.length < ((uint64_t)1 << 31)) &&
+	    (data = malloc (header.length ? header.length : 1)))
+	{
+		if ((read (fd, data, header.length) == (ssize_t)header.length) && (!textindex_deserialize (&mdbTextIndex, data, header.length)))
+		{
+			retval = 0;
+		}
+		free (data);
+	}
+	close (fd);
+	return retval;
+}
+
 int mdbWriteModuleInfo (uint32_t mdb_ref, struct moduleinfostruct *m)
 {
 	int retval = 0;
@@ -398,6 +635,32 @@ int mdbWriteModuleInfo (uint32_t mdb_ref, struct moduleinfostruct *m)
 	assert (mdb_ref < mdbDataSize);
 	assert (mdbData[mdb_ref].mie.general.record_flags == MDB_USED);
 
+	if ((!mdbTextIndexReady) && (!mdbTextIndexStale))
+	{ /* follow the changes from now on, so the stored index stays usable */
+		if (mdbTextIndexLoad ())
+		{
+			mdbTextIndexStale = 1;
+		} else {
+			mdbTextIndexReady = 1;
+		}
+	}
+	if (mdbTextIndexReady)
+	{
+		struct moduleinfostruct old;
+		char oldtext[MDB_TEXT_LEN];
+		char newtext[MDB_TEXT_LEN];
+
+		mdbGetModuleInfo (&old, mdb_ref);
+		mdbTextIndexFormat (oldtext, &old);
+		mdbTextIndexFormat (newtext, m);
+		if (strcmp (oldtext, newtext) && textindex_update (&mdbTextIndex, mdb_ref, oldtext, newtext))
+		{ /* out of memory, drop the index and rebuild it on the next search */
+			textindex_free (&mdbTextIndex);
+			mdbTextIndexReady = 0;
+			mdbTextIndexStale = 1;
+		}
+	}
+
 	/* ensure that there is only zeroes after a possible zero-termination */
 	if (!m->modtype.string.c[0]) m->modtype.string.c[1] = 0;
 	if (!m->modtype.string.c[1]) m->modtype.string.c[2] = 0;
@@ -455,20 +718,269 @@ void mdbScan (struct ocpfile_t *file, uint32_t mdb_ref)
 	}
 }
 
-static int miecmp (const void *a, const void *b)
+static uint32_t mdbKeyHash (const uint8_t *filename_hash, uint64_t size)
+{ /* FNV-1a */
+	uint32_t h = 2166136261u;
+	int i;
+
+	for (i=0; i < 7; i++)
+	{
+		h = (h ^ filename_hash[i]) * 16777619u;
+	}
+	for (i=0; i < 8; i++)
+	{
+		h = (h ^ (uint8_t)(size >> (i * 8))) * 16777619u;
+	}
+	return h;
+}
+
+static uint32_t mdbIndexPut (struct mdbindexbucket *data, uint32_t buckets, uint32_t ref, uint32_t key)
 {
-	struct modinfoentry *c=&mdbData[*(uint32_t *)a];
-	struct modinfoentry *d=&mdbData[*(uint32_t *)b];
-	if (c->mie.general.size==d->mie.general.size)
+	uint32_t i = key & (buckets - 1);
+
+	while (data[i].ref)
 	{
-		return memcmp(c->mie.general.filename_hash, d->mie.general.filename_hash, sizeof (c->mie.general.filename_hash));
+		i = (i + 1) & (buckets - 1);
 	}
-	if (c->mie.general.size < d->mie.general.size)
+	data[i].ref = ref;
+	data[i].key = key;
+
+	return i;
+}
+
+static void mdbIndexRelease (void)
+{
+	if (mdbIndexRawData)
 	{
+		munmap (mdbIndexRawData, mdbIndexRawSize);
+		mdbIndexRawData = 0;
+		mdbIndexRawSize = 0;
+	} else {
+		free (mdbIndexData);
+	}
+	free (mdbIndexDirtyMap);
+	mdbIndexData = 0;
+	mdbIndexBuckets = 0;
+	mdbIndexCount = 0;
+	mdbIndexDirtyMap = 0;
+	mdbIndexRewrite = 0;
+}
+
+/* double the number of buckets, only the index itself is touched */
+static int mdbIndexGrow (void)
+{
+	uint32_t buckets = mdbIndexBuckets ? (mdbIndexBuckets << 1) : MDB_INDEX_MIN_BUCKETS;
+	uint32_t count = mdbIndexCount;
+	struct mdbindexbucket *data;
+	uint8_t *dirtymap;
+	uint32_t i;
+
+	data = calloc (buckets, sizeof (data[0]));
+	dirtymap = calloc (((size_t)buckets * sizeof (data[0]) + MDB_INDEX_PAGE - 1) / MDB_INDEX_PAGE, 1);
+	if ((!data) || (!dirtymap))
+	{
+		free (data);
+		free (dirtymap);
 		return -1;
+	}
+
+	for (i=0; i < mdbIndexBuckets; i++)
+	{
+		if (mdbIndexData[i].ref)
+		{
+			mdbIndexPut (data, buckets, mdbIndexData[i].ref, mdbIndexData[i].key);
+		}
+	}
+
+	mdbIndexRelease ();
+	mdbIndexData = data;
+	mdbIndexBuckets = buckets;
+	mdbIndexCount = count;
+	mdbIndexDirtyMap = dirtymap;
+	mdbIndexRewrite = 1;
+
+	return 0;
+}
+
+/* index every file record in mdbData, this touches the whole database */
+static int mdbIndexRebuild (void)
+{
+	uint32_t i;
+
+	mdbIndexRelease ();
+
+	for (i=0; i < mdbDataSize; i++)
+	{
+		if (mdbData[i].mie.general.record_flags == MDB_USED)
+		{
+			if (((mdbIndexCount + 1) * 2 > mdbIndexBuckets) && mdbIndexGrow ())
+			{
+				return -1;
+			}
+			mdbIndexPut (mdbIndexData, mdbIndexBuckets, i, mdbKeyHash (mdbData[i].mie.general.filename_hash, mdbData[i].mie.general.size));
+			mdbIndexCount++;
+		}
+	}
+	if ((!mdbIndexBuckets) && mdbIndexGrow ())
+	{
+		return -1;
+	}
+	mdbIndexRewrite = 1;
+
+	return 0;
+}
+
+/* use CPMODNFO.IDX if it matches CPMODNFO.DAT */
+static int mdbIndexLoad (const struct stat *st, uint32_t entries)
+{
+	struct mdbindexheader header;
+	struct stat ist;
+	size_t size;
+	void *base;
+
+	if (mdbIndexFd < 0)
+	{
+		return -1;
+	}
+	if (lseek (mdbIndexFd, 0, SEEK_SET) != 0)
+	{
+		return -1;
+	}
+	if (read (mdbIndexFd, &header, sizeof (header)) != sizeof (header))
+	{
+		return -1;
+	}
+	if (memcmp (header.sig, mdbindexsig, sizeof (mdbindexsig)) ||
+	    (header.buckets < MDB_INDEX_MIN_BUCKETS) ||
+	    (header.buckets & (header.buckets - 1)) ||
+	    (header.count * 2 > header.buckets) ||
+	    (header.entries != entries) ||
+	    (header.nextfree > entries) ||
+	    (header.datsize != (uint64_t)st->st_size) ||
+	    (header.datmtime != (int64_t)st->st_mtime))
+	{
+		return -1;
+	}
+	size = sizeof (header) + (size_t)header.buckets * sizeof (mdbIndexData[0]);
+	if (fstat (mdbIndexFd, &ist) || (ist.st_size != size))
+	{
+		return -1;
+	}
+
+	mdbIndexRelease ();
+
+	mdbIndexDirtyMap = calloc (((size_t)header.buckets * sizeof (mdbIndexData[0]) + MDB_INDEX_PAGE - 1) / MDB_INDEX_PAGE, 1);
+	if (!mdbIndexDirtyMap)
+	{
+		return -1;
+	}
+
+	base = mmap (0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, mdbIndexFd, 0);
+	if (base != MAP_FAILED)
+	{
+		mdbIndexRawData = base;
+		mdbIndexRawSize = size;
+		mdbIndexData = (struct mdbindexbucket *)((uint8_t *)base + sizeof (header));
 	} else {
-		return 1;
+		mdbIndexData = malloc ((size_t)header.buckets * sizeof (mdbIndexData[0]));
+		if ((!mdbIndexData) || (read (mdbIndexFd, mdbIndexData, (size_t)header.buckets * sizeof (mdbIndexData[0])) != (ssize_t)((size_t)header.buckets * sizeof (mdbIndexData[0]))))
+		{
+			mdbIndexRelease ();
+			return -1;
+		}
 	}
+	mdbIndexBuckets = header.buckets;
+	mdbIndexCount = header.count;
+	mdbDataNextFree = header.nextfree;
+
+	return 0;
+}
+
+static int mdbIndexWrite (void *buf, size_t len)
+{
+	while (len)
+	{
+		ssize_t res = write (mdbIndexFd, buf, len);
+		if (res < 0)
+		{
+			if ((errno == EAGAIN) || (errno == EINTR))
+			{
+				continue;
+			}
+			return -1;
+		}
+		buf = (uint8_t *)buf + res;
+		len -= res;
+	}
+	return 0;
+}
+
+/* called by mdbUpdate() after CPMODNFO.DAT has been written, so the index can be stamped with its new size and time */
+static void mdbIndexUpdate (void)
+{
+	struct mdbindexheader header;
+	struct stat st;
+	size_t size = (size_t)mdbIndexBuckets * sizeof (mdbIndexData[0]);
+	size_t pages = (size + MDB_INDEX_PAGE - 1) / MDB_INDEX_PAGE;
+	size_t i, j;
+
+	if ((mdbIndexFd < 0) || (!mdbIndexData) || fstat (mdbFd, &st))
+	{
+		return;
+	}
+
+	memset (&header, 0, sizeof (header));
+	memcpy (header.sig, mdbindexsig, sizeof (mdbindexsig));
+	header.buckets = mdbIndexBuckets;
+	header.count = mdbIndexCount;
+	header.nextfree = mdbDataNextFree;
+	header.entries = mdbDataSize;
+	header.datsize = st.st_size;
+	header.datmtime = st.st_mtime;
+
+	if (mdbIndexRewrite)
+	{
+		if (ftruncate (mdbIndexFd, sizeof (header) + size))
+		{
+			goto failed;
+		}
+		memset (mdbIndexDirtyMap, 1, pages);
+		mdbIndexRewrite = 0;
+	}
+
+	if ((lseek (mdbIndexFd, 0, SEEK_SET) != 0) || mdbIndexWrite (&header, sizeof (header)))
+	{
+		goto failed;
+	}
+
+	for (i = 0; i < pages; i++)
+	{
+		size_t from, to;
+
+		if (!mdbIndexDirtyMap[i])
+		{
+			continue;
+		}
+		for (j = i + 1; (j < pages) && mdbIndexDirtyMap[j]; j++)
+		{
+		}
+		from = i * MDB_INDEX_PAGE;
+		to = (j * MDB_INDEX_PAGE < size) ? (j * MDB_INDEX_PAGE) : size;
+		if ((lseek (mdbIndexFd, sizeof (header) + from, SEEK_SET) != (off_t)(sizeof (header) + from)) ||
+		    mdbIndexWrite ((uint8_t *)mdbIndexData + from, to - from))
+		{
+			goto failed;
+		}
+		memset (mdbIndexDirtyMap + i, 0, j - i);
+		i = j;
+	}
+	return;
+
+failed:
+	/* CPMODNFO.DAT is fine, and the index is rebuilt next time since it is not stamped correctly */
+	fprintf (stderr, __FILE__ " write() to \"CPMODNFO.IDX\" failed: %s\n", strerror (errno));
+	close (mdbIndexFd);
+	mdbIndexFd = -1;
 }
 
 /* Unit test is available */
@@ -476,6 +988,8 @@ int mdbInit (void)
 {
 	char *path;
 	struct mdbheader header;
+	struct stat st;
+	int statok;
 	uint32_t i;
 	int retval = 1;
 
@@ -488,10 +1002,9 @@ int mdbInit (void)
 	mdbDirtyMapSize = 0;
 
 	mdbCleanSlate = 1;
+	memset (&mdbTextStamp, 0, sizeof (mdbTextStamp));
 
-	mdbSearchIndexData = 0;
-	mdbSearchIndexCount = 0;
-	mdbSearchIndexSize = 0;
+	mdbIndexRelease ();
 
 	makepath_malloc (&path, 0, cfConfigDir, "CPMODNFO.DAT", 0);
 	fprintf(stderr, "Loading %s .. ", path);
@@ -517,6 +1030,11 @@ int mdbInit (void)
 		goto errorout;
 	}
 
+	/* the index is optional, without it we just have to rebuild it in memory on every startup */
+	makepath_malloc (&path, 0, cfConfigDir, "CPMODNFO.IDX", 0);
+	mdbIndexFd = open (path, O_RDWR | O_CREAT, S_IREAD|S_IWRITE);
+	free (path); path = 0;
+
 	if (read(mdbFd, &header, sizeof(header))!=sizeof(header))
 	{
 		fprintf(stderr, "No header\n");
@@ -542,18 +1060,22 @@ int mdbInit (void)
 		goto errorout;
 	}
 
-	mdbData = malloc(sizeof(struct modinfoentry) * mdbDataSize);
-	if (!mdbData)
+	statok = !fstat (mdbFd, &st);
+	if ((!statok) || (st.st_size < (off_t)mdbDataSize * (off_t)sizeof(*mdbData)) || mdbDataMap (mdbDataSize))
 	{
-		fprintf (stderr, "malloc() failed\n");
-		goto errorout;
-	}
-	memcpy (mdbData, &header, 64);
+		mdbData = malloc(sizeof(struct modinfoentry) * mdbDataSize);
+		if (!mdbData)
+		{
+			fprintf (stderr, "malloc() failed\n");
+			goto errorout;
+		}
+		memcpy (mdbData, &header, 64);
 
-	if (read(mdbFd, &mdbData[1], (mdbDataSize-1)*sizeof(*mdbData))!=(signed)((mdbDataSize-1)*sizeof(*mdbData)))
-	{
-		fprintf(stderr, "Failed to read records\n");
-		goto errorout;
+		if (read(mdbFd, &mdbData[1], (mdbDataSize-1)*sizeof(*mdbData))!=(signed)((mdbDataSize-1)*sizeof(*mdbData)))
+		{
+			fprintf(stderr, "Failed to read records\n");
+			goto errorout;
+		}
 	}
 
 	mdbDirtyMapSize = (mdbDataSize + 255) & ~255;
@@ -564,62 +1086,36 @@ int mdbInit (void)
 		goto errorout;
 	}
 
-	mdbDataNextFree = mdbDataSize;
-	for (i=0; i<mdbDataSize; i++)
+	if ((!statok) || mdbIndexLoad (&st, mdbDataSize))
 	{
-		if (!mdbData[i].mie.general.record_flags)
-		{
-			mdbDataNextFree = i;
-			break;
-		}
-	}
+		fprintf (stderr, "(rebuilding index) ");
 
-
-	for (i=0; i<mdbDataSize; i++)
-	{
-		if (mdbData[i].mie.general.record_flags==MDB_USED)
-		{
-			DEBUG_PRINT("0x%08"PRIx32" is USED GENERAL\n", i);
-			mdbSearchIndexCount++;
-		}
-	}
-	if (mdbSearchIndexCount)
-	{
-		mdbSearchIndexSize = (mdbSearchIndexCount + 31) & ~31;
-		mdbSearchIndexCount = 0;
-		mdbSearchIndexData = malloc(sizeof(uint32_t)*mdbSearchIndexSize);
-		if (!mdbSearchIndexData)
-		{
-			fprintf (stderr, "Failed to allocated mdbSearchIndex\n");
-			goto errorout;
-		}
+		mdbDataNextFree = mdbDataSize;
 		for (i=0; i<mdbDataSize; i++)
 		{
-			if (mdbData[i].mie.general.record_flags==MDB_USED)
+			if (!mdbData[i].mie.general.record_flags)
 			{
-				mdbSearchIndexData[mdbSearchIndexCount++] = i;
+				mdbDataNextFree = i;
+				break;
 			}
 		}
 
-		qsort(mdbSearchIndexData, mdbSearchIndexCount, sizeof(*mdbSearchIndexData), miecmp);
-
-		for (i=0; i<mdbSearchIndexSize; i++)
+		if (mdbIndexRebuild ())
 		{
-			DEBUG_PRINT("%5d => 0x%08"PRIx32" %"PRIu64" 0x%02x%02x%02x%02x%02x%02x%02x%02x\n",
-				i, mdbSearchIndexData[i], mdbData[mdbSearchIndexData[i]].mie.general.size,
-				mdbData[mdbSearchIndexData[i]].mie.general.filename_hash[0],
-				mdbData[mdbSearchIndexData[i]].mie.general.filename_hash[1],
-				mdbData[mdbSearchIndexData[i]].mie.general.filename_hash[2],
-				mdbData[mdbSearchIndexData[i]].mie.general.filename_hash[3],
-				mdbData[mdbSearchIndexData[i]].mie.general.filename_hash[4],
-				mdbData[mdbSearchIndexData[i]].mie.general.filename_hash[5],
-				mdbData[mdbSearchIndexData[i]].mie.general.filename_hash[6],
-				mdbData[mdbSearchIndexData[i]].mie.general.filename_hash[7]);
+			fprintf (stderr, "Failed to allocate index\n");
+			goto errorout;
 		}
 	}
 
 	mdbCleanSlate = 0;
 
+	if (statok)
+	{
+		mdbTextStamp.entries = mdbDataSize;
+		mdbTextStamp.datsize = st.st_size;
+		mdbTextStamp.datmtime = st.st_mtime;
+	}
+
 	fprintf(stderr, "Done\n");
 	return 1;
 errorout:
@@ -630,20 +1126,21 @@ errorout:
 			close (mdbFd);
 		}
 		mdbFd = -1;
+		if (mdbIndexFd >= 0)
+		{
+			close (mdbIndexFd);
+		}
+		mdbIndexFd = -1;
 	}
 
 	free (path);
-	free (mdbData);
+	mdbDataRelease ();
 	free (mdbDirtyMap);
-	free (mdbSearchIndexData);
-	mdbData = 0;
+	mdbIndexRelease ();
 	mdbDataSize = 0;
 	mdbDataNextFree = 1; /* hack to ignore entry #0, which is header */
 	mdbDirtyMap = 0;
 	mdbDirtyMapSize = 0;
-	mdbSearchIndexData = 0;
-	mdbSearchIndexCount = 0;
-	mdbSearchIndexSize = 0;
 	return retval;
 }
 
@@ -655,16 +1152,19 @@ void mdbUpdate (void)
 
 	DEBUG_PRINT("mdbUpdate: mdbDirty=%d fsWriteModInfo=%d\n", mdbDirty, fsWriteModInfo);
 
-	if ((!mdbDirty)||(!fsWriteModInfo)||(mdbFd<0))
+	if ((!fsWriteModInfo)||(mdbFd<0)||(!mdbDataSize))
 	{
 		return;
 	}
-	mdbDirty=0;
-
-	if (!mdbDataSize)
-	{ /* should not happen */
+	if (!mdbDirty)
+	{ /* a rebuilt index is stored even if no record changed, else it is rebuilt again on every start */
+		if (mdbIndexRewrite)
+		{
+			mdbIndexUpdate ();
+		}
 		return;
 	}
+	mdbDirty=0;
 
 	lseek(mdbFd, 0, SEEK_SET);
 	memcpy(header->sig, mdbsigv2, sizeof(mdbsigv2));
@@ -673,19 +1173,25 @@ void mdbUpdate (void)
 
 	for (i = 0; i < mdbDataSize; i += 8)
 	{
-		/* we write in 512 byte chunks - fits old hard-drives sector size */
+		uint32_t j;
+
+		/* we track in 512 byte chunks - fits old hard-drives sector size */
 		if (!mdbDirtyMap[i / 8])
 		{
 			continue;
 		}
+		/* and neighbouring dirty chunks are merged into a single write */
+		for (j = i + 8; (j < mdbDataSize) && mdbDirtyMap[j / 8]; j += 8)
+		{
+		}
 
 		lseek(mdbFd, (uint64_t)i*sizeof(*mdbData), SEEK_SET);
 		while (1)
 		{
 			ssize_t res;
 
-			DEBUG_PRINT("  [0x%08"PRIx32" -> 0x%08"PRIx32"] DIRTY\n", i, i+7);
-			res = write(mdbFd, mdbData + i, 8 * sizeof(*mdbData));
+			DEBUG_PRINT("  [0x%08"PRIx32" -> 0x%08"PRIx32"] DIRTY\n", i, j-1);
+			res = write(mdbFd, mdbData + i, (j - i) * sizeof(*mdbData));
 			if (res < 0)
 			{
 				if (errno==EAGAIN)
@@ -694,38 +1200,179 @@ void mdbUpdate (void)
 					continue;
 				fprintf(stderr, __FILE__ " write() to \"CPMODNFO.DAT\" failed: %s\n", strerror(errno));
 				exit(1);
-			} else if (res != (signed)((8)*sizeof(*mdbData)))
+			} else if (res != (signed)((j - i)*sizeof(*mdbData)))
 			{
 				fprintf(stderr, __FILE__ " write() to \"CPMODNFO.DAT\" returned only partial data\n");
 				exit(1);
 			} else
 				break;
 		}
-		mdbDirtyMap[i / 8] = 0;
+		memset (mdbDirtyMap + i / 8, 0, (j - i) / 8);
+		i = j;
 	}
+
+	mdbIndexUpdate ();
+}
+
+/* on failure the index is left empty, a partial index would make searches miss records */
+static int mdbTextIndexRebuild (void)
+{
+	struct moduleinfostruct m;
+	char text[MDB_TEXT_LEN];
+	uint32_t i;
+
+	textindex_free (&mdbTextIndex);
+	for (i=1; i < mdbDataSize; i++)
+	{
+		if (mdbData[i].mie.general.record_flags == MDB_USED)
+		{
+			mdbGetModuleInfo (&m, i);
+			mdbTextIndexFormat (text, &m);
+			if (textindex_update (&mdbTextIndex, i, 0, text))
+			{
+				textindex_free (&mdbTextIndex);
+				return -1;
+			}
+		}
+	}
+	mdbTextIndex.dirty = 1;
+	return 0;
+}
+
+/* store CPMODNFO.TXI, stamped with the current state of CPMODNFO.DAT */
+static void mdbTextIndexStore (void)
+{
+	struct mdbtextheader header;
+	struct stat st;
+	unsigned char *data;
+	size_t length;
+	char *path;
+	int fd;
+
+	if ((!mdbTextIndexReady) || (!mdbTextIndex.dirty) || (!fsWriteModInfo) || (mdbFd < 0) || mdbDirty || fstat (mdbFd, &st))
+	{
+		return;
+	}
+	data = textindex_serialize (&mdbTextIndex, &length);
+	if (!data)
+	{
+		return;
+	}
+	makepath_malloc (&path, 0, cfConfigDir, "CPMODNFO.TXI", 0);
+	fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, S_IREAD|S_IWRITE);
+	free (path);
+	if (fd < 0)
+	{
+		free (data);
+		return;
+	}
+
+	memset (&header, 0, sizeof (header));
+	memcpy (header.sig, mdbtextsig, sizeof (mdbtextsig));
+	header.entries = mdbDataSize;
+	header.datsize = st.st_size;
+	header.datmtime = st.st_mtime;
+	header.length = length;
+	if ((write (fd, &header, sizeof (header)) != sizeof (header)) ||
+	    (write (fd, data, length) != (ssize_t)length))
+	{
+		fprintf (stderr, __FILE__ " write() to \"CPMODNFO.TXI\" failed: %s\n", strerror (errno));
+		/* a short file never passes the checks in mdbTextIndexLoad() */
+		ftruncate (fd, 0);
+	} else {
+		mdbTextIndex.dirty = 0;
+	}
+	close (fd);
+	free (data);
+}
+
+/* Unit test available */
+int mdbSearchText (const char *query, uint32_t **mdb_refs, uint32_t *count)
+{
+	struct moduleinfostruct m;
+	char text[MDB_TEXT_LEN];
+	char *upper;
+	uint32_t i, fill = 0;
+
+	*mdb_refs = 0;
+	*count = 0;
+
+	if (!mdbTextIndexReady)
+	{
+		if (mdbTextIndexStale || mdbTextIndexLoad ())
+		{
+			fprintf (stderr, "Building text index of CPMODNFO.DAT .. ");
+			if (mdbTextIndexRebuild ())
+			{ /* not ready, the caller falls back to scanning everything */
+				fprintf (stderr, "Failed\n");
+				return -1;
+			}
+			fprintf (stderr, "Done\n");
+		}
+		mdbTextIndexReady = 1;
+		mdbTextIndexStale = 0;
+	}
+
+	upper = strdup (query);
+	if (!upper)
+	{
+		return -1;
+	}
+	strupr (upper);
+	if (textindex_query (&mdbTextIndex, upper, mdb_refs, count))
+	{
+		free (upper);
+		return -1;
+	}
+
+	/* the index gives the candidates that contain all the trigrams, verify that they contain the entire string */
+	for (i=0; i < *count; i++)
+	{
+		uint32_t ref = (*mdb_refs)[i];
+		if ((ref >= mdbDataSize) || (mdbData[ref].mie.general.record_flags != MDB_USED))
+		{
+			continue;
+		}
+		mdbGetModuleInfo (&m, ref);
+		mdbTextIndexFormat (text, &m);
+		if (strstr (strupr (text), upper))
+		{
+			(*mdb_refs)[fill++] = ref;
+		}
+	}
+	*count = fill;
+
+	free (upper);
+	return 0;
 }
 
 void mdbClose (void)
 {
 	mdbUpdate();
+	mdbTextIndexStore();
+	textindex_free (&mdbTextIndex);
+	mdbTextIndexReady = 0;
+	mdbTextIndexStale = 0;
+	memset (&mdbTextStamp, 0, sizeof (mdbTextStamp));
 	if (mdbFd >= 0)
 	{
 		close(mdbFd);
 		mdbFd = -1;
 	}
-	free(mdbData);
+	if (mdbIndexFd >= 0)
+	{
+		close(mdbIndexFd);
+		mdbIndexFd = -1;
+	}
+	mdbDataRelease();
 	free(mdbDirtyMap);
-	free(mdbSearchIndexData);
+	mdbIndexRelease();
 
-	mdbData = 0;
 	mdbDataSize = 0;
 	mdbDataNextFree = 1;
 	mdbDirty = 0;
 	mdbDirtyMap = 0;
 	mdbDirtyMapSize = 0;
-	mdbSearchIndexData = 0;
-	mdbSearchIndexCount = 0;
-	mdbSearchIndexSize = 0;
 }
 
 /* Unit test available */
@@ -733,9 +1380,7 @@ static uint32_t mdbGetModuleReference (const char *name, uint64_t size)
 {
 	uint32_t i;
 
-	uint32_t *min=mdbSearchIndexData;
-	uint32_t num=mdbSearchIndexCount;
-	uint32_t mn;
+	uint32_t key, slot;
 	struct modinfoentry *m;
 	uint8_t hash[8]; /* to byte align with header, byte 0 is ignored */
 
@@ -748,87 +1393,43 @@ static uint32_t mdbGetModuleReference (const char *name, uint64_t size)
 		hash[1+i%7]       += name[i];
 		hash[1+((i+1)%7)] ^= name[i];
 	}
-
-	/* Iterate fast.. If size to to big, set current to be the minimum, and
-	 * set the current to point in the new center, else half the current.
-	 *
-	 * That code is VERY clever. Took me some minutes to read it :-) nice
-	 * work guys
-	 *   - Stian
-	 */
+	key = mdbKeyHash (hash + 1, size);
 
 	DEBUG_PRINT("mdbGetModuleReference(%s=>0x%02x%02x%0x%02x%02x%02x%02x %"PRIu64")\n", name, hash[1], hash[2], hash[3], hash[4], hash[5], hash[6], hash[7], size);
-	while (num)
+	if (mdbIndexBuckets)
 	{
-		struct modinfoentry *m=&mdbData[min[num>>1]];
-		int ret;
-#ifdef MDB_DEBUG
+		for (slot = key & (mdbIndexBuckets - 1); mdbIndexData[slot].ref; slot = (slot + 1) & (mdbIndexBuckets - 1))
 		{
-			uint32_t x;
-			for (x = 0; x < num; x++)
+			uint32_t ref = mdbIndexData[slot].ref;
+
+			if ((mdbIndexData[slot].key != key) || (ref >= mdbDataSize))
 			{
-				DEBUG_PRINT("  %08x %"PRIu64" 0x%02x%02x%02x%02x%02x%02x%02x\n",
-					min[x],
-					mdbData[min[x]].mie.general.size,
-					mdbData[min[x]].mie.general.filename_hash[0],
-					mdbData[min[x]].mie.general.filename_hash[1],
-					mdbData[min[x]].mie.general.filename_hash[2],
-					mdbData[min[x]].mie.general.filename_hash[3],
-					mdbData[min[x]].mie.general.filename_hash[4],
-					mdbData[min[x]].mie.general.filename_hash[5],
-					mdbData[min[x]].mie.general.filename_hash[6]);
+				continue;
 			}
-			DEBUG_PRINT("  ----------\n");
-		}
-#endif
-		if (size==m->mie.general.size)
-		{
-			ret = memcmp(hash+1, m->mie.general.filename_hash, 7);
-		} else {
-			if (size < m->mie.general.size)
+			m = &mdbData[ref];
+			if ((m->mie.general.record_flags == MDB_USED) && (m->mie.general.size == size) && !memcmp (hash + 1, m->mie.general.filename_hash, 7))
 			{
-				ret = -1;
-			} else {
-				ret = 1;
+				DEBUG_PRINT("mdbGetModuleReference(\"%s\" %"PRIu64") => index => 0x%08"PRIx32"\n", name, size, ref);
+				return ref;
 			}
 		}
-		if (!ret)
-		{
-			DEBUG_PRINT("mdbGetModuleReference(\"%s\" %"PRIu64") => mdbSearchIndexData => 0x%08"PRIx32"\n", name, size, min[num>>1]);
-			return min[num>>1];
-		}
-		if (ret<0)
-		{
-			num >>= 1;
-		} else {
-			min += (num >> 1)  + 1;
-			num  = (num  - 1) >> 1;
-		}
 	}
-	mn = min - mdbSearchIndexData;
 
-	i=mdbNew(1);
-	if (i==UINT32_MAX)
+	/* keep the index at most half full, so probe sequences stay short */
+	if (((mdbIndexCount + 1) * 2 > mdbIndexBuckets) && mdbIndexGrow ())
 	{
 		return UINT32_MAX;
 	}
-	if (mdbSearchIndexCount == mdbSearchIndexSize)
+
+	i=mdbNew(1);
+	if (i==UINT32_MAX)
 	{
-		void *n;
-		mdbSearchIndexSize += 512;
-		if (!(n = realloc(mdbSearchIndexData, sizeof (*mdbSearchIndexData) * mdbSearchIndexSize)))
-		{
-			mdbFree (i, 1);
-			return UINT32_MAX;
-		}
-		mdbSearchIndexData = (uint32_t *)n;
+		return UINT32_MAX;
 	}
 
-	memmove( mdbSearchIndexData + mn + 1,
-	         mdbSearchIndexData + mn,
-		(mdbSearchIndexCount - mn ) * sizeof (*mdbSearchIndexData));
-	mdbSearchIndexData[mn]=i;
-	mdbSearchIndexCount++;
+	slot = mdbIndexPut (mdbIndexData, mdbIndexBuckets, i, key);
+	mdbIndexCount++;
+	mdbIndexDirtyMap[(size_t)slot * sizeof (mdbIndexData[0]) / MDB_INDEX_PAGE] = 1;
 
 	m = &mdbData[i];
 	memcpy (m->mie.general.filename_hash, hash + 1, 7);
@@ -921,3 +1522,19 @@ int mdbGetModuleInfo (struct moduleinfostruct *m, uint32_t mdb_ref)
 	mdbGetString (m->album,    sizeof (m->album),    mdbData[mdb_ref].mie.general.album_ref);
 	return 1;
 }
+
+void mdbWritePlaytime (struct moduleinfostruct *m, struct ocpfilehandle_t *f, uint32_t ms)
+{
+	uint32_t playtime = (ms + 500) / 1000;
+	uint32_t mdb_ref;
+	struct moduleinfostruct mi;
+
+	m->playtime = (playtime > 0xffff) ? 0xffff : playtime;
+
+	mdb_ref = mdbGetModuleReference2 (f->dirdb_ref, f->filesize (f));
+	if ((mdb_ref != 0xffffffff) && mdbGetModuleInfo (&mi, mdb_ref) && (mi.playtime != m->playtime))
+	{
+		mi.playtime = m->playtime;
+		mdbWriteModuleInfo (mdb_ref, &mi);
+	}
+}
@@ -63,9 +63,12 @@ struct mdbreadinforegstruct /* this is to test a file, and give it a tag..*/
 	const char *name; /* for debugging */
 	// buf includes the first 1084 byte of the file, enought to include signature in .MOD files */
 	int (*ReadInfo)(struct moduleinfostruct *m, struct ocpfilehandle_t *f, const char *buf, size_t len, const struct mdbReadInfoAPI_t *API);
+	int flags;
 	struct mdbreadinforegstruct *next;
 };
 
+#define MDB_READINFO_THREADSAFE 1 /* ReadInfo only touches m, f and buf, and can be run from the medialib scanner threads */
+
 #define MDBREADINFOREGSTRUCT_TAIL ,0
 
 struct ocpfile_t;
@@ -73,6 +76,8 @@ struct ocpfile_t;
 int mdbGetModuleType (uint32_t fileref, struct moduletype *dst);
 int mdbInfoIsAvailable (uint32_t fileref); // used to be mdbInfoRead
 int mdbReadInfo(struct moduleinfostruct *m, struct ocpfilehandle_t *f);
+int mdbReadInfoThreadSafe(struct moduleinfostruct *m, struct ocpfilehandle_t *f, const struct mdbreadinforegstruct **resume); // stops at the first detector without MDB_READINFO_THREADSAFE, *resume is then non-NULL
+int mdbReadInfoResume(struct moduleinfostruct *m, struct ocpfilehandle_t *f, const struct mdbreadinforegstruct *resume); // continue from mdbReadInfoThreadSafe() on the main thread
 int mdbWriteModuleInfo(uint32_t fileref, struct moduleinfostruct *m); // returns zero on error
 void mdbScan(struct ocpfile_t *file, uint32_t mdb_ref);
 int mdbInit(void); // returns zero on error
@@ -80,6 +85,12 @@ void mdbUpdate(void);
 void mdbClose(void);
 uint32_t mdbGetModuleReference2(const uint32_t dirdb_ref, uint64_t size);
 int mdbGetModuleInfo(struct moduleinfostruct *m, uint32_t fileref); // returns zero on error
+void mdbWritePlaytime(struct moduleinfostruct *m, struct ocpfilehandle_t *f, uint32_t ms); // for players that know the exact length, updates m (the session copy) and the database
+
+/* Finds the modules where title, composer, artist, album or comment contains query, ignoring case. *fileref is sorted
+ * and must be free()ed. Returns non-zero if query is too short to be searched for using the index.
+ */
+int mdbSearchText(const char *query, uint32_t **fileref, uint32_t *count);
 
 void mdbRegisterReadInfo(struct mdbreadinforegstruct *r);
 void mdbUnregisterReadInfo(struct mdbreadinforegstruct *r);
@@ -75,6 +75,7 @@
 #include "filesystem.h"
 #include "filesystem-drive.h"
 #include "filesystem-file-dev.h"
+#include "filesystem-filehandle-cache.h"
 #include "filesystem-bzip2.h"
 #include "filesystem-gzip.h"
 #include "filesystem-pak.h"
@@ -410,7 +411,7 @@ void fsTypeUnregister (struct moduletype modtype)
 	{
 		if (fsTypes[i].modtype.integer.i == modtype.integer.i)
 		{
-			memmove (fsTypes + i, fsTypes + i + 1, fsTypesCount - i - 1);
+			memmove (fsTypes + i, fsTypes + i + 1, (fsTypesCount - i - 1) * sizeof (fsTypes[0]));
 			fsTypesCount--;
 			if (!fsTypesCount)
 			{
@@ -645,6 +646,7 @@ int fsListRemove=1;
 int fsLoopMods=1;
 int fsScanNames=1;
 int fsScanArcs=0;
+int fsScanThreads=0;
 int fsScanInArc=1;
 int fsScrType=0;
 int fsEditWin=1;
@@ -654,6 +656,23 @@ int fsPutArcs=1;
 int fsWriteModInfo=1;
 int fsShowAllFiles=0;
 static int fsPlaylistOnly=0;
+static int fsPrefetch=1;
+static int fsPrefetchDelay=5;  /* seconds into the current file */
+static int fsPrefetchSize=64;  /* MB, larger files are not prefetched */
+static int fsFileCache=16;     /* MB, shared block cache for files inside archives */
+
+/* While a file plays, the next playlist entry is picked in advance, read into memory a chunk at the time and detected
+ * from memory, so fsGetNextFile() does not have to wait for the storage. Every step is done from a separate call to
+ * fsPrefetchIdle(), since the render thread is held out meanwhile */
+#define PREFETCH_CHUNK 65536
+static enum {PrefetchWait, PrefetchOpen, PrefetchRead, PrefetchDetect, PrefetchDone} prefetchstate = PrefetchDone;
+static uint64_t prefetchstart;             /* clock_ms() when the current file was handed out */
+static struct ocpfile_t *prefetchfile;     /* the entry that was picked */
+static unsigned int prefetchpick;          /* playlist index of prefetchfile, at the time it was picked */
+static struct ocpfilehandle_t *prefetchsrc;
+static char *prefetchdata;
+static uint64_t prefetchfill, prefetchsize;
+static struct ocpfilehandle_t *prefetchready; /* the entire file is in memory */
 
 int fsFilesLeft(void)
 {
@@ -705,6 +724,172 @@ void fsRescanDir(void)
 	conSave();
 }
 
+static void fsPrefetchReset (int restart)
+{
+	if (prefetchsrc)
+	{
+		prefetchsrc->unref (prefetchsrc);
+		prefetchsrc = 0;
+	}
+	if (prefetchready)
+	{
+		prefetchready->unref (prefetchready);
+		prefetchready = 0;
+	}
+	if (prefetchfile)
+	{
+		prefetchfile->unref (prefetchfile);
+		prefetchfile = 0;
+	}
+	free (prefetchdata);
+	prefetchdata = 0;
+	prefetchfill = prefetchsize = 0;
+
+	prefetchstate = (restart && fsPrefetch) ? PrefetchWait : PrefetchDone;
+	prefetchstart = clock_ms();
+}
+
+/* Files inside archives are read through the shared block cache, since the archive readers are slow at small reads and seeks */
+static struct ocpfilehandle_t *fsOpenCached (struct ocpfile_t *file)
+{
+	struct ocpfilehandle_t *fh = file->open (file);
+	struct ocpfilehandle_t *retval;
+	struct ocpdir_t *d;
+
+	if ((!fh) || (!fsFileCache))
+	{
+		return fh;
+	}
+	for (d = file->parent; d; d = d->parent)
+	{
+		if (d->is_archive)
+		{
+			break;
+		}
+	}
+	if (!d)
+	{
+		return fh;
+	}
+	retval = cache_filehandle_open (fh);
+	fh->unref (fh);
+	return retval;
+}
+
+/* returns the prefetched handle if m is the entry that was prefetched */
+static struct ocpfilehandle_t *fsPrefetchTake (struct modlistentry *m)
+{
+	struct ocpfilehandle_t *retval = 0;
+
+	if (prefetchready && (m->file == prefetchfile))
+	{
+		retval = prefetchready;
+		prefetchready = 0;
+		retval->seek_set (retval, 0);
+	}
+	return retval;
+}
+
+void fsPrefetchIdle (void)
+{
+	struct modlistentry *m;
+
+	cache_filehandle_idle ();
+
+	switch (prefetchstate)
+	{
+		case PrefetchDone:
+			return;
+		case PrefetchWait:
+		{
+			struct moduleinfostruct info;
+
+			if ((clock_ms() - prefetchstart) < (uint64_t)fsPrefetchDelay * 1000)
+				return;
+			prefetchstate = PrefetchDone;
+
+			/* an entry picked in the fileselector is opened right away anyway */
+			if ((isnextplay != NextPlayNone) || (!playlist->num))
+				return;
+
+			prefetchpick = fsListScramble ? (rand() % playlist->num) : playlist->pos;
+			m = modlist_get (playlist, prefetchpick);
+			if ((!m) || (!m->file) || m->file->is_nodetect)
+				return;
+
+			mdbGetModuleInfo (&info, m->mdb_ref);
+			if (info.flags & MDB_VIRTUAL)
+				return;
+			prefetchfile = m->file;
+			prefetchfile->ref (prefetchfile);
+			prefetchstate = PrefetchOpen;
+			return;
+		}
+		case PrefetchOpen:
+		{
+			uint64_t filesize;
+
+			prefetchstate = PrefetchDone;
+			if (!(prefetchsrc = prefetchfile->open (prefetchfile)))
+				return;
+			filesize = prefetchsrc->filesize_ready (prefetchsrc) ? prefetchsrc->filesize (prefetchsrc) : FILESIZE_STREAM;
+			if ((filesize == FILESIZE_STREAM) || (filesize == FILESIZE_ERROR) || (!filesize) || (filesize > ((uint64_t)fsPrefetchSize << 20)) ||
+			    (!(prefetchdata = malloc (filesize))))
+			{
+				prefetchsrc->unref (prefetchsrc);
+				prefetchsrc = 0;
+				return;
+			}
+			prefetchsize = filesize;
+			prefetchstate = PrefetchRead;
+			return;
+		}
+		case PrefetchRead:
+		{
+			int len = ((prefetchsize - prefetchfill) > PREFETCH_CHUNK) ? PREFETCH_CHUNK : (prefetchsize - prefetchfill);
+
+			if (prefetchsrc->read (prefetchsrc, prefetchdata + prefetchfill, len) != len)
+			{
+				prefetchsrc->unref (prefetchsrc);
+				prefetchsrc = 0;
+				free (prefetchdata);
+				prefetchdata = 0;
+				prefetchstate = PrefetchDone;
+				return;
+			}
+			prefetchfill += len;
+			if (prefetchfill < prefetchsize)
+				return;
+
+			prefetchsrc->unref (prefetchsrc);
+			prefetchsrc = 0;
+			/* takes ownership of prefetchdata. Reads never reach the real file, since the head covers all of it */
+			prefetchready = cache_filehandle_open_pre (prefetchfile, prefetchdata, prefetchsize, 0, 0);
+			if (!prefetchready)
+				free (prefetchdata);
+			prefetchdata = 0;
+			prefetchstate = prefetchready ? PrefetchDetect : PrefetchDone;
+			return;
+		}
+		case PrefetchDetect:
+		{
+			struct moduleinfostruct info;
+
+			prefetchstate = PrefetchDone;
+			if (!prefetchready) /* already taken by fsGetNextFile() */
+				return;
+			m = modlist_get (playlist, prefetchpick);
+			if ((!m) || (m->file != prefetchfile) || mdbInfoIsAvailable (m->mdb_ref))
+				return;
+			/* the detectors only see the copy in memory, so they never reach the archive readers */
+			mdbGetModuleInfo (&info, m->mdb_ref);
+			mdbReadInfo (&info, prefetchready); /* detect info... */
+			mdbWriteModuleInfo (m->mdb_ref, &info);
+			return;
+		}
+	}
+}
+
 int fsGetPrevFile (struct moduleinfostruct *info, struct ocpfilehandle_t **filehandle)
 {
 	struct modlistentry *m;
@@ -743,7 +928,7 @@ int fsGetPrevFile (struct moduleinfostruct *info, struct ocpfilehandle_t **fileh
 	{
 		if (m->file)
 		{
-			*filehandle = m->file->open (m->file);
+			*filehandle = fsOpenCached (m->file);
 		}
 
 		if (*filehandle)
@@ -769,6 +954,7 @@ int fsGetPrevFile (struct moduleinfostruct *info, struct ocpfilehandle_t **fileh
 	{
 		modlist_remove(playlist, pick);
 	}
+	fsPrefetchReset (retval);
 	return retval;
 }
 
@@ -801,10 +987,16 @@ int fsGetNextFile (struct moduleinfostruct *info, struct ocpfilehandle_t **fileh
 				return retval;
 			}
 			if (fsListScramble)
-				pick = rand() % playlist->num;
-			else
+			{
+				/* keep the random pick that was prefetched, if the playlist did not change under it */
+				if (prefetchfile && (prefetchpick < playlist->num) && (modlist_get (playlist, prefetchpick)->file == prefetchfile))
+					pick = prefetchpick;
+				else
+					pick = rand() % playlist->num;
+			} else
 				pick = playlist->pos;
 			m=modlist_get (playlist, pick);
+			*filehandle = fsPrefetchTake (m);
 			break;
 		default:
 			fprintf(stderr, "BUG in pfilesel.c: fsGetNextFile() Invalid isnextplay\n");
@@ -813,9 +1005,9 @@ int fsGetNextFile (struct moduleinfostruct *info, struct ocpfilehandle_t **fileh
 
 	mdbGetModuleInfo(info, m->mdb_ref);
 
-	if (m->file)
+	if (m->file && !*filehandle)
 	{
-		*filehandle = m->file->open (m->file);
+		*filehandle = fsOpenCached (m->file);
 	}
 
 	if (*filehandle)
@@ -851,9 +1043,50 @@ int fsGetNextFile (struct moduleinfostruct *info, struct ocpfilehandle_t **fileh
 				playlist->pos=pick;
 			}
 	}
+	fsPrefetchReset (retval);
 	return retval;
 }
 
+unsigned int fsPlaylistCount(void)
+{
+	return playlist->num;
+}
+
+int fsGetPlaylistFile (unsigned int index, struct moduleinfostruct *info, struct ocpfilehandle_t **filehandle)
+{
+	struct modlistentry *m;
+
+	*filehandle = 0;
+
+	m = modlist_get (playlist, index);
+	if (!m)
+	{
+		return 0;
+	}
+
+	mdbGetModuleInfo(info, m->mdb_ref);
+
+	if (m->file)
+	{
+		*filehandle = fsOpenCached (m->file);
+	}
+
+	if (!*filehandle)
+	{
+		return 0;
+	}
+
+	if (!mdbInfoIsAvailable(m->mdb_ref))
+	{
+		mdbReadInfo(info, *filehandle); /* detect info... */
+		(*filehandle)->seek_set (*filehandle, 0);
+		mdbWriteModuleInfo(m->mdb_ref, info);
+		mdbGetModuleInfo(info, m->mdb_ref);
+	}
+
+	return 1;
+}
+
 void fsForceRemove(const uint32_t dirdbref)
 {
 	modlist_remove_all_by_path(playlist, dirdbref);
@@ -892,6 +1125,12 @@ int fsPreInit(void)
 	fsScanInArc=cfGetProfileBool2(sec, "fileselector", "scaninarcs", 1, 1);
 	fsScanNames=cfGetProfileBool2(sec, "fileselector", "scanmodinfo", 1, 1);
 	fsScanArcs=cfGetProfileBool2(sec, "fileselector", "scanarchives", 1, 1);
+	fsScanThreads=cfGetProfileInt2(sec, "fileselector", "scanthreads", 0, 10);
+	fsPrefetch=cfGetProfileBool2(sec, "fileselector", "prefetch", 1, 1);
+	fsPrefetchDelay=cfGetProfileInt2(sec, "fileselector", "prefetchdelay", 5, 10);
+	fsPrefetchSize=cfGetProfileInt2(sec, "fileselector", "prefetchsize", 64, 10);
+	fsFileCache=cfGetProfileInt2(sec, "fileselector", "filecache", 16, 10);
+	cache_filehandle_setlimit ((uint64_t)fsFileCache << 20);
 	fsListRemove=cfGetProfileBool2(sec, "fileselector", "playonce", 1, 1);
 	fsListScramble=cfGetProfileBool2(sec, "fileselector", "randomplay", 1, 1);
 	fsPutArcs=cfGetProfileBool2(sec, "fileselector", "putarchives", 1, 1);
@@ -1019,6 +1258,9 @@ int fsInit(void)
 
 void fsClose(void)
 {
+	fsPrefetchReset (0);
+	cache_filehandle_flush ();
+
 	if (currentdir)
 	{
 		modlist_free(currentdir);
@@ -10,6 +10,9 @@ struct cpifaceplayerstruct;
 extern int fsGetNextFile (struct moduleinfostruct *info, struct ocpfilehandle_t **filehandle); /* info comes from external buffer */
 extern int fsGetPrevFile (struct moduleinfostruct *info, struct ocpfilehandle_t **filehandle); /* info comes from external buffer */
 extern int fsFilesLeft(void);
+extern unsigned int fsPlaylistCount(void); /* used by --render, which does not use the normal playlist order */
+extern int fsGetPlaylistFile (unsigned int index, struct moduleinfostruct *info, struct ocpfilehandle_t **filehandle); /* info comes from external buffer. The entry is not removed */
+extern void fsPrefetchIdle (void); /* called every frame while playing, prepares the file fsGetNextFile() is going to return */
 extern signed int fsFileSelect(void);
 /* extern char fsAddFiles(const char *);      use the playlist instead..*/
 extern int fsPreInit(void);
@@ -26,6 +29,7 @@ extern int fsLoopMods;
 extern int fsScanNames;
 extern int fsScanArcs;
 extern int fsScanInArc;
+extern int fsScanThreads;
 extern int fsScrType;
 extern int fsEditWin;
 extern int fsColorTypes;
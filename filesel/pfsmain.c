@@ -37,9 +37,13 @@
 #define NO_PFILESEL_IMPORT
 #include "config.h"
 #include <assert.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include "types.h"
 
 #include "boot/plinkman.h"
@@ -53,6 +57,7 @@
 #include "mdb.h"
 #include "pfilesel.h"
 #include "stuff/err.h"
+#include "stuff/poll.h"
 #include "stuff/poutput.h"
 
 
@@ -100,13 +105,13 @@ static interfaceReturnEnum stop;
  * -1 - error occurred
  */
 
-static int callselector (struct moduleinfostruct *info,
-                         struct ocpfilehandle_t **fi,
-                         enumAutoCallFS callfs,
-                         enumForceCallFS forcecall,
-                         enumForceNext forcenext,
-                         const struct interfacestruct     **iface,
-                         const struct cpifaceplayerstruct **ifacep)
+static int callselector_ (struct moduleinfostruct *info,
+                          struct ocpfilehandle_t **fi,
+                          enumAutoCallFS callfs,
+                          enumForceCallFS forcecall,
+                          enumForceNext forcenext,
+                          const struct interfacestruct     **iface,
+                          const struct cpifaceplayerstruct **ifacep)
 {
 	int ret;
 	int result;
@@ -191,6 +196,176 @@ static int callselector (struct moduleinfostruct *info,
 	return 0;
 }
 
+/* The current player is still open while the file selector runs. The file selector shares archive handles, dirdb,
+ * mdb and adbMeta with it, so the audio render thread is held off all the time, except while framelock() sleeps.
+ */
+static int callselector (struct moduleinfostruct *info,
+                         struct ocpfilehandle_t **fi,
+                         enumAutoCallFS callfs,
+                         enumForceCallFS forcecall,
+                         enumForceNext forcenext,
+                         const struct interfacestruct     **iface,
+                         const struct cpifaceplayerstruct **ifacep)
+{
+	int retval;
+
+	tmSetSecure();
+	retval = callselector_ (info, fi, callfs, forcecall, forcenext, iface, ifacep);
+	tmReleaseSecure();
+
+	return retval;
+}
+
+/* --render: play one playlist entry through the interface without any screen, see plmpRenderHeadless() */
+static int fsRenderFile (unsigned int index)
+{
+	struct moduleinfostruct info;
+	struct ocpfilehandle_t *f = 0;
+	const struct interfacestruct *intr = 0;
+	const struct cpifaceplayerstruct *cp = 0;
+	struct preprocregstruct *prep;
+	const char *filename = "";
+
+	if (!fsGetPlaylistFile (index, &info, &f))
+	{
+		fprintf (stderr, "[render] #%u: failed to open file\n", index);
+		return -1;
+	}
+	dirdbGetName_internalstr (f->dirdb_ref, &filename);
+
+	plFindInterface (info.modtype, &intr, &cp);
+	if ((!intr) || strcmp (intr->name, "plOpenCP"))
+	{ /* other interfaces can not run without a screen */
+		fprintf (stderr, "[render] %s: not a playable file\n", filename);
+		f->unref (f);
+		return -1;
+	}
+
+	for (prep=plPreprocess; prep; prep=prep->next)
+	{
+		prep->Preprocess(&info, &f);
+	}
+
+	fprintf (stderr, "[render] %s\n", filename);
+	if (!intr->Init (&info, f, cp))
+	{
+		fprintf (stderr, "[render] %s: failed to start playback\n", filename);
+		f->unref (f);
+		return -1;
+	}
+	while (intr->Run() == interfaceReturnContinue)
+	{
+	}
+	intr->Close();
+
+	f->unref (f);
+	return 0;
+}
+
+/* --render: render every file in the playlist once, -j<n> of them in parallel. The players keep their state in
+ * globals, so each job is a forked process. The parent hands out playlist indexes through a pipe, so a job that gets
+ * short files picks up more of them.
+ */
+static int fsRender (void)
+{
+	unsigned int count = fsPlaylistCount();
+	unsigned int i;
+	int jobs = cfGetProfileInt("CommandLine", "j", 1, 10);
+	int fds[2];
+	int failed = 0;
+	int j;
+
+	if (!count)
+	{
+		fprintf (stderr, "[render] no files given\n");
+		return errGen;
+	}
+
+	if (jobs <= 0)
+	{
+		long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+		jobs = (cpus > 0) ? cpus : 1;
+	}
+	if (jobs > 64)
+	{
+		jobs = 64;
+	}
+	if (jobs > count)
+	{
+		jobs = count;
+	}
+
+	if ((jobs == 1) || pipe (fds))
+	{
+		for (i=0; i < count; i++)
+		{
+			failed |= !!fsRenderFile (i);
+		}
+		return failed ? errGen : errOk;
+	}
+
+	fflush (stdout);
+	fflush (stderr);
+	for (j=0; j < jobs; j++)
+	{
+		pid_t pid = fork ();
+		if (pid < 0)
+		{
+			fprintf (stderr, "[render] fork() failed, continuing with %d jobs\n", j);
+			break;
+		}
+		if (!pid)
+		{
+			close (fds[1]);
+			while (read (fds[0], &i, sizeof (i)) == sizeof (i))
+			{
+				failed |= !!fsRenderFile (i);
+			}
+			fflush (stdout);
+			fflush (stderr);
+			/* skip all the normal shutdown, the parent owns the databases */
+			_exit (failed ? 1 : 0);
+		}
+	}
+	close (fds[0]);
+
+	if (!j)
+	{
+		close (fds[1]);
+		for (i=0; i < count; i++)
+		{
+			failed |= !!fsRenderFile (i);
+		}
+		return failed ? errGen : errOk;
+	}
+
+	/* if every job has died, write() should fail instead of killing us */
+	signal (SIGPIPE, SIG_IGN);
+
+	/* writes of less than PIPE_BUF bytes are atomic, so each index reaches exactly one job */
+	for (i=0; i < count; i++)
+	{
+		if (write (fds[1], &i, sizeof (i)) != sizeof (i))
+		{
+			fprintf (stderr, "[render] write() to the job pipe failed\n");
+			failed = 1;
+			break;
+		}
+	}
+	close (fds[1]);
+
+	while (j--)
+	{
+		int status;
+		if ((wait (&status) < 0) || (!WIFEXITED (status)) || WEXITSTATUS (status))
+		{
+			failed = 1;
+		}
+	}
+
+	return failed ? errGen : errOk;
+}
+
 static int _fsMain(int argc, char *argv[])
 {
 	const struct interfacestruct     *plintr        = 0;
@@ -225,6 +400,13 @@ static int _fsMain(int argc, char *argv[])
 		return errGen;
 	}
 
+	if (cfGetProfileBool("CommandLine--", "render", 0, 0))
+	{
+		int retval = fsRender();
+		lnkPluginCloseAll(&PluginCloseAPI);
+		return retval;
+	}
+
 	conSave();
 
 	callfs=DoNotAutoCallFS;
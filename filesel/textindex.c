@@ -0,0 +1,463 @@
+/* OpenCP Module Player
+ * copyright (c) 2022 Stian Skjelstad <stian.skjelstad@gmail.com>
+ *
+ * Trigram inverted index, for substring searches in the medialib
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "textindex.h"
+
+/*
+ serialized format, all numbers are little endian:
+
+  4 bytes number of trigrams
+
+ per trigram:
+  4 bytes trigram
+  4 bytes number of documents
+  4 bytes per document, sorted
+*/
+
+void textindex_free (struct textindex_t *self)
+{
+	uint32_t i;
+
+	for (i=0; i < self->size; i++)
+	{
+		free (self->buckets[i].docs);
+	}
+	free (self->buckets);
+	self->buckets = 0;
+	self->size = 0;
+	self->fill = 0;
+	self->dirty = 0;
+}
+
+static int textindex_cmp (const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+/* sorted and unique trigrams of text, returns the count or -1 on out of memory */
+static int textindex_trigrams (const char *text, uint32_t **trigrams)
+{
+	size_t len = strlen (text);
+	int count = 0, i, j;
+
+	*trigrams = 0;
+	if (len < 3)
+	{
+		return 0;
+	}
+	*trigrams = malloc ((len - 2) * sizeof (uint32_t));
+	if (!*trigrams)
+	{
+		return -1;
+	}
+	for (i=0; i + 2 < len; i++)
+	{
+		uint8_t a = toupper ((uint8_t)text[i]);
+		uint8_t b = toupper ((uint8_t)text[i + 1]);
+		uint8_t c = toupper ((uint8_t)text[i + 2]);
+
+		if ((a == '\n') || (b == '\n') || (c == '\n'))
+		{
+			continue;
+		}
+		(*trigrams)[count++] = (a << 16) | (b << 8) | c;
+	}
+	qsort (*trigrams, count, sizeof (uint32_t), textindex_cmp);
+	for (i=0, j=0; i < count; i++)
+	{
+		if ((!j) || ((*trigrams)[j - 1] != (*trigrams)[i]))
+		{
+			(*trigrams)[j++] = (*trigrams)[i];
+		}
+	}
+	return j;
+}
+
+static struct textindex_posting_t *textindex_find (struct textindex_t *self, uint32_t trigram)
+{
+	uint32_t i;
+
+	if (!self->size)
+	{
+		return 0;
+	}
+	for (i = (trigram * 2654435761u) & (self->size - 1); self->buckets[i].trigram; i = (i + 1) & (self->size - 1))
+	{
+		if (self->buckets[i].trigram == trigram)
+		{
+			return self->buckets + i;
+		}
+	}
+	return 0;
+}
+
+static struct textindex_posting_t *textindex_findoradd (struct textindex_t *self, uint32_t trigram)
+{
+	uint32_t i;
+
+	/* keep the table at most half full */
+	if ((self->fill + 1) * 2 > self->size)
+	{
+		uint32_t newsize = self->size ? (self->size << 1) : 4096;
+		struct textindex_posting_t *newbuckets = calloc (newsize, sizeof (newbuckets[0]));
+
+		if (!newbuckets)
+		{
+			return 0;
+		}
+		for (i=0; i < self->size; i++)
+		{
+			if (self->buckets[i].trigram)
+			{
+				uint32_t j;
+				for (j = (self->buckets[i].trigram * 2654435761u) & (newsize - 1); newbuckets[j].trigram; j = (j + 1) & (newsize - 1))
+				{
+				}
+				newbuckets[j] = self->buckets[i];
+			}
+		}
+		free (self->buckets);
+		self->buckets = newbuckets;
+		self->size = newsize;
+	}
+
+	for (i = (trigram * 2654435761u) & (self->size - 1); self->buckets[i].trigram; i = (i + 1) & (self->size - 1))
+	{
+		if (self->buckets[i].trigram == trigram)
+		{
+			return self->buckets + i;
+		}
+	}
+	self->buckets[i].trigram = trigram;
+	self->buckets[i].sorted = 1;
+	self->fill++;
+	return self->buckets + i;
+}
+
+static void textindex_sort (struct textindex_posting_t *p)
+{
+	uint32_t i, j;
+
+	if (p->sorted)
+	{
+		return;
+	}
+	qsort (p->docs, p->count, sizeof (p->docs[0]), textindex_cmp);
+	for (i=0, j=0; i < p->count; i++)
+	{
+		if ((!j) || (p->docs[j - 1] != p->docs[i]))
+		{
+			p->docs[j++] = p->docs[i];
+		}
+	}
+	p->count = j;
+	p->sorted = 1;
+}
+
+static int textindex_posting_add (struct textindex_posting_t *p, uint32_t doc)
+{
+	if (p->count == p->size)
+	{
+		uint32_t newsize = p->size ? (p->size + (p->size >> 1)) : 4;
+		uint32_t *temp = realloc (p->docs, newsize * sizeof (p->docs[0]));
+		if (!temp)
+		{
+			return -1;
+		}
+		p->docs = temp;
+		p->size = newsize;
+	}
+	if (p->count && (p->docs[p->count - 1] >= doc))
+	{
+		p->sorted = 0;
+	}
+	p->docs[p->count++] = doc;
+	return 0;
+}
+
+static void textindex_posting_remove (struct textindex_posting_t *p, uint32_t doc)
+{
+	uint32_t i;
+
+	if (p->sorted)
+	{
+		uint32_t *hit = bsearch (&doc, p->docs, p->count, sizeof (p->docs[0]), textindex_cmp);
+		if (hit)
+		{
+			memmove (hit, hit + 1, (p->count - (hit - p->docs) - 1) * sizeof (p->docs[0]));
+			p->count--;
+		}
+		return;
+	}
+	/* an unsorted list might contain doc more than once */
+	for (i=0; i < p->count;)
+	{
+		if (p->docs[i] == doc)
+		{
+			p->docs[i] = p->docs[--p->count];
+		} else {
+			i++;
+		}
+	}
+}
+
+int textindex_update (struct textindex_t *self, uint32_t doc, const char *oldtext, const char *newtext)
+{
+	uint32_t *oldtri = 0, *newtri = 0;
+	int oldcount = 0, newcount = 0;
+	int i = 0, j = 0;
+	int retval = 0;
+
+	if (oldtext && ((oldcount = textindex_trigrams (oldtext, &oldtri)) < 0))
+	{
+		return -1;
+	}
+	if (newtext && ((newcount = textindex_trigrams (newtext, &newtri)) < 0))
+	{
+		free (oldtri);
+		return -1;
+	}
+
+	/* both lists are sorted, so only the differences are touched */
+	while ((i < oldcount) || (j < newcount))
+	{
+		if ((j >= newcount) || ((i < oldcount) && (oldtri[i] < newtri[j])))
+		{
+			struct textindex_posting_t *p = textindex_find (self, oldtri[i]);
+			if (p)
+			{
+				textindex_posting_remove (p, doc);
+				self->dirty = 1;
+			}
+			i++;
+		} else if ((i >= oldcount) || (newtri[j] < oldtri[i]))
+		{
+			struct textindex_posting_t *p = textindex_findoradd (self, newtri[j]);
+			if ((!p) || textindex_posting_add (p, doc))
+			{
+				retval = -1;
+				break;
+			}
+			self->dirty = 1;
+			j++;
+		} else {
+			i++;
+			j++;
+		}
+	}
+
+	free (oldtri);
+	free (newtri);
+	return retval;
+}
+
+int textindex_query (struct textindex_t *self, const char *query, uint32_t **docs, uint32_t *count)
+{
+	uint32_t *tri;
+	struct textindex_posting_t **p;
+	int tricount, i, smallest = 0;
+	uint32_t j, fill = 0;
+
+	*docs = 0;
+	*count = 0;
+
+	tricount = textindex_trigrams (query, &tri);
+	if (tricount <= 0)
+	{
+		free (tri);
+		return -1;
+	}
+
+	p = malloc (tricount * sizeof (p[0]));
+	if (!p)
+	{
+		free (tri);
+		return -1;
+	}
+	for (i=0; i < tricount; i++)
+	{
+		p[i] = textindex_find (self, tri[i]);
+		if ((!p[i]) || (!p[i]->count))
+		{ /* a trigram that is not found anywhere, nothing can match */
+			free (p);
+			free (tri);
+			return 0;
+		}
+		textindex_sort (p[i]);
+		if (p[i]->count < p[smallest]->count)
+		{
+			smallest = i;
+		}
+	}
+	free (tri);
+
+	*docs = malloc (p[smallest]->count * sizeof (uint32_t));
+	if (!*docs)
+	{
+		free (p);
+		return -1;
+	}
+
+	/* start with the shortest list, and look up each candidate in the others */
+	for (j=0; j < p[smallest]->count; j++)
+	{
+		uint32_t doc = p[smallest]->docs[j];
+		for (i=0; i < tricount; i++)
+		{
+			if ((i != smallest) && (!bsearch (&doc, p[i]->docs, p[i]->count, sizeof (uint32_t), textindex_cmp)))
+			{
+				break;
+			}
+		}
+		if (i == tricount)
+		{
+			(*docs)[fill++] = doc;
+		}
+	}
+	free (p);
+
+	*count = fill;
+	return 0;
+}
+
+static void put32 (unsigned char *dst, uint32_t src)
+{
+	dst[0] = src;
+	dst[1] = src >> 8;
+	dst[2] = src >> 16;
+	dst[3] = src >> 24;
+}
+
+static uint32_t get32 (const unsigned char *src)
+{
+	return ((uint32_t)src[3] << 24) | ((uint32_t)src[2] << 16) | ((uint32_t)src[1] << 8) | src[0];
+}
+
+unsigned char *textindex_serialize (struct textindex_t *self, size_t *datasize)
+{
+	unsigned char *retval;
+	size_t size = 4, fill = 4;
+	uint32_t i, j, used = 0;
+
+	for (i=0; i < self->size; i++)
+	{
+		if (self->buckets[i].trigram && self->buckets[i].count)
+		{
+			textindex_sort (self->buckets + i);
+			size += 8 + 4 * (size_t)self->buckets[i].count;
+			used++;
+		}
+	}
+
+	retval = malloc (size);
+	if (!retval)
+	{
+		return 0;
+	}
+	put32 (retval, used);
+	for (i=0; i < self->size; i++)
+	{
+		if (self->buckets[i].trigram && self->buckets[i].count)
+		{
+			put32 (retval + fill, self->buckets[i].trigram);
+			put32 (retval + fill + 4, self->buckets[i].count);
+			fill += 8;
+			for (j=0; j < self->buckets[i].count; j++)
+			{
+				put32 (retval + fill, self->buckets[i].docs[j]);
+				fill += 4;
+			}
+		}
+	}
+
+	*datasize = fill;
+	return retval;
+}
+
+int textindex_deserialize (struct textindex_t *self, const unsigned char *data, size_t datasize)
+{
+	uint32_t used, i, j;
+	size_t pos = 4;
+
+	textindex_free (self);
+
+	if (datasize < 4)
+	{
+		return -1;
+	}
+	used = get32 (data);
+	if (used > (datasize / 8))
+	{
+		return -1;
+	}
+
+	for (i=0; i < used; i++)
+	{
+		struct textindex_posting_t *p;
+		uint32_t trigram, count;
+
+		if (pos + 8 > datasize)
+		{
+			goto error;
+		}
+		trigram = get32 (data + pos);
+		count = get32 (data + pos + 4);
+		pos += 8;
+		if ((!trigram) || (trigram > 0xffffff) || (count > ((datasize - pos) / 4)) || textindex_find (self, trigram))
+		{
+			goto error;
+		}
+		p = textindex_findoradd (self, trigram);
+		if (!p)
+		{
+			goto error;
+		}
+		p->docs = malloc ((count ? count : 1) * sizeof (p->docs[0]));
+		if (!p->docs)
+		{
+			goto error;
+		}
+		p->size = count;
+		for (j=0; j < count; j++, pos += 4)
+		{
+			p->docs[j] = get32 (data + pos);
+			if (j && (p->docs[j] <= p->docs[j - 1]))
+			{
+				goto error;
+			}
+		}
+		p->count = count;
+	}
+
+	self->dirty = 0;
+	return 0;
+
+error:
+	textindex_free (self);
+	return -1;
+}
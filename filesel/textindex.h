@@ -0,0 +1,42 @@
+#ifndef _TEXTINDEX_H
+#define _TEXTINDEX_H 1
+
+/* Trigram inverted index, used for substring searches in the medialib.
+ *
+ * A document is an id and a text. Fields inside the text are separated by
+ * '\n', and no trigram spans a separator. Matching ignores ASCII case, the
+ * same way as strupr(). A query gives the documents that contain all the
+ * trigrams of the query string, so the caller still has to verify these
+ * candidates with strstr().
+ */
+
+struct textindex_posting_t
+{
+	uint32_t  trigram; /* 0 = unused bucket */
+	uint32_t  count;
+	uint32_t  size;
+	int       sorted;  /* documents are appended, and sorted on demand by textindex_query() */
+	uint32_t *docs;
+};
+
+struct textindex_t
+{
+	struct textindex_posting_t *buckets;
+	uint32_t                    size; /* power of two */
+	uint32_t                    fill;
+	int                         dirty; /* changed since load, and should be stored */
+};
+
+void textindex_free (struct textindex_t *self); /* frees the content, not self */
+
+/* Make doc go from indexing oldtext to newtext. Either can be NULL. Returns non-zero on out of memory */
+int textindex_update (struct textindex_t *self, uint32_t doc, const char *oldtext, const char *newtext);
+
+/* Returns -1 if query is too short to use the index (the caller has to scan everything), else the candidates in sorted order. *docs must be free()ed */
+int textindex_query (struct textindex_t *self, const char *query, uint32_t **docs, uint32_t *count);
+
+/* Serialized form, all numbers are little endian */
+unsigned char *textindex_serialize (struct textindex_t *self, size_t *datasize);
+int textindex_deserialize (struct textindex_t *self, const unsigned char *data, size_t datasize);
+
+#endif
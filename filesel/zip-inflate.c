@@ -21,6 +21,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <zlib.h>
+#include "zlib-index.h"
 
 struct zip_inflate_t
 {
@@ -32,6 +33,11 @@ struct zip_inflate_t
 	int need_deinit;
 	int eof_hit;
 	z_stream strm;
+
+	/* optional access point index, total_in/total_out are relative to in_base/out_base */
+	struct zlib_index_t *index;
+	uint64_t in_base;
+	uint64_t out_base;
 };
 
 static int zip_inflate_init (struct zip_inflate_t *self)
@@ -46,10 +52,71 @@ static int zip_inflate_init (struct zip_inflate_t *self)
 	self->need_deinit = 1;
 	self->eof_hit = 0;
 	self->out_buffer_fill = 0;
+	self->in_base = 0;
+	self->out_base = 0;
+
+	return 0;
+}
+
+/* restart at an access point, the caller must feed data starting at point->in. prime is the byte at point->in - 1 */
+static int zip_inflate_resume (struct zip_inflate_t *self, const struct zlib_index_point_t *point, uint8_t prime)
+{
+	if (!self->need_deinit)
+	{
+		if (zip_inflate_init (self))
+		{
+			return -1;
+		}
+	}
+	self->strm.next_in = 0;
+	self->strm.avail_in = 0;
+	if (zlib_index_resume (&self->strm, point, prime))
+	{
+		self->eof_hit = 1;
+		return -1;
+	}
+	self->eof_hit = 0;
+	self->out_buffer_fill = 0;
+	self->in_base = point->in;
+	self->out_base = point->out;
 
 	return 0;
 }
 
+/* inflate stops at every block boundary (so the index can record access points), keep going until we have output or run out of input */
+static int64_t zip_inflate_run (struct zip_inflate_t *self)
+{
+	int res;
+
+	self->out_buffer_readnext = self->out_buffer;
+	self->strm.next_out = self->out_buffer;
+	self->strm.avail_out = sizeof (self->out_buffer);
+
+	do
+	{
+		res = inflate (&self->strm, Z_BLOCK);
+		if (self->index && ((res == Z_OK) || (res == Z_STREAM_END)))
+		{
+			zlib_index_update (self->index, &self->strm, self->in_base + self->strm.total_in, self->out_base + self->strm.total_out);
+		}
+	} while ((res == Z_OK) && (self->strm.next_out == self->out_buffer) && self->strm.avail_in);
+
+	if (res == Z_STREAM_END)
+	{
+		self->eof_hit = 1;
+		self->out_buffer_fill = self->strm.next_out - self->out_buffer;
+		return self->out_buffer_fill;
+	}
+	if (res == Z_OK)
+	{
+		self->out_buffer_fill = self->strm.next_out - self->out_buffer;
+		return self->out_buffer_fill;
+	}
+	self->eof_hit = 1; /* we treat all errors as EOF */
+	self->out_buffer_fill = 0;
+	return -1;
+}
+
 static void zip_inflate_done (struct zip_inflate_t *self)
 {
 	if (self->need_deinit)
@@ -68,27 +135,7 @@ static int64_t zip_inflate_digest(struct zip_inflate_t *self)
 	}
 	if (self->strm.avail_in)
 	{
-		int res;
-
-		self->out_buffer_readnext = self->out_buffer;
-		self->strm.next_out = self->out_buffer;
-		self->strm.avail_out = sizeof (self->out_buffer);
-
-		res = inflate (&self->strm, Z_SYNC_FLUSH);
-		if (res == Z_STREAM_END)
-		{
-			self->eof_hit = 1;
-			self->out_buffer_fill = self->strm.next_out - self->out_buffer;
-			return self->out_buffer_fill;
-		}
-		if (res == Z_OK)
-		{
-			self->out_buffer_fill = self->strm.next_out - self->out_buffer;
-			return self->out_buffer_fill;
-		}
-		self->eof_hit = 1; /* we treat all errors as EOF */
-		self->out_buffer_fill = 0;
-		return -1;
+		return zip_inflate_run (self);
 	}
 	return 0;
 }
@@ -96,32 +143,13 @@ static int64_t zip_inflate_digest(struct zip_inflate_t *self)
 /* call this when both readnext is exhausted, and digest above yielded no new data */
 static int zip_inflate_feed (struct zip_inflate_t *self, uint8_t *src, uint32_t len)
 {
-	int res;
-
 	if (self->eof_hit)
 	{
 		return -1;
 	}
 
-	self->out_buffer_readnext = self->out_buffer;
 	self->strm.next_in = src;
 	self->strm.avail_in = len;
-	self->strm.next_out = self->out_buffer;
-	self->strm.avail_out = sizeof (self->out_buffer);
 
-	res = inflate (&self->strm, Z_SYNC_FLUSH);
-	if (res == Z_STREAM_END)
-	{
-		self->eof_hit = 1;
-		self->out_buffer_fill = self->strm.next_out - self->out_buffer;
-		return self->out_buffer_fill;
-	}
-	if (res == Z_OK)
-	{
-		self->out_buffer_fill = self->strm.next_out - self->out_buffer;
-		return self->out_buffer_fill;
-	}
-	self->eof_hit = 1; /* we treat all errors as EOF */
-	self->out_buffer_fill = 0;
-	return -1;
+	return zip_inflate_run (self);
 }
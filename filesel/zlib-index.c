@@ -0,0 +1,275 @@
+/* OpenCP Module Player
+ * copyright (c) 2022 Stian Skjelstad <stian.skjelstad@gmail.com>
+ *
+ * Access point index for deflate streams, based on the ideas from zran.c
+ * in the zlib examples by Mark Adler.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "types.h"
+#include "zlib-index.h"
+
+/*
+ serialized format, all numbers are little endian:
+
+  4 bytes number of points
+
+ per point:
+  8 bytes out
+  8 bytes in
+  1 byte  bits
+  4 bytes windowsize
+  4 bytes compressed windowsize
+  X bytes window, deflated
+*/
+
+void zlib_index_free (struct zlib_index_t *self)
+{
+	int i;
+
+	for (i=0; i < self->fill; i++)
+	{
+		free (self->points[i].window);
+	}
+	free (self->points);
+	self->points = 0;
+	self->fill = 0;
+	self->size = 0;
+	self->dirty = 0;
+}
+
+void zlib_index_update (struct zlib_index_t *self, z_stream *strm, uint64_t in, uint64_t out)
+{
+	struct zlib_index_point_t *p;
+	uint64_t last = self->fill ? self->points[self->fill - 1].out : 0;
+	uInt windowsize = ZLIB_INDEX_WINDOW;
+
+	/* only at the end of a deflate block, but not after the last one */
+	if (!(strm->data_type & 128) || (strm->data_type & 64))
+	{
+		return;
+	}
+	/* points are only appended, a decoding pass that started earlier in the stream than our last point has nothing new to add */
+	if (out < last + ZLIB_INDEX_SPAN)
+	{
+		return;
+	}
+
+	if (self->fill == self->size)
+	{
+		struct zlib_index_point_t *temp = realloc (self->points, sizeof (self->points[0]) * (self->size + 16));
+		if (!temp)
+		{
+			return;
+		}
+		self->points = temp;
+		self->size += 16;
+	}
+	p = self->points + self->fill;
+
+	p->window = malloc (ZLIB_INDEX_WINDOW);
+	if (!p->window)
+	{
+		return;
+	}
+	if (inflateGetDictionary (strm, p->window, &windowsize) != Z_OK)
+	{
+		free (p->window);
+		p->window = 0;
+		return;
+	}
+	p->windowsize = windowsize;
+	p->out = out;
+	p->in = in;
+	p->bits = strm->data_type & 7;
+
+	self->fill++;
+	self->dirty = 1;
+}
+
+const struct zlib_index_point_t *zlib_index_lookup (const struct zlib_index_t *self, uint64_t pos)
+{
+	int lo = 0, hi = self->fill;
+
+	/* binary search for the last point with out <= pos */
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (self->points[mid].out <= pos)
+		{
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo ? (self->points + lo - 1) : 0;
+}
+
+int zlib_index_resume (z_stream *strm, const struct zlib_index_point_t *point, uint8_t prime)
+{
+	if (inflateReset2 (strm, -15) != Z_OK)
+	{
+		return -1;
+	}
+	if (point->bits)
+	{
+		if (inflatePrime (strm, point->bits, prime >> (8 - point->bits)) != Z_OK)
+		{
+			return -1;
+		}
+	}
+	if (inflateSetDictionary (strm, point->window, point->windowsize) != Z_OK)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+static void put32 (unsigned char *dst, uint32_t src)
+{
+	dst[0] = src;
+	dst[1] = src >> 8;
+	dst[2] = src >> 16;
+	dst[3] = src >> 24;
+}
+
+static void put64 (unsigned char *dst, uint64_t src)
+{
+	put32 (dst, src);
+	put32 (dst + 4, src >> 32);
+}
+
+static uint32_t get32 (const unsigned char *src)
+{
+	return ((uint32_t)src[3] << 24) | ((uint32_t)src[2] << 16) | ((uint32_t)src[1] << 8) | src[0];
+}
+
+static uint64_t get64 (const unsigned char *src)
+{
+	return ((uint64_t)get32 (src + 4) << 32) | get32 (src);
+}
+
+unsigned char *zlib_index_serialize (const struct zlib_index_t *self, size_t *datasize)
+{
+	unsigned char *retval;
+	size_t fill = 4;
+	int i;
+
+	/* worst case size, trimmed by realloc at the end */
+	retval = malloc (4 + self->fill * (25 + compressBound (ZLIB_INDEX_WINDOW)));
+	if (!retval)
+	{
+		return 0;
+	}
+
+	put32 (retval, self->fill);
+	for (i=0; i < self->fill; i++)
+	{
+		uLongf complen = compressBound (ZLIB_INDEX_WINDOW);
+
+		if (compress2 (retval + fill + 25, &complen, self->points[i].window, self->points[i].windowsize, 9) != Z_OK)
+		{
+			free (retval);
+			return 0;
+		}
+		put64 (retval + fill +  0, self->points[i].out);
+		put64 (retval + fill +  8, self->points[i].in);
+		retval[fill + 16] = self->points[i].bits;
+		put32 (retval + fill + 17, self->points[i].windowsize);
+		put32 (retval + fill + 21, complen);
+		fill += 25 + complen;
+	}
+
+	*datasize = fill;
+	{
+		unsigned char *temp = realloc (retval, fill);
+		if (temp)
+		{
+			retval = temp;
+		}
+	}
+	return retval;
+}
+
+int zlib_index_deserialize (struct zlib_index_t *self, const unsigned char *data, size_t datasize)
+{
+	uint32_t count, i;
+	size_t pos = 4;
+
+	zlib_index_free (self);
+
+	if (datasize < 4)
+	{
+		return -1;
+	}
+	count = get32 (data);
+	if (count > datasize / 25)
+	{
+		return -1;
+	}
+	self->points = calloc (count ? count : 1, sizeof (self->points[0]));
+	if (!self->points)
+	{
+		return -1;
+	}
+	self->size = count;
+
+	for (i=0; i < count; i++)
+	{
+		struct zlib_index_point_t *p = self->points + i;
+		uLongf windowsize;
+		uint32_t complen;
+
+		if (pos + 25 > datasize)
+		{
+			goto error;
+		}
+		p->out = get64 (data + pos);
+		p->in = get64 (data + pos + 8);
+		p->bits = data[pos + 16] & 7;
+		p->windowsize = get32 (data + pos + 17);
+		complen = get32 (data + pos + 21);
+		pos += 25;
+		if ((p->windowsize > ZLIB_INDEX_WINDOW) || (complen > datasize - pos) || (i && (p->out <= p[-1].out)))
+		{
+			goto error;
+		}
+		p->window = malloc (ZLIB_INDEX_WINDOW);
+		if (!p->window)
+		{
+			goto error;
+		}
+		self->fill++;
+		windowsize = p->windowsize;
+		if ((uncompress (p->window, &windowsize, data + pos, complen) != Z_OK) || (windowsize != p->windowsize))
+		{
+			goto error;
+		}
+		pos += complen;
+	}
+
+	self->dirty = 0;
+	return 0;
+
+error:
+	zlib_index_free (self);
+	return -1;
+}
@@ -0,0 +1,52 @@
+#ifndef _ZLIB_INDEX_H
+#define _ZLIB_INDEX_H 1
+
+/* Random access into deflate streams (gzip files and deflated zip members).
+ *
+ * While a stream is decoded with inflate(..., Z_BLOCK), access points are
+ * recorded at deflate block boundaries about every ZLIB_INDEX_SPAN bytes of
+ * output. Each holds the 32KB dictionary needed to restart raw inflate at
+ * that place, so a seek only has to inflate from the nearest access point.
+ */
+
+#include <zlib.h>
+
+#ifndef ZLIB_INDEX_SPAN
+# define ZLIB_INDEX_SPAN (1024*1024)
+#endif
+
+#define ZLIB_INDEX_WINDOW 32768
+
+struct zlib_index_point_t
+{
+	uint64_t out;  /* uncompressed offset */
+	uint64_t in;   /* compressed offset of the first full byte */
+	int      bits; /* number of bits (1-7) of the byte before in, that belongs to this point */
+	uint32_t windowsize;
+	uint8_t *window;
+};
+
+struct zlib_index_t
+{
+	struct zlib_index_point_t *points;
+	int                        fill;
+	int                        size;
+	int                        dirty; /* points were added since load, and should be stored */
+};
+
+void zlib_index_free (struct zlib_index_t *self); /* frees the content, not self */
+
+/* Call after every inflate(..., Z_BLOCK). in/out are the absolute stream positions after the call */
+void zlib_index_update (struct zlib_index_t *self, z_stream *strm, uint64_t in, uint64_t out);
+
+/* Returns the last access point at or before pos, or NULL */
+const struct zlib_index_point_t *zlib_index_lookup (const struct zlib_index_t *self, uint64_t pos);
+
+/* strm must already be initialized for raw inflate (windowBits -15). prime is the byte at point->in - 1, ignored if point->bits is zero */
+int zlib_index_resume (z_stream *strm, const struct zlib_index_point_t *point, uint8_t prime);
+
+/* Serialized form, for storing in adbMeta */
+unsigned char *zlib_index_serialize (const struct zlib_index_t *self, size_t *datasize);
+int zlib_index_deserialize (struct zlib_index_t *self, const unsigned char *data, size_t datasize);
+
+#endif
@@ -31,6 +31,239 @@ struct scanlist_t
 	int abort;
 };
 
+/* Files that needs detection are opened by the directory walker and queued
+ * as jobs in a bounded ring. The worker threads run the detectors flagged
+ * MDB_READINFO_THREADSAFE while the walker keeps reading directories, and
+ * the walker commits the finished jobs in order into mdb. Detectors without
+ * the flag (and everything after them in the list) are run serially by the
+ * walker during the commit. The walker only blocks if the ring is full.
+ *
+ * Archive members are detected directly by the walker, since the archive
+ * readers share the handle of the archive file between all the members.
+ */
+#define MLSCAN_QUEUE 64
+
+struct mlScanJob_t
+{
+	struct ocpfile_t                   *file;
+	struct ocpfilehandle_t             *handle;
+	uint32_t                            mdbref;
+	struct moduleinfostruct             info;
+	const struct mdbreadinforegstruct  *resume; /* set by the worker, if a detector has to be run by the walker */
+	int                                 done;
+};
+
+static struct mlScanPool_t
+{
+	pthread_mutex_t    mutex;
+	pthread_cond_t     cond_work; /* workers wait for jobs */
+	pthread_cond_t     cond_done; /* walker waits for the oldest job to complete */
+	pthread_t         *threads;
+	int                threadcount;
+	int                quit;
+	int                depth;     /* mlScan() recurses into sub-directories and archives */
+
+	struct mlScanJob_t jobs[MLSCAN_QUEUE];
+	unsigned int       jobhead;   /* next slot the walker fills */
+	unsigned int       jobnext;   /* next job to be taken by a worker */
+	unsigned int       jobtail;   /* next job to be committed by the walker */
+
+	/* progress */
+	uint32_t           files;
+	uint64_t           bytes;
+	struct timespec    start;
+} mlScanPool;
+
+static void *mlScanWorker (void *arg)
+{
+	pthread_mutex_lock (&mlScanPool.mutex);
+	while (1)
+	{
+		struct mlScanJob_t *job;
+
+		while ((!mlScanPool.quit) && (mlScanPool.jobnext == mlScanPool.jobhead))
+		{
+			pthread_cond_wait (&mlScanPool.cond_work, &mlScanPool.mutex);
+		}
+		if (mlScanPool.quit)
+		{
+			break;
+		}
+		job = mlScanPool.jobs + (mlScanPool.jobnext++ % MLSCAN_QUEUE);
+		pthread_mutex_unlock (&mlScanPool.mutex);
+
+		mdbReadInfoThreadSafe (&job->info, job->handle, &job->resume);
+
+		pthread_mutex_lock (&mlScanPool.mutex);
+		job->done = 1;
+		pthread_cond_signal (&mlScanPool.cond_done);
+	}
+	pthread_mutex_unlock (&mlScanPool.mutex);
+	return 0;
+}
+
+static void mlScanPoolInit (void)
+{
+	int threads = fsScanThreads;
+	int i;
+
+	clock_gettime (CLOCK_MONOTONIC, &mlScanPool.start);
+	mlScanPool.files = 0;
+	mlScanPool.bytes = 0;
+	mlScanPool.jobhead = 0;
+	mlScanPool.jobnext = 0;
+	mlScanPool.jobtail = 0;
+	mlScanPool.quit = 0;
+	mlScanPool.threadcount = 0;
+
+	if (threads <= 0)
+	{
+		threads = sysconf (_SC_NPROCESSORS_ONLN);
+	}
+	if (threads > MLSCAN_QUEUE)
+	{
+		threads = MLSCAN_QUEUE;
+	}
+	if (threads <= 1)
+	{
+		return;
+	}
+
+	mlScanPool.threads = calloc (threads, sizeof (mlScanPool.threads[0]));
+	if (!mlScanPool.threads)
+	{
+		return;
+	}
+	pthread_mutex_init (&mlScanPool.mutex, NULL);
+	pthread_cond_init (&mlScanPool.cond_work, NULL);
+	pthread_cond_init (&mlScanPool.cond_done, NULL);
+	for (i=0; i < threads; i++)
+	{
+		if (pthread_create (&mlScanPool.threads[i], NULL, mlScanWorker, NULL))
+		{
+			break;
+		}
+		mlScanPool.threadcount++;
+	}
+	if (!mlScanPool.threadcount)
+	{
+		pthread_cond_destroy (&mlScanPool.cond_done);
+		pthread_cond_destroy (&mlScanPool.cond_work);
+		pthread_mutex_destroy (&mlScanPool.mutex);
+		free (mlScanPool.threads);
+		mlScanPool.threads = 0;
+	}
+}
+
+static void mlScanDraw(const char *title, struct scanlist_t *token);
+
+/* commit the finished jobs in order, waiting until no more than limit jobs are left in the ring */
+static void mlScanPoolCommit (struct scanlist_t *token, unsigned int limit)
+{
+	while (mlScanPool.jobtail != mlScanPool.jobhead)
+	{
+		struct mlScanJob_t *job = mlScanPool.jobs + (mlScanPool.jobtail % MLSCAN_QUEUE);
+		int done;
+
+		pthread_mutex_lock (&mlScanPool.mutex);
+		done = job->done;
+		if ((!done) && ((mlScanPool.jobhead - mlScanPool.jobtail) > limit))
+		{
+			struct timespec timeout;
+
+			clock_gettime (CLOCK_REALTIME, &timeout);
+			timeout.tv_nsec += 20000000;
+			if (timeout.tv_nsec >= 1000000000)
+			{
+				timeout.tv_sec++;
+				timeout.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait (&mlScanPool.cond_done, &mlScanPool.mutex, &timeout);
+			pthread_mutex_unlock (&mlScanPool.mutex);
+
+			/* keep the dialog alive while waiting */
+			if (poll_framelock())
+			{
+				mlScanDraw ("Scanning", token);
+			}
+			continue;
+		}
+		pthread_mutex_unlock (&mlScanPool.mutex);
+		if (!done)
+		{
+			return;
+		}
+
+		if (job->resume)
+		{
+			mdbReadInfoResume (&job->info, job->handle, job->resume);
+		}
+		job->handle->unref (job->handle);
+		mdbWriteModuleInfo (job->mdbref, &job->info);
+		job->file->unref (job->file);
+		mlScanPool.jobtail++;
+	}
+}
+
+static void mlScanPoolDone (struct scanlist_t *token)
+{
+	int i;
+
+	if (!mlScanPool.threadcount)
+	{
+		return;
+	}
+	mlScanPoolCommit (token, 0);
+
+	pthread_mutex_lock (&mlScanPool.mutex);
+	mlScanPool.quit = 1;
+	pthread_cond_broadcast (&mlScanPool.cond_work);
+	pthread_mutex_unlock (&mlScanPool.mutex);
+	for (i=0; i < mlScanPool.threadcount; i++)
+	{
+		pthread_join (mlScanPool.threads[i], NULL);
+	}
+	pthread_cond_destroy (&mlScanPool.cond_done);
+	pthread_cond_destroy (&mlScanPool.cond_work);
+	pthread_mutex_destroy (&mlScanPool.mutex);
+	free (mlScanPool.threads);
+	mlScanPool.threads = 0;
+	mlScanPool.threadcount = 0;
+}
+
+/* same as mdbScan(), but the detection is done by the workers if possible */
+static void mlScanPoolScan (struct scanlist_t *token, struct ocpfile_t *file, uint32_t mdbref)
+{
+	struct mlScanJob_t *job;
+
+	if ((!mlScanPool.threadcount) || file->is_nodetect || (file->parent && file->parent->is_archive))
+	{
+		mdbScan (file, mdbref);
+		return;
+	}
+
+	/* make room in the ring */
+	mlScanPoolCommit (token, MLSCAN_QUEUE - 1);
+
+	job = mlScanPool.jobs + (mlScanPool.jobhead % MLSCAN_QUEUE);
+	job->handle = file->open (file);
+	if (!job->handle)
+	{
+		return;
+	}
+	file->ref (file);
+	job->file = file;
+	job->mdbref = mdbref;
+	job->resume = 0;
+	job->done = 0;
+	mdbGetModuleInfo (&job->info, mdbref);
+
+	pthread_mutex_lock (&mlScanPool.mutex);
+	mlScanPool.jobhead++;
+	pthread_cond_signal (&mlScanPool.cond_work);
+	pthread_mutex_unlock (&mlScanPool.mutex);
+}
+
 static void mlScanDraw(const char *title, struct scanlist_t *token)
 {
 	unsigned int mlHeight;
@@ -83,6 +316,27 @@ static void mlScanDraw(const char *title, struct scanlist_t *token)
 		displaystr (mlTop, Left + 1 + strlen (title), 0x09, " ",   1);
 	} while (0);
 
+	do
+	{
+		struct timespec now;
+		double elapsed;
+		char progress[80];
+		int len;
+
+		clock_gettime (CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - mlScanPool.start.tv_sec) + (now.tv_nsec - mlScanPool.start.tv_nsec) / 1000000000.0;
+		if (elapsed < 0.001)
+		{
+			elapsed = 0.001;
+		}
+		len = snprintf (progress, sizeof (progress), " %u files, %.1f files/s, %.1f MB/s ", (unsigned int)mlScanPool.files, mlScanPool.files / elapsed, mlScanPool.bytes / elapsed / (1024.0 * 1024.0));
+		if (len > mlWidth - 4)
+		{
+			len = mlWidth - 4;
+		}
+		displaystr (mlTop + mlHeight - 1, mlLeft + (mlWidth - len) / 2, 0x09, progress, len);
+	} while (0);
+
 	for (i = 4; i < (mlHeight-1); i++)
 	{
 		displaystr  (mlTop + i, mlLeft,               0x04, "\xb3", 1);
@@ -143,6 +397,7 @@ static void mlScan_file (void *_token, struct ocpfile_t *file)
 	char *curext = 0;
 	const char *filename = 0;
 	uint32_t mdbref = UINT32_MAX;
+	uint64_t filesize;
 
 	if (poll_framelock())
 	{
@@ -154,6 +409,11 @@ static void mlScan_file (void *_token, struct ocpfile_t *file)
 		return;
 	}
 
+	if (mlScanPool.threadcount)
+	{
+		mlScanPoolCommit (token, MLSCAN_QUEUE);
+	}
+
 	dirdbGetName_internalstr (file->dirdb_ref, &filename);
 
 	getext_malloc (filename, &curext);
@@ -190,10 +450,17 @@ static void mlScan_file (void *_token, struct ocpfile_t *file)
 	free (curext);
 	curext = 0;
 
-	mdbref = mdbGetModuleReference2 (file->dirdb_ref, file->filesize(file));
+	filesize = file->filesize (file);
+	mlScanPool.files++;
+	if (filesize < FILESIZE_ERROR)
+	{
+		mlScanPool.bytes += filesize;
+	}
+
+	mdbref = mdbGetModuleReference2 (file->dirdb_ref, filesize);
 	if (!mdbInfoIsAvailable (mdbref))
 	{
-		mdbScan(file, mdbref);
+		mlScanPoolScan (token, file, mdbref);
 	}
 	dirdbMakeMdbRef(file->dirdb_ref, mdbref);
 
@@ -233,6 +500,11 @@ static int mlScan(struct ocpdir_t *dir)
 		free (token.path);
 		return 0;
 	}
+
+	if (!mlScanPool.depth++)
+	{
+		mlScanPoolInit ();
+	}
 	while (dir->readdir_iterate (handle) && (!token.abort))
 	{
 		if (poll_framelock())
@@ -242,6 +514,11 @@ static int mlScan(struct ocpdir_t *dir)
 	}
 	dir->readdir_cancel (handle);
 
+	if (!--mlScanPool.depth)
+	{
+		mlScanPoolDone (&token);
+	}
+
 	for (i=0; i < token.entries; i++)
 	{
 		token.files[i]->unref (token.files[i]);
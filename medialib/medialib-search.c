@@ -33,6 +33,10 @@ static int                mlSearchResultCount;
 static int                mlSearchResultSize;
 static int                mlSearchFirst = 1;
 static uint32_t           mlSearchDirDbRef;
+static uint32_t          *mlSearchNodes;      /* result from the text indexes, if they could be used for this query */
+static uint32_t           mlSearchNodesCount;
+static uint32_t           mlSearchNodesNext;
+static int                mlSearchIndexed;
 
 static void mlSearchClear (void)
 {
@@ -49,6 +53,30 @@ static void mlSearchClear (void)
 	mlSearchResultCount = 0;
 	mlSearchResultSize = 0;
 	mlSearchFirst = 1;
+	free (mlSearchNodes);
+	      mlSearchNodes = 0;
+	mlSearchNodesCount = 0;
+	mlSearchNodesNext = 0;
+	mlSearchIndexed = 0;
+}
+
+/* Try to resolve the query using the text indexes of mdb and dirdb, else mlSearchPerformQuery() has to scan everything */
+static void mlSearchPrepareQuery (void)
+{
+	uint32_t *mdb_refs = 0;
+	uint32_t mdb_count = 0;
+
+	mlSearchIndexed = 0;
+	if (mdbSearchText (mlSearchQuery, &mdb_refs, &mdb_count))
+	{
+		return;
+	}
+	if (!dirdbSearchMdb (mlSearchQuery, mdb_refs, mdb_count, &mlSearchNodes, &mlSearchNodesCount))
+	{
+		mlSearchNodesNext = 0;
+		mlSearchIndexed = 1;
+	}
+	free (mdb_refs);
 }
 
 static int mlSearchPerformQuery (void)
@@ -63,7 +91,9 @@ static int mlSearchPerformQuery (void)
 	[
 		MAX(sizeof(info.title),
 		MAX(sizeof(info.composer),
-		    sizeof(info.comment)))
+		MAX(sizeof(info.artist),
+		MAX(sizeof(info.album),
+		    sizeof(info.comment)))))
 	];
 
 	if (!mlSearchQuery)
@@ -71,7 +101,14 @@ static int mlSearchPerformQuery (void)
 		return 1;
 	}
 
-	while (1)
+	if (mlSearchIndexed)
+	{
+		if (mlSearchNodesNext >= mlSearchNodesCount)
+		{
+			return 1;
+		}
+		mlSearchDirDbRef = mlSearchNodes[mlSearchNodesNext++];
+	} else while (1)
 	{
 		if (dirdbGetMdb(&mlSearchDirDbRef, &mdb_ref, &mlSearchFirst)) /* does not refcount.... */
 		{
@@ -103,6 +140,7 @@ static int mlSearchPerformQuery (void)
 		{
 			*ptr = toupper (*ptr2);
 		}
+		*ptr = 0;
 		if (strstr (buffer, mlSearchQuery))
 		{
 			break; /* goto add; */
@@ -112,6 +150,27 @@ static int mlSearchPerformQuery (void)
 		{
 			*ptr = toupper (*ptr2);
 		}
+		*ptr = 0;
+		if (strstr (buffer, mlSearchQuery))
+		{
+			break; /* goto add; */
+		}
+
+		for (ptr=buffer, ptr2=info.artist; *ptr2; ptr++, ptr2++)
+		{
+			*ptr = toupper (*ptr2);
+		}
+		*ptr = 0;
+		if (strstr (buffer, mlSearchQuery))
+		{
+			break; /* goto add; */
+		}
+
+		for (ptr=buffer, ptr2=info.album; *ptr2; ptr++, ptr2++)
+		{
+			*ptr = toupper (*ptr2);
+		}
+		*ptr = 0;
 		if (strstr (buffer, mlSearchQuery))
 		{
 			break; /* goto add; */
@@ -121,6 +180,7 @@ static int mlSearchPerformQuery (void)
 		{
 			*ptr = toupper (*ptr2);
 		}
+		*ptr = 0;
 		if (strstr (buffer, mlSearchQuery))
 		{
 			break; /* goto add; */
@@ -277,6 +337,7 @@ static int ocpdir_search_readdir_iterate (ocpdirhandle_pt _handle)
 			} else if (res == 0)
 			{/* make query upper-case */
 				strupr(mlSearchQuery);
+				mlSearchPrepareQuery();
 				mlSearchPerformed = 1;
 				return 1;
 			}
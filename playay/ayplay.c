@@ -525,35 +525,35 @@ void __attribute__ ((visibility ("internal"))) ay_driver_frame(int16_t *quad_sam
 	write (debug_output, quad_samples, bytes);
 #endif
 
-	/* down-mix from 6 channels down to 2 channels */
-	for (i=0; i < (bytes / 12); i++)
+	/* down-mix from 4 channels down to 2 channels */
+	for (i=0; i < (bytes / 8); i++)
 	{
 		int16_t left = 0;
 		int16_t right = 0;
 
 		if (!ayMute[0])
 		{
-			left += quad_samples[(i*6)+0];
+			left += quad_samples[(i*4)+0];
 		}
 		if (!ayMute[1])
 		{
-			left += (quad_samples[(i*6)+1]>>1);
-			right +=  (quad_samples[(i*6)+1]>>1);
+			left += (quad_samples[(i*4)+1]>>1);
+			right +=  (quad_samples[(i*4)+1]>>1);
 		}
 		if (!ayMute[2])
 		{
-			right += quad_samples[(i*6)+2];
+			right += quad_samples[(i*4)+2];
 		}
 		if (!ayMute[3])
 		{
-			left += (quad_samples[(i*6)+3]>>1);
-			right += (quad_samples[(i*6)+3]>>1);
+			left += (quad_samples[(i*4)+3]>>1);
+			right += (quad_samples[(i*4)+3]>>1);
 		}
 		quad_samples[(i<<1)+0] = left;
 		quad_samples[(i<<1)+1] = right;
 	}
 	aydumpbuffer=quad_samples;
-	aydumpbuffer_n=bytes / 12;
+	aydumpbuffer_n=bytes / 8;
 }
 
 void __attribute__ ((visibility ("internal"))) aySetMute (struct cpifaceSessionAPI_t *cpifaceSession, int ch, int mute)
@@ -31,6 +31,7 @@
 #include "dev/deviplay.h"
 #include "dev/mcp.h"
 #include "dev/player.h"
+#include "dev/resample.h"
 #include "dev/ringbuffer.h"
 #include "filesel/filesystem.h"
 #include "flacplay.h"
@@ -64,7 +65,7 @@ static int bitrate;
 static uint16_t *flacbuf;    /* in 16bit samples */
 static uint32_t  flacbufrate; /* This is the mix rate in 16:16 fixed format */
 static struct ringbuffer_t *flacbufpos;
-static uint32_t  flacbuffpos; /* read fine-pos.. when flacbufrate has a fraction */
+static struct resample_t *flacresample = 0;
 /* source info from stream */
 static unsigned int flacrate; /* this is the source rate */
 static int flacstereo; /* this we can ignore I think */
@@ -700,6 +701,9 @@ void __attribute__ ((visibility ("internal"))) flacIdle (struct cpifaceSessionAP
 
 				accumulated_source = accumulated_target = length1 + length2;
 
+				/* keep the resampler history current, so a later speed or pitch change does not start with stale samples */
+				cpifaceSession->resampleAPI->resample_feed (flacresample, (int16_t *)flacbuf, pos1, length1, pos2, length2);
+
 				while (length1)
 				{
 					while (length1)
@@ -726,99 +730,28 @@ void __attribute__ ((visibility ("internal"))) flacIdle (struct cpifaceSessionAP
 				}
 				//accumulated_source = accumulated_target;
 			} else {
-				/* We are going to perform cubic interpolation of rate conversion... this bit is tricky */
-				eof_buffer=0;
+				int consumed;
+				unsigned int i;
 
-				while (targetlength && length1)
+				accumulated_target = cpifaceSession->resampleAPI->resample_stereo16 (flacresample, flacbufrate, t, targetlength, (int16_t *)flacbuf, pos1, length1, pos2, length2, &consumed);
+				accumulated_source = consumed;
+				if (accumulated_target < targetlength)
 				{
-					while (targetlength && length1)
-					{
-						uint32_t wpm1, wp0, wp1, wp2;
-						int32_t rc0, rc1, rc2, rc3, rvm1,rv1,rv2;
-						int32_t lc0, lc1, lc2, lc3, lvm1,lv1,lv2;
-						unsigned int progress;
-						int16_t rs, ls;
-
-						if ((length1+length2) <= 3)
-						{
-							eof_buffer=1;
-							break;
-						}
-						/* will we overflow the flacbuf if we advance? */
-						if ((length1+length2) < ((flacbufrate+flacbuffpos)>>16))
-						{
-							eof_buffer=1;
-							break;
-						}
-
-						switch (length1) /* if we are close to the wrap between buffer segment 1 and 2, len1 will grow down to a small number */
-						{
-							case 1:  wpm1 = pos1; wp0 = pos2;     wp1 = pos2 + 1; wp2 = pos2 + 2; break;
-							case 2:  wpm1 = pos1; wp0 = pos1 + 1; wp1 = pos2;     wp2 = pos2 + 1; break;
-							case 3:  wpm1 = pos1; wp0 = pos1 + 1; wp1 = pos1 + 2; wp2 = pos2;     break;
-							default: wpm1 = pos1; wp0 = pos1 + 1; wp1 = pos1 + 2; wp2 = pos1 + 3; break;
-						}
-
-						rvm1 = (uint16_t)flacbuf[(wpm1<<1)+0]^0x8000; /* we temporary need data to be unsigned - hence the ^0x8000 */
-						lvm1 = (uint16_t)flacbuf[(wpm1<<1)+1]^0x8000;
-						 rc0 = (uint16_t)flacbuf[(wp0 <<1)+0]^0x8000;
-						 lc0 = (uint16_t)flacbuf[(wp0 <<1)+1]^0x8000;
-						 rv1 = (uint16_t)flacbuf[(wp1 <<1)+0]^0x8000;
-						 lv1 = (uint16_t)flacbuf[(wp1 <<1)+1]^0x8000;
-						 rv2 = (uint16_t)flacbuf[(wp2 <<1)+0]^0x8000;
-						 lv2 = (uint16_t)flacbuf[(wp2 <<1)+1]^0x8000;
-
-						rc1 = rv1-rvm1;
-						rc2 = 2*rvm1-2*rc0+rv1-rv2;
-						rc3 = rc0-rvm1-rv1+rv2;
-						rc3 =  imulshr16(rc3,flacbuffpos);
-						rc3 += rc2;
-						rc3 =  imulshr16(rc3,flacbuffpos);
-						rc3 += rc1;
-						rc3 =  imulshr16(rc3,flacbuffpos);
-						rc3 += rc0;
-						if (rc3<0)
-							rc3=0;
-						if (rc3>65535)
-							rc3=65535;
-
-						lc1 = lv1-lvm1;
-						lc2 = 2*lvm1-2*lc0+lv1-lv2;
-						lc3 = lc0-lvm1-lv1+lv2;
-						lc3 =  imulshr16(lc3,flacbuffpos);
-						lc3 += lc2;
-						lc3 =  imulshr16(lc3,flacbuffpos);
-						lc3 += lc1;
-						lc3 =  imulshr16(lc3,flacbuffpos);
-						lc3 += lc0;
-						if (lc3<0)
-							lc3=0;
-						if (lc3>65535)
-							lc3=65535;
-
-						rs = rc3 ^ 0x8000;
-						ls = lc3 ^ 0x8000;
-
-						PANPROC;
+					eof_buffer=1;
+				} else {
+					eof_buffer=0;
+				}
 
-						*(t++) = rs;
-						*(t++) = ls;
+				for (i=0; i < accumulated_target; i++)
+				{
+					int16_t rs = t[(i<<1) + 0];
+					int16_t ls = t[(i<<1) + 1];
 
-						flacbuffpos+=flacbufrate;
-						progress = flacbuffpos>>16;
-						flacbuffpos&=0xFFFF;
-						accumulated_source+=progress;
-						pos1+=progress;
-						length1-=progress;
-						targetlength--;
+					PANPROC;
 
-						accumulated_target++;
-					} /* while (targetlength && length1) */
-					length1 = length2;
-					length2 = 0;
-					pos1 = pos2;
-					pos2 = 0;
-				} /* while (targetlength && length1) */
+					t[(i<<1) + 0] = rs;
+					t[(i<<1) + 1] = ls;
+				}
 			} /* if (flacbufrate==0x10000) */
 			cpifaceSession->ringbufferAPI->tail_consume_samples (flacbufpos, accumulated_source);
 			cpifaceSession->plrDevAPI->CommitBuffer (accumulated_target);
@@ -1070,7 +1003,12 @@ int __attribute__ ((visibility ("internal"))) flacOpenPlayer(struct ocpfilehandl
 		fprintf(stderr, "playflac: ringbuffer_new_samples() failed\n");
 		goto error_out_flacbuf;
 	}
-	flacbuffpos=0;
+	flacresample = cpifaceSession->resampleAPI->resample_new ();
+	if (!flacresample)
+	{
+		fprintf(stderr, "playflac: resample_new() failed\n");
+		goto error_out_ringbuffer;
+	}
 
 	cpifaceSession->mcpSet=flacSet;
 	cpifaceSession->mcpGet=flacGet;
@@ -1079,8 +1017,11 @@ int __attribute__ ((visibility ("internal"))) flacOpenPlayer(struct ocpfilehandl
 
 	return 1;
 
-	//cpifaceSession->ringbufferAPI->free (flacbufpos);
-	//flacbufpos = 0;
+	//cpifaceSession->resampleAPI->resample_free (flacresample);
+	//flacresample = 0;
+error_out_ringbuffer:
+	cpifaceSession->ringbufferAPI->free (flacbufpos);
+	flacbufpos = 0;
 error_out_flacbuf:
 	free (flacbuf);
 	flacbuf = 0;
@@ -1118,6 +1059,11 @@ void __attribute__ ((visibility ("internal"))) flacClosePlayer (struct cpifaceSe
 		cpifaceSession->ringbufferAPI->free (flacbufpos);
 		flacbufpos = 0;
 	}
+	if (flacresample)
+	{
+		cpifaceSession->resampleAPI->resample_free (flacresample);
+		flacresample = 0;
+	}
 
 	if (flacfile)
 	{
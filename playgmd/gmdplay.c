@@ -206,6 +206,48 @@ static int querpos;
 static int quewpos;
 static int quelen;
 
+/* Time index and checkpoints, made by simulating the whole song silently
+ * when the module is started. Times are in 1/65536 seconds. */
+#define GMD_CHECKPOINT_INTERVAL (5*65536) /* a seek never needs to simulate more than this */
+#define GMD_PRECALC_MAXTIME (4*3600*65536) /* give up finding the end of songs that never loop */
+
+struct gmdcheckpoint
+{
+	uint32_t time;
+	int timerfrac;
+	int gspeed;
+	uint8_t looped;
+	uint8_t currenttick;
+	uint8_t tempo;
+	uint16_t currentrow;
+	uint16_t patternlen;
+	uint16_t currentpattern;
+	struct gmdtrack gtrack;
+	uint16_t speed;
+	int16_t brkpat;
+	int16_t brkrow;
+	uint8_t processtick;
+	uint8_t patlooprow[GMD_MAXLCHAN];
+	uint8_t patloopcount[GMD_MAXLCHAN];
+	uint8_t globchan;
+	uint8_t patdelay;
+	uint8_t globalvol;
+	uint8_t globalvolslide[GMD_MAXLCHAN];
+	int8_t globalvolslval[GMD_MAXLCHAN];
+	uint8_t donotshutup;
+	struct trackdata *tdata;
+};
+
+static int simulating;
+static uint32_t simtime;
+static int simtimerfrac;
+static int simgspeed; /* the last mcpGSpeed, the tick rate is simgspeed/256 Hz */
+static uint32_t *rowtimes; /* when each row first starts playing, 0xffffffff if never */
+static int *ordrows; /* index into rowtimes for row 0 of each order */
+static struct gmdcheckpoint *checkpoints;
+static int ncheckpoints;
+static uint32_t songlength; /* until the song loops, 0 if unknown */
+
 #define HPITCHMIN (6848>>6)
 #define HPITCHMAX ((int32_t)6848<<6)
 #define EPITCHMIN -72*256
@@ -214,7 +256,10 @@ static int quelen;
 static void readque (struct cpifaceSessionAPI_t *cpifaceSession)
 {
 	int type,val1/*,val2*/;
-	int time = cpifaceSession->mcpGet (-1, mcpGTimer);
+	int time;
+	if (simulating)
+		return;
+	time = cpifaceSession->mcpGet (-1, mcpGTimer);
 	while (1)
 	{
 		if (querpos==quewpos)
@@ -1113,6 +1158,8 @@ static void DoCommand (struct cpifaceSessionAPI_t *cpifaceSession, struct trackd
 
 static void putque(int time, int type, int val1, int val2)
 {
+	if (simulating)
+		return;
 	if (((quewpos+1)%quelen)==querpos)
 		return;
 	que[quewpos][0]=time;
@@ -1555,6 +1602,217 @@ static void PlayTick (struct cpifaceSessionAPI_t *cpifaceSession)
 	putque(cmdtime, -1, (currentrow<<8)|(currentpattern<<16), 0);
 }
 
+static void gmd_sim_set (int ch, int opt, int val)
+{
+	if ((ch==-1)&&(opt==mcpGSpeed)&&val)
+		simgspeed=val;
+}
+
+static int gmd_sim_get (int ch, int opt)
+{
+	return 0; /* all channels stopped, so PlayTick never runs out of physical channels */
+}
+
+static struct cpifaceSessionAPI_t simsession; /* the real session, but with the mixer calls stubbed out */
+
+static void gmd_sim_tick (void)
+{
+	PlayTick (&simsession);
+
+	simtimerfrac+=((uint64_t)256<<28)/simgspeed;
+	simtime+=simtimerfrac>>12;
+	simtimerfrac&=4095;
+}
+
+static int gmd_checkpoint_save (struct gmdcheckpoint *c)
+{
+	c->tdata=malloc(sizeof(tdata[0])*channels);
+	if (!c->tdata)
+		return -1;
+	memcpy(c->tdata, tdata, sizeof(tdata[0])*channels);
+	c->time=simtime;
+	c->timerfrac=simtimerfrac;
+	c->gspeed=simgspeed;
+	c->looped=looped;
+	c->currenttick=currenttick;
+	c->tempo=tempo;
+	c->currentrow=currentrow;
+	c->patternlen=patternlen;
+	c->currentpattern=currentpattern;
+	c->gtrack=gtrack;
+	c->speed=speed;
+	c->brkpat=brkpat;
+	c->brkrow=brkrow;
+	c->processtick=processtick;
+	memcpy(c->patlooprow, patlooprow, sizeof(patlooprow));
+	memcpy(c->patloopcount, patloopcount, sizeof(patloopcount));
+	c->globchan=globchan;
+	c->patdelay=patdelay;
+	c->globalvol=globalvol;
+	memcpy(c->globalvolslide, globalvolslide, sizeof(globalvolslide));
+	memcpy(c->globalvolslval, globalvolslval, sizeof(globalvolslval));
+	c->donotshutup=donotshutup;
+	return 0;
+}
+
+/* The physical channels are not part of the snapshot, all logical channels are left without one */
+static void gmd_checkpoint_load (const struct gmdcheckpoint *c)
+{
+	int i;
+
+	for (i=0; i<channels; i++)
+	{
+		int mute=tdata[i].mute;
+		tdata[i]=c->tdata[i];
+		tdata[i].mute=mute;
+		tdata[i].phys=-1;
+	}
+	memset(pchan, -1, sizeof(pchan));
+	simtime=c->time;
+	simtimerfrac=c->timerfrac;
+	simgspeed=c->gspeed;
+	looped=c->looped;
+	currenttick=c->currenttick;
+	tempo=c->tempo;
+	currentrow=c->currentrow;
+	patternlen=c->patternlen;
+	currentpattern=c->currentpattern;
+	gtrack=c->gtrack;
+	speed=c->speed;
+	brkpat=c->brkpat;
+	brkrow=c->brkrow;
+	processtick=c->processtick;
+	memcpy(patlooprow, c->patlooprow, sizeof(patlooprow));
+	memcpy(patloopcount, c->patloopcount, sizeof(patloopcount));
+	globchan=c->globchan;
+	patdelay=c->patdelay;
+	globalvol=c->globalvol;
+	memcpy(globalvolslide, c->globalvolslide, sizeof(globalvolslide));
+	memcpy(globalvolslval, c->globalvolslval, sizeof(globalvolslval));
+	donotshutup=c->donotshutup;
+}
+
+static int gmd_checkpoint_add (void)
+{
+	struct gmdcheckpoint *temp;
+
+	if (!(ncheckpoints&63))
+	{
+		temp=realloc(checkpoints, sizeof(checkpoints[0])*(ncheckpoints+64));
+		if (!temp)
+			return -1;
+		checkpoints=temp;
+	}
+	if (gmd_checkpoint_save(&checkpoints[ncheckpoints]))
+		return -1;
+	ncheckpoints++;
+	return 0;
+}
+
+static void gmd_precalc_free (void)
+{
+	int i;
+
+	for (i=0; i<ncheckpoints; i++)
+		free(checkpoints[i].tdata);
+	free(checkpoints);
+	checkpoints=0;
+	ncheckpoints=0;
+	free(rowtimes);
+	rowtimes=0;
+	free(ordrows);
+	ordrows=0;
+	songlength=0;
+}
+
+/* Simulates the song with the given physical channel count, the real mixer
+ * is not touched. Pattern lock and stop-at-end are suspended meanwhile. */
+static void gmd_sim_begin (uint8_t *oldphyschan, int *oldlockpattern, uint8_t *olddonotloopmodule)
+{
+	*oldphyschan=physchan;
+	*oldlockpattern=lockpattern;
+	*olddonotloopmodule=donotloopmodule;
+	physchan=GMD_MAXPCHAN;
+	lockpattern=-1;
+	donotloopmodule=0;
+	simulating=1;
+}
+
+static void gmd_sim_end (uint8_t oldphyschan, int oldlockpattern, uint8_t olddonotloopmodule)
+{
+	simulating=0;
+	physchan=oldphyschan;
+	lockpattern=oldlockpattern;
+	donotloopmodule=olddonotloopmodule;
+	memset(pchan, -1, sizeof(pchan));
+}
+
+/* Plays the whole song without output, noting when each row starts and
+ * saving the complete player state every GMD_CHECKPOINT_INTERVAL. The song
+ * ends when PlayTick flags it as looped, which it does for every jump
+ * backwards and when the end order is reached. */
+static void gmdPrecalc (struct cpifaceSessionAPI_t *cpifaceSession)
+{
+	int i, rows=0;
+	uint8_t oldphyschan, olddonotloopmodule;
+	int oldlockpattern;
+
+	ordrows=malloc(sizeof(ordrows[0])*patternnum);
+	if (!ordrows)
+		return;
+	for (i=0; i<patternnum; i++)
+	{
+		ordrows[i]=rows;
+		if (orders[i]!=0xFFFF)
+			rows+=patterns[orders[i]].patlen;
+	}
+	rowtimes=malloc(sizeof(rowtimes[0])*(rows?rows:1));
+	if (!rowtimes)
+	{
+		gmd_precalc_free();
+		return;
+	}
+	memset(rowtimes, 0xff, sizeof(rowtimes[0])*rows);
+
+	simsession=*cpifaceSession;
+	simsession.mcpSet=gmd_sim_set;
+	simsession.mcpGet=gmd_sim_get;
+	gmd_sim_begin (&oldphyschan, &oldlockpattern, &olddonotloopmodule);
+	simtime=0;
+	simtimerfrac=0;
+	simgspeed=12800;
+
+	if (gmd_checkpoint_add())
+	{
+		gmd_precalc_free();
+		gmd_sim_end (oldphyschan, oldlockpattern, olddonotloopmodule);
+		return;
+	}
+
+	while (simtime<GMD_PRECALC_MAXTIME)
+	{
+		uint32_t ticktime=simtime;
+
+		gmd_sim_tick();
+		if (looped)
+		{
+			songlength=ticktime;
+			break;
+		}
+		if (!currenttick && (currentpattern<patternnum) && (orders[currentpattern]!=0xFFFF) && (currentrow<patternlen))
+		{
+			uint32_t *t=&rowtimes[ordrows[currentpattern]+currentrow];
+			if (*t==0xffffffff)
+				*t=ticktime;
+		}
+		if ((simtime-checkpoints[ncheckpoints-1].time)>=GMD_CHECKPOINT_INTERVAL)
+			gmd_checkpoint_add();
+	}
+
+	gmd_checkpoint_load(&checkpoints[0]);
+	gmd_sim_end (oldphyschan, oldlockpattern, olddonotloopmodule);
+}
+
 char __attribute__ ((visibility ("internal"))) mpPlayModule(const struct gmdmodule *m, struct ocpfilehandle_t *file, struct cpifaceSessionAPI_t *cpifaceSession)
 {
 	int i;
@@ -1621,8 +1879,13 @@ char __attribute__ ((visibility ("internal"))) mpPlayModule(const struct gmdmodu
 	querpos=0;
 	quewpos=0;
 
+	gmdPrecalc (cpifaceSession);
+
 	if (!cpifaceSession->mcpDevAPI->OpenPlayer (channels, PlayTick, file, cpifaceSession))
+	{
+		gmd_precalc_free();
 		return 0;
+	}
 
 	cpifaceSession->mcpAPI->Normalize (cpifaceSession, mcpNormalizeDefaultPlayW);
 
@@ -1640,6 +1903,7 @@ void __attribute__ ((visibility ("internal"))) mpStopModule (struct cpifaceSessi
 	}
 	cpifaceSession->mcpDevAPI->ClosePlayer ();
 	free(que);
+	gmd_precalc_free();
 }
 
 void __attribute__ ((visibility ("internal"))) mpGetChanInfo(uint8_t ch, struct chaninfo *ci)
@@ -1710,7 +1974,45 @@ int __attribute__ ((visibility ("internal"))) mpGetRealPos (struct cpifaceSessio
 	return realpos;
 }
 
-void __attribute__ ((visibility ("internal"))) mpSetPosition (struct cpifaceSessionAPI_t *cpifaceSession, int16_t pat, int16_t row)
+/* Restores the last checkpoint before time, and simulates up to it. Returns the time reached */
+static uint32_t gmd_seek (struct cpifaceSessionAPI_t *cpifaceSession, uint32_t time)
+{
+	int lo=0, hi=ncheckpoints;
+	uint8_t oldphyschan, olddonotloopmodule;
+	int oldlockpattern;
+	int i;
+
+	while ((hi-lo)>1)
+	{
+		int mid=(lo+hi)/2;
+		if (checkpoints[mid].time<=time)
+			lo=mid;
+		else
+			hi=mid;
+	}
+
+	for (i=0; i<physchan; i++)
+		cpifaceSession->mcpSet (i, mcpCReset, 0);
+
+	gmd_sim_begin (&oldphyschan, &oldlockpattern, &olddonotloopmodule);
+	gmd_checkpoint_load(&checkpoints[lo]);
+	while ((simtime<time) && !looped)
+		gmd_sim_tick();
+	gmd_sim_end (oldphyschan, oldlockpattern, olddonotloopmodule);
+
+	for (i=0; i<channels; i++)
+		tdata[i].phys=-1;
+	if (lockpattern!=-1)
+		lockpattern=currentpattern;
+	cpifaceSession->mcpSet (-1, mcpGSpeed, simgspeed);
+	querpos=0;
+	quewpos=0;
+	realpos=(currentrow<<8)|(currentpattern<<16);
+
+	return simtime;
+}
+
+int __attribute__ ((visibility ("internal"))) mpSetPosition (struct cpifaceSessionAPI_t *cpifaceSession, int16_t pat, int16_t row)
 {
 	unsigned int i;
 	if (row<0)
@@ -1747,6 +2049,10 @@ void __attribute__ ((visibility ("internal"))) mpSetPosition (struct cpifaceSess
 		if (pat>=patternnum)
 			pat=looppat;
 	}
+	if (rowtimes && (row<patterns[orders[pat]].patlen) && (rowtimes[ordrows[pat]+row]!=0xffffffff))
+	{ /* restore the player state as it is when the song plays through this row */
+		return ((uint64_t)gmd_seek (cpifaceSession, rowtimes[ordrows[pat]+row])*1000)>>16;
+	}
 	if (pat!=currentpattern)
 	{
 		if (lockpattern!=-1)
@@ -1766,6 +2072,37 @@ void __attribute__ ((visibility ("internal"))) mpSetPosition (struct cpifaceSess
 	currentpattern=pat;
 	currentrow=row;
 	currenttick=tempo;
+	return -1;
+}
+
+int __attribute__ ((visibility ("internal"))) mpGetTime (struct cpifaceSessionAPI_t *cpifaceSession)
+{
+	int pos = mpGetRealPos (cpifaceSession);
+	int pat = pos>>16;
+	int row = (pos>>8)&0xFF;
+
+	if ((!rowtimes) || (pat>=patternnum) || (orders[pat]==0xFFFF) || (row>=patterns[orders[pat]].patlen) || (rowtimes[ordrows[pat]+row]==0xffffffff))
+		return -1;
+	return ((uint64_t)rowtimes[ordrows[pat]+row]*1000)>>16;
+}
+
+int __attribute__ ((visibility ("internal"))) mpSetTime (struct cpifaceSessionAPI_t *cpifaceSession, int ms)
+{
+	uint32_t time;
+
+	if (!ncheckpoints)
+		return -1;
+	if (ms<0)
+		ms=0;
+	time=((uint64_t)ms<<16)/1000;
+	if (songlength && (time>=songlength))
+		return -1;
+	return ((uint64_t)gmd_seek (cpifaceSession, time)*1000)>>16;
+}
+
+uint32_t __attribute__ ((visibility ("internal"))) mpGetLength (void)
+{
+	return ((uint64_t)songlength*1000)>>16;
 }
 
 char __attribute__ ((visibility ("internal"))) mpLooped(void)
@@ -107,9 +107,12 @@ extern int __attribute__ ((visibility ("internal"))) mpLoadSamples (struct cpifa
 struct cpifaceSessionAPI_t;
 extern char __attribute__ ((visibility ("internal"))) mpPlayModule (const struct gmdmodule *, struct ocpfilehandle_t *file, struct cpifaceSessionAPI_t *cpifaceSession);
 extern void __attribute__ ((visibility ("internal"))) mpStopModule (struct cpifaceSessionAPI_t *cpifaceSession);
-extern void __attribute__ ((visibility ("internal"))) mpSetPosition (struct cpifaceSessionAPI_t *cpifaceSession, int16_t pat, int16_t row);
+extern int __attribute__ ((visibility ("internal"))) mpSetPosition (struct cpifaceSessionAPI_t *cpifaceSession, int16_t pat, int16_t row); /* returns the song time of the new position in ms, or -1 if it is unknown */
 extern void __attribute__ ((visibility ("internal"))) mpGetPosition(uint16_t *pat, uint8_t *row);
 extern int __attribute__ ((visibility ("internal"))) mpGetRealPos (struct cpifaceSessionAPI_t *cpifaceSession);
+extern int __attribute__ ((visibility ("internal"))) mpGetTime (struct cpifaceSessionAPI_t *cpifaceSession); /* song time in ms of the row currently heard, or -1 if it is unknown */
+extern int __attribute__ ((visibility ("internal"))) mpSetTime (struct cpifaceSessionAPI_t *cpifaceSession, int ms); /* returns the song time reached in ms, or -1 if time seeking is not possible */
+extern uint32_t __attribute__ ((visibility ("internal"))) mpGetLength (void); /* in ms, until the song loops. 0 if unknown */
 extern void __attribute__ ((visibility ("internal"))) mpGetChanInfo (uint8_t ch, struct chaninfo *ci);
 extern uint16_t __attribute__ ((visibility ("internal"))) mpGetRealNote (struct cpifaceSessionAPI_t *cpifaceSession, uint8_t ch);
 extern void __attribute__ ((visibility ("internal"))) mpGetGlobInfo (struct globinfo *gi);
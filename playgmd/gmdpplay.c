@@ -154,6 +154,31 @@ static void gmdDrawGStrings (struct cpifaceSessionAPI_t *cpifaceSession)
 	);
 }
 
+static void gmdJump (struct cpifaceSessionAPI_t *cpifaceSession, int16_t pat, int16_t row)
+{
+	int songtime = mpSetPosition (cpifaceSession, pat, row);
+
+	if (songtime >= 0)
+	{ /* the playtime follows the jump */
+		starttime = (cpifaceSession->InPause ? pausetime : clock_ms()) - songtime;
+	}
+}
+
+static void gmdJumpTime (struct cpifaceSessionAPI_t *cpifaceSession, int delta)
+{
+	int songtime = mpGetTime (cpifaceSession);
+
+	if (songtime < 0)
+	{
+		return;
+	}
+	songtime = mpSetTime (cpifaceSession, songtime + delta);
+	if (songtime >= 0)
+	{ /* the playtime follows the jump */
+		starttime = (cpifaceSession->InPause ? pausetime : clock_ms()) - songtime;
+	}
+}
+
 static int gmdProcessKey (struct cpifaceSessionAPI_t *cpifaceSession, uint16_t key)
 {
 	uint16_t pat;
@@ -172,6 +197,8 @@ static int gmdProcessKey (struct cpifaceSessionAPI_t *cpifaceSession, uint16_t k
 			cpifaceSession->KeyHelp ('>', "Jump forward (big)");
 			cpifaceSession->KeyHelp (KEY_CTRL_RIGHT, "Jump forward (big)");
 			cpifaceSession->KeyHelp (KEY_CTRL_HOME, "Jump start of track");
+			cpifaceSession->KeyHelp ('[', "Jump back 10 seconds");
+			cpifaceSession->KeyHelp (']', "Jump forward 10 seconds");
 			return 0;
 		case 'p': case 'P':
 			togglepausefade (cpifaceSession);
@@ -203,20 +230,26 @@ static int gmdProcessKey (struct cpifaceSessionAPI_t *cpifaceSession, uint16_t k
 		case '<':
 		case KEY_CTRL_LEFT:
 			mpGetPosition(&pat, &row);
-			mpSetPosition (cpifaceSession, pat-1, 0);
+			gmdJump (cpifaceSession, pat-1, 0);
 			break;
 		case '>':
 		case KEY_CTRL_RIGHT:
 			mpGetPosition(&pat, &row);
-			mpSetPosition (cpifaceSession, pat+1, 0);
+			gmdJump (cpifaceSession, pat+1, 0);
 			break;
 		case KEY_CTRL_UP:
 			mpGetPosition(&pat, &row);
-			mpSetPosition (cpifaceSession, pat, row-8);
+			gmdJump (cpifaceSession, pat, row-8);
 			break;
 		case KEY_CTRL_DOWN:
 			mpGetPosition(&pat, &row);
-			mpSetPosition (cpifaceSession, pat, row+8);
+			gmdJump (cpifaceSession, pat, row+8);
+			break;
+		case '[':
+			gmdJumpTime (cpifaceSession, -10000);
+			break;
+		case ']':
+			gmdJumpTime (cpifaceSession, 10000);
 			break;
 		case KEY_ALT_L:
 			patlock=!patlock;
@@ -276,6 +309,7 @@ static int gmdOpenFile (struct cpifaceSessionAPI_t *cpifaceSession, struct modul
 			sampsize+=(mod.samples[i].length)<<(!!(mod.samples[i].type&mcpSamp16Bit));
 		fprintf(stderr, "%ik)...\n", sampsize>>10);
 
+		cpifaceSession->mcpAPI->SampleCacheSelect (cpifaceSession->mcpAPI->SampleCacheKey (file, info->modtype.integer.i), 0, 0);
 		if (!mpReduceSamples(&mod))
 			retval=errAllocMem;
 		else if (!mpLoadSamples (cpifaceSession, &mod))
@@ -336,6 +370,11 @@ static int gmdOpenFile (struct cpifaceSessionAPI_t *cpifaceSession, struct modul
 		return retval;
 	}
 
+	if (mpGetLength())
+	{ /* found by playing the song through, more exact than the estimate from the file-selector */
+		mdbWritePlaytime (&cpifaceSession->mdbdata, file, mpGetLength());
+	}
+
 	starttime = clock_ms(); /* initialize starttime */
 	cpifaceSession->InPause = 0;
 	cpifaceSession->mcpSet(-1, mcpMasterPause, 0);
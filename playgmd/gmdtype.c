@@ -542,7 +542,7 @@ static const char *ULT_description[] =
 	NULL
 };
 
-static struct mdbreadinforegstruct gmdReadInfoReg = {"MOD", gmdReadInfo MDBREADINFOREGSTRUCT_TAIL};
+static struct mdbreadinforegstruct gmdReadInfoReg = {"MOD", gmdReadInfo, MDB_READINFO_THREADSAFE MDBREADINFOREGSTRUCT_TAIL};
 
 int __attribute__ ((visibility ("internal"))) gmd_type_init (struct PluginInitAPI_t *API)
 {
@@ -22,6 +22,9 @@
 #include "config.h"
 #include <assert.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,11 +33,13 @@
 #include <unistd.h>
 #include "types.h"
 #include "hvlplay.h"
+#include "boot/psetting.h"
 #include "cpiface/cpiface.h" /* merge in from hvlpinst.c, to compensate for buffer-delay */
 #include "dev/deviplay.h"
 #include "dev/mcp.h"
 #include "dev/player.h"
 #include "dev/ringbuffer.h"
+#include "filesel/adbmeta.h"
 #include "loader.h"
 #include "player.h"
 #include "stuff/imsrtns.h"
@@ -101,6 +106,270 @@ static int srnd;
 
 static uint8_t hvl_muted[MAX_CHANNELS];
 
+/* If hvlnormalize is set in ocp.ini, the loudness of each subsong is found by
+ * rendering it on worker threads, while playback starts at unity gain. The
+ * result is stored in adbMeta, keyed by a hash of the file, so later opens use
+ * it at once */
+#define HVL_SCAN_THREADS   8
+#define HVL_SCAN_RATE      44100
+#define HVL_SCAN_SLICE     250            /* frames between each check for abort */
+#define HVL_SCAN_MAXFRAMES (50 * 60 * 10) /* songs that loop without an end are scanned for 10 minutes */
+#define HVL_GAIN_MAX       (4 * 256)      /* 4 times unity gain */
+
+static pthread_mutex_t hvl_scan_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t hvl_scan_threads[HVL_SCAN_THREADS];
+static int hvl_scan_threads_n;
+static uint8_t *hvl_scan_mem;
+static size_t hvl_scan_memlen;
+static uint64_t hvl_scan_hash;
+static int hvl_scan_subsongs;
+static int hvl_scan_next;          /* next subsong to hand out to a worker, protected by hvl_scan_mutex */
+static int hvl_scan_remaining;     /* subsongs not scanned yet, protected by hvl_scan_mutex */
+static atomic_int hvl_scan_abort;  /* polled by the workers without the mutex */
+static int32_t *hvl_scan_loudest;  /* per subsong, -1 if not scanned yet, protected by hvl_scan_mutex */
+
+static int32_t hvl_gain;             /* 8.8 fixed point, currently applied */
+
+static uint64_t hvl_scan_filehash (const uint8_t *mem, size_t memlen)
+{
+	uint64_t hash = UINT64_C(0xcbf29ce484222325); /* FNV-1a */
+	size_t i;
+
+	for (i=0; i < memlen; i++)
+	{
+		hash = (hash ^ mem[i]) * UINT64_C(0x100000001b3);
+	}
+	return hash;
+}
+
+/*
+ serialized format, all numbers are little endian:
+
+  4 bytes number of subsongs
+
+ per subsong:
+  4 bytes loudest sample
+*/
+static void hvl_scan_put32 (unsigned char *dst, uint32_t src)
+{
+	dst[0] = src;
+	dst[1] = src >> 8;
+	dst[2] = src >> 16;
+	dst[3] = src >> 24;
+}
+
+static uint32_t hvl_scan_get32 (const unsigned char *src)
+{
+	return ((uint32_t)src[3] << 24) | ((uint32_t)src[2] << 16) | ((uint32_t)src[1] << 8) | src[0];
+}
+
+static void hvl_scan_load (void)
+{
+	unsigned char *data = 0;
+	size_t datasize = 0;
+	char filename[17];
+	int i;
+
+	snprintf (filename, sizeof (filename), "%016"PRIx64, hvl_scan_hash);
+	if (adbMetaGet (filename, hvl_scan_memlen, "HVLGAIN", &data, &datasize))
+	{
+		return;
+	}
+	if ((datasize == (4 + 4 * hvl_scan_subsongs)) && (hvl_scan_get32 (data) == hvl_scan_subsongs))
+	{
+		for (i=0; i < hvl_scan_subsongs; i++)
+		{
+			if (hvl_scan_get32 (data + 4 + i * 4) > INT32_MAX)
+			{
+				break;
+			}
+		}
+		if (i == hvl_scan_subsongs)
+		{
+			for (i=0; i < hvl_scan_subsongs; i++)
+			{
+				hvl_scan_loudest[i] = hvl_scan_get32 (data + 4 + i * 4);
+			}
+			hvl_scan_remaining = 0;
+		}
+	}
+	free (data);
+}
+
+static void hvl_scan_store (void)
+{
+	unsigned char *data;
+	char filename[17];
+	int i;
+
+	data = malloc (4 + 4 * hvl_scan_subsongs);
+	if (!data)
+	{
+		return;
+	}
+	hvl_scan_put32 (data, hvl_scan_subsongs);
+	for (i=0; i < hvl_scan_subsongs; i++)
+	{
+		hvl_scan_put32 (data + 4 + i * 4, hvl_scan_loudest[i]);
+	}
+	snprintf (filename, sizeof (filename), "%016"PRIx64, hvl_scan_hash);
+	adbMetaAdd (filename, hvl_scan_memlen, "HVLGAIN", data, 4 + 4 * hvl_scan_subsongs);
+	free (data);
+}
+
+static void *hvl_scan_thread (void *arg)
+{
+	struct hvl_tune *tune;
+
+	tune = hvl_LoadTune_memory (hvl_scan_mem, hvl_scan_memlen, 4, HVL_SCAN_RATE);
+	if (!tune)
+	{
+		return 0;
+	}
+
+	while (1)
+	{
+		int32_t loudest = 0;
+		int frames;
+		int nr;
+
+		pthread_mutex_lock (&hvl_scan_mutex);
+		if (atomic_load (&hvl_scan_abort) || (hvl_scan_next >= hvl_scan_subsongs))
+		{
+			pthread_mutex_unlock (&hvl_scan_mutex);
+			break;
+		}
+		nr = hvl_scan_next++;
+		pthread_mutex_unlock (&hvl_scan_mutex);
+
+		hvl_InitSubsong (tune, nr);
+		for (frames = 0; (frames < HVL_SCAN_MAXFRAMES) && (!tune->ht_SongEndReached) && (!atomic_load (&hvl_scan_abort)); frames += HVL_SCAN_SLICE)
+		{
+			int32_t loud = hvl_FindLoudest (tune, HVL_SCAN_SLICE, 1);
+			if (loud > loudest)
+			{
+				loudest = loud;
+			}
+		}
+
+		pthread_mutex_lock (&hvl_scan_mutex);
+		if (!atomic_load (&hvl_scan_abort))
+		{
+			hvl_scan_loudest[nr] = loudest;
+			hvl_scan_remaining--;
+		}
+		pthread_mutex_unlock (&hvl_scan_mutex);
+	}
+
+	hvl_FreeTune (tune);
+	return 0;
+}
+
+static void hvl_scan_start (const uint8_t *mem, size_t memlen)
+{
+	long cpus;
+	int i;
+
+	hvl_scan_threads_n = 0;
+	atomic_store (&hvl_scan_abort, 0);
+	pthread_mutex_lock (&hvl_scan_mutex);
+	hvl_scan_next = 0;
+	hvl_scan_subsongs = ht->ht_SubsongNr + 1;
+	hvl_scan_remaining = hvl_scan_subsongs;
+	pthread_mutex_unlock (&hvl_scan_mutex);
+	hvl_scan_memlen = memlen;
+	hvl_scan_hash = hvl_scan_filehash (mem, memlen);
+
+	hvl_scan_loudest = malloc (sizeof (hvl_scan_loudest[0]) * hvl_scan_subsongs);
+	if (!hvl_scan_loudest)
+	{
+		return;
+	}
+	for (i=0; i < hvl_scan_subsongs; i++)
+	{
+		hvl_scan_loudest[i] = -1;
+	}
+
+	hvl_scan_load ();
+	if (!hvl_scan_remaining)
+	{
+		return;
+	}
+
+	hvl_scan_mem = malloc (memlen);
+	if (!hvl_scan_mem)
+	{
+		return;
+	}
+	memcpy (hvl_scan_mem, mem, memlen);
+
+	cpus = sysconf (_SC_NPROCESSORS_ONLN);
+	if (cpus > HVL_SCAN_THREADS)
+	{
+		cpus = HVL_SCAN_THREADS;
+	}
+	if (cpus > hvl_scan_subsongs)
+	{
+		cpus = hvl_scan_subsongs;
+	}
+	if (cpus < 1)
+	{
+		cpus = 1;
+	}
+	while (hvl_scan_threads_n < cpus)
+	{
+		if (pthread_create (&hvl_scan_threads[hvl_scan_threads_n], 0, hvl_scan_thread, 0))
+		{
+			break;
+		}
+		hvl_scan_threads_n++;
+	}
+}
+
+static void hvl_scan_stop (void)
+{
+	int i;
+
+	atomic_store (&hvl_scan_abort, 1);
+	for (i=0; i < hvl_scan_threads_n; i++)
+	{
+		pthread_join (hvl_scan_threads[i], 0);
+	}
+	if (hvl_scan_threads_n && (!hvl_scan_remaining))
+	{
+		hvl_scan_store ();
+	}
+	hvl_scan_threads_n = 0;
+
+	free (hvl_scan_mem);
+	hvl_scan_mem = 0;
+	pthread_mutex_lock (&hvl_scan_mutex);
+	free (hvl_scan_loudest);
+	hvl_scan_loudest = 0;
+	pthread_mutex_unlock (&hvl_scan_mutex);
+}
+
+/* the gain that puts the loudest sample of the current subsong at full scale, unity until it has been scanned */
+static int32_t hvl_scan_gain (int subsong)
+{
+	int32_t loudest = -1;
+	int32_t gain;
+
+	pthread_mutex_lock (&hvl_scan_mutex);
+	if (hvl_scan_loudest && (subsong < hvl_scan_subsongs))
+	{
+		loudest = hvl_scan_loudest[subsong];
+	}
+	pthread_mutex_unlock (&hvl_scan_mutex);
+
+	if (loudest <= 0)
+	{
+		return 256;
+	}
+	gain = ((int32_t)INT16_MAX << 8) / loudest;
+	return (gain > HVL_GAIN_MAX) ? HVL_GAIN_MAX : gain;
+}
+
 #define PANPROC \
 do { \
 	float _rs = rs, _ls = ls; \
@@ -223,6 +492,7 @@ void __attribute__ ((visibility ("internal"))) hvlIdler (struct cpifaceSessionAP
 		int length1, length2;
 		int16_t *src;
 		int16_t *dst;
+		int32_t gain;
 
 		/* limit the internal render buffer to 100ms */
 		cpifaceSession->ringbufferAPI->get_tailandprocessing_samples (hvl_buf_pos, &pos1, &length1, &pos2, &length2);
@@ -313,11 +583,13 @@ void __attribute__ ((visibility ("internal"))) hvlIdler (struct cpifaceSessionAP
 
 		dst = hvl_buf_stereo + 2 * pos1;
 
+		gain = hvl_scan_gain (ht->ht_SongNum);
 		for (j=0; j < hvl_samples_per_row; j++)
 		{
 			int k;
 			int32_t left = 0;
 			int32_t right = 0;
+			int32_t g = hvl_gain + (gain - hvl_gain) * j / hvl_samples_per_row; /* fade into a new gain over one row */
 			for (k = 0; k < MAX_CHANNELS; k++)
 			{
 				if (!hvl_muted[k])
@@ -328,6 +600,8 @@ void __attribute__ ((visibility ("internal"))) hvlIdler (struct cpifaceSessionAP
 					src+=2;
 				}
 			}
+			left  = (left  * g) >> 8;
+			right = (right * g) >> 8;
 			if (left  > INT16_MAX) left  = INT16_MAX;
 			if (left  < INT16_MIN) left  = INT16_MIN;
 			if (right > INT16_MAX) right = INT16_MAX;
@@ -335,6 +609,7 @@ void __attribute__ ((visibility ("internal"))) hvlIdler (struct cpifaceSessionAP
 			*(dst++) = left;
 			*(dst++) = right;
 		}
+		hvl_gain = gain;
 		if (length1 < hvl_samples_per_row)
 		{
 			memmove (hvl_buf_16chan, hvl_buf_16chan + (pos1 + length1), MAX_CHANNELS * sizeof(int16_t) * 2 * (hvl_samples_per_row - length1));
@@ -694,6 +969,12 @@ struct hvl_tune __attribute__ ((visibility ("internal"))) *hvlOpenPlayer (const
 	cpifaceSession->mcpSet = hvlSet;
 	cpifaceSession->mcpGet = hvlGet;
 
+	if (cpifaceSession->configAPI->GetProfileBool2 (cpifaceSession->configAPI->SoundSec, "sound", "hvlnormalize", 0, 0))
+	{
+		hvl_scan_start (mem, memlen);
+	}
+	hvl_gain = hvl_scan_gain (0);
+
 	cpifaceSession->mcpAPI->Normalize (cpifaceSession, mcpNormalizeDefaultPlayP | mcpNormalizeCanSpeedPitchUnlock);
 
 	return ht;
@@ -726,6 +1007,8 @@ void __attribute__ ((visibility ("internal"))) hvlClosePlayer (struct cpifaceSes
 {
 	cpifaceSession->plrDevAPI->Stop ();
 
+	hvl_scan_stop ();
+
 	if (hvl_buf_pos)
 	{
 		cpifaceSession->ringbufferAPI->free (hvl_buf_pos);
@@ -258,7 +258,7 @@ static const char *HVL_description[] =
 
 };
 
-static struct mdbreadinforegstruct hvlReadInfoReg = {"HVL/AHX", hvlReadInfo MDBREADINFOREGSTRUCT_TAIL};
+static struct mdbreadinforegstruct hvlReadInfoReg = {"HVL/AHX", hvlReadInfo, MDB_READINFO_THREADSAFE MDBREADINFOREGSTRUCT_TAIL};
 
 int __attribute__ ((visibility ("internal"))) hvl_type_init (struct PluginInitAPI_t *API)
 {
@@ -0,0 +1,283 @@
+/* OpenCP Module Player
+ * copyright (c) 2022 Stian Skjelstad <stian.skjelstad@gmail.com>
+ *
+ * Unit-test for the voice mixer in "player.c"
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "types.h"
+
+#include "player.c"
+#include "loader.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# include <x86intrin.h>
+# define HAVE_RDTSC 1
+#endif
+
+#define ANSI_COLOR_RED     "\x1b[31m"
+#define ANSI_COLOR_GREEN   "\x1b[32m"
+#define ANSI_COLOR_RESET   "\x1b[0m"
+
+#define MAXSAMPLES 4096
+
+static int16_t ref[MAXSAMPLES * MAX_CHANNELS * 2];
+static int16_t out[MAXSAMPLES * MAX_CHANNELS * 2];
+
+/* hvl_mixchunk() mixes runs of frames where no waveform wraps. This does it one frame at the time, wrapping each voice when needed */
+static void reference_mixchunk (struct hvl_tune *ht, int16_t *buf, size_t samples)
+{
+	uint32_t i;
+
+	while (samples--)
+	{
+		for (i=0; i < ht->ht_Channels; i++)
+		{
+			struct hvl_voice *v = ht->ht_Voices + i;
+			int32_t j;
+
+			if (v->vc_SamplePos >= (0x280 << 16))
+			{
+				v->vc_SamplePos -= 0x280 << 16;
+			}
+			if (v->vc_RingMixSource)
+			{
+				if (v->vc_RingSamplePos >= (0x280 << 16))
+				{
+					v->vc_RingSamplePos -= 0x280 << 16;
+				}
+				j = ((v->vc_MixSource[v->vc_SamplePos >> 16] * v->vc_RingMixSource[v->vc_RingSamplePos >> 16]) >> 7) * v->vc_VoiceVolume;
+				v->vc_RingSamplePos += v->vc_RingDelta;
+			} else {
+				j = v->vc_MixSource[v->vc_SamplePos >> 16] * v->vc_VoiceVolume;
+			}
+			*(buf++) = (j * v->vc_PanMultLeft) >> 7;
+			*(buf++) = (j * v->vc_PanMultRight) >> 7;
+			v->vc_SamplePos += v->vc_Delta;
+		}
+		for (; i < MAX_CHANNELS; i++)
+		{
+			*(buf++) = 0;
+			*(buf++) = 0;
+		}
+	}
+}
+
+/* hvl_DecodeFrame(), using reference_mixchunk() */
+static void reference_decodeframe (struct hvl_tune *ht, int16_t *buf, size_t buflen)
+{
+	uint32_t pos = 0;
+	uint32_t newpos;
+	int i;
+
+	for (i=1; pos < buflen; i++)
+	{
+		hvl_play_irq (ht);
+
+		newpos = buflen * i / ht->ht_SpeedMultiplier;
+		if (newpos == pos)
+		{
+			continue;
+		}
+		reference_mixchunk (ht, buf, newpos - pos);
+		buf += (newpos - pos) * 2 * MAX_CHANNELS;
+		pos = newpos;
+	}
+}
+
+static const int8_t *random_source (void)
+{
+	return waves + rand () % (WAVES_SIZE - 0x280);
+}
+
+/* voice state as hvl_play_irq() could leave it, including ring positions that are left behind when ring modulation is turned off.
+ * maxdelta is 16.16 samples per output frame */
+static void random_voices (struct hvl_tune *ht, int chans, uint32_t maxdelta)
+{
+	int i;
+
+	memset (ht->ht_Voices, 0, sizeof (ht->ht_Voices));
+	ht->ht_Channels = chans;
+	for (i=0; i < chans; i++)
+	{
+		struct hvl_voice *v = ht->ht_Voices + i;
+
+		v->vc_MixSource     = random_source ();
+		v->vc_Delta         = 1 + rand () % maxdelta;
+		v->vc_SamplePos     = rand () % (0x280 << 16);
+		v->vc_VoiceVolume   = rand () % 0x41;
+		v->vc_PanMultLeft   = panning_left[rand () & 0xff];
+		v->vc_PanMultRight  = panning_right[rand () & 0xff];
+		v->vc_RingSamplePos = rand () * 4096u;
+		if (rand () & 1)
+		{
+			v->vc_RingMixSource = random_source ();
+			v->vc_RingDelta     = 1 + rand () % maxdelta;
+			v->vc_RingSamplePos = rand () % (0x280 << 16);
+		}
+	}
+}
+
+static int test_random (void)
+{
+	struct hvl_tune *a = malloc (sizeof (*a));
+	struct hvl_tune *b = malloc (sizeof (*b));
+	int iter, failed = 0;
+
+	printf ("random voices: ");
+	srand (1);
+	for (iter=0; iter < 2000; iter++)
+	{
+		size_t samples = 1 + rand () % MAXSAMPLES;
+		int i;
+
+		random_voices (a, 1 + rand () % MAX_CHANNELS, (rand () & 1) ? 0x10000 : 0x800000);
+		memcpy (b->ht_Voices, a->ht_Voices, sizeof (a->ht_Voices));
+		b->ht_Channels = a->ht_Channels;
+
+		reference_mixchunk (a, ref, samples);
+		memset (out, 0x55, sizeof (out));
+		hvl_mixchunk (b, out, samples);
+
+		if (memcmp (ref, out, samples * MAX_CHANNELS * 2 * sizeof (int16_t)))
+		{
+			failed = 1;
+		}
+		for (i=0; i < a->ht_Channels; i++)
+		{
+			if ((a->ht_Voices[i].vc_SamplePos != b->ht_Voices[i].vc_SamplePos) ||
+			    (a->ht_Voices[i].vc_RingSamplePos != b->ht_Voices[i].vc_RingSamplePos))
+			{
+				failed = 1;
+			}
+		}
+	}
+	free (a);
+	free (b);
+
+	printf ("%s%s%s\n", failed ? ANSI_COLOR_RED : ANSI_COLOR_GREEN, failed ? "failed" : "ok", ANSI_COLOR_RESET);
+	return failed;
+}
+
+/* A small AHX tune: one square wave instrument playing on the first channel, and one octave up in the subsong */
+static size_t make_tune (uint8_t *song)
+{
+	static const uint8_t header[] =
+	{
+		'T', 'H', 'X', 1, 0, 0,
+		0x80, 2,                 /* track 0 is not stored, 2 positions */
+		0, 0,                    /* restart */
+		4, 1, 1, 1,              /* track length, tracks, instruments, subsongs */
+		0, 1,                    /* subsong 1 starts at position 1 */
+		1, 0,  1, 0,  0, 0,  0, 0,
+		1, 12, 1, 0,  0, 0,  0, 0,
+		25 << 2, 0x10, 0,  0, 0, 0,  0x58, 0x10, 0,  0, 0, 0, /* track 1 */
+		64, 0x03, 1, 64, 1, 64, 10, 1, 0,  0, 0, 0,  0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+		0x01, 0x80, 0, 0,
+		't', 'e', 's', 't', 0, 'i', 'n', 's', 0
+	};
+	memcpy (song, header, sizeof (header));
+	return sizeof (header);
+}
+
+static int test_tune (void)
+{
+	uint8_t song[128];
+	size_t songlen = make_tune (song);
+	struct hvl_tune *a, *b;
+	int frame, failed = 0;
+	const size_t samples = 44100 / 50;
+
+	printf ("tune: ");
+	a = hvl_LoadTune_memory (song, songlen, 4, 44100);
+	b = hvl_LoadTune_memory (song, songlen, 4, 44100);
+	if ((!a) || (!b))
+	{
+		failed = 1;
+		goto out;
+	}
+	hvl_InitSubsong (a, 1);
+	hvl_InitSubsong (b, 1);
+	for (frame = 0; frame < 500; frame++)
+	{
+		reference_decodeframe (a, ref, samples);
+		hvl_DecodeFrame (b, out, samples);
+		if (memcmp (ref, out, samples * MAX_CHANNELS * 2 * sizeof (int16_t)))
+		{
+			failed = 1;
+			break;
+		}
+	}
+out:
+	if (a) hvl_FreeTune (a);
+	if (b) hvl_FreeTune (b);
+
+	printf ("%s%s%s\n", failed ? ANSI_COLOR_RED : ANSI_COLOR_GREEN, failed ? "failed" : "ok", ANSI_COLOR_RESET);
+	return failed;
+}
+
+static void benchmark (const char *name, void (*mixchunk) (struct hvl_tune *ht, int16_t *buf, size_t samples), int chans)
+{
+	struct hvl_tune *ht = malloc (sizeof (*ht));
+	struct timespec t1, t2;
+	uint64_t c1 = 0, c2 = 0;
+	double elapsed;
+	int i;
+
+	/* notes of a period of 113 to 856 at 44100Hz, so waveforms wrap every few hundred to few thousand samples */
+	srand (2);
+	random_voices (ht, chans, 0x18000);
+
+	clock_gettime (CLOCK_MONOTONIC, &t1);
+#ifdef HAVE_RDTSC
+	c1 = __rdtsc ();
+#endif
+	for (i=0; i < 500; i++)
+	{
+		mixchunk (ht, out, MAXSAMPLES);
+	}
+#ifdef HAVE_RDTSC
+	c2 = __rdtsc ();
+#endif
+	clock_gettime (CLOCK_MONOTONIC, &t2);
+	elapsed = (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1000000000.0;
+
+	printf ("benchmark %-9s %2d voices: %6.2f cycles, %6.2f ns per sample\n", name, chans,
+		(double)(c2 - c1) / (500.0 * MAXSAMPLES), elapsed * 1000000000.0 / (500.0 * MAXSAMPLES));
+	free (ht);
+}
+
+int main (int argc, char *argv[])
+{
+	int retval = 0;
+
+	hvl_InitReplayer ();
+
+	retval |= test_random ();
+	retval |= test_tune ();
+
+	benchmark ("reference", reference_mixchunk, 4);
+	benchmark ("reference", reference_mixchunk, 16);
+	benchmark ("mixchunk", hvl_mixchunk, 4);
+	benchmark ("mixchunk", hvl_mixchunk, 16);
+
+	return retval;
+}
@@ -20,6 +20,7 @@
 
 #include "config.h"
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 #include "types.h"
 #include "player.h"
@@ -1520,63 +1521,103 @@ static void hvl_play_irq ( struct hvl_tune *ht )
 	}
 }
 
+/* Voice state for hvl_mixchunk(), shared with hvl_mixblock() */
+struct hvl_mixer
+{
+	const int8_t *src[MAX_CHANNELS];
+	const int8_t *rsrc[MAX_CHANNELS]; /* NULL if no ring modulation */
+	uint32_t      delta[MAX_CHANNELS];
+	uint32_t      rdelta[MAX_CHANNELS];
+	uint32_t      pos[MAX_CHANNELS];
+	uint32_t      rpos[MAX_CHANNELS];
+	int32_t       vol[MAX_CHANNELS];
+	int32_t       panl[MAX_CHANNELS];
+	int32_t       panr[MAX_CHANNELS];
+	uint32_t      chans;
+};
+
+/* Mixes loops frames, where no voice wraps its waveform. Returns buf after the last frame */
+static inline int16_t *hvl_mixblock (struct hvl_mixer *m, int16_t *buf, uint32_t loops)
+{
+	const uint32_t chans = m->chans;
+	int32_t  j;
+	uint32_t i;
+
+	do
+	{
+		for ( i=0; i<chans; i++ )
+		{
+			if ( m->rsrc[i] )
+			{
+				/* Ring Modulation */
+				j = ((m->src[i][m->pos[i]>>16]*m->rsrc[i][m->rpos[i]>>16])>>7)*m->vol[i];
+				m->rpos[i] += m->rdelta[i];
+			} else {
+				j = m->src[i][m->pos[i]>>16]*m->vol[i];
+			}
+
+			*(buf++) = (j * m->panl[i]) >> 7;
+			*(buf++) = (j * m->panr[i]) >> 7;
+			m->pos[i] += m->delta[i];
+		}
+		/* clear non-used channels, just to be nice to the caller */
+		for ( ; i < MAX_CHANNELS; i++)
+		{
+			*(buf++) = 0;
+			*(buf++) = 0;
+		}
+
+		loops--;
+	} while ( loops > 0 );
+
+	return buf;
+}
+
 static void
 hvl_mixchunk (struct hvl_tune *ht, int16_t *buf, size_t samples)
 {
-	const int8_t *src[MAX_CHANNELS];
-	const int8_t *rsrc[MAX_CHANNELS];
-	uint32_t  delta[MAX_CHANNELS];
-	uint32_t  rdelta[MAX_CHANNELS];
-	int32_t   vol[MAX_CHANNELS];
-	uint32_t  pos[MAX_CHANNELS];
-	uint32_t  rpos[MAX_CHANNELS];
+	struct hvl_mixer m;
 	uint32_t  cnt;
-	int32_t   panl[MAX_CHANNELS];
-	int32_t   panr[MAX_CHANNELS];
-//	uint32_t  vu[MAX_CHANNELS];
-	int32_t   j;
-	uint32_t  i, chans, loops;
+	uint32_t  i, loops;
 
-	chans = ht->ht_Channels;
-	for ( i=0; i<chans; i++ )
+	m.chans = ht->ht_Channels;
+	for ( i=0; i<m.chans; i++ )
 	{
-		delta[i] = ht->ht_Voices[i].vc_Delta;
-		vol[i]   = ht->ht_Voices[i].vc_VoiceVolume;
-		pos[i]   = ht->ht_Voices[i].vc_SamplePos;
-		src[i]   = ht->ht_Voices[i].vc_MixSource;
-		panl[i]  = ht->ht_Voices[i].vc_PanMultLeft;
-		panr[i]  = ht->ht_Voices[i].vc_PanMultRight;
+		m.delta[i] = ht->ht_Voices[i].vc_Delta;
+		m.vol[i]   = ht->ht_Voices[i].vc_VoiceVolume;
+		m.pos[i]   = ht->ht_Voices[i].vc_SamplePos;
+		m.src[i]   = ht->ht_Voices[i].vc_MixSource;
+		m.panl[i]  = ht->ht_Voices[i].vc_PanMultLeft;
+		m.panr[i]  = ht->ht_Voices[i].vc_PanMultRight;
 
 	/* Ring Modulation */
-		rdelta[i]= ht->ht_Voices[i].vc_RingDelta;
-		rpos[i]  = ht->ht_Voices[i].vc_RingSamplePos;
-		rsrc[i]  = ht->ht_Voices[i].vc_RingMixSource;
-
-//		vu[i] = 0;
+		m.rdelta[i]= ht->ht_Voices[i].vc_RingDelta;
+		m.rpos[i]  = ht->ht_Voices[i].vc_RingSamplePos;
+		m.rsrc[i]  = ht->ht_Voices[i].vc_RingMixSource;
 	}
 
 	do
 	{
 		loops = samples;
-		for ( i=0; i<chans; i++ )
+		for ( i=0; i<m.chans; i++ )
 		{
-			if ( pos[i] >= (0x280 << 16))
+			if ( m.pos[i] >= (0x280 << 16))
 			{
-				pos[i] -= 0x280<<16;
+				m.pos[i] -= 0x280<<16;
 			}
-			cnt = ((0x280<<16) - pos[i] - 1) / delta[i] + 1;
+			cnt = ((0x280<<16) - m.pos[i] - 1) / m.delta[i] + 1;
 			if ( cnt < loops )
 			{
 				loops = cnt;
 			}
 
-			if ( rsrc[i] )
+			if ( m.rsrc[i] )
 			{
-				if ( rpos[i] >= (0x280<<16))
+				if ( m.rpos[i] >= (0x280<<16))
 				{
-					rpos[i] -= 0x280<<16;
+					m.rpos[i] -= 0x280<<16;
 				}
-				cnt = ((0x280<<16) - rpos[i] - 1) / rdelta[i] + 1;
+				cnt = ((0x280<<16) - m.rpos[i] - 1) / m.rdelta[i] + 1;
 				if ( cnt < loops )
 				{
 					loops = cnt;
@@ -1586,51 +1627,13 @@ hvl_mixchunk (struct hvl_tune *ht, int16_t *buf, size_t samples)
 
 		samples -= loops;
 
-		// Inner loop
-		do
-		{
-			for ( i=0; i<chans; i++ )
-			{
-				if ( rsrc[i] )
-				{
-					/* Ring Modulation */
-					j = ((src[i][pos[i]>>16]*rsrc[i][rpos[i]>>16])>>7)*vol[i];
-					rpos[i] += rdelta[i];
-				} else {
-					j = src[i][pos[i]>>16]*vol[i];
-				}
-				/*
-				if ( abs( j ) > vu[i] )
-				{
-					vu[i] = abs( j );
-				}
-				*/
-
-				*(buf++) = (j * panl[i]) >> 7;
-				*(buf++) = (j * panr[i]) >> 7;
-				pos[i] += delta[i];
-			}
-#if 1
-			/* clear non-used channels, just to be nice to the caller */
-			for ( ; i < MAX_CHANNELS; i++)
-			{
-				*(buf++) = 0;
-				*(buf++) = 0;
-			}
-#else
-/* Possible micro-optimalization */
-			buf += 2 * (MAX_CHANNELS - chans);
-#endif
-
-			loops--;
-		} while ( loops > 0 );
+		buf = hvl_mixblock (&m, buf, loops);
 	} while ( samples > 0 );
 
-	for ( i=0; i<chans; i++ )
+	for ( i=0; i<m.chans; i++ )
 	{
-		ht->ht_Voices[i].vc_SamplePos = pos[i];
-		ht->ht_Voices[i].vc_RingSamplePos = rpos[i];
-//		ht->ht_Voices[i].vc_VUMeter = vu[i];
+		ht->ht_Voices[i].vc_SamplePos = m.pos[i];
+		ht->ht_Voices[i].vc_RingSamplePos = m.rpos[i];
 	}
 }
 
@@ -1656,11 +1659,10 @@ void __attribute__ ((visibility ("internal"))) hvl_DecodeFrame (struct hvl_tune
 	}
 }
 
-#if 0
-int32_t __attribute__ ((visibility ("internal"))) hvl_mix_findloudest ( struct hvl_tune *ht, uint32_ samples )
+static int32_t hvl_mix_findloudest ( struct hvl_tune *ht, uint32_t samples )
 {
-	int8_t   *src[MAX_CHANNELS];
-	int8_t   *rsrc[MAX_CHANNELS];
+	const int8_t *src[MAX_CHANNELS];
+	const int8_t *rsrc[MAX_CHANNELS];
 	uint32_t  delta[MAX_CHANNELS];
 	uint32_t  rdelta[MAX_CHANNELS];
 	int32_t   vol[MAX_CHANNELS];
@@ -1768,7 +1770,7 @@ int32_t __attribute__ ((visibility ("internal"))) hvl_mix_findloudest ( struct h
 	return loud;
 }
 
-int32_t __attribute__ ((visibility ("internal"))) hvl_FindLoudest ( struct hvl_tune *ht, int32_t maxframes, BOOL usesongend )
+int32_t __attribute__ ((visibility ("internal"))) hvl_FindLoudest ( struct hvl_tune *ht, int32_t maxframes, int usesongend )
 {
 	uint32_t rsamp, rloop;
 	uint32_t samples, loops, loud, n;
@@ -1808,4 +1810,3 @@ int32_t __attribute__ ((visibility ("internal"))) hvl_FindLoudest ( struct hvl_t
 
 	return loud;
 }
-#endif
@@ -243,8 +243,7 @@ struct hvl_tune
 void __attribute__ ((visibility ("internal"))) hvl_DecodeFrame (struct hvl_tune *ht, int16_t *buf, size_t buflen);
 void __attribute__ ((visibility ("internal"))) hvl_InitReplayer (void);
 int __attribute__ ((visibility ("internal"))) hvl_InitSubsong (struct hvl_tune *ht, uint32_t nr);
-#if 0
+/* Renders up to maxframes frames without output, and returns the loudest sample of the stereo mix. Only touches ht, so it can run on other threads */
 int32_t __attribute__ ((visibility ("internal"))) hvl_FindLoudest (struct hvl_tune *ht, int32_t maxframes, int usesongend);
-#endif
 
 #endif
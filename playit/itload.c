@@ -610,36 +610,7 @@ int __attribute__ ((visibility ("internal"))) it_load(struct cpifaceSessionAPI_t
 		sp->packed=(shdr.flags&8?1:0);
 		if (sp->packed && this->deltapacked && (shdr.cvt & 4))
 			sp->packed|=2;
-
-		if (!(sip->ptr=malloc((sip->length+512)<<((sip->type&mcpSamp16Bit)?1:0))))
-		{
-			fprintf(stderr, __FILE__ ": malloc(%d) failed #15\n", (sip->length+512)<<((sip->type&mcpSamp16Bit)?1:0));
-			return errAllocMem;
-		}
-	}
-
-	for (i=0; i<hdr.nsmps; i++)
-	{
-		struct it_sampleinfo *sip=&this->sampleinfos[i];
-		struct it_sample *sp=&this->samples[i];
-
-		if (!sip->ptr)
-			continue;
-		file->seek_set (file, sampoff[i]);
-
-		if (sp->packed) {
-			if (sip->type & mcpSamp16Bit)
-				decompress16(file, sip->ptr, sip->length, sp->packed&2);
-			else
-				decompress8(file, sip->ptr, sip->length, sp->packed&2);
-		} else {
-			uint64_t len = sip->length<<((sip->type&mcpSamp16Bit)?1:0);
-			if (file->read (file, sip->ptr, len) != len)
-			{
-				fprintf(stderr, "[IT]: fread() failed #14 (sip-ptr=%p sip->length=%d 16bit=%d)\n", sip->ptr, (int)sip->length, !!(sip->type&mcpSamp16Bit));
-				return errFileRead;
-			}
-		}
+		sp->dataoffset=sampoff[i];
 	}
 
 	this->ninst=(hdr.flags&4)?hdr.nins:hdr.nsmps;
@@ -785,6 +756,44 @@ int __attribute__ ((visibility ("internal"))) it_load(struct cpifaceSessionAPI_t
 	return 0;
 }
 
+/* sample data is loaded separately, so it can be skipped if the sample cache already has the converted samples */
+int __attribute__ ((visibility ("internal"))) it_load_sampledata(struct it_module *this, struct ocpfilehandle_t *file)
+{
+	int i;
+
+	for (i=0; i<this->nsampi; i++)
+	{
+		struct it_sampleinfo *sip=&this->sampleinfos[i];
+		struct it_sample *sp=&this->samples[i];
+
+		if ((!sip->length) || sip->ptr)
+			continue;
+
+		if (!(sip->ptr=malloc((sip->length+512)<<((sip->type&mcpSamp16Bit)?1:0))))
+		{
+			fprintf(stderr, __FILE__ ": malloc(%d) failed #15\n", (sip->length+512)<<((sip->type&mcpSamp16Bit)?1:0));
+			return errAllocMem;
+		}
+
+		file->seek_set (file, sp->dataoffset);
+
+		if (sp->packed) {
+			if (sip->type & mcpSamp16Bit)
+				decompress16(file, sip->ptr, sip->length, sp->packed&2);
+			else
+				decompress8(file, sip->ptr, sip->length, sp->packed&2);
+		} else {
+			uint64_t len = sip->length<<((sip->type&mcpSamp16Bit)?1:0);
+			if (file->read (file, sip->ptr, len) != len)
+			{
+				fprintf(stderr, "[IT]: fread() failed #14 (sip-ptr=%p sip->length=%d 16bit=%d)\n", sip->ptr, (int)sip->length, !!(sip->type&mcpSamp16Bit));
+				return errFileRead;
+			}
+		}
+	}
+	return 0;
+}
+
 void __attribute__ ((visibility ("internal"))) it_free(struct it_module *this)
 {
 	int i;
@@ -95,6 +95,48 @@ static int it_random(struct itplayer *this)
 
 static struct itplayer *staticthis=NULL;
 
+#define IT_CHECKPOINT_INTERVAL (5*65536) /* a seek never needs to simulate more than this */
+#define IT_PRECALC_MAXTIME (4*3600*65536) /* give up finding the end of songs that never loop */
+
+/* New note actions keep notes sounding on physical channels of their own, and when such a note ends decides which
+ * channel the next note gets. So while simulating, each physical channel follows the sample position the mixer would
+ * be at, and a seek restarts the notes still sounding from there */
+struct it_simvoice
+{
+	int samp; /* -1 if none */
+	int playing;
+	int loop; /* as given to mcpCLoop: 0 none, 1 sustain loop, 2 loop */
+	int back;
+	uint64_t pos; /* 16.16 */
+	uint32_t frq; /* the rate is samprate*frq/div */
+	uint32_t div;
+};
+
+struct it_checkpoint
+{
+	uint32_t time;
+	int timerfrac;
+	int gspeed;
+	int randseed;
+	int gotoord;
+	int gotorow;
+	int manualgoto;
+	int patdelayrow;
+	int patdelaytick;
+	uint8_t *patptr;
+	int speed;
+	int tempo;
+	int gvol;
+	int gvolslide;
+	int curtick;
+	int currow;
+	int curord;
+	int looped;
+	struct it_logchan *channels; /* one allocation, followed by pchannels and simvoices */
+	struct it_physchan *pchannels;
+	struct it_simvoice *simvoices;
+};
+
 static int8_t sintab[256] =
 {
 	  0,   2,   3,   5,   6,   8,   9,  11,  12,  14,  16,  17,  19,  20,
@@ -1543,6 +1585,8 @@ static void putglobdata (struct cpifaceSessionAPI_t *cpifaceSession, struct itpl
 
 static void putque(struct itplayer *this, int type, int val1, int val2)
 {
+	if (this->simulating)
+		return;
 	if (((this->quewpos+1)%this->quelen)==this->querpos)
 		return;
 	this->que[this->quewpos][0]=this->proctime;
@@ -1560,7 +1604,11 @@ static int gettime (struct cpifaceSessionAPI_t *cpifaceSession)
 static void readque (struct cpifaceSessionAPI_t *cpifaceSession, struct itplayer *this)
 {
 	int i;
-	int time = gettime (cpifaceSession);
+	int time;
+
+	if (this->simulating)
+		return;
+	time = gettime (cpifaceSession);
 	while (1)
 	{
 		int t, val1, val2;
@@ -1806,6 +1854,410 @@ static void playtick (struct cpifaceSessionAPI_t *cpifaceSession, struct itplaye
 	putque(this, quePos, -1, (this->curtick&0xFF)|(this->currow<<8)|(this->curord<<16));
 }
 
+static struct cpifaceSessionAPI_t simsession; /* the real session, but with the mixer calls stubbed out */
+
+static void it_sim_set (int ch, int opt, int val)
+{
+	struct itplayer *this=staticthis;
+	struct it_simvoice *v;
+	const struct it_sampleinfo *si;
+
+	if (ch<0)
+	{
+		if ((opt==mcpGSpeed)&&val)
+			this->simgspeed=val;
+		return;
+	}
+	if (ch>=this->npchan)
+		return;
+	v=&this->simvoices[ch];
+	si=(v->samp<0)?0:&this->sampleinfos[v->samp];
+	switch (opt)
+	{
+		case mcpCReset:
+			memset(v, 0, sizeof(*v));
+			v->samp=-1;
+			break;
+		case mcpCInstrument:
+			memset(v, 0, sizeof(*v));
+			v->samp=-1;
+			if ((val<0)||(val>=this->nsampi))
+				break;
+			v->samp=val;
+			si=&this->sampleinfos[val];
+			v->loop=(si->type&mcpSampSLoop)?1:(si->type&mcpSampLoop)?2:0;
+			break;
+		case mcpCPosition:
+			if (!si)
+				break;
+			if (val<0)
+				val=0;
+			if ((unsigned)val>=si->length)
+				val=si->length-1;
+			v->pos=(uint64_t)val<<16;
+			break;
+		case mcpCLoop: /* same rules as the mixer */
+			if (!si)
+				break;
+			if ((val==1)&&!(si->type&mcpSampSLoop))
+				val=2;
+			if ((val==2)&&!(si->type&mcpSampLoop))
+				val=0;
+			v->loop=val;
+			break;
+		case mcpCDirect:
+			v->back=(val==0)?0:(val==1)?1:!v->back;
+			break;
+		case mcpCStatus:
+			v->playing=val&&si&&((v->pos>>16)<si->length);
+			break;
+		case mcpCPitch:
+			v->frq=8363;
+			v->div=simsession.mcpAPI->GetFreq8363(-val);
+			break;
+		case mcpCPitch6848:
+			v->frq=6848;
+			v->div=val;
+			break;
+	}
+}
+
+static int it_sim_get (int ch, int opt)
+{
+	if ((ch>=0)&&(ch<staticthis->npchan)&&(opt==mcpCStatus))
+		return staticthis->simvoices[ch].playing;
+	return 0;
+}
+
+static void it_simvoice_advance (const struct it_sampleinfo *si, struct it_simvoice *v, uint64_t dist)
+{
+	uint64_t ls, le, f;
+	int bidi;
+
+	if (v->loop==1)
+	{
+		ls=(uint64_t)si->sloopstart<<16;
+		le=(uint64_t)si->sloopend<<16;
+		bidi=si->type&mcpSampSBiDi;
+	} else if (v->loop==2)
+	{
+		ls=(uint64_t)si->loopstart<<16;
+		le=(uint64_t)si->loopend<<16;
+		bidi=si->type&mcpSampBiDi;
+	} else {
+		ls=le=0;
+	}
+	if (le<=ls) /* no loop */
+		bidi=0;
+
+	if (v->back&&(!bidi||(v->pos>=ls+dist)))
+	{
+		if (v->pos<dist)
+			v->playing=0;
+		else
+			v->pos-=dist;
+		return;
+	}
+	if (!v->back)
+	{
+		v->pos+=dist;
+		if (le<=ls)
+		{
+			if (v->pos>=((uint64_t)si->length<<16))
+				v->playing=0;
+			return;
+		}
+		if (v->pos<le)
+			return;
+		f=v->pos-ls;
+	} else
+		f=(le-ls)+(le-v->pos)+dist; /* a ping-pong loop unrolled, the second half plays backwards */
+
+	if (bidi)
+	{
+		f%=2*(le-ls);
+		v->back=f>=(le-ls);
+		v->pos=v->back?(le-(f-(le-ls))):(ls+f);
+	} else
+		v->pos=ls+f%(le-ls);
+}
+
+static void it_sim_tick (struct itplayer *this)
+{
+	int i;
+
+	playtick (&simsession, this);
+
+	for (i=0; i<this->npchan; i++)
+	{
+		struct it_simvoice *v=&this->simvoices[i];
+		if (v->playing&&v->div)
+			it_simvoice_advance (&this->sampleinfos[v->samp], v, (((uint64_t)this->sampleinfos[v->samp].samprate*v->frq)<<24)/v->div/this->simgspeed);
+	}
+
+	this->simtimerfrac+=((uint64_t)256<<28)/this->simgspeed;
+	this->simtime+=this->simtimerfrac>>12;
+	this->simtimerfrac&=4095;
+}
+
+static int it_checkpoint_save (struct itplayer *this, struct it_checkpoint *c)
+{
+	c->channels=malloc(sizeof(this->channels[0])*this->nchan+(sizeof(this->pchannels[0])+sizeof(this->simvoices[0]))*this->npchan);
+	if (!c->channels)
+		return -1;
+	c->pchannels=(struct it_physchan *)(c->channels+this->nchan);
+	c->simvoices=(struct it_simvoice *)(c->pchannels+this->npchan);
+	memcpy(c->channels, this->channels, sizeof(this->channels[0])*this->nchan);
+	memcpy(c->pchannels, this->pchannels, sizeof(this->pchannels[0])*this->npchan);
+	memcpy(c->simvoices, this->simvoices, sizeof(this->simvoices[0])*this->npchan);
+	c->time=this->simtime;
+	c->timerfrac=this->simtimerfrac;
+	c->gspeed=this->simgspeed;
+	c->randseed=this->randseed;
+	c->gotoord=this->gotoord;
+	c->gotorow=this->gotorow;
+	c->manualgoto=this->manualgoto;
+	c->patdelayrow=this->patdelayrow;
+	c->patdelaytick=this->patdelaytick;
+	c->patptr=this->patptr;
+	c->speed=this->speed;
+	c->tempo=this->tempo;
+	c->gvol=this->gvol;
+	c->gvolslide=this->gvolslide;
+	c->curtick=this->curtick;
+	c->currow=this->currow;
+	c->curord=this->curord;
+	c->looped=this->looped;
+	return 0;
+}
+
+/* The channels keep the mute setting of the user */
+static void it_checkpoint_load (struct itplayer *this, const struct it_checkpoint *c)
+{
+	int i;
+
+	for (i=0; i<this->nchan; i++)
+	{
+		int mute=this->channels[i].mute;
+		this->channels[i]=c->channels[i];
+		this->channels[i].mute=mute;
+	}
+	memcpy(this->pchannels, c->pchannels, sizeof(this->pchannels[0])*this->npchan);
+	memcpy(this->simvoices, c->simvoices, sizeof(this->simvoices[0])*this->npchan);
+	this->simtime=c->time;
+	this->simtimerfrac=c->timerfrac;
+	this->simgspeed=c->gspeed;
+	this->randseed=c->randseed;
+	this->gotoord=c->gotoord;
+	this->gotorow=c->gotorow;
+	this->manualgoto=c->manualgoto;
+	this->patdelayrow=c->patdelayrow;
+	this->patdelaytick=c->patdelaytick;
+	this->patptr=c->patptr;
+	this->speed=c->speed;
+	this->tempo=c->tempo;
+	this->gvol=c->gvol;
+	this->gvolslide=c->gvolslide;
+	this->curtick=c->curtick;
+	this->currow=c->currow;
+	this->curord=c->curord;
+	this->looped=c->looped;
+}
+
+static int it_checkpoint_add (struct itplayer *this)
+{
+	struct it_checkpoint *temp;
+
+	if (!(this->ncheckpoints&63))
+	{
+		temp=realloc(this->checkpoints, sizeof(this->checkpoints[0])*(this->ncheckpoints+64));
+		if (!temp)
+			return -1;
+		this->checkpoints=temp;
+	}
+	if (it_checkpoint_save(this, &this->checkpoints[this->ncheckpoints]))
+		return -1;
+	this->ncheckpoints++;
+	return 0;
+}
+
+static void it_precalc_free (struct itplayer *this)
+{
+	int i;
+
+	for (i=0; i<this->ncheckpoints; i++)
+		free(this->checkpoints[i].channels);
+	free(this->checkpoints);
+	this->checkpoints=0;
+	this->ncheckpoints=0;
+	free(this->rowtimes);
+	this->rowtimes=0;
+	free(this->ordrows);
+	this->ordrows=0;
+	free(this->simvoices);
+	this->simvoices=0;
+	this->songlength=0;
+}
+
+static int it_patloop_active (struct itplayer *this)
+{
+	int i;
+
+	for (i=0; i<this->nchan; i++)
+		if (this->channels[i].patloopcount)
+			return 1;
+	return 0;
+}
+
+/* Plays the whole song without output, noting when each row starts and
+ * saving the complete player state every IT_CHECKPOINT_INTERVAL. The song
+ * ends when it starts a row it has already played without a pattern loop
+ * being in progress, this includes wrapping around at the end. */
+static void it_precalc (struct cpifaceSessionAPI_t *cpifaceSession, struct itplayer *this)
+{
+	int i, rows=0;
+	int oldnoloop=this->noloop;
+
+	this->ordrows=malloc(sizeof(this->ordrows[0])*this->nord);
+	this->simvoices=malloc(sizeof(this->simvoices[0])*this->npchan);
+	if (!this->ordrows||!this->simvoices)
+	{
+		it_precalc_free(this);
+		return;
+	}
+	for (i=0; i<this->nord; i++)
+	{
+		this->ordrows[i]=rows;
+		if (this->orders[i]!=0xFFFF)
+			rows+=this->patlens[this->orders[i]];
+	}
+	this->rowtimes=malloc(sizeof(this->rowtimes[0])*(rows?rows:1));
+	if (!this->rowtimes)
+	{
+		it_precalc_free(this);
+		return;
+	}
+	memset(this->rowtimes, 0xff, sizeof(this->rowtimes[0])*rows);
+	for (i=0; i<this->npchan; i++)
+	{
+		memset(&this->simvoices[i], 0, sizeof(this->simvoices[i]));
+		this->simvoices[i].samp=-1;
+	}
+
+	simsession=*cpifaceSession;
+	simsession.mcpSet=it_sim_set;
+	simsession.mcpGet=it_sim_get;
+	this->simulating=1;
+	this->noloop=0;
+	this->simtime=0;
+	this->simtimerfrac=0;
+	this->simgspeed=256*2*this->tempo/5;
+
+	if (it_checkpoint_add(this))
+	{
+		it_precalc_free(this);
+		this->simulating=0;
+		this->noloop=oldnoloop;
+		return;
+	}
+
+	while (this->simtime<IT_PRECALC_MAXTIME)
+	{
+		uint32_t ticktime=this->simtime;
+		int newrow=((this->curtick+1)==(this->speed+this->patdelaytick))&&!this->patdelayrow;
+		int patloop=it_patloop_active(this); /* the last pass of a loop clears the counter while starting the row */
+
+		it_sim_tick(this);
+		if (newrow)
+		{
+			uint32_t *t=&this->rowtimes[this->ordrows[this->curord]+this->currow];
+			if (*t==0xffffffff)
+				*t=ticktime;
+			else if (!patloop)
+			{
+				this->songlength=ticktime;
+				break;
+			}
+		}
+		if ((this->simtime-this->checkpoints[this->ncheckpoints-1].time)>=IT_CHECKPOINT_INTERVAL)
+			it_checkpoint_add(this);
+	}
+
+	it_checkpoint_load(this, &this->checkpoints[0]);
+	this->simulating=0;
+	this->noloop=oldnoloop;
+}
+
+/* Restores the last checkpoint before time, and simulates up to it. Returns the time reached */
+static uint32_t it_seek (struct cpifaceSessionAPI_t *cpifaceSession, struct itplayer *this, uint32_t time)
+{
+	int lo=0, hi=this->ncheckpoints;
+	int oldnoloop=this->noloop;
+	int i;
+
+	while ((hi-lo)>1)
+	{
+		int mid=(lo+hi)/2;
+		if (this->checkpoints[mid].time<=time)
+			lo=mid;
+		else
+			hi=mid;
+	}
+
+	this->simulating=1;
+	this->noloop=0;
+	it_checkpoint_load(this, &this->checkpoints[lo]);
+	while (this->simtime<time)
+		it_sim_tick(this);
+	this->simulating=0;
+	this->noloop=oldnoloop;
+
+	/* the notes still sounding, including the ones kept by new note actions, continue where they would be */
+	for (i=0; i<this->npchan; i++)
+	{
+		struct it_simvoice *v=&this->simvoices[i];
+
+		cpifaceSession->mcpSet (i, mcpCReset, 0);
+		if ((this->pchannels[i].lch==-1)||!v->playing)
+			continue;
+		cpifaceSession->mcpSet (i, mcpCInstrument, v->samp);
+		cpifaceSession->mcpSet (i, mcpCPosition, v->pos>>16);
+		cpifaceSession->mcpSet (i, mcpCLoop, v->loop);
+		cpifaceSession->mcpSet (i, mcpCDirect, v->back);
+		cpifaceSession->mcpSet (i, mcpCStatus, 1);
+		putchandata (cpifaceSession, this, &this->pchannels[i]);
+	}
+	cpifaceSession->mcpSet (-1, mcpGSpeed, this->simgspeed);
+	this->querpos=this->quewpos=0;
+	this->realpos=(this->curtick&0xFF)|(this->currow<<8)|(this->curord<<16);
+	this->realtempo=this->tempo;
+	this->realspeed=this->speed;
+	this->realgvol=this->gvol;
+
+	return this->simtime;
+}
+
+/* The time the row is first played at, found the same way as playtick() resolves a jump */
+static uint32_t it_rowtime (struct itplayer *this, int ord, int row)
+{
+	if (ord>=this->endord)
+		ord=0;
+	while ((ord<this->endord)&&(this->orders[ord]==0xFFFF))
+		ord++;
+	if (ord>=this->endord)
+		return 0xffffffff;
+	if (row>=this->patlens[this->orders[ord]])
+	{
+		ord++;
+		row=0;
+		while ((ord<this->endord)&&(this->orders[ord]==0xFFFF))
+			ord++;
+		if (ord>=this->endord)
+			return 0xffffffff;
+	}
+	return this->rowtimes[this->ordrows[ord]+row];
+}
+
 int __attribute__ ((visibility ("internal"))) loadsamples (struct cpifaceSessionAPI_t *cpifaceSession, struct it_module *m)
 {
 	return cpifaceSession->mcpDevAPI->LoadSamples(m->sampleinfos, m->nsampi);
@@ -1844,6 +2296,7 @@ int __attribute__ ((visibility ("internal"))) play (struct itplayer *this, const
 	this->geffect=m->geffect;
 	this->curtick=this->speed-1;
 	this->currow=0;
+	this->looped=0;
 	this->realpos=0;
 	this->pitchhigh=-0x6000;
 	this->pitchlow=0x6000;
@@ -1903,12 +2356,22 @@ int __attribute__ ((visibility ("internal"))) play (struct itplayer *this, const
 		c->tremoroffcounter=0;
 	}
 
+	this->npchan=ch;
+	it_precalc (cpifaceSession, this);
+
 	if (!cpifaceSession->mcpDevAPI->OpenPlayer(ch, playtickstatic, file, cpifaceSession))
+	{
+		it_precalc_free (this);
 		return 0;
+	}
 
 	cpifaceSession->mcpAPI->Normalize (cpifaceSession, mcpNormalizeDefaultPlayW);
 
 	this->npchan = cpifaceSession->PhysicalChannelCount;
+	if (this->npchan!=ch)
+	{ /* the checkpoints are for the physical channels asked for */
+		it_precalc_free (this);
+	}
 
 	return 1;
 }
@@ -1931,6 +2394,7 @@ void __attribute__ ((visibility ("internal"))) stop (struct cpifaceSessionAPI_t
 		free(this->que);
 		this->que=NULL;
 	}
+	it_precalc_free (this);
 }
 
 int __attribute__ ((visibility ("internal"))) getpos(struct itplayer *this)
@@ -1973,25 +2437,66 @@ void __attribute__ ((visibility ("internal"))) itplayer_getrealvol (struct cpifa
 		}
 }
 
-void __attribute__ ((visibility ("internal"))) setpos(struct itplayer *this, int ord, int row)
+int __attribute__ ((visibility ("internal"))) setpos (struct cpifaceSessionAPI_t *cpifaceSession, struct itplayer *this, int ord, int row)
 {
 	int i;
+	if ((ord==this->curord)&&(row>this->patlens[this->orders[this->curord]]))
+	{
+		row=0;
+		ord++;
+	}
+	row=(row>0xFF)?0xFF:(row<0)?0:row;
+	ord=((ord>=this->nord)||(ord<0))?0:ord;
+	if (this->rowtimes)
+	{
+		uint32_t time=it_rowtime(this, ord, row);
+		if (time!=0xffffffff)
+		{ /* restore the player state as it is when the song plays through this row */
+			return ((uint64_t)it_seek (cpifaceSession, this, time)*1000)>>16;
+		}
+	}
 	if (this->curord!=ord)
 		for (i=0; i<this->npchan; i++)
 			this->pchannels[i].notecut=1;
 	this->curtick=this->speed-1;
 	this->patdelaytick=0;
 	this->patdelayrow=0;
-	if ((ord==this->curord)&&(row>this->patlens[this->orders[this->curord]]))
-	{
-		row=0;
-		ord++;
-	}
-	this->gotorow=(row>0xFF)?0xFF:(row<0)?0:row;
-	this->gotoord=((ord>=this->nord)||(ord<0))?0:ord;
+	this->gotorow=row;
+	this->gotoord=ord;
 	this->manualgoto=1;
 	this->querpos=this->quewpos=0;
 	this->realpos=(this->gotorow<<8)|(this->gotoord<<16);
+	return -1;
+}
+
+int __attribute__ ((visibility ("internal"))) getsongtime (struct cpifaceSessionAPI_t *cpifaceSession, struct itplayer *this)
+{
+	int pos=getrealpos (cpifaceSession, this);
+	int ord=pos>>16;
+	int row=(pos>>8)&0xFF;
+
+	if ((!this->rowtimes) || (ord>=this->nord) || (this->orders[ord]==0xFFFF) || (row>=this->patlens[this->orders[ord]]) || (this->rowtimes[this->ordrows[ord]+row]==0xffffffff))
+		return -1;
+	return ((uint64_t)this->rowtimes[this->ordrows[ord]+row]*1000)>>16;
+}
+
+int __attribute__ ((visibility ("internal"))) setsongtime (struct cpifaceSessionAPI_t *cpifaceSession, struct itplayer *this, int ms)
+{
+	uint32_t time;
+
+	if (!this->ncheckpoints)
+		return -1;
+	if (ms<0)
+		ms=0;
+	time=((uint64_t)ms<<16)/1000;
+	if (this->songlength && (time>=this->songlength))
+		return -1;
+	return ((uint64_t)it_seek (cpifaceSession, this, time)*1000)>>16;
+}
+
+uint32_t __attribute__ ((visibility ("internal"))) getsonglength (struct itplayer *this)
+{
+	return ((uint64_t)this->songlength*1000)>>16;
 }
 
 int __attribute__ ((visibility ("internal"))) getdotsdata (struct cpifaceSessionAPI_t *cpifaceSession, struct itplayer *this, int ch, int pch, int *smp, int *note, int *voll, int *volr, int *sus)
@@ -31,6 +31,7 @@ struct it_sample
 	uint8_t vit;
 	uint8_t vir;
 	uint8_t dfp;
+	uint32_t dataoffset; /* used by it_load_sampledata() */
 };
 
 #define IT_KEYTABS 120
@@ -110,6 +111,7 @@ struct it_module
 struct cpifaceSessionAPI_t;
 struct ocpfilehandle_t;
 extern int __attribute__ ((visibility ("internal"))) it_load(struct cpifaceSessionAPI_t *cpifaceSession, struct it_module *, struct ocpfilehandle_t *); /* done */
+extern int __attribute__ ((visibility ("internal"))) it_load_sampledata(struct it_module *, struct ocpfilehandle_t *); /* done */
 extern void __attribute__ ((visibility ("internal"))) it_free(struct it_module *); /* done */
 extern void __attribute__ ((visibility ("internal"))) it_optimizepatlens(struct it_module *); /* done */
 extern int __attribute__ ((visibility ("internal"))) it_precalctime(struct it_module *, int startpos, int (*calctimer)[2], int calcn, int ite); /* done */
@@ -362,6 +364,18 @@ struct itplayer
 	{
 		quePos, queSync, queTempo, queSpeed, queGVol
 	} que_types;
+
+	/* Time index and checkpoints, made by simulating the whole song silently when the module is started. Times are in 1/65536 seconds */
+	int simulating;
+	uint32_t simtime;
+	int simtimerfrac;
+	int simgspeed; /* the last mcpGSpeed, the tick rate is simgspeed/256 Hz */
+	struct it_simvoice *simvoices; /* what the mixer would be doing with each physical channel meanwhile */
+	uint32_t *rowtimes; /* when each row first starts playing, 0xffffffff if never */
+	int *ordrows; /* index into rowtimes for row 0 of each order */
+	struct it_checkpoint *checkpoints;
+	int ncheckpoints;
+	uint32_t songlength; /* until the song loops, 0 if unknown */
 };
 
 struct cpifaceSessionAPI_t;
@@ -377,7 +391,10 @@ extern int __attribute__ ((visibility ("internal"))) getrealpos (struct cpifaceS
 /* extern void __attribute__ ((visibility ("internal"))) setevpos(struct itplayer *this, int ch, int pos, int modtype, int mod); */ /* - done */
 /* extern int __attribute__ ((visibility ("internal"))) getevpos(struct itplayer *this, int ch, int *time); */ /* - done */
 /* extern int __attribute__ ((visibility ("internal"))) findevpos(struct itplayer *this, int pos, int *time); */ /* - done */
-extern void __attribute__ ((visibility ("internal"))) setpos(struct itplayer *this, int ord, int row); /* - done */
+extern int __attribute__ ((visibility ("internal"))) setpos (struct cpifaceSessionAPI_t *cpifaceSession, struct itplayer *this, int ord, int row); /* returns the song time of the new position in ms, or -1 if it is unknown */
+extern int __attribute__ ((visibility ("internal"))) getsongtime (struct cpifaceSessionAPI_t *cpifaceSession, struct itplayer *this); /* song time in ms of the row currently heard, or -1 if it is unknown */
+extern int __attribute__ ((visibility ("internal"))) setsongtime (struct cpifaceSessionAPI_t *cpifaceSession, struct itplayer *this, int ms); /* returns the song time reached in ms, or -1 if time seeking is not possible */
+extern uint32_t __attribute__ ((visibility ("internal"))) getsonglength (struct itplayer *this); /* in ms, until the song loops. 0 if unknown */
 extern void __attribute__ ((visibility ("internal"))) mutechan(struct itplayer *this, int c, int m); /* - done */
 extern void __attribute__ ((visibility ("internal"))) getglobinfo (struct cpifaceSessionAPI_t *cpifaceSession, struct itplayer *this, int *speed, int *bpm, int *gvol, int *gs); /* - done */
 extern int __attribute__ ((visibility ("internal"))) getchansample (struct cpifaceSessionAPI_t *cpifaceSession, struct itplayer *this, int ch, int16_t *buf, int len, uint32_t rate, int opt); /* - done */
@@ -112,6 +112,31 @@ static void dopausefade (struct cpifaceSessionAPI_t *cpifaceSession)
 	cpifaceSession->mcpAPI->SetMasterPauseFadeParameters (cpifaceSession, i);
 }
 
+static void itpJump (struct cpifaceSessionAPI_t *cpifaceSession, int ord, int row)
+{
+	int songtime = setpos (cpifaceSession, &itplayer, ord, row);
+
+	if (songtime >= 0)
+	{ /* the playtime follows the jump */
+		starttime = (cpifaceSession->InPause ? pausetime : clock_ms()) - songtime;
+	}
+}
+
+static void itpJumpTime (struct cpifaceSessionAPI_t *cpifaceSession, int delta)
+{
+	int songtime = getsongtime (cpifaceSession, &itplayer);
+
+	if (songtime < 0)
+	{
+		return;
+	}
+	songtime = setsongtime (cpifaceSession, &itplayer, songtime + delta);
+	if (songtime >= 0)
+	{
+		starttime = (cpifaceSession->InPause ? pausetime : clock_ms()) - songtime;
+	}
+}
+
 static int itpProcessKey(struct cpifaceSessionAPI_t *cpifaceSession, uint16_t key)
 {
 	int row;
@@ -129,6 +154,8 @@ static int itpProcessKey(struct cpifaceSessionAPI_t *cpifaceSession, uint16_t ke
 			cpifaceSession->KeyHelp (KEY_CTRL_RIGHT, "Jump forward (big)");
 			cpifaceSession->KeyHelp (KEY_CTRL_UP, "Jump back (small)");
 			cpifaceSession->KeyHelp (KEY_CTRL_DOWN, "Jump forward (small)");
+			cpifaceSession->KeyHelp ('[', "Jump back 10 seconds");
+			cpifaceSession->KeyHelp (']', "Jump forward 10 seconds");
 			cpifaceSession->KeyHelp (KEY_CTRL_HOME, "Jump to start of track");
 			return 0;
 		case 'p': case 'P':
@@ -149,7 +176,7 @@ static int itpProcessKey(struct cpifaceSessionAPI_t *cpifaceSession, uint16_t ke
 			break;
 		case KEY_CTRL_HOME:
 			itpInstClear (cpifaceSession);
-			setpos (&itplayer, 0, 0);
+			setpos (cpifaceSession, &itplayer, 0, 0);
 			if (cpifaceSession->InPause)
 			{
 				starttime = pausetime;
@@ -161,25 +188,31 @@ static int itpProcessKey(struct cpifaceSessionAPI_t *cpifaceSession, uint16_t ke
 		case KEY_CTRL_LEFT:
 			p=getpos(&itplayer);
 			pat=p>>16;
-			setpos(&itplayer, pat-1, 0);
+			itpJump (cpifaceSession, pat-1, 0);
 			break;
 		case '>':
 		case KEY_CTRL_RIGHT:
 			p=getpos(&itplayer);
 			pat=p>>16;
-			setpos(&itplayer, pat+1, 0);
+			itpJump (cpifaceSession, pat+1, 0);
 			break;
 		case KEY_CTRL_UP:
 			p=getpos(&itplayer);
 			pat=p>>16;
 			row=(p>>8)&0xFF;
-			setpos(&itplayer, pat, row-8);
+			itpJump (cpifaceSession, pat, row-8);
 			break;
 		case KEY_CTRL_DOWN:
 			p=getpos(&itplayer);
 			pat=p>>16;
 			row=(p>>8)&0xFF;
-			setpos(&itplayer, pat, row+8);
+			itpJump (cpifaceSession, pat, row+8);
+			break;
+		case '[':
+			itpJumpTime (cpifaceSession, -10000);
+			break;
+		case ']':
+			itpJumpTime (cpifaceSession, 10000);
 			break;
 		default:
 			return 0;
@@ -307,6 +340,11 @@ static int itpGetLChanSample (struct cpifaceSessionAPI_t *cpifaceSession, unsign
 	return getchansample (cpifaceSession, &itplayer, ch, buf, len, rate, opt);
 }
 
+static int itpLoadSampleData (void *file)
+{
+	return it_load_sampledata (&mod, file);
+}
+
 static int itpOpenFile (struct cpifaceSessionAPI_t *cpifaceSession, struct moduleinfostruct *info, struct ocpfilehandle_t *file)
 {
 	const char *filename;
@@ -320,8 +358,12 @@ static int itpOpenFile (struct cpifaceSessionAPI_t *cpifaceSession, struct modul
 	fprintf(stderr, "loading %s (%uk)...\n", filename, (unsigned int)(file->filesize(file)>>10));
 
 	if (!(retval=it_load(cpifaceSession, &mod, file)))
+	{
+		/* sample data is only decompressed if the sample cache misses */
+		cpifaceSession->mcpAPI->SampleCacheSelect (cpifaceSession->mcpAPI->SampleCacheKey (file, info->modtype.integer.i), itpLoadSampleData, file);
 		if (!loadsamples (cpifaceSession, &mod))
 			retval=-1;
+	}
 
 	if (retval)
 	{
@@ -360,6 +402,11 @@ static int itpOpenFile (struct cpifaceSessionAPI_t *cpifaceSession, struct modul
 
 	cpifaceSession->GetPChanSample = cpifaceSession->mcpGetChanSample;
 
+	if (getsonglength (&itplayer))
+	{ /* found by playing the song through, more exact than the estimate from the file-selector */
+		mdbWritePlaytime (&cpifaceSession->mdbdata, file, getsonglength (&itplayer));
+	}
+
 	starttime = clock_ms();
 	cpifaceSession->InPause = 0;
 	cpifaceSession->mcpSet (-1, mcpMasterPause, 0);
@@ -117,7 +117,7 @@ static const char *IT_description[] =
 	NULL
 };
 
-static struct mdbreadinforegstruct itpReadInfoReg = {"IT", itpReadInfo MDBREADINFOREGSTRUCT_TAIL};
+static struct mdbreadinforegstruct itpReadInfoReg = {"IT", itpReadInfo, MDB_READINFO_THREADSAFE MDBREADINFOREGSTRUCT_TAIL};
 
 int __attribute__ ((visibility ("internal"))) it_type_init (struct PluginInitAPI_t *API)
 {
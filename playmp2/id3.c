@@ -26,13 +26,14 @@
 
 #include "config.h"
 #include <assert.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <zlib.h>
 #include "types.h"
 #include "id3.h"
 
-static int id3_serial = 0;
+static atomic_int id3_serial; /* tags are parsed by the medialib scanner threads too */
 
 const char *ID3_APIC_Titles[0x15] =
 {
@@ -491,12 +492,12 @@ static int utf8_decode (
 	return src - _src;
 }
 
-static int ucs2_be; /* big_endian mode ? */
 /* returns -1 on error, else length of target buffer */
 static int ucs2_decode_strlen (
 	const uint8_t *_src,
 	unsigned int _srclen,
-	int flags)
+	int flags,
+	int *be) /* big endian mode, kept between the strings of one frame */
 {
 	int dstlen = 0;
 	int terminated = 0;
@@ -505,23 +506,23 @@ static int ucs2_decode_strlen (
 
 	if (flags & STRING_FIRST)
 	{
-		ucs2_be = -1;
+		*be = -1;
 	}
 	if (srclen > 2)
 	{
 		if ((src[0] == 0xfe) && (src[1] == 0xff))
 	        { // big endian
-	                ucs2_be = 1;
+	                *be = 1;
 			src+=2;
 			srclen-=2;
 		} else if ((src[0] == 0xff) && (src[1] == 0xfe))
 		{ // little endian
-			ucs2_be = 0;
+			*be = 0;
 			src+=2;
 			srclen-=2;
 		}
 	}
-	if (ucs2_be == -1)
+	if (*be == -1)
 	{
 		/* No BOM detected, required for UCS2 */
 		return -1;
@@ -531,7 +532,7 @@ static int ucs2_decode_strlen (
 	{
 		uint16_t codepoint;
 
-		if (ucs2_be)
+		if (*be)
 		{
 			codepoint = (src[0]<<8) | src[1];
 		} else {
@@ -575,7 +576,8 @@ static int ucs2_decode (
 	const uint8_t *_src,
 	unsigned int _srclen,
 	uint8_t **_dst,
-	int flags)
+	int flags,
+	int *be)
 {
 	int terminated = 0;
 	const uint8_t *src = _src;
@@ -583,41 +585,40 @@ static int ucs2_decode (
 	uint8_t *dst;
 
 	{
-		int _ucs2_be = ucs2_be;
+		int _be = *be;
 		int dstlen;
 
-		dstlen = ucs2_decode_strlen (_src, _srclen, flags);
+		dstlen = ucs2_decode_strlen (_src, _srclen, flags, &_be);
 		if (dstlen < 0) return -1;
 		dst = *_dst = malloc (dstlen + 1);
 		if (!dst) return -1;
-		ucs2_be = _ucs2_be;
 	}
 
 	if (flags & STRING_FIRST)
 	{
-		ucs2_be = -1;
+		*be = -1;
 	}
 	if (srclen > 2)
 	{
 		if ((src[0] == 0xfe) && (src[1] == 0xff))
 	        { // big endian
-	                ucs2_be = 1;
+	                *be = 1;
 			src+=2;
 			srclen-=2;
 		} else if ((src[0] == 0xff) && (src[1] == 0xfe))
 		{ // little endian
-			ucs2_be = 0;
+			*be = 0;
 			src+=2;
 			srclen-=2;
 		}
 	}
-	assert (ucs2_be != -1); // caught by ucs2_decode_strlen
+	assert (*be != -1); // caught by ucs2_decode_strlen
 
 	while (srclen>1)
 	{
 		uint16_t codepoint;
 
-		if (ucs2_be)
+		if (*be)
 		{
 			codepoint = (src[0]<<8) | src[1];
 		} else {
@@ -655,12 +656,12 @@ static int ucs2_decode (
 	return src - _src;
 }
 
-static int utf16_be; /* big_endian_mode */
 /* returns -1 on error, else length of target buffer */
 static int utf16_decode_strlen (
 	const uint8_t *_src,
 	unsigned int _srclen,
-	int flags)
+	int flags,
+	int *be) /* big endian mode, kept between the strings of one frame */
 {
 	int dstlen = 0;
 	int terminated = 0;
@@ -670,14 +671,14 @@ static int utf16_decode_strlen (
 
 	if (flags & STRING_FIRST)
 	{
-		utf16_be = 1;
+		*be = 1;
 	}
 
 	while (srclen>1)
 	{
 		uint32_t codepoint;
 
-		if (utf16_be)
+		if (*be)
 		{
 			codepoint = (src[0]<<8) | src[1];
 		} else {
@@ -725,7 +726,7 @@ static int utf16_decode_strlen (
 		}
 		if (codepoint == 0xfffe)
 		{
-			utf16_be = !utf16_be;
+			*be = !*be;
 			continue;
 		} else if (codepoint < 0x0080)
 		{
@@ -756,7 +757,8 @@ static int utf16_decode (
 	const uint8_t *_src,
 	unsigned int _srclen,
 	uint8_t **_dst,
-	int flags)
+	int flags,
+	int *be)
 {
 	int terminated = 0;
 	const uint8_t *src = _src;
@@ -765,26 +767,25 @@ static int utf16_decode (
 	uint32_t first_surrogate = 0;
 
 	{
-		int _utf16_be = utf16_be;
+		int _be = *be;
 		int dstlen;
 
-		dstlen = utf16_decode_strlen (_src, _srclen, flags);
+		dstlen = utf16_decode_strlen (_src, _srclen, flags, &_be);
 		if (dstlen < 0) return -1;
 		dst = *_dst = malloc (dstlen + 1);
 		if (!dst) return -1;
-		utf16_be = _utf16_be;
 	}
 
 	if (flags & STRING_FIRST)
 	{
-		utf16_be = 1;
+		*be = 1;
 	}
 
 	while (srclen>1)
 	{
 		uint32_t codepoint;
 
-		if (utf16_be)
+		if (*be)
 		{
 			codepoint = (src[0]<<8) | src[1];
 		} else {
@@ -823,7 +824,7 @@ static int utf16_decode (
 			}
 			if (codepoint == 0xfffe)
 			{
-				utf16_be = !utf16_be;
+				*be = !*be;
 				continue;
 			}
 		}
@@ -952,6 +953,7 @@ static int parse_frame_T(uint8_t **dst, const uint8_t *src, uint32_t srclen)
 {
 	uint8_t text_encoding;
 	int result;
+	int be = 1;
 
 	if (srclen < 1)
 	{
@@ -969,10 +971,10 @@ static int parse_frame_T(uint8_t **dst, const uint8_t *src, uint32_t srclen)
 			result = iso8859_1_decode (src, srclen, dst, STRING_NO_TERMINATION | STRING_FIRST);
 			break;
 		case 1:
-			result = ucs2_decode (src, srclen, dst, STRING_NO_TERMINATION | STRING_FIRST);
+			result = ucs2_decode (src, srclen, dst, STRING_NO_TERMINATION | STRING_FIRST, &be);
 			break;
 		case 2:
-			result = utf16_decode (src, srclen, dst, STRING_NO_TERMINATION | STRING_FIRST);
+			result = utf16_decode (src, srclen, dst, STRING_NO_TERMINATION | STRING_FIRST, &be);
 			break;
 		case 3:
 			result = utf8_decode (src, srclen, dst, STRING_NO_TERMINATION | STRING_FIRST);
@@ -989,6 +991,7 @@ static int parse_frame_COMM(uint8_t **dst, const uint8_t *src, uint32_t srclen)
 	uint8_t *dst0 = 0;
 	uint8_t text_encoding;
 	int result;
+	int be = 1;
 
 	if (srclen < 1)
 	{
@@ -1015,10 +1018,10 @@ static int parse_frame_COMM(uint8_t **dst, const uint8_t *src, uint32_t srclen)
 			result = iso8859_1_decode (src, srclen, &dst0, STRING_MUST_TERMINATE);
 			break;
 		case 1:
-			result = ucs2_decode (src, srclen, &dst0, STRING_MUST_TERMINATE);
+			result = ucs2_decode (src, srclen, &dst0, STRING_MUST_TERMINATE | STRING_FIRST, &be);
 			break;
 		case 2:
-			result = utf16_decode (src, srclen, &dst0, STRING_MUST_TERMINATE);
+			result = utf16_decode (src, srclen, &dst0, STRING_MUST_TERMINATE | STRING_FIRST, &be);
 			break;
 		case 3:
 			result = utf8_decode (src, srclen, &dst0, STRING_MUST_TERMINATE);
@@ -1036,10 +1039,10 @@ static int parse_frame_COMM(uint8_t **dst, const uint8_t *src, uint32_t srclen)
 			result = iso8859_1_decode (src, srclen, dst, STRING_NO_TERMINATION);
 			break;
 		case 1:
-			result = ucs2_decode (src, srclen, dst, STRING_NO_TERMINATION);
+			result = ucs2_decode (src, srclen, dst, STRING_NO_TERMINATION, &be);
 			break;
 		case 2:
-			result = utf16_decode (src, srclen, dst, STRING_NO_TERMINATION);
+			result = utf16_decode (src, srclen, dst, STRING_NO_TERMINATION, &be);
 			break;
 		case 3:
 			result = utf8_decode (src, srclen, dst, STRING_NO_TERMINATION);
@@ -1057,6 +1060,7 @@ static int parse_frame_APIC(struct ID3_t *dest, const uint8_t *src, uint32_t src
 	int is_jpeg = 0;
 	int is_png = 0;
 	int result;
+	int be = 1;
 
 	if (srclen < 1) return -1;
 	text_encoding = src[0];
@@ -1092,10 +1096,10 @@ static int parse_frame_APIC(struct ID3_t *dest, const uint8_t *src, uint32_t src
 			result = iso8859_1_decode (src, srclen, &description, STRING_MUST_TERMINATE);
 			break;
 		case 1:
-			result = ucs2_decode (src, srclen, &description, STRING_MUST_TERMINATE);
+			result = ucs2_decode (src, srclen, &description, STRING_MUST_TERMINATE | STRING_FIRST, &be);
 			break;
 		case 2:
-			result = utf16_decode (src, srclen, &description, STRING_MUST_TERMINATE);
+			result = utf16_decode (src, srclen, &description, STRING_MUST_TERMINATE | STRING_FIRST, &be);
 			break;
 		case 3:
 			result = utf8_decode (src, srclen, &description, STRING_MUST_TERMINATE);
@@ -1842,7 +1846,7 @@ int parse_ID3v2x(struct ID3_t *destination, uint8_t *src, uint32_t srclen)
 	{
 		ID3_clear(destination);
 	} else {
-		destination->serial = ++id3_serial;
+		destination->serial = atomic_fetch_add (&id3_serial, 1) + 1;
 	}
 	return retval;
 }
@@ -2004,7 +2008,7 @@ int finalize_ID3v1(struct ID3_t *dest, struct ID3v1data_t *data)
 	{
 		ID3_clear (dest);
 	} else {
-		dest->serial = ++id3_serial;
+		dest->serial = atomic_fetch_add (&id3_serial, 1) + 1;
 	}
 	return retval;
 }
@@ -2390,6 +2394,7 @@ int test_ucs2_single_decode_NULL_valid (const uint8_t *src, const int srclen, co
 {
 	uint8_t *dst = 0;
 	int result;
+	int be = 1;
 	int i;
 
 	printf ("UCS-2: \"");
@@ -2404,7 +2409,7 @@ int test_ucs2_single_decode_NULL_valid (const uint8_t *src, const int srclen, co
 		}
 	}
 	printf ("\" => ");
-	result = ucs2_decode (src, srclen, &dst, STRING_MUST_TERMINATE | STRING_FIRST);
+	result = ucs2_decode (src, srclen, &dst, STRING_MUST_TERMINATE | STRING_FIRST, &be);
 	if (result < 0)
 	{
 		printf ("FAILED (returned non-valid string)%s\n", dst?" !!!! and dst is non-null!!!!":"");
@@ -2446,6 +2451,7 @@ int test_ucs2_single_decode_notNULL_valid (const uint8_t *src, const int srclen,
 {
 	uint8_t *dst = 0;
 	int result;
+	int be = 1;
 	int i;
 
 	printf ("UCS-2: \"");
@@ -2460,7 +2466,7 @@ int test_ucs2_single_decode_notNULL_valid (const uint8_t *src, const int srclen,
 		}
 	}
 	printf ("\" => ");
-	result = ucs2_decode (src, srclen, &dst, STRING_NO_TERMINATION | STRING_FIRST);
+	result = ucs2_decode (src, srclen, &dst, STRING_NO_TERMINATION | STRING_FIRST, &be);
 	if (result < 0)
 	{
 		printf ("FAILED (returned non-valid string)%s\n", dst?" !!!! and dst is non-null!!!!":"");
@@ -2502,6 +2508,7 @@ int test_ucs2_single_decode_NULL_invalid (const uint8_t *src, const int srclen)
 {
 	uint8_t *dst = 0;
 	int result;
+	int be = 1;
 	int i;
 
 	printf ("UCS-2: \"");
@@ -2516,7 +2523,7 @@ int test_ucs2_single_decode_NULL_invalid (const uint8_t *src, const int srclen)
 		}
 	}
 	printf ("\" => ");
-	result = ucs2_decode (src, srclen, &dst, STRING_MUST_TERMINATE | STRING_FIRST);
+	result = ucs2_decode (src, srclen, &dst, STRING_MUST_TERMINATE | STRING_FIRST, &be);
 	if (result < 0)
 	{
 		printf ("OK (got a invalid string response)%s\n", dst?" !!!! and dst is non-null!!!!":"");
@@ -2544,6 +2551,7 @@ int test_ucs2_double_decode_NULL_valid (const uint8_t *src0, const int srclen0,
 	uint8_t *dst = 0;
 	uint8_t *dst0 = 0;
 	int result;
+	int be = 1;
 	int i;
 
 	printf ("UCS-2: \"");
@@ -2559,14 +2567,14 @@ int test_ucs2_double_decode_NULL_valid (const uint8_t *src0, const int srclen0,
 	}
 	printf ("\" => ");
 
-	result = ucs2_decode (src0, srclen0, &dst0, STRING_MUST_TERMINATE | STRING_FIRST);
+	result = ucs2_decode (src0, srclen0, &dst0, STRING_MUST_TERMINATE | STRING_FIRST, &be);
 	if (result < 0)
 	{
 		printf ("FAILED on first string already?\n");
 		free (dst0);
 		return -1;
 	}
-	result = ucs2_decode (src, srclen, &dst, STRING_MUST_TERMINATE);
+	result = ucs2_decode (src, srclen, &dst, STRING_MUST_TERMINATE, &be);
 	if (result < 0)
 	{
 		printf ("FAILED (returned non-valid string)%s%s\n", dst0?" !!!! and dst[0] is non-null!!!!":"", dst?" !!!! and dst[1] is non-null!!!!":"");
@@ -2608,6 +2616,7 @@ int test_utf16_decode_NULL_valid (const uint8_t *src, const int srclen, const ui
 {
 	uint8_t *dst = 0;
 	int result;
+	int be = 1;
 	int i;
 
 	printf ("UTF-16: \"");
@@ -2622,7 +2631,7 @@ int test_utf16_decode_NULL_valid (const uint8_t *src, const int srclen, const ui
 		}
 	}
 	printf ("\" => ");
-	result = utf16_decode (src, srclen, &dst, STRING_MUST_TERMINATE | STRING_FIRST);
+	result = utf16_decode (src, srclen, &dst, STRING_MUST_TERMINATE | STRING_FIRST, &be);
 	if (result < 0)
 	{
 		printf ("FAILED (returned non-valid string)%s\n", dst?" !!!! and dst is non-null!!!!":"");
@@ -2664,6 +2673,7 @@ int test_utf16_decode_NULL_invalid (const uint8_t *src, const int srclen)
 {
 	uint8_t *dst = 0;
 	int result;
+	int be = 1;
 	int i;
 
 	printf ("UTF-16: \"");
@@ -2678,7 +2688,7 @@ int test_utf16_decode_NULL_invalid (const uint8_t *src, const int srclen)
 		}
 	}
 	printf ("\" => ");
-	result = utf16_decode (src, srclen, &dst, STRING_MUST_TERMINATE | STRING_FIRST);
+	result = utf16_decode (src, srclen, &dst, STRING_MUST_TERMINATE | STRING_FIRST, &be);
 	if (result < 0)
 	{
 		printf ("OK (got a invalid string response)%s\n", dst?" !!!! and dst is non-null!!!!":"");
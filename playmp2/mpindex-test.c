@@ -0,0 +1,215 @@
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "mpindex.h"
+
+#include "mpindex.c"
+
+#define ANSI_COLOR_RED     "\x1b[31m"
+#define ANSI_COLOR_GREEN   "\x1b[32m"
+#define ANSI_COLOR_RESET   "\x1b[0m"
+
+#define FRAMES 1000
+
+static uint8_t stream[FRAMES * 1500];
+static uint32_t streamlength;
+static uint32_t offsets[FRAMES + 1];
+static int frames;
+
+static void put_frame (int bitrateidx, int padding)
+{
+	struct mpeg_frameheader_t h;
+	uint8_t *p = stream + streamlength;
+
+	p[0] = 0xff;
+	p[1] = 0xfb; /* MPEG 1, layer III, no CRC */
+	p[2] = (bitrateidx << 4) | (0 << 2) | (padding << 1); /* 44100 Hz */
+	p[3] = 0x00; /* stereo */
+	mpeg_frameheader_parse (p, &h);
+	memset (p + 4, 0, h.framelength - 4);
+	offsets[frames++] = streamlength;
+	streamlength += h.framelength;
+}
+
+/* ID3v2 tag, Xing tag, VBR frames with some garbage in between, and a truncated frame at the end */
+static void build_stream (void)
+{
+	uint8_t *xing;
+	int i;
+
+	memcpy (stream, "ID3\x03\x00\x00\x00\x00\x01\x00", 10); /* 128 bytes of tag data follows */
+	memset (stream + 10, 'x', 128);
+	streamlength = 138;
+
+	put_frame (9, 0); /* 128kbps */
+	xing = stream + offsets[0] + 4 + 32;
+	memcpy (xing, "Xing\x00\x00\x00\x07", 8); /* frames, bytes and TOC */
+
+	for (i=1; i < FRAMES; i++)
+	{
+		put_frame (1 + (i * 7) % 14, i & 1);
+		if (i == 500)
+		{ /* false sync, the frame it describes is not followed by another header */
+			memcpy (stream + streamlength, "\xff\xfb\x90\x00garbage", 11);
+			streamlength += 11;
+		}
+	}
+
+	xing[8] = (FRAMES - 1) >> 24;
+	xing[9] = (FRAMES - 1) >> 16;
+	xing[10] = (FRAMES - 1) >> 8;
+	xing[11] = (FRAMES - 1) & 0xff;
+	xing[12] = (streamlength - offsets[0]) >> 24;
+	xing[13] = (streamlength - offsets[0]) >> 16;
+	xing[14] = (streamlength - offsets[0]) >> 8;
+	xing[15] = (streamlength - offsets[0]);
+	for (i=0; i < 100; i++)
+	{
+		xing[16 + i] = (uint64_t)(offsets[FRAMES * i / 100] - offsets[0]) * 256 / (streamlength - offsets[0]);
+	}
+
+	memcpy (stream + streamlength, "\xff\xfb\x90\x00", 4);
+	streamlength += 4 + 100;
+}
+
+static int check_index (struct mpeg_index_t *index)
+{
+	uint32_t i, pointframe, offset;
+
+	if ((!index->complete) || (index->frames != FRAMES) || (index->samplerate != 44100) || (index->samples != 1152))
+	{
+		printf ("frames=%"PRIu32" complete=%d samplerate=%"PRIu32" samples=%d ", index->frames, index->complete, index->samplerate, (int)index->samples);
+		return 1;
+	}
+	for (i=0; i < FRAMES; i++)
+	{
+		if (mpeg_index_lookup (index, i, &pointframe, &offset) ||
+		    (pointframe != (i - (i % MPEG_INDEX_STRIDE))) ||
+		    (offset != offsets[pointframe]))
+		{
+			printf ("frame %"PRIu32" ", i);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int test_scan (void)
+{
+	struct mpeg_index_t index;
+	int failed = 0;
+
+	printf ("scan whole stream: ");
+	memset (&index, 0, sizeof (index));
+	if (mpeg_index_scan (&index, stream, streamlength, 1) || check_index (&index))
+	{
+		failed = 1;
+	}
+	mpeg_index_free (&index);
+	printf ("%s%s%s\n", failed ? ANSI_COLOR_RED : ANSI_COLOR_GREEN, failed ? "failed" : "ok", ANSI_COLOR_RESET);
+	return failed;
+}
+
+static int test_scan_chunks (void)
+{
+	struct mpeg_index_t index, copy;
+	uint32_t pointframe, offset;
+	unsigned char *data;
+	size_t datasize;
+	int failed = 0;
+
+	printf ("scan in chunks, lookup before completion, serialize: ");
+	memset (&index, 0, sizeof (index));
+	memset (&copy, 0, sizeof (copy));
+	while (!index.complete)
+	{
+		uint32_t len = streamlength - index.scanpos;
+		if (len > 4000)
+		{
+			len = 4000;
+		}
+		if (mpeg_index_scan (&index, stream + index.scanpos, len, index.scanpos + len >= streamlength))
+		{
+			failed = 1;
+			break;
+		}
+		if ((!index.complete) && (index.frames) && (!mpeg_index_lookup (&index, index.frames, &pointframe, &offset)))
+		{ /* not reached yet */
+			failed = 1;
+			break;
+		}
+	}
+	if (failed || check_index (&index))
+	{
+		failed = 1;
+	}
+
+	data = mpeg_index_serialize (&index, &datasize);
+	if ((!data) || mpeg_index_deserialize (&copy, data, datasize) || check_index (&copy))
+	{
+		failed = 1;
+	}
+	if (data && (!mpeg_index_deserialize (&copy, data, datasize - 1)))
+	{
+		failed = 1;
+	}
+	free (data);
+	mpeg_index_free (&index);
+	mpeg_index_free (&copy);
+
+	printf ("%s%s%s\n", failed ? ANSI_COLOR_RED : ANSI_COLOR_GREEN, failed ? "failed" : "ok", ANSI_COLOR_RESET);
+	return failed;
+}
+
+static int test_vbrtag (void)
+{
+	struct mpeg_vbrtag_t tag;
+	uint32_t tocframe, offset;
+	int failed = 0;
+
+	printf ("Xing tag: ");
+	if (mpeg_vbrtag_parse (&tag, stream + offsets[0], streamlength - offsets[0], offsets[0], streamlength))
+	{
+		failed = 1;
+	} else {
+		if ((tag.frames != FRAMES - 1) || (!tag.count))
+		{
+			failed = 1;
+		}
+		if (mpeg_vbrtag_lookup (&tag, 0, &tocframe, &offset) || (tocframe != 0) || (offset != offsets[0]))
+		{
+			failed = 1;
+		}
+		/* the table of contents is in 1/256 of the stream, so it only lands close */
+		if (mpeg_vbrtag_lookup (&tag, FRAMES / 2, &tocframe, &offset) ||
+		    (tocframe > FRAMES / 2) || (tocframe < FRAMES / 2 - 20) ||
+		    (offset > offsets[tocframe] + (streamlength / 256) + 1) || (offset + (streamlength / 256) + 1 < offsets[tocframe]))
+		{
+			failed = 1;
+		}
+		mpeg_vbrtag_free (&tag);
+	}
+	if (!mpeg_vbrtag_parse (&tag, stream + offsets[1], streamlength - offsets[1], offsets[1], streamlength))
+	{ /* a normal frame */
+		failed = 1;
+		mpeg_vbrtag_free (&tag);
+	}
+
+	printf ("%s%s%s\n", failed ? ANSI_COLOR_RED : ANSI_COLOR_GREEN, failed ? "failed" : "ok", ANSI_COLOR_RESET);
+	return failed;
+}
+
+int main (int argc, char *argv[])
+{
+	int retval = 0;
+
+	build_stream ();
+
+	retval |= test_scan ();
+	retval |= test_scan_chunks ();
+	retval |= test_vbrtag ();
+
+	return retval;
+}
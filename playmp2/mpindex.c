@@ -0,0 +1,488 @@
+/* OpenCP Module Player
+ * copyright (c) 2022 Stian Skjelstad <stian.skjelstad@gmail.com>
+ *
+ * Frame offset index and VBR tag parser for MPEG audio streams
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "mpindex.h"
+
+/*
+ serialized format, all numbers are little endian:
+
+  4 bytes number of frames
+  4 bytes scanpos
+  4 bytes samplerate
+  2 bytes samples per frame
+  1 byte  version
+  1 byte  layer
+  1 byte  complete
+  1 byte  MPEG_INDEX_STRIDE
+
+ per index point, (frames + MPEG_INDEX_STRIDE - 1) / MPEG_INDEX_STRIDE of them:
+  4 bytes offset
+*/
+
+static const uint16_t mpeg_bitrates[2][3][15] =
+{
+	{ /* MPEG 1 */
+		{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448},
+		{0, 32, 48, 56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 384},
+		{0, 32, 40, 48,  56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320}
+	}, { /* MPEG 2 and 2.5 */
+		{0, 32, 48, 56,  64,  80,  96, 112, 128, 144, 160, 176, 192, 224, 256},
+		{0,  8, 16, 24,  32,  40,  48,  56,  64,  80,  96, 112, 128, 144, 160},
+		{0,  8, 16, 24,  32,  40,  48,  56,  64,  80,  96, 112, 128, 144, 160}
+	}
+};
+
+static const uint16_t mpeg_samplerates[4][3] =
+{
+	{11025, 12000,  8000}, /* MPEG 2.5 */
+	{    0,     0,     0}, /* reserved */
+	{22050, 24000, 16000}, /* MPEG 2 */
+	{44100, 48000, 32000}  /* MPEG 1 */
+};
+
+int mpeg_frameheader_parse (const uint8_t *p, struct mpeg_frameheader_t *h)
+{
+	uint8_t version, layer, bitrateidx, samplerateidx, padding;
+
+	if ((p[0] != 0xff) || ((p[1] & 0xe0) != 0xe0))
+	{
+		return -1;
+	}
+	version = (p[1] >> 3) & 3;
+	layer = 4 - ((p[1] >> 1) & 3);
+	bitrateidx = p[2] >> 4;
+	samplerateidx = (p[2] >> 2) & 3;
+	padding = (p[2] >> 1) & 1;
+
+	if ((version == 1) || (layer == 4) || (!bitrateidx) || (bitrateidx == 15) || (samplerateidx == 3) || ((p[3] & 3) == 2))
+	{ /* reserved values, and free format */
+		return -1;
+	}
+
+	h->version = version;
+	h->layer = layer;
+	h->samplerate = mpeg_samplerates[version][samplerateidx];
+	h->bitrate = mpeg_bitrates[version == 3 ? 0 : 1][layer - 1][bitrateidx] * 1000;
+	h->channels = ((p[3] >> 6) == 3) ? 1 : 2;
+
+	switch (layer)
+	{
+		case 1:
+			h->samples = 384;
+			h->framelength = (12 * h->bitrate / h->samplerate + padding) * 4;
+			break;
+		case 2:
+			h->samples = 1152;
+			h->framelength = 144 * h->bitrate / h->samplerate + padding;
+			break;
+		default:
+			h->samples = (version == 3) ? 1152 : 576;
+			h->framelength = ((version == 3) ? 144 : 72) * h->bitrate / h->samplerate + padding;
+			break;
+	}
+	return 0;
+}
+
+void mpeg_index_free (struct mpeg_index_t *self)
+{
+	free (self->points);
+	memset (self, 0, sizeof (*self));
+}
+
+static int mpeg_index_match (const struct mpeg_index_t *self, const struct mpeg_frameheader_t *h)
+{
+	return (h->samplerate == self->samplerate) && (h->version == self->version) && (h->layer == self->layer);
+}
+
+static int mpeg_index_append (struct mpeg_index_t *self, uint32_t offset)
+{
+	if (!(self->frames % MPEG_INDEX_STRIDE))
+	{
+		if (self->fill == self->size)
+		{
+			uint32_t newsize = self->size ? (self->size + (self->size >> 1)) : 1024;
+			uint32_t *temp = realloc (self->points, newsize * sizeof (self->points[0]));
+			if (!temp)
+			{
+				return -1;
+			}
+			self->points = temp;
+			self->size = newsize;
+		}
+		self->points[self->fill++] = offset;
+	}
+	self->frames++;
+	self->dirty = 1;
+	return 0;
+}
+
+int mpeg_index_scan (struct mpeg_index_t *self, const uint8_t *buf, uint32_t len, int eof)
+{
+	uint32_t pos = 0;
+
+	if (self->complete)
+	{
+		return 0;
+	}
+
+	while (pos + 4 <= len)
+	{
+		struct mpeg_frameheader_t h, next;
+
+		/* ID3v2 tags can be found before, and in theory in between, the frames */
+		if ((pos + 10 <= len) &&
+		    (buf[pos + 0] == 'I') && (buf[pos + 1] == 'D') && (buf[pos + 2] == '3') &&
+		    (buf[pos + 3] != 0xff) && (buf[pos + 4] != 0xff) &&
+		   (!(buf[pos + 6] & 0x80)) && (!(buf[pos + 7] & 0x80)) && (!(buf[pos + 8] & 0x80)) && (!(buf[pos + 9] & 0x80)))
+		{
+			pos += 10 + ((buf[pos + 6] << 21) | (buf[pos + 7] << 14) | (buf[pos + 8] << 7) | buf[pos + 9]) + ((buf[pos + 5] & 0x10) ? 10 : 0);
+			continue;
+		}
+
+		if (mpeg_frameheader_parse (buf + pos, &h) || (self->samplerate && !mpeg_index_match (self, &h)))
+		{
+			pos++;
+			continue;
+		}
+
+		if (pos + h.framelength > len)
+		{
+			if (eof)
+			{ /* truncated last frame, it will not be played either */
+				pos = len;
+			}
+			break;
+		}
+
+		/* a valid header at the end of this one too, or else this could be a false sync in the middle of some garbage */
+		if (pos + h.framelength + 4 <= len)
+		{
+			if (mpeg_frameheader_parse (buf + pos + h.framelength, &next) ||
+			    (next.samplerate != h.samplerate) || (next.version != h.version) || (next.layer != h.layer))
+			{
+				if (((pos + h.framelength + 10) > len) ||
+				    (buf[pos + h.framelength + 0] != 'I') ||
+				    (buf[pos + h.framelength + 1] != 'D') ||
+				    (buf[pos + h.framelength + 2] != '3'))
+				{
+					pos++;
+					continue;
+				}
+			}
+		} else if (!eof)
+		{
+			break;
+		}
+
+		if (!self->samplerate)
+		{
+			self->samplerate = h.samplerate;
+			self->samples = h.samples;
+			self->version = h.version;
+			self->layer = h.layer;
+		}
+		if (mpeg_index_append (self, self->scanpos + pos))
+		{
+			return -1;
+		}
+		pos += h.framelength;
+	}
+
+	if (eof)
+	{
+		self->complete = 1;
+		self->dirty = 1;
+		pos = len;
+	}
+	self->scanpos += pos;
+	return 0;
+}
+
+int mpeg_index_lookup (const struct mpeg_index_t *self, uint32_t frame, uint32_t *pointframe, uint32_t *offset)
+{
+	if ((!self->fill) || ((frame >= self->frames) && (!self->complete)))
+	{
+		return -1;
+	}
+	if (frame >= self->frames)
+	{
+		frame = self->frames - 1;
+	}
+	*pointframe = frame - (frame % MPEG_INDEX_STRIDE);
+	*offset = self->points[frame / MPEG_INDEX_STRIDE];
+	return 0;
+}
+
+static void put32 (unsigned char *dst, uint32_t src)
+{
+	dst[0] = src;
+	dst[1] = src >> 8;
+	dst[2] = src >> 16;
+	dst[3] = src >> 24;
+}
+
+static uint32_t get32 (const unsigned char *src)
+{
+	return ((uint32_t)src[3] << 24) | ((uint32_t)src[2] << 16) | ((uint32_t)src[1] << 8) | src[0];
+}
+
+static uint32_t get32_be (const unsigned char *src)
+{
+	return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | src[3];
+}
+
+unsigned char *mpeg_index_serialize (struct mpeg_index_t *self, size_t *datasize)
+{
+	unsigned char *retval;
+	uint32_t i;
+
+	*datasize = 20 + 4 * (size_t)self->fill;
+	retval = malloc (*datasize);
+	if (!retval)
+	{
+		return 0;
+	}
+	put32 (retval +  0, self->frames);
+	put32 (retval +  4, self->scanpos);
+	put32 (retval +  8, self->samplerate);
+	retval[12] = self->samples;
+	retval[13] = self->samples >> 8;
+	retval[14] = self->version;
+	retval[15] = self->layer;
+	retval[16] = self->complete;
+	retval[17] = MPEG_INDEX_STRIDE;
+	retval[18] = 0;
+	retval[19] = 0;
+	for (i=0; i < self->fill; i++)
+	{
+		put32 (retval + 20 + i * 4, self->points[i]);
+	}
+	return retval;
+}
+
+int mpeg_index_deserialize (struct mpeg_index_t *self, const unsigned char *data, size_t datasize)
+{
+	uint32_t frames, fill, i;
+
+	mpeg_index_free (self);
+
+	if (datasize < 20)
+	{
+		return -1;
+	}
+	frames = get32 (data);
+	fill = (frames + MPEG_INDEX_STRIDE - 1) / MPEG_INDEX_STRIDE;
+	if ((data[17] != MPEG_INDEX_STRIDE) || ((datasize - 20) / 4 != fill) || (data[16] > 1))
+	{
+		return -1;
+	}
+	if (fill)
+	{
+		self->points = malloc (fill * sizeof (self->points[0]));
+		if (!self->points)
+		{
+			return -1;
+		}
+	}
+	for (i=0; i < fill; i++)
+	{
+		self->points[i] = get32 (data + 20 + i * 4);
+		if (i && (self->points[i] <= self->points[i - 1]))
+		{
+			mpeg_index_free (self);
+			return -1;
+		}
+	}
+	self->fill = self->size = fill;
+	self->frames = frames;
+	self->scanpos = get32 (data + 4);
+	self->samplerate = get32 (data + 8);
+	self->samples = data[12] | (data[13] << 8);
+	self->version = data[14];
+	self->layer = data[15];
+	self->complete = data[16];
+	self->dirty = 0;
+	return 0;
+}
+
+void mpeg_vbrtag_free (struct mpeg_vbrtag_t *self)
+{
+	free (self->tocframe);
+	free (self->tocoffset);
+	memset (self, 0, sizeof (*self));
+}
+
+static int mpeg_vbrtag_alloc (struct mpeg_vbrtag_t *self, uint32_t count)
+{
+	self->tocframe = malloc (count * sizeof (self->tocframe[0]));
+	self->tocoffset = malloc (count * sizeof (self->tocoffset[0]));
+	if ((!self->tocframe) || (!self->tocoffset))
+	{
+		mpeg_vbrtag_free (self);
+		return -1;
+	}
+	return 0;
+}
+
+int mpeg_vbrtag_parse (struct mpeg_vbrtag_t *self, const uint8_t *frame, uint32_t len, uint32_t offset, uint32_t streamlength)
+{
+	struct mpeg_frameheader_t h;
+	uint32_t xing;
+
+	memset (self, 0, sizeof (*self));
+
+	if ((len < 4) || mpeg_frameheader_parse (frame, &h) || (h.layer != 3))
+	{
+		return -1;
+	}
+	if (len > h.framelength)
+	{
+		len = h.framelength;
+	}
+
+	/* the Xing tag is located right after the side information */
+	if (h.version == 3)
+	{
+		xing = 4 + ((h.channels == 1) ? 17 : 32);
+	} else {
+		xing = 4 + ((h.channels == 1) ? 9 : 17);
+	}
+
+	if ((xing + 8 <= len) && ((!memcmp (frame + xing, "Xing", 4)) || (!memcmp (frame + xing, "Info", 4))))
+	{
+		uint32_t flags = get32_be (frame + xing + 4);
+		uint32_t pos = xing + 8;
+		uint32_t bytes = streamlength - offset;
+		uint32_t i;
+
+		if (flags & 1)
+		{
+			if (pos + 4 > len)
+			{
+				return -1;
+			}
+			self->frames = get32_be (frame + pos);
+			pos += 4;
+		}
+		if (flags & 2)
+		{
+			if (pos + 4 > len)
+			{
+				return -1;
+			}
+			if (get32_be (frame + pos) && (get32_be (frame + pos) <= bytes))
+			{
+				bytes = get32_be (frame + pos);
+			}
+			pos += 4;
+		}
+		if ((flags & 4) && self->frames && (pos + 100 <= len))
+		{
+			if (mpeg_vbrtag_alloc (self, 100))
+			{
+				return 0;
+			}
+			/* entry i is the byte position at i percent of the playtime, in 1/256 of the stream */
+			for (i=0; i < 100; i++)
+			{
+				uint32_t tocoffset = offset + (uint64_t)frame[pos + i] * bytes / 256;
+				if (self->count && (tocoffset <= self->tocoffset[self->count - 1]))
+				{
+					continue;
+				}
+				self->tocframe[self->count] = (uint64_t)self->frames * i / 100;
+				self->tocoffset[self->count] = tocoffset;
+				self->count++;
+			}
+		}
+		return 0;
+	}
+
+	if ((4 + 32 + 26 <= len) && (!memcmp (frame + 4 + 32, "VBRI", 4)))
+	{
+		const uint8_t *vbri = frame + 4 + 32;
+		uint32_t entries = (vbri[18] << 8) | vbri[19];
+		uint32_t scale = (vbri[20] << 8) | vbri[21];
+		uint32_t entrysize = (vbri[22] << 8) | vbri[23];
+		uint32_t framesperentry = (vbri[24] << 8) | vbri[25];
+		uint32_t tocoffset = offset;
+		uint32_t i, j;
+
+		self->frames = get32_be (vbri + 14);
+
+		if ((!entries) || (!entrysize) || (entrysize > 4) || (4 + 32 + 26 + entries * entrysize > len))
+		{
+			return 0;
+		}
+		if (mpeg_vbrtag_alloc (self, entries + 1))
+		{
+			return 0;
+		}
+		/* each entry is the size of the next framesperentry frames */
+		for (i=0; i <= entries; i++)
+		{
+			uint32_t size = 0;
+
+			self->tocframe[i] = i * framesperentry;
+			self->tocoffset[i] = tocoffset;
+			if (i == entries)
+			{
+				break;
+			}
+			for (j=0; j < entrysize; j++)
+			{
+				size = (size << 8) | vbri[26 + i * entrysize + j];
+			}
+			tocoffset += size * scale;
+		}
+		self->count = entries + 1;
+		return 0;
+	}
+
+	return -1;
+}
+
+int mpeg_vbrtag_lookup (const struct mpeg_vbrtag_t *self, uint32_t frame, uint32_t *tocframe, uint32_t *offset)
+{
+	uint32_t low = 0, high = self->count;
+
+	if ((!self->count) || (frame < self->tocframe[0]))
+	{
+		return -1;
+	}
+	while (high - low > 1)
+	{
+		uint32_t mid = (low + high) / 2;
+		if (self->tocframe[mid] <= frame)
+		{
+			low = mid;
+		} else {
+			high = mid;
+		}
+	}
+	*tocframe = self->tocframe[low];
+	*offset = self->tocoffset[low];
+	return 0;
+}
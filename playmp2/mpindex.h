@@ -0,0 +1,74 @@
+#ifndef _MPINDEX_H
+#define _MPINDEX_H 1
+
+/* Frame offset index for MPEG audio streams, so seeking can land on the exact
+ * frame instead of guessing a byte offset and searching for sync.
+ *
+ * The index is built by a header-only scan, a chunk at the time while
+ * playing. Until it reaches the seek target, the Xing/Info or VBRI tag of
+ * the first frame (if any) gives a coarse table of contents.
+ */
+
+#define MPEG_INDEX_STRIDE 16 /* frames between two index points */
+
+struct mpeg_frameheader_t
+{
+	uint32_t framelength; /* in bytes, including the header */
+	uint32_t samplerate;
+	uint32_t bitrate;     /* in bits per second */
+	uint16_t samples;     /* per channel, in this frame */
+	uint8_t  version;     /* 0 = MPEG 2.5, 2 = MPEG 2, 3 = MPEG 1 */
+	uint8_t  layer;       /* 1, 2 or 3 */
+	uint8_t  channels;
+};
+
+/* Returns non-zero if p[0..3] is not a valid header. Free format streams are not supported */
+int mpeg_frameheader_parse (const uint8_t *p, struct mpeg_frameheader_t *h);
+
+struct mpeg_index_t
+{
+	uint32_t *points;    /* byte offset of frame n * MPEG_INDEX_STRIDE, relative to the start of the stream */
+	uint32_t  fill;
+	uint32_t  size;
+	uint32_t  frames;    /* number of frames indexed */
+	uint32_t  scanpos;   /* where the header scan continues */
+	uint32_t  samplerate;
+	uint16_t  samples;   /* per frame */
+	uint8_t   version;   /* frames that do not match the first frame are treated as garbage */
+	uint8_t   layer;
+	int       complete;
+	int       dirty;     /* changed since load, and should be stored */
+};
+
+void mpeg_index_free (struct mpeg_index_t *self); /* frees the content, not self */
+
+/* Scan len bytes of the stream, starting at self->scanpos. Set eof if the buffer reaches the end of the stream.
+ * self->scanpos is advanced past the frames found, and the caller should continue reading from there.
+ * Returns non-zero on out of memory */
+int mpeg_index_scan (struct mpeg_index_t *self, const uint8_t *buf, uint32_t len, int eof);
+
+/* Find the last index point at, or before, frame. Returns non-zero if the scan has not reached frame yet */
+int mpeg_index_lookup (const struct mpeg_index_t *self, uint32_t frame, uint32_t *pointframe, uint32_t *offset);
+
+/* Serialized form, for storing in adbMeta. All numbers are little endian */
+unsigned char *mpeg_index_serialize (struct mpeg_index_t *self, size_t *datasize);
+int mpeg_index_deserialize (struct mpeg_index_t *self, const unsigned char *data, size_t datasize);
+
+/* Xing/Info (LAME and friends) or VBRI (Fraunhofer) tag, stored in the first frame of VBR files */
+struct mpeg_vbrtag_t
+{
+	uint32_t  frames;    /* number of audio frames, not counting the tag frame. 0 = unknown */
+	uint32_t  count;     /* table of contents, sorted */
+	uint32_t *tocframe;
+	uint32_t *tocoffset; /* relative to the start of the stream */
+};
+
+/* frame is the first frame, located at offset in the stream. streamlength is used if the tag does not
+ * contain the size. Returns non-zero if no tag is found */
+int mpeg_vbrtag_parse (struct mpeg_vbrtag_t *self, const uint8_t *frame, uint32_t len, uint32_t offset, uint32_t streamlength);
+void mpeg_vbrtag_free (struct mpeg_vbrtag_t *self);
+
+/* Find the last table of contents entry at, or before, frame. Returns non-zero if there is none */
+int mpeg_vbrtag_lookup (const struct mpeg_vbrtag_t *self, uint32_t frame, uint32_t *tocframe, uint32_t *offset);
+
+#endif
@@ -33,9 +33,13 @@
 #include "dev/deviplay.h"
 #include "dev/mcp.h"
 #include "dev/player.h"
+#include "dev/resample.h"
 #include "dev/ringbuffer.h"
+#include "filesel/adbmeta.h"
+#include "filesel/dirdb.h"
 #include "filesel/filesystem.h"
 #include "id3.h"
+#include "mpindex.h"
 #include "mpplay.h"
 #include "stuff/imsrtns.h"
 
@@ -87,10 +91,23 @@ static uint64_t newpos;
 
 static int donotloop=1;
 
+/* seeking */
+#define MPEG_INDEX_CHUNK  16384 /* bytes scanned for frame headers per mpegIndexPoll(), small since the audio waits for the read. Must hold the largest frame plus the next header */
+#define MPEG_SEEK_PREROLL 10    /* frames decoded before the seek target, the layer III bit reservoir can reach this far back */
+static uint8_t indexbuffer[MPEG_INDEX_CHUNK];
+static struct mpeg_index_t mpeg_index;
+static int mpeg_index_failed;
+static struct ocpfilehandle_t *indexfile; /* private handle for the index scan, so playback keeps its file position */
+static struct mpeg_vbrtag_t mpeg_vbrtag;
+static uint32_t mpeg_frame;   /* number of the next frame to be decoded, counted from the start of the stream */
+static uint32_t mpeg_samples; /* per frame */
+static uint64_t mpeg_skipto;  /* frames are decoded, but not played, until this sample position */
+static int mpeg_seek;         /* force a buffer flush, even if the byte position is the same */
+
 /* mpegIdler dumping locations */
 static int16_t *mpegbuf = 0;     /* the buffer */
 static struct ringbuffer_t *mpegbufpos = 0;
-static uint32_t mpegbuffpos; /* read fine-pos.. when mpegbufrate has a fraction */
+static struct resample_t *mpegresample = 0;
 static uint32_t mpegbufrate; /* re-sampling rate.. fixed point 0x10000 => 1.0 */
 
 /* clipper threadlock since we use a timer-signal */
@@ -392,7 +409,7 @@ static int stream_for_frame(void)
 {
 	if (data_in_synth)
 		return 1;
-	if (datapos!=newpos) /* force buffer flush */
+	if ((datapos!=newpos) || mpeg_seek) /* force buffer flush */
 	{
 		debug_printf ("[MPx] forcing buffer flush\n");
 		datapos=newpos;
@@ -401,6 +418,10 @@ static int stream_for_frame(void)
 		stream.next_frame=0;
 		stream.error=MAD_ERROR_BUFLEN;
 		GuardPtr=0;
+		eof=0;
+		mpeg_seek=0;
+		mad_frame_mute(&frame);
+		mad_synth_mute(&synth);
 	}
 
 	if (GuardPtr&&(stream.this_frame==GuardPtr)) /* last frame is incomplete */
@@ -464,6 +485,8 @@ static int stream_for_frame(void)
 					} else {
 						eof=0;
 						datapos = newpos = 0;
+						mpeg_frame = 0;
+						mpeg_skipto = 0;
 						file->seek_set (file, ofs);
 						if (stream.skiplen)
 						{
@@ -522,6 +545,7 @@ static int stream_for_frame(void)
 			debug_printf ("[MPx] mad_header_decode() failed: %s\n", mad_stream_errorstr(&stream));
 			goto error;
 		}
+		mpeg_frame++;
 		debug_printf ("[MPx] header samplerate=%d bitrate=%ld\n", frame.header.samplerate, frame.header.bitrate);
 		debug_printf ("[MPx] about to call mad_frame_decode()\n");
 
@@ -590,6 +614,20 @@ error:
 		mad_synth_frame(&synth, &frame);
 		debug_printf ("[MPx] synth pcm.length=%d pcm.samplerate=%d pcm.channels=%d\n", synth.pcm.length, synth.pcm.samplerate, synth.pcm.channels);
 		data_in_synth=synth.pcm.length;
+		if (mpeg_skipto)
+		{ /* preroll after a seek, this frame ends at mpeg_frame * mpeg_samples */
+			uint64_t end = (uint64_t)mpeg_frame * mpeg_samples;
+			if (end <= mpeg_skipto)
+			{
+				data_in_synth=0;
+				continue;
+			}
+			if ((end - mpeg_skipto) < data_in_synth)
+			{
+				data_in_synth = end - mpeg_skipto;
+			}
+			mpeg_skipto = 0;
+		}
 		mpeg_Bitrate=frame.header.bitrate;
 		mpegstereo=synth.pcm.channels==2;
 		return 1;
@@ -645,6 +683,125 @@ static void mpegIdler (struct cpifaceSessionAPI_t *cpifaceSession)
 	}
 }
 
+static void mpegIndexLoad (struct cpifaceSessionAPI_t *cpifaceSession)
+{
+	unsigned char *metadata = 0;
+	size_t metadatasize = 0;
+	const char *filename = 0;
+
+	if (fl == 0xffffffff)
+	{
+		return;
+	}
+	cpifaceSession->dirdb->GetName_internalstr (file->dirdb_ref, &filename);
+	if (!adbMetaGet (filename, file->filesize (file), "MPEGIDX", &metadata, &metadatasize))
+	{
+		if (mpeg_index_deserialize (&mpeg_index, metadata, metadatasize))
+		{
+			debug_printf ("[MPx] invalid MPEGIDX for %s\n", filename);
+		}
+		free (metadata);
+	}
+}
+
+static void mpegIndexStore (struct cpifaceSessionAPI_t *cpifaceSession)
+{
+	unsigned char *metadata;
+	size_t metadatasize = 0;
+	const char *filename = 0;
+
+	if ((!mpeg_index.dirty) || (!mpeg_index.frames) || mpeg_index_failed)
+	{
+		return;
+	}
+	mpeg_index.dirty = 0;
+
+	metadata = mpeg_index_serialize (&mpeg_index, &metadatasize);
+	if (!metadata)
+	{
+		return;
+	}
+	cpifaceSession->dirdb->GetName_internalstr (file->dirdb_ref, &filename);
+	debug_printf ("[MPx] adbMetaAdd(%s, MPEGIDX, %"PRIu32" frames, %lu bytes)\n", filename, mpeg_index.frames, (unsigned long)metadatasize);
+	adbMetaAdd (filename, file->filesize (file), "MPEGIDX", metadata, metadatasize);
+	free (metadata);
+}
+
+/* scan the next chunk of the file for frame headers. Called from the user interface while the render thread is held
+ * out (DrawGStrings), so mpeg_index does not change under a running seek. The audio waits for the seek and read meanwhile,
+ * so only MPEG_INDEX_CHUNK bytes are read per call */
+void __attribute__ ((visibility ("internal"))) mpegIndexPoll (struct cpifaceSessionAPI_t *cpifaceSession)
+{
+	struct ocpfilehandle_t *f;
+	uint32_t len, got;
+
+	if ((!file) || mpeg_index.complete || mpeg_index_failed || (fl == 0xffffffff))
+	{
+		return;
+	}
+
+	if ((!indexfile) && file->origin)
+	{
+		indexfile = file->origin->open (file->origin);
+	}
+	f = indexfile ? indexfile : file;
+
+	len = (mpeg_index.scanpos < fl) ? (fl - mpeg_index.scanpos) : 0;
+	if (len > MPEG_INDEX_CHUNK)
+	{
+		len = MPEG_INDEX_CHUNK;
+	}
+	got = 0;
+	if (len && (f->seek_set (f, ofs + mpeg_index.scanpos) >= 0))
+	{
+		got = f->read (f, indexbuffer, len);
+	}
+	if (f == file)
+	{
+		file->seek_set (file, ofs + datapos);
+	}
+
+	if (mpeg_index_scan (&mpeg_index, indexbuffer, got, (got < len) || (mpeg_index.scanpos + got >= fl)))
+	{
+		mpeg_index_failed = 1;
+	}
+	if (mpeg_index.complete || mpeg_index_failed)
+	{
+		debug_printf ("[MPx] index %s, %"PRIu32" frames\n", mpeg_index_failed ? "failed" : "complete", mpeg_index.frames);
+		if (indexfile)
+		{
+			indexfile->unref (indexfile);
+			indexfile = 0;
+		}
+	}
+}
+
+/* in samples, exact if the index is complete or the file has a VBR tag, else estimated */
+static uint64_t mpegGetLength (void)
+{
+	if ((fl == 0xffffffff) || (!mpeg_samples))
+	{
+		return 0;
+	}
+	if (mpeg_index.complete && (!mpeg_index_failed))
+	{
+		return (uint64_t)mpeg_index.frames * mpeg_samples;
+	}
+	if (mpeg_vbrtag.frames)
+	{
+		return (uint64_t)(mpeg_vbrtag.frames + 1) * mpeg_samples; /* the tag is stored in a silent frame of its own */
+	}
+	if (mpeg_index.frames && mpeg_index.scanpos)
+	{
+		return (uint64_t)mpeg_index.frames * mpeg_samples * fl / mpeg_index.scanpos;
+	}
+	if (mpeg_Bitrate)
+	{
+		return fl * 8 * mpegrate / mpeg_Bitrate;
+	}
+	return 0;
+}
+
 void __attribute__ ((visibility ("internal"))) mpegIdle (struct cpifaceSessionAPI_t *cpifaceSession)
 {
 	if (clipbusy++)
@@ -701,6 +858,9 @@ void __attribute__ ((visibility ("internal"))) mpegIdle (struct cpifaceSessionAP
 
 				accumulated_source = accumulated_target = length1 + length2;
 
+				/* keep the resampler history current, so a later speed or pitch change does not start with stale samples */
+				cpifaceSession->resampleAPI->resample_feed (mpegresample, mpegbuf, pos1, length1, pos2, length2);
+
 				while (length1)
 				{
 					while (length1)
@@ -726,97 +886,28 @@ void __attribute__ ((visibility ("internal"))) mpegIdle (struct cpifaceSessionAP
 				}
 				//accumulated_source = accumulated_target;
 			} else {
-				mpeg_looped &= ~2;
+				int consumed;
+				unsigned int i;
 
-				while (targetlength && length1)
+				accumulated_target = cpifaceSession->resampleAPI->resample_stereo16 (mpegresample, mpegbufrate, t, targetlength, mpegbuf, pos1, length1, pos2, length2, &consumed);
+				accumulated_source = consumed;
+				if (accumulated_target < targetlength)
 				{
-					while (targetlength && length1)
-					{
-						uint32_t wpm1, wp0, wp1, wp2;
-						int32_t rc0, rc1, rc2, rc3, rvm1,rv1,rv2;
-						int32_t lc0, lc1, lc2, lc3, lvm1,lv1,lv2;
-						unsigned int progress;
-						int16_t rs, ls;
-
-						if ((length1+length2) <= 3)
-						{
-							mpeg_looped |= 2;
-							break;
-						}
-						/* will we overflow the mpegbuf if we advance? */
-						if ((length1+length2) < ((mpegbufrate+mpegbuffpos)>>16))
-						{
-							mpeg_looped |= 2;
-							break;
-						}
-
-						switch (length1) /* if we are close to the wrap between buffer segment 1 and 2, len1 will grow down to a small number */
-						{
-							case 1:  wpm1 = pos1; wp0 = pos2;     wp1 = pos2 + 1; wp2 = pos2 + 2; break;
-							case 2:  wpm1 = pos1; wp0 = pos1 + 1; wp1 = pos2;     wp2 = pos2 + 1; break;
-							case 3:  wpm1 = pos1; wp0 = pos1 + 1; wp1 = pos1 + 2; wp2 = pos2;     break;
-							default: wpm1 = pos1; wp0 = pos1 + 1; wp1 = pos1 + 2; wp2 = pos1 + 3; break;
-						}
+					mpeg_looped |= 2;
+				} else {
+					mpeg_looped &= ~2;
+				}
 
-						rvm1 = (uint16_t)mpegbuf[(wpm1<<1)+0]^0x8000; /* we temporary need data to be unsigned - hence the ^0x8000 */
-						lvm1 = (uint16_t)mpegbuf[(wpm1<<1)+1]^0x8000;
-						 rc0 = (uint16_t)mpegbuf[(wp0<<1)+0]^0x8000;
-						 lc0 = (uint16_t)mpegbuf[(wp0<<1)+1]^0x8000;
-						 rv1 = (uint16_t)mpegbuf[(wp1<<1)+0]^0x8000;
-						 lv1 = (uint16_t)mpegbuf[(wp1<<1)+1]^0x8000;
-						 rv2 = (uint16_t)mpegbuf[(wp2<<1)+0]^0x8000;
-						 lv2 = (uint16_t)mpegbuf[(wp2<<1)+1]^0x8000;
-
-						rc1 = rv1-rvm1;
-						rc2 = 2*rvm1-2*rc0+rv1-rv2;
-						rc3 = rc0-rvm1-rv1+rv2;
-						rc3 =  imulshr16(rc3,mpegbuffpos);
-						rc3 += rc2;
-						rc3 =  imulshr16(rc3,mpegbuffpos);
-						rc3 += rc1;
-						rc3 =  imulshr16(rc3,mpegbuffpos);
-						rc3 += rc0;
-						if (rc3<0)
-							rc3=0;
-						if (rc3>65535)
-							rc3=65535;
-
-						lc1 = lv1-lvm1;
-						lc2 = 2*lvm1-2*lc0+lv1-lv2;
-						lc3 = lc0-lvm1-lv1+lv2;
-						lc3 =  imulshr16(lc3,mpegbuffpos);
-						lc3 += lc2;
-						lc3 =  imulshr16(lc3,mpegbuffpos);
-						lc3 += lc1;
-						lc3 =  imulshr16(lc3,mpegbuffpos);
-						lc3 += lc0;
-						if (lc3<0)
-							lc3=0;
-						if (lc3>65535)
-							lc3=65535;
-
-						rs = rc3 ^ 0x8000;
-						ls = lc3 ^ 0x8000;
+				for (i=0; i < accumulated_target; i++)
+				{
+					int16_t rs = t[(i<<1) + 0];
+					int16_t ls = t[(i<<1) + 1];
 
-						PANPROC;
+					PANPROC;
 
-						*(t++) = rs;
-						*(t++) = ls;
-						mpegbuffpos += mpegbufrate;
-						progress = mpegbuffpos>>16;
-						mpegbuffpos &= 0xffff;
-						accumulated_source+=progress;
-						pos1+=progress;
-						length1-=progress;
-						targetlength--;
-
-						accumulated_target++;
-					} /* while (targetlength && length1) */
-					length1 = length2;
-					length2 = 0;
-					pos1 = pos2;
-					pos2 = 0;
-				} /* while (targetlength && length1) */
+					t[(i<<1) + 0] = rs;
+					t[(i<<1) + 1] = ls;
+				}
 			} /* if (mpegbufrate==0x10000) */
 			cpifaceSession->ringbufferAPI->tail_consume_samples (mpegbufpos, accumulated_source);
 			cpifaceSession->plrDevAPI->CommitBuffer (accumulated_target);
@@ -890,23 +981,60 @@ void __attribute__ ((visibility ("internal"))) mpegGetInfo(struct mpeginfo *info
 {
 	info->pos=datapos;
 	info->len=fl;
+	info->timelen=mpegGetLength();
+	info->samplerate=mpegrate;
 	info->rate=mpeg_Bitrate;
 	info->stereo=mpegstereo;
 	info->bit16=1;
 	info->opt25=opt25;
 	info->opt50=opt50;
 }
-uint32_t __attribute__ ((visibility ("internal"))) mpegGetPos(void)
+uint64_t __attribute__ ((visibility ("internal"))) mpegGetPos(void)
 {
-	return datapos;
+	uint64_t pos = (uint64_t)mpeg_frame * mpeg_samples;
+
+	if (mpeg_skipto)
+	{ /* seek in progress */
+		return mpeg_skipto;
+	}
+	return (pos > data_in_synth) ? (pos - data_in_synth) : 0;
 }
-void __attribute__ ((visibility ("internal"))) mpegSetPos(uint32_t pos)
+void __attribute__ ((visibility ("internal"))) mpegSetPos(uint64_t pos)
 {
-	/*if (pos<0)
-		pos=0;*/
-	if (pos>fl)
-		pos=fl;
-	newpos=pos;
+	uint64_t length = mpegGetLength();
+	uint32_t target, frame, offset;
+
+	if ((fl == 0xffffffff) || (!mpeg_samples))
+	{
+		return;
+	}
+	if (length && (pos > length))
+	{
+		pos = length;
+	}
+	target = pos / mpeg_samples;
+	frame = (target > MPEG_SEEK_PREROLL) ? (target - MPEG_SEEK_PREROLL) : 0;
+
+	if (!mpeg_index_lookup (&mpeg_index, frame, &frame, &offset))
+	{ /* decode from the index point, and drop everything before pos */
+		mpeg_skipto = pos;
+	} else if (!mpeg_vbrtag_lookup (&mpeg_vbrtag, target, &frame, &offset))
+	{ /* the scan has not reached this far yet, the table of contents lands close */
+		mpeg_skipto = 0;
+	} else { /* estimate */
+		frame = target;
+		offset = length ? (fl * pos / length) : 0;
+		mpeg_skipto = 0;
+	}
+	if (offset > fl)
+	{
+		offset = fl;
+	}
+	debug_printf ("[MPx] seek to sample %"PRIu64", frame %"PRIu32" at offset %"PRIu32"\n", pos, frame, offset);
+	newpos = offset;
+	mpeg_frame = frame;
+	mpeg_seek = 1;
+	data_in_synth = 0;
 }
 
 static int mpegOpenPlayer_FindRangeAndTags (struct ocpfilehandle_t *mpegfile)
@@ -1101,6 +1229,12 @@ int __attribute__ ((visibility ("internal"))) mpegOpenPlayer(struct ocpfilehandl
 	data_length=0;
 	data_in_synth=0;
 	eof=0;
+	mpeg_frame=0;
+	mpeg_samples=0;
+	mpeg_skipto=0;
+	mpeg_seek=0;
+	mpeg_index_failed=0;
+	mpegIndexLoad (cpifaceSession);
 	mpeg_inpause=0;
 	mpeg_looped=0;
 
@@ -1121,6 +1255,11 @@ int __attribute__ ((visibility ("internal"))) mpegOpenPlayer(struct ocpfilehandl
 		goto error_out;
 	}
 	mpegrate=frame.header.samplerate;
+	mpeg_samples=32 * MAD_NSBSAMPLES(&frame.header);
+	if ((fl != 0xffffffff) && stream.this_frame && (stream.next_frame > stream.this_frame))
+	{ /* Xing/VBRI tag, for the playtime and seeking until the index is ready */
+		mpeg_vbrtag_parse (&mpeg_vbrtag, stream.this_frame, stream.next_frame - stream.this_frame, datapos - data_length + (stream.this_frame - data), fl);
+	}
 
 	mpegRate=mpegrate;
 	format=PLR_STEREO_16BIT_SIGNED;
@@ -1142,7 +1281,12 @@ int __attribute__ ((visibility ("internal"))) mpegOpenPlayer(struct ocpfilehandl
 		fprintf(stderr, "[MPx]: ringbuffer_new_samples() failed\n");
 		goto error_out_plrDevAPI_Play;
 	}
-	mpegbuffpos=0;
+	mpegresample = cpifaceSession->resampleAPI->resample_new ();
+	if (!mpegresample)
+	{
+		fprintf(stderr, "[MPx]: resample_new() failed\n");
+		goto error_out_plrDevAPI_Play;
+	}
 	GuardPtr=0;
 
 	cpifaceSession->mcpSet = mpegSet;
@@ -1169,8 +1313,16 @@ error_out:
 		cpifaceSession->ringbufferAPI->free (mpegbufpos);
 		mpegbufpos = 0;
 	}
+	if (mpegresample)
+	{
+		cpifaceSession->resampleAPI->resample_free (mpegresample);
+		mpegresample = 0;
+	}
 	free(mpegbuf); mpegbuf=0;
 
+	mpeg_index_free (&mpeg_index);
+	mpeg_vbrtag_free (&mpeg_vbrtag);
+
 	mad_synth_finish(&synth);
 	mad_frame_finish(&frame);
 	mad_stream_finish(&stream);
@@ -1198,15 +1350,28 @@ void __attribute__ ((visibility ("internal"))) mpegClosePlayer (struct cpifaceSe
 		cpifaceSession->ringbufferAPI->free (mpegbufpos);
 		mpegbufpos = 0;
 	}
+	if (mpegresample)
+	{
+		cpifaceSession->resampleAPI->resample_free (mpegresample);
+		mpegresample = 0;
+	}
 	free(mpegbuf); mpegbuf=0;
 
 	ID3_clear(&CurrentTag);
 	ID3_clear(&HoldingTag);
 	newHoldingTag = 0;
 
+	if (indexfile)
+	{
+		indexfile->unref (indexfile);
+		indexfile = 0;
+	}
 	if (file)
 	{
+		mpegIndexStore (cpifaceSession); /* on the main thread, adbMeta is not touched from the player */
 		file->unref (file);
 		file = 0;
 	}
+	mpeg_index_free (&mpeg_index);
+	mpeg_vbrtag_free (&mpeg_vbrtag);
 }
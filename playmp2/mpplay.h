@@ -5,7 +5,8 @@ struct mpeginfo
 {
 	uint32_t pos;
 	uint32_t len;
-	uint32_t timelen;
+	uint64_t timelen; /* in samples, 0 if unknown */
+	uint32_t samplerate;
 	uint32_t rate;
 	int	 stereo;
 	int      bit16;
@@ -21,12 +22,13 @@ extern int __attribute__ ((visibility ("internal"))) mpeg_Bitrate; /* bitrate of
 extern int __attribute__ ((visibility ("internal"))) mpegOpenPlayer(struct ocpfilehandle_t *, struct cpifaceSessionAPI_t *cpifaceSession);
 extern void __attribute__ ((visibility ("internal"))) mpegClosePlayer (struct cpifaceSessionAPI_t *cpifaceSession);
 extern void __attribute__ ((visibility ("internal"))) mpegIdle (struct cpifaceSessionAPI_t *cpifaceSession);
+extern void __attribute__ ((visibility ("internal"))) mpegIndexPoll (struct cpifaceSessionAPI_t *cpifaceSession);
 extern void __attribute__ ((visibility ("internal"))) mpegSetLoop(uint8_t s);
 extern char __attribute__ ((visibility ("internal"))) mpegIsLooped(void);
 extern void __attribute__ ((visibility ("internal"))) mpegPause(uint8_t p);
 extern void __attribute__ ((visibility ("internal"))) mpegGetInfo(struct mpeginfo *);
-extern uint32_t __attribute__ ((visibility ("internal"))) mpegGetPos(void);
-extern void __attribute__ ((visibility ("internal"))) mpegSetPos(uint32_t pos);
+extern uint64_t __attribute__ ((visibility ("internal"))) mpegGetPos(void); /* in samples */
+extern void __attribute__ ((visibility ("internal"))) mpegSetPos(uint64_t pos);
 extern void __attribute__ ((visibility ("internal"))) mpegGetID3(struct ID3_t **ID3);
 extern void __attribute__ ((visibility ("internal"))) ID3InfoInit (struct cpifaceSessionAPI_t *cpifaceSession);
 extern void __attribute__ ((visibility ("internal"))) ID3InfoDone (struct cpifaceSessionAPI_t *cpifaceSession);
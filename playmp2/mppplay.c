@@ -41,8 +41,7 @@
 #include "stuff/poutput.h"
 #include "stuff/sets.h"
 
-static uint32_t mpeglen;
-static uint32_t mpegrate;
+static uint32_t mpegrate; /* samplerate */
 
 static time_t starttime;      /* when did the song start, if paused, this is slided if unpaused */
 static time_t pausetime;      /* when did the pause start (fully paused) */
@@ -103,8 +102,15 @@ static void mpegDrawGStrings (struct cpifaceSessionAPI_t *cpifaceSession)
 {
 	struct mpeginfo inf;
 
+	mpegIndexPoll (cpifaceSession);
 	mpegGetInfo (&inf);
 
+	if (inf.timelen && inf.samplerate)
+	{ /* more exact than the estimate from the file-selector, and improves as the frame index is built */
+		uint64_t playtime = inf.timelen / inf.samplerate;
+		cpifaceSession->mdbdata.playtime = (playtime > 0xffff) ? 0xffff : playtime;
+	}
+
 	cpifaceSession->drawHelperAPI->GStringsFixedLengthStream
 	(
 		cpifaceSession,
@@ -151,33 +157,32 @@ static int mpegProcessKey (struct cpifaceSessionAPI_t *cpifaceSession, uint16_t
 			mpegPause (cpifaceSession->InPause = !cpifaceSession->InPause);
 			break;
 		case KEY_CTRL_UP:
-			mpegSetPos(mpegGetPos()-mpegrate);
+			{
+				uint64_t pos = mpegGetPos();
+				mpegSetPos((pos > (mpegrate << 3)) ? (pos - (mpegrate << 3)) : 0);
+			}
 			break;
 		case KEY_CTRL_DOWN:
-			mpegSetPos(mpegGetPos()+mpegrate);
+			mpegSetPos(mpegGetPos()+(mpegrate << 3));
 			break;
 		case '<':
 		case KEY_CTRL_LEFT:
 			{
-				uint32_t pos = mpegGetPos();
-				uint32_t newpos = pos - (mpeglen>>5);
-				if (newpos > pos)
-				{
-					newpos = 0;
-				}
-				mpegSetPos(newpos);
+				struct mpeginfo inf;
+				uint64_t pos = mpegGetPos();
+
+				mpegGetInfo (&inf);
+				mpegSetPos((pos > (inf.timelen>>5)) ? (pos - (inf.timelen>>5)) : 0);
 			}
 			break;
 		case '>':
 		case KEY_CTRL_RIGHT:
 			{
-				uint32_t pos = mpegGetPos();
-				uint32_t newpos = pos + (mpeglen>>5);
-				if ((newpos < pos) || (newpos > mpeglen))
-				{
-					newpos = mpeglen - 4;
-				}
-				mpegSetPos(newpos);
+				struct mpeginfo inf;
+				uint64_t pos = mpegGetPos();
+
+				mpegGetInfo (&inf);
+				mpegSetPos(pos + (inf.timelen>>5));
 			}
 			break;
 		case KEY_CTRL_HOME:
@@ -232,8 +237,7 @@ static int mpegOpenFile (struct cpifaceSessionAPI_t *cpifaceSession, struct modu
 	pausefadedirection = 0;
 
 	mpegGetInfo(&inf);
-	mpeglen=inf.len;
-	mpegrate=inf.rate;
+	mpegrate=inf.samplerate;
 
 	ID3InfoInit (cpifaceSession);
 	ID3PicInit (cpifaceSession);
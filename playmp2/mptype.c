@@ -640,7 +640,7 @@ static const char *MPx_description[] =
 	NULL
 };
 
-static struct mdbreadinforegstruct ampegpReadInfoReg = {"MPx", ampegpReadInfo MDBREADINFOREGSTRUCT_TAIL};
+static struct mdbreadinforegstruct ampegpReadInfoReg = {"MPx", ampegpReadInfo, MDB_READINFO_THREADSAFE MDBREADINFOREGSTRUCT_TAIL};
 
 int __attribute__ ((visibility ("internal"))) ampeg_type_init (struct PluginInitAPI_t *API)
 {
@@ -40,6 +40,7 @@
 #include "dev/mcp.h"
 #include "dev/player.h"
 #include "dev/plrasm.h"
+#include "dev/resample.h"
 #include "dev/ringbuffer.h"
 #include "filesel/filesystem.h"
 #include "oggplay.h"
@@ -69,7 +70,7 @@ static int oggneedseek;
 
 static int16_t *oggbuf=NULL;
 static struct ringbuffer_t *oggbufpos = 0;
-static uint_fast32_t oggbuffpos;
+static struct resample_t *oggresample = 0;
 static uint_fast32_t oggbufrate;
 static volatile int active;
 static int ogg_looped;
@@ -257,6 +258,9 @@ void __attribute__ ((visibility ("internal"))) oggIdle (struct cpifaceSessionAPI
 
 				accumulated_source = accumulated_target = length1 + length2;
 
+				/* keep the resampler history current, so a later speed or pitch change does not start with stale samples */
+				cpifaceSession->resampleAPI->resample_feed (oggresample, oggbuf, pos1, length1, pos2, length2);
+
 				while (length1)
 				{
 					while (length1)
@@ -282,98 +286,28 @@ void __attribute__ ((visibility ("internal"))) oggIdle (struct cpifaceSessionAPI
 				}
 				//accumulated_source = accumulated_target;
 			} else {
-				ogg_looped &= ~2;
+				int consumed;
+				unsigned int i;
 
-				while (targetlength && length1)
+				accumulated_target = cpifaceSession->resampleAPI->resample_stereo16 (oggresample, oggbufrate, t, targetlength, oggbuf, pos1, length1, pos2, length2, &consumed);
+				accumulated_source = consumed;
+				if (accumulated_target < targetlength)
 				{
-					while (targetlength && length1)
-					{
-						uint32_t wpm1, wp0, wp1, wp2;
-						int32_t rc0, rc1, rc2, rc3, rvm1,rv1,rv2;
-						int32_t lc0, lc1, lc2, lc3, lvm1,lv1,lv2;
-						unsigned int progress;
-						int16_t rs, ls;
-
-						if ((length1+length2) <= 3)
-						{
-							ogg_looped |= 2;
-							break;
-						}
-						/* will we overflow the oggbuf if we advance? */
-						if ((length1+length2) < ((oggbufrate+oggbuffpos)>>16))
-						{
-							ogg_looped |= 2;
-							break;
-						}
-
-						switch (length1) /* if we are close to the wrap between buffer segment 1 and 2, len1 will grow down to a small number */
-						{
-							case 1:  wpm1 = pos1; wp0 = pos2;     wp1 = pos2 + 1; wp2 = pos2 + 2; break;
-							case 2:  wpm1 = pos1; wp0 = pos1 + 1; wp1 = pos2;     wp2 = pos2 + 1; break;
-							case 3:  wpm1 = pos1; wp0 = pos1 + 1; wp1 = pos1 + 2; wp2 = pos2;     break;
-							default: wpm1 = pos1; wp0 = pos1 + 1; wp1 = pos1 + 2; wp2 = pos1 + 3; break;
-						}
-
-						rvm1 = (uint16_t)oggbuf[(wpm1<<1)+0]^0x8000; /* we temporary need data to be unsigned - hence the ^0x8000 */
-						lvm1 = (uint16_t)oggbuf[(wpm1<<1)+1]^0x8000;
-						 rc0 = (uint16_t)oggbuf[(wp0 <<1)+0]^0x8000;
-						 lc0 = (uint16_t)oggbuf[(wp0 <<1)+1]^0x8000;
-						 rv1 = (uint16_t)oggbuf[(wp1 <<1)+0]^0x8000;
-						 lv1 = (uint16_t)oggbuf[(wp1 <<1)+1]^0x8000;
-						 rv2 = (uint16_t)oggbuf[(wp2 <<1)+0]^0x8000;
-						 lv2 = (uint16_t)oggbuf[(wp2 <<1)+1]^0x8000;
-
-						rc1 = rv1-rvm1;
-						rc2 = 2*rvm1-2*rc0+rv1-rv2;
-						rc3 = rc0-rvm1-rv1+rv2;
-						rc3 =  imulshr16(rc3,oggbuffpos);
-						rc3 += rc2;
-						rc3 =  imulshr16(rc3,oggbuffpos);
-						rc3 += rc1;
-						rc3 =  imulshr16(rc3,oggbuffpos);
-						rc3 += rc0;
-						if (rc3<0)
-							rc3=0;
-						if (rc3>65535)
-							rc3=65535;
-
-						lc1 = lv1-lvm1;
-						lc2 = 2*lvm1-2*lc0+lv1-lv2;
-						lc3 = lc0-lvm1-lv1+lv2;
-						lc3 =  imulshr16(lc3,oggbuffpos);
-						lc3 += lc2;
-						lc3 =  imulshr16(lc3,oggbuffpos);
-						lc3 += lc1;
-						lc3 =  imulshr16(lc3,oggbuffpos);
-						lc3 += lc0;
-						if (lc3<0)
-							lc3=0;
-						if (lc3>65535)
-							lc3=65535;
-
-						rs = rc3 ^ 0x8000;
-						ls = lc3 ^ 0x8000;
-
-						PANPROC;
+					ogg_looped |= 2;
+				} else {
+					ogg_looped &= ~2;
+				}
 
-						*(t++) = rs;
-						*(t++) = ls;
+				for (i=0; i < accumulated_target; i++)
+				{
+					int16_t rs = t[(i<<1) + 0];
+					int16_t ls = t[(i<<1) + 1];
 
-						oggbuffpos+=oggbufrate;
-						progress = oggbuffpos>>16;
-						oggbuffpos &= 0xffff;
-						accumulated_source+=progress;
-						pos1+=progress;
-						length1-=progress;
-						targetlength--;
+					PANPROC;
 
-						accumulated_target++;
-					} /* while (targetlength && length1) */
-					length1 = length2;
-					length2 = 0;
-					pos1 = pos2;
-					pos2 = 0;
-				} /* while (targetlength && length1) */
+					t[(i<<1) + 0] = rs;
+					t[(i<<1) + 1] = ls;
+				}
 			} /* if (oggbufrate==0x10000) */
 			cpifaceSession->ringbufferAPI->tail_consume_samples (oggbufpos, accumulated_source);
 			cpifaceSession->plrDevAPI->CommitBuffer (accumulated_target);
@@ -847,6 +781,7 @@ void __attribute__ ((visibility ("internal"))) oggSetPos (struct cpifaceSessionA
 	oggneedseek=1;
 	oggpos=pos;
 	cpifaceSession->ringbufferAPI->reset (oggbufpos);
+	cpifaceSession->resampleAPI->resample_reset (oggresample);
 }
 
 static void oggFreeComments (void)
@@ -943,7 +878,11 @@ int __attribute__ ((visibility ("internal"))) oggOpenPlayer(struct ocpfilehandle
 	{
 		goto error_out_oggbuf;
 	}
-	oggbuffpos=0;
+	oggresample = cpifaceSession->resampleAPI->resample_new ();
+	if (!oggresample)
+	{
+		goto error_out_ringbuffer;
+	}
 	current_section=0;
 	oggneedseek=0;
 
@@ -976,8 +915,12 @@ int __attribute__ ((visibility ("internal"))) oggOpenPlayer(struct ocpfilehandle
 
 	return 1;
 
-	//cpifaceSession->ringbufferAPI->free (oggbufpos);
-	//oggbufpos = 0;
+	//cpifaceSession->resampleAPI->resample_free (oggresample);
+	//oggresample = 0;
+
+error_out_ringbuffer:
+	cpifaceSession->ringbufferAPI->free (oggbufpos);
+	oggbufpos = 0;
 
 error_out_oggbuf:
 	free(oggbuf);
@@ -1013,6 +956,12 @@ void __attribute__ ((visibility ("internal"))) oggClosePlayer (struct cpifaceSes
 		oggbufpos = 0;
 	}
 
+	if (oggresample)
+	{
+		cpifaceSession->resampleAPI->resample_free (oggresample);
+		oggresample = 0;
+	}
+
 	free(oggbuf);
 	oggbuf=NULL;
 
@@ -142,7 +142,7 @@ static const char *OGG_description[] =
 	NULL
 };
 
-static struct mdbreadinforegstruct oggReadInfoReg = {"OGG", oggReadInfo MDBREADINFOREGSTRUCT_TAIL};
+static struct mdbreadinforegstruct oggReadInfoReg = {"OGG", oggReadInfo, MDB_READINFO_THREADSAFE MDBREADINFOREGSTRUCT_TAIL};
 
 int __attribute__ ((visibility ("internal"))) ogg_type_init (struct PluginInitAPI_t *API)
 {
@@ -37,6 +37,7 @@
 #include "dev/deviplay.h"
 #include "dev/mcp.h"
 #include "dev/player.h"
+#include "dev/resample.h"
 #include "dev/ringbuffer.h"
 #include "filesel/filesystem.h"
 #include "stuff/imsrtns.h"
@@ -78,7 +79,7 @@ static int donotloop;
 static uint32_t waveoffs;
 static  int16_t *wavebuf=0;
 static struct ringbuffer_t *wavebufpos = 0;
-static uint32_t wavebuffpos;
+static struct resample_t *waveresample = 0;
 static uint32_t wavebufrate;
 
 static volatile int clipbusy=0;
@@ -329,6 +330,9 @@ void  __attribute__ ((visibility ("internal"))) wpIdle (struct cpifaceSessionAPI
 
 				accumulated_source = accumulated_target = length1 + length2;
 
+				/* keep the resampler history current, so a later speed or pitch change does not start with stale samples */
+				cpifaceSession->resampleAPI->resample_feed (waveresample, wavebuf, pos1, length1, pos2, length2);
+
 				while (length1)
 				{
 					while (length1)
@@ -355,99 +359,28 @@ void  __attribute__ ((visibility ("internal"))) wpIdle (struct cpifaceSessionAPI
 				}
 				//accumulated_source = accumulated_target;
 			} else {
-				/* We are going to perform cubic interpolation of rate conversion... this bit is tricky */
-				wav_looped &= ~2;
+				int consumed;
+				unsigned int i;
 
-				while (targetlength && length1)
+				accumulated_target = cpifaceSession->resampleAPI->resample_stereo16 (waveresample, wavebufrate, t, targetlength, wavebuf, pos1, length1, pos2, length2, &consumed);
+				accumulated_source = consumed;
+				if (accumulated_target < targetlength)
 				{
-					while (targetlength && length1)
-					{
-						uint32_t wpm1, wp0, wp1, wp2;
-						int32_t rc0, rc1, rc2, rc3, rvm1,rv1,rv2;
-						int32_t lc0, lc1, lc2, lc3, lvm1,lv1,lv2;
-						unsigned int progress;
-						int16_t rs, ls;
-
-						if ((length1+length2) <= 3)
-						{
-							wav_looped |= 2;
-							break;
-						}
-						/* will we overflow the wavebuf if we advance? */
-						if ((length1+length2) < ((wavebufrate+wavebuffpos)>>16))
-						{
-							wav_looped |= 2;
-							break;
-						}
-
-						switch (length1) /* if we are close to the wrap between buffer segment 1 and 2, len1 will grow down to a small number */
-						{
-							case 1:  wpm1 = pos1; wp0 = pos2;     wp1 = pos2 + 1; wp2 = pos2 + 2; break;
-							case 2:  wpm1 = pos1; wp0 = pos1 + 1; wp1 = pos2;     wp2 = pos2 + 1; break;
-							case 3:  wpm1 = pos1; wp0 = pos1 + 1; wp1 = pos1 + 2; wp2 = pos2;     break;
-							default: wpm1 = pos1; wp0 = pos1 + 1; wp1 = pos1 + 2; wp2 = pos1 + 3; break;
-						}
-
-						lvm1 = (uint16_t)wavebuf[wpm1*2+0]^0x8000; /* we temporary need data to be unsigned - hence the ^0x8000 */
-						rvm1 = (uint16_t)wavebuf[wpm1*2+1]^0x8000;
-						 lc0 = (uint16_t)wavebuf[wp0*2+0]^0x8000;
-						 rc0 = (uint16_t)wavebuf[wp0*2+1]^0x8000;
-						 lv1 = (uint16_t)wavebuf[wp1*2+0]^0x8000;
-						 rv1 = (uint16_t)wavebuf[wp1*2+1]^0x8000;
-						 lv2 = (uint16_t)wavebuf[wp2*2+0]^0x8000;
-						 rv2 = (uint16_t)wavebuf[wp2*2+1]^0x8000;
-
-						rc1 = rv1-rvm1;
-						rc2 = 2*rvm1-2*rc0+rv1-rv2;
-						rc3 = rc0-rvm1-rv1+rv2;
-						rc3 =  imulshr16(rc3,wavebuffpos);
-						rc3 += rc2;
-						rc3 =  imulshr16(rc3,wavebuffpos);
-						rc3 += rc1;
-						rc3 =  imulshr16(rc3,wavebuffpos);
-						rc3 += rc0;
-						if (rc3<0)
-							rc3=0;
-						if (rc3>65535)
-							rc3=65535;
-
-						lc1 = lv1-lvm1;
-						lc2 = 2*lvm1-2*lc0+lv1-lv2;
-						lc3 = lc0-lvm1-lv1+lv2;
-						lc3 =  imulshr16(lc3,wavebuffpos);
-						lc3 += lc2;
-						lc3 =  imulshr16(lc3,wavebuffpos);
-						lc3 += lc1;
-						lc3 =  imulshr16(lc3,wavebuffpos);
-						lc3 += lc0;
-						if (lc3<0)
-							lc3=0;
-						if (lc3>65535)
-							lc3=65535;
-
-						rs = rc3 ^ 0x8000;
-						ls = lc3 ^ 0x8000;
-
-						PANPROC;
+					wav_looped |= 2;
+				} else {
+					wav_looped &= ~2;
+				}
 
-						*(t++) = rs;
-						*(t++) = ls;
+				for (i=0; i < accumulated_target; i++)
+				{
+					int16_t rs = t[(i<<1) + 0];
+					int16_t ls = t[(i<<1) + 1];
 
-						wavebuffpos+=wavebufrate;
-						progress = wavebuffpos>>16;
-						wavebuffpos &= 0xffff;
-						accumulated_source+=progress;
-						pos1+=progress;
-						length1-=progress;
-						targetlength--;
+					PANPROC;
 
-						accumulated_target++;
-					} /* while (targetlength && length1) */
-					length1 = length2;
-					length2 = 0;
-					pos1 = pos2;
-					pos2 = 0;
-				} /* while (targetlength && length1) */
+					t[(i<<1) + 0] = rs;
+					t[(i<<1) + 1] = ls;
+				}
 			} /* if (wavebufrate==0x10000) */
 			cpifaceSession->ringbufferAPI->tail_consume_samples (wavebufpos, accumulated_source);
 			cpifaceSession->plrDevAPI->CommitBuffer (accumulated_target);
@@ -548,6 +481,7 @@ void __attribute__ ((visibility ("internal"))) wpSetPos (struct cpifaceSessionAP
 	waveneedseek=1;
 	wavepos=pos;
 	cpifaceSession->ringbufferAPI->reset (wavebufpos);
+	cpifaceSession->resampleAPI->resample_reset (waveresample);
 }
 
 uint8_t __attribute__ ((visibility ("internal"))) wpOpenPlayer(struct ocpfilehandle_t *wavf, struct cpifaceSessionAPI_t *cpifaceSession)
@@ -751,7 +685,12 @@ uint8_t __attribute__ ((visibility ("internal"))) wpOpenPlayer(struct ocpfilehan
 	}
 
 	wavebufrate=imuldiv(65536, waverate, waveRate);
-	wavebuffpos = 0;
+	waveresample = cpifaceSession->resampleAPI->resample_new ();
+	if (!waveresample)
+	{
+		fprintf(stderr, "[WAVE]: resample_new() failed\n");
+		goto error_out_plrDevAPI_Play;
+	}
 	waveneedseek = 0;
 
 	wav_inpause=0;
@@ -766,7 +705,8 @@ uint8_t __attribute__ ((visibility ("internal"))) wpOpenPlayer(struct ocpfilehan
 
 	return 1;
 
-	//cpifaceSession->plrDevAPI->Stop();
+error_out_plrDevAPI_Play:
+	cpifaceSession->plrDevAPI->Stop();
 error_out_wavebuf:
 	free (wavebuf);
 	wavebuf=0;
@@ -791,6 +731,12 @@ void __attribute__ ((visibility ("internal"))) wpClosePlayer(struct cpifaceSessi
 		wavebufpos = 0;
 	}
 
+	if (waveresample)
+	{
+		cpifaceSession->resampleAPI->resample_free (waveresample);
+		waveresample = 0;
+	}
+
 	if (wavebuf)
 	{
 		free(wavebuf);
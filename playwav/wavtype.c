@@ -197,7 +197,7 @@ static const char *WAV_description[] =
 	NULL
 };
 
-static struct mdbreadinforegstruct wavReadInfoReg = {"WAVE", wavReadInfo MDBREADINFOREGSTRUCT_TAIL};
+static struct mdbreadinforegstruct wavReadInfoReg = {"WAVE", wavReadInfo, MDB_READINFO_THREADSAFE MDBREADINFOREGSTRUCT_TAIL};
 
 int __attribute__ ((visibility ("internal"))) wav_type_init (struct PluginInitAPI_t *API)
 {
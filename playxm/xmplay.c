@@ -211,6 +211,42 @@ static int realtempo;
 static int realspeed;
 static int realgvol;
 
+/* Time index and checkpoints, made by simulating the whole song silently
+ * when the module is started. Times are in 1/65536 seconds. */
+#define XMP_CHECKPOINT_INTERVAL (5*65536) /* a seek never needs to simulate more than this */
+#define XMP_PRECALC_MAXTIME (4*3600*65536) /* give up finding the end of songs that never loop */
+
+struct xmpcheckpoint
+{
+	uint32_t time;
+	int timerfrac;
+	int looped;
+	int usersetpos;
+	uint8_t globalvol;
+	uint8_t globalfx;
+	uint8_t curtick;
+	uint8_t curtempo;
+	int currow;
+	uint8_t (*patptr)[5];
+	int patlen;
+	int curord;
+	int jumptoord;
+	int jumptorow;
+	int nextpatternrow;
+	int patdelay;
+	int curbpm;
+	struct channel *channels;
+};
+
+static int simulating;
+static uint32_t simtime;
+static int simtimerfrac;
+static uint32_t *rowtimes; /* when each row first starts playing, 0xffffffff if never */
+static int *ordrows; /* index into rowtimes for row 0 of each order */
+static struct xmpcheckpoint *checkpoints;
+static int ncheckpoints;
+static uint32_t songlength; /* until the song loops, 0 if unknown */
+
 
 enum
 {
@@ -276,7 +312,11 @@ static void ReadQue (struct cpifaceSessionAPI_t *cpifaceSession)
 {
 	int type,val1,val2,t;
 	int i;
-	int time = cpifaceSession->mcpGet(-1, mcpGTimer);
+	int time;
+
+	if (simulating)
+		return;
+	time = cpifaceSession->mcpGet(-1, mcpGTimer);
 	while (1)
 	{
 		if (querpos==quewpos)
@@ -343,6 +383,8 @@ static void ReadQue (struct cpifaceSessionAPI_t *cpifaceSession)
 
 static void putque(int type, int val1, int val2)
 {
+	if (simulating)
+		return;
 	if (((quewpos+1)%quelen)==querpos)
 		return;
 	que[quewpos][0]=cmdtime;
@@ -1376,6 +1418,234 @@ static void xmpPlayTick (struct cpifaceSessionAPI_t *cpifaceSession)
 	putque(quePos, -1, curtick|(curord<<16)|(currow<<8));
 }
 
+static void xmp_sim_set (int ch, int opt, int val)
+{
+}
+
+static int xmp_sim_get (int ch, int opt)
+{
+	return 0;
+}
+
+static struct cpifaceSessionAPI_t simsession; /* the real session, but with the mixer calls stubbed out */
+
+static void xmp_sim_tick (void)
+{
+	xmpPlayTick (&simsession);
+
+	/* same timing as xmpPrecalcTime() */
+	simtimerfrac+=4096*163840/curbpm;
+	simtime+=simtimerfrac>>12;
+	simtimerfrac&=4095;
+}
+
+static int xmp_checkpoint_save (struct xmpcheckpoint *c)
+{
+	c->channels=malloc(sizeof(channels[0])*nchan);
+	if (!c->channels)
+		return -1;
+	memcpy(c->channels, channels, sizeof(channels[0])*nchan);
+	c->time=simtime;
+	c->timerfrac=simtimerfrac;
+	c->looped=looped;
+	c->usersetpos=usersetpos;
+	c->globalvol=globalvol;
+	c->globalfx=globalfx;
+	c->curtick=curtick;
+	c->curtempo=curtempo;
+	c->currow=currow;
+	c->patptr=patptr;
+	c->patlen=patlen;
+	c->curord=curord;
+	c->jumptoord=jumptoord;
+	c->jumptorow=jumptorow;
+	c->nextpatternrow=nextpatternrow;
+	c->patdelay=patdelay;
+	c->curbpm=curbpm;
+	return 0;
+}
+
+static void xmp_checkpoint_load (const struct xmpcheckpoint *c)
+{
+	memcpy(channels, c->channels, sizeof(channels[0])*nchan);
+	simtime=c->time;
+	simtimerfrac=c->timerfrac;
+	looped=c->looped;
+	usersetpos=c->usersetpos;
+	globalvol=c->globalvol;
+	globalfx=c->globalfx;
+	curtick=c->curtick;
+	curtempo=c->curtempo;
+	currow=c->currow;
+	patptr=c->patptr;
+	patlen=c->patlen;
+	curord=c->curord;
+	jumptoord=c->jumptoord;
+	jumptorow=c->jumptorow;
+	nextpatternrow=c->nextpatternrow;
+	patdelay=c->patdelay;
+	curbpm=c->curbpm;
+}
+
+static int xmp_checkpoint_add (void)
+{
+	struct xmpcheckpoint *temp;
+
+	if (!(ncheckpoints&63))
+	{
+		temp=realloc(checkpoints, sizeof(checkpoints[0])*(ncheckpoints+64));
+		if (!temp)
+			return -1;
+		checkpoints=temp;
+	}
+	if (xmp_checkpoint_save(&checkpoints[ncheckpoints]))
+		return -1;
+	ncheckpoints++;
+	return 0;
+}
+
+static void xmp_precalc_free (void)
+{
+	int i;
+
+	for (i=0; i<ncheckpoints; i++)
+		free(checkpoints[i].channels);
+	free(checkpoints);
+	checkpoints=0;
+	ncheckpoints=0;
+	free(rowtimes);
+	rowtimes=0;
+	free(ordrows);
+	ordrows=0;
+	songlength=0;
+}
+
+static int xmp_patloop_active (void)
+{
+	int i;
+
+	for (i=0; i<nchan; i++)
+		if (channels[i].chPatLoopCount)
+			return 1;
+	return 0;
+}
+
+/* Plays the whole song without output, noting when each row starts and
+ * saving the complete player state every XMP_CHECKPOINT_INTERVAL. The song
+ * ends when it jumps backwards, or starts a row it has already played
+ * without a pattern loop being in progress. */
+static void xmpPrecalc (struct cpifaceSessionAPI_t *cpifaceSession)
+{
+	int i, rows=0;
+	int oldlooping=looping;
+	int oldfirstspeed=firstspeed;
+
+	if (!curbpm)
+		return;
+
+	ordrows=malloc(sizeof(ordrows[0])*nord);
+	if (!ordrows)
+		return;
+	for (i=0; i<nord; i++)
+	{
+		ordrows[i]=rows;
+		rows+=patlens[orders[i]];
+	}
+	rowtimes=malloc(sizeof(rowtimes[0])*(rows?rows:1));
+	if (!rowtimes)
+	{
+		xmp_precalc_free();
+		return;
+	}
+	memset(rowtimes, 0xff, sizeof(rowtimes[0])*rows);
+
+	simsession=*cpifaceSession;
+	simsession.mcpSet=xmp_sim_set;
+	simsession.mcpGet=xmp_sim_get;
+	simulating=1;
+	looping=1;
+	simtime=0;
+	simtimerfrac=0;
+
+	if (xmp_checkpoint_add())
+	{
+		xmp_precalc_free();
+		simulating=0;
+		looping=oldlooping;
+		return;
+	}
+
+	while (simtime<XMP_PRECALC_MAXTIME)
+	{
+		uint32_t ticktime=simtime;
+		int delayed=patdelay;
+		int patloop=xmp_patloop_active(); /* the last pass of a loop clears the counter while starting the row */
+
+		xmp_sim_tick();
+		if (looped)
+		{
+			songlength=ticktime;
+			break;
+		}
+		if (tick0 && !delayed && (currow<patlens[orders[curord]]))
+		{
+			uint32_t *t=&rowtimes[ordrows[curord]+currow];
+			if (*t==0xffffffff)
+				*t=ticktime;
+			else if (!patloop)
+			{
+				songlength=ticktime;
+				break;
+			}
+		}
+		if ((simtime-checkpoints[ncheckpoints-1].time)>=XMP_CHECKPOINT_INTERVAL)
+			xmp_checkpoint_add();
+	}
+
+	xmp_checkpoint_load(&checkpoints[0]);
+	simulating=0;
+	looping=oldlooping;
+	firstspeed=oldfirstspeed;
+}
+
+/* Restores the last checkpoint before time, and simulates up to it. Returns the time reached */
+static uint32_t xmp_seek (struct cpifaceSessionAPI_t *cpifaceSession, uint32_t time)
+{
+	int lo=0, hi=ncheckpoints;
+	int oldlooping=looping;
+	int i;
+
+	while ((hi-lo)>1)
+	{
+		int mid=(lo+hi)/2;
+		if (checkpoints[mid].time<=time)
+			lo=mid;
+		else
+			hi=mid;
+	}
+
+	simulating=1;
+	looping=1;
+	xmp_checkpoint_load(&checkpoints[lo]);
+	while ((simtime<time) && !looped)
+		xmp_sim_tick();
+	simulating=0;
+	looping=oldlooping;
+
+	for (i=0; i<nchan; i++)
+		cpifaceSession->mcpSet (i, mcpCReset, 0);
+	firstspeed=0;
+	cpifaceSession->mcpSet (-1, mcpGSpeed, 256*2*curbpm/5);
+	querpos=0;
+	quewpos=0;
+	realpos=curtick|(curord<<16)|(currow<<8);
+	realtempo=curbpm;
+	realspeed=curtempo;
+	realgvol=globalvol;
+
+	return simtime;
+}
+
 int __attribute__ ((visibility ("internal"))) xmpGetRealPos (struct cpifaceSessionAPI_t *cpifaceSession)
 {
 	ReadQue (cpifaceSession);
@@ -1428,7 +1698,7 @@ uint16_t __attribute__ ((visibility ("internal"))) xmpGetPos(void)
 	return (curord<<8)|currow;
 }
 
-void __attribute__ ((visibility ("internal"))) xmpSetPos (struct cpifaceSessionAPI_t *cpifaceSession, int ord, int row)
+int __attribute__ ((visibility ("internal"))) xmpSetPos (struct cpifaceSessionAPI_t *cpifaceSession, int ord, int row)
 {
 	int i;
 
@@ -1454,6 +1724,10 @@ void __attribute__ ((visibility ("internal"))) xmpSetPos (struct cpifaceSessionA
 		if (row<0)
 			row=0;
 	}
+	if (rowtimes && (row<patlens[orders[ord]]) && (rowtimes[ordrows[ord]+row]!=0xffffffff))
+	{ /* restore the player state as it is when the song plays through this row */
+		return ((uint64_t)xmp_seek (cpifaceSession, rowtimes[ordrows[ord]+row])*1000)>>16;
+	}
 	for (i=0; i<nchan; i++)
 		cpifaceSession->mcpSet (i, mcpCReset, 0);
 	jumptoord=ord;
@@ -1465,6 +1739,7 @@ void __attribute__ ((visibility ("internal"))) xmpSetPos (struct cpifaceSessionA
 	querpos=0;
 	quewpos=0;
 	realpos=(curord<<16)|(currow<<8);
+	return -1;
 }
 
 void __attribute__ ((visibility ("internal"))) xmpMute (struct cpifaceSessionAPI_t *cpifaceSession, int i, int m)
@@ -1540,14 +1815,21 @@ int __attribute__ ((visibility ("internal"))) xmpPlayModule (struct xmodule *m,
 	realtempo=m->inibpm;
 	realspeed=m->initempo;
 	firstspeed=256*2*curbpm/5;
+
+	xmpPrecalc (cpifaceSession);
+
 	if (!cpifaceSession->mcpDevAPI->OpenPlayer(nchan, xmpPlayTick, file, cpifaceSession))
+	{
+		xmp_precalc_free();
 		return 0;
+	}
 
 	cpifaceSession->mcpAPI->Normalize (cpifaceSession, mcpNormalizeDefaultPlayW);
 
 	if (nchan != cpifaceSession->PhysicalChannelCount)
 	{
 		cpifaceSession->mcpDevAPI->ClosePlayer ();
+		xmp_precalc_free();
 		return 0;
 	}
 
@@ -1558,6 +1840,37 @@ void __attribute__ ((visibility ("internal"))) xmpStopModule (struct cpifaceSess
 {
 	cpifaceSession->mcpDevAPI->ClosePlayer ();
 	free(que);
+	xmp_precalc_free();
+}
+
+uint32_t __attribute__ ((visibility ("internal"))) xmpGetLength(void)
+{
+	return ((uint64_t)songlength*1000)>>16;
+}
+
+int __attribute__ ((visibility ("internal"))) xmpGetTime (struct cpifaceSessionAPI_t *cpifaceSession)
+{
+	int pos = xmpGetRealPos (cpifaceSession);
+	int ord = (pos>>16)&0xFF;
+	int row = (pos>>8)&0xFF;
+
+	if ((!rowtimes) || (ord>=nord) || (row>=patlens[orders[ord]]) || (rowtimes[ordrows[ord]+row]==0xffffffff))
+		return -1;
+	return ((uint64_t)rowtimes[ordrows[ord]+row]*1000)>>16;
+}
+
+int __attribute__ ((visibility ("internal"))) xmpSetTime (struct cpifaceSessionAPI_t *cpifaceSession, int ms)
+{
+	uint32_t time;
+
+	if (!ncheckpoints)
+		return -1;
+	if (ms<0)
+		ms=0;
+	time=((uint64_t)ms<<16)/1000;
+	if (songlength && (time>=songlength))
+		return -1;
+	return ((uint64_t)xmp_seek (cpifaceSession, time)*1000)>>16;
 }
 
 void __attribute__ ((visibility ("internal"))) xmpGetGlobInfo(int *tmp, int *bpm, int *gvol)
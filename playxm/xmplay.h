@@ -122,7 +122,10 @@ extern void __attribute__ ((visibility ("internal"))) xmpFreeModule (struct xmod
 
 extern int __attribute__ ((visibility ("internal"))) xmpPlayModule (struct xmodule *m, struct ocpfilehandle_t *file, struct cpifaceSessionAPI_t *cpifaceSession);
 extern void __attribute__ ((visibility ("internal"))) xmpStopModule (struct cpifaceSessionAPI_t *cpifaceSession);
-extern void __attribute__ ((visibility ("internal"))) xmpSetPos (struct cpifaceSessionAPI_t *cpifaceSession, int ord, int row);
+extern int __attribute__ ((visibility ("internal"))) xmpSetPos (struct cpifaceSessionAPI_t *cpifaceSession, int ord, int row); /* returns the song time of the new position in ms, or -1 if it is unknown */
+extern uint32_t __attribute__ ((visibility ("internal"))) xmpGetLength (void); /* in ms, until the song loops. 0 if unknown */
+extern int __attribute__ ((visibility ("internal"))) xmpGetTime (struct cpifaceSessionAPI_t *cpifaceSession); /* song time in ms of the row currently heard, or -1 if it is unknown */
+extern int __attribute__ ((visibility ("internal"))) xmpSetTime (struct cpifaceSessionAPI_t *cpifaceSession, int ms); /* returns the song time reached in ms, or -1 if time seeking is not possible */
 
 extern void __attribute__ ((visibility ("internal"))) xmpGetRealVolume (struct cpifaceSessionAPI_t *cpifaceSession, int i, int *l, int *r);
 extern void __attribute__ ((visibility ("internal"))) xmpMute (struct cpifaceSessionAPI_t *cpifaceSession, int i, int m);
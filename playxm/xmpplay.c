@@ -116,6 +116,31 @@ static void dopausefade (struct cpifaceSessionAPI_t *cpifaceSession)
 }
 
 
+static void xmpJump (struct cpifaceSessionAPI_t *cpifaceSession, int ord, int row)
+{
+	int songtime = xmpSetPos (cpifaceSession, ord, row);
+
+	if (songtime >= 0)
+	{ /* the playtime follows the jump */
+		starttime = (cpifaceSession->InPause ? pausetime : clock_ms()) - songtime;
+	}
+}
+
+static void xmpJumpTime (struct cpifaceSessionAPI_t *cpifaceSession, int delta)
+{
+	int songtime = xmpGetTime (cpifaceSession);
+
+	if (songtime < 0)
+	{
+		return;
+	}
+	songtime = xmpSetTime (cpifaceSession, songtime + delta);
+	if (songtime >= 0)
+	{
+		starttime = (cpifaceSession->InPause ? pausetime : clock_ms()) - songtime;
+	}
+}
+
 static int xmpProcessKey(struct cpifaceSessionAPI_t *cpifaceSession, uint16_t key)
 {
 	int row;
@@ -133,6 +158,8 @@ static int xmpProcessKey(struct cpifaceSessionAPI_t *cpifaceSession, uint16_t ke
 			cpifaceSession->KeyHelp (KEY_CTRL_RIGHT, "Jump forward (big)");
 			cpifaceSession->KeyHelp (KEY_CTRL_UP, "Jump back (small)");
 			cpifaceSession->KeyHelp (KEY_CTRL_DOWN, "Jump forward (small)");
+			cpifaceSession->KeyHelp ('[', "Jump back 10 seconds");
+			cpifaceSession->KeyHelp (']', "Jump forward 10 seconds");
 			cpifaceSession->KeyHelp (KEY_CTRL_HOME, "Jump to start of track");
 			return 0;
 		case 'p': case 'P':
@@ -166,25 +193,31 @@ static int xmpProcessKey(struct cpifaceSessionAPI_t *cpifaceSession, uint16_t ke
 		case KEY_CTRL_LEFT:
 			p=xmpGetPos();
 			pat=p>>8;
-			xmpSetPos (cpifaceSession, pat-1, 0);
+			xmpJump (cpifaceSession, pat-1, 0);
 			break;
 		case '>':
 		case KEY_CTRL_RIGHT:
 			p=xmpGetPos();
 			pat=p>>8;
-			xmpSetPos (cpifaceSession, pat+1, 0);
+			xmpJump (cpifaceSession, pat+1, 0);
 			break;
 		case KEY_CTRL_UP:
 			p=xmpGetPos();
 			pat=p>>8;
 			row=p&0xFF;
-			xmpSetPos (cpifaceSession, pat, row-8);
+			xmpJump (cpifaceSession, pat, row-8);
 			break;
 		case KEY_CTRL_DOWN:
 			p=xmpGetPos();
 			pat=p>>8;
 			row=p&0xFF;
-			xmpSetPos (cpifaceSession, pat, row+8);
+			xmpJump (cpifaceSession, pat, row+8);
+			break;
+		case '[':
+			xmpJumpTime (cpifaceSession, -10000);
+			break;
+		case ']':
+			xmpJumpTime (cpifaceSession, 10000);
 			break;
 		default:
 			return 0;
@@ -313,8 +346,11 @@ static int xmpOpenFile (struct cpifaceSessionAPI_t *cpifaceSession, struct modul
 		return errFormStruc;
 
 	if (!(retval=loader(&mod, file)))
+	{
+		cpifaceSession->mcpAPI->SampleCacheSelect (cpifaceSession->mcpAPI->SampleCacheKey (file, info->modtype.integer.i), 0, 0);
 		if (!xmpLoadSamples (cpifaceSession, &mod))
 			retval=-1;
+	}
 
 /*
 	fclose(file);   Parent does this for us */
@@ -355,6 +391,11 @@ static int xmpOpenFile (struct cpifaceSessionAPI_t *cpifaceSession, struct modul
 	xmpInstSetup (cpifaceSession, mod.instruments, mod.ninst, mod.samples, mod.nsamp, mod.sampleinfos, mod.nsampi, 0, xmpMarkInsSamp);
 	xmTrkSetup (cpifaceSession, &mod);
 
+	if (xmpGetLength())
+	{ /* found by playing the song through, more exact than the estimate from the file-selector */
+		mdbWritePlaytime (&cpifaceSession->mdbdata, file, xmpGetLength());
+	}
+
 	starttime = clock_ms();
 	cpifaceSession->InPause = 0;
 	cpifaceSession->mcpSet(-1, mcpMasterPause, 0);
@@ -341,7 +341,7 @@ static const char *XM_description[] =
 	NULL
 };
 
-static struct mdbreadinforegstruct xmpReadInfoReg = {"MOD/XM", xmpReadInfo MDBREADINFOREGSTRUCT_TAIL};
+static struct mdbreadinforegstruct xmpReadInfoReg = {"MOD/XM", xmpReadInfo, MDB_READINFO_THREADSAFE MDBREADINFOREGSTRUCT_TAIL};
 
 int __attribute__((visibility ("internal"))) xm_type_init (struct PluginInitAPI_t *API)
 {
@@ -39,12 +39,13 @@
 #ifndef __YM2149EX__
 #define __YM2149EX__
 
+#include "dev/psg.h"
+
 #define	AMSTRAD_CLOCK	1000000L
 #define	ATARI_CLOCK		2000000L
 #define	SPECTRUM_CLOCK	1773400L
 #define	MFP_CLOCK		2457600L
 #define	NOISESIZE		16384
-#define	DRUM_PREC		15
 
 #define	PI				3.1415926
 #define	SIDSINPOWER		0.7
@@ -62,34 +63,18 @@ struct	YmSpecialEffect
 		ymbool		bDrum;
 		ymu32		drumSize;
 		ymu8	*	drumData;
-		ymu32		drumPos;
-		ymu32		drumStep;
+		ymu32		drumPos;		// the next sample to play
+		ymu32		drumNext;		// when, in output samples from the start of the block, 16.16 fixed point
+		ymu32		drumPeriod;		// 16.16 output samples per timer tick
+		ymbool		bDac;			// the voice is given to the drum
 
 		ymbool		bSid;
-		ymu32		sidPos;
-		ymu32		sidStep;
+		ymbool		bSidRunning;	// the timer of the chip runs, it keeps its phase when started again
+		ymu32		sidPeriod;		// 16.16 like drumPeriod
 		ymint		sidVol;
 
 };
 
-static	const	ymint		DC_ADJUST_BUFFERLEN		=	512;
-
-class	CDcAdjuster
-{
-public:
-	CDcAdjuster();
-	
-	void	AddSample(ymint sample);
-	ymint	GetDcLevel(void)			{ return m_sum / DC_ADJUST_BUFFERLEN; }
-	void	Reset(void);
-
-private:
-	ymint	m_buffer[DC_ADJUST_BUFFERLEN];
-	ymint		m_pos;
-	ymint		m_sum;
-};
-
-
 class CYm2149Ex
 {
 public:
@@ -115,52 +100,24 @@ public:
 
 private:
 
-		CDcAdjuster		m_dcAdjust;
-
-		ymu32	frameCycle;
-		ymu32	cyclePerSample;
-		inline	ymsample nextSample(void);
-		ymu32 toneStepCompute(ymu8 rHigh,ymu8 rLow);
-		ymu32 noiseStepCompute(ymu8 rNoise);
-		ymu32 envStepCompute(ymu8 rHigh,ymu8 rLow);
-		void	updateEnvGen(ymint nbSample);
-		void	updateNoiseGen(ymint nbSample);
-		void	updateToneGen(ymint voice,ymint nbSample);
-		ymu32	rndCompute(void);
+		// The chip itself, rendered in blocks with band-limited steps
+		struct psg_t	*psg;
 
-		void	sidVolumeCompute(ymint voice,ymint *pVol);
+		void	writeRegisterAt(ymu32 time,ymint reg,ymint value);
+		ymu32	timerPeriod(ymint timerFreq);
+		void	effectsRun(ymu32 end);
 		inline int		LowPassFilter(int in);
 
 		ymint	replayFrequency;
 		ymu32	internalClock;
 		ymu8	registers[14];
 
-		ymu32	cycleSample;
-		ymu32	stepA,stepB,stepC;
-		ymu32	posA,posB,posC;
-		ymint				volA,volB,volC,volE;
-		ymu32	mixerTA,mixerTB,mixerTC;
-		ymu32	mixerNA,mixerNB,mixerNC;
-		ymint				*pVolA,*pVolB,*pVolC;
-
-		ymu32	noiseStep;
-		ymu32 noisePos;
-		ymu32	rndRack;
-		ymu32	currentNoise;
-		ymu32	bWrite13;
-
-		ymu32	envStep;
-		ymu32 envPos;
-		ymint		envPhase;
 		ymint		envShape;
-		ymu8	envData[16][2][16*2];
-		ymint	globalVolume;
 
 		struct	YmSpecialEffect	specialEffect[3];
 		ymbool	bSyncBuzzer;
-		ymu32	syncBuzzerStep;
-		ymu32	syncBuzzerPhase;
-		ymint	syncBuzzerShape;
+		ymu32	syncBuzzerNext;		// the next envelope restart, 16.16 like drumNext
+		ymu32	syncBuzzerPeriod;
 
 		int		m_lowPassFilter[2];
 		ymbool	m_bFilter;
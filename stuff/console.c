@@ -93,6 +93,12 @@ static int console_init(void)
 
 	vgaMakePal();
 
+	if (cfGetProfileBool("CommandLine--", "render", 0, 0))
+	{
+		fprintf(stderr, "Rendering, no console needed\n");
+		return 0; /* keep dummyConsoleDriver */
+	}
+
 	fprintf(stderr, "Initing console... \n");
 	fflush(stderr);
 	{
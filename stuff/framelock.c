@@ -89,13 +89,13 @@ rerun:
 	{
 		if (curr.tv_usec<targetFPS.tv_usec)
 		{
-			usleep(targetFPS.tv_usec-curr.tv_usec);
+			tmSleep(targetFPS.tv_usec-curr.tv_usec);
 		}
 		targetFPS.tv_usec+=1000000/fsFPS;
 	} else {
 		if (curr.tv_usec < targetAudioPoll.tv_usec)
 		{
-			usleep(targetAudioPoll.tv_usec-curr.tv_usec);
+			tmSleep(targetAudioPoll.tv_usec-curr.tv_usec);
 		}
 		goto rerun;
 	}
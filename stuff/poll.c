@@ -33,33 +33,157 @@
  *    -Rewritten to use the posix itimer, and posix signals to fetch them
  *  --ss040907  Stian Skjelstad <stian@nixia.no>
  *    -Use gettimeofday() to calculate cpu-usage, since itimer() uses rounded off values
+ *
+ * If [sound] renderthread is enabled, the slave routine (player tick, mixer
+ * and device commit) is driven by a dedicated thread every renderperiod ms
+ * instead of from framelock(). The UI thread must then hold tmSetSecure()
+ * while it touches player state, and sleep via tmSleep() so the render
+ * thread can run while the UI is idle. While the lock is held,
+ * tmTimerHandler() services the player from the UI thread instead.
  */
 
 #include "config.h"
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 #include "types.h"
+#include "boot/psetting.h"
 #include "imsrtns.h"
 #include "poll.h"
 
 static void (*tmTimerRoutineSlave)()=NULL;
 
+static pthread_mutex_t tmSecureMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tmRenderCond = PTHREAD_COND_INITIALIZER;
+static pthread_t tmRenderThread;
+static int tmRenderRunning; /* only modified by the UI thread, while the render thread is not alive */
+static int tmRenderStop;    /* protected by tmSecureMutex */
+static int tmSecureHeld;    /* only accessed by the UI thread */
+
+static void *tmRenderThreadMain (void *arg)
+{
+	int period = *(int *)arg;
+	struct timespec next;
+
+	clock_gettime (CLOCK_MONOTONIC, &next);
+
+	pthread_mutex_lock (&tmSecureMutex);
+	while (!tmRenderStop)
+	{
+		tmTimerRoutineSlave ();
+
+		next.tv_nsec += period * 1000000L;
+		while (next.tv_nsec >= 1000000000L)
+		{
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+		while (!tmRenderStop)
+		{
+			if (pthread_cond_timedwait (&tmRenderCond, &tmSecureMutex, &next) == ETIMEDOUT)
+			{
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock (&tmSecureMutex);
+
+	return 0;
+}
+
 void tmTimerHandler(void)
 {
+	/* while the UI thread holds the lock, the render thread can not run. Long operations call this via
+	 * preemptive_framelock() and poll_framelock(), so service the player from here like without the thread */
+	if (tmRenderRunning && !tmSecureHeld)
+		return;
 	if (tmTimerRoutineSlave)
 		tmTimerRoutineSlave();
 }
 
+void tmSetSecure(void)
+{
+	if (tmRenderRunning && !tmSecureHeld)
+	{
+		pthread_mutex_lock (&tmSecureMutex);
+		tmSecureHeld = 1;
+	}
+}
+
+void tmReleaseSecure(void)
+{
+	if (tmSecureHeld)
+	{
+		tmSecureHeld = 0;
+		pthread_mutex_unlock (&tmSecureMutex);
+	}
+}
+
+void tmSleep(unsigned int usec)
+{
+	if (tmSecureHeld)
+	{
+		pthread_mutex_unlock (&tmSecureMutex);
+		usleep (usec);
+		pthread_mutex_lock (&tmSecureMutex);
+	} else {
+		usleep (usec);
+	}
+}
+
 int pollInit(void (*f)(void))
 {
+	static int period;
+	pthread_condattr_t attr;
+
 	tmTimerRoutineSlave=f;
+
+	if (!cfGetProfileBool("sound", "renderthread", 1, 1))
+	{
+		return 1;
+	}
+	period = cfGetProfileInt("sound", "renderperiod", 5, 10);
+	if (period < 1)
+	{
+		period = 1;
+	} else if (period > 50)
+	{
+		period = 50;
+	}
+
+	pthread_cond_destroy (&tmRenderCond);
+	pthread_condattr_init (&attr);
+	pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+	pthread_cond_init (&tmRenderCond, &attr);
+	pthread_condattr_destroy (&attr);
+
+	tmRenderStop = 0;
+	if (pthread_create (&tmRenderThread, 0, tmRenderThreadMain, &period))
+	{
+		fprintf (stderr, "pollInit: failed to start audio render thread, falling back to framelock() polling\n");
+		return 1;
+	}
+	tmRenderRunning = 1;
+
 	return 1;
 }
 
 void pollClose(void)
 {
+	if (tmRenderRunning)
+	{
+		tmReleaseSecure ();
+		pthread_mutex_lock (&tmSecureMutex);
+		tmRenderStop = 1;
+		pthread_cond_signal (&tmRenderCond);
+		pthread_mutex_unlock (&tmSecureMutex);
+		pthread_join (tmRenderThread, 0);
+		tmRenderRunning = 0;
+	}
 	tmTimerRoutineSlave=0;
 }
@@ -6,4 +6,8 @@ void pollClose(void);
 
 void tmTimerHandler(void);
 
+void tmSetSecure(void);          /* hold off the audio render thread while player state is touched from the UI */
+void tmReleaseSecure(void);
+void tmSleep(unsigned int usec); /* usleep() that lets the audio render thread run while tmSetSecure() is held */
+
 #endif
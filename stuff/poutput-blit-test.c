@@ -0,0 +1,176 @@
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "poutput-blit.h"
+
+#include "poutput-blit.c"
+
+#define ANSI_COLOR_RED     "\x1b[31m"
+#define ANSI_COLOR_GREEN   "\x1b[32m"
+#define ANSI_COLOR_CYAN    "\x1b[36m"
+#define ANSI_COLOR_RESET   "\x1b[0m"
+
+#define PIXELS 1000
+
+static uint32_t palette[256];
+static uint8_t  src8[PIXELS + 64];
+static uint32_t ref32[PIXELS + 64];
+static uint32_t dst32[PIXELS + 64];
+static uint8_t  bgra[(PIXELS + 64) * 4];
+static uint8_t  refblend[(PIXELS + 64) * 4];
+static uint8_t  dstblend[(PIXELS + 64) * 4];
+static uint8_t  background[(PIXELS + 64) * 4];
+
+static void fill_data (void)
+{
+	int i;
+
+	srand (1234);
+	for (i=0; i < 256; i++)
+	{
+		palette[i] = 0xff000000 | (rand () & 0xffffff);
+	}
+	/* runs of the same color, like text mode, mixed with noise */
+	for (i=0; i < PIXELS + 64; i++)
+	{
+		src8[i] = ((i / 40) & 1) ? (i / 40) : rand ();
+	}
+	for (i=0; i < (PIXELS + 64) * 4; i++)
+	{
+		background[i] = rand ();
+		bgra[i] = rand ();
+	}
+	/* alpha: fully transparent and opaque blocks, and all the values in between */
+	for (i=0; i < PIXELS + 64; i++)
+	{
+		switch ((i / 24) % 3)
+		{
+			case 0: bgra[(i<<2) + 3] = 0; break;
+			case 1: bgra[(i<<2) + 3] = 255; break;
+			default: bgra[(i<<2) + 3] = i; break;
+		}
+	}
+}
+
+/* every length and misalignment up to the vector width, compared against the C kernel */
+static int test_kernel (int kernel)
+{
+	int offset, length, failed = 0;
+
+	if (!blit_select_kernel (kernel))
+	{
+		printf ("%s%s kernel not available on this CPU, skipping%s\n", ANSI_COLOR_CYAN, blit_kernel_name (kernel), ANSI_COLOR_RESET);
+		return 0;
+	}
+
+	printf ("%s kernel, palette lookup: ", blit_kernel_name (kernel));
+	for (offset=0; offset < 33; offset++)
+	{
+		for (length=0; length < PIXELS; length += (length < 70) ? 1 : 37)
+		{
+			memset (ref32, 0x55, sizeof (ref32));
+			memset (dst32, 0x55, sizeof (dst32));
+			blit_pal8_to_32_c (ref32 + offset, src8 + offset, palette, length);
+			blit_pal8_to_32 (dst32 + offset, src8 + offset, palette, length);
+			if (memcmp (ref32, dst32, sizeof (ref32)))
+			{
+				failed = 1;
+			}
+		}
+	}
+	printf ("%s%s%s\n", failed ? ANSI_COLOR_RED : ANSI_COLOR_GREEN, failed ? "failed" : "ok", ANSI_COLOR_RESET);
+	if (failed)
+	{
+		return 1;
+	}
+
+	printf ("%s kernel, overlay blending: ", blit_kernel_name (kernel));
+	for (offset=0; offset < 33; offset++)
+	{
+		for (length=0; length < PIXELS; length += (length < 70) ? 1 : 37)
+		{
+			memcpy (refblend, background, sizeof (refblend));
+			memcpy (dstblend, background, sizeof (dstblend));
+			blit_blend_bgra_c (refblend + (offset << 2), bgra + (offset << 2), length);
+			blit_blend_bgra (dstblend + (offset << 2), bgra + (offset << 2), length);
+			if (memcmp (refblend, dstblend, sizeof (refblend)))
+			{
+				failed = 1;
+			}
+		}
+	}
+	printf ("%s%s%s\n", failed ? ANSI_COLOR_RED : ANSI_COLOR_GREEN, failed ? "failed" : "ok", ANSI_COLOR_RESET);
+	return failed;
+}
+
+static int test_dirty (void)
+{
+	uint8_t shadow[16 * 40];
+	uint8_t frame[16 * 40];
+	uint8_t dirtymap[40];
+	unsigned int y, y1, count;
+	int failed = 0;
+
+	printf ("dirty lines and spans: ");
+
+	memset (shadow, 0, sizeof (shadow));
+	memset (frame, 0, sizeof (frame));
+	if (blit_dirty_lines (shadow, frame, 16, 40, dirtymap))
+	{
+		failed = 1;
+	}
+	y = 0;
+	if (blit_next_span (dirtymap, 40, &y, &y1))
+	{
+		failed = 1;
+	}
+
+	/* line 2, lines 5+6 (merged with line 2), and line 30 (a span of its own) */
+	frame[2 * 16 + 15] = 1;
+	frame[5 * 16] = 1;
+	frame[6 * 16 + 3] = 1;
+	frame[30 * 16 + 8] = 1;
+	count = blit_dirty_lines (shadow, frame, 16, 40, dirtymap);
+	if ((count != 4) || memcmp (shadow, frame, sizeof (frame)))
+	{
+		failed = 1;
+	}
+	y = 0;
+	if ((!blit_next_span (dirtymap, 40, &y, &y1)) || (y != 2) || (y1 != 7))
+	{
+		failed = 1;
+	}
+	y = y1;
+	if ((!blit_next_span (dirtymap, 40, &y, &y1)) || (y != 30) || (y1 != 31))
+	{
+		failed = 1;
+	}
+	y = y1;
+	if (blit_next_span (dirtymap, 40, &y, &y1))
+	{
+		failed = 1;
+	}
+	/* nothing changed since the last compare */
+	if (blit_dirty_lines (shadow, frame, 16, 40, dirtymap))
+	{
+		failed = 1;
+	}
+
+	printf ("%s%s%s\n", failed ? ANSI_COLOR_RED : ANSI_COLOR_GREEN, failed ? "failed" : "ok", ANSI_COLOR_RESET);
+	return failed;
+}
+
+int main (int argc, char *argv[])
+{
+	int retval = 0;
+
+	fill_data ();
+
+	retval |= test_kernel (BLIT_KERNEL_SSE2);
+	retval |= test_kernel (BLIT_KERNEL_AVX2);
+	retval |= test_dirty ();
+
+	return retval;
+}
@@ -0,0 +1,328 @@
+/* OpenCP Module Player
+ * copyright (c) 2022 Stian Skjelstad <stian.skjelstad@gmail.com>
+ *
+ * Palette expansion, overlay blending and dirty line tracking for the
+ * drivers that present plVidMem through a 32bit surface.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.h"
+#include <string.h>
+#include "types.h"
+#include "poutput-blit.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define BLIT_HAVE_SSE2 1
+# define BLIT_HAVE_AVX2 1
+# include <immintrin.h>
+#endif
+
+/* clean lines between two dirty spans, before they are uploaded as one */
+#define BLIT_SPAN_GAP 8
+
+typedef void (*blit_pal8_to_32_call)(uint32_t *dst, const uint8_t *src, const uint32_t *palette, unsigned int count);
+typedef void (*blit_blend_bgra_call)(uint8_t *dst, const uint8_t *src, unsigned int count);
+
+static blit_pal8_to_32_call blit_pal8_to_32_kernel = 0; /* selected by blit_select_kernel() */
+static blit_blend_bgra_call blit_blend_bgra_kernel = 0;
+
+static void blit_pal8_to_32_c (uint32_t *dst, const uint8_t *src, const uint32_t *palette, unsigned int count)
+{
+	while (count--)
+	{
+		*(dst++) = palette[*(src++)];
+	}
+}
+
+static void blit_blend_bgra_c (uint8_t *dst, const uint8_t *src, unsigned int count)
+{
+	while (count--)
+	{
+		if (src[3] == 0)
+		{
+		} else if (src[3] == 255)
+		{
+			dst[0] = src[0];
+			dst[1] = src[1];
+			dst[2] = src[2];
+		} else {
+			uint8_t a = src[3];
+			uint8_t na = a ^ 0xff;
+			dst[0] = ((dst[0] * na) >> 8) + ((src[0] * a) >> 8); // b
+			dst[1] = ((dst[1] * na) >> 8) + ((src[1] * a) >> 8); // g
+			dst[2] = ((dst[2] * na) >> 8) + ((src[2] * a) >> 8); // r
+		}
+		src += 4;
+		dst += 4;
+	}
+}
+
+#ifdef BLIT_HAVE_SSE2
+/* text mode has long runs of the same color, those are stored without looking up every pixel */
+__attribute__((target("sse2"))) static void blit_pal8_to_32_sse2 (uint32_t *dst, const uint8_t *src, const uint32_t *palette, unsigned int count)
+{
+	while (count >= 16)
+	{
+		__m128i s = _mm_loadu_si128 ((const __m128i *)src);
+		if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (s, _mm_set1_epi8 (src[0]))) == 0xffff)
+		{
+			__m128i c = _mm_set1_epi32 (palette[src[0]]);
+			_mm_storeu_si128 ((__m128i *)dst + 0, c);
+			_mm_storeu_si128 ((__m128i *)dst + 1, c);
+			_mm_storeu_si128 ((__m128i *)dst + 2, c);
+			_mm_storeu_si128 ((__m128i *)dst + 3, c);
+		} else {
+			int i;
+			for (i=0; i < 16; i++)
+			{
+				dst[i] = palette[src[i]];
+			}
+		}
+		src += 16;
+		dst += 16;
+		count -= 16;
+	}
+	blit_pal8_to_32_c (dst, src, palette, count);
+}
+
+/* 4 pixels, d*(255-a)>>8 + s*a>>8, with a=0 and a=255 exact like the C version, and the alpha of d kept */
+__attribute__((target("sse2"))) static inline __m128i blit_blend4_sse2 (__m128i d, __m128i s)
+{
+	const __m128i zero = _mm_setzero_si128 ();
+	const __m128i ff = _mm_set1_epi16 (0xff);
+	const __m128i alphamask = _mm_set1_epi32 (0xff000000);
+	__m128i a32 = _mm_srli_epi32 (s, 24);
+	__m128i a16 = _mm_or_si128 (a32, _mm_slli_epi32 (a32, 16));
+	__m128i alo = _mm_unpacklo_epi32 (a16, a16);
+	__m128i ahi = _mm_unpackhi_epi32 (a16, a16);
+	__m128i lo, hi, r, m0, m255;
+
+	lo = _mm_add_epi16 (_mm_srli_epi16 (_mm_mullo_epi16 (_mm_unpacklo_epi8 (d, zero), _mm_xor_si128 (alo, ff)), 8),
+	                    _mm_srli_epi16 (_mm_mullo_epi16 (_mm_unpacklo_epi8 (s, zero), alo), 8));
+	hi = _mm_add_epi16 (_mm_srli_epi16 (_mm_mullo_epi16 (_mm_unpackhi_epi8 (d, zero), _mm_xor_si128 (ahi, ff)), 8),
+	                    _mm_srli_epi16 (_mm_mullo_epi16 (_mm_unpackhi_epi8 (s, zero), ahi), 8));
+	r = _mm_packus_epi16 (lo, hi);
+
+	m0 = _mm_cmpeq_epi32 (a32, zero);
+	m255 = _mm_cmpeq_epi32 (a32, _mm_set1_epi32 (255));
+	r = _mm_or_si128 (_mm_andnot_si128 (_mm_or_si128 (m0, m255), r), _mm_or_si128 (_mm_and_si128 (m0, d), _mm_and_si128 (m255, s)));
+	return _mm_or_si128 (_mm_andnot_si128 (alphamask, r), _mm_and_si128 (alphamask, d));
+}
+
+__attribute__((target("sse2"))) static void blit_blend_bgra_sse2 (uint8_t *dst, const uint8_t *src, unsigned int count)
+{
+	const __m128i alphamask = _mm_set1_epi32 (0xff000000);
+
+	while (count >= 4)
+	{
+		__m128i s = _mm_loadu_si128 ((const __m128i *)src);
+		__m128i sa = _mm_and_si128 (s, alphamask);
+
+		if (_mm_movemask_epi8 (_mm_cmpeq_epi32 (sa, _mm_setzero_si128 ())) != 0xffff) /* all transparent, nothing to do */
+		{
+			__m128i d = _mm_loadu_si128 ((const __m128i *)dst);
+			_mm_storeu_si128 ((__m128i *)dst, blit_blend4_sse2 (d, s));
+		}
+		src += 16;
+		dst += 16;
+		count -= 4;
+	}
+	blit_blend_bgra_c (dst, src, count);
+}
+#endif
+
+#ifdef BLIT_HAVE_AVX2
+__attribute__((target("avx2"))) static void blit_pal8_to_32_avx2 (uint32_t *dst, const uint8_t *src, const uint32_t *palette, unsigned int count)
+{
+	while (count >= 32)
+	{
+		__m256i s = _mm256_loadu_si256 ((const __m256i *)src);
+		if ((uint32_t)_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (s, _mm256_set1_epi8 (src[0]))) == 0xffffffff)
+		{
+			__m256i c = _mm256_set1_epi32 (palette[src[0]]);
+			_mm256_storeu_si256 ((__m256i *)dst + 0, c);
+			_mm256_storeu_si256 ((__m256i *)dst + 1, c);
+			_mm256_storeu_si256 ((__m256i *)dst + 2, c);
+			_mm256_storeu_si256 ((__m256i *)dst + 3, c);
+		} else {
+			int i;
+			for (i=0; i < 32; i += 8)
+			{
+				__m256i idx = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *)(src + i)));
+				_mm256_storeu_si256 ((__m256i *)(dst + i), _mm256_i32gather_epi32 ((const int *)palette, idx, 4));
+			}
+		}
+		src += 32;
+		dst += 32;
+		count -= 32;
+	}
+	blit_pal8_to_32_c (dst, src, palette, count);
+}
+
+/* same as blit_blend4_sse2(), the unpack and pack instructions work inside each 128bit lane, so the pixel order is kept */
+__attribute__((target("avx2"))) static inline __m256i blit_blend8_avx2 (__m256i d, __m256i s)
+{
+	const __m256i zero = _mm256_setzero_si256 ();
+	const __m256i ff = _mm256_set1_epi16 (0xff);
+	const __m256i alphamask = _mm256_set1_epi32 (0xff000000);
+	__m256i a32 = _mm256_srli_epi32 (s, 24);
+	__m256i a16 = _mm256_or_si256 (a32, _mm256_slli_epi32 (a32, 16));
+	__m256i alo = _mm256_unpacklo_epi32 (a16, a16);
+	__m256i ahi = _mm256_unpackhi_epi32 (a16, a16);
+	__m256i lo, hi, r, m0, m255;
+
+	lo = _mm256_add_epi16 (_mm256_srli_epi16 (_mm256_mullo_epi16 (_mm256_unpacklo_epi8 (d, zero), _mm256_xor_si256 (alo, ff)), 8),
+	                       _mm256_srli_epi16 (_mm256_mullo_epi16 (_mm256_unpacklo_epi8 (s, zero), alo), 8));
+	hi = _mm256_add_epi16 (_mm256_srli_epi16 (_mm256_mullo_epi16 (_mm256_unpackhi_epi8 (d, zero), _mm256_xor_si256 (ahi, ff)), 8),
+	                       _mm256_srli_epi16 (_mm256_mullo_epi16 (_mm256_unpackhi_epi8 (s, zero), ahi), 8));
+	r = _mm256_packus_epi16 (lo, hi);
+
+	m0 = _mm256_cmpeq_epi32 (a32, zero);
+	m255 = _mm256_cmpeq_epi32 (a32, _mm256_set1_epi32 (255));
+	r = _mm256_or_si256 (_mm256_andnot_si256 (_mm256_or_si256 (m0, m255), r), _mm256_or_si256 (_mm256_and_si256 (m0, d), _mm256_and_si256 (m255, s)));
+	return _mm256_or_si256 (_mm256_andnot_si256 (alphamask, r), _mm256_and_si256 (alphamask, d));
+}
+
+__attribute__((target("avx2"))) static void blit_blend_bgra_avx2 (uint8_t *dst, const uint8_t *src, unsigned int count)
+{
+	const __m256i alphamask = _mm256_set1_epi32 (0xff000000);
+
+	while (count >= 8)
+	{
+		__m256i s = _mm256_loadu_si256 ((const __m256i *)src);
+		__m256i sa = _mm256_and_si256 (s, alphamask);
+
+		if ((uint32_t)_mm256_movemask_epi8 (_mm256_cmpeq_epi32 (sa, _mm256_setzero_si256 ())) != 0xffffffff) /* all transparent, nothing to do */
+		{
+			__m256i d = _mm256_loadu_si256 ((const __m256i *)dst);
+			_mm256_storeu_si256 ((__m256i *)dst, blit_blend8_avx2 (d, s));
+		}
+		src += 32;
+		dst += 32;
+		count -= 8;
+	}
+	blit_blend_bgra_c (dst, src, count);
+}
+#endif
+
+int blit_select_kernel (int kernel)
+{
+	switch (kernel)
+	{
+		case BLIT_KERNEL_C:
+			blit_pal8_to_32_kernel = blit_pal8_to_32_c;
+			blit_blend_bgra_kernel = blit_blend_bgra_c;
+			return 1;
+#ifdef BLIT_HAVE_SSE2
+		case BLIT_KERNEL_SSE2:
+			__builtin_cpu_init ();
+			if (!__builtin_cpu_supports ("sse2"))
+				return 0;
+			blit_pal8_to_32_kernel = blit_pal8_to_32_sse2;
+			blit_blend_bgra_kernel = blit_blend_bgra_sse2;
+			return 1;
+#endif
+#ifdef BLIT_HAVE_AVX2
+		case BLIT_KERNEL_AVX2:
+			__builtin_cpu_init ();
+			if (!__builtin_cpu_supports ("avx2"))
+				return 0;
+			blit_pal8_to_32_kernel = blit_pal8_to_32_avx2;
+			blit_blend_bgra_kernel = blit_blend_bgra_avx2;
+			return 1;
+#endif
+		case BLIT_KERNEL_AUTO:
+			return blit_select_kernel (BLIT_KERNEL_AVX2) ||
+			       blit_select_kernel (BLIT_KERNEL_SSE2) ||
+			       blit_select_kernel (BLIT_KERNEL_C);
+		default:
+			return 0;
+	}
+}
+
+const char *blit_kernel_name (int kernel)
+{
+	switch (kernel)
+	{
+		case BLIT_KERNEL_C:    return "C";
+		case BLIT_KERNEL_SSE2: return "SSE2";
+		case BLIT_KERNEL_AVX2: return "AVX2";
+		default:               return "unknown";
+	}
+}
+
+void blit_pal8_to_32 (uint32_t *dst, const uint8_t *src, const uint32_t *palette, unsigned int count)
+{
+	if (!blit_pal8_to_32_kernel)
+	{
+		blit_select_kernel (BLIT_KERNEL_AUTO);
+	}
+	blit_pal8_to_32_kernel (dst, src, palette, count);
+}
+
+void blit_blend_bgra (uint8_t *dst, const uint8_t *src, unsigned int count)
+{
+	if (!blit_blend_bgra_kernel)
+	{
+		blit_select_kernel (BLIT_KERNEL_AUTO);
+	}
+	blit_blend_bgra_kernel (dst, src, count);
+}
+
+unsigned int blit_dirty_lines (uint8_t *shadow, const uint8_t *src, unsigned int pitch, unsigned int lines, uint8_t *dirtymap)
+{
+	unsigned int y, retval = 0;
+
+	for (y=0; y < lines; y++)
+	{
+		if (memcmp (shadow, src, pitch))
+		{
+			memcpy (shadow, src, pitch);
+			dirtymap[y] = 1;
+			retval++;
+		} else {
+			dirtymap[y] = 0;
+		}
+		shadow += pitch;
+		src += pitch;
+	}
+	return retval;
+}
+
+int blit_next_span (const uint8_t *dirtymap, unsigned int lines, unsigned int *y, unsigned int *y1)
+{
+	unsigned int i, end;
+
+	for (i = *y; (i < lines) && (!dirtymap[i]); i++)
+	{
+	}
+	if (i >= lines)
+	{
+		return 0;
+	}
+	*y = i;
+
+	end = i + 1;
+	for (i = end; (i < lines) && (i < end + BLIT_SPAN_GAP); i++)
+	{
+		if (dirtymap[i])
+		{
+			end = i + 1;
+		}
+	}
+	*y1 = end;
+	return 1;
+}
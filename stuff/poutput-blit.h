@@ -0,0 +1,31 @@
+#ifndef _STUFF_POUTPUT_BLIT_H
+#define _STUFF_POUTPUT_BLIT_H 1
+
+/* Helpers for the drivers that present the 8bit virtual framebuffer (plVidMem)
+ * through a 32bit BGRA surface, like SDL2 and X11.
+ */
+
+#define BLIT_KERNEL_AUTO -1
+#define BLIT_KERNEL_C     0
+#define BLIT_KERNEL_SSE2  1
+#define BLIT_KERNEL_AVX2  2
+
+int blit_select_kernel (int kernel); /* returns 0 if the kernel is not available on this host/CPU */
+const char *blit_kernel_name (int kernel);
+
+/* dst[i] = palette[src[i]] */
+void blit_pal8_to_32 (uint32_t *dst, const uint8_t *src, const uint32_t *palette, unsigned int count);
+
+/* Alpha blend count BGRA pixels from src on top of dst. The alpha byte of dst is kept as is */
+void blit_blend_bgra (uint8_t *dst, const uint8_t *src, unsigned int count);
+
+/* Compare the framebuffer with the copy of the last presented frame (shadow), and copy the lines
+ * that changed into shadow. dirtymap[line] is set to non-zero for each of those. Returns the
+ * number of changed lines */
+unsigned int blit_dirty_lines (uint8_t *shadow, const uint8_t *src, unsigned int pitch, unsigned int lines, uint8_t *dirtymap);
+
+/* Find the next span of dirty lines, starting the search at *y. Spans that are only a few
+ * clean lines apart are merged. Returns zero if there are no more, else the span is [*y, *y1) */
+int blit_next_span (const uint8_t *dirtymap, unsigned int lines, unsigned int *y, unsigned int *y1);
+
+#endif
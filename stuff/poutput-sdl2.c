@@ -30,6 +30,7 @@
 #include "cpiface/cpiface.h"
 #include "framelock.h"
 #include "poutput.h"
+#include "poutput-blit.h"
 #include "poutput-fontengine.h"
 #include "poutput-keyboard.h"
 #include "poutput-sdl2.h"
@@ -127,6 +128,12 @@ static uint32_t sdl2_palette[256] = {
 
 static uint8_t *virtual_framebuffer = 0;
 
+/* Only the lines of virtual_framebuffer that changed since the last frame are converted and uploaded into the texture */
+static uint8_t *sdl2_shadow;     /* virtual_framebuffer as it was last uploaded */
+static uint8_t *sdl2_dirtymap;   /* one byte per line */
+static size_t   sdl2_shadow_size;
+static int      sdl2_dirty_all = 1; /* new texture, palette or overlays */
+
 static void sdl2_close_window(void)
 {
 	if (current_texture)
@@ -1126,6 +1133,7 @@ static void *sdl2_TextOverlayAddBGRA (unsigned int x, unsigned int y, unsigned i
 		SDL2ScrTextGUIOverlays = realloc (SDL2ScrTextGUIOverlays, sizeof (SDL2ScrTextGUIOverlays[0]) * SDL2ScrTextGUIOverlays_size);
 	}
 	SDL2ScrTextGUIOverlays[SDL2ScrTextGUIOverlays_count++] = e;
+	sdl2_dirty_all = 1;
 
 	return e;
 }
@@ -1140,6 +1148,7 @@ static void sdl2_TextOverlayRemove (void *handle)
 			memmove (SDL2ScrTextGUIOverlays + i, SDL2ScrTextGUIOverlays + i + 1, sizeof (SDL2ScrTextGUIOverlays[0]) * (SDL2ScrTextGUIOverlays_count - i - 1));
 			SDL2ScrTextGUIOverlays_count--;
 			free (handle);
+			sdl2_dirty_all = 1;
 			return;
 		}
 	}
@@ -1148,8 +1157,9 @@ static void sdl2_TextOverlayRemove (void *handle)
 
 static void RefreshScreenGraph(void)
 {
-	void *pixels;
-	int pitch;
+	unsigned int y, y1;
+	size_t size;
+	int all;
 
 	if (!current_texture)
 		return;
@@ -1157,84 +1167,108 @@ static void RefreshScreenGraph(void)
 	if (!virtual_framebuffer)
 		return;
 
-	SDL_LockTexture (current_texture, NULL, &pixels, &pitch);
+	size = (size_t)Console.GraphBytesPerLine * Console.GraphLines;
+	if (size != sdl2_shadow_size)
+	{
+		free (sdl2_shadow);
+		free (sdl2_dirtymap);
+		sdl2_shadow = malloc (size);
+		sdl2_dirtymap = malloc (Console.GraphLines);
+		sdl2_shadow_size = size;
+		sdl2_dirty_all = 1;
+	}
+	if ((!sdl2_shadow) || (!sdl2_dirtymap))
+	{ /* out of memory, upload everything every frame */
+		free (sdl2_shadow);
+		free (sdl2_dirtymap);
+		sdl2_shadow = 0;
+		sdl2_dirtymap = 0;
+		sdl2_shadow_size = 0;
+		sdl2_dirty_all = 1;
+	}
 
+	all = sdl2_dirty_all;
+	sdl2_dirty_all = 0;
+	if (all)
 	{
-		uint8_t *src=virtual_framebuffer;
-		uint8_t *dst_line = (uint8_t *)/*current_surface->*/pixels;
-		int Y=0;
+		if (sdl2_shadow)
+		{
+			memcpy (sdl2_shadow, virtual_framebuffer, size);
+			memset (sdl2_dirtymap, 1, Console.GraphLines);
+		}
+		y = 0;
+		y1 = Console.GraphLines;
+	} else {
+		blit_dirty_lines (sdl2_shadow, virtual_framebuffer, Console.GraphBytesPerLine, Console.GraphLines, sdl2_dirtymap);
+		y = 0;
+		if (!blit_next_span (sdl2_dirtymap, Console.GraphLines, &y, &y1))
+		{
+			y = y1 = Console.GraphLines;
+		}
+	}
+
+	while (y < y1)
+	{
+		SDL_Rect rect;
+		void *pixels;
+		int pitch;
 		int i;
+		unsigned int Y;
 
-		uint32_t *dst;
+		rect.x = 0;
+		rect.y = y;
+		rect.w = Console.GraphBytesPerLine;
+		rect.h = y1 - y;
 
-		while (1)
+		if (SDL_LockTexture (current_texture, &rect, &pixels, &pitch))
 		{
-			int j;
+			SDL_ClearError();
+			sdl2_dirty_all = 1;
+			break;
+		}
 
-			dst = (uint32_t *)dst_line;
-			for (j = 0; j < Console.GraphBytesPerLine; j++)
-			{
-				*(dst++)=sdl2_palette[*(src++)];
-			}
-			if ((++Y) >= Console.GraphLines)
-			{
-				break;
-			}
-			dst_line += /*current_surface->*/pitch;
+		for (Y = y; Y < y1; Y++)
+		{
+			blit_pal8_to_32 ((uint32_t *)((uint8_t *)pixels + (Y - y) * pitch), virtual_framebuffer + Y * Console.GraphBytesPerLine, sdl2_palette, Console.GraphBytesPerLine);
 		}
 
 		for (i=0; i < SDL2ScrTextGUIOverlays_count; i++)
 		{
-			int ty, y;
-			ty = SDL2ScrTextGUIOverlays[i]->y + SDL2ScrTextGUIOverlays[i]->height;
-			y = (SDL2ScrTextGUIOverlays[i]->y < 0) ? 0 : SDL2ScrTextGUIOverlays[i]->y;
-			for (; y < ty; y++)
-			{
-				int tx, x;
-				uint8_t *src, *dst;
+			struct SDL2ScrTextGUIOverlay_t *o = SDL2ScrTextGUIOverlays[i];
+			unsigned int oy1 = o->y + o->height;
+			unsigned int width = o->width;
 
-				if (y >= Console.GraphLines) { break; }
-
-				tx = SDL2ScrTextGUIOverlays[i]->x + SDL2ScrTextGUIOverlays[i]->width;
-				x = (SDL2ScrTextGUIOverlays[i]->x < 0) ? 0 : SDL2ScrTextGUIOverlays[i]->x;
-
-				src = SDL2ScrTextGUIOverlays[i]->data_bgra + (((y - SDL2ScrTextGUIOverlays[i]->y) * SDL2ScrTextGUIOverlays[i]->pitch + (x - SDL2ScrTextGUIOverlays[i]->x)) << 2);
-				dst = (uint8_t *)pixels + (y * pitch) + (x<<2);
+			if (o->x >= Console.GraphBytesPerLine)
+			{
+				continue;
+			}
+			if (o->x + width > Console.GraphBytesPerLine)
+			{
+				width = Console.GraphBytesPerLine - o->x;
+			}
+			if (oy1 > y1)
+			{
+				oy1 = y1;
+			}
+			for (Y = (o->y > y) ? o->y : y; Y < oy1; Y++)
+			{
+				blit_blend_bgra ((uint8_t *)pixels + (Y - y) * pitch + (o->x << 2), o->data_bgra + (((Y - o->y) * o->pitch) << 2), width);
+			}
+		}
 
-				for (; x < tx; x++)
-				{
-					if (x >= Console.GraphBytesPerLine) { break; }
+		SDL_UnlockTexture (current_texture);
 
-					if (src[3] == 0)
-					{
-						src+=4;
-						dst+=4;
-					} else if (src[3] == 255)
-					{
-						*(dst++) = *(src++);
-						*(dst++) = *(src++);
-						*(dst++) = *(src++);
-						src++;
-						dst++;
-					} else{
-						//uint8_t b = src[0];
-						//uint8_t g = src[1];
-						//uint8_t r = src[2];
-						uint8_t a = src[3];
-						uint8_t na = a ^ 0xff;
-						*dst = ((*dst * na) >> 8) + ((*src * a) >> 8); dst++; src++; // b
-						*dst = ((*dst * na) >> 8) + ((*src * a) >> 8); dst++; src++; // g
-						*dst = ((*dst * na) >> 8) + ((*src * a) >> 8); dst++; src++; // r
-						dst++;
-						src++;
-					}
-				}
-			}
+		if (all)
+		{
+			break;
+		}
+		y = y1;
+		if (!blit_next_span (sdl2_dirtymap, Console.GraphLines, &y, &y1))
+		{
+			break;
 		}
 	}
 
-	SDL_UnlockTexture (current_texture);
-
 	SDL_RenderCopy (current_renderer, current_texture, NULL, NULL);
 	SDL_RenderPresent (current_renderer);
 
@@ -1278,6 +1312,12 @@ static int ekbhit_sdl2dummy(void)
 		static int skipone = 0;
 		switch (event.type)
 		{
+			case SDL_RENDER_TARGETS_RESET:
+			case SDL_RENDER_DEVICE_RESET:
+			{ /* the content of the texture might be lost */
+				sdl2_dirty_all = 1;
+				break;
+			}
 			case SDL_WINDOWEVENT:
 			{
 				switch (event.window.event)
@@ -1536,17 +1576,24 @@ static int ekbhit_sdl2dummy(void)
 	return 0;
 }
 
+/* called after every mode change, so the new texture gets filled */
 static void sdl2_gFlushPal(void)
 {
+	sdl2_dirty_all = 1;
 }
 
 static void sdl2_gUpdatePal (uint8_t index, uint8_t _red, uint8_t _green, uint8_t _blue)
 {
 	uint8_t *pal = (uint8_t *)sdl2_palette;
+	uint32_t old = sdl2_palette[index];
 	pal[(index<<2)+3] = 0xff;
 	pal[(index<<2)+2] = _red<<2;
 	pal[(index<<2)+1] = _green<<2;
 	pal[(index<<2)+0] = _blue<<2;
+	if (old != sdl2_palette[index])
+	{
+		sdl2_dirty_all = 1;
+	}
 }
 
 static int need_quit = 0;
@@ -1658,6 +1705,13 @@ void sdl2_done(void)
 	SDL2ScrTextGUIOverlays = 0;
 	SDL2ScrTextGUIOverlays_size = 0;
 	SDL2ScrTextGUIOverlays_count = 0;
+
+	free (sdl2_shadow);
+	free (sdl2_dirtymap);
+	sdl2_shadow = 0;
+	sdl2_dirtymap = 0;
+	sdl2_shadow_size = 0;
+	sdl2_dirty_all = 1;
 }
 
 static void sdl2_DosShell (void)
@@ -53,6 +53,7 @@
 #include "cpiface/cpiface.h"
 #include "framelock.h"
 #include "poutput.h"
+#include "poutput-blit.h"
 #include "poutput-fontengine.h"
 #include "poutput-keyboard.h"
 #include "poutput-swtext.h"
@@ -1477,14 +1478,10 @@ static void RefreshScreenGraph(void)
 
 		if (x11_depth==32)
 		{
-			uint32_t *dst;
 			while (1)
 			{
-				dst = (uint32_t *)dst_line;
-				for (j = 0; j < Console.GraphBytesPerLine; j++)
-				{
-					*(dst++)=x11_palette32[*(src++)];
-				}
+				blit_pal8_to_32 ((uint32_t *)dst_line, src, x11_palette32, Console.GraphBytesPerLine);
+				src += Console.GraphBytesPerLine;
 				if ((++Y) >= Console.GraphLines)
 				{
 					break;
@@ -1581,33 +1578,13 @@ static void RefreshScreenGraph(void)
 					src = X11ScrTextGUIOverlays[i]->data_bgra + (((y - X11ScrTextGUIOverlays[i]->y) * X11ScrTextGUIOverlays[i]->pitch + (x - X11ScrTextGUIOverlays[i]->x)) << 2);
 					dst = (uint8_t *)image->data + (y * image->bytes_per_line) + (x<<2);
 
-					for (; x < tx; x++)
+					if (tx > Console.GraphBytesPerLine)
 					{
-						if (x >= Console.GraphBytesPerLine) { break; }
-
-						if (src[3] == 0)
-						{
-							src+=4;
-							dst+=4;
-						} else if (src[3] == 255)
-						{
-							*(dst++) = *(src++);
-							*(dst++) = *(src++);
-							*(dst++) = *(src++);
-							src++;
-							dst++;
-						} else{
-							//uint8_t b = src[0];
-							//uint8_t g = src[1];
-							//uint8_t r = src[2];
-							uint8_t a = src[3];
-							uint8_t na = a ^ 0xff;
-							*dst = ((*dst * na) >> 8) + ((*src * a) >> 8); dst++; src++; // b
-							*dst = ((*dst * na) >> 8) + ((*src * a) >> 8); dst++; src++; // g
-							*dst = ((*dst * na) >> 8) + ((*src * a) >> 8); dst++; src++; // r
-							dst++;
-							src++;
-						}
+						tx = Console.GraphBytesPerLine;
+					}
+					if (x < tx)
+					{
+						blit_blend_bgra (dst, src, tx - x);
 					}
 				}
 			}